@@ -0,0 +1,471 @@
+/**
+ * @file aaa_loopback.c
+ * @brief In-process AAA server, to measure the controller without sockets.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "includes.h"
+#include "common.h"
+#include "eloop.h"
+#include "eap_server/eap.h"
+#include "eap_server/eap_methods.h"
+#include "radius/radius.h"
+#include "radius/radius_server.h"
+
+#include "aaa_loopback.h"
+#include "panautils.h"
+
+#define RING_MASK (AAA_LOOPBACK_RING - 1)
+
+struct ring_slot {
+	/**Position the slot can be written at, or 1 + the one it has been written at.*/
+	uint64_t seq;
+	uint8_t *msg;
+	size_t len;
+};
+
+/**
+ * Bounded queue of messages, many producers and one consumer. A producer
+ * takes a position with a compare and swap of the tail and publishes the
+ * message with the sequence of its slot.
+ */
+struct ring {
+	uint64_t tail __attribute__((aligned(64)));
+	uint64_t head __attribute__((aligned(64)));
+	/**The consumer has been woken up and has not emptied the queue yet.*/
+	int rung __attribute__((aligned(64)));
+	/**The producers wake up the consumer through it.*/
+	int doorbell[2];
+	struct ring_slot slots[AAA_LOOPBACK_RING];
+};
+
+/** A thread of the AAA server, with its queue of requests and its sessions.*/
+struct loopback_aaa {
+	struct ring requests;
+	/**Only used by the thread, with its own eloop.*/
+	struct radius_server_data *server;
+	unsigned int index;
+	pthread_t thread;
+	int running;
+	/**Posted when the thread has started its server, 0 in result, or failed.*/
+	sem_t started;
+	int result;
+};
+
+struct aaa_loopback {
+	struct ring answers;
+	struct loopback_aaa *aaa;
+	unsigned int threads;
+	/**The same for every thread but the sessions' identifiers.*/
+	struct radius_server_conf server_conf;
+	char *secret;
+	struct eap_method *methods;
+	int (*get_psk)(const uint8_t *identity, size_t identity_len, uint8_t *psk);
+	int has_default_psk;
+	uint8_t default_psk[AAA_LOOPBACK_PSK_LEN];
+	/**Address of the RADIUS client, the same for every request.*/
+	struct sockaddr_in client;
+	int stop;
+	struct aaa_loopback_stats stats;
+};
+
+static struct aaa_loopback *loopback = NULL;
+
+/* Queues */
+
+static void ring_init(struct ring *r) {
+	uint64_t i;
+
+	for (i = 0; i < AAA_LOOPBACK_RING; i++)
+		r->slots[i].seq = i;
+	r->doorbell[0] = r->doorbell[1] = -1;
+}
+
+static int ring_open(struct ring *r) {
+	int i;
+
+	if (pipe(r->doorbell) < 0)
+		return -1;
+	for (i = 0; i < 2; i++) {
+		fcntl(r->doorbell[i], F_SETFL, fcntl(r->doorbell[i], F_GETFL) | O_NONBLOCK);
+		fcntl(r->doorbell[i], F_SETFD, FD_CLOEXEC);
+	}
+	return 0;
+}
+
+static void ring_close(struct ring *r) {
+	uint8_t *msg;
+	uint64_t i;
+
+	for (i = 0; i < 2; i++)
+		if (r->doorbell[i] >= 0)
+			close(r->doorbell[i]);
+	for (i = r->head; i != r->tail; i++) {
+		msg = r->slots[i & RING_MASK].msg;
+		if (__atomic_load_n(&r->slots[i & RING_MASK].seq, __ATOMIC_ACQUIRE) == i + 1)
+			free(msg);
+	}
+}
+
+/* Takes the message. Any thread. */
+static int ring_push(struct ring *r, uint8_t *msg, size_t len) {
+	struct ring_slot *slot;
+	uint64_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED), seq;
+
+	for (;;) {
+		slot = &r->slots[pos & RING_MASK];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((int64_t) (seq - pos) < 0)
+			return -1;
+		else
+			pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	}
+	slot->msg = msg;
+	slot->len = len;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* The consumer only. */
+static uint8_t *ring_pop(struct ring *r, size_t *len) {
+	struct ring_slot *slot = &r->slots[r->head & RING_MASK];
+	uint8_t *msg;
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != r->head + 1)
+		return NULL;
+	msg = slot->msg;
+	*len = slot->len;
+	__atomic_store_n(&slot->seq, r->head + AAA_LOOPBACK_RING, __ATOMIC_RELEASE);
+	r->head++;
+	return msg;
+}
+
+/* After a push: the consumer is woken up once until it drains the queue.
+ * The fences pair with the ones of ring_wakeup, so either the producer sees
+ * that the consumer is not rung, or the consumer sees the message. */
+static int ring_ring(struct ring *r) {
+	char b = 0;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->rung, __ATOMIC_RELAXED) ||
+			__atomic_exchange_n(&r->rung, 1, __ATOMIC_SEQ_CST))
+		return 0;
+	if (write(r->doorbell[1], &b, 1) < 0 && errno != EAGAIN)
+		pana_error("aaa_loopback: the consumer could not be woken up");
+	return 1;
+}
+
+/* Before the consumer drains the queue. */
+static void ring_wakeup(struct ring *r) {
+	char drain[64];
+
+	while (read(r->doorbell[0], drain, sizeof(drain)) > 0)
+		;
+	__atomic_store_n(&r->rung, 0, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* AAA server, in its thread */
+
+static int loopback_get_eap_user(void *ctx, const u8 *identity, size_t identity_len,
+		int phase2, struct eap_user *user) {
+
+	uint8_t psk[AAA_LOOPBACK_PSK_LEN];
+	int found = 0;
+
+	// Any identity can start a session, EAP-PSK looks for its ID_P.
+	if (user == NULL)
+		return 0;
+
+	os_memset(user, 0, sizeof(*user));
+	user->methods[0].vendor = EAP_VENDOR_IETF;
+	user->methods[0].method = EAP_TYPE_PSK;
+	if (loopback->get_psk != NULL && loopback->get_psk(identity, identity_len, psk) == 0)
+		found = 1;
+	else if (loopback->has_default_psk) {
+		os_memcpy(psk, loopback->default_psk, sizeof(psk));
+		found = 1;
+	}
+	// Without a password the device is rejected.
+	if (found) {
+		user->password = os_malloc(sizeof(psk));
+		if (user->password == NULL)
+			return -1;
+		os_memcpy(user->password, psk, sizeof(psk));
+		user->password_len = sizeof(psk);
+	}
+	return 0;
+}
+
+static int loopback_send_reply(void *ctx, const u8 *data, size_t len,
+		const struct sockaddr *to, socklen_t tolen) {
+
+	uint8_t *msg = (uint8_t *) malloc(len);
+
+	if (msg == NULL)
+		return -1;
+	memcpy(msg, data, len);
+	if (ring_push(&loopback->answers, msg, len) < 0) {
+		free(msg);
+		__atomic_fetch_add(&loopback->stats.dropped, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	__atomic_fetch_add(&loopback->stats.answers, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* The requests of a wakeup are answered together, and the network thread
+ * is woken up once for all of them. At most a queue's worth, so that the
+ * timeouts of the sessions run under load. */
+static void loopback_receive(int sock, void *eloop_ctx, void *sock_ctx) {
+	struct loopback_aaa *aaa = (struct loopback_aaa *) eloop_ctx;
+	uint8_t *msg;
+	size_t len;
+	int n;
+
+	ring_wakeup(&aaa->requests);
+	__atomic_fetch_add(&loopback->stats.aaa_wakeups, 1, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&loopback->stop, __ATOMIC_ACQUIRE)) {
+		eloop_terminate();
+		return;
+	}
+
+	for (n = 0; n < AAA_LOOPBACK_RING; n++) {
+		msg = ring_pop(&aaa->requests, &len);
+		if (msg == NULL)
+			break;
+		radius_server_receive(aaa->server, msg, len,
+				(struct sockaddr *) &loopback->client, sizeof(loopback->client));
+		free(msg);
+	}
+	if (n > 0 && ring_ring(&loopback->answers))
+		__atomic_fetch_add(&loopback->stats.network_wakeups, 1, __ATOMIC_RELAXED);
+	if (n == AAA_LOOPBACK_RING)
+		ring_ring(&aaa->requests);
+}
+
+/* The server and the eloop of a thread are its own: they are started and
+ * stopped by it. */
+static void *loopback_thread(void *arg) {
+	struct loopback_aaa *aaa = (struct loopback_aaa *) arg;
+	struct radius_server_conf server_conf = loopback->server_conf;
+	sigset_t all;
+
+	// The signals are handled by the other threads.
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	server_conf.sess_id_offset = aaa->index;
+	server_conf.sess_id_step = loopback->threads;
+	aaa->result = -1;
+	if (eloop_init() == 0) {
+		aaa->server = radius_server_init(&server_conf);
+		if (aaa->server != NULL &&
+				eloop_register_read_sock(aaa->requests.doorbell[0], loopback_receive, aaa, NULL) == 0)
+			aaa->result = 0;
+	}
+	sem_post(&aaa->started);
+
+	if (aaa->result == 0) {
+		eloop_run();
+		eloop_unregister_read_sock(aaa->requests.doorbell[0]);
+	}
+	radius_server_deinit(aaa->server);
+	eloop_destroy();
+	wpabuf_pool_flush();
+	return NULL;
+}
+
+/* Thread of a request: the one of its session, from the State of the
+ * answers (its identifier, offset + k * threads), or any for the first
+ * request of a session, from its Request Authenticator, so that its
+ * retransmissions go to the same thread. */
+static unsigned int loopback_thread_of(const uint8_t *data, size_t len) {
+	size_t pos = 20;
+
+	if (loopback->threads == 1 || len < 20)
+		return 0;
+	while (pos + 2 <= len && data[pos + 1] >= 2 && pos + data[pos + 1] <= len) {
+		if (data[pos] == RADIUS_ATTR_STATE && data[pos + 1] == 6)
+			return WPA_GET_BE32(data + pos + 2) % loopback->threads;
+		pos += data[pos + 1];
+	}
+	return WPA_GET_BE32(data + 4) % loopback->threads;
+}
+
+/* API */
+
+int aaa_loopback_init(const struct aaa_loopback_conf *conf) {
+	struct radius_server_conf *server_conf;
+	unsigned int i, threads;
+	int max_sessions;
+
+	threads = conf->threads > 0 ? conf->threads : 1;
+	if (loopback != NULL || conf->secret == NULL || threads > AAA_LOOPBACK_MAX_THREADS)
+		return -1;
+	loopback = (struct aaa_loopback *) calloc(1, sizeof(*loopback));
+	if (loopback == NULL)
+		return -1;
+	loopback->aaa = (struct loopback_aaa *) calloc(threads, sizeof(*loopback->aaa));
+	if (loopback->aaa == NULL)
+		goto fail;
+	loopback->threads = threads;
+	ring_init(&loopback->answers);
+	for (i = 0; i < threads; i++) {
+		loopback->aaa[i].index = i;
+		ring_init(&loopback->aaa[i].requests);
+	}
+	loopback->get_psk = conf->get_psk;
+	if (conf->default_psk != NULL) {
+		memcpy(loopback->default_psk, conf->default_psk, AAA_LOOPBACK_PSK_LEN);
+		loopback->has_default_psk = 1;
+	}
+	loopback->client.sin_family = AF_INET;
+	loopback->client.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (ring_open(&loopback->answers) < 0)
+		goto fail;
+	for (i = 0; i < threads; i++)
+		if (ring_open(&loopback->aaa[i].requests) < 0)
+			goto fail;
+	if (eap_server_identity_register(&loopback->methods) < 0 ||
+			eap_server_psk_register(&loopback->methods) < 0)
+		goto fail;
+	loopback->secret = strdup(conf->secret);
+	if (loopback->secret == NULL)
+		goto fail;
+
+	// The sessions are shared out between the threads.
+	max_sessions = conf->max_sessions > 0 ? conf->max_sessions :
+			AAA_LOOPBACK_DEFAULT_SESSIONS;
+	server_conf = &loopback->server_conf;
+	server_conf->get_eap_user = loopback_get_eap_user;
+	server_conf->eap_methods = loopback->methods;
+	server_conf->shared_secret = loopback->secret;
+	server_conf->max_sessions = (max_sessions + threads - 1) / threads;
+	server_conf->completed_timeout = AAA_LOOPBACK_COMPLETED_TIMEOUT;
+	server_conf->send_reply = loopback_send_reply;
+	server_conf->session_arena = 1;
+
+	for (i = 0; i < threads; i++) {
+		struct loopback_aaa *aaa = &loopback->aaa[i];
+
+		sem_init(&aaa->started, 0, 0);
+		if (pthread_create(&aaa->thread, NULL, loopback_thread, aaa) != 0)
+			goto fail;
+		aaa->running = 1;
+		sem_wait(&aaa->started);
+		if (aaa->result < 0)
+			goto fail;
+	}
+	return 0;
+
+fail:
+	pana_error("aaa_loopback: the AAA server could not be started");
+	aaa_loopback_deinit();
+	return -1;
+}
+
+void aaa_loopback_deinit() {
+	unsigned int i;
+
+	if (loopback == NULL)
+		return;
+	__atomic_store_n(&loopback->stop, 1, __ATOMIC_RELEASE);
+	for (i = 0; loopback->aaa != NULL && i < loopback->threads; i++) {
+		struct loopback_aaa *aaa = &loopback->aaa[i];
+
+		if (aaa->running) {
+			ring_ring(&aaa->requests);
+			pthread_join(aaa->thread, NULL);
+			sem_destroy(&aaa->started);
+		}
+		ring_close(&aaa->requests);
+	}
+	eap_server_unregister_methods(&loopback->methods);
+	ring_close(&loopback->answers);
+	free(loopback->aaa);
+	free(loopback->secret);
+	free(loopback);
+	loopback = NULL;
+}
+
+int aaa_loopback_enabled() {
+	return loopback != NULL;
+}
+
+int aaa_loopback_send(void *ctx, const uint8_t *data, size_t len) {
+	uint8_t *msg = (uint8_t *) malloc(len);
+	struct ring *requests = &loopback->aaa[loopback_thread_of(data, len)].requests;
+
+	if (msg == NULL)
+		return -1;
+	memcpy(msg, data, len);
+	if (ring_push(requests, msg, len) < 0) {
+		free(msg);
+		__atomic_fetch_add(&loopback->stats.refused, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	__atomic_fetch_add(&loopback->stats.requests, 1, __ATOMIC_RELAXED);
+	ring_ring(requests);
+	return (int) len;
+}
+
+int aaa_loopback_fd_set(fd_set *rset) {
+	FD_SET(loopback->answers.doorbell[0], rset);
+	return loopback->answers.doorbell[0];
+}
+
+int aaa_loopback_process(fd_set *rset, aaa_loopback_deliver_cb deliver) {
+	uint8_t *msg;
+	size_t len;
+	int n = 0;
+
+	if (rset != NULL && !FD_ISSET(loopback->answers.doorbell[0], rset))
+		return 0;
+	ring_wakeup(&loopback->answers);
+	while ((msg = ring_pop(&loopback->answers, &len)) != NULL) {
+		deliver(msg, (int) len);
+		free(msg);
+		n++;
+	}
+	return n;
+}
+
+void aaa_loopback_get_stats(struct aaa_loopback_stats *stats) {
+	stats->requests = __atomic_load_n(&loopback->stats.requests, __ATOMIC_RELAXED);
+	stats->refused = __atomic_load_n(&loopback->stats.refused, __ATOMIC_RELAXED);
+	stats->answers = __atomic_load_n(&loopback->stats.answers, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&loopback->stats.dropped, __ATOMIC_RELAXED);
+	stats->aaa_wakeups = __atomic_load_n(&loopback->stats.aaa_wakeups, __ATOMIC_RELAXED);
+	stats->network_wakeups = __atomic_load_n(&loopback->stats.network_wakeups, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,146 @@
+/**
+ * @file aaa_loopback.h
+ * @brief Headers of the in-process AAA server, to measure the controller without sockets.
+ *
+ * In pass-through mode, the Access-Requests of the RADIUS client
+ * (radius_client.c) can be given to a RADIUS server of the same process
+ * (radius_server.c, with EAP-PSK) instead of going over the UDP socket,
+ * set as its transport with radius_client_set_transport() and
+ * aaa_loopback_send(). It is meant for benchmarks: the CPU time of the
+ * controller per authentication is measured without the kernel's network
+ * stack and without a real AAA server.
+ *
+ *  - The requests and the answers go through two bounded lock-free queues
+ *    of AAA_LOOPBACK_RING messages, without locks and without copies to
+ *    the kernel.
+ *  - The AAA server runs in its own threads, each one with its queue of
+ *    requests and its sessions, and which only sleeps when its queue is
+ *    empty: the senders write to its pipe (the doorbell) once per batch,
+ *    not once per request. A request goes to the thread of its session,
+ *    from the State attribute, the sessions of thread i are i + k * threads.
+ *  - Each thread has its own eloop (epoll) and its sessions are found by
+ *    their State in a hash table, so the cost of a request does not grow
+ *    with the number of sessions. The wpabufs of a session are taken from
+ *    its own arena, released with it (wpabuf_arena_new()).
+ *  - The answers are handled by the network thread, which waits for
+ *    aaa_loopback_fd_set() and then calls aaa_loopback_process() with the
+ *    answers' callback, as with radsec.h.
+ *
+ * The messages are signed with the secret of the RADIUS client, as over
+ * the socket, so the controller does the same work.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef AAA_LOOPBACK_H
+#define AAA_LOOPBACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/select.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Messages queued each way at most, per thread, a power of 2.*/
+#define AAA_LOOPBACK_RING 4096
+/** Max number of threads of the AAA server.*/
+#define AAA_LOOPBACK_MAX_THREADS 64
+/** Sessions kept by the AAA server by default, between all its threads.*/
+#define AAA_LOOPBACK_DEFAULT_SESSIONS 250000
+/** Seconds the finished sessions are kept, to answer the retransmissions.*/
+#define AAA_LOOPBACK_COMPLETED_TIMEOUT 1
+/** Length of the PSK of EAP-PSK.*/
+#define AAA_LOOPBACK_PSK_LEN 16
+
+/** Configuration of the AAA server.*/
+struct aaa_loopback_conf {
+	/**Shared secret of the RADIUS client.*/
+	const char *secret;
+	/**
+	 * Looks for the PSK of a device (e.g. psk_store_get), NULL if every
+	 * device has default_psk. Called from the threads of the AAA server.
+	 *
+	 * @return 0 if it has been found, -1 otherwise.
+	 */
+	int (*get_psk)(const uint8_t *identity, size_t identity_len, uint8_t *psk);
+	/**PSK of the devices get_psk does not know, NULL if they are rejected.*/
+	const uint8_t *default_psk;
+	/**0 for AAA_LOOPBACK_DEFAULT_SESSIONS.*/
+	int max_sessions;
+	/**Threads of the AAA server, 0 for 1, up to AAA_LOOPBACK_MAX_THREADS.*/
+	unsigned int threads;
+};
+
+/** Counters of the transport.*/
+struct aaa_loopback_stats {
+	/**Requests queued, and the ones refused because the queue was full.*/
+	uint64_t requests;
+	uint64_t refused;
+	/**Answers given to the network thread, and the ones lost because the queue was full.*/
+	uint64_t answers;
+	uint64_t dropped;
+	/**Times the threads of the AAA server and the network thread were woken up.*/
+	uint64_t aaa_wakeups;
+	uint64_t network_wakeups;
+};
+
+/** Called by aaa_loopback_process() with every answer.*/
+typedef void (*aaa_loopback_deliver_cb)(uint8_t *buf, int len);
+
+/**
+ * Starts the AAA server and its threads.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int aaa_loopback_init(const struct aaa_loopback_conf *conf);
+/** Stops the threads of the AAA server, the requests queued are dropped.*/
+void aaa_loopback_deinit();
+/** @return TRUE if aaa_loopback_init has been called.*/
+int aaa_loopback_enabled();
+
+/**
+ * Queues a RADIUS message for the AAA server. It has the signature of the
+ * transport of the RADIUS client, ctx is not used. Thread safe.
+ *
+ * @return len, or -1 if the queue is full.
+ */
+int aaa_loopback_send(void *ctx, const uint8_t *data, size_t len);
+
+/**
+ * Adds the descriptor the network thread must wait for.
+ *
+ * @return It.
+ */
+int aaa_loopback_fd_set(fd_set *rset);
+/**
+ * Passes the answers queued to deliver, if the descriptor is set in rset
+ * or rset is NULL.
+ *
+ * @return Number of answers.
+ */
+int aaa_loopback_process(fd_set *rset, aaa_loopback_deliver_cb deliver);
+
+void aaa_loopback_get_stats(struct aaa_loopback_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,231 @@
+/**
+ * @file bench.cpp
+ * @brief Helpers shared by the controller's microbenchmarks.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "bench.h"
+
+/* Allocation counters, updated by every thread. */
+static uint64_t bench_allocs = 0;
+static uint64_t bench_bytes = 0;
+/* TRUE once the first result has been printed. */
+static int bench_first = 1;
+/* Repetitions of bench_run. */
+static int bench_reps = 5;
+/* Where the JSON document goes, stdout unless it is silenced. */
+static FILE *bench_out = NULL;
+
+#define BENCH_OUT (bench_out != NULL ? bench_out : stdout)
+
+extern "C" {
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+void *__wrap_malloc(size_t size) {
+	__atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&bench_bytes, size, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+	__atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&bench_bytes, num * size, __ATOMIC_RELAXED);
+	return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+	__atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&bench_bytes, size, __ATOMIC_RELAXED);
+	return __real_realloc(p, size);
+}
+
+void __wrap_free(void *p) {
+	__real_free(p);
+}
+
+uint64_t bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t bench_alloc_count(void) {
+	return __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+}
+
+uint64_t bench_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return bench_now_ns();
+#endif
+}
+
+static uint64_t bench_ctxsw(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t) (ru.ru_nvcsw + ru.ru_nivcsw);
+}
+
+void bench_start(struct bench_sample *s) {
+	s->allocs = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+	s->bytes = __atomic_load_n(&bench_bytes, __ATOMIC_RELAXED);
+	s->ctxsw = bench_ctxsw();
+	s->ns = bench_now_ns();
+}
+
+void bench_stop(struct bench_sample *s) {
+	s->ns = bench_now_ns() - s->ns;
+	s->ctxsw = bench_ctxsw() - s->ctxsw;
+	s->allocs = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED) - s->allocs;
+	s->bytes = __atomic_load_n(&bench_bytes, __ATOMIC_RELAXED) - s->bytes;
+}
+
+uint64_t bench_iterations(int argc, char *argv[], uint64_t def) {
+	int i;
+	for (i = 1; i < argc - 1; i++) {
+		if (strcmp(argv[i], "-n") == 0)
+			return strtoull(argv[i + 1], NULL, 10);
+	}
+	return def;
+}
+
+void bench_init(int argc, char *argv[]) {
+	int verbose = 0;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[i], "-r") == 0 && i < argc - 1)
+			bench_reps = atoi(argv[i + 1]) > 0 ? atoi(argv[i + 1]) : 1;
+	}
+
+	if (!verbose) {
+		int null_fd = open("/dev/null", O_WRONLY);
+
+		bench_out = fdopen(dup(STDOUT_FILENO), "w");
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		close(null_fd);
+	}
+}
+
+static int bench_cmp_ns(const void *a, const void *b) {
+	const struct bench_sample *x = (const struct bench_sample *) a;
+	const struct bench_sample *y = (const struct bench_sample *) b;
+
+	return x->ns < y->ns ? -1 : x->ns > y->ns;
+}
+
+void bench_run(const char *name, uint64_t iterations, bench_fn fn, void *arg) {
+	struct bench_sample *samples = (struct bench_sample *) malloc(bench_reps * sizeof(*samples));
+	struct bench_sample *median;
+	double spread;
+	int i;
+
+	fn(arg, iterations / 10 + 1);
+
+	for (i = 0; i < bench_reps; i++) {
+		bench_start(&samples[i]);
+		fn(arg, iterations);
+		bench_stop(&samples[i]);
+	}
+
+	qsort(samples, bench_reps, sizeof(*samples), bench_cmp_ns);
+	median = &samples[bench_reps / 2];
+	spread = median->ns ? 100.0 * (double) (samples[bench_reps - 1].ns - samples[0].ns) / (double) median->ns : 0;
+
+	bench_report_extra(name, iterations, median, "spread_pct", spread);
+	free(samples);
+}
+
+void bench_begin(const char *benchmark) {
+	fprintf(BENCH_OUT, "{\"benchmark\": \"%s\", \"results\": [", benchmark);
+	bench_first = 1;
+}
+
+void bench_report_extra(const char *name, uint64_t iterations, const struct bench_sample *s,
+		const char *extra_name, double extra_value) {
+	double n = iterations ? (double) iterations : 1.0;
+
+	fprintf(BENCH_OUT, "%s\n  {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f, "
+			"\"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f, \"ctxsw_per_op\": %.3f",
+			bench_first ? "" : ",", name, (unsigned long long) iterations,
+			s->ns / n, s->allocs / n, s->bytes / n, s->ctxsw / n);
+	if (extra_name != NULL)
+		fprintf(BENCH_OUT, ", \"%s\": %.3f", extra_name, extra_value);
+	fprintf(BENCH_OUT, "}");
+	bench_first = 0;
+}
+
+void bench_report(const char *name, uint64_t iterations, const struct bench_sample *s) {
+	bench_report_extra(name, iterations, s, NULL, 0);
+}
+
+void bench_end(void) {
+	fprintf(BENCH_OUT, "\n]}\n");
+	fflush(BENCH_OUT);
+}
+
+}
+
+/* new/delete go through malloc/free so they are counted too. */
+void *operator new(size_t size) {
+	void *p = malloc(size ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	free(p);
+}
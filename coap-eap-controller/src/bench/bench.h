@@ -0,0 +1,105 @@
+/**
+ * @file bench.h
+ * @brief Helpers shared by the controller's microbenchmarks.
+ *
+ * Every benchmark prints its results as a JSON document in stdout:
+ *
+ *   {"benchmark": "<name>", "results": [
+ *     {"name": "...", "iterations": N, "ns_per_op": ..., "allocs_per_op": ...,
+ *      "bytes_per_op": ..., "ctxsw_per_op": ...}, ...]}
+ *
+ * Allocations are counted by wrapping malloc/calloc/realloc/free at link
+ * time (see Makefile) and by replacing the global operator new/delete.
+ *
+ * Results measured with bench_run are the median of several repetitions
+ * (-r, 5 by default) after a warm-up run, "spread_pct" is the difference
+ * between the slowest and the fastest repetition relative to the median.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Counters taken at the start of a measure, deltas once it is stopped.*/
+struct bench_sample {
+	uint64_t ns;      /**< Elapsed wall-clock time.*/
+	uint64_t allocs;  /**< Number of allocations.*/
+	uint64_t bytes;   /**< Bytes requested.*/
+	uint64_t ctxsw;   /**< Voluntary and involuntary context switches.*/
+};
+
+/** Monotonic time in nanoseconds.*/
+uint64_t bench_now_ns(void);
+
+/** Allocations since the start of the program.*/
+uint64_t bench_alloc_count(void);
+/** Time stamp counter (TSC ticks) on x86, nanoseconds elsewhere.*/
+uint64_t bench_cycles(void);
+
+/** Starts a measure.*/
+void bench_start(struct bench_sample *s);
+/** Stops a measure, s holds the deltas since bench_start.*/
+void bench_stop(struct bench_sample *s);
+
+/**
+ * Number of iterations requested with -n, or def if it was not given.
+ */
+uint64_t bench_iterations(int argc, char *argv[], uint64_t def);
+
+/**
+ * Parses -r (repetitions of bench_run) and -v. The controller and the EAP
+ * library print every message they handle in stdout and stderr: unless -v
+ * is given they are sent to /dev/null and only the JSON document is
+ * printed. Call it before anything else.
+ */
+void bench_init(int argc, char *argv[]);
+
+/** Runs iterations operations, it is given the number of iterations.*/
+typedef void (*bench_fn)(void *arg, uint64_t iterations);
+
+/**
+ * Runs fn once to warm up and then the number of repetitions requested,
+ * the repetition with the median time is reported.
+ */
+void bench_run(const char *name, uint64_t iterations, bench_fn fn, void *arg);
+
+/** Opens the JSON document of the benchmark.*/
+void bench_begin(const char *benchmark);
+/** Adds a result to the JSON document.*/
+void bench_report(const char *name, uint64_t iterations, const struct bench_sample *s);
+/** Adds a result with an extra numeric field (e.g. hit rate, throughput).*/
+void bench_report_extra(const char *name, uint64_t iterations, const struct bench_sample *s,
+		const char *extra_name, double extra_value);
+/** Closes the JSON document.*/
+void bench_end(void);
+
+/** Prevents the compiler from removing a computation.*/
+#define BENCH_KEEP(x) __asm__ __volatile__("" : : "g"(x) : "memory")
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
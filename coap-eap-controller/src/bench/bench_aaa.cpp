@@ -0,0 +1,311 @@
+/**
+ * @file bench_aaa.cpp
+ * @brief Authentications per second of the AAA server of AAA_LOOPBACK.
+ *
+ * Full EAP-PSK authentications against the RADIUS server of the
+ * controller's AAA_LOOPBACK (aaa_loopback.h), driven without the
+ * authenticator: the Access-Requests are built here, with the EAP
+ * responses of the peers of bench_eap_peer.cpp, and given to
+ * aaa_loopback_send(), and the answers are taken from its queue.
+ *
+ * S sessions are in progress at the same time (1, 100, 1000 and 10000),
+ * every one with its own peer, and they take turns: a session sends its
+ * next request once the ones of the others before it have been sent, at
+ * most WINDOW of them waiting for their answer. With S sessions the
+ * server holds S sessions in progress, and those finished within
+ * AAA_LOOPBACK_COMPLETED_TIMEOUT, so the cost of finding a session by its
+ * State (and of its timeouts) can be seen to not grow with S.
+ *
+ *  - sessions_<S>: the extra field is the number of authentications per
+ *    second.
+ *  - sessions_<S>_cpu: the CPU time of the threads of the AAA server, the
+ *    CPU time of the process but the one of this thread, the extra field
+ *    is the microseconds per authentication.
+ *
+ * -t sets the threads of the AAA server (1 by default). On a machine with
+ * fewer CPUs than threads + 1 the authentications per second do not grow
+ * with them, the CPU time per authentication is still meaningful.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/select.h>
+
+extern "C" {
+#include "includes.h"
+#include "common.h"
+#include "eap_common/eap_defs.h"
+#include "radius/radius.h"
+#include "../aaa_loopback.h"
+}
+
+#include "bench.h"
+#include "bench_eap.h"
+
+#define SECRET "testing123"
+#define SECRET_LEN 10
+#define PSK "0123456789abcdef"
+/** Requests waiting for their answer at most, below AAA_LOOPBACK_RING.*/
+#define WINDOW 1024
+#define MAX_STATE_LEN 64
+
+/** A session in progress, the answers find it by its Proxy-State.*/
+struct session {
+	struct eap_peer_ctx *peer;
+	char identity[32];
+	u8 state[MAX_STATE_LEN];
+	size_t state_len;
+	/**Identifier of the last EAP request given to the peer.*/
+	u8 last_id;
+	/**Next session to send a request.*/
+	struct session *next;
+};
+
+struct driver {
+	struct session *sessions;
+	uint64_t count;
+	/**Sessions with a request to send, in turn.*/
+	struct session *head;
+	struct session *tail;
+	/**EAP response of every session of the queue, sent when its turn comes.*/
+	struct wpabuf **responses;
+	uint64_t in_flight;
+	/**Authentications started and finished.*/
+	uint64_t started;
+	uint64_t finished;
+	uint64_t target;
+	u8 identifier;
+};
+
+static struct driver driver;
+
+static void queue_response(struct session *s, const uint8_t *eap, size_t len) {
+	struct wpabuf *resp = wpabuf_alloc_copy(eap, len);
+
+	if (resp == NULL)
+		abort();
+	driver.responses[s - driver.sessions] = resp;
+	s->next = NULL;
+	if (driver.tail != NULL)
+		driver.tail->next = s;
+	else
+		driver.head = s;
+	driver.tail = s;
+}
+
+/* A new authentication of a session: the peer answers the Request/Identity
+ * of the controller, and its Response/Identity starts the session of the
+ * server, whose first request has the next identifier. The identifier is
+ * far from the last one of the peer, which would take it as a
+ * retransmission. */
+static void start(struct session *s) {
+	uint8_t req_identity[5] = {EAP_CODE_REQUEST, 0, 0, 5, EAP_TYPE_IDENTITY};
+	const uint8_t *resp;
+	size_t resp_len;
+
+	req_identity[1] = s->last_id = (u8) (s->last_id + 128);
+	if (bench_peer_process(s->peer, req_identity, sizeof(req_identity), &resp, &resp_len) <= 0)
+		abort();
+	s->state_len = 0;
+	driver.started++;
+	queue_response(s, resp, resp_len);
+}
+
+/* The Access-Request of a session, signed as by the RADIUS client. */
+static void send_request(struct session *s) {
+	struct wpabuf *resp = driver.responses[s - driver.sessions];
+	u8 index[4];
+	u8 identifier = driver.identifier++;
+	struct radius_msg *msg = radius_msg_new(RADIUS_CODE_ACCESS_REQUEST, identifier);
+	struct wpabuf *buf;
+
+	WPA_PUT_BE32(index, (u32) (s - driver.sessions));
+	radius_msg_make_authenticator(msg, (u8 *) &driver.started, sizeof(driver.started));
+	if (!radius_msg_add_attr(msg, RADIUS_ATTR_USER_NAME, (u8 *) s->identity, strlen(s->identity)) ||
+			!radius_msg_add_eap(msg, wpabuf_head_u8(resp), wpabuf_len(resp)) ||
+			(s->state_len > 0 &&
+			 !radius_msg_add_attr(msg, RADIUS_ATTR_STATE, s->state, s->state_len)) ||
+			!radius_msg_add_attr(msg, RADIUS_ATTR_PROXY_STATE, index, sizeof(index)))
+		abort();
+	if (radius_msg_finish(msg, (u8 *) SECRET, SECRET_LEN) < 0)
+		abort();
+	buf = radius_msg_get_buf(msg);
+	if (aaa_loopback_send(NULL, wpabuf_head_u8(buf), wpabuf_len(buf)) < 0)
+		abort();
+	radius_msg_free(msg);
+	wpabuf_free(resp);
+	driver.responses[s - driver.sessions] = NULL;
+	driver.in_flight++;
+}
+
+static void send_requests(void) {
+	struct session *s;
+
+	while (driver.head != NULL && driver.in_flight < WINDOW) {
+		s = driver.head;
+		driver.head = s->next;
+		if (driver.head == NULL)
+			driver.tail = NULL;
+		send_request(s);
+	}
+}
+
+/* The answer of a request: its EAP request goes to the peer, and its
+ * response is queued, or the session starts again if it has finished. */
+static void deliver(uint8_t *buf, int len) {
+	struct radius_msg *msg = radius_msg_parse(buf, (size_t) len);
+	struct session *s;
+	const uint8_t *resp;
+	size_t resp_len, eap_len;
+	u8 index[4], *eap;
+	int res;
+
+	if (msg == NULL || radius_msg_get_attr(msg, RADIUS_ATTR_PROXY_STATE, index, sizeof(index)) != 4)
+		abort();
+	s = &driver.sessions[WPA_GET_BE32(index)];
+	driver.in_flight--;
+	eap = radius_msg_get_eap(msg, &eap_len);
+	if (eap == NULL)
+		abort();
+	s->last_id = eap[1];
+	res = bench_peer_process(s->peer, eap, eap_len, &resp, &resp_len);
+	os_free(eap);
+
+	switch (radius_msg_get_hdr(msg)->code) {
+	case RADIUS_CODE_ACCESS_CHALLENGE:
+		res = res > 0 ? radius_msg_get_attr(msg, RADIUS_ATTR_STATE, s->state, sizeof(s->state)) : -1;
+		if (res < 0)
+			abort();
+		s->state_len = (size_t) res;
+		queue_response(s, resp, resp_len);
+		break;
+	case RADIUS_CODE_ACCESS_ACCEPT:
+		bench_peer_restart(s->peer);
+		driver.finished++;
+		if (driver.started < driver.target)
+			start(s);
+		break;
+	default:
+		abort();
+	}
+	radius_msg_free(msg);
+}
+
+/* n authentications with the sessions of the driver. */
+static void run(uint64_t n) {
+	struct pollfd pfd;
+	fd_set rset;
+	uint64_t i;
+
+	FD_ZERO(&rset);
+	pfd.fd = aaa_loopback_fd_set(&rset);
+	pfd.events = POLLIN;
+	driver.started = driver.finished = 0;
+	driver.target = n;
+	for (i = 0; i < driver.count && i < n; i++)
+		start(&driver.sessions[i]);
+	while (driver.finished < n) {
+		send_requests();
+		if (poll(&pfd, 1, 1000) <= 0)
+			abort();
+		aaa_loopback_process(NULL, deliver);
+	}
+}
+
+static uint64_t cpu_ns(clockid_t clock) {
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void run_sessions(uint64_t count, uint64_t n) {
+	struct bench_sample sample, cpu;
+	uint64_t i, process, thread;
+	char name[64];
+
+	driver.sessions = (struct session *) calloc(count, sizeof(*driver.sessions));
+	driver.responses = (struct wpabuf **) calloc(count, sizeof(*driver.responses));
+	driver.count = count;
+	for (i = 0; i < count; i++) {
+		struct session *s = &driver.sessions[i];
+
+		snprintf(s->identity, sizeof(s->identity), "device%05llu", (unsigned long long) i);
+		s->peer = bench_peer_new(s->identity, PSK);
+		if (s->peer == NULL)
+			abort();
+	}
+
+	// Warm up, the sessions of the server are those of the measure.
+	run(count > n / 10 ? count : n / 10 + 1);
+	process = cpu_ns(CLOCK_PROCESS_CPUTIME_ID);
+	thread = cpu_ns(CLOCK_THREAD_CPUTIME_ID);
+	bench_start(&sample);
+	run(n);
+	bench_stop(&sample);
+	cpu = sample;
+	cpu.ns = (cpu_ns(CLOCK_PROCESS_CPUTIME_ID) - process) - (cpu_ns(CLOCK_THREAD_CPUTIME_ID) - thread);
+
+	snprintf(name, sizeof(name), "sessions_%llu", (unsigned long long) count);
+	bench_report_extra(name, n, &sample, "auth_per_s",
+			sample.ns > 0 ? (double) n * 1e9 / (double) sample.ns : 0);
+	snprintf(name, sizeof(name), "sessions_%llu_cpu", (unsigned long long) count);
+	bench_report_extra(name, n, &cpu, "cpu_us_per_auth", (double) cpu.ns / 1e3 / (double) n);
+
+	for (i = 0; i < count; i++)
+		bench_peer_free(driver.sessions[i].peer);
+	free(driver.sessions);
+	free(driver.responses);
+	memset(&driver, 0, sizeof(driver));
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 20000);
+	const uint64_t levels[] = {1, 100, 1000, 10000};
+	struct aaa_loopback_conf conf;
+	unsigned int threads = 1;
+	size_t i;
+	int opt;
+
+	bench_init(argc, argv);
+	for (opt = 1; opt < argc - 1; opt++)
+		if (strcmp(argv[opt], "-t") == 0)
+			threads = (unsigned int) atoi(argv[opt + 1]);
+
+	memset(&conf, 0, sizeof(conf));
+	conf.secret = SECRET;
+	conf.default_psk = (const uint8_t *) PSK;
+	conf.threads = threads;
+	if (aaa_loopback_init(&conf) < 0) {
+		fprintf(stderr, "cannot start the AAA server\n");
+		return 1;
+	}
+
+	bench_begin("aaa");
+	for (i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+		run_sessions(levels[i], n);
+	bench_end();
+
+	aaa_loopback_deinit();
+	return 0;
+}
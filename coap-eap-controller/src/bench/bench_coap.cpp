@@ -0,0 +1,243 @@
+/**
+ * @file bench_coap.cpp
+ * @brief Cost of the CoAP messages handled per step of a session.
+ *
+ * Measures, with the messages of an EAP-PSK bootstrap:
+ *
+ *  - parse: an ACK of a device is wrapped and validated, and the token,
+ *    the Location-Path and the payload are read, as in
+ *    process_coap_datagram, update_location and process_eap_response.
+ *    The options are read from the index built by validate, it should
+ *    not allocate memory.
+ *  - parse_options: the same with a message with more options than fit
+ *    in the index, they are walked on every access.
+ *  - build_post: a POST with an EAP request is built in an InlineCoapPDU
+ *    as in process_radius_answer.
+ *  - build_post_oscore: the last POST, with the OSCORE option.
+ *  - build_post_heap: build_post with a CoapPDU that allocates its
+ *    buffer, as it was built before.
+ *  - template_build: the template of the POSTs of a session is built,
+ *    once per session and location.
+ *  - template_post: a POST is made from the template, only the message
+ *    id is patched (send_post).
+ *  - cbor_encode: the CBOR of the first POST with every field of its
+ *    schema (cipher suites, recipient ID and lifetime) is serialized.
+ *  - cbor_decode: the same CBOR is parsed in place.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../cantcoap-master/cantcoap.h"
+#include "../coap_template.h"
+#include "../coap_eap_cbor.h"
+#include "bench.h"
+
+#define BUF_LEN 500
+/** Sizes of EAP-PSK-2 (sent by the device) and EAP-PSK-3.*/
+#define EAP_RESPONSE_LEN 59
+#define EAP_REQUEST_LEN 59
+
+/** An ACK and its length.*/
+struct ack_msg {
+	uint8_t buf[BUF_LEN];
+	int len;
+};
+
+static struct ack_msg plain_ack;
+static struct ack_msg options_ack;
+static uint8_t eap_request[EAP_REQUEST_LEN];
+
+static void build_ack(struct ack_msg *msg, int extra_options) {
+	uint8_t eap_response[EAP_RESPONSE_LEN];
+	uint32_t token = 0x12345678;
+	CoapPDU ack(msg->buf, BUF_LEN, 0);
+	int i;
+
+	memset(eap_response, 0x2f, sizeof(eap_response));
+	eap_response[0] = 2;
+	eap_response[2] = 0;
+	eap_response[3] = EAP_RESPONSE_LEN;
+
+	ack.setVersion(1);
+	ack.setType(CoapPDU::COAP_ACKNOWLEDGEMENT);
+	ack.setCode(CoapPDU::COAP_CHANGED);
+	ack.setMessageID(0x1234);
+	ack.setToken((uint8_t *) &token, sizeof(token));
+	ack.addOption(CoapPDU::COAP_OPTION_LOCATION_PATH, 1, (uint8_t *) "a");
+	for (i = 0; i < extra_options; i++)
+		ack.addOption(CoapPDU::COAP_OPTION_LOCATION_QUERY, 1, (uint8_t *) "q");
+	ack.setPayload(eap_response, sizeof(eap_response));
+	msg->len = ack.getPDULength();
+}
+
+static void run_parse(void *arg, uint64_t n) {
+	struct ack_msg *msg = (struct ack_msg *) arg;
+	uint8_t buf[BUF_LEN];
+	char uri[30];
+	int uri_len;
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		// The datagram is received in the buffer of the network thread.
+		memcpy(buf, msg->buf, (size_t) msg->len);
+
+		CoapPDU recvPDU(buf, msg->len, msg->len);
+		if (recvPDU.validate() != 1 || recvPDU.getType() != CoapPDU::COAP_ACKNOWLEDGEMENT)
+			abort();
+
+		uint32_t session_id;
+		memcpy(&session_id, recvPDU.getTokenPointer(), sizeof(session_id));
+		recvPDU.getLocation(uri, sizeof(uri), &uri_len);
+		BENCH_KEEP(recvPDU.getOptionPointer(CoapPDU::COAP_OPTION_AUTH));
+		BENCH_KEEP(recvPDU.getPayloadPointer());
+		BENCH_KEEP(session_id);
+	}
+}
+
+static void build_post(CoapPDU *post, int oscore, uint16_t message_id) {
+	uint32_t session_id = 0x12345678;
+
+	post->setVersion(1);
+	post->setMessageID(message_id);
+	post->setToken((uint8_t *) &session_id, 4);
+	post->setCode(CoapPDU::COAP_POST);
+	post->setType(CoapPDU::COAP_CONFIRMABLE);
+	post->setURI((char *) "/a", 2);
+
+	if (oscore) {
+		unsigned char oscore_option[2] = {0x09, 0x00};
+		post->addOption(CoapPDU::COAP_OPTION_OSCORE, 2, oscore_option);
+		post->setPayload(eap_request, 22);
+	}
+	else
+		post->setPayload(eap_request, sizeof(eap_request));
+
+	BENCH_KEEP(post->getPDUPointer());
+}
+
+static void run_build_post(void *arg, uint64_t n) {
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		InlineCoapPDU<BUF_LEN> post;
+		build_post(&post, arg != NULL, (uint16_t) i);
+	}
+}
+
+static void run_build_post_heap(void *arg, uint64_t n) {
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		CoapPDU *post = new CoapPDU();
+		build_post(post, 0, (uint16_t) i);
+		delete post;
+	}
+}
+
+static void run_template_build(void *arg, uint64_t n) {
+	struct coap_template t;
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		if (coap_template_build(&t, 0x12345678, "/a", 0) < 0)
+			abort();
+		BENCH_KEEP(t.len);
+	}
+}
+
+static void run_template_post(void *arg, uint64_t n) {
+	struct coap_template t;
+	struct iovec iov[COAP_TEMPLATE_IOV];
+	uint64_t i;
+
+	if (coap_template_build(&t, 0x12345678, "/a", 0) < 0)
+		abort();
+	for (i = 0; i < n; i++) {
+		coap_template_iov(&t, (uint16_t) i, eap_request, sizeof(eap_request), NULL, 0, iov);
+		BENCH_KEEP(iov);
+	}
+}
+
+static void fill_cbor(struct coap_eap_cbor *cbor) {
+	static const uint8_t recipient_id[] = {0x01, 0x02, 0x03, 0x04};
+
+	memset(cbor, 0, sizeof(*cbor));
+	cbor->present = COAP_EAP_CBOR_CIPHER_SUITES | COAP_EAP_CBOR_RECIPIENT_ID | COAP_EAP_CBOR_LIFETIME;
+	cbor->n_cipher_suites = 3;
+	cbor->cipher_suites[1] = 1;
+	cbor->cipher_suites[2] = 2;
+	cbor->recipient_id = recipient_id;
+	cbor->recipient_id_len = sizeof(recipient_id);
+	cbor->lifetime = 28800;
+}
+
+static void run_cbor_encode(void *arg, uint64_t n) {
+	struct coap_eap_cbor cbor;
+	uint8_t buf[COAP_EAP_CBOR_MAX_LEN];
+	uint64_t i;
+
+	fill_cbor(&cbor);
+	for (i = 0; i < n; i++) {
+		cbor.lifetime = (uint32_t) i;
+		if (coap_eap_cbor_encode(&coap_eap_cbor_request, &cbor, buf, sizeof(buf)) < 0)
+			abort();
+		BENCH_KEEP(buf);
+	}
+}
+
+static void run_cbor_decode(void *arg, uint64_t n) {
+	struct coap_eap_cbor cbor;
+	uint8_t buf[COAP_EAP_CBOR_MAX_LEN];
+	int len;
+	uint64_t i;
+
+	fill_cbor(&cbor);
+	len = coap_eap_cbor_encode(&coap_eap_cbor_request, &cbor, buf, sizeof(buf));
+	for (i = 0; i < n; i++) {
+		if (coap_eap_cbor_decode(&coap_eap_cbor_request, buf, (size_t) len, &cbor) < 0 ||
+				cbor.lifetime != 28800)
+			abort();
+		BENCH_KEEP(&cbor);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 1000000);
+
+	bench_init(argc, argv);
+	build_ack(&plain_ack, 0);
+	build_ack(&options_ack, COAP_OPTION_INDEX_LENGTH);
+	memset(eap_request, 0x2f, sizeof(eap_request));
+
+	bench_begin("coap");
+	bench_run("parse", n, run_parse, &plain_ack);
+	bench_run("parse_options", n, run_parse, &options_ack);
+	bench_run("build_post", n, run_build_post, NULL);
+	bench_run("build_post_oscore", n, run_build_post, (void *) 1);
+	bench_run("build_post_heap", n, run_build_post_heap, NULL);
+	bench_run("template_build", n, run_template_build, NULL);
+	bench_run("template_post", n, run_template_post, NULL);
+	bench_run("cbor_encode", n, run_cbor_encode, NULL);
+	bench_run("cbor_decode", n, run_cbor_decode, NULL);
+	bench_end();
+
+	return 0;
+}
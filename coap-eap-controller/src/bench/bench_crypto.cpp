@@ -0,0 +1,232 @@
+/**
+ * @file bench_crypto.cpp
+ * @brief Cost of the controller's own cryptographic primitives.
+ *
+ * Measures:
+ *
+ *  - omac: AES-CMAC of a CoAP message (do_omac), as in check_mac.
+ *  - eax_64, eax_256: AES-EAX of 64 and 256 bytes with an 8 byte header
+ *    (do_eax).
+ *  - prf_plus: 80 bytes of keying material derived from a 64 byte MSK
+ *    (PRF_plus with HMAC-SHA1, 4 iterations).
+ *
+ * And the SHA-1 and SHA-256 of the EAP library (sha1-internal.c,
+ * sha256-internal.c) with every backend: "scalar", the portable code, and
+ * "shani", the x86 SHA extensions (sha_x86.c), if the CPU has them.
+ *
+ *  - sha1_<len>_<backend>, sha256_<len>_<backend>: hash of len bytes, the
+ *    extra field is cycles_per_byte (TSC ticks).
+ *  - sha1_prf_<backend>, sha256_prf_<backend>: 64 bytes derived from a 64
+ *    byte key (as the MSK of EAP-PEAP and the rRK of ERP), the extra field
+ *    is kdf_per_s.
+ *  - pbkdf2_sha1_<backend>: PBKDF2 with 4096 iterations, n / 1000 times.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+extern "C" {
+#include "includes.h"
+#include "common.h"
+#include "crypto/crypto.h"
+#include "crypto/sha1.h"
+#include "crypto/sha256.h"
+#include "crypto/sha_x86.h"
+#include "../eax.h"
+#include "../prf_plus.h"
+}
+
+#include "bench.h"
+
+/** Size of a POST with an EAP-PSK request.*/
+#define PDU_LEN 120
+#define MSK_LEN 64
+#define PRF_ITERATIONS 4
+#define KDF_LEN 64
+#define PBKDF2_ITERATIONS 4096
+
+static uint8_t key[16];
+static uint8_t nonce[NONCE_SIZE];
+static uint8_t header[HEADER_SIZE];
+static uint8_t data[256];
+static uint8_t msk[MSK_LEN];
+static uint8_t large[1024];
+
+static void run_omac(void *arg, uint64_t n) {
+	uint8_t mac[16];
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		data[0] = (uint8_t) i;
+		do_omac(key, data, PDU_LEN, mac);
+		BENCH_KEEP(mac[0]);
+	}
+}
+
+static void run_eax(void *arg, uint64_t n) {
+	int len = (int) (uintptr_t) arg;
+	uint8_t ciphered[256];
+	uint8_t tag[TAG_SIZE];
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		nonce[0] = (uint8_t) i;
+		do_eax(key, nonce, data, len, header, HEADER_SIZE, ciphered, tag, TAG_SIZE);
+		BENCH_KEEP(tag[0]);
+	}
+}
+
+static void run_prf_plus(void *arg, uint64_t n) {
+	u8 sequence[] = "IETF COAP AUTH\x12\x34\x56\x78";
+	u8 result[20 * PRF_ITERATIONS];
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		sequence[0] = (u8) i;
+		PRF_plus(PRF_ITERATIONS, msk, MSK_LEN, sequence, sizeof(sequence) - 1, result);
+		BENCH_KEEP(result[0]);
+	}
+}
+
+static void run_sha1(void *arg, uint64_t n) {
+	const u8 *addr[1] = {large};
+	size_t len = (size_t) (uintptr_t) arg;
+	u8 mac[SHA1_MAC_LEN];
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		large[0] = (u8) i;
+		sha1_vector(1, addr, &len, mac);
+		BENCH_KEEP(mac[0]);
+	}
+}
+
+static void run_sha256(void *arg, uint64_t n) {
+	const u8 *addr[1] = {large};
+	size_t len = (size_t) (uintptr_t) arg;
+	u8 mac[SHA256_MAC_LEN];
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		large[0] = (u8) i;
+		sha256_vector(1, addr, &len, mac);
+		BENCH_KEEP(mac[0]);
+	}
+}
+
+static void run_sha1_prf(void *arg, uint64_t n) {
+	u8 result[KDF_LEN];
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		msk[0] = (u8) i;
+		sha1_prf(msk, MSK_LEN, "client EAP encryption", data, 64, result, sizeof(result));
+		BENCH_KEEP(result[0]);
+	}
+}
+
+static void run_sha256_prf(void *arg, uint64_t n) {
+	u8 result[KDF_LEN];
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		msk[0] = (u8) i;
+		sha256_prf(msk, MSK_LEN, "EAP Re-authentication Root Key", data, 64, result, sizeof(result));
+		BENCH_KEEP(result[0]);
+	}
+}
+
+static void run_pbkdf2(void *arg, uint64_t n) {
+	u8 result[32];
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		pbkdf2_sha1("0123456789abcdef", "coap-eap", 8, PBKDF2_ITERATIONS, result, sizeof(result));
+		BENCH_KEEP(result[0]);
+	}
+}
+
+/* Once to warm up and once measured, with its TSC ticks. */
+static void measure(struct bench_sample *s, uint64_t *cycles, uint64_t n, bench_fn fn, void *arg) {
+	fn(arg, n / 10 + 1);
+	bench_start(s);
+	*cycles = bench_cycles();
+	fn(arg, n);
+	*cycles = bench_cycles() - *cycles;
+	bench_stop(s);
+}
+
+static void run_hash(const char *alg, size_t len, const char *backend, uint64_t n, bench_fn fn) {
+	struct bench_sample s;
+	uint64_t cycles;
+	char name[64];
+
+	measure(&s, &cycles, n, fn, (void *) (uintptr_t) len);
+	snprintf(name, sizeof(name), "%s_%u_%s", alg, (unsigned int) len, backend);
+	bench_report_extra(name, n, &s, "cycles_per_byte", (double) cycles / (double) (n * len));
+}
+
+static void run_kdf(const char *alg, const char *backend, uint64_t n, bench_fn fn) {
+	struct bench_sample s;
+	uint64_t cycles;
+	char name[64];
+
+	if (n == 0)
+		n = 1;
+	measure(&s, &cycles, n, fn, NULL);
+	snprintf(name, sizeof(name), "%s_%s", alg, backend);
+	bench_report_extra(name, n, &s, "kdf_per_s", s.ns > 0 ? (double) n * 1e9 / (double) s.ns : 0);
+}
+
+static void run_backend(const char *backend, uint64_t n) {
+	run_hash("sha1", 64, backend, n, run_sha1);
+	run_hash("sha1", sizeof(large), backend, n / 4, run_sha1);
+	run_hash("sha256", 64, backend, n, run_sha256);
+	run_hash("sha256", sizeof(large), backend, n / 4, run_sha256);
+	run_kdf("sha1_prf", backend, n / 4, run_sha1_prf);
+	run_kdf("sha256_prf", backend, n / 4, run_sha256_prf);
+	run_kdf("pbkdf2_sha1", backend, n / 1000, run_pbkdf2);
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 200000);
+
+	bench_init(argc, argv);
+
+	memset(key, 0x4b, sizeof(key));
+	memset(nonce, 0x4e, sizeof(nonce));
+	memset(header, 0x48, sizeof(header));
+	memset(data, 0x44, sizeof(data));
+	memset(msk, 0x4d, sizeof(msk));
+	memset(large, 0x4c, sizeof(large));
+
+	bench_begin("crypto");
+	bench_run("omac", n, run_omac, NULL);
+	bench_run("eax_64", n, run_eax, (void *) 64);
+	bench_run("eax_256", n, run_eax, (void *) 256);
+	bench_run("prf_plus", n, run_prf_plus, NULL);
+
+	sha_x86_enable(0);
+	run_backend("scalar", n);
+	if (sha_x86_enable(1))
+		run_backend("shani", n);
+	bench_end();
+
+	return 0;
+}
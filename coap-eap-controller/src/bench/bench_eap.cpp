@@ -0,0 +1,297 @@
+/**
+ * @file bench_eap.cpp
+ * @brief Cost of the EAP state machines of a bootstrap.
+ *
+ * Measures:
+ *
+ *  - auth_identity: the EAP authenticator of a new session is created
+ *    (eap_auth_init), sends the Request/Identity and passes the
+ *    Response/Identity through to the AAA server. That is two steps of
+ *    eap_auth_step, the second one builds and sends the Access-Request to
+ *    a local socket. As in the controller, the authenticators are not
+ *    released: they stay in the list of the RADIUS client.
+ *  - psk_exchange: a full EAP-PSK authentication between an EAP server
+ *    with EAP-PSK, as the one of the AAA server, and a peer, as the one of
+ *    the devices. Both are restarted after every exchange.
+ *  - psk_server: the part of psk_exchange spent in eap_server_sm_step, in
+ *    the last repetition (only the time is measured).
+ *  - psk2_server, psk4_server: the same, per message: the step of the EAP
+ *    server that processes PSK-2 (and builds PSK-3), and the one that
+ *    processes PSK-4 (and builds the EAP-Success). cycles_per_op are TSC
+ *    ticks.
+ *  - psk_exchange_heap: psk_exchange with the wpabufs taken from the heap
+ *    instead of the free lists of the thread (wpabuf_pool_enable(0)).
+ *  - psk_exchange_cached, psk2_server_cached, psk4_server_cached: the
+ *    same, with the AK and KDK given already derived by the credential
+ *    store, as in the standalone mode of the controller.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+extern "C" {
+#include "../libeapstack/eap_auth_interface.h"
+#include "eap_server/eap_methods.h"
+#include "eap_common/eap_psk_common.h"
+}
+
+#include "bench.h"
+#include "bench_eap.h"
+
+#define SECRET "testing123"
+#define IDENTITY "alpha.t.eu.org"
+#define PSK "0123456789abcdef"
+/** The Access-Requests are drained every DRAIN_EVERY iterations.*/
+#define DRAIN_EVERY 64
+#define DRAIN_BUF_LEN 4096
+
+/** The EAP server of EAP-PSK and its peer.*/
+struct psk_pair {
+	struct eap_sm *server;
+	struct eap_eapol_interface *server_if;
+	struct eap_method *methods;
+	struct eap_peer_ctx *peer;
+	uint64_t server_ns;
+	/** Server side of every response: Identity, PSK-2 and PSK-4.*/
+	struct bench_sample msgs[3];
+	uint64_t msg_cycles[3];
+	/** Keys of the credential store, for the cached runs.*/
+	struct eap_psk_keys keys;
+};
+
+static int aaa_sock = -1;
+
+static void drain_aaa(void) {
+	uint8_t buf[DRAIN_BUF_LEN];
+
+	while (recv(aaa_sock, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		;
+}
+
+/* The AAA server is a socket that nobody answers. */
+static int init_controller(void) {
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+
+	aaa_sock = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (aaa_sock < 0 || bind(aaa_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+			getsockname(aaa_sock, (struct sockaddr *) &addr, &addr_len) < 0)
+		return -1;
+
+	if (rad_client_init((char *) "127.0.0.1", ntohs(addr.sin_port), (char *) SECRET) == NULL)
+		return -1;
+	return 0;
+}
+
+static void run_auth_identity(void *arg, uint64_t n) {
+	u8 identity[5 + sizeof(IDENTITY) - 1];
+	uint64_t i;
+
+	identity[0] = EAP_CODE_RESPONSE;
+	WPA_PUT_BE16(&identity[2], sizeof(identity));
+	identity[4] = EAP_TYPE_IDENTITY;
+	memcpy(&identity[5], IDENTITY, sizeof(IDENTITY) - 1);
+
+	for (i = 0; i < n; i++) {
+		struct eap_auth_ctx *eap_ctx = (struct eap_auth_ctx *) malloc(sizeof(*eap_ctx));
+
+		if (eap_auth_init(eap_ctx, NULL, NULL, NULL, NULL) < 0)
+			abort();
+		eap_auth_step(eap_ctx);
+		if (!eap_auth_get_eapReq(eap_ctx))
+			abort();
+		eap_auth_set_eapReq(eap_ctx, FALSE);
+
+		identity[1] = wpabuf_head_u8(eap_auth_get_eapReqData(eap_ctx))[1];
+		eap_auth_set_eapRespData(eap_ctx, identity, sizeof(identity));
+		eap_auth_set_eapResp(eap_ctx, TRUE);
+		eap_auth_step(eap_ctx);
+		if (eap_ctx->radius_identifier < 0)
+			abort();
+
+		if (i % DRAIN_EVERY == DRAIN_EVERY - 1)
+			drain_aaa();
+	}
+	drain_aaa();
+}
+
+/* Every identity is a user of EAP-PSK with the same key, as in the simulation. */
+static int psk_get_eap_user(void *ctx, const u8 *identity, size_t identity_len,
+		int phase2, struct eap_user *user) {
+
+	os_memset(user, 0, sizeof(*user));
+	user->methods[0].vendor = EAP_VENDOR_IETF;
+	user->methods[0].method = EAP_TYPE_PSK;
+	user->password = (u8 *) os_strdup(PSK);
+	user->password_len = os_strlen(PSK);
+	return 0;
+}
+
+static const char *psk_get_eap_req_id_text(void *ctx, size_t *len) {
+	*len = 0;
+	return NULL;
+}
+
+static int psk_get_eap_psk_keys(void *ctx, const u8 *identity, size_t identity_len,
+		struct eap_psk_keys *keys) {
+	memcpy(keys, &((struct psk_pair *) ctx)->keys, sizeof(*keys));
+	return 0;
+}
+
+static struct eapol_callbacks psk_eapol_cb;
+
+static int init_psk_pair(struct psk_pair *pair) {
+	struct eap_config eap_conf;
+
+	memset(pair, 0, sizeof(*pair));
+	if (eap_server_identity_register(&pair->methods) < 0 ||
+			eap_server_psk_register(&pair->methods) < 0)
+		return -1;
+
+	memset(&psk_eapol_cb, 0, sizeof(psk_eapol_cb));
+	psk_eapol_cb.get_eap_user = psk_get_eap_user;
+	psk_eapol_cb.get_eap_req_id_text = psk_get_eap_req_id_text;
+
+	os_memset(&eap_conf, 0, sizeof(eap_conf));
+	eap_conf.backend_auth = TRUE;
+	eap_conf.eap_server = 1;
+	eap_conf.eap_methods = pair->methods;
+
+	pair->server = eap_server_sm_init(pair, &psk_eapol_cb, &eap_conf);
+	if (pair->server == NULL)
+		return -1;
+	pair->server_if = eap_get_interface(pair->server);
+	pair->server_if->portEnabled = TRUE;
+
+	pair->peer = bench_peer_new(IDENTITY, PSK);
+	return pair->peer != NULL ? 0 : -1;
+}
+
+/* msg is the response processed, -1 for the restart. */
+static void server_step(struct psk_pair *pair, int msg) {
+	uint64_t allocs = bench_alloc_count();
+	uint64_t cycles = bench_cycles();
+	uint64_t start = bench_now_ns();
+	uint64_t ns;
+
+	eap_server_sm_step(pair->server);
+	ns = bench_now_ns() - start;
+	cycles = bench_cycles() - cycles;
+	allocs = bench_alloc_count() - allocs;
+
+	pair->server_ns += ns;
+	if (msg >= 0 && msg < 3) {
+		pair->msgs[msg].ns += ns;
+		pair->msgs[msg].allocs += allocs;
+		pair->msg_cycles[msg] += cycles;
+	}
+}
+
+static void run_psk_exchange(void *arg, uint64_t n) {
+	struct psk_pair *pair = (struct psk_pair *) arg;
+	struct eap_eapol_interface *srv = pair->server_if;
+	const uint8_t *resp;
+	size_t resp_len;
+	uint64_t i;
+	int msg;
+
+	pair->server_ns = 0;
+	memset(pair->msgs, 0, sizeof(pair->msgs));
+	memset(pair->msg_cycles, 0, sizeof(pair->msg_cycles));
+	for (i = 0; i < n; i++) {
+		srv->eapRestart = TRUE;
+		server_step(pair, -1);
+		msg = 0;
+		while (srv->eapReq) {
+			srv->eapReq = FALSE;
+			if (bench_peer_process(pair->peer, wpabuf_head_u8(srv->eapReqData),
+					wpabuf_len(srv->eapReqData), &resp, &resp_len) != 1)
+				abort();
+
+			wpabuf_free(srv->eapRespData);
+			srv->eapRespData = wpabuf_alloc_copy(resp, resp_len);
+			srv->eapResp = TRUE;
+			server_step(pair, msg++);
+		}
+
+		if (!srv->eapSuccess || !srv->eapKeyAvailable)
+			abort();
+		srv->eapSuccess = FALSE;
+		// The peer derives its keys with the EAP-Success.
+		bench_peer_process(pair->peer, wpabuf_head_u8(srv->eapReqData),
+				wpabuf_len(srv->eapReqData), &resp, &resp_len);
+
+		// Ready for the next one, the last response would be taken again.
+		srv->eapResp = FALSE;
+		wpabuf_free(srv->eapRespData);
+		srv->eapRespData = NULL;
+		bench_peer_restart(pair->peer);
+	}
+}
+
+static void report_messages(const struct psk_pair *pair, uint64_t n, const char *suffix) {
+	char name[64];
+
+	snprintf(name, sizeof(name), "psk2_server%s", suffix);
+	bench_report_extra(name, n, &pair->msgs[1], "cycles_per_op", (double) pair->msg_cycles[1] / n);
+	snprintf(name, sizeof(name), "psk4_server%s", suffix);
+	bench_report_extra(name, n, &pair->msgs[2], "cycles_per_op", (double) pair->msg_cycles[2] / n);
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 20000);
+	struct psk_pair pair;
+	struct bench_sample sample;
+
+	bench_init(argc, argv);
+
+	if (init_controller() < 0 || init_psk_pair(&pair) < 0) {
+		fprintf(stderr, "cannot initialize the EAP state machines\n");
+		return 1;
+	}
+
+	bench_begin("eap");
+	bench_run("auth_identity", n, run_auth_identity, NULL);
+	bench_run("psk_exchange", n, run_psk_exchange, &pair);
+
+	// Only the server side of the last repetition.
+	memset(&sample, 0, sizeof(sample));
+	sample.ns = pair.server_ns;
+	bench_report("psk_server", n, &sample);
+	report_messages(&pair, n, "");
+
+	wpabuf_pool_enable(0);
+	bench_run("psk_exchange_heap", n, run_psk_exchange, &pair);
+	wpabuf_pool_enable(1);
+
+	eap_psk_keys_setup((const u8 *) PSK, &pair.keys);
+	psk_eapol_cb.get_eap_psk_keys = psk_get_eap_psk_keys;
+	bench_run("psk_exchange_cached", n, run_psk_exchange, &pair);
+	report_messages(&pair, n, "_cached");
+	bench_end();
+
+	return 0;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file bench_eap.h
+ * @brief EAP peer of the EAP benchmark (bench_eap_peer.cpp).
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BENCH_EAP_H
+#define BENCH_EAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct eap_peer_ctx;
+
+/** A peer of EAP-PSK, NULL on error.*/
+struct eap_peer_ctx *bench_peer_new(const char *identity, const char *psk);
+/** Prepares the peer for a new authentication, once one has finished.*/
+void bench_peer_restart(struct eap_peer_ctx *peer);
+/**
+ * Hands an EAP request to the peer.
+ *
+ * @return 1 if there is a response, valid until the next call, 0 if
+ * there is not and -1 if the authentication has failed.
+ */
+int bench_peer_process(struct eap_peer_ctx *peer, const uint8_t *req, size_t len,
+		const uint8_t **resp, size_t *resp_len);
+void bench_peer_free(struct eap_peer_ctx *peer);
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * @file bench_eap_peer.cpp
+ * @brief EAP peer of the EAP benchmark (bench_eap.cpp).
+ *
+ * The peer is kept apart because the headers of the EAP peer and of the
+ * EAP server cannot be included together.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+
+extern "C" {
+#include "../libeapstack/eap_peer_interface.h"
+}
+
+#include "bench.h"
+#include "bench_eap.h"
+
+struct eap_peer_ctx *bench_peer_new(const char *identity, const char *psk) {
+	struct eap_peer_ctx *peer = (struct eap_peer_ctx *) malloc(sizeof(*peer));
+
+	if (eap_peer_init(peer, NULL, (char *) identity, (char *) psk,
+			(char *) "", (char *) "", (char *) "", (char *) "", 1398) < 0) {
+		free(peer);
+		return NULL;
+	}
+	return peer;
+}
+
+void bench_peer_restart(struct eap_peer_ctx *peer) {
+	eap_peer_set_eapSuccess(peer, FALSE);
+	eap_peer_set_eapRestart(peer, TRUE);
+}
+
+int bench_peer_process(struct eap_peer_ctx *peer, const uint8_t *req, size_t len,
+		const uint8_t **resp, size_t *resp_len) {
+	struct wpabuf *buf;
+
+	eap_peer_set_eapReq(peer, TRUE);
+	eap_peer_set_eapReqData(peer, req, len);
+	eap_peer_step(peer);
+	eap_peer_set_eapReq(peer, FALSE);
+
+	if (eap_peer_get_eapFail(peer))
+		return -1;
+	if (!eap_peer_get_eapResp(peer))
+		return 0;
+	eap_peer_set_eapResp(peer, FALSE);
+
+	buf = eap_peer_get_eapRespData(peer);
+	*resp = (const uint8_t *) wpabuf_head(buf);
+	*resp_len = wpabuf_len(buf);
+	return 1;
+}
+
+void bench_peer_free(struct eap_peer_ctx *peer) {
+	eap_peer_deinit(peer, &peer->eap_methods);
+	free(peer);
+}
@@ -0,0 +1,263 @@
+/**
+ * @file bench_flow.cpp
+ * @brief Per-step overhead of the CoAP-EAP session dispatch.
+ *
+ * Compares the two ways of handing an ACK received by the network thread
+ * to its session:
+ *
+ *  - task: the datagram is copied into a network task, queued in the
+ *    tasks' list and a worker wakes up, parses it again, looks for the
+ *    session and runs the callback (the path used before the session
+ *    flows).
+ *  - flow: the network thread parses the datagram once, looks for the
+ *    session and resumes its flow directly.
+ *
+ * Both paths do the same work per step: the ACK must match the message
+ * id expected by the session, which then moves to the next one.
+ *
+ * Neither runs the controller's code: the task path is a model of the
+ * CURRENT_STATE dispatch removed with the flows (same task list, copy and
+ * re-parse, but not its callbacks), and the flow path a flow with a
+ * single await. The results are named task_model and flow_model, the
+ * difference is the cost of the hop to a worker, not that of a whole
+ * step of the controller.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <string.h>
+
+extern "C" {
+#include "../tasks.h"
+#include "../state_machines/coap_eap_flow.h"
+}
+
+#include "../cantcoap-master/cantcoap.h"
+#include "bench.h"
+
+#define BUF_LEN 500
+/** Number of sessions alive during the benchmark.*/
+#define BENCH_SESSIONS 64
+/** Number of workers used by the task path.*/
+#define BENCH_WORKERS 4
+
+struct bench_session {
+	uint32_t session_id;
+	uint16_t message_id;
+	pthread_mutex_t mutex;
+	struct coap_eap_flow flow;
+	uint64_t steps;
+	struct bench_session *next;
+};
+
+/* Copy of the datagram handed to a worker, like the old network_task. */
+struct bench_network_task {
+	char buf[BUF_LEN];
+	int len;
+	struct sockaddr_storage their_addr;
+};
+
+static struct bench_session sessions[BENCH_SESSIONS];
+static struct bench_session *list_sessions = NULL;
+static pthread_mutex_t list_sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Posted by the worker when a step has been completed. */
+static sem_t step_done;
+static volatile int fin = 0;
+
+static struct bench_session *get_session(uint32_t id) {
+	struct bench_session *s;
+
+	pthread_mutex_lock(&list_sessions_mutex);
+	for (s = list_sessions; s != NULL; s = s->next)
+		if (s->session_id == id)
+			break;
+	pthread_mutex_unlock(&list_sessions_mutex);
+	return s;
+}
+
+/* The work done per step, shared by both paths. */
+static int session_step(struct bench_session *s, CoapPDU *ack) {
+	if (ack->getMessageID() != s->message_id)
+		return 0;
+	s->message_id++;
+	s->steps++;
+	return 1;
+}
+
+static int session_flow(struct bench_session *s, int ev, void *data) {
+	struct coap_eap_flow *f = &s->flow;
+
+	FLOW_BEGIN(f);
+	while (1) {
+		FLOW_AWAIT(f, ev == FLOW_EV_ACK &&
+				((CoapPDU *) data)->getMessageID() == s->message_id);
+		session_step(s, (CoapPDU *) data);
+	}
+	FLOW_END(f);
+}
+
+static void *process_ack_task(void *arg) {
+	struct bench_network_task *task = (struct bench_network_task *) arg;
+
+	CoapPDU *request = new CoapPDU((uint8_t *) task->buf, BUF_LEN, BUF_LEN);
+	request->setPDULength(task->len);
+	if (request->validate() == 1) {
+		uint32_t session_id;
+		memcpy(&session_id, request->getTokenPointer(), sizeof(session_id));
+		struct bench_session *s = get_session(session_id);
+
+		pthread_mutex_lock(&s->mutex);
+		session_step(s, request);
+		pthread_mutex_unlock(&s->mutex);
+	}
+
+	delete request;
+	free(task);
+	sem_post(&step_done);
+	return NULL;
+}
+
+static void *bench_worker(void *data) {
+	struct task_list *task;
+
+	while (!fin) {
+		wait_task();
+		task = get_task();
+		if (task) {
+			task->use_function(task->data);
+			free(task);
+		}
+	}
+	return NULL;
+}
+
+/* Builds the ACK that the device sends for the message id expected. */
+static int build_ack(uint8_t *buf, struct bench_session *s) {
+	CoapPDU ack(buf, BUF_LEN, 0);
+
+	ack.setVersion(1);
+	ack.setType(CoapPDU::COAP_ACKNOWLEDGEMENT);
+	ack.setCode(CoapPDU::COAP_CHANGED);
+	ack.setMessageID(s->message_id);
+	ack.setToken((uint8_t *) &s->session_id, sizeof(s->session_id));
+	return ack.getPDULength();
+}
+
+static void init_sessions(void) {
+	int i;
+
+	list_sessions = NULL;
+	for (i = 0; i < BENCH_SESSIONS; i++) {
+		sessions[i].session_id = 0x1000 + i;
+		sessions[i].message_id = 1;
+		sessions[i].steps = 0;
+		pthread_mutex_init(&sessions[i].mutex, NULL);
+		FLOW_INIT(&sessions[i].flow);
+		sessions[i].next = list_sessions;
+		list_sessions = &sessions[i];
+	}
+}
+
+static void run_task_path(uint64_t n) {
+	uint8_t buf[BUF_LEN];
+	struct sockaddr_storage their_addr;
+	struct bench_sample sample;
+	uint64_t i;
+
+	init_sessions();
+	memset(&their_addr, 0, sizeof(their_addr));
+
+	bench_start(&sample);
+	for (i = 0; i < n; i++) {
+		struct bench_session *s = &sessions[i % BENCH_SESSIONS];
+		int len = build_ack(buf, s);
+
+		CoapPDU recvPDU(buf, BUF_LEN, BUF_LEN);
+		recvPDU.setPDULength(len);
+		if (recvPDU.validate() != 1)
+			abort();
+
+		struct bench_network_task *task =
+				(struct bench_network_task *) malloc(sizeof(struct bench_network_task));
+		memcpy(task->buf, buf, (size_t) len);
+		task->len = len;
+		memcpy(&task->their_addr, &their_addr, sizeof(their_addr));
+
+		add_task(process_ack_task, task);
+		sem_wait(&step_done);
+	}
+	bench_stop(&sample);
+
+	bench_report("task_model", n, &sample);
+}
+
+static void run_flow_path(uint64_t n) {
+	uint8_t buf[BUF_LEN];
+	struct bench_sample sample;
+	uint64_t i;
+
+	init_sessions();
+	for (i = 0; i < BENCH_SESSIONS; i++)
+		session_flow(&sessions[i], FLOW_EV_START, NULL);
+
+	bench_start(&sample);
+	for (i = 0; i < n; i++) {
+		struct bench_session *s = &sessions[i % BENCH_SESSIONS];
+		int len = build_ack(buf, s);
+
+		CoapPDU recvPDU(buf, BUF_LEN, BUF_LEN);
+		recvPDU.setPDULength(len);
+		if (recvPDU.validate() != 1)
+			abort();
+
+		uint32_t session_id;
+		memcpy(&session_id, recvPDU.getTokenPointer(), sizeof(session_id));
+		struct bench_session *found = get_session(session_id);
+
+		pthread_mutex_lock(&found->mutex);
+		session_flow(found, FLOW_EV_ACK, &recvPDU);
+		pthread_mutex_unlock(&found->mutex);
+	}
+	bench_stop(&sample);
+
+	for (i = 0; i < BENCH_SESSIONS; i++)
+		if (sessions[i].steps != n / BENCH_SESSIONS + (i < n % BENCH_SESSIONS))
+			abort();
+
+	bench_report("flow_model", n, &sample);
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 200000);
+	pthread_t workers[BENCH_WORKERS];
+	int i;
+
+	init_tasks();
+	sem_init(&step_done, 0, 0);
+	for (i = 0; i < BENCH_WORKERS; i++)
+		pthread_create(&workers[i], NULL, bench_worker, NULL);
+
+	bench_begin("flow");
+	run_task_path(n);
+	run_flow_path(n);
+	bench_end();
+
+	return 0;
+}
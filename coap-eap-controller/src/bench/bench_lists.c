@@ -0,0 +1,188 @@
+/**
+ * @file bench_lists.c
+ * @brief Cost of the controller's lists: sessions, alarms and tasks.
+ *
+ * The lists are walked in every operation, so the larger ones are run
+ * with fewer iterations.
+ *
+ * Measures, with the controller's own functions (mainserver.cpp is built
+ * without main(), as in the simulation):
+ *
+ *  - lookup_<n>: get_coap_eap_session of a random session with n sessions
+ *    in the list, as for every ACK received.
+ *  - alarm_rearm_<n>: the retransmission alarm of a random session is
+ *    removed and added again (get_alarm_coap_eap_session and
+ *    add_alarm_coap_eap), as for every POST sent, with n alarms pending.
+ *  - alarm_expire: an alarm that has expired is added and taken from the
+ *    list (get_next_alarm_coap_eap), as the alarm thread does.
+ *  - task: a task is queued (add_task) and taken by a worker (wait_task and
+ *    get_task).
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mainserver.h"
+#include "../lalarm.h"
+
+#include "bench.h"
+
+/** Sizes of the lists.*/
+static const uint32_t list_sizes[] = {16, 256, 4096};
+#define NUM_SIZES (sizeof(list_sizes) / sizeof(list_sizes[0]))
+#define MAX_SESSIONS 4096
+
+extern struct lalarm_coap* list_alarms_coap_eap;
+extern pthread_mutex_t list_sessions_mutex;
+
+static coap_eap_ctx *sessions[MAX_SESSIONS];
+static uint32_t nsessions = 0;
+
+/* The POSTs of the sessions are not sent anywhere. */
+void sim_coap_send(struct sockaddr_storage *addr, uint8_t *buf, size_t len) {
+}
+
+/* Deterministic, so every run looks for the same sessions. */
+static uint32_t bench_rand(uint32_t *seed) {
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static void add_sessions(uint32_t n) {
+	for (; nsessions < n; nsessions++) {
+		coap_eap_ctx *s = XMALLOC(coap_eap_ctx, 1);
+
+		memset(s, 0, sizeof(*s));
+		s->session_id = 0x10000000 + nsessions;
+		sessions[nsessions] = s;
+		add_coap_eap_session(s);
+	}
+}
+
+static void run_lookup(void *arg, uint64_t n) {
+	uint32_t seed = 1;
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		coap_eap_ctx *s = sessions[bench_rand(&seed) % nsessions];
+		if (get_coap_eap_session(s->session_id) != s)
+			abort();
+	}
+}
+
+static void run_alarm_rearm(void *arg, uint64_t n) {
+	uint32_t seed = 1;
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		coap_eap_ctx *s = sessions[bench_rand(&seed) % nsessions];
+
+		if (get_alarm_coap_eap_session(&list_alarms_coap_eap, s->session_id, POST_ALARM) != s)
+			abort();
+		add_alarm_coap_eap(&list_alarms_coap_eap, s, 2.0 + (bench_rand(&seed) % 1000) / 1000.0,
+				POST_ALARM);
+	}
+}
+
+static void run_alarm_expire(void *arg, uint64_t n) {
+	struct lalarm_coap *alarm;
+	uint64_t i;
+
+	// Already expired, each one before the previous so it goes first.
+	for (i = 0; i < n; i++)
+		add_alarm_coap_eap(&list_alarms_coap_eap, sessions[i % nsessions], -1.0 - i * 1e-3,
+				POST_ALARM);
+
+	for (i = 0; i < n; i++) {
+		alarm = get_next_alarm_coap_eap(&list_alarms_coap_eap, getTime());
+		if (alarm == NULL)
+			abort();
+		XFREE(alarm);
+	}
+}
+
+/* The larger lists are walked with fewer iterations. */
+static uint64_t list_iterations(uint64_t n, uint32_t size) {
+	uint64_t scaled = n * list_sizes[0] / size;
+	return scaled > 1000 ? scaled : 1000;
+}
+
+static void *bench_task(void *arg) {
+	return arg;
+}
+
+static void run_task(void *arg, uint64_t n) {
+	struct task_list *task;
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		add_task(bench_task, sessions[0]);
+		wait_task();
+		task = get_task();
+		if (task == NULL)
+			abort();
+		task->use_function(task->data);
+		XFREE(task);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 100000);
+	char name[32];
+	uint32_t i;
+
+	bench_init(argc, argv);
+
+	pthread_mutex_init(&list_sessions_mutex, NULL);
+	list_alarms_coap_eap = init_alarms_coap();
+	init_tasks();
+
+	bench_begin("lists");
+
+	for (i = 0; i < NUM_SIZES; i++) {
+		add_sessions(list_sizes[i]);
+		snprintf(name, sizeof(name), "lookup_%u", list_sizes[i]);
+		bench_run(name, list_iterations(n, list_sizes[i]), run_lookup, NULL);
+	}
+
+	// One retransmission alarm per session, as while they wait for an ACK.
+	nsessions = 0;
+	for (i = 0; i < NUM_SIZES; i++) {
+		uint32_t j;
+
+		for (j = nsessions; j < list_sizes[i]; j++)
+			add_alarm_coap_eap(&list_alarms_coap_eap, sessions[j], 2.0 + (j % 1000) / 1000.0,
+					POST_ALARM);
+		nsessions = list_sizes[i];
+		snprintf(name, sizeof(name), "alarm_rearm_%u", list_sizes[i]);
+		bench_run(name, list_iterations(n, list_sizes[i]), run_alarm_rearm, NULL);
+	}
+
+	// Once the sessions have finished.
+	for (i = 0; i < nsessions; i++)
+		remove_alarm_coap_eap(&list_alarms_coap_eap, sessions[i]->session_id);
+	bench_run("alarm_expire", n, run_alarm_expire, NULL);
+
+	bench_run("task", n, run_task, NULL);
+
+	bench_end();
+	return 0;
+}
@@ -0,0 +1,308 @@
+/**
+ * @file bench_radius.cpp
+ * @brief Cost of the RADIUS messages exchanged with the AAA server.
+ *
+ * Measures, with the messages of an EAP-PSK bootstrap:
+ *
+ *  - build_request: an Access-Request with the attributes added by
+ *    eap_auth_encapsulate_radius is built and signed (radius_msg_finish),
+ *    attribute by attribute.
+ *  - build_request_static: the same Access-Request, as the authenticator
+ *    builds it: in one buffer of its size (radius_msg_new_sized), with the
+ *    attributes that do not change encoded once (radius_msg_add_attrs).
+ *  - parse: an Access-Challenge received from the AAA server is parsed
+ *    (radius_msg_parse), as in process_radius_datagram.
+ *  - verify: the Response Authenticator and the Message-Authenticator of
+ *    the answer are checked against the request (radius_msg_verify).
+ *  - parse_extract: the answer is parsed and its EAP-Message and State
+ *    are extracted (radius_msg_get_eap, radius_msg_get_attr), as the
+ *    authenticator does with every answer.
+ *  - parse_extract_arena: the same, parsed into an arena of the caller
+ *    (radius_msg_parse_arena).
+ *  - parse_extract_tls: parse_extract with an Access-Challenge of EAP-TLS,
+ *    whose EAP request of EAP_TLS_REQUEST_LEN bytes is in 5 EAP-Message
+ *    attributes.
+ *
+ * The extra field of the parse_extract modes is the number of packets per
+ * second.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "includes.h"
+#include "common.h"
+#include "eap_common/eap_defs.h"
+#include "radius/radius.h"
+}
+
+#include "bench.h"
+
+#define SECRET "testing123"
+#define SECRET_LEN 10
+/** Sizes of EAP-PSK-2 (in the request) and EAP-PSK-3 (in the answer).*/
+#define EAP_RESPONSE_LEN 59
+#define EAP_REQUEST_LEN 59
+#define STATE_LEN 18
+#define EAP_TLS_REQUEST_LEN 1024
+
+static u8 eap_response[EAP_RESPONSE_LEN];
+static u8 eap_request[EAP_REQUEST_LEN];
+static u8 eap_tls_request[EAP_TLS_REQUEST_LEN];
+static u8 state[STATE_LEN];
+
+/* The request of the exchange and the answer of the AAA server to it. */
+static struct radius_msg *request = NULL;
+static u8 *answer_buf = NULL;
+static size_t answer_len = 0;
+static u8 *tls_answer_buf = NULL;
+static size_t tls_answer_len = 0;
+/* NAS-IP-Address, Calling-Station-Id, Framed-MTU and NAS-Port-Type */
+static u8 *static_attrs = NULL;
+static size_t static_attrs_len = 0;
+#define STATIC_ATTRS 4
+
+static struct radius_msg *build_request(u8 identifier) {
+	struct radius_msg *msg = radius_msg_new(RADIUS_CODE_ACCESS_REQUEST, identifier);
+	struct in_addr own_ip_addr;
+	char buf[128];
+
+	radius_msg_make_authenticator(msg, (u8 *) &identifier, sizeof(identifier));
+	inet_aton("127.0.0.1", &own_ip_addr);
+	os_snprintf(buf, sizeof(buf), RADIUS_802_1X_ADDR_FORMAT, 0, 0, 0, 0, 0, 0);
+
+	if (!radius_msg_add_attr(msg, RADIUS_ATTR_USER_NAME, (u8 *) "alpha.t.eu.org", 14) ||
+			!radius_msg_add_attr(msg, RADIUS_ATTR_NAS_IP_ADDRESS, (u8 *) &own_ip_addr, 4) ||
+			!radius_msg_add_attr(msg, RADIUS_ATTR_CALLING_STATION_ID, (u8 *) buf, os_strlen(buf)) ||
+			!radius_msg_add_attr_int32(msg, RADIUS_ATTR_FRAMED_MTU, 1400) ||
+			!radius_msg_add_attr_int32(msg, RADIUS_ATTR_NAS_PORT_TYPE,
+					RADIUS_NAS_PORT_TYPE_IEEE_802_11) ||
+			!radius_msg_add_eap(msg, eap_response, sizeof(eap_response)) ||
+			!radius_msg_add_attr(msg, RADIUS_ATTR_STATE, state, sizeof(state)))
+		abort();
+
+	if (radius_msg_finish(msg, (u8 *) SECRET, SECRET_LEN) < 0)
+		abort();
+	return msg;
+}
+
+/* The attributes of build_request after User-Name, up to the EAP-Message. */
+static void build_static_attrs(void) {
+	struct radius_msg *msg = build_request(0);
+	const u8 *pos = wpabuf_head_u8(radius_msg_get_buf(msg)) + sizeof(struct radius_hdr);
+	const u8 *start = pos + pos[1];
+	size_t i;
+
+	for (pos = start, i = 0; i < STATIC_ATTRS; i++)
+		pos += pos[1];
+	static_attrs_len = pos - start;
+	static_attrs = (u8 *) malloc(static_attrs_len);
+	memcpy(static_attrs, start, static_attrs_len);
+	radius_msg_free(msg);
+}
+
+static struct radius_msg *build_request_static(u8 identifier) {
+	size_t eap_attrs = (sizeof(eap_response) + RADIUS_MAX_ATTR_LEN - 1) / RADIUS_MAX_ATTR_LEN;
+	size_t len = sizeof(struct radius_hdr) + 2 + 14 + static_attrs_len +
+		2 * eap_attrs + sizeof(eap_response) + 2 + sizeof(state) + 2 + 16;
+	struct radius_msg *msg = radius_msg_new_sized(RADIUS_CODE_ACCESS_REQUEST, identifier,
+			len, 1 + STATIC_ATTRS + eap_attrs + 2);
+
+	radius_msg_make_authenticator(msg, (u8 *) &identifier, sizeof(identifier));
+	if (!radius_msg_add_attr(msg, RADIUS_ATTR_USER_NAME, (u8 *) "alpha.t.eu.org", 14) ||
+			radius_msg_add_attrs(msg, static_attrs, static_attrs_len) < 0 ||
+			!radius_msg_add_eap(msg, eap_response, sizeof(eap_response)) ||
+			!radius_msg_add_attr(msg, RADIUS_ATTR_STATE, state, sizeof(state)))
+		abort();
+
+	if (radius_msg_finish(msg, (u8 *) SECRET, SECRET_LEN) < 0)
+		abort();
+	return msg;
+}
+
+/* Both builds give the same attributes, Message-Authenticator aside. */
+static void check_build_request_static(void) {
+	struct radius_msg *msg = build_request(2), *msg_static = build_request_static(2);
+	struct wpabuf *buf = radius_msg_get_buf(msg), *buf_static = radius_msg_get_buf(msg_static);
+
+	if (wpabuf_len(buf) != wpabuf_len(buf_static) ||
+			memcmp(wpabuf_head_u8(buf) + sizeof(struct radius_hdr),
+				wpabuf_head_u8(buf_static) + sizeof(struct radius_hdr),
+				wpabuf_len(buf) - sizeof(struct radius_hdr) - 18) != 0)
+		abort();
+	radius_msg_free(msg);
+	radius_msg_free(msg_static);
+}
+
+/* An Access-Challenge with the EAP request, as the AAA server sends it. */
+static u8 *build_answer(const u8 *eap, size_t eap_len, size_t *len) {
+	struct radius_msg *msg = radius_msg_new(RADIUS_CODE_ACCESS_CHALLENGE,
+			radius_msg_get_hdr(request)->identifier);
+	struct wpabuf *buf;
+	u8 *answer;
+
+	if (!radius_msg_add_attr(msg, RADIUS_ATTR_STATE, state, sizeof(state)) ||
+			!radius_msg_add_eap(msg, eap, eap_len))
+		abort();
+	if (radius_msg_finish_srv(msg, (u8 *) SECRET, SECRET_LEN,
+			radius_msg_get_hdr(request)->authenticator) < 0)
+		abort();
+
+	buf = radius_msg_get_buf(msg);
+	*len = wpabuf_len(buf);
+	answer = (u8 *) malloc(*len);
+	memcpy(answer, wpabuf_head(buf), *len);
+	radius_msg_free(msg);
+	return answer;
+}
+
+static void run_build_request(void *arg, uint64_t n) {
+	uint64_t i;
+
+	for (i = 0; i < n; i++)
+		radius_msg_free(build_request((u8) i));
+}
+
+static void run_build_request_static(void *arg, uint64_t n) {
+	uint64_t i;
+
+	for (i = 0; i < n; i++)
+		radius_msg_free(build_request_static((u8) i));
+}
+
+static void run_parse(void *arg, uint64_t n) {
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		struct radius_msg *msg = radius_msg_parse(answer_buf, answer_len);
+		if (msg == NULL)
+			abort();
+		radius_msg_free(msg);
+	}
+}
+
+static void run_verify(void *arg, uint64_t n) {
+	struct radius_msg *msg = radius_msg_parse(answer_buf, answer_len);
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		if (radius_msg_verify(msg, (u8 *) SECRET, SECRET_LEN, request, 1))
+			abort();
+	}
+	radius_msg_free(msg);
+}
+
+/* What the authenticator takes from an answer. */
+static void extract(struct radius_msg *msg, size_t eap_len) {
+	u8 buf[STATE_LEN];
+	size_t len = 0;
+	u8 *eap = radius_msg_get_eap(msg, &len);
+
+	if (eap == NULL || len != eap_len ||
+			radius_msg_get_attr(msg, RADIUS_ATTR_STATE, buf, sizeof(buf)) != STATE_LEN)
+		abort();
+	BENCH_KEEP(eap[0]);
+	os_free(eap);
+}
+
+static void run_parse_extract(void *arg, uint64_t n) {
+	size_t eap_len = arg == NULL ? EAP_REQUEST_LEN : EAP_TLS_REQUEST_LEN;
+	const u8 *data = arg == NULL ? answer_buf : tls_answer_buf;
+	size_t len = arg == NULL ? answer_len : tls_answer_len;
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		struct radius_msg *msg = radius_msg_parse(data, len);
+		if (msg == NULL)
+			abort();
+		extract(msg, eap_len);
+		radius_msg_free(msg);
+	}
+}
+
+static void run_parse_extract_arena(void *arg, uint64_t n) {
+	struct radius_arena *arena = (struct radius_arena *) arg;
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		struct radius_msg *msg = radius_msg_parse_arena(answer_buf, answer_len, arena);
+		if (msg == NULL)
+			abort();
+		extract(msg, EAP_REQUEST_LEN);
+		arena->used = 0;
+	}
+}
+
+/* Warm up and one measurement, reported with the packets per second. */
+static void run_mode(const char *name, uint64_t n, bench_fn fn, void *arg) {
+	struct bench_sample sample;
+
+	fn(arg, n / 10 + 1);
+	bench_start(&sample);
+	fn(arg, n);
+	bench_stop(&sample);
+	bench_report_extra(name, n, &sample, "packets_per_s",
+			sample.ns > 0 ? (double) n * 1e9 / (double) sample.ns : 0);
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 500000);
+	static u8 arena_buf[4 * RADIUS_DEFAULT_MSG_SIZE];
+	struct radius_arena arena;
+
+	bench_init(argc, argv);
+
+	memset(eap_response, 0x2f, sizeof(eap_response));
+	eap_response[0] = EAP_CODE_RESPONSE;
+	WPA_PUT_BE16(&eap_response[2], EAP_RESPONSE_LEN);
+	memset(eap_request, 0x2f, sizeof(eap_request));
+	eap_request[0] = EAP_CODE_REQUEST;
+	WPA_PUT_BE16(&eap_request[2], EAP_REQUEST_LEN);
+	memset(eap_tls_request, 0x2f, sizeof(eap_tls_request));
+	eap_tls_request[0] = EAP_CODE_REQUEST;
+	WPA_PUT_BE16(&eap_tls_request[2], EAP_TLS_REQUEST_LEN);
+	memset(state, 0x53, sizeof(state));
+
+	request = build_request(1);
+	build_static_attrs();
+	check_build_request_static();
+	answer_buf = build_answer(eap_request, sizeof(eap_request), &answer_len);
+	tls_answer_buf = build_answer(eap_tls_request, sizeof(eap_tls_request), &tls_answer_len);
+	arena.buf = arena_buf;
+	arena.size = sizeof(arena_buf);
+	arena.used = 0;
+
+	bench_begin("radius");
+	bench_run("build_request", n, run_build_request, NULL);
+	bench_run("build_request_static", n, run_build_request_static, NULL);
+	bench_run("parse", n, run_parse, NULL);
+	bench_run("verify", n, run_verify, NULL);
+	run_mode("parse_extract", n, run_parse_extract, NULL);
+	run_mode("parse_extract_arena", n, run_parse_extract_arena, &arena);
+	run_mode("parse_extract_tls", n, run_parse_extract, tls_answer_buf);
+	bench_end();
+
+	radius_msg_free(request);
+	free(static_attrs);
+	free(tls_answer_buf);
+	free(answer_buf);
+	return 0;
+}
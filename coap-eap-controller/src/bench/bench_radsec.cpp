@@ -0,0 +1,398 @@
+/**
+ * @file bench_radsec.cpp
+ * @brief Answers per second of the RadSec transport (radsec.c) to the AAA server.
+ *
+ * The AAA server is a stand-in RadSec server in other threads of the same
+ * process, on a loopback TCP socket with OpenSSL: it answers every
+ * Access-Request with an Access-Challenge signed with RADSEC_SECRET, and
+ * the answers of the requests read together are written together. The
+ * requests are sent by the transport and its connections are handled as
+ * in the network thread of the controller:
+ *
+ *  - window_1: one connection and one request at a time, every request
+ *    waits for the round trip of the previous one.
+ *  - window_64: one connection with up to 64 requests in flight.
+ *  - pool_4: four connections with up to 64 requests in flight.
+ *  - *_writes: requests per write of the transport in the same run, the
+ *    requests queued while a connection is written go in the next write.
+ *  - reconnect_full: the server closes the connection after every answer
+ *    and the transport opens it again, with a full TLS handshake.
+ *  - reconnect_resumed: the same, resuming the TLS session.
+ *
+ * The cost of the network and of a real AAA server (FreeRADIUS) is not
+ * included: the tail latency under loss is compared with UDP in the
+ * simulation (coap_eap_sim -t), and the allocations counted include the
+ * ones of the server. The server uses bench_tls.pem and bench_tls.key,
+ * made by the Makefile. The extra field is the number of answers per
+ * second, of requests per write or of connections per second.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+
+#include <openssl/ssl.h>
+
+extern "C" {
+#include "utils/includes.h"
+#include "utils/common.h"
+#include "utils/wpabuf.h"
+#include "crypto/crypto.h"
+#include "crypto/md5.h"
+#include "radius/radius.h"
+#include "../radsec.h"
+}
+
+#include "bench.h"
+
+#define SERVER_CERT "bench_tls.pem"
+#define SERVER_KEY "bench_tls.key"
+#define RADIUS_HDR_LEN 20
+#define RADIUS_MAX_LEN 4096
+#define IN_SIZE (16384 + RADIUS_MAX_LEN)
+
+/** EAP-Request/PSK of the Access-Challenge, as the one of a real server.*/
+static const u8 challenge_eap[] = {
+	0x01, 0x02, 0x00, 0x1c, 0x2f, 0x00,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	'a', 'a', 'a', '.', 'o', 'r'
+};
+static const u8 challenge_state[] = {
+	0x5a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69
+};
+
+struct server {
+	SSL_CTX *ctx;
+	int sock;
+	int port;
+	/**The connection is closed after every answer.*/
+	int close_after_answer;
+	/**Access-Challenge, with the identifier and the authenticators of the request patched.*/
+	u8 answer[RADIUS_MAX_LEN];
+	size_t answer_len;
+	size_t ma_offset;
+};
+
+struct client {
+	/**Access-Request sent, with the identifier patched.*/
+	u8 request[RADIUS_MAX_LEN];
+	size_t request_len;
+	int window;
+	uint64_t sent;
+	uint64_t answered;
+	uint8_t in_flight[256];
+	uint8_t next_id;
+};
+
+static struct client client;
+
+/* The Access-Challenge of a request, signed as radius_msg_finish_srv(). */
+static void sign_answer(struct server *srv, const u8 *req, u8 *answer) {
+	const u8 *addr[2];
+	size_t len[2];
+
+	memcpy(answer, srv->answer, srv->answer_len);
+	answer[1] = req[1];
+	memcpy(answer + 4, req + 4, MD5_MAC_LEN);
+	hmac_md5((const u8 *) RADSEC_SECRET, sizeof(RADSEC_SECRET) - 1, answer, srv->answer_len,
+			answer + srv->ma_offset);
+	addr[0] = answer;
+	len[0] = srv->answer_len;
+	addr[1] = (const u8 *) RADSEC_SECRET;
+	len[1] = sizeof(RADSEC_SECRET) - 1;
+	md5_vector(2, addr, len, answer + 4);
+}
+
+/* Answers the requests of a connection, the ones read together are
+ * answered in one write. */
+static void *serve_connection(void *arg) {
+	SSL *ssl = (SSL *) arg;
+	struct server *srv = (struct server *) SSL_get_app_data(ssl);
+	u8 *in = (u8 *) malloc(IN_SIZE), *out = (u8 *) malloc(IN_SIZE / RADIUS_HDR_LEN * srv->answer_len);
+	size_t in_len = 0, off, out_len, len;
+	int ret;
+
+	if (SSL_accept(ssl) != 1)
+		goto out;
+	for (;;) {
+		ret = SSL_read(ssl, in + in_len, (int) (IN_SIZE - in_len));
+		if (ret <= 0)
+			break;
+		in_len += (size_t) ret;
+		out_len = 0;
+		for (off = 0; in_len - off >= 4; off += len) {
+			len = WPA_GET_BE16(in + off + 2);
+			if (len < RADIUS_HDR_LEN || len > RADIUS_MAX_LEN)
+				goto out;
+			if (in_len - off < len)
+				break;
+			sign_answer(srv, in + off, out + out_len);
+			out_len += srv->answer_len;
+		}
+		memmove(in, in + off, in_len - off);
+		in_len -= off;
+		if (out_len > 0 && SSL_write(ssl, out, (int) out_len) <= 0)
+			break;
+		if (out_len > 0 && srv->close_after_answer) {
+			SSL_shutdown(ssl);
+			break;
+		}
+	}
+out:
+	close(SSL_get_fd(ssl));
+	SSL_free(ssl);
+	free(in);
+	free(out);
+	return NULL;
+}
+
+static void *server_accept(void *arg) {
+	struct server *srv = (struct server *) arg;
+	pthread_t thread;
+	SSL *ssl;
+	int s;
+
+	for (;;) {
+		s = accept(srv->sock, NULL, NULL);
+		if (s < 0)
+			continue;
+		ssl = SSL_new(srv->ctx);
+		SSL_set_fd(ssl, s);
+		SSL_set_app_data(ssl, srv);
+		pthread_create(&thread, NULL, serve_connection, ssl);
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+static int server_start(struct server *srv) {
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	struct radius_msg *msg;
+	struct wpabuf *buf;
+	u8 *ma;
+	pthread_t thread;
+
+	srv->ctx = SSL_CTX_new(TLS_server_method());
+	if (srv->ctx == NULL || SSL_CTX_use_certificate_file(srv->ctx, SERVER_CERT, SSL_FILETYPE_PEM) != 1 ||
+			SSL_CTX_use_PrivateKey_file(srv->ctx, SERVER_KEY, SSL_FILETYPE_PEM) != 1)
+		return -1;
+
+	msg = radius_msg_new(RADIUS_CODE_ACCESS_CHALLENGE, 0);
+	if (msg == NULL || !radius_msg_add_eap(msg, challenge_eap, sizeof(challenge_eap)) ||
+			!radius_msg_add_attr(msg, RADIUS_ATTR_STATE, challenge_state, sizeof(challenge_state)) ||
+			radius_msg_finish_srv(msg, (const u8 *) RADSEC_SECRET, sizeof(RADSEC_SECRET) - 1,
+					radius_msg_get_hdr(msg)->authenticator) < 0)
+		return -1;
+	buf = radius_msg_get_buf(msg);
+	srv->answer_len = wpabuf_len(buf);
+	memcpy(srv->answer, wpabuf_head(buf), srv->answer_len);
+	radius_msg_free(msg);
+	// The Message-Authenticator is the last attribute, it is computed
+	// with its value set to zero.
+	ma = srv->answer + srv->answer_len - MD5_MAC_LEN;
+	srv->ma_offset = (size_t) (ma - srv->answer);
+	memset(ma, 0, MD5_MAC_LEN);
+
+	srv->sock = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (srv->sock < 0 || bind(srv->sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+			getsockname(srv->sock, (struct sockaddr *) &addr, &addr_len) < 0 || listen(srv->sock, 64) < 0)
+		return -1;
+	srv->port = ntohs(addr.sin_port);
+	return pthread_create(&thread, NULL, server_accept, srv) == 0 ? 0 : -1;
+}
+
+/* Full handshakes only: no session ticket and no session cache. */
+static void server_set_resumption(struct server *srv, int resumption) {
+	SSL_CTX_set_session_cache_mode(srv->ctx, resumption ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+	SSL_CTX_set_num_tickets(srv->ctx, resumption ? 2 : 0);
+	if (resumption)
+		SSL_CTX_clear_options(srv->ctx, SSL_OP_NO_TICKET);
+	else
+		SSL_CTX_set_options(srv->ctx, SSL_OP_NO_TICKET);
+}
+
+static int client_init(void) {
+	struct radius_msg *msg;
+	struct wpabuf *buf;
+	u8 eap[64];
+
+	// EAP-Response/PSK-2 of a device, sent as the controller does.
+	memset(eap, 0x42, sizeof(eap));
+	eap[0] = 2;
+	eap[1] = 2;
+	WPA_PUT_BE16(eap + 2, sizeof(eap));
+	eap[4] = 0x2f;
+	msg = radius_msg_new(RADIUS_CODE_ACCESS_REQUEST, 0);
+	if (msg == NULL)
+		return -1;
+	radius_msg_make_authenticator(msg, (const u8 *) "x", 1);
+	if (!radius_msg_add_attr(msg, RADIUS_ATTR_USER_NAME, (const u8 *) "device05000", 11) ||
+			!radius_msg_add_eap(msg, eap, sizeof(eap)) ||
+			!radius_msg_add_attr(msg, RADIUS_ATTR_STATE, challenge_state, sizeof(challenge_state)) ||
+			radius_msg_finish(msg, (const u8 *) RADSEC_SECRET, sizeof(RADSEC_SECRET) - 1) < 0)
+		return -1;
+	buf = radius_msg_get_buf(msg);
+	client.request_len = wpabuf_len(buf);
+	memcpy(client.request, wpabuf_head(buf), client.request_len);
+	radius_msg_free(msg);
+	return 0;
+}
+
+static void deliver(uint8_t *buf, int len) {
+	if (len < RADIUS_HDR_LEN || buf[0] != RADIUS_CODE_ACCESS_CHALLENGE || !client.in_flight[buf[1]])
+		abort();
+	client.in_flight[buf[1]] = 0;
+	client.answered++;
+}
+
+/* n requests, with at most window in flight. The identifiers are those
+ * free, as those of the RADIUS client. */
+static void run_requests(void *arg, uint64_t n) {
+	uint64_t end = client.answered + n, to_send = client.sent + n;
+	struct timespec ts;
+	fd_set rset, wset;
+	int maxfd;
+
+	while (client.answered < end) {
+		while (client.sent < to_send && client.sent - client.answered < (uint64_t) client.window) {
+			while (client.in_flight[client.next_id])
+				client.next_id++;
+			client.request[1] = client.next_id;
+			if (radsec_send(NULL, client.request, client.request_len) < 0)
+				abort();
+			client.in_flight[client.next_id++] = 1;
+			client.sent++;
+		}
+		FD_ZERO(&rset);
+		FD_ZERO(&wset);
+		maxfd = radsec_fd_set(&rset, &wset);
+		if (pselect(maxfd + 1, &rset, &wset, NULL, radsec_timeout(&ts) ? &ts : NULL, NULL) < 0) {
+			FD_ZERO(&rset);
+			FD_ZERO(&wset);
+		}
+		radsec_process(&rset, &wset, deliver);
+	}
+}
+
+static int transport_init(const struct server *srv, int connections, int window) {
+	struct radsec_conf conf;
+	struct radsec_stats stats;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.host = "127.0.0.1";
+	conf.port = srv->port;
+	conf.connections = connections;
+	if (radsec_init(&conf) < 0)
+		return -1;
+	client.window = window;
+	// The first requests wait for the connections.
+	run_requests(NULL, (uint64_t) connections);
+	radsec_get_stats(&stats);
+	return stats.connects >= (uint64_t) connections ? 0 : -1;
+}
+
+/* Warm up and one measurement, reported with the answers per second, and
+ * the requests per write in the same run. */
+static void run_mode(const char *name, uint64_t n, int connections, int window, const struct server *srv) {
+	struct bench_sample sample;
+	struct radsec_stats before, after;
+	char writes_name[64];
+
+	if (transport_init(srv, connections, window) < 0) {
+		fprintf(stderr, "the RadSec connections could not be established\n");
+		exit(1);
+	}
+	run_requests(NULL, n / 10 + 1);
+	radsec_get_stats(&before);
+	bench_start(&sample);
+	run_requests(NULL, n);
+	bench_stop(&sample);
+	radsec_get_stats(&after);
+	radsec_deinit();
+
+	bench_report_extra(name, n, &sample, "answers_per_s",
+			sample.ns > 0 ? (double) n * 1e9 / (double) sample.ns : 0);
+	snprintf(writes_name, sizeof(writes_name), "%s_writes", name);
+	bench_report_extra(writes_name, n, &sample, "requests_per_write",
+			after.writes > before.writes ? (double) (after.requests - before.requests) /
+			(double) (after.writes - before.writes) : 0);
+}
+
+/* One connection per request, the server closes it after the answer. */
+static void run_reconnect(const char *name, uint64_t n, struct server *srv, int resumption) {
+	struct bench_sample sample;
+	struct radsec_stats before, after;
+	uint64_t connects, resumed;
+
+	server_set_resumption(srv, resumption);
+	srv->close_after_answer = 1;
+	if (transport_init(srv, 1, 1) < 0) {
+		fprintf(stderr, "the RadSec connection could not be established\n");
+		exit(1);
+	}
+	run_requests(NULL, n / 10 + 1);
+	radsec_get_stats(&before);
+	bench_start(&sample);
+	run_requests(NULL, n);
+	bench_stop(&sample);
+	radsec_get_stats(&after);
+	radsec_deinit();
+	srv->close_after_answer = 0;
+
+	// Every connection resumes the session of the previous one, or none does.
+	connects = after.connects - before.connects;
+	resumed = after.resumed - before.resumed;
+	if (resumption ? resumed < connects : resumed != 0)
+		abort();
+	bench_report_extra(name, n, &sample, "connects_per_s",
+			sample.ns > 0 ? (double) connects * 1e9 / (double) sample.ns : 0);
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 20000);
+	struct server srv;
+
+	bench_init(argc, argv);
+
+	memset(&srv, 0, sizeof(srv));
+	memset(&client, 0, sizeof(client));
+	if (server_start(&srv) < 0 || client_init() < 0) {
+		fprintf(stderr, "cannot start the RadSec server with %s and %s\n", SERVER_CERT, SERVER_KEY);
+		return 1;
+	}
+
+	bench_begin("radsec");
+	run_mode("window_1", n, 1, 1, &srv);
+	run_mode("window_64", n * 4, 1, 64, &srv);
+	run_mode("pool_4", n * 4, 4, 64, &srv);
+	run_reconnect("reconnect_full", n / 20, &srv, 0);
+	run_reconnect("reconnect_resumed", n / 20, &srv, 1);
+	bench_end();
+	return 0;
+}
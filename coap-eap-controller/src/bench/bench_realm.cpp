@@ -0,0 +1,183 @@
+/**
+ * @file bench_realm.cpp
+ * @brief Routing of the devices to the AAA servers by realm.
+ *
+ * Compiles a table of R realms (10000 by default, -R) spread over 16 AAA
+ * servers and measures:
+ *
+ *  - compile: loading the table from a buffer, "realms_per_s".
+ *  - hit: lookup of an identity of one of the realms.
+ *  - subdomain: lookup of an identity of a subdomain of a realm, the walk
+ *    goes one label deeper than the realm.
+ *  - miss: an identity of a realm that is not in the table, it shares the
+ *    last labels with the ones that are.
+ *  - no_realm: an identity without '@'.
+ *  - route: realm_route, the lookup and the counter of the realm, as the
+ *    controller does for every new session. The counters are checked.
+ *
+ * Lookups never allocate, "allocs_per_op" must be 0 but in compile.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "../realm.h"
+}
+
+#include "bench.h"
+
+#define SERVERS 16
+/** Identities of every mode, used in turn.*/
+#define IDENTITIES 4096
+#define IDENTITY_LEN 96
+
+struct identities {
+	char id[IDENTITIES][IDENTITY_LEN];
+	size_t len[IDENTITIES];
+	/**Realm each one must be found in, -1 for none.*/
+	int realm[IDENTITIES];
+	uint64_t calls;
+};
+
+static uint64_t nrealms = 10000;
+
+/* The servers of the table are "10.0.0.<i>:1812", their index is i. */
+static int server_index(const char *server, void *arg) {
+	return atoi(server + strlen("10.0.0."));
+}
+
+static void lookups(void *arg, uint64_t iterations) {
+	struct identities *ids = (struct identities *) arg;
+	uint64_t i;
+	int realm;
+
+	for (i = 0; i < iterations; i++) {
+		realm = realm_lookup((const uint8_t *) ids->id[i % IDENTITIES], ids->len[i % IDENTITIES]);
+		if (realm != ids->realm[i % IDENTITIES])
+			abort();
+	}
+}
+
+static void routes(void *arg, uint64_t iterations) {
+	struct identities *ids = (struct identities *) arg;
+	uint64_t i;
+	uint32_t servers;
+
+	for (i = 0; i < iterations; i++) {
+		servers = realm_route((const uint8_t *) ids->id[i % IDENTITIES], ids->len[i % IDENTITIES]);
+		BENCH_KEEP(servers);
+	}
+	ids->calls += iterations;
+}
+
+/* Realm i is "tenant<i>.vendor<i % 100>.example", in upper case one of every
+ * 8 to check that the case is ignored. */
+static int realm_name(char *buf, size_t size, uint64_t i) {
+	return snprintf(buf, size, (i & 7) ? "tenant%llu.vendor%llu.example" : "TENANT%llu.Vendor%llu.example",
+			(unsigned long long) i, (unsigned long long) (i % 100));
+}
+
+static void fill(struct identities *ids, const char *mode) {
+	char realm[IDENTITY_LEN];
+	uint64_t r;
+	int i;
+
+	for (i = 0; i < IDENTITIES; i++) {
+		r = (uint64_t) rand() % nrealms;
+		realm_name(realm, sizeof(realm), r);
+		ids->realm[i] = (int) r;
+		if (strcmp(mode, "hit") == 0)
+			ids->len[i] = snprintf(ids->id[i], IDENTITY_LEN, "device%d@%s", i, realm);
+		else if (strcmp(mode, "subdomain") == 0)
+			ids->len[i] = snprintf(ids->id[i], IDENTITY_LEN, "device%d@lab%d.%s", i, i % 10, realm);
+		else if (strcmp(mode, "miss") == 0) {
+			ids->len[i] = snprintf(ids->id[i], IDENTITY_LEN, "device%d@tenant%llu.vendor%llu.example",
+					i, (unsigned long long) (r + nrealms), (unsigned long long) (r % 100));
+			ids->realm[i] = -1;
+		} else {
+			ids->len[i] = snprintf(ids->id[i], IDENTITY_LEN, "device%d", i);
+			ids->realm[i] = -1;
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n, i, sessions;
+	struct bench_sample sample;
+	struct identities *ids;
+	struct realm_info info;
+	const char *modes[] = {"hit", "subdomain", "miss", "no_realm"};
+	char *table, *p;
+	size_t size;
+	int opt, loaded;
+
+	bench_init(argc, argv);
+	n = bench_iterations(argc, argv, 1000000);
+	for (opt = 1; opt < argc - 1; opt++)
+		if (strcmp(argv[opt], "-R") == 0)
+			nrealms = strtoull(argv[opt + 1], NULL, 10);
+
+	// "realm 10.0.0.<a>:1812 10.0.0.<b>:1812" per line.
+	table = (char *) malloc(nrealms * 80);
+	for (i = 0, p = table; i < nrealms; i++) {
+		p += realm_name(p, 80, i);
+		p += sprintf(p, " 10.0.0.%llu:1812 10.0.0.%llu:1812\n",
+				(unsigned long long) (i % SERVERS), (unsigned long long) ((i + 1) % SERVERS));
+	}
+	size = (size_t) (p - table);
+
+	bench_begin("realm");
+
+	bench_start(&sample);
+	loaded = realm_table_load_buffer(table, size, server_index, NULL);
+	bench_stop(&sample);
+	if (loaded != (int) nrealms)
+		abort();
+	bench_report_extra("compile", 1, &sample, "realms_per_s", (double) nrealms * 1e9 / (double) sample.ns);
+	realm_set_default(1u << SERVERS);
+
+	ids = (struct identities *) calloc(1, sizeof(*ids));
+	srand(1);
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		fill(ids, modes[i]);
+		bench_run(modes[i], n, lookups, ids);
+	}
+
+	// The counters of the realms add up to the sessions routed.
+	fill(ids, "hit");
+	bench_run("route", n, routes, ids);
+	sessions = realm_default_sessions();
+	for (i = 0; realm_get(i, &info) == 0; i++) {
+		if (info.servers != ((1u << (i % SERVERS)) | (1u << ((i + 1) % SERVERS))))
+			abort();
+		sessions += info.sessions;
+	}
+	if (sessions != ids->calls || realm_default_sessions() != 0)
+		abort();
+
+	bench_end();
+
+	realm_table_close();
+	free(ids);
+	free(table);
+	return 0;
+}
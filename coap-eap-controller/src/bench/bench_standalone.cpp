@@ -0,0 +1,347 @@
+/**
+ * @file bench_standalone.cpp
+ * @brief Authentications per second of the standalone and pass-through modes.
+ *
+ * Full EAP-PSK authentications of a device through the authenticator of
+ * the controller (eap_auth_interface.c), with the peer of bench_eap_peer.cpp
+ * as the device and without CoAP:
+ *
+ *  - standalone: the authenticator is the EAP server (MODE 0), the AK and
+ *    KDK of the device are looked up in a store of STORE_DEVICES devices.
+ *  - standalone_derive: the same, but the AK and KDK are derived from the
+ *    PSK of the store on every authentication.
+ *  - passthrough: the authenticator passes EAP through to a local AAA
+ *    server (MODE 1), the emulated one of the simulation (sim_aaa.c),
+ *    behind a loopback UDP socket and answered in the same thread. As in
+ *    the controller, its first Request/Identity is answered by the
+ *    authenticator. The cost of a real AAA server (FreeRADIUS) and of the
+ *    network is not included, so this is the lowest it can be.
+ *  - passthrough_loopback: the same, but the AAA server is the RADIUS
+ *    server of the controller's AAA_LOOPBACK (aaa_loopback.h), in its own
+ *    thread, and the messages go through its queues instead of the socket.
+ *    "passthrough_loopback_cpu" is the CPU time of the thread of the
+ *    authenticator (and of the peer) alone, its extra field the
+ *    microseconds per authentication: the cost of the controller, without
+ *    the one of the AAA server.
+ *
+ * Every authentication uses a new authenticator, as every session of the
+ * controller. The extra field is the number of authentications per second.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+extern "C" {
+#include "../libeapstack/eap_auth_interface.h"
+#include "radius/radius.h"
+#include "radius/radius_client.h"
+#include "../psk_store.h"
+#include "../aaa_loopback.h"
+#include "sim.h"
+}
+
+#include "bench.h"
+#include "bench_eap.h"
+
+#define SECRET "testing123"
+#define PSK "0123456789abcdef"
+/** Devices of the store, the one authenticated is in the middle.*/
+#define STORE_DEVICES 10000
+#define DEVICE_IDENTITY "device05000"
+/** Identity the authenticator sends to the AAA server, as the controller.*/
+#define AAA_IDENTITY "alpha.t.eu.org"
+#define RADIUS_BUF_LEN 4096
+
+static int aaa_sock = -1;
+
+/* The AAA server is the emulated one, behind a loopback socket. */
+static int init_aaa(void) {
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+
+	aaa_sock = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (aaa_sock < 0 || bind(aaa_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+			getsockname(aaa_sock, (struct sockaddr *) &addr, &addr_len) < 0)
+		return -1;
+
+	if (sim_aaa_init(SECRET, PSK) < 0)
+		return -1;
+	if (rad_client_init((char *) "127.0.0.1", ntohs(addr.sin_port), (char *) SECRET) == NULL)
+		return -1;
+	return 0;
+}
+
+static int init_store(void) {
+	char *buf = (char *) malloc(STORE_DEVICES * 32);
+	size_t len = 0;
+	int i, ret;
+
+	for (i = 0; i < STORE_DEVICES; i++)
+		len += (size_t) sprintf(buf + len, "device%05d %s\n", i, PSK);
+	ret = psk_store_load_buffer(buf, len);
+	free(buf);
+	return ret == STORE_DEVICES ? 0 : -1;
+}
+
+/* The AAA server answers the Access-Request sent, and the answer is
+ * received by the RADIUS client of the authenticator. */
+static void aaa_round_trip(void) {
+	uint8_t buf[RADIUS_BUF_LEN];
+	struct sockaddr_in from;
+	socklen_t from_len = sizeof(from);
+	struct radius_client_data *radius_data = get_rad_client_ctx();
+	struct radius_msg *msg;
+	uint8_t *answer;
+	int len, answer_len = 0, radius_type = RADIUS_AUTH;
+
+	len = (int) recvfrom(aaa_sock, buf, sizeof(buf), 0, (struct sockaddr *) &from, &from_len);
+	if (len <= 0)
+		abort();
+	answer = sim_aaa_request(buf, len, &answer_len, 0);
+	if (answer == NULL)
+		abort();
+	sendto(aaa_sock, answer, (size_t) answer_len, 0, (struct sockaddr *) &from, from_len);
+	free(answer);
+
+	len = (int) recv(radius_data->auth_serv_sock, buf, sizeof(buf), 0);
+	msg = len > 0 ? radius_msg_parse(buf, (size_t) len) : NULL;
+	if (msg == NULL)
+		abort();
+	radius_client_receive(msg, radius_data, &radius_type);
+}
+
+static void loopback_deliver(uint8_t *buf, int len) {
+	struct radius_msg *msg = radius_msg_parse(buf, (size_t) len);
+	int radius_type = RADIUS_AUTH;
+
+	if (msg == NULL)
+		abort();
+	radius_client_receive(msg, get_rad_client_ctx(), &radius_type);
+}
+
+/* The Access-Request has been queued by the RADIUS client, the answer is
+ * waited for as the network thread of the controller does. */
+static void loopback_round_trip(void) {
+	struct pollfd pfd;
+	fd_set rset;
+
+	FD_ZERO(&rset);
+	pfd.fd = aaa_loopback_fd_set(&rset);
+	pfd.events = POLLIN;
+	do {
+		if (poll(&pfd, 1, 1000) <= 0)
+			abort();
+	} while (aaa_loopback_process(NULL, loopback_deliver) == 0);
+}
+
+static void set_response(struct eap_auth_ctx *eap_ctx, const uint8_t *resp, size_t resp_len) {
+	eap_auth_set_eapRespData(eap_ctx, resp, resp_len);
+	eap_auth_set_eapResp(eap_ctx, TRUE);
+	eap_auth_step(eap_ctx);
+}
+
+/* The Response/Identity the controller sends to the first Request/Identity
+ * of the AAA server. */
+static void answer_aaa_identity(struct eap_auth_ctx *eap_ctx, const struct wpabuf *req) {
+	u8 identity[5 + sizeof(AAA_IDENTITY) - 1];
+
+	identity[0] = EAP_CODE_RESPONSE;
+	identity[1] = wpabuf_head_u8(req)[1];
+	WPA_PUT_BE16(&identity[2], sizeof(identity));
+	identity[4] = EAP_TYPE_IDENTITY;
+	memcpy(&identity[5], AAA_IDENTITY, sizeof(AAA_IDENTITY) - 1);
+	set_response(eap_ctx, identity, sizeof(identity));
+}
+
+/* One authentication, from the first Request/Identity to the EAP-Success
+ * received by the peer. round_trip is NULL in standalone mode. */
+static void authenticate(struct eap_auth_ctx *eap_ctx, struct eap_peer_ctx *peer, void (*round_trip)(void)) {
+	struct wpabuf *req;
+	const uint8_t *resp;
+	size_t resp_len;
+	int aaa_identity = round_trip != NULL;
+	u8 identity_id = 0;
+
+	eap_auth_set_eapRestart(eap_ctx, TRUE);
+	eap_auth_step(eap_ctx);
+
+	for (;;) {
+		if (eap_auth_get_eapFail(eap_ctx))
+			abort();
+		req = eap_auth_take_eapReqData(eap_ctx);
+		eap_auth_set_eapReq(eap_ctx, FALSE);
+		if (req == NULL)
+			abort();
+		if (aaa_identity)
+			identity_id = wpabuf_head_u8(req)[1];
+		if (bench_peer_process(peer, wpabuf_head_u8(req), wpabuf_len(req), &resp, &resp_len) < 0)
+			abort();
+		wpabuf_free(req);
+		if (eap_auth_get_eapSuccess(eap_ctx))
+			break;
+
+		set_response(eap_ctx, resp, resp_len);
+		if (round_trip == NULL)
+			continue;
+		round_trip();
+
+		// The first answer of the AAA server may be its own Request/Identity.
+		if (aaa_identity) {
+			aaa_identity = 0;
+			req = eap_auth_get_eapReqData(eap_ctx);
+			if (req == NULL || wpabuf_len(req) < 5 || wpabuf_head_u8(req)[4] != EAP_TYPE_IDENTITY)
+				continue;
+			req = eap_auth_take_eapReqData(eap_ctx);
+			eap_auth_set_eapReq(eap_ctx, FALSE);
+			if (req == NULL)
+				abort();
+			answer_aaa_identity(eap_ctx, req);
+			wpabuf_free(req);
+			round_trip();
+
+			// The identifiers of the AAA server are not those of the
+			// authenticator: its first request may have the identifier
+			// of the Request/Identity, which the peer would take as a
+			// retransmission.
+			req = eap_auth_get_eapReqData(eap_ctx);
+			if (req != NULL && wpabuf_head_u8(req)[1] == identity_id)
+				bench_peer_restart(peer);
+		}
+	}
+	bench_peer_restart(peer);
+}
+
+static void run_standalone(void *arg, uint64_t n) {
+	struct eap_peer_ctx *peer = (struct eap_peer_ctx *) arg;
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		struct eap_auth_ctx *eap_ctx = (struct eap_auth_ctx *) malloc(sizeof(*eap_ctx));
+
+		if (eap_auth_init(eap_ctx, NULL, NULL, NULL, NULL) < 0)
+			abort();
+		authenticate(eap_ctx, peer, NULL);
+		eap_auth_deinit(eap_ctx);
+		free(eap_ctx);
+	}
+}
+
+/* The authenticators stay in the list of the RADIUS client, as in the
+ * controller: only their state machines are released. */
+static void passthrough(struct eap_peer_ctx *peer, uint64_t n, void (*round_trip)(void)) {
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		struct eap_auth_ctx *eap_ctx = (struct eap_auth_ctx *) malloc(sizeof(*eap_ctx));
+
+		if (eap_auth_init(eap_ctx, NULL, NULL, NULL, NULL) < 0)
+			abort();
+		authenticate(eap_ctx, peer, round_trip);
+		eap_auth_deinit(eap_ctx);
+	}
+}
+
+static void run_passthrough(void *arg, uint64_t n) {
+	passthrough((struct eap_peer_ctx *) arg, n, aaa_round_trip);
+}
+
+static void run_passthrough_loopback(void *arg, uint64_t n) {
+	passthrough((struct eap_peer_ctx *) arg, n, loopback_round_trip);
+}
+
+static uint64_t thread_cpu_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* Warm up and one measurement, reported with the authentications per second. */
+static void run_mode(const char *name, uint64_t n, bench_fn fn, void *arg) {
+	struct bench_sample sample;
+
+	fn(arg, n / 10 + 1);
+	bench_start(&sample);
+	fn(arg, n);
+	bench_stop(&sample);
+	bench_report_extra(name, n, &sample, "auth_per_s",
+			sample.ns > 0 ? (double) n * 1e9 / (double) sample.ns : 0);
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 2000);
+	struct eap_peer_ctx *peer;
+
+	bench_init(argc, argv);
+
+	peer = bench_peer_new(DEVICE_IDENTITY, PSK);
+	if (peer == NULL || init_aaa() < 0 || init_store() < 0) {
+		fprintf(stderr, "cannot initialize the EAP state machines\n");
+		return 1;
+	}
+
+	bench_begin("standalone");
+	if (eap_auth_set_standalone(psk_store_get, psk_store_get_keys) < 0)
+		return 1;
+	run_mode("standalone", n, run_standalone, peer);
+	eap_auth_set_standalone(psk_store_get, NULL);
+	run_mode("standalone_derive", n, run_standalone, peer);
+	eap_auth_set_standalone(NULL, NULL);
+	run_mode("passthrough", n, run_passthrough, peer);
+
+	// The same, with the AAA server of AAA_LOOPBACK. The CPU time of this
+	// thread does not include the one of the AAA server.
+	struct aaa_loopback_conf loopback_conf;
+	struct bench_sample sample, cpu;
+	uint64_t cpu_start;
+
+	memset(&loopback_conf, 0, sizeof(loopback_conf));
+	loopback_conf.secret = SECRET;
+	loopback_conf.get_psk = psk_store_get;
+	if (aaa_loopback_init(&loopback_conf) < 0)
+		return 1;
+	radius_client_set_transport(get_rad_client_ctx(), aaa_loopback_send, NULL);
+	run_passthrough_loopback(peer, n / 10 + 1);
+	cpu_start = thread_cpu_ns();
+	bench_start(&sample);
+	run_passthrough_loopback(peer, n);
+	bench_stop(&sample);
+	cpu = sample;
+	cpu.ns = thread_cpu_ns() - cpu_start;
+	bench_report_extra("passthrough_loopback", n, &sample, "auth_per_s",
+			sample.ns > 0 ? (double) n * 1e9 / (double) sample.ns : 0);
+	bench_report_extra("passthrough_loopback_cpu", n, &cpu, "cpu_us_per_auth", (double) cpu.ns / 1e3 / (double) n);
+	bench_end();
+	aaa_loopback_deinit();
+
+	bench_peer_free(peer);
+	psk_store_close();
+	sim_aaa_deinit();
+	return 0;
+}
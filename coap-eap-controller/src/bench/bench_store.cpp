@@ -0,0 +1,163 @@
+/**
+ * @file bench_store.cpp
+ * @brief Warm restart with the session store.
+ *
+ * Fills the session store with N sessions in progress (100000 by default),
+ * simulates a crash of the controller while some of them are being
+ * written, and measures:
+ *
+ *  - save: cost of writing the state of a session after each event.
+ *  - restart: time from opening the store again until every session has
+ *    been rebuilt and can be served, and the percentage of the sessions
+ *    in progress that have been recovered.
+ *
+ * Sessions whose record was being written when the process died are
+ * discarded, they are the only ones that must be lost.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern "C" {
+#include "../session_store.h"
+#include "../state_machines/coap_eap_flow.h"
+}
+
+#include "bench.h"
+
+#define STORE_PATH "/tmp/bench_session_store.db"
+/** One of every TORN_EVERY sessions is being written when the process dies.*/
+#define TORN_EVERY 1000
+
+/* What the controller rebuilds from a record (see restore_coap_eap_session). */
+struct bench_session {
+	uint32_t session_id;
+	uint16_t message_id;
+	int waiting;
+	char *location;
+	uint8_t *lastSentMessage;
+	int lastSentMessage_len;
+	uint8_t *lastReceivedMessage;
+	int lastReceivedMessage_len;
+};
+
+static struct bench_session **restored;
+static uint64_t nrestored = 0;
+
+/* Realistic sizes: a POST with an EAP request, the ACK with the response. */
+static void fill_record(struct session_record *r, uint32_t i) {
+	r->session_id = 0x10000000 + i;
+	r->message_id = (uint16_t) (i % 7 + 1);
+	r->waiting = (i & 1) ? FLOW_EV_RADIUS : FLOW_EV_ACK;
+	r->passthrough = 1;
+	r->eap_id = (int16_t) (i & 0xff);
+	r->rtx_counter = 0;
+	r->eap_workarround = 1;
+	r->eap_success = 0;
+	r->key_len = 0;
+	r->rt = 2.5;
+	r->rt_init = 2.5;
+	memset(&r->addr, 0, sizeof(r->addr));
+	r->addr.ss_family = AF_INET6;
+	strcpy(r->location, "/a/1");
+	memset(r->userID, 0, sizeof(r->userID));
+	r->identity_len = 14;
+	memcpy(r->identity, "alpha.t.eu.org", 14);
+	r->radius_state_len = 18;
+	memset(r->radius_state, (int) i, 18);
+	r->sent_len = 120;
+	memset(r->sent, 0x42, 120);
+	r->received_len = 60;
+	memset(r->received, 0x24, 60);
+}
+
+static int restore_session(int slot, const struct session_record *r, void *arg) {
+	struct bench_session *s = (struct bench_session *) malloc(sizeof(*s));
+
+	s->session_id = r->session_id;
+	s->message_id = r->message_id;
+	s->waiting = r->waiting;
+	s->location = strdup(r->location);
+	s->lastSentMessage = (uint8_t *) malloc(r->sent_len);
+	memcpy(s->lastSentMessage, r->sent, r->sent_len);
+	s->lastSentMessage_len = r->sent_len;
+	s->lastReceivedMessage = (uint8_t *) malloc(r->received_len);
+	memcpy(s->lastReceivedMessage, r->received, r->received_len);
+	s->lastReceivedMessage_len = r->received_len;
+
+	restored[nrestored++] = s;
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 100000);
+	struct bench_sample sample;
+	uint64_t i, torn = 0;
+	int slot;
+
+	unlink(STORE_PATH);
+	if (session_store_open(STORE_PATH, (uint32_t) n) < 0) {
+		fprintf(stderr, "cannot open %s\n", STORE_PATH);
+		return 1;
+	}
+	session_store_recover(NULL, NULL);
+
+	bench_begin("store");
+
+	bench_start(&sample);
+	for (i = 0; i < n; i++) {
+		slot = session_store_alloc();
+		if (slot < 0)
+			abort();
+		fill_record(session_store_begin(slot), (uint32_t) i);
+		session_store_commit(slot);
+	}
+	bench_stop(&sample);
+	bench_report_extra("save", n, &sample, "slot_bytes", (double) sizeof(struct session_slot));
+
+	// The crash: some sessions are being updated and the store is unmapped
+	// without releasing anything.
+	for (i = 0; i < n; i += TORN_EVERY) {
+		struct session_record *r = session_store_begin((int) i);
+		r->message_id++;
+		torn++;
+	}
+	session_store_close();
+
+	restored = (struct bench_session **) malloc(n * sizeof(*restored));
+
+	bench_start(&sample);
+	if (session_store_open(STORE_PATH, (uint32_t) n) < 0)
+		abort();
+	session_store_recover(restore_session, NULL);
+	bench_stop(&sample);
+
+	if (nrestored != n - torn)
+		abort();
+	bench_report_extra("restart", 1, &sample, "recovered_pct", 100.0 * (double) nrestored / (double) n);
+
+	bench_end();
+
+	session_store_close();
+	unlink(STORE_PATH);
+	return 0;
+}
@@ -0,0 +1,290 @@
+/**
+ * @file bench_tls.cpp
+ * @brief TLS handshakes per second of the EAP-TLS server, full and resumed.
+ *
+ * The TLS server is the one of EAP-TLS in standalone mode (tls_internal.c),
+ * with the shared context of eap_auth_set_tls(), and the client is the TLS
+ * client of the same library (tlsv1_client.c), in the same thread:
+ *
+ *  - full: every handshake is a full one (RSA key exchange), with a new
+ *    client every time.
+ *  - session_id: the client resumes its session by session ID, the server
+ *    keeps it in its session cache.
+ *  - ticket: the client resumes its session with a session ticket (RFC
+ *    5077), the server keeps nothing.
+ *
+ * and the modular exponentiations of the internal bignum (libtommath.c)
+ * that dominate a full handshake:
+ *
+ *  - rsa2048_sign: RSA-2048 private key operation (with CRT), as in the
+ *    ClientKeyExchange of the server or the signature of a client.
+ *  - dh_group5: g^x mod p of the 1536-bit MODP group 5, with a 1536-bit x.
+ *
+ * The server uses bench_tls.pem and bench_tls.key, made by the Makefile.
+ * The extra field is the number of operations per second.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "utils/includes.h"
+#include "utils/common.h"
+#include "utils/wpabuf.h"
+#include "utils/base64.h"
+#include "utils/os.h"
+#include "crypto/crypto.h"
+#include "crypto/dh_groups.h"
+#include "crypto/tls.h"
+#include "tls/tlsv1_client.h"
+}
+
+#include "bench.h"
+
+#define SERVER_CERT "bench_tls.pem"
+#define SERVER_KEY "bench_tls.key"
+#define CACHE_SIZE 10000
+#define LIFETIME 3600
+/** Flights of a full handshake, with some margin.*/
+#define MAX_ROUNDS 6
+
+struct tls_mode {
+	void *tls_ctx;
+	struct tlsv1_client *client; /* NULL, a new client every time */
+	int tickets;
+};
+
+static void *server_init(size_t cache_size, int tickets) {
+	struct tls_config tconf;
+	struct tls_connection_params params;
+	void *tls_ctx;
+
+	memset(&tconf, 0, sizeof(tconf));
+	tls_ctx = tls_init(&tconf);
+	if (tls_ctx == NULL)
+		return NULL;
+
+	memset(&params, 0, sizeof(params));
+	params.client_cert = SERVER_CERT;
+	params.private_key = SERVER_KEY;
+	if (tls_global_set_params(tls_ctx, &params) < 0 ||
+			tls_global_set_session_cache(tls_ctx, cache_size, LIFETIME, tickets) < 0) {
+		tls_deinit(tls_ctx);
+		return NULL;
+	}
+	return tls_ctx;
+}
+
+/* One handshake, from the ClientHello to the last flight. Returns 1 if the
+ * session was resumed, 0 if not and -1 on error. */
+static int handshake(void *tls_ctx, struct tlsv1_client *client) {
+	struct tls_connection *conn = tls_connection_init(tls_ctx);
+	struct wpabuf *in, *resp = NULL;
+	size_t out_len;
+	u8 *out;
+	int round, ret = -1;
+
+	if (conn == NULL || tls_connection_set_verify(tls_ctx, conn, 0) < 0)
+		goto out;
+
+	out = tlsv1_client_handshake(client, NULL, 0, &out_len, NULL, NULL);
+	for (round = 0; out != NULL && round < MAX_ROUNDS; round++) {
+		in = wpabuf_alloc_ext_data(out, out_len);
+		if (in == NULL) {
+			os_free(out);
+			goto out;
+		}
+		resp = tls_connection_server_handshake(tls_ctx, conn, in, NULL);
+		wpabuf_free(in);
+		if (resp == NULL)
+			goto out;
+		if (tlsv1_client_established(client) &&
+				tls_connection_established(tls_ctx, conn))
+			break;
+		out = tlsv1_client_handshake(client, wpabuf_head_u8(resp), wpabuf_len(resp),
+				&out_len, NULL, NULL);
+		wpabuf_free(resp);
+		resp = NULL;
+		if (out != NULL && tlsv1_client_established(client) &&
+				tls_connection_established(tls_ctx, conn)) {
+			os_free(out);
+			break;
+		}
+	}
+
+	if (tlsv1_client_established(client) && tls_connection_established(tls_ctx, conn))
+		ret = tls_connection_resumed(tls_ctx, conn);
+out:
+	wpabuf_free(resp);
+	tls_connection_deinit(tls_ctx, conn);
+	return ret;
+}
+
+static void run_full(void *arg, uint64_t n) {
+	struct tls_mode *mode = (struct tls_mode *) arg;
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		struct tlsv1_client *client = tlsv1_client_init();
+
+		if (client == NULL || handshake(mode->tls_ctx, client) != 0)
+			abort();
+		tlsv1_client_deinit(client);
+	}
+}
+
+/* The client keeps its session, or its ticket, from one handshake to the
+ * next one. */
+static void run_resumed(void *arg, uint64_t n) {
+	struct tls_mode *mode = (struct tls_mode *) arg;
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		if (tlsv1_client_shutdown(mode->client) < 0 ||
+				handshake(mode->tls_ctx, mode->client) != 1)
+			abort();
+	}
+}
+
+static void run_rsa_sign(void *arg, uint64_t n) {
+	struct crypto_private_key *key = (struct crypto_private_key *) arg;
+	u8 hash[36], sig[256];
+	size_t sig_len;
+	uint64_t i;
+
+	memset(hash, 0x5a, sizeof(hash));
+	for (i = 0; i < n; i++) {
+		hash[0] = (u8) i;
+		sig_len = sizeof(sig);
+		if (crypto_private_key_sign_pkcs1(key, hash, sizeof(hash), sig, &sig_len) < 0)
+			abort();
+		BENCH_KEEP(sig[0]);
+	}
+}
+
+static void run_dh(void *arg, uint64_t n) {
+	const struct dh_group *dh = (const struct dh_group *) arg;
+	u8 priv[192], pub[192];
+	size_t pub_len;
+	uint64_t i;
+
+	if (os_get_random(priv, dh->prime_len) < 0)
+		abort();
+	priv[0] &= 0x7f;
+	for (i = 0; i < n; i++) {
+		priv[dh->prime_len - 1] = (u8) i;
+		pub_len = sizeof(pub);
+		if (crypto_mod_exp(dh->generator, dh->generator_len, priv, dh->prime_len,
+				dh->prime, dh->prime_len, pub, &pub_len) < 0)
+			abort();
+		BENCH_KEEP(pub[0]);
+	}
+}
+
+/* The private key of the server, from its PEM (PKCS #8 or PKCS #1). */
+static struct crypto_private_key *load_key(void) {
+	struct crypto_private_key *key = NULL;
+	char *pem, *start, *end;
+	unsigned char *der;
+	size_t len;
+
+	pem = os_readfile(SERVER_KEY, &len);
+	if (pem == NULL)
+		return NULL;
+	start = strstr(pem, "-----\n");
+	end = start != NULL ? strstr(start + 6, "-----END") : NULL;
+	if (end != NULL) {
+		der = base64_decode((unsigned char *) start + 6, end - start - 6, &len);
+		if (der != NULL)
+			key = crypto_private_key_import(der, len, NULL);
+		os_free(der);
+	}
+	os_free(pem);
+	return key;
+}
+
+/* Warm up and one measurement, reported with the operations per second. */
+static void run_mode(const char *name, const char *extra, uint64_t n, bench_fn fn, void *arg) {
+	struct bench_sample sample;
+
+	fn(arg, n / 10 + 1);
+	bench_start(&sample);
+	fn(arg, n);
+	bench_stop(&sample);
+	bench_report_extra(name, n, &sample, extra,
+			sample.ns > 0 ? (double) n * 1e9 / (double) sample.ns : 0);
+}
+
+/* The first handshake of a client is a full one. */
+static int resumed_mode_init(struct tls_mode *mode, size_t cache_size, int tickets) {
+	mode->tls_ctx = server_init(cache_size, tickets);
+	mode->client = tlsv1_client_init();
+	if (mode->tls_ctx == NULL || mode->client == NULL)
+		return -1;
+	tlsv1_client_set_session_tickets(mode->client, tickets);
+	return handshake(mode->tls_ctx, mode->client) == 0 ? 0 : -1;
+}
+
+static void mode_deinit(struct tls_mode *mode) {
+	if (mode->client != NULL)
+		tlsv1_client_deinit(mode->client);
+	if (mode->tls_ctx != NULL)
+		tls_deinit(mode->tls_ctx);
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 200);
+	struct tls_mode full, session_id, ticket;
+	struct crypto_private_key *key;
+	const struct dh_group *dh = dh_groups_get(5);
+
+	bench_init(argc, argv);
+
+	memset(&full, 0, sizeof(full));
+	memset(&session_id, 0, sizeof(session_id));
+	memset(&ticket, 0, sizeof(ticket));
+	full.tls_ctx = server_init(CACHE_SIZE, 0);
+	if (full.tls_ctx == NULL || resumed_mode_init(&session_id, CACHE_SIZE, 0) < 0 ||
+			resumed_mode_init(&ticket, 0, 1) < 0) {
+		fprintf(stderr, "cannot initialize TLS with %s and %s\n", SERVER_CERT, SERVER_KEY);
+		return 1;
+	}
+	key = load_key();
+	if (key == NULL || dh == NULL) {
+		fprintf(stderr, "cannot load %s\n", SERVER_KEY);
+		return 1;
+	}
+
+	bench_begin("tls");
+	run_mode("full", "handshakes_per_s", n, run_full, &full);
+	run_mode("session_id", "handshakes_per_s", n * 10, run_resumed, &session_id);
+	run_mode("ticket", "handshakes_per_s", n * 10, run_resumed, &ticket);
+	run_mode("rsa2048_sign", "ops_per_s", n, run_rsa_sign, key);
+	run_mode("dh_group5", "ops_per_s", n, run_dh, (void *) dh);
+	bench_end();
+
+	crypto_private_key_free(key);
+
+	mode_deinit(&ticket);
+	mode_deinit(&session_id);
+	mode_deinit(&full);
+	return 0;
+}
@@ -0,0 +1,180 @@
+/**
+ * @file bench_wpabuf.cpp
+ * @brief Cost of the wpabufs of the EAP messages, with and without their pool.
+ *
+ * Every operation is a session of SESSION_MESSAGES messages, and every
+ * message allocates and frees the buffers it would in the EAP state machines
+ * and the RADIUS code: the EAP request, the copy of the response, a RADIUS
+ * message grown attribute by attribute, the EAP-Message taken from it, and
+ * the copy of the last request kept by the session until it ends.
+ *
+ *  - session_heap: the buffers are taken from the heap
+ *    (wpabuf_pool_enable(0)), as without CONFIG_WPABUF_POOL.
+ *  - session_pool: from the free lists of the thread.
+ *  - session_arena: from an arena of the session, released once it ends.
+ *  The extra field is the percentage of wpabufs that did not need the heap
+ *  (wpabuf_pool_get_stats()), allocs_per_op are all the allocations.
+ *  - threads_heap, threads_pool: the same with THREADS threads, every one
+ *    with its sessions, the extra field is the number of sessions per
+ *    second between all of them.
+ *
+ * psk_exchange_heap in bench_eap is the full EAP-PSK exchange from the heap.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+extern "C" {
+#include "includes.h"
+#include "common.h"
+}
+
+#include "bench.h"
+
+#define SESSION_MESSAGES 4
+#define EAP_LEN 64
+#define RADIUS_HDR_LEN 20
+#define RADIUS_ATTRS 6
+#define RADIUS_ATTR_LEN 40
+#define THREADS 4
+
+/* The buffers of a message, *last is the copy kept by the session. */
+static void message(struct wpabuf **last) {
+	struct wpabuf *req, *resp, *radius, *eap;
+	int i;
+
+	req = wpabuf_alloc(EAP_LEN);
+	if (req == NULL)
+		abort();
+	memset(wpabuf_put(req, EAP_LEN), 1, EAP_LEN);
+	resp = wpabuf_alloc_copy(wpabuf_head(req), wpabuf_len(req));
+	radius = wpabuf_alloc(RADIUS_HDR_LEN);
+	if (resp == NULL || radius == NULL)
+		abort();
+
+	wpabuf_put(radius, RADIUS_HDR_LEN);
+	for (i = 0; i < RADIUS_ATTRS; i++) {
+		if (wpabuf_resize(&radius, RADIUS_ATTR_LEN) < 0)
+			abort();
+		wpabuf_put_data(radius, wpabuf_head(resp), RADIUS_ATTR_LEN);
+	}
+	eap = wpabuf_alloc_ext_data((u8 *) os_malloc(EAP_LEN), EAP_LEN);
+	if (eap == NULL)
+		abort();
+	memcpy(wpabuf_mhead(eap), wpabuf_head(resp), EAP_LEN);
+
+	wpabuf_free(*last);
+	*last = wpabuf_dup(req);
+	BENCH_KEEP(wpabuf_head_u8(radius)[RADIUS_HDR_LEN]);
+	wpabuf_free(req);
+	wpabuf_free(resp);
+	wpabuf_free(radius);
+	wpabuf_free(eap);
+}
+
+static void run_sessions(void *arg, uint64_t n) {
+	int arena = arg != NULL;
+	struct wpabuf *last;
+	uint64_t i;
+	int m;
+
+	for (i = 0; i < n; i++) {
+		struct wpabuf_arena *session = arena ? wpabuf_arena_new() : NULL;
+		struct wpabuf_arena *prev = wpabuf_arena_set(session);
+
+		last = NULL;
+		for (m = 0; m < SESSION_MESSAGES; m++)
+			message(&last);
+		wpabuf_arena_set(prev);
+		wpabuf_free(last);
+		wpabuf_arena_free(session);
+	}
+}
+
+static void *sessions_thread(void *arg) {
+	run_sessions(NULL, *(uint64_t *) arg);
+	wpabuf_pool_flush();
+	return NULL;
+}
+
+static void run_threads(void *arg, uint64_t n) {
+	pthread_t threads[THREADS];
+	uint64_t per_thread = n / THREADS;
+	int i;
+
+	for (i = 0; i < THREADS; i++)
+		if (pthread_create(&threads[i], NULL, sessions_thread, &per_thread) != 0)
+			abort();
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/* One warm-up and one measure, the extra field is the percentage of the
+ * wpabufs of this thread that did not need the heap. */
+static void measure(const char *name, uint64_t n, bench_fn fn, void *arg) {
+	struct wpabuf_pool_stats before, after;
+	struct bench_sample sample;
+	unsigned long allocs, heap;
+
+	fn(arg, n / 10 + 1);
+	wpabuf_pool_get_stats(&before);
+	bench_start(&sample);
+	fn(arg, n);
+	bench_stop(&sample);
+	wpabuf_pool_get_stats(&after);
+
+	allocs = after.allocs - before.allocs;
+	heap = after.heap_allocs - before.heap_allocs;
+	bench_report_extra(name, n, &sample, "no_heap_pct",
+			allocs > 0 && heap < allocs ? 100.0 * (double) (allocs - heap) / (double) allocs : 0);
+}
+
+static void measure_threads(const char *name, uint64_t n) {
+	struct bench_sample sample;
+
+	n -= n % THREADS;
+	run_threads(NULL, n / 10 + THREADS);
+	bench_start(&sample);
+	run_threads(NULL, n);
+	bench_stop(&sample);
+	bench_report_extra(name, n, &sample, "sessions_per_s",
+			sample.ns > 0 ? (double) n * 1e9 / (double) sample.ns : 0);
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t n = bench_iterations(argc, argv, 200000);
+	int arena = 1;
+
+	bench_init(argc, argv);
+	bench_begin("wpabuf");
+
+	wpabuf_pool_enable(0);
+	measure("session_heap", n, run_sessions, NULL);
+	measure_threads("threads_heap", n);
+
+	wpabuf_pool_enable(1);
+	measure("session_pool", n, run_sessions, NULL);
+	measure("session_arena", n, run_sessions, &arena);
+	measure_threads("threads_pool", n);
+
+	bench_end();
+	return 0;
+}
@@ -0,0 +1,191 @@
+/**
+ * @file check_sha.cpp
+ * @brief Known-answer test of the SHA-1 and SHA-256 of the EAP library.
+ *
+ * sha1-internal.c and sha256-internal.c have two backends: the portable
+ * code and the x86 SHA extensions (sha_x86.c), used when the CPU has them.
+ * Both are checked:
+ *
+ *  - against the examples of FIPS 180-2 ("abc", the two block message and
+ *    one million 'a', this one given in chunks of 1000 bytes).
+ *  - against OpenSSL, for every length from 0 to MAX_LEN bytes, hashed in
+ *    one piece and split in chunks of CHUNKS bytes (sha1_vector and
+ *    sha256_vector with several elements), so that the partial blocks
+ *    carried from an element to the next are covered.
+ *
+ * Prints a JSON document in stdout and returns 1 if any digest is wrong,
+ * the wrong ones are printed in stderr. "make check" runs it.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <openssl/sha.h>
+
+extern "C" {
+#include "includes.h"
+#include "common.h"
+#include "crypto/crypto.h"
+#include "crypto/sha1.h"
+#include "crypto/sha256.h"
+#include "crypto/sha_x86.h"
+}
+
+#define MAX_LEN 300
+/** Maximum number of elements of a vector, MAX_LEN in chunks of 1 byte.*/
+#define MAX_ELEMS MAX_LEN
+
+/** Chunk sizes, around the 64 byte block of both hashes.*/
+static const size_t CHUNKS[] = { 1, 3, 55, 63, 64, 65, 127 };
+
+static u8 input[MAX_LEN];
+static int checked, failed;
+
+typedef int (*hash_vector_fn)(size_t num, const u8 *addr[], const size_t *len, u8 *mac);
+
+struct hash {
+	const char *name;
+	size_t len;
+	hash_vector_fn vector;
+	/**FIPS 180-2 digests of "abc", of the two block message and of one
+	 * million 'a'.*/
+	const char *abc, *two_blocks, *million;
+};
+
+static const char TWO_BLOCKS[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+
+static const struct hash hashes[] = {
+	{ "sha1", SHA1_MAC_LEN, sha1_vector,
+	  "a9993e364706816aba3e25717850c26c9cd0d89d",
+	  "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+	  "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+	{ "sha256", SHA256_MAC_LEN, sha256_vector,
+	  "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+	  "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+	  "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+
+static void check(const struct hash *h, const char *backend, const char *what,
+		size_t len, size_t chunk, const u8 *mac, const u8 *expected) {
+	char hex[2 * SHA256_MAC_LEN + 1];
+	size_t i;
+
+	checked++;
+	if (memcmp(mac, expected, h->len) == 0)
+		return;
+	failed++;
+	for (i = 0; i < h->len; i++)
+		sprintf(hex + 2 * i, "%02x", mac[i]);
+	fprintf(stderr, "%s %s: %s, %u bytes in chunks of %u: %s\n", h->name, backend,
+			what, (unsigned int) len, (unsigned int) chunk, hex);
+}
+
+static void check_hex(const struct hash *h, const char *backend, const char *what,
+		size_t len, size_t chunk, const u8 *mac, const char *expected) {
+	u8 bin[SHA256_MAC_LEN];
+
+	hexstr2bin(expected, bin, h->len);
+	check(h, backend, what, len, chunk, mac, bin);
+}
+
+/* Hashes the len bytes of data in chunks of chunk bytes. */
+static void hash_chunks(const struct hash *h, const u8 *data, size_t len, size_t chunk, u8 *mac) {
+	const u8 *addr[MAX_ELEMS];
+	size_t lens[MAX_ELEMS];
+	size_t num = 0, off;
+
+	for (off = 0; off < len; off += chunk, num++) {
+		addr[num] = data + off;
+		lens[num] = len - off < chunk ? len - off : chunk;
+	}
+	h->vector(num, addr, lens, mac);
+}
+
+static void check_fips(const struct hash *h, const char *backend) {
+	static u8 a[1000];
+	const u8 *addr[1000];
+	size_t lens[1000];
+	u8 mac[SHA256_MAC_LEN];
+	size_t i;
+
+	hash_chunks(h, (const u8 *) "abc", 3, 3, mac);
+	check_hex(h, backend, "abc", 3, 3, mac, h->abc);
+	hash_chunks(h, (const u8 *) TWO_BLOCKS, strlen(TWO_BLOCKS), strlen(TWO_BLOCKS), mac);
+	check_hex(h, backend, "two blocks", strlen(TWO_BLOCKS), strlen(TWO_BLOCKS), mac, h->two_blocks);
+
+	memset(a, 'a', sizeof(a));
+	for (i = 0; i < 1000; i++) {
+		addr[i] = a;
+		lens[i] = sizeof(a);
+	}
+	h->vector(1000, addr, lens, mac);
+	check_hex(h, backend, "million a", 1000000, sizeof(a), mac, h->million);
+}
+
+static void check_lengths(const struct hash *h, const char *backend) {
+	u8 mac[SHA256_MAC_LEN], expected[SHA256_MAC_LEN];
+	size_t len, c;
+
+	for (len = 0; len <= MAX_LEN; len++) {
+		if (h->len == SHA1_MAC_LEN)
+			SHA1(input, len, expected);
+		else
+			SHA256(input, len, expected);
+
+		hash_chunks(h, input, len, len > 0 ? len : 1, mac);
+		check(h, backend, "openssl", len, len, mac, expected);
+		for (c = 0; c < sizeof(CHUNKS) / sizeof(CHUNKS[0]); c++) {
+			if (CHUNKS[c] >= len)
+				break;
+			hash_chunks(h, input, len, CHUNKS[c], mac);
+			check(h, backend, "openssl", len, CHUNKS[c], mac, expected);
+		}
+	}
+}
+
+static void check_backend(const char *backend) {
+	size_t i;
+
+	for (i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++) {
+		check_fips(&hashes[i], backend);
+		check_lengths(&hashes[i], backend);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	u32 x = 0x12345678;
+	int shani;
+	size_t i;
+
+	/* Not a repeated pattern, a wrong word order shows up. */
+	for (i = 0; i < sizeof(input); i++) {
+		x = x * 1103515245 + 12345;
+		input[i] = (u8) (x >> 16);
+	}
+
+	sha_x86_enable(0);
+	check_backend("scalar");
+	shani = sha_x86_enable(1);
+	if (shani)
+		check_backend("shani");
+
+	printf("{\"check\": \"sha\", \"shani\": %d, \"checked\": %d, \"failed\": %d}\n",
+			shani, checked, failed);
+	return failed > 0;
+}
@@ -70,6 +70,7 @@ CoapPDU::CoapPDU() {
 	//options
 	_numOptions = 0;
 	_maxAddedOptionNumber = 0;
+	_optionIndexValid = 0;
 
 	// payload
 	_payloadPointer = NULL;
@@ -157,6 +158,7 @@ CoapPDU::CoapPDU(uint8_t *buffer, int bufferLength, int pduLength) {
 	// options
 	_numOptions = 0;
 	_maxAddedOptionNumber = 0;
+	_optionIndexValid = 0;
 
 	// payload
 	_payloadPointer = NULL;
@@ -193,6 +195,7 @@ int CoapPDU::reset() {
 	// options
 	_numOptions = 0;
 	_maxAddedOptionNumber = 0;
+	_optionIndexValid = 0;
 	// payload
 	_payloadPointer = NULL;
 	_payloadLength = 0;
@@ -207,9 +210,16 @@ int CoapPDU::reset() {
  * \warning The validation call parses the PDU structure to set some internal parameters. If you do
  * not validate the PDU, then the behaviour of member access functions will be undefined.
  *
+ * The options found are recorded in the option index, so that CoapPDU::getOptionPointer(),
+ * CoapPDU::getURI() and the other accessors do not walk the PDU again. If the PDU buffer is
+ * changed directly, validate it again.
+ *
  * \return 1 if the PDU validates correctly, 0 if not. XXX maybe add some error codes
  */
 int CoapPDU::validate() {
+	// the option index is rebuilt below
+	_optionIndexValid = 0;
+
 	if(_pduLength<4) {
 		DBG("PDU has to be a minimum of 4 bytes. This: %d bytes",_pduLength);
 		return 0;
@@ -266,7 +276,7 @@ int CoapPDU::validate() {
 
 	// token can be anything so nothing to check
 
-	// check that options all make sense
+	// check that options all make sense, the first ones are recorded in the index
 	uint16_t optionDelta =0, optionNumber = 0, optionValueLength = 0;
 	int totalLength = 0;
 
@@ -278,6 +288,7 @@ int CoapPDU::validate() {
 		DBG("No options. No payload.");
 		_numOptions = 0;
 		_payloadLength = 0;
+		_optionIndexValid = 1;
 		return 1;
 	}
 
@@ -296,6 +307,7 @@ int CoapPDU::validate() {
 					_payloadPointer = &_pdu[optionPos+1];
 					_payloadLength = (bytesRemaining-1);
 					_numOptions = numOptions;
+					_optionIndexValid = 1;
 					DBG("Payload found, length: %d",_payloadLength);
 					return 1;
 				}
@@ -319,6 +331,7 @@ int CoapPDU::validate() {
 			_payloadPointer = NULL;
 			_payloadLength = 0;
 			_numOptions = numOptions;
+			_optionIndexValid = 1;
 			return 1;
 		}
 
@@ -357,6 +370,17 @@ int CoapPDU::validate() {
 		}
 		DBG("Enough space for option payload: %d %d",optionValueLength,(totalLength-headerBytesNeeded-1));
 
+		// record option details
+		if(numOptions<COAP_OPTION_INDEX_LENGTH) {
+			CoapOption *o = &_optionIndex[numOptions];
+			o->optionNumber = optionNumber;
+			o->optionDelta = optionDelta;
+			o->optionValueLength = optionValueLength;
+			o->totalLength = totalLength;
+			o->optionPointer = &_pdu[optionPos];
+			o->optionValuePointer = &_pdu[optionPos+totalLength-optionValueLength];
+		}
+
 		// recompute bytesRemaining
 		bytesRemaining -= totalLength;
 		bytesRemaining++; // correct for previous --
@@ -538,9 +562,8 @@ int CoapPDU::addURIQuery(char *query) {
 //  OPTION
 uint8_t* CoapPDU::getOptionPointer(uint8_t OPTION){
 	// get options
-	CoapPDU::CoapOption *options = getOptions();
+	CoapPDU::CoapOption *options = indexOptions();
 	if(options==NULL) {
-		free(options);
 		return 0;
 	}
 	// iterate over options to construct URI
@@ -549,22 +572,21 @@ uint8_t* CoapPDU::getOptionPointer(uint8_t OPTION){
 	for(int i=0; i<_numOptions; i++) {
 		o = &options[i];
 		if(o->optionNumber==OPTION) {
-			// if the option is a query, change the separator to &
-			free(options);
-			return o->optionValuePointer;
+			uint8_t *value = o->optionValuePointer;
+			releaseOptions(options);
+			return value;
 			
 		}
 	}
-	free(options);
+	releaseOptions(options);
 	return NULL;
 	
 }
 
 int CoapPDU::getOptionLength(uint8_t OPTION){
 	// get options
-	CoapPDU::CoapOption *options = getOptions();
+	CoapPDU::CoapOption *options = indexOptions();
 	if(options==NULL) {
-		free(options);
 		return 0;
 	}
 	// iterate over options to construct URI
@@ -572,13 +594,13 @@ int CoapPDU::getOptionLength(uint8_t OPTION){
 	for(int i=0; i<_numOptions; i++) {
 		o = &options[i];
 		if(o->optionNumber==OPTION) {
-			// if the option is a query, change the separator to &
-			free(options);
-			return o->optionValueLength;
+			int value = o->optionValueLength;
+			releaseOptions(options);
+			return value;
 		}
 	}
 	
-	free(options);
+	releaseOptions(options);
 	return 0;
 	
 }
@@ -625,7 +647,7 @@ int CoapPDU::getLocation(char *dst, int dstlen, int *outLen) {
 		return 0;
 	}
 	// get options
-	CoapPDU::CoapOption *options = getOptions();
+	CoapPDU::CoapOption *options = indexOptions();
 	if(options==NULL) {
 		*dst = 0x00;
 		*outLen = 0;
@@ -642,7 +664,7 @@ int CoapPDU::getLocation(char *dst, int dstlen, int *outLen) {
 		bytesLeft--;
 	} else {
 		DBG("No space for initial slash needed 1, got %d",bytesLeft);
-		free(options);
+		releaseOptions(options);
 		return 1;
 	}
 
@@ -666,7 +688,7 @@ int CoapPDU::getLocation(char *dst, int dstlen, int *outLen) {
 			// check space
 			if(oLen>bytesLeft) {
 				DBG("Destination buffer too small, needed %d, got %d",oLen,bytesLeft);
-				free(options);
+				releaseOptions(options);
 				return 1;
 			}
 
@@ -674,7 +696,7 @@ int CoapPDU::getLocation(char *dst, int dstlen, int *outLen) {
 			if(oLen==1&&o->optionValuePointer[0]=='/') {
 				*dst = 0x00;
 				*outLen = 1;
-				free(options);
+				releaseOptions(options);
 				return 0;
 			}
 
@@ -692,7 +714,7 @@ int CoapPDU::getLocation(char *dst, int dstlen, int *outLen) {
 				bytesLeft--;
 			} else {
 				DBG("Ran out of space after processing option");
-				free(options);
+				releaseOptions(options);
 				return 1;
 			}
 		}
@@ -704,7 +726,7 @@ int CoapPDU::getLocation(char *dst, int dstlen, int *outLen) {
 	// add null terminating byte (always space since reserved)
 	*dst = 0x00;
 	*outLen = (dstlen-1)-bytesLeft;
-	free(options);
+	releaseOptions(options);
 	return 0;
 }
 
@@ -747,7 +769,7 @@ int CoapPDU::getURI(char *dst, int dstlen, int *outLen) {
 		return 0;
 	}
 	// get options
-	CoapPDU::CoapOption *options = getOptions();
+	CoapPDU::CoapOption *options = indexOptions();
 	if(options==NULL) {
 		*dst = 0x00;
 		*outLen = 0;
@@ -764,7 +786,7 @@ int CoapPDU::getURI(char *dst, int dstlen, int *outLen) {
 		bytesLeft--;
 	} else {
 		DBG("No space for initial slash needed 1, got %d",bytesLeft);
-		free(options);
+		releaseOptions(options);
 		return 1;
 	}
 
@@ -788,7 +810,7 @@ int CoapPDU::getURI(char *dst, int dstlen, int *outLen) {
 			// check space
 			if(oLen>bytesLeft) {
 				DBG("Destination buffer too small, needed %d, got %d",oLen,bytesLeft);
-				free(options);
+				releaseOptions(options);
 				return 1;
 			}
 
@@ -796,7 +818,7 @@ int CoapPDU::getURI(char *dst, int dstlen, int *outLen) {
 			if(oLen==1&&o->optionValuePointer[0]=='/') {
 				*dst = 0x00;
 				*outLen = 1;
-				free(options);
+				releaseOptions(options);
 				return 0;
 			}
 
@@ -814,7 +836,7 @@ int CoapPDU::getURI(char *dst, int dstlen, int *outLen) {
 				bytesLeft--;
 			} else {
 				DBG("Ran out of space after processing option");
-				free(options);
+				releaseOptions(options);
 				return 1;
 			}
 		}
@@ -826,7 +848,7 @@ int CoapPDU::getURI(char *dst, int dstlen, int *outLen) {
 	// add null terminating byte (always space since reserved)
 	*dst = 0x00;
 	*outLen = (dstlen-1)-bytesLeft;
-	free(options);
+	releaseOptions(options);
 	return 0;
 }
 
@@ -881,6 +903,8 @@ int CoapPDU::setTokenLength(uint8_t tokenLength) {
 	if(tokenLength>8)
 		return 1;
 
+	// options move
+	_optionIndexValid = 0;
 	_pdu[0] &= 0xF0;
 	_pdu[0] |= tokenLength;
 	return 0;
@@ -925,7 +949,8 @@ int CoapPDU::setToken(uint8_t *token, uint8_t tokenLength) {
 		return 0;
 	}
 
-	// otherwise compute new length of PDU
+	// otherwise compute new length of PDU, options move
+	_optionIndexValid = 0;
 	uint8_t oldPDULength = _pduLength;
 	_pduLength -= oldTokenLength;
 	_pduLength += tokenLength;
@@ -1099,13 +1124,13 @@ int CoapPDU::getNumOptions() {
 
 /**
  * This returns the options as a sequence of structs.
+ *
+ * The array is allocated and must be freed by the caller. The accessors of the class use
+ * the option index instead, see CoapPDU::indexOptions().
  */
 CoapPDU::CoapOption* CoapPDU::getOptions() {
 	DBG("getOptions() called, %d options.",_numOptions);
 
-	uint16_t optionDelta =0, optionNumber = 0, optionValueLength = 0;
-	int totalLength = 0;
-
 	if(_numOptions==0) {
 		return NULL;
 	}
@@ -1117,6 +1142,19 @@ CoapPDU::CoapOption* CoapPDU::getOptions() {
 		return NULL;
 	}
 
+	if(_optionIndexValid&&_numOptions<=COAP_OPTION_INDEX_LENGTH) {
+		memcpy(options,_optionIndex,_numOptions*sizeof(CoapOption));
+	} else {
+		fillOptions(options);
+	}
+	return options;
+}
+
+/// Walks over the options of the PDU and records them in \b options, which has room for all of them.
+void CoapPDU::fillOptions(CoapOption *options) {
+	uint16_t optionDelta =0, optionNumber = 0, optionValueLength = 0;
+	int totalLength = 0;
+
 	// first option occurs after token
 	int optionPos = COAP_HDR_SIZE + getTokenLength();
 
@@ -1141,8 +1179,37 @@ CoapPDU::CoapOption* CoapPDU::getOptions() {
 		// move to next option
 		optionPos += totalLength; 
 	}
+}
 
-	return options;
+/// Returns the options of the PDU from the option index, without allocating memory.
+/**
+ * The index is built by CoapPDU::validate(), or here the first time it is needed after the options
+ * have changed. If the PDU has more than COAP_OPTION_INDEX_LENGTH options they are returned with
+ * CoapPDU::getOptions() instead.
+ *
+ * \return The options, to be given back with CoapPDU::releaseOptions(), or NULL if there are none.
+ */
+CoapPDU::CoapOption* CoapPDU::indexOptions() {
+	if(_numOptions==0) {
+		return NULL;
+	}
+
+	if(_numOptions>COAP_OPTION_INDEX_LENGTH) {
+		return getOptions();
+	}
+
+	if(!_optionIndexValid) {
+		fillOptions(_optionIndex);
+		_optionIndexValid = 1;
+	}
+	return _optionIndex;
+}
+
+/// Gives back the options returned by CoapPDU::indexOptions().
+void CoapPDU::releaseOptions(CoapOption *options) {
+	if(options!=_optionIndex) {
+		free(options);
+	}
 }
 
 /// Add an option to the PDU.
@@ -1161,6 +1228,9 @@ int CoapPDU::addOption(uint16_t insertedOptionNumber, uint16_t optionValueLength
 	// prevOption <-- insertionPosition
 	// nextOption
 
+	// options move
+	_optionIndexValid = 0;
+
 	// find insertion location and previous option number
 	uint16_t prevOptionNumber = 0; // option number of option before insertion point
 	int insertionPosition = findInsertionPosition(insertedOptionNumber,&prevOptionNumber);
@@ -1282,6 +1352,7 @@ int CoapPDU::addOption(uint16_t insertedOptionNumber, uint16_t optionValueLength
 	// now insert the new option into the gap
 	DBGLX("Inserting new option...");
 	insertOption(insertionPosition,optionDelta,optionValueLength,optionValue);
+	_numOptions++;
 	DBGX("done\r\n");
 	DBG_PDU();
 
@@ -1333,11 +1404,17 @@ uint8_t* CoapPDU::mallocPayload(int len) {
 	// make space for payload (and payload marker if necessary)
 	int newLen = _pduLength+payloadSpace+markerSpace;
 	if(!_constructedFromBuffer) {
+		int payloadOffset = _payloadPointer!=NULL ? _payloadPointer-_pdu : 0;
 		uint8_t* newPDU = (uint8_t*)realloc(_pdu,newLen);
 		if(newPDU==NULL) {
 			DBG("Cannot allocate (or shrink) space for payload");
 			return NULL;
 		}
+		// options and payload may have moved
+		_optionIndexValid = 0;
+		if(_payloadPointer!=NULL) {
+			_payloadPointer = &newPDU[payloadOffset];
+		}
 		_pdu = newPDU;
 		_bufferLength = newLen;
 	} else {
@@ -1371,7 +1448,7 @@ uint8_t* CoapPDU::mallocPayload(int len) {
 void CoapPDU::copyOptions(CoapPDU * tocopyfrom){
 
 // Adding all other options
-    CoapPDU::CoapOption *options = tocopyfrom->getOptions();
+    CoapPDU::CoapOption *options = tocopyfrom->indexOptions();
     if(options != NULL) {
         // SetOptions
         CoapOption *o = NULL;
@@ -1380,7 +1457,7 @@ void CoapPDU::copyOptions(CoapPDU * tocopyfrom){
             this->addOption(o->optionNumber, o->optionValueLength, o->optionValuePointer);
         }
     }
-    free(options);
+    tocopyfrom->releaseOptions(options);
 }
 
 
@@ -1863,7 +1940,7 @@ void CoapPDU::printHuman() {
 	}
 
 	// print options
-	CoapPDU::CoapOption* options = getOptions();
+	CoapPDU::CoapOption* options = indexOptions();
 	if(options==NULL) {
 		return;
 	}
@@ -1986,7 +2063,7 @@ void CoapPDU::printHuman() {
 		}
 		INFO("\"");
 	}
-	free(options);
+	releaseOptions(options);
 	INFO("__________________");
 }
 
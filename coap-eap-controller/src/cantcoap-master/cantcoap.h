@@ -10,6 +10,8 @@
 
 #define COAP_HDR_SIZE 4
 #define COAP_OPTION_HDR_BYTE 1
+/// Options kept in the index of a CoapPDU, PDUs with more options are walked on every access.
+#define COAP_OPTION_INDEX_LENGTH 8
 
 // CoAP PDU format
 
@@ -206,6 +208,10 @@ class CoapPDU {
 		int 		_numOptions;
 		uint16_t 	_maxAddedOptionNumber;
 
+		// option index, built by validate() or on first access
+		CoapOption	_optionIndex[COAP_OPTION_INDEX_LENGTH];
+		int 		_optionIndexValid;
+
 		// functions
 		void 		shiftPDUUp(int shiftOffset, int shiftAmount);
 		void 		shiftPDUDown(int startLocation, int shiftOffset, int shiftAmount);
@@ -218,9 +224,33 @@ class CoapPDU {
 		uint16_t 	getOptionDelta(uint8_t *option);
 		void 		setOptionDelta(int optionPosition, uint16_t optionDelta);
 		uint16_t 	getOptionValueLength(uint8_t *option);
+		void 		fillOptions(CoapOption *options);
+		CoapOption*	indexOptions();
+		void 		releaseOptions(CoapOption *options);
 		
 };
 
+/// Storage of an InlineCoapPDU, it is a base class so that it is constructed before the CoapPDU.
+template<int N> struct CoapPDUStorage {
+	uint8_t _storage[N];
+};
+
+/// A CoapPDU that holds its own buffer of N bytes.
+/**
+ * It allows to build or parse a PDU without any dynamic allocation, the object can live on the stack
+ * or inside another structure. It behaves as CoapPDU::CoapPDU(uint8_t *buffer, int bufferLength, int pduLength):
+ * the PDU cannot exceed N bytes.
+ *
+ * To parse a received PDU, copy it with CoapPDU::getPDUPointer() and CoapPDU::setPDULength(), then validate it.
+ */
+template<int N> class InlineCoapPDU : private CoapPDUStorage<N>, public CoapPDU {
+	public:
+		InlineCoapPDU() : CoapPDU(CoapPDUStorage<N>::_storage,N,0) {}
+		// the copy would point to the buffer of the original
+		InlineCoapPDU(const InlineCoapPDU&) = delete;
+		InlineCoapPDU& operator=(const InlineCoapPDU&) = delete;
+};
+
 /*
 #define COAP_CODE_EMPTY 0x00
 
@@ -13,6 +13,7 @@ void testHeaderFirstByteConstruction();
 void testMethodCodes();
 void testOptionInsertion();
 void testTokenInsertion();
+void testOptionIndex();
 void testAgainstServer(CoapPDU *pdu);
 
 // some macros for portability with mbed code
@@ -545,6 +546,56 @@ void testURISizes()
     delete pdu;
 }
 
+// Option index
+
+void testOptionIndex() {
+	uint8_t buffer[64];
+	int pduLength = 0;
+
+	// options added out of order, more than fit in the index
+	CoapPDU *pdu = new CoapPDU();
+	pdu->setVersion(1);
+	pdu->setType(CoapPDU::COAP_CONFIRMABLE);
+	pdu->setCode(CoapPDU::COAP_POST);
+	for(int i=COAP_OPTION_INDEX_LENGTH; i>=0; i--) {
+		uint8_t value = i;
+		CU_ASSERT_FATAL(pdu->addOption(20+i,1,&value)==0);
+		// the index is refreshed after every change
+		CU_ASSERT_EQUAL_FATAL(*pdu->getOptionPointer(20+i),i);
+	}
+	CU_ASSERT_EQUAL_FATAL(pdu->getNumOptions(),COAP_OPTION_INDEX_LENGTH+1);
+	CU_ASSERT_EQUAL_FATAL(*pdu->getOptionPointer(20+COAP_OPTION_INDEX_LENGTH),COAP_OPTION_INDEX_LENGTH);
+	// options move with a longer token
+	CU_ASSERT_FATAL(pdu->setToken((uint8_t*)"\x01\x02\x03\x04",4)==0);
+	CU_ASSERT_EQUAL_FATAL(*pdu->getOptionPointer(20),0);
+	CU_ASSERT_FATAL(pdu->getOptionPointer(19)==NULL);
+	pduLength = pdu->getPDULength();
+	memcpy(buffer,pdu->getPDUPointer(),pduLength);
+	delete pdu;
+
+	// index built by validate
+	pdu = new CoapPDU(buffer,pduLength);
+	CU_ASSERT_FATAL(pdu->validate()==1);
+	CU_ASSERT_EQUAL_FATAL(pdu->getNumOptions(),COAP_OPTION_INDEX_LENGTH+1);
+	for(int i=0; i<=COAP_OPTION_INDEX_LENGTH; i++) {
+		CU_ASSERT_EQUAL_FATAL(*pdu->getOptionPointer(20+i),i);
+		CU_ASSERT_EQUAL_FATAL(pdu->getOptionLength(20+i),1);
+	}
+	delete pdu;
+
+	// PDU with its own buffer
+	InlineCoapPDU<64> inlinePDU;
+	memcpy(inlinePDU.getPDUPointer(),buffer,pduLength);
+	inlinePDU.setPDULength(pduLength);
+	CU_ASSERT_FATAL(inlinePDU.validate()==1);
+	CU_ASSERT_EQUAL_FATAL(*inlinePDU.getOptionPointer(21),1);
+	CU_ASSERT_FATAL(inlinePDU.getPDUPointer()!=buffer);
+	inlinePDU.reset();
+	CU_ASSERT_FATAL(inlinePDU.setURI((char*)"/a/b",4)==0);
+	CU_ASSERT_EQUAL_FATAL(inlinePDU.getNumOptions(),2);
+	CU_ASSERT_FATAL(inlinePDU.setPayload(buffer,64)==1);
+}
+
 int main(int argc, char **argv) {
 	// use CUnit test framework
 	CU_pSuite pSuite = NULL;
@@ -586,6 +637,11 @@ int main(int argc, char **argv) {
       return CU_get_error();
    }
 
+   if(!CU_add_test(pSuite, "Option index", testOptionIndex)) {
+      CU_cleanup_registry();
+      return CU_get_error();
+   }
+
    if(!CU_add_test(pSuite, "URI setting", testURISetting)) {
       CU_cleanup_registry();
       return CU_get_error();
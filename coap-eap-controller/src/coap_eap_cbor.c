@@ -0,0 +1,228 @@
+/**
+ * @file coap_eap_cbor.c
+ * @brief CBOR of the CoAP-EAP messages.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+#include "coap_eap_cbor.h"
+
+#define CBOR_MAJOR_UINT  0
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_ARRAY 4
+
+const struct coap_eap_cbor_schema coap_eap_cbor_request = {
+	3, {COAP_EAP_CBOR_CIPHER_SUITES, COAP_EAP_CBOR_RECIPIENT_ID, COAP_EAP_CBOR_LIFETIME}
+};
+
+const struct coap_eap_cbor_schema coap_eap_cbor_response = {
+	2, {COAP_EAP_CBOR_CIPHER_SUITES, COAP_EAP_CBOR_RECIPIENT_ID, 0}
+};
+
+/* Writer */
+
+void cbor_writer_init(struct cbor_writer *w, uint8_t *buf, size_t size) {
+	w->buf = buf;
+	w->size = size;
+	w->len = 0;
+	w->error = 0;
+}
+
+/* Initial byte and argument, in the shortest form. */
+static void put_head(struct cbor_writer *w, uint8_t major, uint32_t value) {
+	size_t n = value < 24 ? 0 : value <= 0xff ? 1 : value <= 0xffff ? 2 : 4;
+	uint8_t *p;
+
+	if (w->error || w->size - w->len < n + 1) {
+		w->error = 1;
+		return;
+	}
+
+	p = w->buf + w->len;
+	w->len += n + 1;
+	switch (n) {
+	case 0:
+		p[0] = (uint8_t) (major << 5 | value);
+		return;
+	case 1:
+		p[0] = (uint8_t) (major << 5 | 24);
+		break;
+	case 2:
+		p[0] = (uint8_t) (major << 5 | 25);
+		break;
+	default:
+		p[0] = (uint8_t) (major << 5 | 26);
+	}
+	/* Network byte order. */
+	while (n > 0) {
+		p[n] = (uint8_t) value;
+		value >>= 8;
+		n--;
+	}
+}
+
+void cbor_put_uint(struct cbor_writer *w, uint32_t value) {
+	put_head(w, CBOR_MAJOR_UINT, value);
+}
+
+void cbor_put_array(struct cbor_writer *w, uint32_t n) {
+	put_head(w, CBOR_MAJOR_ARRAY, n);
+}
+
+void cbor_put_bytes(struct cbor_writer *w, const uint8_t *data, size_t len) {
+	put_head(w, CBOR_MAJOR_BYTES, (uint32_t) len);
+	if (w->error || w->size - w->len < len) {
+		w->error = 1;
+		return;
+	}
+	memcpy(w->buf + w->len, data, len);
+	w->len += len;
+}
+
+/* Reader */
+
+void cbor_reader_init(struct cbor_reader *r, const uint8_t *buf, size_t len) {
+	r->p = buf;
+	r->end = buf + len;
+	r->error = 0;
+}
+
+int cbor_reader_done(const struct cbor_reader *r) {
+	return r->p == r->end;
+}
+
+/* Initial byte and argument of the next item, if it is of the major type given. */
+static int get_head(struct cbor_reader *r, uint8_t major, uint32_t *value) {
+	const uint8_t *p = r->p;
+	uint8_t info;
+	size_t n;
+
+	if (r->error || p == r->end || (*p >> 5) != major)
+		goto malformed;
+
+	info = *p++ & 0x1f;
+	if (info < 24) {
+		*value = info;
+		r->p = p;
+		return 0;
+	}
+	/* 8 byte arguments and indefinite lengths are not used. */
+	if (info > 26)
+		goto malformed;
+
+	n = (size_t) 1 << (info - 24);
+	if ((size_t) (r->end - p) < n)
+		goto malformed;
+	*value = 0;
+	while (n-- > 0)
+		*value = *value << 8 | *p++;
+	r->p = p;
+	return 0;
+
+malformed:
+	r->error = 1;
+	return -1;
+}
+
+int cbor_get_uint(struct cbor_reader *r, uint32_t *value) {
+	return get_head(r, CBOR_MAJOR_UINT, value);
+}
+
+int cbor_get_array(struct cbor_reader *r, uint32_t *n) {
+	return get_head(r, CBOR_MAJOR_ARRAY, n);
+}
+
+int cbor_get_bytes(struct cbor_reader *r, const uint8_t **data, size_t *len) {
+	uint32_t n;
+
+	if (get_head(r, CBOR_MAJOR_BYTES, &n) < 0)
+		return -1;
+	if ((size_t) (r->end - r->p) < n) {
+		r->error = 1;
+		return -1;
+	}
+	*data = r->p;
+	*len = n;
+	r->p += n;
+	return 0;
+}
+
+/* Messages */
+
+int coap_eap_cbor_encode(const struct coap_eap_cbor_schema *schema,
+		const struct coap_eap_cbor *cbor, uint8_t *buf, size_t size) {
+	struct cbor_writer w;
+	uint8_t i, j;
+
+	cbor_writer_init(&w, buf, size);
+	for (i = 0; i < schema->nfields && (cbor->present & schema->fields[i]); i++) {
+		switch (schema->fields[i]) {
+		case COAP_EAP_CBOR_CIPHER_SUITES:
+			cbor_put_array(&w, cbor->n_cipher_suites);
+			for (j = 0; j < cbor->n_cipher_suites; j++)
+				cbor_put_uint(&w, cbor->cipher_suites[j]);
+			break;
+		case COAP_EAP_CBOR_RECIPIENT_ID:
+			cbor_put_bytes(&w, cbor->recipient_id, cbor->recipient_id_len);
+			break;
+		case COAP_EAP_CBOR_LIFETIME:
+			cbor_put_array(&w, 1);
+			cbor_put_uint(&w, cbor->lifetime);
+			break;
+		}
+	}
+	return w.error ? -1 : (int) w.len;
+}
+
+int coap_eap_cbor_decode(const struct coap_eap_cbor_schema *schema,
+		const uint8_t *buf, size_t len, struct coap_eap_cbor *cbor) {
+	struct cbor_reader r;
+	uint32_t n, value;
+	size_t bytes_len;
+	uint8_t i;
+
+	memset(cbor, 0, sizeof(*cbor));
+	cbor_reader_init(&r, buf, len);
+	for (i = 0; i < schema->nfields && !cbor_reader_done(&r); i++) {
+		switch (schema->fields[i]) {
+		case COAP_EAP_CBOR_CIPHER_SUITES:
+			if (cbor_get_array(&r, &n) < 0 || n > COAP_EAP_CBOR_MAX_SUITES)
+				return -1;
+			for (cbor->n_cipher_suites = 0; cbor->n_cipher_suites < n; cbor->n_cipher_suites++) {
+				if (cbor_get_uint(&r, &value) < 0 || value > 0xff)
+					return -1;
+				cbor->cipher_suites[cbor->n_cipher_suites] = (uint8_t) value;
+			}
+			break;
+		case COAP_EAP_CBOR_RECIPIENT_ID:
+			if (cbor_get_bytes(&r, &cbor->recipient_id, &bytes_len) < 0 || bytes_len > 0xff)
+				return -1;
+			cbor->recipient_id_len = (uint8_t) bytes_len;
+			break;
+		case COAP_EAP_CBOR_LIFETIME:
+			if (cbor_get_array(&r, &n) < 0 || n != 1 || cbor_get_uint(&r, &cbor->lifetime) < 0)
+				return -1;
+			break;
+		}
+		cbor->present |= schema->fields[i];
+	}
+	/* Items that are not in the schema. */
+	return cbor_reader_done(&r) ? 0 : -1;
+}
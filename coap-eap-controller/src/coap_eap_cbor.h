@@ -0,0 +1,140 @@
+/**
+ * @file coap_eap_cbor.h
+ * @brief CBOR of the CoAP-EAP messages.
+ *
+ * The payload of some CoAP-EAP messages carries, after the EAP message, a
+ * CBOR sequence: the cipher suites offered by the controller in its first
+ * POST and the one chosen by the device in its answer, the recipient IDs
+ * of the OSCORE context and the lifetime of the session.
+ *
+ * The codec is streaming and never allocates: the writer serializes in
+ * the buffer given and the reader parses in place, the byte strings point
+ * into the payload received. The fields of every message are described
+ * by a constant schema, in the order they are sent; the ones at the end
+ * can be left out. Only definite lengths and values of up to 32 bits are
+ * supported, which is all CoAP-EAP needs.
+ *
+ * The same file is built in the controller and in the devices (the Contiki
+ * app coap-eap-cbor links to it), it is C89.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef COAP_EAP_CBOR_H
+#define COAP_EAP_CBOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of cipher suites of a message.*/
+#define COAP_EAP_CBOR_MAX_SUITES 4
+/** Maximum length of the CBOR of a message.*/
+#define COAP_EAP_CBOR_MAX_LEN 32
+
+/** Fields of the messages, bits of coap_eap_cbor.present.*/
+#define COAP_EAP_CBOR_CIPHER_SUITES 0x01
+#define COAP_EAP_CBOR_RECIPIENT_ID  0x02
+#define COAP_EAP_CBOR_LIFETIME      0x04
+
+/** Content of the CBOR of a message.*/
+struct coap_eap_cbor {
+	/**Fields present, COAP_EAP_CBOR_* bits.*/
+	uint8_t present;
+	/**Cipher suites, an array of integers.*/
+	uint8_t n_cipher_suites;
+	uint8_t cipher_suites[COAP_EAP_CBOR_MAX_SUITES];
+	/**Recipient ID, a byte string. Points into the buffer parsed.*/
+	const uint8_t *recipient_id;
+	uint8_t recipient_id_len;
+	/**Lifetime of the session in seconds, an array of one integer.*/
+	uint32_t lifetime;
+};
+
+/** Fields of a message, in the order they are sent.*/
+struct coap_eap_cbor_schema {
+	uint8_t nfields;
+	uint8_t fields[3];
+};
+
+/** First POST of the controller: cipher suites offered, RID-C, lifetime.*/
+extern const struct coap_eap_cbor_schema coap_eap_cbor_request;
+/** Answer of the device: cipher suite chosen, RID-I.*/
+extern const struct coap_eap_cbor_schema coap_eap_cbor_response;
+
+/** Serializes CBOR items in a buffer. error is set if it does not fit.*/
+struct cbor_writer {
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	int error;
+};
+
+/** Parses CBOR items in place. error is set on malformed input.*/
+struct cbor_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+	int error;
+};
+
+void cbor_writer_init(struct cbor_writer *w, uint8_t *buf, size_t size);
+/** Unsigned integer (major type 0).*/
+void cbor_put_uint(struct cbor_writer *w, uint32_t value);
+/** Header of an array of n items (major type 4), the items follow.*/
+void cbor_put_array(struct cbor_writer *w, uint32_t n);
+/** Byte string (major type 2).*/
+void cbor_put_bytes(struct cbor_writer *w, const uint8_t *data, size_t len);
+
+void cbor_reader_init(struct cbor_reader *r, const uint8_t *buf, size_t len);
+/** @return 1 if there are no more items.*/
+int cbor_reader_done(const struct cbor_reader *r);
+/** @return 0 on success, -1 if the next item is not an unsigned integer.*/
+int cbor_get_uint(struct cbor_reader *r, uint32_t *value);
+/** @return 0 on success, -1 if the next item is not an array.*/
+int cbor_get_array(struct cbor_reader *r, uint32_t *n);
+/**
+ * @return 0 on success, -1 if the next item is not a byte string. data
+ * points into the buffer parsed.
+ */
+int cbor_get_bytes(struct cbor_reader *r, const uint8_t **data, size_t *len);
+
+/**
+ * Serializes the fields of a message present in cbor, up to the first
+ * missing one.
+ *
+ * @return Length written, -1 if it does not fit in buf.
+ */
+int coap_eap_cbor_encode(const struct coap_eap_cbor_schema *schema,
+		const struct coap_eap_cbor *cbor, uint8_t *buf, size_t size);
+
+/**
+ * Parses the CBOR of a message. The fields not sent are not present.
+ *
+ * @return 0 on success, -1 if buf does not follow the schema.
+ */
+int coap_eap_cbor_decode(const struct coap_eap_cbor_schema *schema,
+		const uint8_t *buf, size_t len, struct coap_eap_cbor *cbor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
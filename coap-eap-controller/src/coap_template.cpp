@@ -0,0 +1,74 @@
+/**
+ * @file coap_template.cpp
+ * @brief Pre-serialized CoAP POSTs of a CoAP-EAP session.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+#include "coap_template.h"
+#include "cantcoap-master/cantcoap.h"
+
+int coap_template_build(struct coap_template *t, uint32_t token, const char *location, int oscore) {
+
+	// Built as the POSTs were, so the bytes sent are the same.
+	InlineCoapPDU<COAP_TEMPLATE_LEN> post;
+	post.setVersion(1);
+	post.setType(CoapPDU::COAP_CONFIRMABLE);
+	post.setCode(CoapPDU::COAP_POST);
+	post.setToken((uint8_t *) &token, sizeof(token));
+	post.setMessageID(0);
+
+	t->len = 0;
+	if (post.setURI((char *) location, strlen(location)) != 0)
+		return -1;
+
+	if (oscore) {
+		unsigned char oscore_option[2] = {0x09, 0x00};
+		if (post.addOption(CoapPDU::COAP_OPTION_OSCORE, 2, oscore_option) != 0)
+			return -1;
+	}
+
+	// Room for the payload marker.
+	if (post.getPDULength() >= COAP_TEMPLATE_LEN)
+		return -1;
+
+	memcpy(t->pdu, post.getPDUPointer(), (size_t) post.getPDULength());
+	t->pdu[post.getPDULength()] = 0xFF;
+	t->len = post.getPDULength() + 1;
+	t->oscore = oscore;
+	return 0;
+}
+
+void coap_template_iov(struct coap_template *t, uint16_t message_id,
+		const uint8_t *payload, size_t len, const uint8_t *tail, size_t tail_len,
+		struct iovec iov[COAP_TEMPLATE_IOV]) {
+
+	// Network byte order, as CoapPDU::setMessageID.
+	t->pdu[2] = (uint8_t) (message_id >> 8);
+	t->pdu[3] = (uint8_t) message_id;
+
+	// Without payload there is no payload marker.
+	iov[0].iov_base = t->pdu;
+	iov[0].iov_len = len + tail_len > 0 ? (size_t) t->len : (size_t) t->len - 1;
+	iov[1].iov_base = (void *) payload;
+	iov[1].iov_len = len;
+	iov[2].iov_base = (void *) tail;
+	iov[2].iov_len = tail_len;
+}
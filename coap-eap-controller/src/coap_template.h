@@ -0,0 +1,95 @@
+/**
+ * @file coap_template.h
+ * @brief Pre-serialized CoAP POSTs of a CoAP-EAP session.
+ *
+ * All the POSTs sent to a device have the same shape: confirmable POST,
+ * the session id as 4-byte token, the Uri-Path options of the location
+ * announced by the device and an EAP payload (the last one with the
+ * OSCORE option too). The header, token and options are serialized once
+ * in a template; every POST only patches the message id and is sent as
+ * three segments: the template, the EAP message and the CBOR tail of the
+ * payload, if any (the cryptosuites of the first POST).
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef COAP_TEMPLATE_H
+#define COAP_TEMPLATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum length of the header, token, options and payload marker.*/
+#define COAP_TEMPLATE_LEN 128
+/** Segments of a POST built from a template.*/
+#define COAP_TEMPLATE_IOV 3
+
+/** Header, token and options of the POSTs of a session.*/
+struct coap_template {
+	/**Serialized PDU up to the payload marker, included.*/
+	uint8_t pdu[COAP_TEMPLATE_LEN];
+	/**Bytes used in pdu, 0 if the template has to be built.*/
+	int len;
+	/**The template has the OSCORE option.*/
+	int oscore;
+};
+
+/**
+ * Serializes the template of the POSTs of a session.
+ *
+ * @param *t Template.
+ * @param token Token of the POSTs, the session id.
+ * @param *location URI of the device, one Uri-Path option per segment.
+ * @param oscore If not 0, the OSCORE option is added.
+ *
+ * @return 0 on success, -1 if the options do not fit in the template.
+ */
+int coap_template_build(struct coap_template *t, uint32_t token, const char *location, int oscore);
+
+/**
+ * Patches the message id of a template and returns the segments of the
+ * POST. The segments point to the template, the payload and the tail,
+ * nothing is copied: they are valid while those are.
+ *
+ * @param *t Template, already built.
+ * @param message_id Message id of the POST.
+ * @param *payload Payload of the POST, the EAP message.
+ * @param len Length of the payload.
+ * @param *tail Bytes sent after the payload, NULL if there are none.
+ * @param tail_len Length of the tail.
+ * @param iov Segments of the POST.
+ */
+void coap_template_iov(struct coap_template *t, uint16_t message_id,
+		const uint8_t *payload, size_t len, const uint8_t *tail, size_t tail_len,
+		struct iovec iov[COAP_TEMPLATE_IOV]);
+
+/** The template has to be built again (e.g. the location has changed).*/
+static inline void coap_template_invalidate(struct coap_template *t) {
+	t->len = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
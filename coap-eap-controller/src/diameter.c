@@ -0,0 +1,972 @@
+/**
+ * @file diameter.c
+ * @brief Diameter EAP application (RFC 4072) transport to the AAA server.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "diameter.h"
+#include "panautils.h"
+
+#define DIAMETER_IN_SIZE (2 * DIAMETER_MAX_LEN)
+/** Backoff of the reconnections, in seconds.*/
+#define DIAMETER_BACKOFF_MIN 0.1
+#define DIAMETER_BACKOFF_MAX 30
+/** Seconds to establish a connection, TCP and the capabilities exchange.*/
+#define DIAMETER_CONNECT_TIMEOUT 5
+/** Seconds without any answer, with requests in flight, before the connection is taken as lost.*/
+#define DIAMETER_ANSWER_TIMEOUT 10
+/** Seconds of an idle connection before a Device-Watchdog-Request (Tw, RFC 3539).*/
+#define DIAMETER_WATCHDOG 30
+/** Times a request is sent again before it is abandoned: the server drops it.*/
+#define DIAMETER_MAX_RESENDS 3
+#define DIAMETER_PRODUCT_NAME "coap-eap-controller"
+
+enum diameter_state {
+	DIAMETER_CLOSED,
+	DIAMETER_CONNECTING,
+	/**CER sent, waiting for the CEA.*/
+	DIAMETER_CER,
+	DIAMETER_UP
+};
+
+struct diameter_conn {
+	int fd;
+	enum diameter_state state;
+	/**The socket is not writable.*/
+	int want_write;
+	/**Next connection attempt when closed, or end of the current one.*/
+	double deadline;
+	double backoff;
+	/**Last message received, or start of the wait for one.*/
+	double last_rx;
+	/**A DWR is waiting for its DWA.*/
+	int watchdog;
+	/**The server asked to disconnect (DPR), closed once the DPA is written.*/
+	int disconnect;
+	/**The connection established has received answers.*/
+	int answered;
+
+	/**Requests queued by diameter_send_der, under the lock.*/
+	uint8_t *out;
+	size_t out_len;
+	size_t out_size;
+	/**Messages of the connection itself (CER, DWR, DWA, DPA), written before the requests.*/
+	uint8_t *ctrl;
+	size_t ctrl_len;
+	size_t ctrl_size;
+	/**Messages being written by the network thread.*/
+	uint8_t *wbuf;
+	size_t wbuf_len;
+	size_t wbuf_off;
+	size_t wbuf_size;
+
+	uint8_t *in;
+	size_t in_len;
+
+	/**Requests without answer, under the lock.*/
+	uint32_t in_flight;
+};
+
+/** A request without answer, in the slot of its hop-by-hop identifier.*/
+struct diameter_pending {
+	/**Copy of the DER, NULL if the slot is free.*/
+	uint8_t *msg;
+	uint32_t len;
+	uint32_t hbh;
+	uint32_t session;
+	/**Connection it has been queued on, -1 with the transport of the conf.*/
+	int conn;
+	int resends;
+};
+
+struct diameter {
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char *origin_host;
+	char *origin_realm;
+	char *destination_realm;
+	/**Start of the controller, in the Session-Ids and end-to-end identifiers.*/
+	uint32_t boot;
+	uint32_t next_hbh;
+	uint32_t next_e2e;
+	size_t queue_limit;
+	int (*transport)(void *ctx, const uint8_t *buf, size_t len);
+	void *transport_ctx;
+	/**The senders wake up the network thread through it.*/
+	int doorbell[2];
+	int rung;
+	struct diameter_conn *conns;
+	int nconns;
+	struct diameter_pending pending[DIAMETER_WINDOW];
+	/**The counters of the connections are only written by the network thread.*/
+	struct diameter_stats stats;
+	pthread_mutex_t lock;
+};
+
+static struct diameter *diameter = NULL;
+
+/* Codec */
+
+static void put_be24(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t) (v >> 16);
+	p[1] = (uint8_t) (v >> 8);
+	p[2] = (uint8_t) v;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t) (v >> 24);
+	p[1] = (uint8_t) (v >> 16);
+	p[2] = (uint8_t) (v >> 8);
+	p[3] = (uint8_t) v;
+}
+
+static uint32_t get_be24(const uint8_t *p) {
+	return ((uint32_t) p[0] << 16) | ((uint32_t) p[1] << 8) | p[2];
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+uint32_t diameter_length(const uint8_t *msg) {
+	return get_be24(msg + 1);
+}
+
+size_t diameter_put_header(uint8_t *buf, uint8_t flags, uint32_t cmd, uint32_t app,
+		uint32_t hbh, uint32_t e2e) {
+	buf[0] = 1;
+	put_be24(buf + 1, DIAMETER_HDR_LEN);
+	buf[4] = flags;
+	put_be24(buf + 5, cmd);
+	put_be32(buf + 8, app);
+	put_be32(buf + 12, hbh);
+	put_be32(buf + 16, e2e);
+	return DIAMETER_HDR_LEN;
+}
+
+size_t diameter_put_avp(uint8_t *buf, uint32_t code, const void *data, size_t len) {
+	size_t size = DIAMETER_AVP_SIZE(len);
+
+	put_be32(buf, code);
+	buf[4] = DIAMETER_AVP_MANDATORY;
+	put_be24(buf + 5, (uint32_t) (DIAMETER_AVP_HDR_LEN + len));
+	memcpy(buf + DIAMETER_AVP_HDR_LEN, data, len);
+	memset(buf + DIAMETER_AVP_HDR_LEN + len, 0, size - DIAMETER_AVP_HDR_LEN - len);
+	return size;
+}
+
+size_t diameter_put_u32(uint8_t *buf, uint32_t code, uint32_t value) {
+	uint8_t v[4];
+
+	put_be32(v, value);
+	return diameter_put_avp(buf, code, v, sizeof(v));
+}
+
+void diameter_finish(uint8_t *msg, size_t len) {
+	put_be24(msg + 1, (uint32_t) len);
+}
+
+int diameter_parse(const uint8_t *buf, size_t len, struct diameter_msg *msg) {
+	const uint8_t *p, *end, *data;
+	uint32_t code, avp_len;
+	size_t hdr, data_len;
+
+	memset(msg, 0, sizeof(*msg));
+	if (len < DIAMETER_HDR_LEN || buf[0] != 1 || diameter_length(buf) != len)
+		return -1;
+	msg->flags = buf[4];
+	msg->cmd = get_be24(buf + 5);
+	msg->app = get_be32(buf + 8);
+	msg->hbh = get_be32(buf + 12);
+	msg->e2e = get_be32(buf + 16);
+
+	for (p = buf + DIAMETER_HDR_LEN, end = buf + len; p < end; p += (avp_len + 3) & ~3u) {
+		if (end - p < DIAMETER_AVP_HDR_LEN)
+			return -1;
+		code = get_be32(p);
+		avp_len = get_be24(p + 5);
+		hdr = p[4] & DIAMETER_AVP_VENDOR ? DIAMETER_AVP_HDR_LEN + 4 : DIAMETER_AVP_HDR_LEN;
+		if (avp_len < hdr || avp_len > (size_t) (end - p))
+			return -1;
+		// Only the base and EAP AVPs, not the ones of a vendor.
+		if (p[4] & DIAMETER_AVP_VENDOR)
+			continue;
+		data = p + hdr;
+		data_len = avp_len - hdr;
+		switch (code) {
+		case DIAMETER_AVP_RESULT_CODE:
+			if (data_len != 4)
+				return -1;
+			msg->result = get_be32(data);
+			break;
+		case DIAMETER_AVP_SESSION_ID:
+			msg->session_id = data;
+			msg->session_id_len = data_len;
+			break;
+		case DIAMETER_AVP_ORIGIN_HOST:
+			msg->origin_host = data;
+			msg->origin_host_len = data_len;
+			break;
+		case DIAMETER_AVP_USER_NAME:
+			msg->user_name = data;
+			msg->user_name_len = data_len;
+			break;
+		case DIAMETER_AVP_EAP_PAYLOAD:
+			msg->eap = data;
+			msg->eap_len = data_len;
+			break;
+		case DIAMETER_AVP_EAP_MASTER_SESSION_KEY:
+			msg->msk = data;
+			msg->msk_len = data_len;
+			break;
+		case DIAMETER_AVP_STATE:
+			msg->state = data;
+			msg->state_len = data_len;
+			break;
+		}
+	}
+	return 0;
+}
+
+/* Transport */
+
+static int resolve(const char *host, int port, struct sockaddr_storage *addr, socklen_t *addr_len) {
+	struct addrinfo hints, *res;
+	char service[8];
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+	if (getaddrinfo(host, service, &hints, &res) != 0)
+		return -1;
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	*addr_len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return 0;
+}
+
+static int reserve(uint8_t **buf, size_t *len, size_t *size, size_t data_len) {
+	if (*len + data_len > *size) {
+		size_t n = *size ? *size : 4096;
+		uint8_t *p;
+
+		while (n < *len + data_len)
+			n *= 2;
+		p = (uint8_t *) realloc(*buf, n);
+		if (p == NULL)
+			return -1;
+		*buf = p;
+		*size = n;
+	}
+	return 0;
+}
+
+static int append(uint8_t **buf, size_t *len, size_t *size, const uint8_t *data, size_t data_len) {
+	if (reserve(buf, len, size, data_len) < 0)
+		return -1;
+	memcpy(*buf + *len, data, data_len);
+	*len += data_len;
+	return 0;
+}
+
+/* The connection open with the fewest requests in flight, or the one
+ * closed with the fewest if none is open. Under the lock. */
+static struct diameter_conn *pick_conn(struct diameter_conn *except) {
+	struct diameter_conn *best = NULL, *c;
+	int i;
+
+	for (i = 0; i < diameter->nconns; i++) {
+		c = &diameter->conns[i];
+		if (c == except)
+			continue;
+		if (best == NULL || (c->state == DIAMETER_UP && best->state != DIAMETER_UP) ||
+				((c->state == DIAMETER_UP) == (best->state == DIAMETER_UP) &&
+				 c->in_flight < best->in_flight))
+			best = c;
+	}
+	return best;
+}
+
+static void ring(void) {
+	char b = 0;
+
+	if (!diameter->rung) {
+		diameter->rung = 1;
+		if (write(diameter->doorbell[1], &b, 1) < 0 && errno != EAGAIN)
+			pana_error("diameter: the network thread could not be woken up");
+	}
+}
+
+/* Frees the slot of a request. Under the lock. */
+static void forget_request(struct diameter_pending *p) {
+	if (p->conn >= 0)
+		diameter->conns[p->conn].in_flight--;
+	free(p->msg);
+	p->msg = NULL;
+	diameter->stats.in_flight--;
+}
+
+/* Origin-Host and Origin-Realm, in every message. */
+static size_t put_origin(uint8_t *buf) {
+	size_t len;
+
+	len = diameter_put_avp(buf, DIAMETER_AVP_ORIGIN_HOST, diameter->origin_host,
+			strlen(diameter->origin_host));
+	len += diameter_put_avp(buf + len, DIAMETER_AVP_ORIGIN_REALM, diameter->origin_realm,
+			strlen(diameter->origin_realm));
+	return len;
+}
+
+int diameter_send_der(uint32_t session, const uint8_t *user_name, size_t user_name_len,
+		const uint8_t *eap, size_t eap_len, const uint8_t *state, size_t state_len,
+		uint32_t *id) {
+	struct diameter_pending *p;
+	struct diameter_conn *c = NULL;
+	char session_id[320];
+	uint8_t *msg;
+	size_t len, size;
+	int session_id_len;
+
+	if (diameter == NULL)
+		return -1;
+	session_id_len = snprintf(session_id, sizeof(session_id), "%s;%u;%08x",
+			diameter->origin_host, diameter->boot, session);
+	size = DIAMETER_HDR_LEN + DIAMETER_AVP_SIZE((size_t) session_id_len) +
+		DIAMETER_AVP_SIZE(strlen(diameter->origin_host)) +
+		DIAMETER_AVP_SIZE(strlen(diameter->origin_realm)) +
+		DIAMETER_AVP_SIZE(strlen(diameter->destination_realm)) +
+		2 * DIAMETER_AVP_SIZE(4) + DIAMETER_AVP_SIZE(eap_len) +
+		(user_name != NULL ? DIAMETER_AVP_SIZE(user_name_len) : 0) +
+		(state != NULL ? DIAMETER_AVP_SIZE(state_len) : 0);
+	msg = (uint8_t *) malloc(size);
+	if (msg == NULL)
+		return -1;
+
+	pthread_mutex_lock(&diameter->lock);
+	// The identifiers whose slot still has a request, wrapped around onto
+	// one never answered, are skipped.
+	if (diameter->stats.in_flight >= DIAMETER_WINDOW)
+		goto refused;
+	do {
+		*id = diameter->next_hbh++;
+		p = &diameter->pending[*id & (DIAMETER_WINDOW - 1)];
+	} while (p->msg != NULL);
+
+	len = diameter_put_header(msg, DIAMETER_FLAG_REQUEST | DIAMETER_FLAG_PROXIABLE,
+			DIAMETER_CMD_DER, DIAMETER_APP_EAP, *id, diameter->next_e2e++);
+	len += diameter_put_avp(msg + len, DIAMETER_AVP_SESSION_ID, session_id, (size_t) session_id_len);
+	len += diameter_put_u32(msg + len, DIAMETER_AVP_AUTH_APPLICATION_ID, DIAMETER_APP_EAP);
+	len += put_origin(msg + len);
+	len += diameter_put_avp(msg + len, DIAMETER_AVP_DESTINATION_REALM, diameter->destination_realm,
+			strlen(diameter->destination_realm));
+	len += diameter_put_u32(msg + len, DIAMETER_AVP_AUTH_REQUEST_TYPE, DIAMETER_AUTHORIZE_AUTHENTICATE);
+	if (user_name != NULL)
+		len += diameter_put_avp(msg + len, DIAMETER_AVP_USER_NAME, user_name, user_name_len);
+	len += diameter_put_avp(msg + len, DIAMETER_AVP_EAP_PAYLOAD, eap, eap_len);
+	if (state != NULL)
+		len += diameter_put_avp(msg + len, DIAMETER_AVP_STATE, state, state_len);
+	diameter_finish(msg, len);
+
+	if (diameter->transport != NULL) {
+		if (diameter->transport(diameter->transport_ctx, msg, len) < 0)
+			goto refused;
+		p->conn = -1;
+	} else {
+		c = pick_conn(NULL);
+		if (c->out_len + len > diameter->queue_limit ||
+				append(&c->out, &c->out_len, &c->out_size, msg, len) < 0)
+			goto refused;
+		if (c->in_flight++ == 0 && !c->watchdog)
+			c->last_rx = getTime();
+		p->conn = (int) (c - diameter->conns);
+		ring();
+	}
+	p->msg = msg;
+	p->len = (uint32_t) len;
+	p->hbh = *id;
+	p->session = session;
+	p->resends = 0;
+	diameter->stats.requests++;
+	diameter->stats.in_flight++;
+	pthread_mutex_unlock(&diameter->lock);
+	return 0;
+
+refused:
+	diameter->stats.refused++;
+	pthread_mutex_unlock(&diameter->lock);
+	free(msg);
+	errno = ENOBUFS;
+	return -1;
+}
+
+/* Takes the request of a DEA and passes the answer to deliver. */
+static void deliver_answer(const struct diameter_msg *msg, diameter_deliver_cb deliver) {
+	struct diameter_pending *p;
+	struct diameter_answer answer;
+
+	pthread_mutex_lock(&diameter->lock);
+	p = &diameter->pending[msg->hbh & (DIAMETER_WINDOW - 1)];
+	if (p->msg == NULL || p->hbh != msg->hbh) {
+		diameter->stats.unknown++;
+		pthread_mutex_unlock(&diameter->lock);
+		pana_debug("diameter: answer %08x without request, dropped\n", msg->hbh);
+		return;
+	}
+	answer.session = p->session;
+	forget_request(p);
+	diameter->stats.answers++;
+	pthread_mutex_unlock(&diameter->lock);
+
+	answer.id = msg->hbh;
+	answer.result = msg->result;
+	answer.eap = msg->eap;
+	answer.eap_len = msg->eap_len;
+	answer.msk = msg->msk;
+	answer.msk_len = msg->msk_len;
+	answer.state = msg->state;
+	answer.state_len = msg->state_len;
+	deliver(&answer);
+}
+
+void diameter_receive(const uint8_t *buf, size_t len, diameter_deliver_cb deliver) {
+	struct diameter_msg msg;
+
+	if (diameter_parse(buf, len, &msg) < 0 || (msg.flags & DIAMETER_FLAG_REQUEST) ||
+			msg.cmd != DIAMETER_CMD_DER) {
+		pana_debug("diameter: invalid answer, dropped\n");
+		return;
+	}
+	deliver_answer(&msg, deliver);
+}
+
+/* Queues again the requests without answer of a connection lost, on the
+ * connection open with the fewest requests, or on the same one if none
+ * is open, with the T flag. Its queue is dropped: the requests of the
+ * queue are pending too. */
+static void requeue(struct diameter_conn *c) {
+	struct diameter_conn *to;
+	struct diameter_pending *p;
+	int i, index = (int) (c - diameter->conns);
+
+	pthread_mutex_lock(&diameter->lock);
+	c->out_len = 0;
+	for (i = 0; i < DIAMETER_WINDOW; i++) {
+		p = &diameter->pending[i];
+		if (p->msg == NULL || p->conn != index)
+			continue;
+		if (p->resends++ == DIAMETER_MAX_RESENDS) {
+			forget_request(p);
+			diameter->stats.abandoned++;
+			continue;
+		}
+		to = pick_conn(c);
+		if (to == NULL || to->state != DIAMETER_UP)
+			to = c;
+		p->msg[4] |= DIAMETER_FLAG_RETRANSMIT;
+		if (append(&to->out, &to->out_len, &to->out_size, p->msg, p->len) < 0) {
+			forget_request(p);
+			continue;
+		}
+		if (to != c) {
+			c->in_flight--;
+			if (to->in_flight++ == 0 && !to->watchdog)
+				to->last_rx = getTime();
+			p->conn = (int) (to - diameter->conns);
+		}
+		diameter->stats.resent++;
+	}
+	pthread_mutex_unlock(&diameter->lock);
+}
+
+/* A connection lost after it got answers is opened again at once, the
+ * backoff is for the ones that fail. why is NULL if the server closed it. */
+static void conn_close(struct diameter_conn *c, double now, const char *why) {
+	if (why != NULL)
+		pana_error("diameter: connection to the AAA server %s: %s", c->state == DIAMETER_UP ? "lost" : "failed", why);
+	else
+		pana_debug("diameter: connection closed by the AAA server\n");
+	if (c->state == DIAMETER_UP)
+		diameter->stats.up--;
+	if (c->state == DIAMETER_UP && c->answered) {
+		c->backoff = DIAMETER_BACKOFF_MIN;
+		c->deadline = now;
+	} else {
+		c->deadline = now + c->backoff;
+		c->backoff *= 2;
+		if (c->backoff > DIAMETER_BACKOFF_MAX)
+			c->backoff = DIAMETER_BACKOFF_MAX;
+	}
+	diameter->stats.failures++;
+	if (c->fd >= 0) {
+		close(c->fd);
+		c->fd = -1;
+	}
+	c->state = DIAMETER_CLOSED;
+	c->want_write = 0;
+	c->watchdog = 0;
+	c->disconnect = 0;
+	c->in_len = 0;
+	c->ctrl_len = 0;
+	c->wbuf_len = c->wbuf_off = 0;
+	requeue(c);
+}
+
+/* Queues a message of the connection itself, built by put. */
+static void queue_ctrl(struct diameter_conn *c, uint8_t flags, uint32_t cmd, uint32_t hbh, uint32_t e2e,
+		uint32_t result, size_t (*put)(struct diameter_conn *c, uint8_t *buf)) {
+	uint8_t *msg;
+	size_t len;
+
+	if (reserve(&c->ctrl, &c->ctrl_len, &c->ctrl_size, 256 + strlen(diameter->origin_host) +
+			strlen(diameter->origin_realm)) < 0)
+		return;
+	msg = c->ctrl + c->ctrl_len;
+	len = diameter_put_header(msg, flags, cmd, DIAMETER_APP_COMMON, hbh, e2e);
+	if (result != 0)
+		len += diameter_put_u32(msg + len, DIAMETER_AVP_RESULT_CODE, result);
+	len += put_origin(msg + len);
+	if (put != NULL)
+		len += put(c, msg + len);
+	diameter_finish(msg, len);
+	c->ctrl_len += len;
+}
+
+/* The AVPs of the CER after the origin. */
+static size_t put_capabilities(struct diameter_conn *c, uint8_t *buf) {
+	struct sockaddr_storage local;
+	socklen_t local_len = sizeof(local);
+	uint8_t addr[18];
+	size_t len = 0;
+
+	if (getsockname(c->fd, (struct sockaddr *) &local, &local_len) == 0) {
+		if (local.ss_family == AF_INET6) {
+			addr[0] = 0;
+			addr[1] = 2;
+			memcpy(addr + 2, &((struct sockaddr_in6 *) &local)->sin6_addr, 16);
+			len += diameter_put_avp(buf + len, DIAMETER_AVP_HOST_IP_ADDRESS, addr, 18);
+		} else {
+			addr[0] = 0;
+			addr[1] = 1;
+			memcpy(addr + 2, &((struct sockaddr_in *) &local)->sin_addr, 4);
+			len += diameter_put_avp(buf + len, DIAMETER_AVP_HOST_IP_ADDRESS, addr, 6);
+		}
+	}
+	len += diameter_put_u32(buf + len, DIAMETER_AVP_VENDOR_ID, 0);
+	len += diameter_put_avp(buf + len, DIAMETER_AVP_PRODUCT_NAME, DIAMETER_PRODUCT_NAME,
+			strlen(DIAMETER_PRODUCT_NAME));
+	len += diameter_put_u32(buf + len, DIAMETER_AVP_AUTH_APPLICATION_ID, DIAMETER_APP_EAP);
+	return len;
+}
+
+/* Queues a request of the connection itself, its identifier does not
+ * take a slot. */
+static void queue_ctrl_request(struct diameter_conn *c, uint32_t cmd,
+		size_t (*put)(struct diameter_conn *c, uint8_t *buf)) {
+	uint32_t hbh, e2e;
+
+	pthread_mutex_lock(&diameter->lock);
+	hbh = diameter->next_hbh++;
+	e2e = diameter->next_e2e++;
+	pthread_mutex_unlock(&diameter->lock);
+	queue_ctrl(c, DIAMETER_FLAG_REQUEST, cmd, hbh, e2e, 0, put);
+}
+
+static void conn_start(struct diameter_conn *c, double now) {
+	c->state = DIAMETER_CER;
+	queue_ctrl_request(c, DIAMETER_CMD_CAPABILITIES_EXCHANGE, put_capabilities);
+}
+
+static void conn_open(struct diameter_conn *c, double now) {
+	int one = 1;
+
+	c->fd = socket(diameter->addr.ss_family, SOCK_STREAM, 0);
+	if (c->fd < 0) {
+		conn_close(c, now, strerror(errno));
+		return;
+	}
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+	fcntl(c->fd, F_SETFD, FD_CLOEXEC);
+	// The requests are written as soon as they are queued.
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	c->deadline = now + DIAMETER_CONNECT_TIMEOUT;
+	if (connect(c->fd, (struct sockaddr *) &diameter->addr, diameter->addr_len) == 0)
+		conn_start(c, now);
+	else if (errno == EINPROGRESS)
+		c->state = DIAMETER_CONNECTING;
+	else
+		conn_close(c, now, strerror(errno));
+}
+
+/* Writes everything queued: the messages of the connection first, and the
+ * requests once it is up. A queue becomes the buffer being written when
+ * the previous one is done. */
+static void conn_write(struct diameter_conn *c, double now) {
+	uint8_t *buf;
+	size_t size;
+	ssize_t ret;
+
+	for (;;) {
+		if (c->wbuf_off == c->wbuf_len) {
+			buf = c->wbuf;
+			size = c->wbuf_size;
+			if (c->ctrl_len > 0) {
+				c->wbuf = c->ctrl;
+				c->wbuf_size = c->ctrl_size;
+				c->wbuf_len = c->ctrl_len;
+				c->ctrl = buf;
+				c->ctrl_size = size;
+				c->ctrl_len = 0;
+			} else if (c->state == DIAMETER_UP && !c->disconnect) {
+				pthread_mutex_lock(&diameter->lock);
+				c->wbuf = c->out;
+				c->wbuf_size = c->out_size;
+				c->wbuf_len = c->out_len;
+				c->out = buf;
+				c->out_size = size;
+				c->out_len = 0;
+				pthread_mutex_unlock(&diameter->lock);
+			} else
+				c->wbuf_len = 0;
+			c->wbuf_off = 0;
+			if (c->wbuf_len == 0) {
+				if (c->disconnect)
+					conn_close(c, now, NULL);
+				return;
+			}
+		}
+
+		ret = send(c->fd, c->wbuf + c->wbuf_off, c->wbuf_len - c->wbuf_off, MSG_NOSIGNAL);
+		if (ret > 0) {
+			c->wbuf_off += (size_t) ret;
+			c->want_write = 0;
+			diameter->stats.writes++;
+			continue;
+		}
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			c->want_write = 1;
+			return;
+		}
+		if (ret < 0 && errno == EINTR)
+			continue;
+		conn_close(c, now, "write");
+		return;
+	}
+}
+
+/* Handles a message of the server. */
+static void conn_message(struct diameter_conn *c, const uint8_t *buf, size_t len, double now,
+		diameter_deliver_cb deliver) {
+	struct diameter_msg msg;
+
+	if (diameter_parse(buf, len, &msg) < 0) {
+		conn_close(c, now, "invalid Diameter message");
+		return;
+	}
+	c->last_rx = now;
+
+	if (msg.flags & DIAMETER_FLAG_REQUEST) {
+		switch (msg.cmd) {
+		case DIAMETER_CMD_DEVICE_WATCHDOG:
+			queue_ctrl(c, 0, msg.cmd, msg.hbh, msg.e2e, DIAMETER_SUCCESS, NULL);
+			break;
+		case DIAMETER_CMD_DISCONNECT_PEER:
+			pana_debug("diameter: the AAA server disconnects\n");
+			queue_ctrl(c, 0, msg.cmd, msg.hbh, msg.e2e, DIAMETER_SUCCESS, NULL);
+			c->disconnect = 1;
+			break;
+		default:
+			pana_debug("diameter: request %u of the AAA server ignored\n", msg.cmd);
+		}
+		return;
+	}
+
+	switch (msg.cmd) {
+	case DIAMETER_CMD_CAPABILITIES_EXCHANGE:
+		if (c->state != DIAMETER_CER || msg.result != DIAMETER_SUCCESS) {
+			conn_close(c, now, "capabilities exchange rejected");
+			return;
+		}
+		c->state = DIAMETER_UP;
+		c->answered = 0;
+		diameter->stats.connects++;
+		diameter->stats.up++;
+		pana_debug("diameter: connection to the AAA server %.*s established\n",
+				(int) msg.origin_host_len, msg.origin_host != NULL ? (const char *) msg.origin_host : "");
+		break;
+	case DIAMETER_CMD_DEVICE_WATCHDOG:
+		c->watchdog = 0;
+		break;
+	case DIAMETER_CMD_DER:
+		c->answered = 1;
+		deliver_answer(&msg, deliver);
+		break;
+	}
+}
+
+/* Reads the messages and handles the whole ones. */
+static void conn_read(struct diameter_conn *c, double now, diameter_deliver_cb deliver) {
+	size_t off, len;
+	ssize_t ret;
+
+	for (;;) {
+		ret = recv(c->fd, c->in + c->in_len, DIAMETER_IN_SIZE - c->in_len, 0);
+		if (ret == 0) {
+			conn_close(c, now, NULL);
+			return;
+		}
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				conn_close(c, now, "read");
+			return;
+		}
+		c->in_len += (size_t) ret;
+
+		for (off = 0; c->in_len - off >= 4; off += len) {
+			len = diameter_length(c->in + off);
+			if (c->in[off] != 1 || len < DIAMETER_HDR_LEN || len > DIAMETER_MAX_LEN) {
+				conn_close(c, now, "invalid Diameter message");
+				return;
+			}
+			if (c->in_len - off < len)
+				break;
+			conn_message(c, c->in + off, len, now, deliver);
+			if (c->state == DIAMETER_CLOSED)
+				return;
+		}
+		memmove(c->in, c->in + off, c->in_len - off);
+		c->in_len -= off;
+	}
+}
+
+int diameter_init(const struct diameter_conf *conf) {
+	int i;
+
+	if (diameter != NULL || (conf->transport == NULL &&
+			(conf->connections <= 0 || conf->connections > DIAMETER_MAX_CONNECTIONS)))
+		return -1;
+	diameter = (struct diameter *) calloc(1, sizeof(*diameter));
+	if (diameter == NULL)
+		return -1;
+	diameter->doorbell[0] = diameter->doorbell[1] = -1;
+	pthread_mutex_init(&diameter->lock, NULL);
+	diameter->queue_limit = conf->queue_limit ? conf->queue_limit : DIAMETER_DEFAULT_QUEUE_LIMIT;
+	diameter->origin_host = strdup(conf->origin_host ? conf->origin_host : "coap-eap-controller.localdomain");
+	diameter->origin_realm = strdup(conf->origin_realm ? conf->origin_realm : "localdomain");
+	diameter->destination_realm = strdup(conf->destination_realm ? conf->destination_realm : "localdomain");
+	// RFC 6733, 3: the end-to-end identifiers start with the low bits of
+	// the time, the hop-by-hop ones at random.
+	diameter->boot = (uint32_t) getTime();
+	diameter->next_e2e = (diameter->boot << 20) | ((uint32_t) rand() & 0xfffff);
+	diameter->next_hbh = (uint32_t) rand();
+	diameter->transport = conf->transport;
+	diameter->transport_ctx = conf->transport_ctx;
+	if (conf->transport != NULL)
+		return 0;
+
+	if (resolve(conf->host, conf->port, &diameter->addr, &diameter->addr_len) < 0) {
+		pana_error("diameter: the address of the AAA server %s could not be resolved", conf->host);
+		goto fail;
+	}
+	if (pipe(diameter->doorbell) < 0)
+		goto fail;
+	for (i = 0; i < 2; i++) {
+		fcntl(diameter->doorbell[i], F_SETFL, fcntl(diameter->doorbell[i], F_GETFL) | O_NONBLOCK);
+		fcntl(diameter->doorbell[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	diameter->conns = (struct diameter_conn *) calloc((size_t) conf->connections, sizeof(*diameter->conns));
+	if (diameter->conns == NULL)
+		goto fail;
+	diameter->nconns = conf->connections;
+	for (i = 0; i < diameter->nconns; i++) {
+		diameter->conns[i].fd = -1;
+		diameter->conns[i].backoff = DIAMETER_BACKOFF_MIN;
+		diameter->conns[i].in = (uint8_t *) malloc(DIAMETER_IN_SIZE);
+		if (diameter->conns[i].in == NULL)
+			goto fail;
+	}
+	return 0;
+
+fail:
+	diameter_deinit();
+	return -1;
+}
+
+void diameter_deinit() {
+	struct diameter_conn *c;
+	int i;
+
+	if (diameter == NULL)
+		return;
+	for (i = 0; i < diameter->nconns; i++) {
+		c = &diameter->conns[i];
+		if (c->fd >= 0)
+			close(c->fd);
+		free(c->out);
+		free(c->ctrl);
+		free(c->wbuf);
+		free(c->in);
+	}
+	for (i = 0; i < DIAMETER_WINDOW; i++)
+		free(diameter->pending[i].msg);
+	free(diameter->conns);
+	for (i = 0; i < 2; i++)
+		if (diameter->doorbell[i] >= 0)
+			close(diameter->doorbell[i]);
+	free(diameter->origin_host);
+	free(diameter->origin_realm);
+	free(diameter->destination_realm);
+	pthread_mutex_destroy(&diameter->lock);
+	free(diameter);
+	diameter = NULL;
+}
+
+int diameter_enabled() {
+	return diameter != NULL;
+}
+
+int diameter_fd_set(fd_set *rset, fd_set *wset) {
+	struct diameter_conn *c;
+	int i, maxfd = diameter->doorbell[0];
+
+	if (diameter->transport != NULL)
+		return -1;
+	FD_SET(diameter->doorbell[0], rset);
+	for (i = 0; i < diameter->nconns; i++) {
+		c = &diameter->conns[i];
+		if (c->state == DIAMETER_CLOSED)
+			continue;
+		if (c->state != DIAMETER_CONNECTING)
+			FD_SET(c->fd, rset);
+		if (c->state == DIAMETER_CONNECTING || c->want_write)
+			FD_SET(c->fd, wset);
+		if (c->fd > maxfd)
+			maxfd = c->fd;
+	}
+	return maxfd;
+}
+
+int diameter_timeout(struct timespec *ts) {
+	struct diameter_conn *c;
+	double next = -1, at, now = getTime();
+	int i;
+
+	for (i = 0; i < diameter->nconns; i++) {
+		c = &diameter->conns[i];
+		if (c->state != DIAMETER_UP)
+			at = c->deadline;
+		else if (c->in_flight > 0 || c->watchdog)
+			at = c->last_rx + DIAMETER_ANSWER_TIMEOUT;
+		else
+			at = c->last_rx + DIAMETER_WATCHDOG;
+		if (next < 0 || at < next)
+			next = at;
+	}
+	if (next < 0)
+		return 0;
+	next = next > now ? next - now : 0;
+	ts->tv_sec = (time_t) next;
+	ts->tv_nsec = (long) ((next - (double) ts->tv_sec) * 1e9);
+	return 1;
+}
+
+void diameter_process(fd_set *rset, fd_set *wset, diameter_deliver_cb deliver) {
+	struct diameter_conn *c;
+	double now = getTime();
+	char drain[64];
+	int i, err;
+	socklen_t err_len;
+
+	if (diameter->transport != NULL)
+		return;
+	if (FD_ISSET(diameter->doorbell[0], rset)) {
+		pthread_mutex_lock(&diameter->lock);
+		while (read(diameter->doorbell[0], drain, sizeof(drain)) > 0)
+			;
+		diameter->rung = 0;
+		pthread_mutex_unlock(&diameter->lock);
+	}
+
+	for (i = 0; i < diameter->nconns; i++) {
+		c = &diameter->conns[i];
+		switch (c->state) {
+		case DIAMETER_CLOSED:
+			if (now >= c->deadline)
+				conn_open(c, now);
+			break;
+		case DIAMETER_CONNECTING:
+			if (FD_ISSET(c->fd, wset)) {
+				err = 0;
+				err_len = sizeof(err);
+				if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0)
+					conn_close(c, now, strerror(err ? err : errno));
+				else
+					conn_start(c, now);
+			} else if (now >= c->deadline)
+				conn_close(c, now, "timeout");
+			break;
+		case DIAMETER_CER:
+			if (FD_ISSET(c->fd, rset))
+				conn_read(c, now, deliver);
+			if (c->state == DIAMETER_CER && now >= c->deadline)
+				conn_close(c, now, "capabilities exchange timeout");
+			break;
+		case DIAMETER_UP:
+			if (FD_ISSET(c->fd, rset))
+				conn_read(c, now, deliver);
+			if (c->state != DIAMETER_UP)
+				break;
+			if (c->in_flight > 0 || c->watchdog) {
+				if (now >= c->last_rx + DIAMETER_ANSWER_TIMEOUT)
+					conn_close(c, now, "no answers");
+			} else if (now >= c->last_rx + DIAMETER_WATCHDOG) {
+				// RFC 3539: an idle connection is probed.
+				queue_ctrl_request(c, DIAMETER_CMD_DEVICE_WATCHDOG, NULL);
+				c->watchdog = 1;
+				c->last_rx = now;
+				diameter->stats.watchdogs++;
+			}
+			break;
+		}
+		// Also the messages of the connection just established.
+		if (c->state == DIAMETER_CER || c->state == DIAMETER_UP)
+			conn_write(c, now);
+	}
+}
+
+void diameter_get_stats(struct diameter_stats *stats) {
+	pthread_mutex_lock(&diameter->lock);
+	*stats = diameter->stats;
+	pthread_mutex_unlock(&diameter->lock);
+}
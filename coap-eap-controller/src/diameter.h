@@ -0,0 +1,288 @@
+/**
+ * @file diameter.h
+ * @brief Headers of the Diameter EAP application (RFC 4072) transport to the AAA server.
+ *
+ * In pass-through mode, the EAP responses of the devices can go to the AAA
+ * server in Diameter-EAP-Requests (DER) instead of RADIUS Access-Requests,
+ * set as the AAA backend of the authenticators (eap_auth_set_aaa_backend),
+ * and its Diameter-EAP-Answers (DEA) are given back to them:
+ *
+ *  - The requests go over a pool of persistent TCP connections (RFC 6733),
+ *    each one opened with a Capabilities-Exchange (CER/CEA) and kept alive
+ *    by the Device-Watchdog (DWR/DWA, RFC 3539) while it is idle.
+ *  - The hop-by-hop identifiers have 32 bits: many requests are in flight
+ *    on each connection at the same time (pipelining), up to
+ *    DIAMETER_WINDOW, instead of the 256 of a RADIUS socket. A new request
+ *    goes to the connection with the fewest ones.
+ *  - The messages are not limited to 4096 bytes, the EAP payload goes in
+ *    one AVP.
+ *  - A request is kept until its answer arrives: if its connection is
+ *    lost, it is sent again, with the T flag, over another one or over the
+ *    same one once it is opened again with an exponential backoff, up to
+ *    3 times. The identifiers of the requests still kept are skipped when
+ *    the next ones wrap around.
+ *
+ * The requests can be sent from any thread, but the connections are only
+ * handled by the network thread, which waits for diameter_fd_set() and
+ * diameter_timeout() and then calls diameter_process() with the answers'
+ * callback, as with radsec.h.
+ *
+ * The encoding functions are also used by the Diameter server of the
+ * simulation and by its stand-in (src/sim).
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DIAMETER_H
+#define DIAMETER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/select.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAMETER_DEFAULT_PORT 3868
+/** Max number of connections of the pool.*/
+#define DIAMETER_MAX_CONNECTIONS 64
+/** Requests in flight at most, a power of 2.*/
+#define DIAMETER_WINDOW 16384
+/** Bytes queued on a connection before the new requests are refused.*/
+#define DIAMETER_DEFAULT_QUEUE_LIMIT (1024 * 1024)
+/** Longest message received.*/
+#define DIAMETER_MAX_LEN 65536
+
+#define DIAMETER_HDR_LEN 20
+#define DIAMETER_AVP_HDR_LEN 8
+
+/** Flags of the header.*/
+#define DIAMETER_FLAG_REQUEST 0x80
+#define DIAMETER_FLAG_PROXIABLE 0x40
+#define DIAMETER_FLAG_ERROR 0x20
+#define DIAMETER_FLAG_RETRANSMIT 0x10
+/** Flags of the AVPs.*/
+#define DIAMETER_AVP_VENDOR 0x80
+#define DIAMETER_AVP_MANDATORY 0x40
+
+/** Commands.*/
+#define DIAMETER_CMD_CAPABILITIES_EXCHANGE 257
+#define DIAMETER_CMD_DER 268
+#define DIAMETER_CMD_DEVICE_WATCHDOG 280
+#define DIAMETER_CMD_DISCONNECT_PEER 282
+
+/** Applications: the base protocol and Diameter EAP.*/
+#define DIAMETER_APP_COMMON 0
+#define DIAMETER_APP_EAP 5
+
+/** AVPs.*/
+#define DIAMETER_AVP_USER_NAME 1
+#define DIAMETER_AVP_STATE 24
+#define DIAMETER_AVP_HOST_IP_ADDRESS 257
+#define DIAMETER_AVP_AUTH_APPLICATION_ID 258
+#define DIAMETER_AVP_SESSION_ID 263
+#define DIAMETER_AVP_ORIGIN_HOST 264
+#define DIAMETER_AVP_VENDOR_ID 266
+#define DIAMETER_AVP_RESULT_CODE 268
+#define DIAMETER_AVP_PRODUCT_NAME 269
+#define DIAMETER_AVP_DISCONNECT_CAUSE 273
+#define DIAMETER_AVP_AUTH_REQUEST_TYPE 274
+#define DIAMETER_AVP_DESTINATION_REALM 283
+#define DIAMETER_AVP_ORIGIN_REALM 296
+#define DIAMETER_AVP_EAP_PAYLOAD 462
+#define DIAMETER_AVP_EAP_MASTER_SESSION_KEY 464
+
+/** Auth-Request-Type AUTHORIZE_AUTHENTICATE.*/
+#define DIAMETER_AUTHORIZE_AUTHENTICATE 3
+
+/** Result codes.*/
+#define DIAMETER_MULTI_ROUND_AUTH 1001
+#define DIAMETER_SUCCESS 2001
+#define DIAMETER_AUTHENTICATION_REJECTED 4001
+#define DIAMETER_UNABLE_TO_COMPLY 5012
+
+/** A message parsed by diameter_parse(), its AVPs point to the buffer.*/
+struct diameter_msg {
+	uint8_t flags;
+	uint32_t cmd;
+	uint32_t app;
+	uint32_t hbh;
+	uint32_t e2e;
+	/**0 if there is no Result-Code.*/
+	uint32_t result;
+	/**The AVPs not present have a NULL pointer.*/
+	const uint8_t *session_id;
+	size_t session_id_len;
+	const uint8_t *origin_host;
+	size_t origin_host_len;
+	const uint8_t *user_name;
+	size_t user_name_len;
+	const uint8_t *eap;
+	size_t eap_len;
+	const uint8_t *msk;
+	size_t msk_len;
+	const uint8_t *state;
+	size_t state_len;
+};
+
+/** @return Length of a message, from its header.*/
+uint32_t diameter_length(const uint8_t *msg);
+/**
+ * Parses a whole message.
+ *
+ * @return 0, or -1 if it is not valid.
+ */
+int diameter_parse(const uint8_t *buf, size_t len, struct diameter_msg *msg);
+/**
+ * Writes the header of a message, its length is set by diameter_finish().
+ *
+ * @return DIAMETER_HDR_LEN.
+ */
+size_t diameter_put_header(uint8_t *buf, uint8_t flags, uint32_t cmd, uint32_t app,
+		uint32_t hbh, uint32_t e2e);
+/**
+ * Writes a mandatory AVP, padded to 4 bytes.
+ *
+ * @return Bytes written, DIAMETER_AVP_SIZE(len).
+ */
+size_t diameter_put_avp(uint8_t *buf, uint32_t code, const void *data, size_t len);
+size_t diameter_put_u32(uint8_t *buf, uint32_t code, uint32_t value);
+/** Sets the length of the message in its header.*/
+void diameter_finish(uint8_t *msg, size_t len);
+/** Bytes of an AVP with len bytes of data.*/
+#define DIAMETER_AVP_SIZE(len) (DIAMETER_AVP_HDR_LEN + (((len) + 3) & ~(size_t) 3))
+
+/** Configuration of the transport.*/
+struct diameter_conf {
+	/**Name or IP address of the AAA server.*/
+	const char *host;
+	int port;
+	/**Connections of the pool, 1..DIAMETER_MAX_CONNECTIONS.*/
+	int connections;
+	/**Identity of the controller and realm of the AAA server, defaults if NULL.*/
+	const char *origin_host;
+	const char *origin_realm;
+	const char *destination_realm;
+	/**0 for DIAMETER_DEFAULT_QUEUE_LIMIT.*/
+	size_t queue_limit;
+	/**
+	 * If not NULL, the requests are given to it instead of going over the
+	 * connections, and the answers are given to diameter_receive(): the
+	 * simulation's network. It returns 0, or -1 if the request is lost.
+	 */
+	int (*transport)(void *ctx, const uint8_t *buf, size_t len);
+	void *transport_ctx;
+};
+
+/** Counters of the transport.*/
+struct diameter_stats {
+	/**Connections established (CEA received) and the ones that could not be or were lost.*/
+	uint64_t connects;
+	uint64_t failures;
+	/**DERs queued, and the ones refused because the queue or the window were full.*/
+	uint64_t requests;
+	uint64_t refused;
+	/**DERs sent again after their connection was lost, and the ones given up after 3 times.*/
+	uint64_t resent;
+	uint64_t abandoned;
+	/**DEAs received, and the ones without request (answered already).*/
+	uint64_t answers;
+	uint64_t unknown;
+	/**Device-Watchdog-Requests sent.*/
+	uint64_t watchdogs;
+	/**Writes of the connections, every one with as many requests as were queued.*/
+	uint64_t writes;
+	/**Connections established now and requests in flight.*/
+	uint32_t up;
+	uint32_t in_flight;
+};
+
+/** A DEA, its pointers are only valid during the callback.*/
+struct diameter_answer {
+	/**Session given to diameter_send_der, and the identifier it got.*/
+	uint32_t session;
+	uint32_t id;
+	uint32_t result;
+	const uint8_t *eap;
+	size_t eap_len;
+	const uint8_t *msk;
+	size_t msk_len;
+	const uint8_t *state;
+	size_t state_len;
+};
+
+/** Called with every DEA of a request in flight.*/
+typedef void (*diameter_deliver_cb)(const struct diameter_answer *answer);
+
+/**
+ * Resolves the AAA server and starts opening the connections.
+ *
+ * @return 0 on success, -1 if the configuration is not valid.
+ */
+int diameter_init(const struct diameter_conf *conf);
+/** Closes the connections, the requests in flight are dropped.*/
+void diameter_deinit();
+/** @return TRUE if diameter_init has been called.*/
+int diameter_enabled();
+
+/**
+ * Queues a DER of a session on a connection. The Session-Id is made of
+ * the controller's Origin-Host and session. Thread safe.
+ *
+ * @param *user_name Identity of the device, NULL if it is not known yet.
+ * @param *state State of the last DEA of the session, NULL if none.
+ * @param *id Hop-by-hop identifier of the request, its DEA has the same.
+ *
+ * @return 0, or -1 if the queue or the window are full.
+ */
+int diameter_send_der(uint32_t session, const uint8_t *user_name, size_t user_name_len,
+		const uint8_t *eap, size_t eap_len, const uint8_t *state, size_t state_len,
+		uint32_t *id);
+/** Handles a message of the conf's transport.*/
+void diameter_receive(const uint8_t *buf, size_t len, diameter_deliver_cb deliver);
+
+/**
+ * Adds the descriptors the network thread must wait for.
+ *
+ * @return The highest one.
+ */
+int diameter_fd_set(fd_set *rset, fd_set *wset);
+/**
+ * Time the network thread can wait at most, for the next reconnection,
+ * watchdog or expiration of a connection.
+ *
+ * @return 1 if ts is set, 0 if it can wait forever.
+ */
+int diameter_timeout(struct timespec *ts);
+/**
+ * Handles the connections after the wait: writes the messages queued,
+ * reads the answers, which are passed to deliver, answers the watchdogs
+ * of the server and opens again the connections lost. rset and wset can
+ * be empty.
+ */
+void diameter_process(fd_set *rset, fd_set *wset, diameter_deliver_cb deliver);
+
+void diameter_get_stats(struct diameter_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,363 @@
+/**
+ * @file erp.c
+ * @brief EAP re-authentication (ERP, RFC 6696) of the controller.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "includes.h"
+#include "common.h"
+#include "crypto/sha256.h"
+
+#include "erp.h"
+#include "panautils.h"
+
+#define ERP_TLV_KEYNAME_NAI 1
+
+#define ERP_RRK_LABEL  "EAP Re-authentication Root Key@ietf.org"
+#define ERP_RIK_LABEL  "Re-authentication Integrity Key@ietf.org"
+#define ERP_RMSK_LABEL "Re-authentication Master Session Key@ietf.org"
+#define ERP_NAME_LABEL "EMSK"
+
+/* Keys */
+
+/*
+ * KDF of RFC 5295: PRF+ with HMAC-SHA256 over label | "\0" | data | length.
+ * T(i) = HMAC(key, T(i-1) | S | i).
+ */
+static void erp_kdf(const uint8_t *key, size_t key_len, const char *label,
+		const uint8_t *data, size_t data_len, uint8_t *out, size_t out_len) {
+	uint8_t t[SHA256_MAC_LEN], length[2], counter = 1;
+	const u8 *addr[5];
+	size_t len[5], n;
+
+	length[0] = (uint8_t) (out_len >> 8);
+	length[1] = (uint8_t) out_len;
+
+	addr[1] = (const u8 *) label;
+	len[1] = strlen(label) + 1;
+	addr[2] = data;
+	len[2] = data_len;
+	addr[3] = length;
+	len[3] = sizeof(length);
+	addr[4] = &counter;
+	len[4] = 1;
+
+	while (out_len > 0) {
+		addr[0] = t;
+		len[0] = counter == 1 ? 0 : sizeof(t);
+		hmac_sha256_vector(key, key_len, 5, addr, len, t);
+
+		n = out_len < sizeof(t) ? out_len : sizeof(t);
+		memcpy(out, t, n);
+		out += n;
+		out_len -= n;
+		counter++;
+	}
+}
+
+void erp_derive(const uint8_t *msk, size_t msk_len, struct erp_keys *keys) {
+	uint8_t suite = ERP_CRYPTOSUITE;
+
+	erp_kdf(msk, msk_len, ERP_NAME_LABEL, NULL, 0, keys->keyname, sizeof(keys->keyname));
+	erp_kdf(msk, msk_len, ERP_RRK_LABEL, NULL, 0, keys->rrk, sizeof(keys->rrk));
+	erp_kdf(keys->rrk, sizeof(keys->rrk), ERP_RIK_LABEL, &suite, 1, keys->rik, sizeof(keys->rik));
+}
+
+void erp_rmsk(const struct erp_keys *keys, uint16_t seq, uint8_t rmsk[ERP_RMSK_LEN]) {
+	uint8_t data[2];
+
+	data[0] = (uint8_t) (seq >> 8);
+	data[1] = (uint8_t) seq;
+	erp_kdf(keys->rrk, sizeof(keys->rrk), ERP_RMSK_LABEL, data, sizeof(data), rmsk, ERP_RMSK_LEN);
+}
+
+/* Messages */
+
+void erp_build_start(uint8_t id, uint8_t *buf) {
+	buf[0] = EAP_CODE_INITIATE;
+	buf[1] = id;
+	buf[2] = 0;
+	buf[3] = ERP_START_LEN;
+	buf[4] = ERP_TYPE_REAUTH_START;
+	buf[5] = 0;
+}
+
+int erp_is_start(const uint8_t *buf, size_t len) {
+	return len >= ERP_START_LEN && buf[0] == EAP_CODE_INITIATE &&
+			buf[4] == ERP_TYPE_REAUTH_START;
+}
+
+static const char hex[] = "0123456789abcdef";
+
+/*
+ * Code | Id | Length | Type | Flags | SEQ | keyName-NAI TLV | Cryptosuite | Tag
+ * The tag covers everything before it.
+ */
+void erp_build(uint8_t code, uint8_t id, uint8_t flags, uint16_t seq,
+		const struct erp_keys *keys, uint8_t *buf) {
+	uint8_t mac[SHA256_MAC_LEN];
+	uint8_t *p = buf;
+	int i;
+
+	*p++ = code;
+	*p++ = id;
+	*p++ = 0;
+	*p++ = ERP_MSG_LEN;
+	*p++ = ERP_TYPE_REAUTH;
+	*p++ = flags;
+	*p++ = (uint8_t) (seq >> 8);
+	*p++ = (uint8_t) seq;
+	*p++ = ERP_TLV_KEYNAME_NAI;
+	*p++ = 2 * ERP_KEYNAME_LEN;
+	for (i = 0; i < ERP_KEYNAME_LEN; i++) {
+		*p++ = (uint8_t) hex[keys->keyname[i] >> 4];
+		*p++ = (uint8_t) hex[keys->keyname[i] & 0xf];
+	}
+	*p++ = ERP_CRYPTOSUITE;
+
+	hmac_sha256(keys->rik, sizeof(keys->rik), buf, (size_t) (p - buf), mac);
+	memcpy(p, mac, ERP_TAG_LEN);
+}
+
+static int unhex(uint8_t c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+int erp_parse(const uint8_t *buf, size_t len, uint8_t code, struct erp_msg *msg) {
+	const uint8_t *nai = buf + 10;
+	int i, h, l;
+
+	if (len < ERP_MSG_LEN || buf[0] != code || buf[2] != 0 || buf[3] != ERP_MSG_LEN ||
+			buf[4] != ERP_TYPE_REAUTH || buf[8] != ERP_TLV_KEYNAME_NAI ||
+			buf[9] != 2 * ERP_KEYNAME_LEN || buf[ERP_MSG_LEN - ERP_TAG_LEN - 1] != ERP_CRYPTOSUITE)
+		return -1;
+
+	for (i = 0; i < ERP_KEYNAME_LEN; i++) {
+		h = unhex(nai[2 * i]);
+		l = unhex(nai[2 * i + 1]);
+		if (h < 0 || l < 0)
+			return -1;
+		msg->keyname[i] = (uint8_t) (h << 4 | l);
+	}
+	msg->code = code;
+	msg->id = buf[1];
+	msg->flags = buf[5];
+	msg->seq = (uint16_t) (buf[6] << 8 | buf[7]);
+	return 0;
+}
+
+int erp_verify(const struct erp_keys *keys, const uint8_t *buf, size_t len) {
+	uint8_t mac[SHA256_MAC_LEN], diff = 0;
+	int i;
+
+	if (len < ERP_MSG_LEN)
+		return 0;
+	hmac_sha256(keys->rik, sizeof(keys->rik), buf, ERP_MSG_LEN - ERP_TAG_LEN, mac);
+	// In constant time.
+	for (i = 0; i < ERP_TAG_LEN; i++)
+		diff |= mac[i] ^ buf[ERP_MSG_LEN - ERP_TAG_LEN + i];
+	return diff == 0;
+}
+
+/* Cache */
+
+/** Keys of a device: 88 bytes.*/
+struct erp_entry {
+	struct erp_keys keys;
+	double expires;
+	/** Last SEQ accepted, -1 if none.*/
+	int32_t seq;
+	uint32_t pad;
+};
+
+/*
+ * The entries are a ring in the order they were added: the oldest one
+ * (head) is the first to expire and the one evicted. An open addressing
+ * table (linear probing) finds the entry of a keyName.
+ */
+static struct erp_entry *ring = NULL;
+static uint32_t ring_size = 0;
+static uint32_t head = 0;
+static uint32_t count = 0;
+/** ring index + 1, 0 if the slot is empty.*/
+static uint32_t *slots = NULL;
+static uint32_t slots_mask = 0;
+static double key_lifetime = 0;
+static struct erp_cache_stats stats;
+static pthread_mutex_t erp_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The keyName is already a hash. */
+static uint32_t keyname_hash(const uint8_t *keyname) {
+	uint32_t hash;
+
+	memcpy(&hash, keyname, sizeof(hash));
+	return hash;
+}
+
+static uint32_t find_slot(const uint8_t *keyname) {
+	uint32_t i = keyname_hash(keyname) & slots_mask;
+
+	while (slots[i] != 0 &&
+			memcmp(ring[slots[i] - 1].keys.keyname, keyname, ERP_KEYNAME_LEN) != 0)
+		i = (i + 1) & slots_mask;
+	return i;
+}
+
+/* Backward shift, so no tombstones are needed. */
+static void delete_slot(uint32_t i) {
+	uint32_t j = i, home;
+
+	for (;;) {
+		slots[i] = 0;
+		for (;;) {
+			j = (j + 1) & slots_mask;
+			if (slots[j] == 0)
+				return;
+			home = keyname_hash(ring[slots[j] - 1].keys.keyname) & slots_mask;
+			// Moved unless its home is cyclically in (i, j].
+			if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+				continue;
+			break;
+		}
+		slots[i] = slots[j];
+		i = j;
+	}
+}
+
+static void remove_head() {
+	delete_slot(find_slot(ring[head].keys.keyname));
+	head = (head + 1) % ring_size;
+	count--;
+}
+
+static void expire(double now) {
+	while (count > 0 && ring[head].expires <= now) {
+		remove_head();
+		stats.expired++;
+	}
+}
+
+int erp_cache_init(uint32_t size, double lifetime) {
+	uint32_t nslots = 1;
+
+	if (size == 0)
+		return 0;
+
+	// Load factor of 1/2 at most.
+	while (nslots < 2 * size)
+		nslots <<= 1;
+
+	pthread_mutex_lock(&erp_mutex);
+	ring = XCALLOC(struct erp_entry, size);
+	slots = XCALLOC(uint32_t, nslots);
+	ring_size = size;
+	slots_mask = nslots - 1;
+	head = count = 0;
+	key_lifetime = lifetime;
+	memset(&stats, 0, sizeof(stats));
+	stats.capacity = size;
+	stats.bytes = size * sizeof(struct erp_entry) + nslots * sizeof(uint32_t);
+	pthread_mutex_unlock(&erp_mutex);
+
+	pana_debug("erp: %u entries (%zu bytes), keys kept %.0f s", size, stats.bytes, lifetime);
+	return 0;
+}
+
+int erp_cache_enabled() {
+	return ring_size > 0;
+}
+
+void erp_cache_add(const uint8_t *msk, size_t msk_len, double now) {
+	struct erp_entry *e;
+	uint32_t slot;
+
+	if (ring_size == 0)
+		return;
+
+	pthread_mutex_lock(&erp_mutex);
+	expire(now);
+	if (count == ring_size) {
+		remove_head();
+		stats.evicted++;
+	}
+
+	e = &ring[(head + count) % ring_size];
+	erp_derive(msk, msk_len, &e->keys);
+	e->expires = now + key_lifetime;
+	e->seq = -1;
+
+	// The same MSK twice: the old entry is left to expire.
+	slot = find_slot(e->keys.keyname);
+	if (slots[slot] == 0) {
+		slots[slot] = (head + count) % ring_size + 1;
+		count++;
+		stats.added++;
+	}
+	pthread_mutex_unlock(&erp_mutex);
+}
+
+int erp_cache_check(const uint8_t *buf, size_t len, double now,
+		struct erp_msg *msg, struct erp_keys *keys) {
+	struct erp_entry *e;
+	uint32_t slot;
+	int ret = -1;
+
+	if (ring_size == 0 || erp_parse(buf, len, EAP_CODE_INITIATE, msg) < 0)
+		return -1;
+
+	pthread_mutex_lock(&erp_mutex);
+	expire(now);
+	slot = find_slot(msg->keyname);
+	if (slots[slot] == 0) {
+		stats.misses++;
+	} else {
+		e = &ring[slots[slot] - 1];
+		if ((int32_t) msg->seq > e->seq && erp_verify(&e->keys, buf, len)) {
+			e->seq = msg->seq;
+			memcpy(keys, &e->keys, sizeof(*keys));
+			stats.hits++;
+			ret = 0;
+		} else
+			stats.rejected++;
+	}
+	pthread_mutex_unlock(&erp_mutex);
+	return ret;
+}
+
+void erp_cache_get_stats(struct erp_cache_stats *s) {
+	pthread_mutex_lock(&erp_mutex);
+	memcpy(s, &stats, sizeof(*s));
+	s->entries = count;
+	pthread_mutex_unlock(&erp_mutex);
+}
+
+void erp_cache_deinit() {
+	pthread_mutex_lock(&erp_mutex);
+	XFREE(ring);
+	XFREE(slots);
+	ring_size = count = head = 0;
+	pthread_mutex_unlock(&erp_mutex);
+}
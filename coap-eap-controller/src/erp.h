@@ -0,0 +1,171 @@
+/**
+ * @file erp.h
+ * @brief Headers of the EAP re-authentication (ERP, RFC 6696) of the controller.
+ *
+ * A device that has finished a full EAP authentication keeps a root key
+ * (rRK) derived from the MSK, and so does the controller in a cache. Its
+ * re-authentication is then a local exchange of two POSTs that never
+ * reaches the AAA server:
+ *
+ *   controller -> device   POST EAP-Initiate/Re-auth-Start
+ *   device -> controller   ACK  EAP-Initiate/Re-auth (keyName-NAI, SEQ, tag)
+ *   controller -> device   POST EAP-Finish/Re-auth (SEQ, tag) + OSCORE
+ *   device -> controller   ACK
+ *
+ * The tags are HMAC-SHA256-128 with the integrity key (rIK) and the
+ * new MSK (rMSK) is derived from the rRK and the SEQ, which the controller
+ * only accepts increasing. A device without rRK answers the Re-auth-Start
+ * with an empty ACK, and gets a full EAP authentication.
+ *
+ * The keys are derived as in RFC 6696 (KDF of RFC 5295 with HMAC-SHA256),
+ * but from the MSK: the authenticator does not export the EMSK.
+ *
+ * The cache of the controller has a fixed number of entries, indexed by
+ * the keyName of the device. The entries live ERP key lifetime seconds
+ * since the full authentication; they are kept in the order they were
+ * added, which is the order they expire in, so the expired ones and the
+ * ones evicted when it is full are always the oldest.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ERP_H
+#define ERP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EAP_CODE_INITIATE 5
+#define EAP_CODE_FINISH   6
+#define ERP_TYPE_REAUTH_START 1
+#define ERP_TYPE_REAUTH       2
+/** HMAC-SHA256-128.*/
+#define ERP_CRYPTOSUITE 2
+
+#define ERP_KEYNAME_LEN 8
+#define ERP_KEY_LEN 32
+#define ERP_RMSK_LEN 64
+#define ERP_TAG_LEN 16
+/** Length of EAP-Initiate/Re-auth-Start.*/
+#define ERP_START_LEN 6
+/** Length of EAP-Initiate/Re-auth and EAP-Finish/Re-auth.*/
+#define ERP_MSG_LEN (8 + 2 + 2 * ERP_KEYNAME_LEN + 1 + ERP_TAG_LEN)
+
+/** Steps of the ERP exchange of a session (coap_eap_ctx.erp).*/
+#define ERP_NONE     0
+#define ERP_STARTED  1
+#define ERP_FINISHED 2
+
+/** Keys of a device, derived from the MSK of its last full authentication.*/
+struct erp_keys {
+	/**Name of the rRK, sent in the keyName-NAI (in hex).*/
+	uint8_t keyname[ERP_KEYNAME_LEN];
+	uint8_t rrk[ERP_KEY_LEN];
+	uint8_t rik[ERP_KEY_LEN];
+};
+
+/** Fields of a parsed EAP-Initiate/Re-auth or EAP-Finish/Re-auth.*/
+struct erp_msg {
+	uint8_t code;
+	uint8_t id;
+	uint8_t flags;
+	uint16_t seq;
+	uint8_t keyname[ERP_KEYNAME_LEN];
+};
+
+/** Derives the keys of ERP from a MSK.*/
+void erp_derive(const uint8_t *msk, size_t msk_len, struct erp_keys *keys);
+/** Derives the rMSK of the re-authentication with sequence number seq.*/
+void erp_rmsk(const struct erp_keys *keys, uint16_t seq, uint8_t rmsk[ERP_RMSK_LEN]);
+
+/** Writes EAP-Initiate/Re-auth-Start in buf (ERP_START_LEN bytes).*/
+void erp_build_start(uint8_t id, uint8_t *buf);
+/** @return TRUE if buf is an EAP-Initiate/Re-auth-Start.*/
+int erp_is_start(const uint8_t *buf, size_t len);
+/**
+ * Writes EAP-Initiate/Re-auth (code EAP_CODE_INITIATE) or EAP-Finish/Re-auth
+ * (EAP_CODE_FINISH) in buf (ERP_MSG_LEN bytes), with its tag.
+ */
+void erp_build(uint8_t code, uint8_t id, uint8_t flags, uint16_t seq,
+		const struct erp_keys *keys, uint8_t *buf);
+/**
+ * Parses a message written by erp_build. The tag is not checked.
+ *
+ * @return 0 on success, -1 if buf is not a message of the code given.
+ */
+int erp_parse(const uint8_t *buf, size_t len, uint8_t code, struct erp_msg *msg);
+/** @return TRUE if the tag of the message parsed in buf is right.*/
+int erp_verify(const struct erp_keys *keys, const uint8_t *buf, size_t len);
+
+/** Counters of the cache.*/
+struct erp_cache_stats {
+	uint64_t added;
+	uint64_t hits;
+	/**keyName not found: evicted, expired or never added.*/
+	uint64_t misses;
+	uint64_t expired;
+	uint64_t evicted;
+	/**Tag or SEQ not valid.*/
+	uint64_t rejected;
+	uint32_t entries;
+	uint32_t capacity;
+	/**Memory of the cache, entries and index.*/
+	size_t bytes;
+};
+
+/**
+ * Allocates the cache of the controller.
+ *
+ * @param size Max number of devices, 0 disables ERP.
+ * @param lifetime Seconds the keys of a full authentication are kept.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int erp_cache_init(uint32_t size, double lifetime);
+/** @return TRUE if ERP is enabled.*/
+int erp_cache_enabled();
+/** Adds the keys derived from the MSK of a full authentication.*/
+void erp_cache_add(const uint8_t *msk, size_t msk_len, double now);
+/**
+ * Checks an EAP-Initiate/Re-auth received from a device: its keyName must
+ * be in the cache, its tag right and its SEQ higher than the last one
+ * accepted, which is updated.
+ *
+ * @param *buf The message.
+ * @param len Its length.
+ * @param now Current time.
+ * @param *msg The message parsed.
+ * @param *keys Keys of the device.
+ *
+ * @return 0 if it is accepted, -1 otherwise.
+ */
+int erp_cache_check(const uint8_t *buf, size_t len, double now,
+		struct erp_msg *msg, struct erp_keys *keys);
+/** @return The counters of the cache.*/
+void erp_cache_get_stats(struct erp_cache_stats *stats);
+void erp_cache_deinit();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
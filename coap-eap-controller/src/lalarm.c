@@ -114,8 +114,10 @@ struct lalarm_coap * add_alarm_coap_eap(struct lalarm_coap ** l,
  
     } else {
         struct lalarm_coap *aux = (*l);
-       
-        while (difftime(aux->tmp, tiempo) < 0 && final == 0) {//Search the place where the new alarm 
+
+        // The times are compared as doubles: difftime() takes time_t, it
+        // rounded them to seconds and left the alarms of a second unsorted.
+        while ((aux->tmp - tiempo) < 0 && final == 0) {//Search the place where the new alarm 
 
             if (aux->sig == NULL)//If we reach the end of the alarm list
                 final = TRUE;
@@ -131,7 +133,7 @@ struct lalarm_coap * add_alarm_coap_eap(struct lalarm_coap ** l,
             aux->sig->tmp = tiempo; 
             aux->sig->id = iden;
             aux->sig->sig = NULL;
-        } else if (difftime(aux->tmp, tiempo) > 0) { //If the place of the new alarm is between the start and the end, whe have two options:
+        } else if ((aux->tmp - tiempo) > 0) { //If the place of the new alarm is between the start and the end, whe have two options:
             // 		- If anterior == l the new alarm must be inserted in the first position.
             //		- Else, the new alarm must be inserted in an intermediate position.
             if (aux == (*l)) { // We have to insert the new alarm in the first position
@@ -148,7 +150,7 @@ struct lalarm_coap * add_alarm_coap_eap(struct lalarm_coap ** l,
                 anterior->sig->id = iden;
                 anterior->sig->sig = aux;
             }
-        } else if (difftime(aux->tmp, tiempo) == 0) { //If two alarms are at the same time, they are inserted too.
+        } else if ((aux->tmp - tiempo) == 0) { //If two alarms are at the same time, they are inserted too.
             struct lalarm *aux2 = anterior->sig;
             anterior->sig = XMALLOC(struct lalarm_coap,1);
             anterior->sig->coap_eap_session = session;
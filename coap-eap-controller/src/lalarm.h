@@ -55,6 +55,8 @@ extern "C" {
 #define POST_ALARM 6
 /** Alarm type identifier: Ping exchange Alarm.*/
 #define PUT_ALARM 7
+/** Alarm type identifier: AAA answer timeout Alarm.*/
+#define AAA_ALARM 8
 
 /** Struct that represents an alarms' list*/
 //struct lalarm {
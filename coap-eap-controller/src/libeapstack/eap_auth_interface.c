@@ -17,7 +17,9 @@ extern "C" {
 #include "../wpa_supplicant/src/radius/radius_client.h"
 #include "../wpa_supplicant/src/utils/ip_addr.h"
 #include "../wpa_supplicant/src/eap_common/eap_defs.h"
+#include "../wpa_supplicant/src/eap_common/eap_psk_common.h"
 #include "../wpa_supplicant/src/radius/radius.h"
+#include "../wpa_supplicant/src/crypto/md5.h"
 
 #ifdef __cplusplus
 }
@@ -28,6 +30,32 @@ struct radius_ctx *global_rad_ctx=NULL;
 pthread_mutex_t radmutex;
 pthread_mutex_t radmutex_list;
 
+/* Standalone mode: the methods and the callbacks are shared by every
+ * authenticator, the keys of the devices are taken from standalone_get_psk,
+ * or their AK and KDK from standalone_get_psk_keys if it is given. */
+static int (*standalone_get_psk)(const u8 *identity, size_t identity_len, u8 *psk) = NULL;
+static int (*standalone_get_psk_keys)(const u8 *identity, size_t identity_len,
+				      struct eap_psk_keys *keys) = NULL;
+static struct eap_method *standalone_methods = NULL;
+
+/* Pass-through mode: mask of the AAA servers of the pool a new session can
+ * go to, from the identity of the device. NULL for all of them. */
+static u32 (*radius_route)(const u8 *identity, size_t identity_len) = NULL;
+
+/* Pass-through mode: transport of the EAP responses instead of RADIUS,
+ * NULL for RADIUS. */
+static const struct eap_aaa_backend *aaa_backend = NULL;
+
+/* TLS context of EAP-TLS in standalone mode, shared by every authenticator.
+ * eap_auth_set_tls() replaces it, the one replaced is released when its
+ * last authenticator is. */
+struct eap_auth_tls {
+	void *ssl_ctx;
+	int refs;
+};
+static struct eap_auth_tls *standalone_tls = NULL;
+static pthread_mutex_t tlsmutex = PTHREAD_MUTEX_INITIALIZER;
+
 static char *eap_type_text(u8 type)
 {
 	switch (type) {
@@ -125,6 +153,115 @@ find_extra_attr(struct extra_radius_attr *attrs, u8 type)
 }
 
 
+/* Encodes the attributes of the Access-Requests that are the same in all of
+ * them: NAS-IP-Address, Calling-Station-Id, Framed-MTU, NAS-Port-Type and
+ * Connect-Info, unless they are extra attributes, and the extra attributes */
+static int eap_auth_build_static_attrs(struct radius_ctx *radctx)
+{
+	struct radius_msg *msg;
+	struct extra_radius_attr *p;
+	struct wpabuf *wbuf;
+	char buf[128];
+	int count = 0;
+
+	msg = radius_msg_new(RADIUS_CODE_ACCESS_REQUEST, 0);
+	if (msg == NULL)
+		return -1;
+
+	if (!find_extra_attr(radctx->extra_attrs, RADIUS_ATTR_NAS_IP_ADDRESS)) {
+		if (!radius_msg_add_attr(msg, RADIUS_ATTR_NAS_IP_ADDRESS,
+								 (u8 *) &radctx->own_ip_addr, 4)) {
+			printf("Could not add NAS-IP-Address\n");
+			goto fail;
+		}
+		count++;
+	}
+
+	os_snprintf(buf, sizeof(buf), RADIUS_802_1X_ADDR_FORMAT, MAC2STR(radctx->own_addr));
+	if (!find_extra_attr(radctx->extra_attrs, RADIUS_ATTR_CALLING_STATION_ID)) {
+		if (!radius_msg_add_attr(msg, RADIUS_ATTR_CALLING_STATION_ID,
+								 (u8 *) buf, os_strlen(buf))) {
+			printf("Could not add Calling-Station-Id\n");
+			goto fail;
+		}
+		count++;
+	}
+
+	/* TODO: should probably check MTU from driver config; 2304 is max for
+	 * IEEE 802.11, but use 1400 to avoid problems with too large packets
+	 */
+	if (!find_extra_attr(radctx->extra_attrs, RADIUS_ATTR_FRAMED_MTU)) {
+		if (!radius_msg_add_attr_int32(msg, RADIUS_ATTR_FRAMED_MTU, 1400)) {
+			printf("Could not add Framed-MTU\n");
+			goto fail;
+		}
+		count++;
+	}
+
+	if (!find_extra_attr(radctx->extra_attrs, RADIUS_ATTR_NAS_PORT_TYPE)) {
+		if (!radius_msg_add_attr_int32(msg, RADIUS_ATTR_NAS_PORT_TYPE,
+									   RADIUS_NAS_PORT_TYPE_IEEE_802_11)) {
+			printf("Could not add NAS-Port-Type\n");
+			goto fail;
+		}
+		count++;
+	}
+
+	os_snprintf(buf, sizeof(buf), "%s", radctx->connect_info);
+	if (!find_extra_attr(radctx->extra_attrs, RADIUS_ATTR_CONNECT_INFO)) {
+		if (!radius_msg_add_attr(msg, RADIUS_ATTR_CONNECT_INFO,
+								 (u8 *) buf, os_strlen(buf))) {
+			printf("Could not add Connect-Info\n");
+			goto fail;
+		}
+		count++;
+	}
+
+	if (add_extra_attrs(msg, radctx->extra_attrs) < 0)
+		goto fail;
+	for (p = radctx->extra_attrs; p; p = p->next)
+		count++;
+
+	wbuf = radius_msg_get_buf(msg);
+	os_free(radctx->static_attrs);
+	radctx->static_attrs_len = wpabuf_len(wbuf) - sizeof(struct radius_hdr);
+	radctx->static_attrs = os_malloc(radctx->static_attrs_len + 1);
+	if (radctx->static_attrs == NULL)
+		goto fail;
+	os_memcpy(radctx->static_attrs, wpabuf_head_u8(wbuf) + sizeof(struct radius_hdr),
+			  radctx->static_attrs_len);
+	radctx->static_attrs_count = count;
+	radius_msg_free(msg);
+	return 0;
+
+fail:
+	radius_msg_free(msg);
+	return -1;
+}
+
+
+/* The identity of the device is taken from its EAP-Response/Identity */
+static void eap_auth_learn_identity(struct eap_auth_ctx *eap_ctx, const u8 *eap, size_t len)
+{
+	const struct eap_hdr *hdr = (const struct eap_hdr *) eap;
+	const u8 *pos = (const u8 *) (hdr + 1);
+
+	if (len > sizeof(*hdr) && hdr->code == EAP_CODE_RESPONSE &&
+		pos[0] == EAP_TYPE_IDENTITY) {
+		pos++;
+		os_free(eap_ctx->eap_identity);
+		eap_ctx->eap_identity_len = len - sizeof(*hdr) - 1;
+		eap_ctx->eap_identity = os_malloc(eap_ctx->eap_identity_len);
+		if (eap_ctx->eap_identity) {
+			os_memcpy(eap_ctx->eap_identity, pos, eap_ctx->eap_identity_len);
+			wpa_hexdump(MSG_DEBUG, "Learned identity from "
+						"EAP-Response-Identity",
+						eap_ctx->eap_identity, eap_ctx->eap_identity_len);
+		}
+	}
+}
+
+
 static void eap_auth_encapsulate_radius(struct eap_auth_ctx *eap_ctx, const struct wpabuf *eap_buf)
 {
 
@@ -132,11 +269,11 @@ static void eap_auth_encapsulate_radius(struct eap_auth_ctx *eap_ctx, const stru
 		
 		
 		struct radius_msg *msg;
-		char buf[128];
 		u8 *eap;
-		size_t len;
-		const struct eap_hdr *hdr;
-		const u8 *pos;
+		size_t len, msg_len, attr_count, state_len = 0, state_count = 0, attr_len;
+		int server;
+		struct radius_msg *challenge = NULL;
+		u8 *state = NULL;
     	
 		eap = wpabuf_head(eap_buf);
 		len = wpabuf_len(eap_buf);
@@ -144,15 +281,42 @@ static void eap_auth_encapsulate_radius(struct eap_auth_ctx *eap_ctx, const stru
 		wpa_printf(MSG_DEBUG, "Encapsulating EAP message into a RADIUS "
 				   "packet");
 		
+		eap_auth_learn_identity(eap_ctx, eap, len);
 		
+		/* State attribute must be copied if and only if this packet is
+		 * Access-Request reply to the previous Access-Challenge */
+		if (eap_ctx->last_recv_radius &&
+			radius_msg_get_hdr(eap_ctx->last_recv_radius)->code ==
+			RADIUS_CODE_ACCESS_CHALLENGE) {
+			challenge = eap_ctx->last_recv_radius;
+			while (radius_msg_get_attr_ptr(challenge, RADIUS_ATTR_STATE, &state,
+										   &attr_len, state) == 0) {
+				state_len += sizeof(struct radius_attr_hdr) + attr_len;
+				state_count++;
+			}
+		}
+		
+		/* The whole message in one buffer: header, User-Name, the static
+		 * attributes, the EAP-Message fragments, State and
+		 * Message-Authenticator */
+		attr_count = 1 + radctx->static_attrs_count + state_count + 1;
+		msg_len = sizeof(struct radius_hdr) + radctx->static_attrs_len + state_len +
+			sizeof(struct radius_attr_hdr) + MD5_MAC_LEN;
+		if (eap_ctx->eap_identity)
+			msg_len += sizeof(struct radius_attr_hdr) + eap_ctx->eap_identity_len;
+		if (eap) {
+			attr_count += (len + RADIUS_MAX_ATTR_LEN - 1) / RADIUS_MAX_ATTR_LEN;
+			msg_len += len + sizeof(struct radius_attr_hdr) *
+				((len + RADIUS_MAX_ATTR_LEN - 1) / RADIUS_MAX_ATTR_LEN);
+		}
 		
 		/*We enter the critical section to prepare a message to be sent*/
 		
 		
 		eap_ctx->radius_identifier = radius_client_get_id(radctx->radius);		
 		
-		msg = radius_msg_new(RADIUS_CODE_ACCESS_REQUEST,
-							 eap_ctx->radius_identifier);
+		msg = radius_msg_new_sized(RADIUS_CODE_ACCESS_REQUEST,
+								   eap_ctx->radius_identifier, msg_len, attr_count);
 
 		
 		if (msg == NULL) {
@@ -162,22 +326,6 @@ static void eap_auth_encapsulate_radius(struct eap_auth_ctx *eap_ctx, const stru
 		
 		radius_msg_make_authenticator(msg, (u8 *) eap_ctx, sizeof(*eap_ctx));
 		
-		hdr = (const struct eap_hdr *) eap;
-		pos = (const u8 *) (hdr + 1);
-		if (len > sizeof(*hdr) && hdr->code == EAP_CODE_RESPONSE &&
-			pos[0] == EAP_TYPE_IDENTITY) {
-			pos++;
-			os_free(eap_ctx->eap_identity);
-			eap_ctx->eap_identity_len = len - sizeof(*hdr) - 1;
-			eap_ctx->eap_identity = os_malloc(eap_ctx->eap_identity_len);
-			if (eap_ctx->eap_identity) {
-				os_memcpy(eap_ctx->eap_identity, pos, eap_ctx->eap_identity_len);
-				wpa_hexdump(MSG_DEBUG, "Learned identity from "
-							"EAP-Response-Identity",
-							eap_ctx->eap_identity, eap_ctx->eap_identity_len);
-			}
-		}
-		
 		if (eap_ctx->eap_identity &&
 			!radius_msg_add_attr(msg, RADIUS_ATTR_USER_NAME,
 								 eap_ctx->eap_identity, eap_ctx->eap_identity_len)) {
@@ -185,62 +333,18 @@ static void eap_auth_encapsulate_radius(struct eap_auth_ctx *eap_ctx, const stru
 				goto fail;
 			}
 		
-		if (!find_extra_attr(radctx->extra_attrs, RADIUS_ATTR_NAS_IP_ADDRESS) &&
-			!radius_msg_add_attr(msg, RADIUS_ATTR_NAS_IP_ADDRESS,
-								 (u8 *) &radctx->own_ip_addr, 4)) {
-				printf("Could not add NAS-IP-Address\n");
-				goto fail;
-			}
-		
-		os_snprintf(buf, sizeof(buf), RADIUS_802_1X_ADDR_FORMAT, MAC2STR(eap_ctx->own_addr));
-		if (!find_extra_attr(radctx->extra_attrs, RADIUS_ATTR_CALLING_STATION_ID)
-			&&
-			!radius_msg_add_attr(msg, RADIUS_ATTR_CALLING_STATION_ID,
-								 (u8 *) buf, os_strlen(buf))) {
-				printf("Could not add Calling-Station-Id\n");
-				goto fail;
-			}
-		
-		/* TODO: should probably check MTU from driver config; 2304 is max for
-		 * IEEE 802.11, but use 1400 to avoid problems with too large packets
-		 */
-		if (!find_extra_attr(radctx->extra_attrs, RADIUS_ATTR_FRAMED_MTU) &&
-			!radius_msg_add_attr_int32(msg, RADIUS_ATTR_FRAMED_MTU, 1400)) {
-			printf("Could not add Framed-MTU\n");
+		if (radius_msg_add_attrs(msg, radctx->static_attrs, radctx->static_attrs_len) < 0) {
+			printf("Could not add the static attributes\n");
 			goto fail;
 		}
 		
-		if (!find_extra_attr(radctx->extra_attrs, RADIUS_ATTR_NAS_PORT_TYPE) &&
-			!radius_msg_add_attr_int32(msg, RADIUS_ATTR_NAS_PORT_TYPE,
-									   RADIUS_NAS_PORT_TYPE_IEEE_802_11)) {
-				printf("Could not add NAS-Port-Type\n");
-				goto fail;
-			}
-		
-		os_snprintf(buf, sizeof(buf), "%s", radctx->connect_info);
-		if (!find_extra_attr(radctx->extra_attrs, RADIUS_ATTR_CONNECT_INFO) &&
-			!radius_msg_add_attr(msg, RADIUS_ATTR_CONNECT_INFO,
-								 (u8 *) buf, os_strlen(buf))) {
-				printf("Could not add Connect-Info\n");
-				goto fail;
-			}
-		
-		if (add_extra_attrs(msg, radctx->extra_attrs) < 0)
-			goto fail;
-		
 		if (eap && !radius_msg_add_eap(msg, eap, len)) {
 			printf("Could not add EAP-Message\n");
 			goto fail;
 		}
 		
-		/* State attribute must be copied if and only if this packet is
-		 * Access-Request reply to the previous Access-Challenge */
-		
-		if (eap_ctx->last_recv_radius &&
-			radius_msg_get_hdr(eap_ctx->last_recv_radius)->code ==
-			RADIUS_CODE_ACCESS_CHALLENGE) {
-			int res = radius_msg_copy_attr(msg, eap_ctx->last_recv_radius,
-										   RADIUS_ATTR_STATE);
+		if (challenge) {
+			int res = radius_msg_copy_attr(msg, challenge, RADIUS_ATTR_STATE);
 			if (res < 0) {
 				printf("Could not copy State attribute from previous "
 					   "Access-Challenge\n");
@@ -255,7 +359,19 @@ static void eap_auth_encapsulate_radius(struct eap_auth_ctx *eap_ctx, const stru
 		//Update the last RADIUS message sended
 		eap_ctx->last_send_radius = msg;
 		
-		radius_client_send(radctx->radius, msg, RADIUS_AUTH, eap_ctx->own_addr,(void *)eap_ctx);
+		/* A new session, without State, can go to any server of the
+		 * pool (of its realm), the next Access-Requests to the one
+		 * that holds it */
+		if (challenge)
+			server = eap_ctx->radius_server;
+		else if (radius_route != NULL && eap_ctx->eap_identity)
+			server = radius_client_select_server(radctx->radius,
+				radius_route(eap_ctx->eap_identity, eap_ctx->eap_identity_len));
+		else
+			server = -1;
+		radius_client_send_server(radctx->radius, msg, eap_ctx->own_addr,
+					  (void *)eap_ctx, &server);
+		eap_ctx->radius_server = server;
 		return;
 		
 	fail:
@@ -263,6 +379,27 @@ static void eap_auth_encapsulate_radius(struct eap_auth_ctx *eap_ctx, const stru
 }
 
 
+/* Sends the EAP response through the AAA backend, with the State of the
+ * last challenge */
+static void eap_auth_send_aaa(struct eap_auth_ctx *eap_ctx, const struct wpabuf *eap_buf)
+{
+	const u8 *eap = wpabuf_head(eap_buf);
+	size_t len = wpabuf_len(eap_buf);
+
+	wpa_printf(MSG_DEBUG, "Sending EAP message through %s", aaa_backend->name);
+
+	eap_auth_learn_identity(eap_ctx, eap, len);
+
+	if (aaa_backend->send(eap_ctx, eap, len, eap_ctx->aaa_state,
+			      eap_ctx->aaa_state_len, &eap_ctx->aaa_id) < 0) {
+		printf("Could not send the EAP message through %s\n", aaa_backend->name);
+		eap_ctx->aaa_pending = 0;
+		return;
+	}
+	eap_ctx->aaa_pending = 1;
+}
+
+
 static void eap_auth_get_keys(struct eap_auth_ctx *eap_ctx,
 								struct radius_msg *msg, struct radius_msg *req,
 								const u8 *shared_secret,
@@ -331,10 +468,7 @@ static void eap_auth_decapsulate_radius(struct eap_auth_ctx *eap_ctx)
 		return;
 	}
 
-	int length = ntohs(radius_msg_get_hdr(eap_ctx->last_recv_radius)->length);
-	msg = malloc (length*sizeof(char));
-	memcpy (msg, eap_ctx->last_recv_radius, length*sizeof(char));
-	//msg = eap_ctx->last_recv_radius;
+	msg = eap_ctx->last_recv_radius;
 	
 	eap = radius_msg_get_eap(msg, &len);
 	if (eap == NULL) {
@@ -450,17 +584,13 @@ eap_auth_receive_radius(struct radius_msg *msg, struct radius_msg *req,
 	/*********************************************************************************************/
 
 	wpa_printf(MSG_DEBUG, "RADIUS packet matching with station");
+	/* Answered: later answers with the same identifier are for another session */
+	eap_ctx->radius_identifier = -1;
 
-	//if (eap_ctx->last_recv_radius != NULL){
-		//radius_msg_free(eap_ctx->last_recv_radius); //fixme: This line must be uncommented?
-	//}
-
-	int length = ntohs(radius_msg_get_hdr(msg)->length);
-	eap_ctx->last_recv_radius = malloc(length *sizeof(char));
-	memcpy(eap_ctx->last_recv_radius, msg, length * sizeof(char));
-
-	//The 3 lines of code above replace the following one
-	//eap_ctx->last_recv_radius = msg;
+	/* The answer is kept (RADIUS_RX_QUEUED) until the next one, for its
+	 * State attribute */
+	radius_msg_free(eap_ctx->last_recv_radius);
+	eap_ctx->last_recv_radius = msg;
 
 
 	session_timeout_set = !radius_msg_get_attr_int32(msg, RADIUS_ATTR_SESSION_TIMEOUT,
@@ -556,12 +686,96 @@ eap_auth_receive_radius(struct radius_msg *msg, struct radius_msg *req,
 
 
 
+int eap_auth_aaa_answer(struct eap_auth_ctx *eap_ctx, const struct eap_aaa_answer *answer)
+{
+	pthread_mutex_lock(&radmutex);
+
+	if (!eap_ctx->aaa_pending || eap_ctx->aaa_id != answer->id) {
+		pthread_mutex_unlock(&radmutex);
+		return -1;
+	}
+	eap_ctx->aaa_pending = 0;
+
+	/* The State is only sent back in the response to a challenge */
+	os_free(eap_ctx->aaa_state);
+	eap_ctx->aaa_state = NULL;
+	eap_ctx->aaa_state_len = 0;
+	if (answer->result == EAP_AAA_CHALLENGE && answer->state_len > 0) {
+		eap_ctx->aaa_state = os_malloc(answer->state_len);
+		if (eap_ctx->aaa_state) {
+			os_memcpy(eap_ctx->aaa_state, answer->state, answer->state_len);
+			eap_ctx->aaa_state_len = answer->state_len;
+		}
+	}
+
+	if (answer->eap != NULL && answer->eap_len >= sizeof(struct eap_hdr)) {
+		wpabuf_free(eap_ctx->eap_if->aaaEapReqData);
+		eap_ctx->eap_if->aaaEapReqData = wpabuf_alloc_copy(answer->eap, answer->eap_len);
+		eap_ctx->eap_if->aaaEapReq = TRUE;
+	}
+
+	switch (answer->result) {
+		case EAP_AAA_ACCEPT:
+			eap_ctx->eap_if->aaaSuccess = TRUE;
+			eap_ctx->eap_if->aaaEapReq = FALSE;
+			/* The MSK, as the MS-MPPE keys of RADIUS */
+			if (answer->msk_len >= 64) {
+				os_free(eap_ctx->eap_if->aaaEapKeyData);
+				eap_ctx->eap_if->aaaEapKeyData = os_malloc(64);
+				if (eap_ctx->eap_if->aaaEapKeyData) {
+					os_memcpy(eap_ctx->eap_if->aaaEapKeyData, answer->msk, 64);
+					eap_ctx->eap_if->aaaEapKeyDataLen = 64;
+					eap_ctx->eap_if->aaaEapKeyAvailable = TRUE;
+				}
+			}
+			break;
+		case EAP_AAA_REJECT:
+			eap_ctx->radius_access_reject_received = 1;
+			eap_ctx->eap_if->aaaFail = TRUE;
+			eap_ctx->eap_if->aaaEapReq = FALSE;
+			break;
+	}
+
+	eap_server_sm_step(eap_ctx->eap);
+
+	pthread_mutex_unlock(&radmutex);
+	return 0;
+}
+
+
+
 static int server_get_eap_user(void *ctx, const u8 *identity,
 							   size_t identity_len, int phase2,
 							   struct eap_user *user)
 {
 	os_memset(user, 0, sizeof(*user));
 
+	if (standalone_get_psk != NULL) {
+		/* Only EAP-PSK, with the key of the device */
+		u8 psk[EAP_PSK_PSK_LEN];
+
+		if (standalone_get_psk(identity, identity_len, psk) < 0) {
+			/* The devices not in the store use EAP-TLS, if any */
+			if (standalone_tls == NULL)
+				return -1;
+			user->methods[0].vendor = EAP_VENDOR_IETF;
+			user->methods[0].method = EAP_TYPE_TLS;
+			return 0;
+		}
+		user->methods[0].vendor = EAP_VENDOR_IETF;
+		user->methods[0].method = EAP_TYPE_PSK;
+		/* EAP-PSK does not need the PSK if the store has its keys */
+		if (standalone_get_psk_keys == NULL) {
+			user->password = os_malloc(EAP_PSK_PSK_LEN);
+			if (user->password == NULL)
+				return -1;
+			os_memcpy(user->password, psk, EAP_PSK_PSK_LEN);
+			user->password_len = EAP_PSK_PSK_LEN;
+		}
+		os_memset(psk, 0, sizeof(psk));
+		return 0;
+	}
+
     printf("ENTRAMOS EN SERVER_GET_EAP_USER\n");
 
     if (!phase2) {
@@ -592,6 +806,20 @@ static const char * server_get_eap_req_id_text(void *ctx, size_t *len)
 	return NULL;
 }
 
+static int server_get_eap_psk_keys(void *ctx, const u8 *identity,
+				   size_t identity_len, struct eap_psk_keys *keys)
+{
+	if (standalone_get_psk_keys == NULL)
+		return -1;
+	return standalone_get_psk_keys(identity, identity_len, keys);
+}
+
+static struct eapol_callbacks standalone_cb = {
+	.get_eap_user = server_get_eap_user,
+	.get_eap_req_id_text = server_get_eap_req_id_text,
+	.get_eap_psk_keys = server_get_eap_psk_keys,
+};
+
 /**This is for the standalone authenticator**/
 static int eap_server_register_methods(struct eap_method **eap_methods)
 {
@@ -699,15 +927,16 @@ static int eap_server_register_methods(struct eap_method **eap_methods)
 	return ret;
 }
 
-static int eap_auth_init_tls(struct eap_auth_ctx *eap_ctx, char* cacert, char* servercert, char* serverkey)
+static void *eap_auth_init_tls(char* cacert, char* servercert, char* serverkey)
 {
 	struct tls_config tconf;
 	struct tls_connection_params tparams;
+	void *tls_ctx;
 	
 	os_memset(&tconf, 0, sizeof(tconf));
-	eap_ctx->tls_ctx = tls_init(&tconf);
-	if (eap_ctx->tls_ctx == NULL){
-		return -1;
+	tls_ctx = tls_init(&tconf);
+	if (tls_ctx == NULL){
+		return NULL;
 	}
 	
 	os_memset(&tparams, 0, sizeof(tparams));
@@ -717,29 +946,48 @@ static int eap_auth_init_tls(struct eap_auth_ctx *eap_ctx, char* cacert, char* s
 	//tparams.private_key = "server-key.pem";
 	/* tparams.private_key_passwd = "whatever"; */
 	
-	if (tls_global_set_params(eap_ctx->tls_ctx, &tparams)) {
+	if (tls_global_set_params(tls_ctx, &tparams)) {
 		printf("Failed to set TLS parameters\n");
-		return -1;
+		tls_deinit(tls_ctx);
+		return NULL;
 	}
 	
-	if (tls_global_set_verify(eap_ctx->tls_ctx, 0)) {
+	if (tls_global_set_verify(tls_ctx, 0)) {
 		printf("Failed to set check_crl\n");
-		return -1;
+		tls_deinit(tls_ctx);
+		return NULL;
 	}
 
-	return 0;
+	return tls_ctx;
+}
+
+static void eap_auth_tls_release(struct eap_auth_tls *tls)
+{
+	if (tls == NULL)
+		return;
+	pthread_mutex_lock(&tlsmutex);
+	if (--tls->refs == 0) {
+		tls_deinit(tls->ssl_ctx);
+		os_free(tls);
+	}
+	pthread_mutex_unlock(&tlsmutex);
 }
 
 struct radius_ctx *rad_client_init(char *ip, int port, char * shared_secret)
 {
-	char *as_addr = ip;
-	int as_port = port;
+	return rad_client_init_pool(&ip, &port, 1, shared_secret,
+				    RADIUS_BALANCE_FAILOVER, 0);
+}
+
+struct radius_ctx *rad_client_init_pool(char **ips, int *ports, int num,
+					char *shared_secret, int balance,
+					int status_interval)
+{
 	char *as_secret = shared_secret;
-	char *cli_addr = NULL;
 	
-	struct extra_radius_attr *p = NULL, *p1;
 	struct hostapd_radius_server *srv;
 	struct radius_ctx *rad_ctx = global_rad_ctx;
+	int i;
 	
 	if (rad_ctx == NULL)
 	{			
@@ -760,22 +1008,28 @@ struct radius_ctx *rad_client_init(char *ip, int port, char * shared_secret)
 	
 		rad_ctx->connect_info=os_zalloc(sizeof("CONNECT 11Mbps 802.11b")+1);
 		os_snprintf(rad_ctx->connect_info, sizeof(rad_ctx->connect_info), "%s", "CONNECT 11Mbps 802.11b");
+		if (eap_auth_build_static_attrs(rad_ctx) < 0)
+			return NULL;
 	
-		srv = os_zalloc(sizeof(*srv));
+		srv = os_zalloc(num * sizeof(*srv));
 		if (srv == NULL)	
 			return NULL;
 	
-		srv->addr.af = AF_INET;
-		srv->port = as_port;
-		if (hostapd_parse_ip_addr(as_addr, &srv->addr) < 0) {
-			printf("Failed to parse IP address\n");
-			return NULL;
+		for (i = 0; i < num; i++) {
+			srv[i].addr.af = AF_INET;
+			srv[i].port = ports[i];
+			if (hostapd_parse_ip_addr(ips[i], &srv[i].addr) < 0) {
+				printf("Failed to parse IP address %s\n", ips[i]);
+				return NULL;
+			}
+			srv[i].shared_secret = (u8 *) os_strdup(as_secret); //Rafa: Obtain this password from a file
+			srv[i].shared_secret_len = strlen(as_secret);
 		}
-		srv->shared_secret = (u8 *) os_strdup(as_secret); //Rafa: Obtain this password from a file
-		srv->shared_secret_len = strlen(as_secret);
 	
 		rad_ctx->conf.auth_server = rad_ctx->conf.auth_servers = srv;
-		rad_ctx->conf.num_auth_servers = 1;
+		rad_ctx->conf.num_auth_servers = num;
+		rad_ctx->conf.balance = balance;
+		rad_ctx->conf.status_interval = status_interval;
 		rad_ctx->conf.msg_dumps = 1;
 	
 		rad_ctx->radius = radius_client_init(rad_ctx, &(rad_ctx->conf));
@@ -825,7 +1079,8 @@ struct eap_auth_ctx *search_eap_ctx_rad_client(u8 identifier)
 	
 	while (searched != NULL)
 	{
-		if (searched->radius_identifier == identifier) break; 
+		if (searched->radius_identifier >= 0 &&
+		    searched->radius_identifier == identifier) break; 
 		else	
 			searched=searched->next;
 		
@@ -835,8 +1090,114 @@ struct eap_auth_ctx *search_eap_ctx_rad_client(u8 identifier)
 }
 
 
+int eap_auth_set_standalone(int (*get_psk)(const u8 *identity, size_t identity_len, u8 *psk),
+			    int (*get_psk_keys)(const u8 *identity, size_t identity_len,
+						struct eap_psk_keys *keys))
+{
+	if (get_psk != NULL &&
+	    eap_server_get_eap_method(standalone_methods, EAP_VENDOR_IETF,
+				      EAP_TYPE_PSK) == NULL &&
+	    (eap_server_identity_register(&standalone_methods) < 0 ||
+	     eap_server_psk_register(&standalone_methods) < 0)) {
+		eap_server_unregister_methods(&standalone_methods);
+		return -1;
+	}
+	standalone_get_psk = get_psk;
+	standalone_get_psk_keys = get_psk != NULL ? get_psk_keys : NULL;
+	return 0;
+}
+
+void eap_auth_set_radius_route(u32 (*route)(const u8 *identity, size_t identity_len))
+{
+	radius_route = route;
+}
+
+void eap_auth_set_aaa_backend(const struct eap_aaa_backend *backend)
+{
+	aaa_backend = backend;
+}
+
+int eap_auth_set_tls(char *cacert, char *servercert, char *serverkey,
+		     size_t cache_size, unsigned int lifetime, int tickets)
+{
+	struct eap_auth_tls *tls = NULL, *old;
+
+	if (servercert != NULL) {
+#ifdef EAP_SERVER_TLS
+		if (eap_server_get_eap_method(standalone_methods, EAP_VENDOR_IETF,
+					      EAP_TYPE_TLS) == NULL &&
+		    eap_server_tls_register(&standalone_methods) < 0)
+			return -1;
+#else /* EAP_SERVER_TLS */
+		return -1;
+#endif /* EAP_SERVER_TLS */
+
+		tls = os_zalloc(sizeof(*tls));
+		if (tls == NULL)
+			return -1;
+		tls->refs = 1;
+		tls->ssl_ctx = eap_auth_init_tls(cacert, servercert, serverkey);
+		if (tls->ssl_ctx == NULL) {
+			os_free(tls);
+			return -1;
+		}
+		if (tls_global_set_session_cache(tls->ssl_ctx, cache_size,
+						 lifetime, tickets) < 0) {
+			printf("Failed to set the TLS session cache\n");
+			eap_auth_tls_release(tls);
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock(&tlsmutex);
+	old = standalone_tls;
+	standalone_tls = tls;
+	pthread_mutex_unlock(&tlsmutex);
+	eap_auth_tls_release(old);
+	return 0;
+}
+
+/* The EAP server of the authenticator runs EAP-PSK itself, there is no
+ * RADIUS exchange, so it is not added to the list of the RADIUS client. */
+static int eap_auth_init_standalone(struct eap_auth_ctx *eap_ctx, void *eap_ll_ctx)
+{
+	struct eap_config eap_conf;
+
+	os_memset(eap_ctx, 0, sizeof(*eap_ctx));
+	eap_ctx->radius_identifier = -1;
+	eap_ctx->radius_server = -1;
+
+	pthread_mutex_lock(&tlsmutex);
+	eap_ctx->tls = standalone_tls;
+	if (eap_ctx->tls != NULL) {
+		eap_ctx->tls->refs++;
+		eap_ctx->tls_ctx = eap_ctx->tls->ssl_ctx;
+	}
+	pthread_mutex_unlock(&tlsmutex);
+
+	os_memset(&eap_conf, 0, sizeof(eap_conf));
+	eap_conf.eap_server = 1;
+	eap_conf.eap_methods = standalone_methods;
+	eap_conf.ssl_ctx = eap_ctx->tls_ctx;
+
+	eap_ctx->eap = eap_server_sm_init(eap_ctx, &standalone_cb, &eap_conf);
+	if (eap_ctx->eap == NULL) {
+		eap_auth_tls_release(eap_ctx->tls);
+		return -1;
+	}
+
+	eap_ctx->eap_if = eap_get_interface(eap_ctx->eap);
+	eap_ctx->eap_if->portEnabled = TRUE;
+	eap_ctx->eap_if->eapRestart = TRUE;
+	eap_ctx->eap_ll_ctx = eap_ll_ctx;
+	return 0;
+}
+
 int eap_auth_init(struct eap_auth_ctx *eap_ctx, void *eap_ll_ctx, char* cacert, char* servercert, char* serverkey)
 {
+	if (standalone_get_psk != NULL)
+		return eap_auth_init_standalone(eap_ctx, eap_ll_ctx);
+
 	pthread_mutex_lock(&radmutex);
 	/*if (rad_client_init(&global_rad_ctx) < 0)
 		return -1;*/
@@ -848,6 +1209,8 @@ int eap_auth_init(struct eap_auth_ctx *eap_ctx, void *eap_ll_ctx, char* cacert,
 	eap_conf=os_zalloc(sizeof(*eap_conf));
 	
 	os_memset(eap_ctx, 0, sizeof(*eap_ctx));
+	eap_ctx->radius_identifier = -1;
+	eap_ctx->radius_server = -1;
 	
 	if (eap_server_register_methods(&(eap_ctx->eap_methods)) < 0)
 	{
@@ -855,9 +1218,6 @@ int eap_auth_init(struct eap_auth_ctx *eap_ctx, void *eap_ll_ctx, char* cacert,
 		return -1;
 	}
 	
-	/*if (eap_auth_init_tls(eap_ctx, cacert, servercert, serverkey) < 0)
-		return -1;*/
-	
 	os_memset(eap_cb, 0, sizeof(*eap_cb));
 	eap_cb->get_eap_user = server_get_eap_user;
 	eap_cb->get_eap_req_id_text = server_get_eap_req_id_text;
@@ -885,7 +1245,9 @@ int eap_auth_init(struct eap_auth_ctx *eap_ctx, void *eap_ll_ctx, char* cacert,
 	 */
 	//radctx->eap_srv_ctx=eap_ctx;
 	eap_ctx->rad_ctx = global_rad_ctx;
-	add_eap_ctx_rad_client(eap_ctx);
+	/* The answers of another backend are not looked up in the list */
+	if (aaa_backend == NULL)
+		add_eap_ctx_rad_client(eap_ctx);
 	//eap_ctx->eap_ll_cb = eap_ll_cb;
 	eap_ctx->eap_ll_ctx = eap_ll_ctx;
 
@@ -899,7 +1261,14 @@ void eap_auth_deinit(struct eap_auth_ctx *eap_ctx)
 	
 	eap_server_sm_deinit(eap_ctx->eap);
 	eap_server_unregister_methods(&(eap_ctx->eap_methods));
-	tls_deinit(eap_ctx->tls_ctx);
+	// Only the standalone authenticators have a TLS context, shared.
+	eap_auth_tls_release(eap_ctx->tls);
+	eap_ctx->tls = NULL;
+	eap_ctx->tls_ctx = NULL;
+	radius_msg_free(eap_ctx->last_recv_radius);
+	eap_ctx->last_recv_radius = NULL;
+	os_free(eap_ctx->aaa_state);
+	eap_ctx->aaa_state = NULL;
 	
 	pthread_mutex_unlock(&radmutex);
 }
@@ -914,7 +1283,10 @@ int eap_auth_step(struct eap_auth_ctx* eap_ctx)
 	
 	if (eap_ctx->eap_if->aaaEapResp)
 	{
-		eap_auth_encapsulate_radius(eap_ctx,eap_ctx->eap_if->aaaEapRespData);
+		if (aaa_backend != NULL)
+			eap_auth_send_aaa(eap_ctx, eap_ctx->eap_if->aaaEapRespData);
+		else
+			eap_auth_encapsulate_radius(eap_ctx,eap_ctx->eap_if->aaaEapRespData);
 		eap_ctx->eap_if->aaaEapResp = FALSE;
 	}
 		
@@ -1009,6 +1381,14 @@ struct wpabuf *eap_auth_get_eapReqData(struct eap_auth_ctx* eap_ctx)
 	return eap_ctx->eap_if->eapReqData;				
 }
 
+struct wpabuf *eap_auth_take_eapReqData(struct eap_auth_ctx* eap_ctx)
+{
+	struct wpabuf *req = eap_ctx->eap_if->eapReqData;
+
+	eap_ctx->eap_if->eapReqData = NULL;
+	return req;
+}
+
 Boolean eap_auth_get_eapNoReq(struct eap_auth_ctx* eap_ctx)
 {
 	return eap_ctx->eap_if->eapNoReq;				
@@ -1065,3 +1445,109 @@ u8 *eap_auth_get_eapIdentity(struct eap_auth_ctx *eap_ctx, size_t *length)
 	*length = eap_ctx->eap_identity_len;
 	return eap_ctx->eap_identity;
 }
+
+/*Returns the identifier of the EAP request the peer has to answer and
+ *whether the EAP authenticator is in pass-through mode*/
+int eap_auth_get_resume_state(struct eap_auth_ctx *eap_ctx, int *passthrough)
+{
+	return eap_server_sm_get_resume_state(eap_ctx->eap, passthrough);
+}
+
+/*Copies the State attribute of the last Access-Challenge (or the State
+ *of the last challenge of the AAA backend) into buf.
+ *Returns its length, 0 if there is none or -1 if it does not fit*/
+int eap_auth_get_radius_state(struct eap_auth_ctx *eap_ctx, u8 *buf, size_t len)
+{
+	int res;
+
+	if (aaa_backend != NULL) {
+		if (eap_ctx->aaa_state_len > len)
+			return -1;
+		if (eap_ctx->aaa_state_len > 0)
+			os_memcpy(buf, eap_ctx->aaa_state, eap_ctx->aaa_state_len);
+		return (int) eap_ctx->aaa_state_len;
+	}
+
+	if (eap_ctx->last_recv_radius == NULL ||
+		radius_msg_get_hdr(eap_ctx->last_recv_radius)->code !=
+		RADIUS_CODE_ACCESS_CHALLENGE)
+		return 0;
+
+	res = radius_msg_get_attr(eap_ctx->last_recv_radius, RADIUS_ATTR_STATE, buf, len);
+	if (res < 0)
+		return 0;
+	if ((size_t) res > len)
+		return -1;
+	return res;
+}
+
+int eap_auth_get_radius_server(struct eap_auth_ctx *eap_ctx)
+{
+	return eap_ctx->radius_server;
+}
+
+void eap_auth_set_radius_server(struct eap_auth_ctx *eap_ctx, int server)
+{
+	eap_ctx->radius_server = server;
+}
+
+/*Restores an EAP authenticator (just initialized with eap_auth_init) that
+ *was waiting for the response to the request with identifier id in
+ *another process. The identity and the State attribute are the ones
+ *included in the next Access-Request*/
+int eap_auth_resume(struct eap_auth_ctx *eap_ctx, int passthrough, int id,
+					const u8 *identity, size_t identity_len,
+					const u8 *state, size_t state_len)
+{
+	struct radius_msg *msg;
+
+	pthread_mutex_lock(&radmutex);
+
+	if (!passthrough) {
+		eap_ctx->eap_if->eapRestart = TRUE;
+		eap_server_sm_step(eap_ctx->eap);
+	}
+	eap_server_sm_resume(eap_ctx->eap, passthrough, id);
+
+	if (identity_len > 0) {
+		os_free(eap_ctx->eap_identity);
+		eap_ctx->eap_identity = os_malloc(identity_len);
+		if (eap_ctx->eap_identity == NULL) {
+			eap_ctx->eap_identity_len = 0;
+			pthread_mutex_unlock(&radmutex);
+			return -1;
+		}
+		os_memcpy(eap_ctx->eap_identity, identity, identity_len);
+		eap_ctx->eap_identity_len = identity_len;
+	}
+
+	if (state_len > 0 && aaa_backend != NULL) {
+		os_free(eap_ctx->aaa_state);
+		eap_ctx->aaa_state = os_malloc(state_len);
+		if (eap_ctx->aaa_state == NULL) {
+			eap_ctx->aaa_state_len = 0;
+			pthread_mutex_unlock(&radmutex);
+			return -1;
+		}
+		os_memcpy(eap_ctx->aaa_state, state, state_len);
+		eap_ctx->aaa_state_len = state_len;
+	}
+	/* The State attribute is copied from the last Access-Challenge
+	 * received, so it is stored as one */
+	else if (state_len > 0) {
+		msg = radius_msg_new(RADIUS_CODE_ACCESS_CHALLENGE, 0);
+		if (msg == NULL ||
+			!radius_msg_add_attr(msg, RADIUS_ATTR_STATE, state, state_len)) {
+			printf("Could not restore the RADIUS State attribute\n");
+			if (msg)
+				radius_msg_free(msg);
+			pthread_mutex_unlock(&radmutex);
+			return -1;
+		}
+		radius_msg_free(eap_ctx->last_recv_radius);
+		eap_ctx->last_recv_radius = msg;
+	}
+
+	pthread_mutex_unlock(&radmutex);
+	return 0;
+}
@@ -49,6 +49,7 @@ struct extra_radius_attr {
 };
 
 struct eap_auth_ctx;
+struct eap_auth_tls;
 
 struct radius_ctx {
 	struct radius_client_data *radius;
@@ -60,6 +61,11 @@ struct radius_ctx {
 	struct extra_radius_attr *extra_attrs;
 	u8 own_addr[6];//mac addrs
     u8 *connect_info;
+	/* The attributes of every Access-Request that do not change,
+	 * encoded once (NAS-IP-Address ... Connect-Info and extra_attrs) */
+	u8 *static_attrs;
+	size_t static_attrs_len;
+	size_t static_attrs_count;
 	//struct radius_msg *last_recv_radius;
 		//int radius_access_accept_received;
 	//int radius_access_reject_received;
@@ -84,7 +90,8 @@ struct eap_auth_ctx {
 	struct eap_eapol_interface *eap_if; /*Interface lower-layer <-> EAP state machine following RFC 4137*/
 	struct eap_sm *eap;/*EAP full authenticator state machine*/
 	struct radius_ctx *rad_ctx;
-	u8 radius_identifier;
+	int radius_identifier; /* -1 if no Access-Request is pending */
+	int radius_server; /* server of the pool holding the State, -1 if none */
 	struct radius_msg *last_recv_radius;
 	struct radius_msg *last_send_radius;
 	int radius_access_reject_received;
@@ -98,10 +105,17 @@ struct eap_auth_ctx {
 	/*u8 authenticator_msk[64];
 	size_t authenticator_msk_len;*/
 	void *tls_ctx;
+	struct eap_auth_tls *tls; /* reference to the shared TLS context */
 	struct eap_auth_ctx *next;
 	struct eap_method *eap_methods;
 	struct wpabuf *eapRequest;
 	void *eap_ll_ctx;
+	/* Other AAA backend (eap_auth_set_aaa_backend): identifier of the
+	 * request without answer, and State of the last challenge */
+	u32 aaa_id;
+	int aaa_pending;
+	u8 *aaa_state;
+	size_t aaa_state_len;
 	//struct eap_ll_callbacks *eap_ll_cb;
 };
 
@@ -110,6 +124,28 @@ struct eap_auth_ctx {
 				  struct eapol_callbacks *eap_cb, struct eap_config *eap_conf);*/
 
 int eap_auth_init(struct eap_auth_ctx *eap_ctx, void *eap_ll_ctx, char* cacert, char* servercert, char* serverkey);
+/**
+ * Standalone mode: the authenticators created from now on are EAP servers
+ * of EAP-PSK, get_psk gives the key (EAP_PSK_PSK_LEN bytes) of an identity
+ * and returns 0, or -1 if it is unknown. get_psk_keys, if not NULL, gives
+ * the AK and KDK already derived from it, which are then not derived on
+ * every authentication. NULL goes back to pass-through, where the AAA
+ * server is the EAP server.
+ */
+int eap_auth_set_standalone(int (*get_psk)(const u8 *identity, size_t identity_len, u8 *psk),
+			    int (*get_psk_keys)(const u8 *identity, size_t identity_len,
+						struct eap_psk_keys *keys));
+/**
+ * Standalone mode: the devices not known by get_psk authenticate with
+ * EAP-TLS, with this server certificate and key. The TLS context is shared
+ * by the authenticators created from now on, and it resumes the sessions of
+ * cache_size devices (by session ID) and, if tickets is not 0, those with a
+ * session ticket, lifetime seconds after their full handshake. Calling it
+ * again (reload) replaces the context, the sessions of the old one cannot
+ * be resumed. A NULL servercert disables EAP-TLS.
+ */
+int eap_auth_set_tls(char *cacert, char *servercert, char *serverkey,
+		     size_t cache_size, unsigned int lifetime, int tickets);
 void eap_auth_deinit(struct eap_auth_ctx *eap_ctx);
 //void eap_auth_rx(struct eap_auth_ctx *eap_ctx,const u8 *data, size_t data_len);
 int eap_auth_step(struct eap_auth_ctx* eap_ctx);
@@ -125,6 +161,11 @@ void eap_auth_set_eapRTTVAR(struct eap_auth_ctx* eap_ctx, int eapRTTVAR);
 Boolean eap_auth_get_eapReq(struct eap_auth_ctx* eap_ctx);
 void eap_auth_set_eapReq(struct eap_auth_ctx* eap_ctx, Boolean value);
 struct wpabuf *eap_auth_get_eapReqData(struct eap_auth_ctx* eap_ctx);
+/**
+ * Takes the EAP request from the authenticator, which does not use it
+ * again once sent (lastReqData keeps its own copy). The caller frees it.
+ */
+struct wpabuf *eap_auth_take_eapReqData(struct eap_auth_ctx* eap_ctx);
 Boolean eap_auth_get_eapNoReq(struct eap_auth_ctx* eap_ctx);
 void eap_auth_set_eapNoReq(struct eap_auth_ctx* eap_ctx, Boolean value);
 Boolean eap_auth_get_eapSuccess(struct eap_auth_ctx* eap_ctx);
@@ -136,8 +177,77 @@ Boolean eap_auth_get_eapKeyAvailable(struct eap_auth_ctx* eap_ctx);
 u8 *eap_auth_get_eapKeyData(struct eap_auth_ctx* eap_ctx, size_t *key_len);
 /************************************************************************/
 u8 *eap_auth_get_eapIdentity(struct eap_auth_ctx *eap_ctx, size_t *length);
+/****************Warm restart of a session******************************/
+int eap_auth_get_resume_state(struct eap_auth_ctx *eap_ctx, int *passthrough);
+int eap_auth_get_radius_state(struct eap_auth_ctx *eap_ctx, u8 *buf, size_t len);
+int eap_auth_resume(struct eap_auth_ctx *eap_ctx, int passthrough, int id,
+					const u8 *identity, size_t identity_len,
+					const u8 *state, size_t state_len);
+/**
+ * Pass-through mode: a new session goes to the servers of the pool whose
+ * mask route gives for the identity of the device (bit i for the server
+ * i), e.g. realm_route of realm.h. NULL for all of them.
+ */
+void eap_auth_set_radius_route(u32 (*route)(const u8 *identity, size_t identity_len));
+/*Server of the pool of AAA servers the session is bound to, -1 if none*/
+int eap_auth_get_radius_server(struct eap_auth_ctx *eap_ctx);
+void eap_auth_set_radius_server(struct eap_auth_ctx *eap_ctx, int server);
+/****************AAA backends other than RADIUS************************/
+/* Kinds of answer of the AAA server */
+#define EAP_AAA_CHALLENGE 0
+#define EAP_AAA_ACCEPT 1
+#define EAP_AAA_REJECT 2
+
+/**
+ * A transport of the EAP responses to the AAA server other than the
+ * RADIUS client, e.g. Diameter EAP (diameter.h). send carries an EAP
+ * response, with the State of the last challenge if any, and gives the
+ * identifier its answer will have. It returns 0, or -1 if it could not be
+ * sent. It is called with the authenticator locked, from eap_auth_step.
+ */
+struct eap_aaa_backend {
+	const char *name;
+	int (*send)(struct eap_auth_ctx *eap_ctx, const u8 *eap, size_t eap_len,
+		    const u8 *state, size_t state_len, u32 *id);
+};
+
+/* An answer of the AAA server, for eap_auth_aaa_answer */
+struct eap_aaa_answer {
+	u32 id;
+	int result; /* EAP_AAA_* */
+	const u8 *eap;
+	size_t eap_len;
+	const u8 *msk;
+	size_t msk_len;
+	const u8 *state;
+	size_t state_len;
+};
+
+/**
+ * Pass-through mode: the authenticators send their EAP responses through
+ * backend instead of RADIUS. NULL goes back to RADIUS. It is set before
+ * the first authenticator is created.
+ */
+void eap_auth_set_aaa_backend(const struct eap_aaa_backend *backend);
+/**
+ * Gives the authenticator the answer to its last request sent through the
+ * backend, and steps it as eap_auth_step.
+ *
+ * Returns 0, or -1 if it was not waiting for an answer with that id.
+ */
+int eap_auth_aaa_answer(struct eap_auth_ctx *eap_ctx, const struct eap_aaa_answer *answer);
 /************************************************************************/
 struct radius_ctx *rad_client_init(char *ip, int port, char * shared_secret);
+/**
+ * RADIUS client with a pool of num AAA servers sharing the secret: each new
+ * session goes to one of them (balance is a RadiusBalance), and all its
+ * Access-Requests to that one. The ones that stop answering are probed
+ * with Status-Server, and the idle ones every status_interval seconds if
+ * it is not 0. rad_client_init is a pool of one server.
+ */
+struct radius_ctx *rad_client_init_pool(char **ips, int *ports, int num,
+					char *shared_secret, int balance,
+					int status_interval);
 struct radius_client_data *get_rad_client_ctx();
 int add_eap_ctx_rad_client(struct eap_auth_ctx *eap_ctx);
 struct eap_auth_ctx *search_eap_ctx_rad_client(u8 identifier);
@@ -29,6 +29,9 @@ extern "C" {
 
 #include "loadconfig.h"
 #include "panautils.h"
+#include "radsec.h"
+#include "diameter.h"
+#include "aaa_loopback.h"
 
 #ifdef __cplusplus
 }
@@ -137,7 +140,7 @@ static void parse_xml_client(xmlNode * a_node) {
 			else if (strcmp((char *)cur_node->name, "IP_PAA")==0){  // IP configurable value
 				if (pac) {
 					xmlChar * value = xmlNodeGetContent(cur_node);
-					DESTIP = XMALLOC(char,strlen((char*)value));
+					DESTIP = XMALLOC(char,strlen((char*)value)+1);
 					sprintf(DESTIP, "%s", (char *)value);
 					xmlFree (value);
 				}
@@ -225,7 +228,7 @@ static void parse_xml_client(xmlNode * a_node) {
 			else if (strcmp((char *)cur_node->name, "USER")==0){ // User name configurable value
 				if (pac){
 					char * value = (char*)xmlNodeGetContent(cur_node);
-					USER = XMALLOC(char,strlen((char*)value));
+					USER = XMALLOC(char,strlen((char*)value)+1);
 					sprintf(USER, "%s",(char *) value);
 					xmlFree(value);
 					
@@ -234,7 +237,7 @@ static void parse_xml_client(xmlNode * a_node) {
 			else if (strcmp((char *)cur_node->name, "PASSWORD")==0){ // Password configurable value
 				if (pac){
 					char * value = (char*)xmlNodeGetContent(cur_node);
-					PASSWORD = XMALLOC(char,strlen((char*)value));
+					PASSWORD = XMALLOC(char,strlen((char*)value)+1);
 					sprintf(PASSWORD, "%s",(char *) value);
 					xmlFree(value);
 				}
@@ -254,7 +257,7 @@ static void parse_xml_client(xmlNode * a_node) {
 						}
 						else{
 							printf("PANA: Loading %s from current directory.\n",value);
-							CA_CERT = XMALLOC(char,strlen((char*)value));
+							CA_CERT = XMALLOC(char,strlen((char*)value)+1);
 							sprintf(CA_CERT, "%s",(char *) value);
 						}
 					}
@@ -281,7 +284,7 @@ static void parse_xml_client(xmlNode * a_node) {
 						}
 						else{
 							printf("PANA: Loading %s from current directory.\n",value);
-							CLIENT_CERT = XMALLOC(char,strlen((char*)value));
+							CLIENT_CERT = XMALLOC(char,strlen((char*)value)+1);
 							sprintf(CLIENT_CERT, "%s",(char *) value);
 						}
 					}
@@ -306,7 +309,7 @@ static void parse_xml_client(xmlNode * a_node) {
 						}
 						else{
 							printf("PANA: Loading %s from current directory.\n",value);
-							CLIENT_KEY = XMALLOC(char,strlen((char*)value));
+							CLIENT_KEY = XMALLOC(char,strlen((char*)value)+1);
 							sprintf(CLIENT_KEY, "%s",(char *) value);
 						}
 					}
@@ -320,7 +323,7 @@ static void parse_xml_client(xmlNode * a_node) {
 			else if (strcmp((char *)cur_node->name, "PRIVATE_KEY")==0){ // Client private key value
 				if (pac){
 					char * value = (char*)xmlNodeGetContent(cur_node);
-					PRIVATE_KEY = XMALLOC(char,strlen((char*)value));
+					PRIVATE_KEY = XMALLOC(char,strlen((char*)value)+1);
 					sprintf(PRIVATE_KEY, "%s",(char *) value);
 					xmlFree(value);
 				}
@@ -526,7 +529,7 @@ static void parse_xml_server(xmlNode * a_node){
 			else if (strcmp((char *)cur_node->name, "CA_CERT")==0){ // CA cert's name.
 				if (paa){
 					char * value = (char *)xmlNodeGetContent(cur_node);
-					CA_CERT = XMALLOC(char,strlen((char*)value));
+					CA_CERT = XMALLOC(char,strlen((char*)value)+1);
 					sprintf(CA_CERT, "%s",(char *) value);
 					xmlFree(value);
 				}
@@ -534,7 +537,7 @@ static void parse_xml_server(xmlNode * a_node){
 			else if (strcmp((char *)cur_node->name, "SERVER_CERT")==0){ // Server certificate's name
 				if (paa){
 					char * value = (char *)xmlNodeGetContent(cur_node);
-					SERVER_CERT = XMALLOC(char,strlen((char*)value));
+					SERVER_CERT = XMALLOC(char,strlen((char*)value)+1);
 					sprintf(SERVER_CERT, "%s",(char *) value);
 					xmlFree(value);
 				}
@@ -542,7 +545,7 @@ static void parse_xml_server(xmlNode * a_node){
 			else if (strcmp((char *)cur_node->name, "SERVER_KEY")==0){ // Server key certificate's name
 				if (paa){
 					char * value = (char*)xmlNodeGetContent(cur_node);
-					SERVER_KEY = XMALLOC(char,strlen((char*)value));
+					SERVER_KEY = XMALLOC(char,strlen((char*)value)+1);
 					sprintf(SERVER_KEY, "%s",(char *) value);
 					xmlFree(value);
 				}
@@ -563,7 +566,7 @@ static void parse_xml_server(xmlNode * a_node){
 			else if (strcmp((char *)cur_node->name, "AS_IP")==0){ // IP address of AS
 				if (paa){
 					char * value = (char*)xmlNodeGetContent(cur_node);
-					AS_IP = XMALLOC(char,strlen((char*)value));
+					AS_IP = XMALLOC(char,strlen((char*)value)+1);
 					sprintf(AS_IP, "%s",(char *) value);
 					xmlFree(value);
 				}
@@ -582,11 +585,53 @@ static void parse_xml_server(xmlNode * a_node){
 			else if (strcmp((char *)cur_node->name, "SHARED_SECRET")==0){ // Shared secret between EAP auth & EAP server.
 				if (paa){
 					char * value = (char*)xmlNodeGetContent(cur_node);
-					AS_SECRET = XMALLOC(char,strlen((char*)value));
+					AS_SECRET = XMALLOC(char,strlen((char*)value)+1);
 					sprintf(AS_SECRET, "%s",(char *) value);
 					xmlFree(value);
 				}
 			}
+			else if (strcmp((char *)cur_node->name, "AS_POOL")==0){ // More AAA servers, with the same shared secret.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						AS_POOL = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(AS_POOL, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "REALM_FILE")==0){ // AAA servers of the realms.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						REALM_FILE = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(REALM_FILE, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "AS_BALANCE")==0){ // Selection of the AAA server of a new session.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &AS_BALANCE);
+					xmlFree(value);
+					if (AS_BALANCE < 0 || AS_BALANCE > 2){
+						pana_error("AS_BALANCE must be set to 0 (failover), 1 (least outstanding) or 2 (latency)");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "AS_STATUS_INTERVAL")==0){ // Status-Server probes of the idle AAA servers.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &AS_STATUS_INTERVAL);
+					xmlFree(value);
+					if (AS_STATUS_INTERVAL < 0){
+						pana_error("AS_STATUS_INTERVAL must be set to 0 (to be desactivated) or to a number higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
 			else if (strcmp((char *)cur_node->name, "PING_TIME")==0){
 				if (paa){
 					char * value = (char*)xmlNodeGetContent(cur_node);
@@ -610,6 +655,261 @@ static void parse_xml_server(xmlNode * a_node){
 					}
 				}
 			}
+			else if (strcmp((char *)cur_node->name, "MODE")==0){ // Standalone or pass-through.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &MODE);
+					xmlFree(value);
+					if (MODE != 0 && MODE != 1){
+						pana_error("MODE must be set to 0 (standalone) or to 1 (passthrough)");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "PSK_FILE")==0){ // Credentials of the standalone mode.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						PSK_FILE = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(PSK_FILE, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "STORE_FILE")==0){ // File of the session store.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						STORE_FILE = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(STORE_FILE, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "STORE_SLOTS")==0){ // Max number of sessions stored.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &STORE_SLOTS);
+					xmlFree(value);
+					if (STORE_SLOTS <0 ){
+						pana_error("The number of slots of the session store must be set to 0 (to be desactivated) or to a number higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "REAUTH_LIFETIME")==0){ // Lifetime of the sessions.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &REAUTH_LIFETIME);
+					xmlFree(value);
+					if (REAUTH_LIFETIME <0 ){
+						pana_error("The lifetime of the sessions must be set to 0 (to be desactivated) or to a number higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "REAUTH_JITTER")==0){ // Spread of the re-authentications.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &REAUTH_JITTER);
+					xmlFree(value);
+					if (REAUTH_JITTER <0 ){
+						pana_error("The jitter of the re-authentications must be set to 0 (to be desactivated) or to a number higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "REAUTH_RATE")==0){ // Max re-authentications per second.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &REAUTH_RATE);
+					xmlFree(value);
+					if (REAUTH_RATE <0 ){
+						pana_error("The rate of the re-authentications must be set to 0 (no limit) or to a number higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "ERP_CACHE_SIZE")==0){ // Devices whose ERP keys are kept.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &ERP_CACHE_SIZE);
+					xmlFree(value);
+					if (ERP_CACHE_SIZE <0 ){
+						pana_error("The size of the ERP cache must be set to 0 (to be desactivated) or to a number higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "ERP_KEY_LIFETIME")==0){ // Lifetime of the ERP keys.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &ERP_KEY_LIFETIME);
+					xmlFree(value);
+					if (ERP_KEY_LIFETIME <=0 ){
+						pana_error("The lifetime of the ERP keys must be set to a number higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "TLS_SESSION_CACHE")==0){ // EAP-TLS sessions resumed by session ID.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &TLS_SESSION_CACHE);
+					xmlFree(value);
+					if (TLS_SESSION_CACHE <0 ){
+						pana_error("The size of the TLS session cache must be set to 0 (to be desactivated) or to a number higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "TLS_SESSION_LIFETIME")==0){ // Lifetime of the TLS sessions.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &TLS_SESSION_LIFETIME);
+					xmlFree(value);
+					if (TLS_SESSION_LIFETIME <=0 ){
+						pana_error("The lifetime of the TLS sessions must be set to a number higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "TLS_SESSION_TICKETS")==0){ // TLS session tickets.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &TLS_SESSION_TICKETS);
+					xmlFree(value);
+					if (TLS_SESSION_TICKETS != 0 && TLS_SESSION_TICKETS != 1){
+						pana_error("TLS_SESSION_TICKETS must be set to 0 (to be desactivated) or to 1");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "AAA_LOOPBACK")==0){ // AAA server in the controller.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &AAA_LOOPBACK);
+					xmlFree(value);
+					if (AAA_LOOPBACK < 0 || AAA_LOOPBACK > AAA_LOOPBACK_MAX_THREADS){
+						pana_error("AAA_LOOPBACK must be set to 0 (to be desactivated) or to a number of threads between 1 and %d", AAA_LOOPBACK_MAX_THREADS);
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "RADSEC_CONNECTIONS")==0){ // TLS connections to the AAA server.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &RADSEC_CONNECTIONS);
+					xmlFree(value);
+					if (RADSEC_CONNECTIONS <0 || RADSEC_CONNECTIONS > RADSEC_MAX_CONNECTIONS){
+						pana_error("RADSEC_CONNECTIONS must be set to 0 (to be desactivated) or to a number between 1 and %d", RADSEC_MAX_CONNECTIONS);
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "RADSEC_PORT")==0){ // RadSec port of the AAA server.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%hd", &RADSEC_PORT);
+					xmlFree(value);
+					if (RADSEC_PORT <= 0){
+						pana_error("The Authentication Server's RadSec Port must be higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "RADSEC_CA")==0){ // CA of the AAA server's certificate.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						RADSEC_CA = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(RADSEC_CA, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "RADSEC_CERT")==0){ // Certificate of the controller for RadSec.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						RADSEC_CERT = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(RADSEC_CERT, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "RADSEC_KEY")==0){ // Key of the controller for RadSec.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						RADSEC_KEY = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(RADSEC_KEY, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "DIAMETER_CONNECTIONS")==0){ // Diameter connections to the AAA server.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%d", &DIAMETER_CONNECTIONS);
+					xmlFree(value);
+					if (DIAMETER_CONNECTIONS <0 || DIAMETER_CONNECTIONS > DIAMETER_MAX_CONNECTIONS){
+						pana_error("DIAMETER_CONNECTIONS must be set to 0 (to be desactivated) or to a number between 1 and %d", DIAMETER_MAX_CONNECTIONS);
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "DIAMETER_PORT")==0){ // Diameter port of the AAA server.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					sscanf(value, "%hd", &DIAMETER_PORT);
+					xmlFree(value);
+					if (DIAMETER_PORT <= 0){
+						pana_error("The Authentication Server's Diameter Port must be higher than 0");
+						checkconfig = TRUE;
+					}
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "DIAMETER_ORIGIN_HOST")==0){ // Diameter identity of the controller.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						DIAMETER_ORIGIN_HOST = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(DIAMETER_ORIGIN_HOST, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "DIAMETER_ORIGIN_REALM")==0){ // Realm of the controller.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						DIAMETER_ORIGIN_REALM = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(DIAMETER_ORIGIN_REALM, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "DIAMETER_REALM")==0){ // Realm of the AAA server.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						DIAMETER_REALM = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(DIAMETER_REALM, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
+			else if (strcmp((char *)cur_node->name, "CAPTURE_FILE")==0){ // pcap file of the captured traffic.
+				if (paa){
+					char * value = (char*)xmlNodeGetContent(cur_node);
+					if (strlen(value) > 0){
+						CAPTURE_FILE = XMALLOC(char,strlen((char*)value)+1);
+						sprintf(CAPTURE_FILE, "%s",(char *) value);
+					}
+					xmlFree(value);
+				}
+			}
         }
 
         parse_xml_server(cur_node->children);
@@ -662,7 +962,7 @@ static void parse_xml_pre(xmlNode * a_node) {
 				if (pre){
 
 					xmlChar * value = xmlNodeGetContent(cur_node);
-					IP_PAA = XMALLOC(char,strlen((char*)value));
+					IP_PAA = XMALLOC(char,strlen((char*)value)+1);
 					sprintf(IP_PAA, "%s",(char *) value);
 					xmlFree(value);
 				}
@@ -17,6 +17,16 @@ extern "C" {
 #include "lalarm.h"
 #include "panautils.h"
 #include "eax.h"
+#include "session_store.h"
+#include "pcapfile.h"
+#include "coap_eap_cbor.h"
+#include "reauth.h"
+#include "erp.h"
+#include "psk_store.h"
+#include "radsec.h"
+#include "realm.h"
+#include "diameter.h"
+#include "aaa_loopback.h"
 
 
 #ifdef __cplusplus
@@ -74,24 +84,18 @@ struct coap_ctx_list* list_coap_ctx = NULL;
 /** Mutex associated to CoAP-EAP sessions' list.*/
 pthread_mutex_t list_sessions_mutex;
 
-/** Linked list of server's tasks.*/
-struct task_list* list_tasks = NULL;
-/** Last task. */
-struct task_list* last_task = NULL;
-/** Mutex associated to tasks' list. */
-pthread_mutex_t list_tasks_mutex;
-
 /** Alarm's list. */
 struct lalarm_coap* list_alarms_coap_eap = NULL;
 
 
 char URI_PATH[50] ={0};
-unsigned char cborCryptosuite[4] = {0x83,0x00,0x01,0x02};
-unsigned char cborlifetime[4] = {0x81,0x19, 0x70,0x80};
-
 
-/** Semaphore used to wait for new tasks by workers. */
-sem_t got_task;
+/** Cipher suites offered to the devices in the first POST.*/
+static const uint8_t offered_cipher_suites[] = {0, 1, 2};
+/** CBOR of the first POST, the same for every session (see encode_request_cbor).*/
+static uint8_t request_cbor[COAP_EAP_CBOR_MAX_LEN];
+static int request_cbor_len = 0;
+static pthread_once_t request_cbor_once = PTHREAD_ONCE_INIT;
 
 
 
@@ -203,15 +207,6 @@ unsigned int print_ipv6_address(char *output, struct in6_addr *v6addr){
 	return 1;
 }
 
-struct network_task{
-	char buf[BUF_LEN];
-	int len;
-	struct sockaddr_storage their_addr;	
-	uint32_t session_id;
-};
-
-
-
 void printHexadecimal(CoapPDU *pdu){
 #if DEBUG
     pana_debug("PDU: (%d)\n",pdu->getTokenPointer());
@@ -220,27 +215,27 @@ void printHexadecimal(CoapPDU *pdu){
 }
 
 
-network_task* createNetworkTask( char *buf, int len, struct sockaddr_storage *their_addr){
-
-	network_task *task = XMALLOC(network_task,1);
-
-	memcpy(&(task->buf), buf, (size_t)len);
-	(task->buf)[len] = '\0';
-	
-	task->len = len;
-    memcpy(&(task->their_addr), their_addr, sizeof(struct sockaddr_storage));
-
-	return task;
+void signal_handler(int sig) {
+	pana_debug("\nStopping server, signal: %d\n", sig);
+	fin = 0;
 }
 
-void setSessionID(struct network_task *task, uint32_t session_id){
-	task->session_id = session_id;
-}
+/** Set by SIGHUP, the credentials of the standalone mode are loaded again.*/
+static volatile sig_atomic_t reload_psk = 0;
 
+static void reload_handler(int sig) {
+	reload_psk = 1;
+}
 
-void signal_handler(int sig) {
-	pana_debug("\nStopping server, signal: %d\n", sig);
-	fin = 0;
+/** Standalone: EAP-TLS for the devices not in PSK_FILE, if the controller
+ * has a certificate. The TLS context is created again on every call, the
+ * sessions of the previous one are not resumed.*/
+static void load_tls(void) {
+	if (SERVER_CERT == NULL || SERVER_KEY == NULL)
+		return;
+	if (eap_auth_set_tls(CA_CERT, SERVER_CERT, SERVER_KEY, (size_t) TLS_SESSION_CACHE,
+			(unsigned int) TLS_SESSION_LIFETIME, TLS_SESSION_TICKETS) < 0)
+		pana_error("EAP-TLS could not be set up with %s and %s", SERVER_CERT, SERVER_KEY);
 }
 
 
@@ -290,82 +285,6 @@ void printDebug(coap_eap_ctx * coap_eap_session){
 }
 
 
-// Task Functions
-struct task_list* get_task() {
-	int rc; /* return code of pthreads functions.  */
-
-	struct task_list* task = NULL;
-
-
-	pana_debug("Trying to get a task.");
-
-	/* lock the mutex, to assure exclusive access to the list */
-	rc = pthread_mutex_lock(&list_tasks_mutex);
-
-	if (list_tasks != NULL) {
-		task = list_tasks; 
-		list_tasks = list_tasks->next;
-		task->next = NULL;
-	}
-
-
-	/* unlock mutex */
-	rc = pthread_mutex_unlock(&list_tasks_mutex);
-
-	/* return the task to the caller. */
-	if (task == NULL) {
-
-		pana_debug("Task not found");
-
-		return NULL;
-	}
-
-	return task;
-}
-
-void
-add_task(task_function funcion, void * arg) {
-	
-	if(arg == NULL)
-	{
-		pana_error("ERROR: add_task: arg  == NULL ");
-		exit(0);	
-	}
-	
-	int rc; // return code of pthreads functions.
-	// lock the mutex, to assure exclusive access to the list
-	rc = pthread_mutex_lock(&list_tasks_mutex);
-
-	struct task_list * new_element; // A new element in the list
-
-	// create structure with new element
-	new_element = XMALLOC(struct task_list,1);
-
-	new_element->use_function = funcion;
-	new_element->data = arg;
-	new_element->next = NULL;
-
-
-	/* add new session to the end of the list, updating list */
-	/* pointers as required */
-	if (list_tasks == NULL) { /* special case - list is empty */
-		list_tasks = new_element;
-		last_task = new_element;
-	}
-	else {
-		last_task->next = new_element;
-		last_task = last_task->next;
-	}
-
-
-	pana_debug("add_task: added task");
-
-	/* unlock mutex */
-	rc = pthread_mutex_unlock(&list_tasks_mutex);
-	/* signal the condition variable - there's a new task to handle */
-	rc = sem_post(&got_task);
-}
-
 // Hash functions
 
 int
@@ -413,7 +332,33 @@ void override_auth_option_pdu(unsigned char *key, CoapPDU *pdu){
 
 // Retransmissions funtions
 
-void storeLastSentMessageInSession(CoapPDU *pdu, coap_eap_ctx *coap_eap_session){
+/** Copies the segments of a message in buf, at most size bytes. Returns the length copied.*/
+static size_t iov_flatten(const struct iovec *iov, int iovcnt, uint8_t *buf, size_t size){
+	size_t len = 0;
+
+	for (int i = 0; i < iovcnt; i++) {
+		size_t n = min(iov[i].iov_len, size - len);
+		memcpy(buf + len, iov[i].iov_base, n);
+		len += n;
+	}
+	return len;
+}
+
+static size_t iov_length(const struct iovec *iov, int iovcnt){
+	size_t len = 0;
+
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	return len;
+}
+
+/**
+ * Keeps the segments of the last POST sent for its retransmissions. They
+ * point to the template of the session and to eap, the EAP request taken
+ * from the authenticator (NULL if the payload is constant), so nothing is
+ * copied. The EAP request of the previous POST is released.
+ */
+void storeLastSentMessageInSession(const struct iovec *iov, int iovcnt, struct wpabuf *eap, coap_eap_ctx *coap_eap_session){
 	
 	if(coap_eap_session->lastSentMessage != NULL)
 	{
@@ -421,9 +366,12 @@ void storeLastSentMessageInSession(CoapPDU *pdu, coap_eap_ctx *coap_eap_session)
 		coap_eap_session->lastSentMessage = NULL;
 	}
 
-	coap_eap_session->lastSentMessage = XMALLOC(uint8_t,pdu->getPDULength());
-	memcpy(coap_eap_session->lastSentMessage,pdu->getPDUPointer() ,(size_t)pdu->getPDULength());
-	coap_eap_session->lastSentMessage_len = pdu->getPDULength();
+	wpabuf_free(coap_eap_session->lastSentEap);
+	coap_eap_session->lastSentEap = eap;
+
+	memcpy(coap_eap_session->lastSentIov, iov, iovcnt * sizeof(struct iovec));
+	coap_eap_session->lastSentIovcnt = iovcnt;
+	coap_eap_session->lastSentMessage_len = (int) iov_length(iov, iovcnt);
 }
 
 void storeLastReceivedMessageInSession(CoapPDU *pdu, coap_eap_ctx *coap_eap_session){
@@ -447,255 +395,353 @@ void storeLastReceivedMessageInSession(CoapPDU *pdu, coap_eap_ctx *coap_eap_sess
 
 
 
-void* process_receive_radius_msg(void* arg) {
-
-    if(arg == NULL)
-    {
-        printf("ERROR: process_receive_radius_msg: arg  == NULL \n");
-        exit(0);
-    }
-
-    printf("\nœ\n"
-			   "##\n"
-				"######## ENTER: process_receive_radius_msg \n");
-
-
-    struct radius_func_parameter radius_params = *((struct radius_func_parameter*) arg);
-    int radius_type = RADIUS_AUTH;
-
-    //Get the function's parameters.
-    struct radius_ms_radiug *radmsg = (struct radius_ms_radiug *)radius_params.msg;
-
-    // Get the information about the new message received
-    struct radius_client_data *radius_data = get_rad_client_ctx();
-    struct radius_hdr *hdr = radius_msg_get_hdr((struct radius_msg *)radmsg);
-    struct eap_auth_ctx *eap_ctx = search_eap_ctx_rad_client(hdr->identifier);
-
-    if (eap_ctx == NULL){
-        printf("eap_ctx NULL. It can't be used\n");
-        return NULL;
-    }
-
-    coap_eap_ctx * coap_eap_session = (coap_eap_ctx*) (eap_ctx->eap_ll_ctx);
-    pthread_mutex_lock(&(coap_eap_session->mutex));
-
-#if DEBUG
-    printDebug(coap_eap_session);
-#endif
-
-    radius_client_receive((struct radius_msg *)radmsg, radius_data, &radius_type);
-
-    // In case of a EAP Fail is produced.
-    if ((eap_auth_get_eapFail(eap_ctx) == TRUE)){
-        printf("Error: There's an eap fail in RADIUS\n");
-        exit(0);
-    }
-
-
-
-    if ((eap_auth_get_eapReq(eap_ctx) == TRUE) || (eap_auth_get_eapSuccess(eap_ctx) == TRUE)) {
-
-
-        printf("There's an eap request in RADIUS\n");
-		printf("Trying to make a transition with the message from RADIUS\n");
-
-        struct wpabuf * packet = eap_auth_get_eapReqData(&(coap_eap_session->eap_ctx));
-
-
-        socklen_t addrLen = sizeof(struct sockaddr_in);
-        if((&coap_eap_session->recvAddr)->ss_family==AF_INET6) {
-            addrLen = sizeof(struct sockaddr_in6);
-        }
+/** pcap file of the captured traffic, NULL if it is not captured.*/
+static struct pcap_file *capture = NULL;
+/** Addresses of the controller's CoAP socket and of the RADIUS client and server.*/
+static struct sockaddr_storage capture_coap_addr;
+static struct sockaddr_storage capture_radius_addr;
+static struct sockaddr_storage capture_as_addr;
 
+static void capture_udp(const struct sockaddr_storage *src, const struct sockaddr_storage *dst,
+		const uint8_t *buf, size_t len){
+	if (capture != NULL)
+		pcap_file_write_udp(capture, getTime(), (const struct sockaddr *) src,
+				(const struct sockaddr *) dst, buf, len);
+}
 
+static int is_ip_addr(const struct sockaddr_storage *addr){
+	return addr->ss_family == AF_INET || addr->ss_family == AF_INET6;
+}
 
+int capture_open(const char *path){
+	capture = pcap_file_create(path);
+	return capture != NULL ? 0 : -1;
+}
 
-        if(coap_eap_session->eap_workarround == 0){
+static void capture_radius_tx(void *ctx, RadiusType msg_type, const u8 *data, size_t len){
+	capture_udp(&capture_radius_addr, &capture_as_addr, data, len);
+}
 
-            get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
-            coap_eap_session->eap_workarround++;
-            mempcpy(eap_req_id, wpabuf_head(packet), wpabuf_len(packet));
+void capture_sockets_init(){
+	struct radius_client_data *radius_data = get_rad_client_ctx();
+	socklen_t len;
 
-            // TODO:
-            os_memcpy(coap_eap_session->userID, "alpha.t.eu.org", os_strlen("alpha.t.eu.org"));
+	if (capture == NULL)
+		return;
 
-            // Copiamos el ID
-            eap_req_id[0] = 0x02;
-            eap_req_id[3] = 5+strlen(coap_eap_session->userID);
-            memset(&eap_req_id[5],0,45);
-            mempcpy(&eap_req_id[5], coap_eap_session->userID, 5+strlen(coap_eap_session->userID));
+	// The simulator has no sockets: the loopback address and MYPORT.
+	len = sizeof(capture_coap_addr);
+	if (getsockname(global_sockfd, (struct sockaddr *) &capture_coap_addr, &len) < 0 ||
+			!is_ip_addr(&capture_coap_addr)) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &capture_coap_addr;
 
-            eap_auth_set_eapResp(&(coap_eap_session->eap_ctx), TRUE);
-            eap_auth_set_eapRespData(&(coap_eap_session->eap_ctx), eap_req_id, 5+strlen(coap_eap_session->userID));
-            eap_auth_step(&(coap_eap_session->eap_ctx));
+		memset(&capture_coap_addr, 0, sizeof(capture_coap_addr));
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr = in6addr_loopback;
+		sin6->sin6_port = htons(5683);
+	}
 
-            pthread_mutex_unlock(&(coap_eap_session->mutex));
+	if (radius_data == NULL)
+		return;
+
+	len = sizeof(capture_radius_addr);
+	if (getsockname(radius_data->auth_sock, (struct sockaddr *) &capture_radius_addr, &len) < 0)
+		memset(&capture_radius_addr, 0, sizeof(capture_radius_addr));
+	len = sizeof(capture_as_addr);
+	if (getpeername(radius_data->auth_sock, (struct sockaddr *) &capture_as_addr, &len) < 0)
+		memset(&capture_as_addr, 0, sizeof(capture_as_addr));
+
+	// Not an UDP socket (the simulator's): the AAA server of the configuration,
+	// and the loopback address as the client's.
+	if (!is_ip_addr(&capture_radius_addr) || !is_ip_addr(&capture_as_addr)) {
+		struct sockaddr_in *sin = (struct sockaddr_in *) &capture_as_addr;
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &capture_as_addr;
+
+		memset(&capture_as_addr, 0, sizeof(capture_as_addr));
+		memset(&capture_radius_addr, 0, sizeof(capture_radius_addr));
+		if (inet_pton(AF_INET, AS_IP, &sin->sin_addr) == 1) {
+			sin->sin_family = AF_INET;
+			sin->sin_port = htons(AS_PORT);
+			sin = (struct sockaddr_in *) &capture_radius_addr;
+			sin->sin_family = AF_INET;
+			sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		}
+		else if (inet_pton(AF_INET6, AS_IP, &sin6->sin6_addr) == 1) {
+			sin6->sin6_family = AF_INET6;
+			sin6->sin6_port = htons(AS_PORT);
+			sin6 = (struct sockaddr_in6 *) &capture_radius_addr;
+			sin6->sin6_family = AF_INET6;
+			sin6->sin6_addr = in6addr_loopback;
+		}
+	}
 
-            return;
-        }
+	radius_client_set_tx_cb(radius_data, capture_radius_tx, NULL);
+}
 
+void capture_close(){
+	pcap_file_close(capture);
+	capture = NULL;
+}
 
+/**
+ * Sends a CoAP message, given as segments, to the device of a session.
+ * In the simulation build it is handed to the simulated network instead.
+ */
+static void send_to_device(coap_eap_ctx *coap_eap_session, const struct iovec *iov, int iovcnt){
 
+#ifndef SIMULATION
+	socklen_t addrLen = sizeof(struct sockaddr_in);
+	if((&coap_eap_session->recvAddr)->ss_family==AF_INET6) {
+		addrLen = sizeof(struct sockaddr_in6);
+	}
 
+	if (capture == NULL) {
+		struct msghdr msg;
 
-        coap_eap_session->message_id += 1;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &coap_eap_session->recvAddr;
+		msg.msg_namelen = addrLen;
+		msg.msg_iov = (struct iovec *) iov;
+		msg.msg_iovlen = iovcnt;
 
-        printf("Creating CoAP PDU after RADIUS exchange\n");
+		ssize_t sent = sendmsg(global_sockfd, &msg, 0);
+		if(sent<0) {
+			DBG("Error sending packet: %ld.",sent);
+			perror(NULL);
+		}
+		return;
+	}
+#endif
 
-        // FIXME: Orden de creación, secuencia, y location path dinámico
-        CoapPDU *response = new CoapPDU();
-        response->setVersion(1);
-        response->setMessageID(coap_eap_session->message_id);
-        response->setToken((uint8_t *)&coap_eap_session->session_id,4);
-        response->setCode(CoapPDU::COAP_POST);
-        response->setType(CoapPDU::COAP_CONFIRMABLE);
+	// The capture and the simulated network take the whole message.
+	uint8_t pdu[MAX_DATA_LEN];
+	size_t len = iov_flatten(iov, iovcnt, pdu, sizeof(pdu));
 
-		printf("The Stored URI is %s \n",coap_eap_session->location);
-		response->setURI(coap_eap_session->location, strlen(coap_eap_session->location));
+	capture_udp(&capture_coap_addr, &coap_eap_session->recvAddr, pdu, len);
 
+#ifdef SIMULATION
+	sim_coap_send(&coap_eap_session->recvAddr, pdu, len);
+#else
+	ssize_t sent = sendto(
+			global_sockfd,
+			pdu,
+			len,
+			0,
+			(sockaddr *)&coap_eap_session->recvAddr,
+			addrLen
+	);
+	if(sent<0) {
+		DBG("Error sending packet: %ld.",sent);
+		perror(NULL);
+	}
+#endif
+}
 
+/**
+ * Sends a POST to the device of a session and keeps it for the
+ * retransmissions. The POST is built from the session's template, which
+ * is serialized again only when the location or the OSCORE option change,
+ * and sent as segments: the EAP request and the tail are not copied.
+ *
+ * @param *eap EAP request of the payload, owned by the session from now
+ * on, or NULL to send payload instead (it must outlive the session).
+ * @param *payload Constant payload, when eap is NULL.
+ * @param len Length of payload.
+ * @param *tail Constant bytes sent after the payload, or NULL.
+ * @param tail_len Length of tail.
+ * @param oscore If not 0, the POST has the OSCORE option.
+ *
+ * @return 0 if the POST has been sent, -1 if the location does not fit in
+ * the template.
+ */
+static int send_post(coap_eap_ctx *coap_eap_session, struct wpabuf *eap,
+		const uint8_t *payload, size_t len, const uint8_t *tail, size_t tail_len, int oscore){
+
+	struct coap_template *t = &(coap_eap_session->post_template);
+	struct iovec iov[COAP_TEMPLATE_IOV];
+
+	if (t->len == 0 || t->oscore != oscore) {
+		if (coap_template_build(t, coap_eap_session->session_id, coap_eap_session->location, oscore) < 0) {
+			pana_error("Location %s too long, session %X", coap_eap_session->location,
+					coap_eap_session->session_id);
+			wpabuf_free(eap);
+			return -1;
+		}
+	}
 
+	if (eap != NULL) {
+		payload = wpabuf_head_u8(eap);
+		len = wpabuf_len(eap);
+	}
 
-        if (eap_auth_get_eapKeyAvailable(&(coap_eap_session->eap_ctx)))
-        {
-            size_t key_len = 0;
-            u8 *key = eap_auth_get_eapKeyData(&(coap_eap_session->eap_ctx),(size_t *)&(coap_eap_session->key_len));
+	coap_template_iov(t, coap_eap_session->message_id, payload, len, tail, tail_len, iov);
+	storeLastSentMessageInSession(iov, COAP_TEMPLATE_IOV, eap, coap_eap_session);
 
-            coap_eap_session->msk_key = XMALLOC(u8 , (coap_eap_session->key_len) );
+#if DEBUG
+	pana_debug("PDU TO SEND: \n");
+	for (int i = 0; i < COAP_TEMPLATE_IOV; i++)
+		printf_hex((unsigned char *) iov[i].iov_base, iov[i].iov_len);
+#endif
 
-            memcpy(coap_eap_session->msk_key,key,coap_eap_session->key_len);
-          // Here we would verify the OSCORE Option
+	send_to_device(coap_eap_session, iov, COAP_TEMPLATE_IOV);
+	return 0;
+}
 
+/**
+ * Sends to the device what the EAP authenticator has to send, the next
+ * EAP request or the EAP success, in a new POST. In pass-through it is
+ * called with every RADIUS answer, in standalone mode with every EAP
+ * response (the EAP server is in the controller).
+ *
+ * @return -1 if the EAP authentication failed, 0 if no message was sent to
+ * the device, 1 if a new POST was sent.
+ */
+static int process_eap_answer(coap_eap_ctx *coap_eap_session) {
 
-            coap_eap_session->CURRENT_STATE = 3;
+    struct eap_auth_ctx *eap_ctx = &(coap_eap_session->eap_ctx);
 
-            printf("Cambio a estado 3 message_id: %d, session_id: %X\n",coap_eap_session->message_id,coap_eap_session->session_id);
+    // In case of a EAP Fail is produced.
+    if ((eap_auth_get_eapFail(eap_ctx) == TRUE)){
+        pana_error("There's an eap fail in RADIUS, session: %X", coap_eap_session->session_id);
+        return -1;
+    }
 
-        }
+    if ((eap_auth_get_eapReq(eap_ctx) != TRUE) && (eap_auth_get_eapSuccess(eap_ctx) != TRUE))
+        return 0;
 
-        else{
-		pana_debug("message_id: %d\n",coap_eap_session->message_id);
-		pana_debug("NO Cambio a estado 3 message_id: %d, session_id: %X\n",coap_eap_session->message_id,coap_eap_session->session_id);
-	}
+    pana_debug("There's an eap request in RADIUS\n");
 
-	
-	if (eap_auth_get_eapSuccess(eap_ctx) == TRUE) {			
-		printf("EAP SUCCESS::::::::::::::::::::::\n");		
-	}
-	
+    struct wpabuf * packet = eap_auth_get_eapReqData(eap_ctx);
 
+    // eapReq is never cleared: without a new request (the answer was
+    // discarded by the RADIUS client) the last one was already sent.
+    if (packet == NULL && eap_auth_get_eapSuccess(eap_ctx) != TRUE)
+        return 0;
 
-	if (eap_auth_get_eapSuccess(eap_ctx) == TRUE) 
-	{			
+    // The AAA server starts with its own Request/Identity.
+    if(MODE && coap_eap_session->eap_workarround == 0){
 
+        coap_eap_session->eap_workarround++;
+        mempcpy(eap_req_id, wpabuf_head(packet), wpabuf_len(packet));
 
-		unsigned char tempPayload[100]={0};
-		unsigned char oscore_option[2] = {0x09,0x00};
+        // TODO:
+        os_memcpy(coap_eap_session->userID, "alpha.t.eu.org", os_strlen("alpha.t.eu.org"));
 
-		response->addOption(CoapPDU::COAP_OPTION_OSCORE,2,oscore_option);
+        // Copiamos el ID
+        eap_req_id[0] = 0x02;
+        eap_req_id[3] = 5+strlen(coap_eap_session->userID);
+        memset(&eap_req_id[5],0,45);
+        mempcpy(&eap_req_id[5], coap_eap_session->userID, 5+strlen(coap_eap_session->userID));
 
-		unsigned char payloadOSCORE [] = {0xad, 0x88, 0x3c, 0x74, 0x28, 0x13, 0x2e, 0x52, 0xbe, 0x82, 0x57, 0x65, 0xb2, 0x61, 0x86, 0xf5, 0x35, 0x84, 0x82, 0x49, 0xa7, 0x45};
-      
-  /*      
-	if (eap_auth_get_eapSuccess(eap_ctx) != TRUE) {			
-				printf("The Stored URI is %s \n",coap_eap_session->location);
-				response->setURI(coap_eap_session->location, strlen(coap_eap_session->location));
-	}
-*/
-      response->setPayload(
-				payloadOSCORE,
-				22
-				);
+        eap_auth_set_eapResp(eap_ctx, TRUE);
+        eap_auth_set_eapRespData(eap_ctx, eap_req_id, 5+strlen(coap_eap_session->userID));
+        eap_auth_step(eap_ctx);
 
-	}else{
+        return 0;
+    }
 
+    coap_eap_session->message_id += 1;
 
-	if (eap_auth_get_eapSuccess(eap_ctx) != TRUE) {			
-				//response->setURI(coap_eap_session->location, strlen(coap_eap_session->location));
-//				response->setURI((char*)"/.well-known/a",14);
-	}
+    pana_debug("Creating CoAP PDU after RADIUS exchange\n");
 
-	        response->setPayload(
-					(unsigned char *)wpabuf_head(packet),
-					(int)wpabuf_len(packet)
-					);
-	}
+    // FIXME: Orden de creación, secuencia, y location path dinámico
+    pana_debug("The Stored URI is %s \n",coap_eap_session->location);
 
-        if ((coap_eap_session->msk_key != NULL) && (coap_eap_session->auth_key != NULL))
-            override_auth_option_pdu(coap_eap_session->auth_key,response);
+    if (eap_auth_get_eapKeyAvailable(eap_ctx))
+    {
+        u8 *key = eap_auth_get_eapKeyData(eap_ctx,(size_t *)&(coap_eap_session->key_len));
 
+        coap_eap_session->msk_key = XMALLOC(u8 , (coap_eap_session->key_len) );
 
-        if((coap_eap_session->msk_key != NULL))
-			{
-				pana_debug("MSK KEY:\n");
-				printf_hex(coap_eap_session->msk_key,16);
+        memcpy(coap_eap_session->msk_key,key,coap_eap_session->key_len);
+        // Here we would verify the OSCORE Option
 
-			}
+        pana_debug("Key available message_id: %d, session_id: %X\n",coap_eap_session->message_id,coap_eap_session->session_id);
+    }
 
+    if((coap_eap_session->msk_key != NULL))
+    {
+        pana_debug("MSK KEY:\n");
+        printf_hex(coap_eap_session->msk_key,16);
+    }
 
+    int sent;
+    if (eap_auth_get_eapSuccess(eap_ctx) == TRUE)
+    {
+        pana_debug("EAP SUCCESS::::::::::::::::::::::\n");
 
-			// Send new coap Message
-	//#if DEBUG			
-			printf("PDU TO SEND: \n");
-			printHexadecimal(response);
-	//#endif
-	
-		printf("Sending message in RADIUS response \n");
-			response->printHuman();
-    
-        ssize_t sent = sendto(
-                global_sockfd,
-                response->getPDUPointer(),
-                (size_t)response->getPDULength(),
-                0,
-                (sockaddr *)&coap_eap_session->recvAddr,
-                addrLen
-        );
-        if(sent<0) {
-            DBG("Error sending packet: %ld.",sent);
-            perror(NULL);
-            return NULL;
-        }
+        // The OSCORE option is added by the template.
+        static const unsigned char payloadOSCORE [] = {0xad, 0x88, 0x3c, 0x74, 0x28, 0x13, 0x2e, 0x52, 0xbe, 0x82, 0x57, 0x65, 0xb2, 0x61, 0x86, 0xf5, 0x35, 0x84, 0x82, 0x49, 0xa7, 0x45};
 
+        sent = send_post(coap_eap_session, NULL, payloadOSCORE, sizeof(payloadOSCORE), NULL, 0, 1);
+    }
+    else {
+        // The request is sent and retransmitted from the buffer built by
+        // the authenticator.
+        sent = send_post(coap_eap_session, eap_auth_take_eapReqData(eap_ctx), NULL, 0, NULL, 0, 0);
+    }
 
+    if (sent < 0)
+        return -1;
 
+    get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
+    coap_eap_session->RT = coap_eap_session->RT_INIT;
+    coap_eap_session->RTX_COUNTER = 0;
+    add_alarm_coap_eap(&(list_alarms_coap_eap),coap_eap_session,coap_eap_session->RT,POST_ALARM);
 
-        storeLastSentMessageInSession(response,coap_eap_session);
+    return 1;
+}
 
-        get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
-        coap_eap_session->RT = coap_eap_session->RT_INIT;
-        coap_eap_session->RTX_COUNTER = 0;
-        add_alarm_coap_eap(&(list_alarms_coap_eap),coap_eap_session,coap_eap_session->RT,POST_ALARM);
+/**
+ * Processes the RADIUS answer of a session and, when it carries a new
+ * EAP request (or the EAP success), sends it to the device in a new POST.
+ *
+ * @return As process_eap_answer.
+ */
+static int process_radius_answer(coap_eap_ctx *coap_eap_session, struct radius_msg *radmsg) {
 
-        char s[INET6_ADDRSTRLEN];
-						pana_debug("Alarma añandida:::::::\n  MSGID: %d IP: %s\n", ntohs(response->getMessageID()),
-								inet_ntop(((coap_eap_session)->recvAddr).ss_family,
-										get_in_addr((struct sockaddr *)&(coap_eap_session)->recvAddr),
-										s, sizeof s)
-						);
+    pana_debug("\nœ\n"
+			   "##\n"
+				"######## ENTER: process_radius_answer \n");
 
+    int radius_type = RADIUS_AUTH;
+    int ret;
 
-    }
+    // Get the information about the new message received
+    struct radius_client_data *radius_data = get_rad_client_ctx();
 
 #if DEBUG
     printDebug(coap_eap_session);
 #endif
 
-    pthread_mutex_unlock(&(coap_eap_session->mutex));
+    radius_client_receive(radmsg, radius_data, &radius_type);
 
+    ret = process_eap_answer(coap_eap_session);
 
-    pana_debug("######## SALIMOS DE : process_receive_radius_msg \n"
+    pana_debug("######## SALIMOS DE : process_radius_answer \n"
 			"##\n"
 			"œ\n"
 	);
 
-    //free(&radius_params);
-    return NULL;
-
+    return ret;
 }
 
+/**
+ * Processes the Diameter answer of a session (diameter.h), as
+ * process_radius_answer. An answer to a request that is not the last one
+ * of the session is ignored.
+ *
+ * @return As process_eap_answer.
+ */
+static int process_aaa_answer(coap_eap_ctx *coap_eap_session, struct eap_aaa_answer *answer) {
 
-
+    if (eap_auth_aaa_answer(&(coap_eap_session->eap_ctx), answer) < 0) {
+        pana_debug("AAA answer %08x not expected by session %X, dropped\n", answer->id,
+                coap_eap_session->session_id);
+        return 0;
+    }
+    return process_eap_answer(coap_eap_session);
+}
 
 
 
@@ -715,45 +761,12 @@ void coapRetransmitLastSentMessage(coap_eap_ctx * coap_eap_session){
 	printDebug(coap_eap_session);
 #endif
 
-	CoapPDU *response = new CoapPDU(coap_eap_session->lastSentMessage, BUF_LEN, BUF_LEN);
-	response->setPDULength(coap_eap_session->lastSentMessage_len);
-
-	if(response->validate() != 1){
-			pana_debug("Malformed CoapPDU \n");
-			exit(0);
-	}
-	
-	//response->printHuman();
-
-	//struct sockaddr_storage * recvFrom = coap_eap_session->recvAddr;
-	int sockfd = global_sockfd;
-	
-	socklen_t addrLen = sizeof(struct sockaddr_in);
-	if( (&coap_eap_session->recvAddr)->ss_family==AF_INET6) {
-		addrLen = sizeof(struct sockaddr_in6);
-	}
-
-
 	coap_eap_session->RT=(coap_eap_session->RT*2);
 	get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
 	add_alarm_coap_eap(&(list_alarms_coap_eap),coap_eap_session,coap_eap_session->RT,POST_ALARM);
 
-	ssize_t sent = sendto(
-			sockfd,
-			response->getPDUPointer(),
-            (size_t) response->getPDULength(),
-			0,
-			(sockaddr *)&coap_eap_session->recvAddr,
-			addrLen
-			);
-	if(sent<0) {
-		DBG("Error sending packet: %ld.",sent);
-		perror(NULL);
-
-	}
-
-
-	delete response;
+	// The same segments of the POST, the message id has not changed.
+	send_to_device(coap_eap_session, coap_eap_session->lastSentIov, coap_eap_session->lastSentIovcnt);
 
 
 #if DEBUG
@@ -810,139 +823,51 @@ void remove_coap_eap_session(uint32_t id) {
 
 
 
-void* process_retr_coap_eap(void *arg){
-
-	if(arg == NULL)
+// Coap EAP Session Functions
+void add_coap_eap_session(coap_eap_ctx * session) {
+	
+	if(session == NULL)
 	{
-		pana_error("ERROR: process_retr_coap_eap: arg  == NULL ");
+		pana_error("ERROR: add_coap_eap_session: session  == NULL ");
 		exit(0);	
 	}
+	
+	int rc; //> return code of pthreads functions.  
 
+	struct coap_eap_ctx_list * new_element;
 
-	pana_debug(	"\nœ\n"
-			"##\n"
-			"######## ENTRAMOS EN: process_retr_coap_eap \n");
-
-
-	struct retr_coap_func_parameter* retr_params;
+	/* create structure with new request */
+	new_element = XMALLOC(struct coap_eap_ctx_list,1);
+	new_element->coap_eap_session = session;
+	new_element->next = NULL;
 
+	/* lock the mutex, to assure exclusive access to the list */
+	rc = pthread_mutex_lock(&list_sessions_mutex);
 
-	// Get the function's parameters.
-	retr_params = (struct retr_coap_func_parameter*) arg;
-	int alarm_id = retr_params->id;
-	coap_eap_ctx * coap_eap_session = retr_params->session;
-	pthread_mutex_lock(&(coap_eap_session->mutex));
+	/* add new session to the end of the list, updating list */
+	/* pointers as required */
+	if (list_coap_eap_sessions == NULL) { /* special case - list is empty */
+		list_coap_eap_sessions = new_element;
+	} 
+	else {
+		new_element->next = list_coap_eap_sessions;
+		list_coap_eap_sessions = new_element;
+	}
 
+	pana_debug("add_session: added CoAP EAP session: %X",ntohl(new_element->coap_eap_session->session_id));
+	/* unlock mutex */
+	rc = pthread_mutex_unlock(&list_sessions_mutex);
 
+}
 
-#if DEBUG
-	printDebug(coap_eap_session);
-#endif
+coap_eap_ctx* get_coap_eap_session(uint32_t id) {
+	int rc; /* return code of pthreads functions.  */
 
-	// Depends on the alarm produced, it is processed.
-	if (alarm_id == POST_ALARM) {
+	struct coap_eap_ctx_list* session = NULL;
 
-		
-		pana_debug("Processing POST_AUTH alarm ocurred %d\n", coap_eap_session->session_id);
-		
-
-		//get_alarm_coap_eap_session(coap_eap_session->list_of_alarms, coap_eap_session->session_id, POST_ALARM);
-		get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
-		coap_eap_session->RTX_COUNTER++;
-		if (coap_eap_session->RTX_COUNTER < MAX_RETRANSMIT) {
-
-			if (coap_eap_session->lastSentMessage != NULL)
-			{
-
-				pana_debug("Retransmiting %f\n",coap_eap_session->RT);
-
-				coapRetransmitLastSentMessage(coap_eap_session);
-            }
-			/*else
-				pana_debug("No message for retransmitting\n");
-			*/
-		}
-		else {
-			pana_debug("Timeout %d\n",coap_eap_session->session_id);
-			int session = coap_eap_session->session_id;
-			remove_coap_eap_session(session);
-			remove_coap_eap_session(session);
-			//XFREE(coap_eap_session); //Rafa: Watch out!!!
-		}
-		
-	} 
-	else if (alarm_id == SESS_ALARM)
-	{
-		pana_debug("Session expired\n");
-	}	
-	else {
-		pana_debug("An UNKNOWN alarm ocurred");
-	}
-
-
-
-
-#if DEBUG
-	printDebug(coap_eap_session);
-#endif
-
-
-	pthread_mutex_unlock(&(coap_eap_session->mutex));
-
-
-	pana_debug("######## SALIMOS DE: process_retr_coap_eap \n"
-			"##\n"
-			"œ\n"
-	);
-
-	return NULL;
-}
-
-// Coap EAP Session Functions
-void add_coap_eap_session(coap_eap_ctx * session) {
-	
-	if(session == NULL)
-	{
-		pana_error("ERROR: add_coap_eap_session: session  == NULL ");
-		exit(0);	
-	}
-	
-	int rc; //> return code of pthreads functions.  
-
-	struct coap_eap_ctx_list * new_element;
-
-	/* create structure with new request */
-	new_element = XMALLOC(struct coap_eap_ctx_list,1);
-	new_element->coap_eap_session = session;
-	new_element->next = NULL;
-
-	/* lock the mutex, to assure exclusive access to the list */
-	rc = pthread_mutex_lock(&list_sessions_mutex);
-
-	/* add new session to the end of the list, updating list */
-	/* pointers as required */
-	if (list_coap_eap_sessions == NULL) { /* special case - list is empty */
-		list_coap_eap_sessions = new_element;
-	} 
-	else {
-		new_element->next = list_coap_eap_sessions;
-		list_coap_eap_sessions = new_element;
-	}
-
-	pana_debug("add_session: added CoAP EAP session: %X",ntohl(new_element->coap_eap_session->session_id));
-	/* unlock mutex */
-	rc = pthread_mutex_unlock(&list_sessions_mutex);
-
-}
-
-coap_eap_ctx* get_coap_eap_session(uint32_t id) {
-	int rc; /* return code of pthreads functions.  */
-
-	struct coap_eap_ctx_list* session = NULL;
-
-//	pana_debug("Trying to get session of id: %X", htonl(id));
-	/* lock the mutex, to assure exclusive access to the list */
-	rc = pthread_mutex_lock(&list_sessions_mutex);
+//	pana_debug("Trying to get session of id: %X", htonl(id));
+	/* lock the mutex, to assure exclusive access to the list */
+	rc = pthread_mutex_lock(&list_sessions_mutex);
 
 	if (list_coap_eap_sessions != NULL) {
 		session = list_coap_eap_sessions;
@@ -958,7 +883,7 @@ coap_eap_ctx* get_coap_eap_session(uint32_t id) {
 	/* return the session to the caller. */
 	if (session == NULL) {
 		pana_debug("Session not found, id: %d", ntohl(id));
-		exit(0);	
+		return NULL;
 	}
 	return session->coap_eap_session;
 }
@@ -981,7 +906,6 @@ void * handle_worker(void* data) {
 
 
 	int thread_id = *((int*) data); /* thread identifying number */
-	int rc; /* return code of pthreads functions.  */
 	struct task_list* a_task = NULL; /* pointer to a task. */
 
 
@@ -989,27 +913,18 @@ void * handle_worker(void* data) {
 	pana_debug("Starting thread '%d'", thread_id);
 
 
-	/* lock the mutex, to access the requests list exclusively. */
-	sem_wait(&got_task);
-
 	/* do forever.... */
 	while (fin) {
 
+		wait_task();
 
 		pana_debug("thread '%d' tries to get a task", thread_id);
 
-
-		if (list_tasks != NULL) { /* a request is pending */
-			a_task = get_task();
-		}
-
+		a_task = get_task();
 		if (a_task) {
-			//pana_debug("Hay task!");
 			a_task->use_function(a_task->data);
+			XFREE(a_task);
 		}
-		rc = sem_wait(&got_task);
-		/* and after we return from pthread_cond_wait, the mutex  */
-		/* is locked again, so we don't need to lock it ourselves */
 	}
 
 
@@ -1022,380 +937,510 @@ void * handle_worker(void* data) {
 }
 
 
-void* process_coap_msg(void *arg){
-	if(arg == NULL)
-	{
-		pana_error("ERROR: process_coap_msg: arg  == NULL ");
-		exit(0);	
-	}
-
-
-	printf("@"
-			"##"
-			"######## ENTRAMOS EN: process_coap_msg\n");
-
+/**
+ * Serializes the CBOR of the first POST once: the cipher suites offered.
+ */
+static void encode_request_cbor(){
 
-	struct network_task *mytask = (struct network_task *)arg;
+	struct coap_eap_cbor cbor;
 
-	CoapPDU *request = new CoapPDU((uint8_t *)mytask->buf, BUF_LEN, BUF_LEN);
-	request->setPDULength(mytask->len);
+	memset(&cbor, 0, sizeof(cbor));
+	cbor.present = COAP_EAP_CBOR_CIPHER_SUITES;
+	cbor.n_cipher_suites = sizeof(offered_cipher_suites);
+	memcpy(cbor.cipher_suites, offered_cipher_suites, sizeof(offered_cipher_suites));
 
-	if(request->validate() != 1){
-		pana_debug("Malformed CoapPDU \n");
-		exit(0);
+	request_cbor_len = coap_eap_cbor_encode(&coap_eap_cbor_request, &cbor,
+			request_cbor, sizeof(request_cbor));
+	if (request_cbor_len < 0) {
+		pana_error("Cannot encode the CBOR of the first POST");
+		request_cbor_len = 0;
 	}
+}
 
+/**
+ * Starts the EAP authentication of a new device: sends the first POST,
+ * with the EAP Request/Identity and the list of cipher suites, to the
+ * URI announced by the device in its request. A re-authentication has
+ * no request, the location is the one of the last session.
+ */
+static void send_first_post(coap_eap_ctx *coap_eap_session, CoapPDU *request){
 
-#if DEBUG
-
-#endif
-	request->printHuman();
-
-	struct sockaddr_storage * recvFrom = &(mytask->their_addr);
-	int sockfd = global_sockfd;
-	uint32_t session_id = mytask->session_id;
-	
-	
-	coap_eap_ctx *coap_eap_session = NULL;
-
-
-	pana_debug("Session ID: %x \n", session_id);
-	pana_debug("Session ID2: %x \n", session_id);
-
-
-	coap_eap_session = get_coap_eap_session(session_id);
+	pana_debug("######## ENTRAMOS EN: send_first_post\n");
 
-	if(coap_eap_session == NULL )
-	{	
-		pana_debug("Error getting coap_eap_session\n");
-		exit(0);		
-	}
-	
-	int rc =  pthread_mutex_lock(&(coap_eap_session->mutex));
 	struct wpabuf * packet;
 
-	pana_debug("######## IN PROCESS RECEVIE COAP\n");
-
-#if DEBUG
-	printDebug(coap_eap_session);
-#endif
-
-	socklen_t addrLen = sizeof(struct sockaddr_in);
-	if(recvFrom->ss_family==AF_INET6) {
-		addrLen = sizeof(struct sockaddr_in6);
-	}
-
-
-	//  prepare next message, a POST
-	CoapPDU *pdu = new CoapPDU();
-	pdu->setVersion(1);
-	pdu->setType(CoapPDU::COAP_CONFIRMABLE);
-	pdu->setCode(CoapPDU::COAP_POST);
-	pdu->setToken((uint8_t*)&coap_eap_session->session_id,sizeof(uint32_t));
-	pdu->setMessageID(coap_eap_session->message_id );
-
-	printf("---------------------------- \n");
-	printf("Payload of the first message %d \n",request->getPayloadLength());
-	printf("---------------------------- \n");
+	if(request != NULL)
+		pana_debug("Payload of the first message %d \n",request->getPayloadLength());
 
-	if(request->getPayloadLength() == 0){	
-			coap_eap_session->location = strdup("/.well-known/a");
-		//		pdu->setURI((char*)"/.well-known/a",14);
+	if(request == NULL){
+		// Re-authentication, the location is already set.
+	}else if(request->getPayloadLength() == 0){
+		coap_eap_session->location = strdup("/.well-known/a");
 	}else{
-			coap_eap_session->location = (char *) malloc((request->getPayloadLength() + 5 )* sizeof(char));
-			memset(coap_eap_session->location, 0, (request->getPayloadLength() + 5 )* sizeof(char));
-			memcpy(coap_eap_session->location,request->getPayloadPointer(),request->getPayloadLength());
-			//pdu->setURI((char*) request->getPayloadPointer(),request->getPayloadLength());					
+		coap_eap_session->location = (char *) malloc((request->getPayloadLength() + 5 )* sizeof(char));
+		memset(coap_eap_session->location, 0, (request->getPayloadLength() + 5 )* sizeof(char));
+		memcpy(coap_eap_session->location,request->getPayloadPointer(),request->getPayloadLength());
 	}
 
-			printf("The Stored URI is %s \n",coap_eap_session->location);
-			pdu->setURI((char*) coap_eap_session->location,strlen(coap_eap_session->location));
-
+	pana_debug("The Stored URI is %s \n",coap_eap_session->location);
 
 	// Empezamos con el tratamiento EAP, enviamos el primer put
 	eap_auth_set_eapRestart(&(coap_eap_session->eap_ctx), TRUE);
 	eap_auth_step(&(coap_eap_session->eap_ctx));
-	packet = eap_auth_get_eapReqData(&(coap_eap_session->eap_ctx));
-
-	unsigned char tempPayload[100]={0};
-	memcpy(tempPayload, (uint8_t *)wpabuf_head(packet),(uint8_t) wpabuf_len(packet));
-	memcpy(tempPayload+(uint8_t) wpabuf_len(packet),cborCryptosuite,4);
-
-	//pdu->setPayload((uint8_t *)wpabuf_head(packet),(uint8_t) wpabuf_len(packet));
-	pdu->setPayload((uint8_t *)tempPayload,(uint8_t) wpabuf_len(packet)+4 );
-
+	packet = eap_auth_take_eapReqData(&(coap_eap_session->eap_ctx));
 
+	get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
+	coap_eap_session->RTX_COUNTER = 0;
+	coap_eap_session->RT = coap_eap_session->RT_INIT;
+	add_alarm_coap_eap(&(list_alarms_coap_eap),coap_eap_session,coap_eap_session->RT,POST_ALARM);
 
-	coap_eap_session->CURRENT_STATE = 2;
-
-	storeLastReceivedMessageInSession(request,coap_eap_session);
-	storeLastSentMessageInSession(pdu,coap_eap_session);
+	pana_debug("SENDING POST\n");
+	// The cryptosuites follow the EAP request in the payload.
+	pthread_once(&request_cbor_once, encode_request_cbor);
+	send_post(coap_eap_session, packet, NULL, 0, request_cbor, (size_t) request_cbor_len, 0);
+}
 
+/**
+ * Starts the re-authentication of a device with ERP: the first POST is an
+ * EAP-Initiate/Re-auth-Start, sent to the location of the last session.
+ */
+static void send_erp_start(coap_eap_ctx *coap_eap_session){
 
+	struct wpabuf *start = wpabuf_alloc(ERP_START_LEN);
 
+	if (start != NULL)
+		erp_build_start((uint8_t) coap_eap_session->message_id, (uint8_t *) wpabuf_put(start, ERP_START_LEN));
+	coap_eap_session->erp = ERP_STARTED;
 
 	get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
 	coap_eap_session->RTX_COUNTER = 0;
 	coap_eap_session->RT = coap_eap_session->RT_INIT;
 	add_alarm_coap_eap(&(list_alarms_coap_eap),coap_eap_session,coap_eap_session->RT,POST_ALARM);
 
-	
-	char s[INET6_ADDRSTRLEN];
-	pana_debug("Alarma añandida:::::::\n  MSGID: %d IP: %s\n", ntohs(pdu->getMessageID()),
-			inet_ntop(((coap_eap_session)->recvAddr).ss_family,
-					get_in_addr((struct sockaddr *)&(coap_eap_session)->recvAddr),
-					s, sizeof s)
-	);
-	
-	pana_debug("SENDING POST\n");
-#if DEBUG
-    printHexadecimal(pdu);
-#endif
-    pdu->printHuman();
-
-    ssize_t sent2 = sendto(
-			sockfd,
-			pdu->getPDUPointer(),
-            (size_t) pdu->getPDULength(),
-			0,
-			(sockaddr*)recvFrom,
-			addrLen
-		     );
-	if(sent2<0) {
-		DBG("Error sending packet: %ld.",sent);
-		perror(NULL);
-		//return NULL;
-	}
+	pana_debug("SENDING EAP-Initiate/Re-auth-Start, session %X\n", coap_eap_session->session_id);
+	if (start != NULL)
+		send_post(coap_eap_session, start, NULL, 0, NULL, 0, 0);
+}
 
+/**
+ * Answers the EAP-Initiate/Re-auth of the device, carried by its ACK, with
+ * the EAP-Finish/Re-auth, with the OSCORE option as the EAP success. The
+ * rMSK is the new key of the session. The AAA server is not contacted.
+ *
+ * @return 0 if the EAP-Finish has been sent, -1 if the device has to be
+ * authenticated with EAP (it has no keys, or they are not valid).
+ */
+static int process_erp_reauth(coap_eap_ctx *coap_eap_session, CoapPDU *ack){
 
-	delete request;
-	//delete response;
-	delete pdu;
-	delete mytask;
+	struct erp_msg msg;
+	struct erp_keys keys;
+	struct wpabuf *finish;
+	uint8_t *payload = ack->getPayloadPointer();
+	int payload_len = ack->getPayloadLength();
 
-#if DEBUG
-	printDebug(coap_eap_session);
-#endif
+	if (payload == NULL || payload_len <= 0 ||
+			erp_cache_check(payload, (size_t) payload_len, getTime(), &msg, &keys) < 0)
+		return -1;
 
-	rc =  pthread_mutex_unlock(&(coap_eap_session->mutex));
+	finish = wpabuf_alloc(ERP_MSG_LEN);
+	if (finish == NULL)
+		return -1;
+	erp_build(EAP_CODE_FINISH, msg.id, 0, msg.seq, &keys, (uint8_t *) wpabuf_put(finish, ERP_MSG_LEN));
 
+	XFREE(coap_eap_session->msk_key);
+	coap_eap_session->msk_key = XMALLOC(u8, ERP_RMSK_LEN);
+	coap_eap_session->key_len = ERP_RMSK_LEN;
+	erp_rmsk(&keys, msg.seq, coap_eap_session->msk_key);
+	memset(&keys, 0, sizeof(keys));
 
-    pana_debug("######## SALIMOS DE: process_coap_msg\n"
-			"##\n"
-			"œ\n"
-	);
+	coap_eap_session->message_id += 1;
+	coap_eap_session->erp = ERP_FINISHED;
 
-	return 0;
+	get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
+	coap_eap_session->RTX_COUNTER = 0;
+	coap_eap_session->RT = coap_eap_session->RT_INIT;
+	add_alarm_coap_eap(&(list_alarms_coap_eap),coap_eap_session,coap_eap_session->RT,POST_ALARM);
 
+	pana_debug("SENDING EAP-Finish/Re-auth, SEQ %u, session %X\n", msg.seq, coap_eap_session->session_id);
+	return send_post(coap_eap_session, finish, NULL, 0, NULL, 0, 1);
 }
 
+/**
+ * Stores the location announced in an ACK of the device, the next POST
+ * will be sent there. The template of the POSTs is built again only if
+ * it has changed.
+ */
+static void update_location(coap_eap_ctx *coap_eap_session, CoapPDU *ack){
 
-void* process_acknowledgment(void * arg){
+	char URI[30] = {0};
+	int URI_len;
 
-	if(arg == NULL)
-	{
-		pana_error("ERROR: process_acknowledgment: arg  == NULL ");
-		exit(0);	
+	ack->getLocation(URI,30,&URI_len);
+	// An ACK without Location-Path (e.g. the one of the EAP success) keeps
+	// the previous location, the re-authentication is sent there.
+	if (URI[0] == '\0' && coap_eap_session->location != NULL)
+		return;
+	if (coap_eap_session->location == NULL || strcmp(coap_eap_session->location, URI) != 0) {
+		free(coap_eap_session->location);
+		coap_eap_session->location = strdup(URI);
+		coap_template_invalidate(&(coap_eap_session->post_template));
 	}
 
+	pana_debug("\nURI PATH(%d): %s \n",URI_len, coap_eap_session->location);
+}
 
+/**
+ * Hands the EAP response carried in an ACK to the EAP authenticator. The
+ * CBOR after the EAP packet, if any, is parsed in place and only shown.
+ */
+static void process_eap_response(coap_eap_ctx *coap_eap_session, CoapPDU *ack){
 
-	pana_debug(	"\nœ\n"
-			"##\n"
-			"######## ENTRAMOS EN: process_acknowledgment\n");
-
-
-	struct network_task *mytask = (struct network_task *)arg;
-
-	CoapPDU *request = new CoapPDU((uint8_t *)mytask->buf, BUF_LEN, BUF_LEN);
-	request->setPDULength(mytask->len);
-	
-	if(request->validate() != 1){
-			pana_debug("Error: PDU invalido \n");
-			exit(0);
+	if(ack->getOptionPointer(CoapPDU::COAP_OPTION_AUTH) != NULL){
+		pana_debug("Error: auth option present before the EAP success\n");
 	}
 
-	
-	struct sockaddr_storage * recvFrom = &mytask->their_addr;
-	int sockfd = global_sockfd;
-
-	coap_eap_ctx *coap_eap_session=NULL;
-	uint32_t session_id;
-	memcpy(&session_id, request->getTokenPointer(), (size_t) request->getTokenLength());
-	coap_eap_session = get_coap_eap_session(session_id);
-	
-	
-	if(coap_eap_session == NULL )
-	{	
-		pana_debug("Error getting coap_eap_session\n");
-		exit(0);		
-	}
-	
-	int rc = pthread_mutex_lock(&(coap_eap_session->mutex));
+	uint8_t *payload = ack->getPayloadPointer();
+	int payload_len = ack->getPayloadLength();
+	int lengthEAP = 0;
 
+	if(payload_len >= 4)
+		lengthEAP = (payload[2] << 8) | payload[3];
 
-	pana_debug("######## PROCESSING... ACKNOWLEDGMENT\n");
+	if(lengthEAP > payload_len)
+		lengthEAP = payload_len;
 
+	pana_debug("Length EAP vs Payload: %d -- %d\n",lengthEAP,payload_len);
 
-#if DEBUG
-	printDebug(coap_eap_session);
-#endif
+	if(payload_len > lengthEAP){
+		struct coap_eap_cbor cbor;
 
-	socklen_t addrLen = sizeof(struct sockaddr_in);
-	if(recvFrom->ss_family==AF_INET6) {
-		addrLen = sizeof(struct sockaddr_in6);
+		if (coap_eap_cbor_decode(&coap_eap_cbor_response, payload + lengthEAP,
+				(size_t) (payload_len - lengthEAP), &cbor) < 0)
+			pana_debug("Malformed CBOR content, session %X\n", coap_eap_session->session_id);
+		else if ((cbor.present & COAP_EAP_CBOR_CIPHER_SUITES) && cbor.n_cipher_suites > 0)
+			pana_debug("Cipher suite chosen by the device: %d\n", cbor.cipher_suites[0]);
 	}
 
-	char URI[30] = {0};
-	int URI_len;
-    char ** split_uri = NULL;
-    int split_uri_len;
-
-	CoapPDU *response = new CoapPDU();
-
-	struct wpabuf * packet;
-    unsigned char *lpath = NULL;
-	ssize_t sent;
-	uint8_t *dst;
-
-	bool auth_option_present=FALSE, finish = FALSE;
-	unsigned char mac[16] = {0};
-
-	int session;
+	eap_auth_set_eapResp(&(coap_eap_session->eap_ctx), TRUE);
+	eap_auth_set_eapRespData(&(coap_eap_session->eap_ctx), payload, lengthEAP);
+	eap_auth_step(&(coap_eap_session->eap_ctx));
+}
 
-			unsigned char tempEAPPayload[100] = {0};
+/**
+ * Restarts the exchange of a session restored from the session store.
+ * If the session was waiting for an ACK the last POST is sent again. If it
+ * was waiting for the AAA server, the Access-Request sent before the
+ * restart is lost, so the EAP response of the last ACK is processed again.
+ */
+static void restart_exchange(coap_eap_ctx *coap_eap_session){
 
-	printf("CURRENT_STATE %d\n",coap_eap_session->CURRENT_STATE);
+	pana_debug("Restarting the exchange of the session %X\n", coap_eap_session->session_id);
 
+	if (coap_eap_session->waiting == FLOW_EV_RADIUS) {
+		CoapPDU *ack = new CoapPDU(coap_eap_session->lastReceivedMessage,
+				coap_eap_session->lastReceivedMessage_len,
+				coap_eap_session->lastReceivedMessage_len);
 
-	//char responseURI[10] = {0};
-	if(coap_eap_session->CURRENT_STATE == 1) {
-	/*	
-		coap_eap_session->location = (char *) malloc(10 * sizeof(char));
-		memset(coap_eap_session->location, 0, 10);
-	*/
+		if (ack->validate() == 1)
+			process_eap_response(coap_eap_session, ack);
+		delete ack;
 	}
+	else
+		coapRetransmitLastSentMessage(coap_eap_session);
+}
 
+/**
+ * The CoAP-EAP exchange of a session. It is resumed with every event of
+ * the session (see coap_eap_flow.h):
+ *
+ *  - FLOW_EV_START: data is the request of the device.
+ *  - FLOW_EV_ACK: data is the ACK received.
+ *  - FLOW_EV_RADIUS: data is the RADIUS answer, or the eap_aaa_answer of
+ *    the Diameter one.
+ *  - FLOW_EV_TIMER: the POST retransmission alarm expired.
+ *  - FLOW_EV_AAA_TIMER: the AAA server has not answered in AAA_TIMEOUT.
+ *  - FLOW_EV_RESTORE: the session has been restored from the session
+ *    store, it goes on waiting for what it was (see restore_coap_eap_session).
+ *  - FLOW_EV_REAUTH: re-authentication of an authorized device (see
+ *    start_reauth), with ERP if the cache is enabled.
+ *
+ * Must be called with the session's mutex locked.
+ */
+static int coap_eap_flow_run(coap_eap_ctx *coap_eap_session, int ev, void *data){
 
-	int lengthEAP = 0;
-
-			free(coap_eap_session->location);
-			
-			memset(URI,0,30);
-			request->getLocation(URI,30,&URI_len);
-			printf("The Retrieved URI is %s , len %d\n",URI,URI_len);
-			coap_eap_session->location = strdup(URI);
-			printf("The Stored URI is %s \n",coap_eap_session->location);
-
-			pana_debug("==============");
-			pana_debug("\nURI PATH(%d): %s \n",URI_len, coap_eap_session->location);
-			pana_debug("==============");
+	struct coap_eap_flow *f = &(coap_eap_session->flow);
 
+	FLOW_BEGIN(f);
 
+	if (ev == FLOW_EV_REAUTH && erp_cache_enabled())
+		send_erp_start(coap_eap_session);
+	else if (ev == FLOW_EV_START || ev == FLOW_EV_REAUTH)
+		send_first_post(coap_eap_session, (CoapPDU *) data);
+	else
+		restart_exchange(coap_eap_session);
 
-	switch(coap_eap_session->CURRENT_STATE) {
+	while(1) {
 
-		
+		if (ev == FLOW_EV_RESTORE && coap_eap_session->waiting == FLOW_EV_RADIUS)
+			goto wait_radius;
 
-		case 2:
-			
-			printf("Entramos en el estado 2\n");
-			
+		// Only the ACK of the last POST sent is taken into account,
+		// any other one is a duplicate.
+		coap_eap_session->waiting = FLOW_EV_ACK;
+		FLOW_AWAIT(f, ev == FLOW_EV_TIMER ||
+				(ev == FLOW_EV_ACK &&
+				 ((CoapPDU *) data)->getMessageID() == coap_eap_session->message_id));
 
-			if(request->getOptionPointer(CoapPDU::COAP_OPTION_AUTH) != NULL){
-				pana_debug("Error: estado 2, auth option presente \n");
-				exit(0);
+		if (ev == FLOW_EV_TIMER) {
+			coap_eap_session->RTX_COUNTER++;
+			if (coap_eap_session->RTX_COUNTER < MAX_RETRANSMIT &&
+					coap_eap_session->lastSentIovcnt > 0) {
+				pana_debug("Retransmiting %f\n",coap_eap_session->RT);
+				coapRetransmitLastSentMessage(coap_eap_session);
+				continue;
 			}
+			pana_debug("Timeout %X\n",coap_eap_session->session_id);
+			FLOW_EXIT(f);
+		}
 
+		get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
+		storeLastReceivedMessageInSession((CoapPDU *) data, coap_eap_session);
+		update_location(coap_eap_session, (CoapPDU *) data);
 
-			// We need to look for the  cyphersuite
+		// The device has acknowledged the EAP success (or the
+		// EAP-Finish/Re-auth), we are done.
+		if (eap_auth_get_eapSuccess(&(coap_eap_session->eap_ctx)) == TRUE ||
+				coap_eap_session->erp == ERP_FINISHED)
+			break;
 
-			memcpy(tempEAPPayload,request->getPayloadPointer(), 
-                    (size_t)request->getPayloadLength());
-	
-			printf("EAP_tempPayload: \n");
-		  printf_hex(tempEAPPayload, (size_t)request->getPayloadLength());
-
-			lengthEAP = (tempEAPPayload[2]*10)+tempEAPPayload[3];
-			printf("Length EAP 0: %d\n",tempEAPPayload[2]);
-			printf("Length EAP 1: %d\n",tempEAPPayload[3]);
-			printf("Length EAP: %d\n", lengthEAP);
-			
-			printf("Length EAP vs Payload: %d -- %d\n",lengthEAP,(size_t)request->getPayloadLength());
-			
-		  if((size_t)request->getPayloadLength()>lengthEAP ){
-			printf("CBOR content\n");
-		 printf_hex( tempEAPPayload+(lengthEAP),
- 	               (size_t)request->getPayloadLength()-lengthEAP
- 								);
-	
-			}
+		if (coap_eap_session->erp == ERP_STARTED) {
+			if (process_erp_reauth(coap_eap_session, (CoapPDU *) data) == 0)
+				continue;
+			pana_debug("No ERP keys for session %X, full EAP authentication\n",
+					coap_eap_session->session_id);
+			coap_eap_session->erp = ERP_NONE;
+			coap_eap_session->message_id += 1;
+			send_first_post(coap_eap_session, NULL);
+			continue;
+		}
 
-			eap_auth_set_eapResp(&(coap_eap_session->eap_ctx), TRUE);
-			eap_auth_set_eapRespData(
-										&(coap_eap_session->eap_ctx), 
-											request->getPayloadPointer(), 
-											lengthEAP
-									);
-	
-  			eap_auth_step(&(coap_eap_session->eap_ctx));
+		process_eap_response(coap_eap_session, (CoapPDU *) data);
 
+		// Standalone: the EAP server has already answered.
+		if (!MODE) {
+			if (process_eap_answer(coap_eap_session) <= 0)
+				FLOW_EXIT(f);
+			continue;
+		}
 
+		// The first answer of the AAA is consumed internally
+		// (eap_workarround), so we may have to wait more than once.
+wait_radius:
+		coap_eap_session->waiting = FLOW_EV_RADIUS;
+		// A lost answer would leave the session waiting forever.
+		add_alarm_coap_eap(&(list_alarms_coap_eap), coap_eap_session, AAA_TIMEOUT, AAA_ALARM);
+		do {
+			FLOW_AWAIT(f, ev == FLOW_EV_RADIUS || ev == FLOW_EV_AAA_TIMER);
+			if (ev == FLOW_EV_AAA_TIMER) {
+				pana_debug("No answer of the AAA server, session %X\n",
+						coap_eap_session->session_id);
+				FLOW_EXIT(f);
+			}
+			if (diameter_enabled())
+				f->result = process_aaa_answer(coap_eap_session, (struct eap_aaa_answer *) data);
+			else
+				f->result = process_radius_answer(coap_eap_session, (struct radius_msg *) data);
+		} while (f->result == 0);
+
+		get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, AAA_ALARM);
+		if (f->result < 0)
+			FLOW_EXIT(f);
+	}
 
+	pana_debug("Final binding, session %X finished\n", coap_eap_session->session_id);
 
-			break;
+	FLOW_END(f);
+}
 
-		case 3:
-			
-			pana_debug("Entramos en el estado 3\n");
-			pana_debug("Final Binding.Checking AUTH OPTION\n");
-			
+/**
+ * Writes the state of a session in its slot of the session store. A
+ * session that does not fit in a slot is not stored anymore.
+ */
+static void save_coap_eap_session(coap_eap_ctx *coap_eap_session){
+
+	struct eap_auth_ctx *eap_ctx = &(coap_eap_session->eap_ctx);
+	struct session_record *record;
+	size_t identity_len = 0;
+	u8 *identity = eap_auth_get_eapIdentity(eap_ctx, &identity_len);
+	int passthrough = 0;
+	int state_len;
+
+	if (coap_eap_session->location == NULL ||
+			strlen(coap_eap_session->location) >= STORE_LOCATION_LEN ||
+			coap_eap_session->lastSentMessage_len > STORE_SENT_LEN ||
+			coap_eap_session->lastReceivedMessage_len > STORE_RECEIVED_LEN ||
+			identity_len > STORE_IDENTITY_LEN ||
+			coap_eap_session->key_len > STORE_KEY_LEN)
+		goto not_stored;
+
+	record = session_store_begin(coap_eap_session->store_slot);
+
+	state_len = eap_auth_get_radius_state(eap_ctx, record->radius_state, STORE_RADIUS_STATE_LEN);
+	if (state_len < 0)
+		goto not_stored;
+	record->radius_state_len = (uint16_t) state_len;
+
+	record->session_id = coap_eap_session->session_id;
+	record->message_id = coap_eap_session->message_id;
+	record->waiting = (uint8_t) coap_eap_session->waiting;
+	record->eap_id = (int16_t) eap_auth_get_resume_state(eap_ctx, &passthrough);
+	record->passthrough = (uint8_t) passthrough;
+	record->rtx_counter = coap_eap_session->RTX_COUNTER;
+	record->eap_workarround = coap_eap_session->eap_workarround;
+	record->eap_success = eap_auth_get_eapSuccess(eap_ctx) == TRUE;
+	record->radius_server = (uint8_t) (eap_auth_get_radius_server(eap_ctx) + 1);
+	record->rt = coap_eap_session->RT;
+	record->rt_init = coap_eap_session->RT_INIT;
+	memcpy(&record->addr, &coap_eap_session->recvAddr, sizeof(record->addr));
+	strcpy(record->location, coap_eap_session->location);
+	memset(record->userID, 0, sizeof(record->userID));
+	memcpy(record->userID, coap_eap_session->userID, sizeof(coap_eap_session->userID));
+
+	record->identity_len = (uint16_t) identity_len;
+	if (identity_len > 0)
+		memcpy(record->identity, identity, identity_len);
+
+	record->key_len = 0;
+	if (coap_eap_session->msk_key != NULL) {
+		record->key_len = coap_eap_session->key_len;
+		memcpy(record->msk_key, coap_eap_session->msk_key, coap_eap_session->key_len);
+	}
 
-			auth_option_present = TRUE;
+	record->sent_len = (uint16_t) iov_flatten(coap_eap_session->lastSentIov,
+			coap_eap_session->lastSentIovcnt, record->sent, sizeof(record->sent));
+	record->received_len = (uint16_t) coap_eap_session->lastReceivedMessage_len;
+	memcpy(record->received, coap_eap_session->lastReceivedMessage, (size_t) record->received_len);
 
-			dst = request->getPDUPointer();
+	session_store_commit(coap_eap_session->store_slot);
+	return;
 
-			get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
+not_stored:
+	pana_debug("Session %X does not fit in the session store\n", coap_eap_session->session_id);
+	session_store_release(coap_eap_session->store_slot);
+	coap_eap_session->store_slot = -1;
+}
 
+/**
+ * Rebuilds a session from its record in the session store and restarts
+ * its exchange. Called by session_store_recover.
+ *
+ * @return 0 if the session has been restored.
+ */
+static int restore_coap_eap_session(int slot, const struct session_record *record, void *arg){
 
-			if (auth_option_present)
-			{ 	
+	if (record->sent_len == 0 ||
+			(record->waiting == FLOW_EV_RADIUS && record->received_len == 0))
+		return -1;
 
-				int session = coap_eap_session->session_id;
-				get_alarm_coap_eap_session(&list_alarms_coap_eap, coap_eap_session->session_id, POST_ALARM);
-				remove_coap_eap_session(session);
-				remove_coap_eap_session(session);
+	coap_eap_ctx *coap_eap_session = XMALLOC(coap_eap_ctx,1);
+	init_CoAP_EAP_Session(coap_eap_session);
 
-			}else {
-				pana_debug("AUTH option is not present!!!!\n");
-				int session = coap_eap_session->session_id;
-				get_alarm_coap_eap_session(coap_eap_session->list_of_alarms, coap_eap_session->session_id, POST_ALARM);
-				remove_coap_eap_session(session);				
-				remove_coap_eap_session(session);
+	if (eap_auth_resume(&(coap_eap_session->eap_ctx), record->passthrough, record->eap_id,
+			record->identity, record->identity_len,
+			record->radius_state, record->radius_state_len) < 0) {
+		eap_auth_deinit(&(coap_eap_session->eap_ctx));
+		XFREE(coap_eap_session);
+		return -1;
+	}
+	eap_auth_set_radius_server(&(coap_eap_session->eap_ctx), (int) record->radius_server - 1);
+
+	coap_eap_session->session_id = record->session_id;
+	coap_eap_session->message_id = record->message_id;
+	coap_eap_session->waiting = record->waiting;
+	coap_eap_session->RTX_COUNTER = record->rtx_counter;
+	coap_eap_session->eap_workarround = record->eap_workarround;
+	coap_eap_session->RT = record->rt;
+	coap_eap_session->RT_INIT = record->rt_init;
+	memcpy(&coap_eap_session->recvAddr, &record->addr, sizeof(record->addr));
+	coap_eap_session->location = strdup(record->location);
+	memcpy(coap_eap_session->userID, record->userID, sizeof(coap_eap_session->userID));
+
+	if (record->eap_success)
+		eap_auth_set_eapSuccess(&(coap_eap_session->eap_ctx), TRUE);
+	if (record->key_len > 0) {
+		coap_eap_session->key_len = record->key_len;
+		coap_eap_session->msk_key = XMALLOC(u8, record->key_len);
+		memcpy(coap_eap_session->msk_key, record->msk_key, record->key_len);
+	}
 
-			}
-			break;
+	coap_eap_session->lastSentMessage = XMALLOC(uint8_t, record->sent_len);
+	memcpy(coap_eap_session->lastSentMessage, record->sent, record->sent_len);
+	coap_eap_session->lastSentMessage_len = record->sent_len;
+	coap_eap_session->lastSentIov[0].iov_base = coap_eap_session->lastSentMessage;
+	coap_eap_session->lastSentIov[0].iov_len = record->sent_len;
+	coap_eap_session->lastSentIovcnt = 1;
+	if (record->received_len > 0) {
+		coap_eap_session->lastReceivedMessage = XMALLOC(uint8_t, record->received_len);
+		memcpy(coap_eap_session->lastReceivedMessage, record->received, record->received_len);
+		coap_eap_session->lastReceivedMessage_len = record->received_len;
+	}
 
-		default:
-			break;
+	coap_eap_session->list_of_alarms = &(list_alarms_coap_eap);
+	coap_eap_session->store_slot = slot;
+	add_coap_eap_session(coap_eap_session);
 
-	}
-	
-	delete request;
-	delete response;
+	resume_coap_eap_flow(coap_eap_session, FLOW_EV_RESTORE, NULL);
+	return 0;
+}
 
+int resume_coap_eap_flow(coap_eap_ctx *coap_eap_session, int ev, void *data){
 
+	pthread_mutex_lock(&(coap_eap_session->mutex));
 
-	rc = pthread_mutex_unlock(&(coap_eap_session->mutex));
+	// A late timer or a duplicated ACK of a session that has already
+	// finished: everything was done when it finished.
+	if (FLOW_FINISHED(&coap_eap_session->flow)) {
+		pthread_mutex_unlock(&(coap_eap_session->mutex));
+		return FLOW_IGNORED;
+	}
 
-	pana_debug("######## SALIMOS DE: process_acknowledgment\n"
-			"##\n"
-			"œ\n"
-	);
+	int ret = coap_eap_flow_run(coap_eap_session, ev, data);
+
+	// An ERP exchange is not stored: it is short, and the device gets a
+	// full authentication next time if it is lost. Neither is a standalone
+	// one, the state of the EAP server cannot be restored.
+	if (ret == FLOW_WAITING && coap_eap_session->store_slot >= 0 &&
+			coap_eap_session->erp == ERP_NONE && MODE)
+		save_coap_eap_session(coap_eap_session);
+
+	// The keys of a full authentication are kept for the next
+	// re-authentication.
+	if (ret == FLOW_ENDED && coap_eap_session->erp == ERP_NONE &&
+			coap_eap_session->msk_key != NULL)
+		erp_cache_add(coap_eap_session->msk_key, coap_eap_session->key_len, getTime());
+
+	// The device is authorized, it will be re-authenticated before the
+	// session expires.
+	if (ret == FLOW_ENDED && reauth_enabled() &&
+			reauth_add(&coap_eap_session->recvAddr, coap_eap_session->location,
+					coap_eap_session->session_id, getTime()) < 0)
+		pana_error("Location %s too long, the device will not be re-authenticated",
+				coap_eap_session->location);
+
+	if (ret != FLOW_WAITING) {
+		uint32_t session = coap_eap_session->session_id;
+		session_store_release(coap_eap_session->store_slot);
+		coap_eap_session->store_slot = -1;
+		remove_alarm_coap_eap(&list_alarms_coap_eap, session);
+		remove_coap_eap_session(session);
+	}
 
+	pthread_mutex_unlock(&(coap_eap_session->mutex));
 
+	return ret;
 }
 
+
 int get_coap_address(	void *their_addr, unsigned short port) {
     int rc; /* return code of pthreads functions.  */
 
@@ -1446,18 +1491,369 @@ int get_coap_address(	void *their_addr, unsigned short port) {
 
 
 
+void process_coap_datagram(uint8_t *buf, int len, struct sockaddr_storage *their_addr) {
+
+	coap_eap_ctx *new_coap_eap_session = NULL;
+
+	capture_udp(their_addr, &capture_coap_addr, buf, (size_t) len);
+
+	// validate packet
+	if(len>BUF_LEN) {
+		INFO("PDU too large to fit in pre-allocated buffer");
+		return;
+	}
+
+	CoapPDU recvPDU(buf,len,len);
+	if(recvPDU.validate()!=1) {
+		INFO("Malformed CoAP packet");
+		return;
+	}
+
+#if DEBUG
+	printHexadecimal(&recvPDU);
+#endif
+
+	if(recvPDU.getType() != CoapPDU::COAP_ACKNOWLEDGEMENT) {
+
+		pana_debug("######## GET RECIBIDO\n");
+
+
+		pana_debug("SESSION NOT FOUND, CREATE A NEW ONE\n");
+
+
+		new_coap_eap_session = XMALLOC(coap_eap_ctx,1);
+		init_CoAP_EAP_Session(new_coap_eap_session);
+
+		memcpy(&new_coap_eap_session->recvAddr, their_addr, sizeof(struct sockaddr_storage));
+		pana_debug("The new session_id is %X\n", new_coap_eap_session->session_id);
+
+		new_coap_eap_session->list_of_alarms=&(list_alarms_coap_eap);
+		new_coap_eap_session->store_slot = session_store_alloc();
+		storeLastReceivedMessageInSession(&recvPDU,new_coap_eap_session);
+		add_coap_eap_session(new_coap_eap_session);
+
+		resume_coap_eap_flow(new_coap_eap_session, FLOW_EV_START, &recvPDU);
+
+	} else {
+
+		pana_debug("######## ACK RECIBIDO\n");
+
+		uint32_t session_id = 0;
+		if (recvPDU.getTokenLength() == sizeof(session_id))
+			memcpy(&session_id, recvPDU.getTokenPointer(), sizeof(session_id));
+
+		coap_eap_ctx * coap_eap_session = get_coap_eap_session(session_id);
+
+		if(coap_eap_session == NULL )
+		{
+			pana_debug("ACK for an unknown session, dropped\n");
+			return;
+		}
+
+		// Duplicates are discarded by the flow, it only
+		// accepts the ACK of the last message sent.
+		resume_coap_eap_flow(coap_eap_session, FLOW_EV_ACK, &recvPDU);
+	}
+}
+
+void process_radius_datagram(uint8_t *buf, int len) {
+
+	struct radius_msg *radmsg = radius_msg_parse(buf, (size_t)len);
+	struct eap_auth_ctx *eap_ctx = NULL;
+
+	capture_udp(&capture_as_addr, &capture_radius_addr, buf, (size_t) len);
+
+	// The answers to the Status-Server probes of the pool have no session.
+	if (radmsg != NULL && radius_client_status_response(get_rad_client_ctx(), radmsg)) {
+		radius_msg_free(radmsg);
+		return;
+	}
+
+	if (radmsg != NULL)
+		eap_ctx = search_eap_ctx_rad_client(radius_msg_get_hdr(radmsg)->identifier);
+
+	if (eap_ctx != NULL)
+		resume_coap_eap_flow((coap_eap_ctx*) (eap_ctx->eap_ll_ctx), FLOW_EV_RADIUS, radmsg);
+	else {
+		pana_debug("RADIUS answer without session, dropped\n");
+		if (radmsg != NULL)
+			radius_msg_free(radmsg);
+	}
+}
+
+/* The AAA backend of the authenticators with Diameter: the DER of a
+ * session carries its identifier, in the Session-Id. */
+static int diameter_aaa_send(struct eap_auth_ctx *eap_ctx, const u8 *eap, size_t eap_len,
+		const u8 *state, size_t state_len, u32 *id) {
+
+	coap_eap_ctx *coap_eap_session = (coap_eap_ctx *) eap_ctx->eap_ll_ctx;
+	size_t identity_len;
+	u8 *identity = eap_auth_get_eapIdentity(eap_ctx, &identity_len);
+
+	return diameter_send_der(coap_eap_session->session_id, identity, identity_len,
+			eap, eap_len, state, state_len, id);
+}
+
+static const struct eap_aaa_backend diameter_backend = {
+	"Diameter",
+	diameter_aaa_send
+};
+
+static void process_diameter_answer(const struct diameter_answer *answer) {
+
+	coap_eap_ctx *coap_eap_session = get_coap_eap_session(answer->session);
+	struct eap_aaa_answer aaa;
+
+	if (coap_eap_session == NULL) {
+		pana_debug("Diameter answer without session, dropped\n");
+		return;
+	}
+
+	aaa.id = answer->id;
+	if (answer->result == DIAMETER_MULTI_ROUND_AUTH)
+		aaa.result = EAP_AAA_CHALLENGE;
+	else if (answer->result == DIAMETER_SUCCESS)
+		aaa.result = EAP_AAA_ACCEPT;
+	else
+		aaa.result = EAP_AAA_REJECT;
+	aaa.eap = answer->eap;
+	aaa.eap_len = answer->eap_len;
+	aaa.msk = answer->msk;
+	aaa.msk_len = answer->msk_len;
+	aaa.state = answer->state;
+	aaa.state_len = answer->state_len;
+	resume_coap_eap_flow(coap_eap_session, FLOW_EV_RADIUS, &aaa);
+}
+
+int init_diameter_backend(const struct diameter_conf *conf) {
+
+	if (diameter_init(conf) < 0)
+		return -1;
+	eap_auth_set_aaa_backend(&diameter_backend);
+	return 0;
+}
+
+void process_diameter_message(uint8_t *buf, int len) {
+
+	diameter_receive(buf, (size_t) len, process_diameter_answer);
+}
+
+/**
+ * Starts the re-authentication of an authorized device: a new session,
+ * as if the device had sent its first request, whose first POST is sent
+ * to the location of the last one.
+ */
+static void start_reauth(const struct reauth_device *device){
+
+	coap_eap_ctx *new_coap_eap_session = XMALLOC(coap_eap_ctx,1);
+	init_CoAP_EAP_Session(new_coap_eap_session);
+
+	memcpy(&new_coap_eap_session->recvAddr, &device->addr, sizeof(struct sockaddr_storage));
+	new_coap_eap_session->location = strdup(device->location);
+	pana_debug("Re-authentication %sof %s, session_id %X\n",
+			device->urgent ? "(urgent) " : "", device->location, new_coap_eap_session->session_id);
+
+	new_coap_eap_session->list_of_alarms=&(list_alarms_coap_eap);
+	new_coap_eap_session->store_slot = session_store_alloc();
+	add_coap_eap_session(new_coap_eap_session);
+
+	resume_coap_eap_flow(new_coap_eap_session, FLOW_EV_REAUTH, NULL);
+}
+
+#ifndef SIMULATION
+/** Task of the workers: start_reauth.*/
+static void * reauth_task(void *data){
+	start_reauth((struct reauth_device *) data);
+	XFREE(data);
+	return NULL;
+}
+#endif
+
+/**
+ * Re-authentications due at time. The simulator starts them at once,
+ * the controller hands them to the workers, the urgent ones first.
+ */
+static void process_reauths(double time) {
+
+	struct reauth_device device;
+	while (reauth_pop(time, &device))
+	{
+#ifdef SIMULATION
+		start_reauth(&device);
+#else
+		struct reauth_device *task = XMALLOC(struct reauth_device,1);
+		memcpy(task, &device, sizeof(device));
+		if (device.urgent)
+			add_priority_task(reauth_task, task);
+		else
+			add_task(reauth_task, task);
+#endif
+	}
+}
+
+void process_alarms(double time) {
+
+	struct lalarm_coap* alarm = NULL;
+	while ((alarm=get_next_alarm_coap_eap(&list_alarms_coap_eap, time)) != NULL)
+	{
+		pana_debug("Looking for alarms\n");
+
+		if (alarm->id == POST_ALARM) 
+		{
+			pana_debug("A POST_AUTH alarm ocurred %d\n",alarm->coap_eap_session->session_id);
+			resume_coap_eap_flow(alarm->coap_eap_session, FLOW_EV_TIMER, NULL);
+		}
+
+		else if (alarm->id == AAA_ALARM)
+		{
+			pana_debug("An AAA_ALARM alarm ocurred %d\n",alarm->coap_eap_session->session_id);
+			resume_coap_eap_flow(alarm->coap_eap_session, FLOW_EV_AAA_TIMER, NULL);
+		}
+
+		else { // An unknown alarm is activated.
+			pana_debug("\nAn UNKNOWN alarm ocurred\n");
+		}
+
+		XFREE(alarm);
+	}
+
+	process_reauths(time);
+	radius_client_status_timer(get_rad_client_ctx());
+}
+
+/** AAA servers given to the RADIUS client, AS_IP the first one.*/
+struct aaa_servers {
+	char *ips[AS_POOL_MAX];
+	int ports[AS_POOL_MAX];
+	int num;
+};
+
+/**
+ * Adds a server "ip:port", "[ipv6]:port" or "ip" (AS_PORT) to the list if
+ * it is not there yet. It is the realm_server_cb of the realm table.
+ *
+ * @return Its index in the list, -1 if it is not valid or the list is full.
+ */
+static int add_aaa_server(const char *server, void *arg) {
+
+	struct aaa_servers *list = (struct aaa_servers *) arg;
+	char buf[INET6_ADDRSTRLEN + 8];
+	char *ip = buf, *colon;
+	int port = AS_PORT, i;
+
+	if (strlen(server) >= sizeof(buf)) {
+		pana_error("AAA server %s is not valid", server);
+		return -1;
+	}
+	strcpy(buf, server);
+	if (ip[0] == '[') {
+		colon = strchr(ip, ']');
+		if (colon == NULL) {
+			pana_error("AAA server %s is not valid", server);
+			return -1;
+		}
+		*colon++ = '\0';
+		ip++;
+		if (*colon == ':')
+			port = atoi(colon + 1);
+	} else if ((colon = strchr(ip, ':')) != NULL && strchr(colon + 1, ':') == NULL) {
+		*colon = '\0';
+		port = atoi(colon + 1);
+	}
+	if (port <= 0) {
+		pana_error("The port of the AAA server %s is not valid", server);
+		return -1;
+	}
+
+	for (i = 0; i < list->num; i++)
+		if (list->ports[i] == port && strcmp(list->ips[i], ip) == 0)
+			return i;
+	if (list->num == AS_POOL_MAX) {
+		pana_error("More than %d AAA servers, %s is not used", AS_POOL_MAX, server);
+		return -1;
+	}
+	list->ips[list->num] = strdup(ip);
+	list->ports[list->num] = port;
+	return list->num++;
+}
+
+/**
+ * Initializes the RADIUS client with AS_IP, the servers of AS_POOL,
+ * "ip:port" or "[ipv6]:port" separated by spaces, AS_PORT if there is no
+ * port, and the ones of the realms of REALM_FILE. With RadSec there is
+ * only AS_IP.
+ */
+static void init_radius_client(void) {
+
+	struct aaa_servers list;
+	char *pool, *token, *save = NULL;
+	int defaults, realms = 0, i;
+
+	list.ips[0] = strdup(AS_IP);
+	list.ports[0] = AS_PORT;
+	list.num = 1;
+
+	if ((RADSEC_CONNECTIONS > 0 || DIAMETER_CONNECTIONS > 0 || AAA_LOOPBACK) && (AS_POOL != NULL || REALM_FILE != NULL))
+		pana_error("AS_POOL and REALM_FILE are not used with RadSec, Diameter or AAA_LOOPBACK, only AS_IP");
+	else {
+		if (AS_POOL != NULL) {
+			pool = strdup(AS_POOL);
+			for (token = strtok_r(pool, " \t\n", &save); token != NULL;
+					token = strtok_r(NULL, " \t\n", &save))
+				add_aaa_server(token, &list);
+			free(pool);
+		}
+		// The identities without realm go to the servers above.
+		defaults = list.num;
+		if (REALM_FILE != NULL) {
+			realms = realm_table_load(REALM_FILE, add_aaa_server, &list);
+			if (realms < 0) {
+				pana_error("%s could not be loaded, every device goes to AS_IP and AS_POOL", REALM_FILE);
+				while (list.num > defaults)
+					free(list.ips[--list.num]);
+			}
+			realm_set_default((1u << defaults) - 1);
+		}
+	}
+
+	rad_client_init_pool(list.ips, list.ports, list.num,
+			RADSEC_CONNECTIONS > 0 ? (char *) RADSEC_SECRET : AS_SECRET,
+			AS_BALANCE, AS_STATUS_INTERVAL);
+	if (realms > 0)
+		eap_auth_set_radius_route(realm_route);
+	if (list.num > 1)
+		pana_debug("Pool of %d AAA servers, balance %d, %d realms\n", list.num, AS_BALANCE,
+				realms > 0 ? realms : 0);
+	for (i = 0; i < list.num; i++)
+		free(list.ips[i]);
+}
+
+/** Logs the sessions routed to every realm (realm.h).*/
+static void log_realm_sessions(void) {
+
+	struct realm_info info;
+	size_t i;
+
+	for (i = 0; realm_get(i, &info) == 0; i++)
+		if (info.sessions > 0)
+			pana_debug("Realm %.*s: %llu sessions\n", (int) info.name_len, info.name,
+					(unsigned long long) info.sessions);
+	if (realm_count() > 0)
+		pana_debug("Without realm: %llu sessions\n", (unsigned long long) realm_default_sessions());
+}
+
 void * handle_network_management(void *data) {
 
 #define MYPORT "5683"
 
-	// the port users will be connecting to
-	coap_eap_ctx *new_coap_eap_session = NULL;
-
 	//To handle exit signals
 	signal(SIGINT, signal_handler);
 	signal(SIGQUIT, signal_handler);
+	signal(SIGHUP, reload_handler);
 
 	fd_set mreadset; // master read set
+	fd_set mwriteset; // RadSec or Diameter connections waiting to be written
+	struct timespec aaa_wait;
 
 	struct addrinfo hints, *servinfo, *p;
 	int rv;
@@ -1541,88 +1937,165 @@ void * handle_network_management(void *data) {
 
 
 
-	// Radius
-	int radius_sock=0; //Init it to a non-valid value
+	// Radius: one socket, or one per server of the pool
+	int radius_socks[AS_POOL_MAX];
+	int num_radius_socks = 0;
+	int i;
 
 	struct sockaddr_in sa;
 	struct sockaddr_in6 sa6;
 
-	rad_client_init(AS_IP, AS_PORT, AS_SECRET);
+	init_radius_client();
 
 	struct radius_client_data *radius_data = get_rad_client_ctx();
 
-	if (radius_data != NULL) {
-		if (IP_VERSION_AUTH==4)
-			radius_sock = radius_data->auth_serv_sock;
-		else if (IP_VERSION_AUTH==6)
-			radius_sock = radius_data->auth_serv_sock6;
+	// RadSec: the Access-Requests go over TLS connections, and the
+	// answers are read from them instead of radius_socks.
+	if (MODE && RADSEC_CONNECTIONS > 0 && radius_data != NULL) {
+		struct radsec_conf radsec_conf;
+
+		memset(&radsec_conf, 0, sizeof(radsec_conf));
+		radsec_conf.host = AS_IP;
+		radsec_conf.port = RADSEC_PORT > 0 ? RADSEC_PORT : RADSEC_DEFAULT_PORT;
+		radsec_conf.connections = RADSEC_CONNECTIONS;
+		radsec_conf.ca = RADSEC_CA;
+		radsec_conf.cert = RADSEC_CERT;
+		radsec_conf.key = RADSEC_KEY;
+		if (radsec_init(&radsec_conf) < 0)
+			pana_fatal("RadSec to %s could not be initialized", AS_IP);
+		radius_client_set_transport(radius_data, radsec_send, NULL);
+	}
+
+	// Diameter: the EAP responses go in DERs instead of Access-Requests,
+	// the RADIUS client is not used.
+	if (MODE && DIAMETER_CONNECTIONS > 0) {
+		struct diameter_conf diameter_conf;
+
+		if (radsec_enabled())
+			pana_fatal("RadSec and Diameter cannot be used at the same time");
+		memset(&diameter_conf, 0, sizeof(diameter_conf));
+		diameter_conf.host = AS_IP;
+		diameter_conf.port = DIAMETER_PORT > 0 ? DIAMETER_PORT : DIAMETER_DEFAULT_PORT;
+		diameter_conf.connections = DIAMETER_CONNECTIONS;
+		diameter_conf.origin_host = DIAMETER_ORIGIN_HOST;
+		diameter_conf.origin_realm = DIAMETER_ORIGIN_REALM;
+		diameter_conf.destination_realm = DIAMETER_REALM;
+		if (init_diameter_backend(&diameter_conf) < 0)
+			pana_fatal("Diameter to %s could not be initialized", AS_IP);
+	}
+
+	// AAA_LOOPBACK: the Access-Requests go to the AAA server of the
+	// controller instead of AS_IP, and its answers come from its queue.
+	if (MODE && AAA_LOOPBACK && radius_data != NULL) {
+		struct aaa_loopback_conf loopback_conf;
+
+		if (radsec_enabled() || diameter_enabled())
+			pana_fatal("AAA_LOOPBACK cannot be used with RadSec or Diameter");
+		if (PSK_FILE == NULL || psk_store_load(PSK_FILE) < 0)
+			pana_fatal("AAA_LOOPBACK needs the PSK_FILE of the devices");
+		memset(&loopback_conf, 0, sizeof(loopback_conf));
+		loopback_conf.secret = AS_SECRET;
+		loopback_conf.get_psk = psk_store_get;
+		loopback_conf.threads = AAA_LOOPBACK;
+		if (aaa_loopback_init(&loopback_conf) < 0)
+			pana_fatal("The AAA server of the controller could not be started");
+		radius_client_set_transport(radius_data, aaa_loopback_send, NULL);
+		pana_debug("AAA_LOOPBACK: %d threads, %zu devices\n", AAA_LOOPBACK, psk_store_count());
 	}
 
+	if (radius_data != NULL)
+		num_radius_socks = radius_client_get_auth_socks(radius_data, radius_socks, AS_POOL_MAX);
+	capture_sockets_init();
+
 	u8 udp_packet[MAX_DATA_LEN];
-    struct sockaddr_in eap_ll_dst_addr, radius_dst_addr;
-	struct sockaddr_in6 eap_ll_dst_addr6, radius_dst_addr6; //For ipv6 support
+    struct sockaddr_in eap_ll_dst_addr;
+	struct sockaddr_in6 eap_ll_dst_addr6; //For ipv6 support
+	struct sockaddr_storage radius_dst_addr;
 	int addr_size;
 
-	//struct pana_func_parameter *pana_params;
-	struct radius_func_parameter *radius_params;
-	pana *msg;
 	int length;
 
 
+	// The sessions of the previous run are restored once the sockets
+	// and the RADIUS client are ready.
+	if (session_store_enabled()) {
+		int restored = session_store_recover(restore_coap_eap_session, NULL);
+		pana_debug("Sessions restored from the session store: %d\n", restored);
+	}
 
 	while(fin){
 
 		FD_ZERO(&mreadset);
+		FD_ZERO(&mwriteset);
 		FD_SET(global_sockfd, &mreadset);
-		FD_SET(radius_sock, &mreadset);
+		for (i = 0; i < num_radius_socks; i++)
+			FD_SET(radius_socks[i], &mreadset);
+		if (radsec_enabled())
+			radsec_fd_set(&mreadset, &mwriteset);
+		if (diameter_enabled())
+			diameter_fd_set(&mreadset, &mwriteset);
+		if (aaa_loopback_enabled())
+			aaa_loopback_fd_set(&mreadset);
 		
 		// -- 
 		sigset_t emptyset, blockset;
 
         sigemptyset(&blockset);         /* Block SIGINT */
         sigaddset(&blockset, SIGINT);
+        sigaddset(&blockset, SIGHUP);
         sigprocmask(SIG_BLOCK, &blockset, NULL);
 
+        // The workers go on with the old credentials until the new
+        // ones are ready (psk_store.h).
+        if (reload_psk) {
+            reload_psk = 0;
+            if ((!MODE || aaa_loopback_enabled()) && psk_store_load(PSK_FILE) < 0)
+                pana_error("%s could not be loaded, the previous credentials are kept", PSK_FILE);
+            if (!MODE)
+                load_tls();
+            log_realm_sessions();
+        }
+
         /* Initialize nfds and readfds, and perhaps do other work here */
         /* Unblock signal, then wait for signal or ready file descriptor */
 
         sigemptyset(&emptyset);
-        int retSelect  = pselect(FD_SETSIZE, &mreadset, NULL, NULL, NULL, &emptyset);
+        struct timespec *wait = NULL;
+        if ((radsec_enabled() && radsec_timeout(&aaa_wait)) ||
+                (diameter_enabled() && diameter_timeout(&aaa_wait)))
+            wait = &aaa_wait;
+        int retSelect  = pselect(FD_SETSIZE, &mreadset, &mwriteset, NULL, wait, &emptyset);
 
 		//int retSelect = select(FD_SETSIZE,&mreadset,NULL,NULL,NULL);
 
+		if (retSelect < 0) {
+			FD_ZERO(&mreadset);
+			FD_ZERO(&mwriteset);
+		}
+		// Also on a timeout, to open again the connections lost.
+		if (radsec_enabled())
+			radsec_process(&mreadset, &mwriteset, process_radius_datagram);
+		if (diameter_enabled())
+			diameter_process(&mreadset, &mwriteset, process_diameter_answer);
+		if (aaa_loopback_enabled())
+			aaa_loopback_process(&mreadset, process_radius_datagram);
+
 		if(retSelect>0){
 
 
-			if (FD_ISSET(radius_sock, &mreadset)) 
-			{
+			for (i = 0; i < num_radius_socks; i++) {
+				if (!FD_ISSET(radius_socks[i], &mreadset))
+					continue;
 
 				pana_debug( "\nœ\n"
 						"##\n"
 					"######## MENSAJE RADIUS RECIBIDO\n");
 
 
-                length = 0;
-
-				if (IP_VERSION==4){
-					addr_size = sizeof (radius_dst_addr);
-					length = (int) recvfrom(radius_sock, udp_packet, sizeof (udp_packet), 0, (struct sockaddr *) &(radius_dst_addr), (socklen_t *)&(addr_size));
-				}
-				else if (IP_VERSION==6){
-					addr_size = sizeof (radius_dst_addr6);
-					length = (int) recvfrom(radius_sock, udp_packet, sizeof (udp_packet), 0, (struct sockaddr *) &(radius_dst_addr6), (socklen_t *)&(addr_size));
-				}
+				addr_size = sizeof (radius_dst_addr);
+				length = (int) recvfrom(radius_socks[i], udp_packet, sizeof (udp_packet), 0, (struct sockaddr *) &(radius_dst_addr), (socklen_t *)&(addr_size));
 				if (length > 0) 
-				{
-
-          radius_params = XMALLOC(struct radius_func_parameter,1);
-
-					struct radius_msg *radmsg = radius_msg_parse(udp_packet, (size_t)length);
-					radius_params->msg = (struct radius_msg *)XMALLOC ( char,length);
-					memcpy(radius_params->msg, radmsg, (size_t)length);
-					add_task(process_receive_radius_msg, radius_params);                    
-
-				}
+					process_radius_datagram(udp_packet, length);
 				else
 					pana_error("recvfrom returned ret=%d, errno=%d", length, errno);
 
@@ -1642,8 +2115,6 @@ void * handle_network_management(void *data) {
 
 
 
-				CoapPDU *recvPDU = new CoapPDU((uint8_t*)buf,BUF_LEN,BUF_LEN);
-
 				addr_len = sizeof their_addr;
 				if ((numbytes = (int) recvfrom(global_sockfd, buf, MAXBUFLEN-1 , 0,
 								(struct sockaddr *)&their_addr, &addr_len)) == -1) {
@@ -1667,116 +2138,7 @@ void * handle_network_management(void *data) {
 
 				buf[numbytes] = '\0';
 
-				pana_debug("listener: packet contains \"%s\"\n", buf);
-
-
-				// validate packet
-				if(numbytes>BUF_LEN) {
-					INFO("PDU too large to fit in pre-allocated buffer");
-					continue;
-				}
-				
-				recvPDU->setPDULength(numbytes);
-				if(recvPDU->validate()!=1) {
-					INFO("Malformed CoAP packet");
-					continue;
-				}
-
-
-#if DEBUG
-        printHexadecimal(recvPDU);
-#endif
-	recvPDU->printHuman();
-
-				network_task * new_task  = createNetworkTask(buf, numbytes, &their_addr);
-
-
-				if(recvPDU->getType() != CoapPDU::COAP_ACKNOWLEDGEMENT) {
-
-					pana_debug("######## GET RECIBIDO\n");
-
-
-					pana_debug("SESSION NOT FOUND, CREATE A NEW ONE\n");
-
-
-					new_coap_eap_session = XMALLOC(coap_eap_ctx,1);
-					init_CoAP_EAP_Session(new_coap_eap_session);
-					
-					int rc = pthread_mutex_lock(&(new_coap_eap_session->mutex));
-						
-						memcpy(&new_coap_eap_session->recvAddr, &their_addr, sizeof(struct sockaddr_storage));
-						pana_debug("The new session_id is %X\n", new_coap_eap_session->session_id);
-
-						setSessionID(new_task,new_coap_eap_session->session_id);
-						
-						new_coap_eap_session->list_of_alarms=&(list_alarms_coap_eap);
-						add_coap_eap_session(new_coap_eap_session);	
-						
-						storeLastReceivedMessageInSession(recvPDU,new_coap_eap_session);
-
-					rc = pthread_mutex_unlock(&(new_coap_eap_session->mutex));
-	
-					add_task(process_coap_msg, new_task);                    	
-
-
-				} else if(recvPDU->getType() == CoapPDU::COAP_ACKNOWLEDGEMENT){
-
-					pana_debug("######## ACK RECIBIDO\n");
-
-
-					// Nos aseguramos de que el mensaje no es un duplicado
-					uint32_t session_id;
-					memcpy(&session_id, recvPDU->getTokenPointer(), (size_t)recvPDU->getTokenLength());
-
-					coap_eap_ctx * coap_eap_session = get_coap_eap_session(session_id);
-
-					if(coap_eap_session == NULL )
-					{
-						pana_debug("Error getting coap_eap_session\n");
-						exit(0);
-					}
-
-					int rc = pthread_mutex_lock(&(coap_eap_session->mutex));
-
-
-					// Vemos que el ultimo mensaje recivido no sea el mismo que el actual
-					CoapPDU *lastReceived =  new CoapPDU((uint8_t*)coap_eap_session->lastReceivedMessage,BUF_LEN,BUF_LEN);
-					lastReceived->setPDULength(coap_eap_session->lastReceivedMessage_len);
-
-					CoapPDU *lastSent =  new CoapPDU((uint8_t*)coap_eap_session->lastSentMessage,BUF_LEN,BUF_LEN);
-					lastSent->setPDULength(coap_eap_session->lastSentMessage_len);
-
-
-					if(lastReceived->validate() != 1 || lastSent->validate() != 1){
-						INFO(" Malformed CoAP packet");
-						rc = pthread_mutex_unlock(&(coap_eap_session->mutex));
-						continue;
-					}
-
-					if(ntohs(recvPDU->getMessageID()) != ntohs(lastSent->getMessageID()) )
-					{
-
-						pana_debug("DUPLICADO: Mensaje fuera de orden");
-					}
-
-					else{
-						storeLastReceivedMessageInSession(recvPDU,coap_eap_session);
-						add_task(process_acknowledgment, new_task);                    
-					}
-				
-					rc = pthread_mutex_unlock(&(coap_eap_session->mutex));
-					delete lastReceived;
-				}
-
-
-				// code==0, no payload, this is a ping request, send RST
-				if(recvPDU->getPDULength()==0&&recvPDU->getCode()==0) {
-					INFO("CoAP ping request");
-				}else
-				{
-					delete recvPDU;
-				}
-
+				process_coap_datagram((uint8_t *) buf, numbytes, &their_addr);
 
 				pana_debug("######## FIN PROCESAMIENTO DE MENSAJE RECIBIDO\n"
 						"##\n"
@@ -1801,37 +2163,16 @@ void * handle_alarm_coap_management(void *data) {
 
     while (TRUE){ // Do it while the PAA is activated.
 
-		struct retr_coap_func_parameter retrans_params;
 		// Get the actual timestamp.
-		double time = getTime();
-
-		struct lalarm_coap* alarm = NULL;
-		while ((alarm=get_next_alarm_coap_eap(&list_alarms_coap_eap, time)) != NULL)
-        {
-            pana_debug("Looking for alarms\n");
-
-            retrans_params.session = alarm->coap_eap_session;
-			retrans_params.id = 0;
-			
-			if (alarm->id == POST_ALARM) 
-			{
-
-				pana_debug("A POST_AUTH alarm ocurred %d\n",retrans_params.session->session_id);
-
-				retrans_params.id = POST_ALARM;
-				add_task(process_retr_coap_eap, &retrans_params);     
-			}
-
-			else { // An unknown alarm is activated.
-				pana_debug("\nAn UNKNOWN alarm ocurred\n");
-			}
-
-		}
+		process_alarms(getTime());
+		// The capture can be read while the controller runs
+		pcap_file_flush(capture);
 		waitusec(TIME_WAKE_UP);
 	}
 	return NULL;
 }
 
+#ifndef SIMULATION
 //>
 //> MAIN
 //>
@@ -1847,6 +2188,8 @@ int main(int argc, char* argv[]) {
 
 	load_config_server();
 
+	// Seeds the session ids and the retransmission timeouts.
+	srand((unsigned) (getTime() * 1000000));
 
     pana_debug("\n Server operation mode:");
 
@@ -1855,21 +2198,35 @@ int main(int argc, char* argv[]) {
     else
         pana_debug("STANDALONE\n\n");
 
+	// Standalone: the controller is the EAP server of the devices.
+	if (!MODE && PSK_FILE == NULL)
+		pana_fatal("The standalone mode needs the PSK_FILE of the devices");
+	if (!MODE && (psk_store_load(PSK_FILE) < 0 || eap_auth_set_standalone(psk_store_get, psk_store_get_keys) < 0))
+		pana_fatal("The credentials of the standalone mode could not be loaded from %s", PSK_FILE);
+	if (!MODE)
+		load_tls();
+
 
 	global_sockfd = socket(AF_INET6, SOCK_DGRAM, 0);
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-	sem_init(&got_task, 0, 0);
-#pragma clang diagnostic pop
+	init_tasks();
 
 	//Init the lockers
 	pthread_mutex_init(&list_sessions_mutex, NULL);
-	pthread_mutex_init(&list_tasks_mutex, NULL);
 
 	//Init global variables
 	list_alarms_coap_eap = init_alarms_coap();
 
+	if (STORE_FILE != NULL && STORE_SLOTS > 0 &&
+			session_store_open(STORE_FILE, (uint32_t) STORE_SLOTS) < 0)
+		pana_error("The session store could not be opened, sessions will not be restored");
+
+	if (CAPTURE_FILE != NULL && capture_open(CAPTURE_FILE) < 0)
+		pana_error("The capture file %s could not be created", CAPTURE_FILE);
+
+	reauth_init(REAUTH_LIFETIME, REAUTH_JITTER, REAUTH_RATE);
+	erp_cache_init((uint32_t) ERP_CACHE_SIZE, ERP_KEY_LIFETIME);
+
 	for (i = 0; i < NUM_WORKERS; i++) {
 		thr_id[i] = i;
 		pthread_create(&p_threads[i], NULL, handle_worker, (void*) &thr_id[i]);
@@ -1886,6 +2243,4 @@ int main(int argc, char* argv[]) {
 	pana_debug("OpenPANA-CoAP: The server has stopped.\n");
 	return 0;
 }
-
-
-
+#endif
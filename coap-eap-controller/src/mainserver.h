@@ -39,6 +39,8 @@ extern "C" {
 #include "wpa_supplicant/src/utils/wpabuf.h"
 #include "state_machines/session.h"
 #include "panautils.h"
+#include "tasks.h"
+#include "diameter.h"
 
 #ifdef __cplusplus
 }
@@ -59,15 +61,20 @@ extern "C" {
 #define RETR_AAA_TIME 1
 /** Maximum number of retransmissions to an AAA server. */
 #define MAX_RETR_AAA 3
+/**
+ * Time waited for the answer of the AAA server before the session is
+ * removed, the RADIUS client retransmits in the meantime. It is the
+ * MAX_TRANSMIT_WAIT of RFC 7252, the device does not wait longer either.
+ */
+#define AAA_TIMEOUT (ACK_TIMEOUT * ((1 << (MAX_RETRANSMIT + 1)) - 1) * ACK_RANDOM_FACTOR)
+/** Maximum number of AAA servers, AS_IP and the ones of AS_POOL and REALM_FILE. */
+#define AS_POOL_MAX 16
 /** Time to wake up the alarm manager (in miliseconds).*/
 #define TIME_WAKE_UP 1000000
 
 
 //void treatMessage(CoapPDU *recvPDU );
 
-/** Task's callback.*/
-typedef void* (*task_function)(void* data);
-
 /** List of PANA contexts.*/
 //struct pana_ctx_list {
 //	/**PANA context value.*/
@@ -92,19 +99,6 @@ struct coap_ctx_list {
 };
 
 
-/** List of tasks.*/
-struct task_list {
-	/** Function to be used with the task.*/
-    task_function use_function;
-    /** Data of the task.*/
-    void* data;
-    /** Id session of the task.*/
-    //int id_session;
-    /**Pointer to the next task of the list.*/
-    struct task_list * next;
-};
-
-
 /**Struct of process_receive_eap_ll_msg function's parameter.*/
 //struct pana_func_parameter {
 //	/** PaC destination address IPv4. */
@@ -140,19 +134,6 @@ struct coap_eap_func_parameter {
 //	pana_ctx * session;
 //};
 
-struct retr_coap_func_parameter {
-	/** Identifier of the alarm activated.*/
-	int id;
-	/** PANA session associated with the alarm. */
-	coap_eap_ctx * session;
-};
-
-
-/**Struct of process_receive_radius_msg function's parameter*/
-struct radius_func_parameter {
-	/** RADIUS message received */
-    struct radius_msg * msg;
-};
 
 /**
  * A procedure to add a PANA session in the
@@ -171,15 +152,91 @@ struct radius_func_parameter {
  */ 
 void add_coap_eap_session(coap_eap_ctx * session);
 /**
- * A procedure to add a task in the tasks' list
- * managed by the PAA.
+ * A procedure to get a CoAP-EAP session from the sessions' list.
+ *
+ * @param id Session identifier, the token of its messages.
+ *
+ * @return The session, or NULL if it is not in the list.
+ */
+coap_eap_ctx* get_coap_eap_session(uint32_t id);
+/**
+ * A procedure to resume the CoAP-EAP exchange of a session with a new
+ * event. It is called directly by the thread that receives the event.
+ *
+ * @param *session CoAP-EAP session of the event.
+ * @param ev Event identifier (FLOW_EV_*).
+ * @param *data CoapPDU received, RADIUS message or eap_aaa_answer of the
+ * Diameter one received, or NULL for timers.
+ *
+ * @return FLOW_WAITING while the exchange is not finished, FLOW_IGNORED if
+ * it had already finished, the session is removed otherwise.
+ */
+int resume_coap_eap_flow(coap_eap_ctx *session, int ev, void *data);
+/**
+ * A procedure to process a CoAP message received from a device.
+ *
+ * @param *buf Message received.
+ * @param len Length of the message.
+ * @param *their_addr Address of the device.
+ */
+void process_coap_datagram(uint8_t *buf, int len, struct sockaddr_storage *their_addr);
+/**
+ * A procedure to process a RADIUS message received from the AAA server.
+ *
+ * @param *buf Message received.
+ * @param len Length of the message.
+ */
+void process_radius_datagram(uint8_t *buf, int len);
+/**
+ * A procedure to send the EAP responses of the sessions to the AAA server
+ * in Diameter-EAP-Requests instead of RADIUS (diameter.h).
  *
- * @param funcion Callback to function to be executed
- * by some worker thread.
- * @param *arg Arguments of the function pointed by the
- * callback.
+ * @param *conf Configuration of the Diameter transport.
+ *
+ * @return 0 on success, -1 if it could not be initialized.
+ */
+int init_diameter_backend(const struct diameter_conf *conf);
+/**
+ * A procedure to process a Diameter message received from the AAA server
+ * through the transport of the diameter_conf.
+ *
+ * @param *buf Message received.
+ * @param len Length of the message.
+ */
+void process_diameter_message(uint8_t *buf, int len);
+/**
+ * A procedure to resume the sessions whose alarms expired before time,
+ * and to start the re-authentications due.
+ *
+ * @param time Current time, as given by getTime.
+ */
+void process_alarms(double time);
+/**
+ * A procedure to capture the CoAP and RADIUS messages of the controller in
+ * a pcap file, to be replayed later with src/replay.
+ *
+ * @param *path pcap file, it is truncated.
+ *
+ * @return 0 if the capture is started, -1 otherwise.
+ */
+int capture_open(const char *path);
+/**
+ * A procedure to take the addresses of the captured messages from the
+ * CoAP socket and the RADIUS client, and to capture the messages sent by
+ * the RADIUS client too. It is called once they are initialized.
  */
-void add_task(task_function funcion, void* arg);
+void capture_sockets_init();
+/**
+ * A procedure to flush and close the capture.
+ */
+void capture_close();
+#ifdef SIMULATION
+/**
+ * Sends a CoAP message to a device of the simulated network, implemented
+ * by the simulator (src/sim).
+ */
+void sim_coap_send(struct sockaddr_storage *addr, uint8_t *buf, size_t len);
+#endif
 /**
  * A procedure to check if exists a new EAP event
  * available. In that case, a PANA state machine's transition
@@ -198,13 +255,6 @@ void add_task(task_function funcion, void* arg);
  * @return A pointer to the PANA session with the identifier searched.
  */ 
 //pana_ctx* get_session(uint32_t id);
-/**
- * A procedure to get a task from the PANA tasks' list managed by
- * the PAA
- *
- * @return A pointer to the a new task available.
- */ 
-struct task_list* get_task();
 /**
  * A procedure to do the Alarm Manager function in the
  * multithreading framework. Basically, this function consists
@@ -259,12 +309,6 @@ void signal_handler(int sig);
  * @param *arg Arguments necessary to execute the callback
  */ 
 void* process_receive_eap_ll_msg(void * arg);
-/**
- * A procedure to process a RADIUS message received
- *
- * @param *arg Arguments necessary to execute the callback
- */ 
-void* process_receive_radius_msg(void* arg);
 /**
  * A procedure to process a retransmission needed.
  *
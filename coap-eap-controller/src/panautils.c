@@ -473,7 +473,10 @@ int Hex2Dec (char * value, int length) {
 double getTime(){
 	double time;
 	
-	#ifdef HAVE_GETTIMEOFDAY
+	#ifdef SIMULATION
+		// Virtual clock of the simulator (src/sim).
+		time = sim_now();
+	#elif defined(HAVE_GETTIMEOFDAY)
 		struct timeval tv; 
 		gettimeofday(&tv, NULL);
 		time = tv.tv_sec;
@@ -489,7 +492,10 @@ void waitusec(unsigned int wait){
 	waitnano(wait*1000);
 }
 void waitnano(long wait){
-	#ifdef HAVE_NANOSLEEP
+	#ifdef SIMULATION
+		// Nothing sleeps in the simulator, the virtual clock goes on.
+		sim_set_now(sim_now() + (double) wait / 1000000000);
+	#elif defined(HAVE_NANOSLEEP)
 		struct timespec req;
 		long seconds = 0;
 		while(wait > 999999999){//If the limit of nsecs is reached.
@@ -158,6 +158,12 @@ int sendPana6(struct sockaddr_in6 destaddr6, char *msg, int sock);
  * @return Time of the system.
  * */
 double getTime();
+#ifdef SIMULATION
+/** Virtual time of the simulator, in seconds. Used by getTime.*/
+double sim_now();
+/** Moves the virtual clock forward. Used by waitnano.*/
+void sim_set_now(double now);
+#endif
 
 /** 
  * Suspends execution for microseconds intervals.
@@ -0,0 +1,443 @@
+/**
+ * @file pcapfile.c
+ * @brief Reader and writer of pcap files.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "pcapfile.h"
+
+#define PCAP_MAGIC_NG 0x0a0d0d0a
+
+#define IPV4_HEADER_LEN 20
+#define IPV6_HEADER_LEN 40
+#define UDP_HEADER_LEN 8
+
+struct pcap_file {
+	FILE *fp;
+	int write;
+	/** The file was written with the other byte order.*/
+	int swapped;
+	int nsec;
+	uint32_t linktype;
+	uint8_t *buf;
+	pthread_mutex_t mutex;
+};
+
+struct pcap_global_header {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_record_header {
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+static uint32_t swap32(uint32_t v) {
+	return ((v & 0xff) << 24) | ((v & 0xff00) << 8) |
+			((v >> 8) & 0xff00) | (v >> 24);
+}
+
+static uint16_t get16(const uint8_t *p) {
+	return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+	p[0] = (uint8_t) (v >> 8);
+	p[1] = (uint8_t) v;
+}
+
+static struct pcap_file *pcap_file_new(FILE *fp, int write) {
+	struct pcap_file *file = calloc(1, sizeof(*file));
+
+	if (file == NULL)
+		return NULL;
+	file->buf = malloc(PCAP_SNAPLEN);
+	if (file->buf == NULL) {
+		free(file);
+		return NULL;
+	}
+	file->fp = fp;
+	file->write = write;
+	pthread_mutex_init(&file->mutex, NULL);
+	return file;
+}
+
+struct pcap_file *pcap_file_create(const char *path) {
+	struct pcap_global_header header;
+	struct pcap_file *file;
+	FILE *fp;
+
+	fp = fopen(path, "wb");
+	if (fp == NULL)
+		return NULL;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = PCAP_MAGIC;
+	header.version_major = 2;
+	header.version_minor = 4;
+	header.snaplen = PCAP_SNAPLEN;
+	header.linktype = PCAP_LINKTYPE_RAW;
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 || fflush(fp) != 0 ||
+			(file = pcap_file_new(fp, 1)) == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+	file->linktype = PCAP_LINKTYPE_RAW;
+	return file;
+}
+
+struct pcap_file *pcap_file_open(const char *path) {
+	struct pcap_global_header header;
+	struct pcap_file *file;
+	int swapped = 0, nsec = 0;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	if (fread(&header, sizeof(header), 1, fp) != 1)
+		goto error;
+
+	switch (header.magic) {
+	case PCAP_MAGIC:
+		break;
+	case PCAP_MAGIC_NSEC:
+		nsec = 1;
+		break;
+	default:
+		if (header.magic == swap32(PCAP_MAGIC))
+			swapped = 1;
+		else if (header.magic == swap32(PCAP_MAGIC_NSEC))
+			swapped = nsec = 1;
+		else {
+			if (header.magic == PCAP_MAGIC_NG)
+				fprintf(stderr, "%s: pcapng is not supported, convert it with "
+						"\"editcap -F pcap\"\n", path);
+			goto error;
+		}
+	}
+	if (swapped)
+		header.linktype = swap32(header.linktype);
+
+	switch (header.linktype & 0xffff) {
+	case PCAP_LINKTYPE_NULL:
+	case PCAP_LINKTYPE_ETHERNET:
+	case PCAP_LINKTYPE_RAW:
+	case 12: // DLT_RAW of some BSDs
+	case 14:
+	case PCAP_LINKTYPE_LINUX_SLL:
+	case PCAP_LINKTYPE_IPV4:
+	case PCAP_LINKTYPE_IPV6:
+	case PCAP_LINKTYPE_LINUX_SLL2:
+		break;
+	default:
+		fprintf(stderr, "%s: link type %u is not supported\n", path,
+				header.linktype & 0xffff);
+		goto error;
+	}
+
+	file = pcap_file_new(fp, 0);
+	if (file == NULL)
+		goto error;
+	file->swapped = swapped;
+	file->nsec = nsec;
+	file->linktype = header.linktype & 0xffff;
+	return file;
+
+error:
+	fclose(fp);
+	return NULL;
+}
+
+/* Checksum of RFC 1071, over the pseudo-header and the UDP datagram. */
+static uint32_t checksum_add(uint32_t sum, const uint8_t *p, size_t len) {
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += get16(p + i);
+	if (len & 1)
+		sum += (uint32_t) p[len - 1] << 8;
+	return sum;
+}
+
+static uint16_t checksum_fold(uint32_t sum) {
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t) ~sum;
+}
+
+int pcap_file_write_udp(struct pcap_file *file, double time,
+		const struct sockaddr *src, const struct sockaddr *dst,
+		const uint8_t *data, size_t len) {
+	uint8_t ip[IPV6_HEADER_LEN + UDP_HEADER_LEN];
+	struct pcap_record_header record;
+	uint8_t *udp;
+	uint32_t sum;
+	uint8_t proto_len[4];
+	size_t ip_len;
+	int ret = 0;
+
+	if (file == NULL || !file->write || src->sa_family != dst->sa_family ||
+			len > PCAP_SNAPLEN - sizeof(ip))
+		return -1;
+
+	memset(ip, 0, sizeof(ip));
+	if (src->sa_family == AF_INET) {
+		const struct sockaddr_in *s = (const struct sockaddr_in *) src;
+		const struct sockaddr_in *d = (const struct sockaddr_in *) dst;
+
+		ip_len = IPV4_HEADER_LEN;
+		ip[0] = 0x45;
+		put16(ip + 2, (uint16_t) (IPV4_HEADER_LEN + UDP_HEADER_LEN + len));
+		ip[6] = 0x40; // Don't fragment
+		ip[8] = 64;
+		ip[9] = IPPROTO_UDP;
+		memcpy(ip + 12, &s->sin_addr, 4);
+		memcpy(ip + 16, &d->sin_addr, 4);
+		put16(ip + 10, checksum_fold(checksum_add(0, ip, IPV4_HEADER_LEN)));
+
+		udp = ip + ip_len;
+		put16(udp, ntohs(s->sin_port));
+		put16(udp + 2, ntohs(d->sin_port));
+		sum = checksum_add(0, ip + 12, 8);
+	}
+	else if (src->sa_family == AF_INET6) {
+		const struct sockaddr_in6 *s = (const struct sockaddr_in6 *) src;
+		const struct sockaddr_in6 *d = (const struct sockaddr_in6 *) dst;
+
+		ip_len = IPV6_HEADER_LEN;
+		ip[0] = 0x60;
+		put16(ip + 4, (uint16_t) (UDP_HEADER_LEN + len));
+		ip[6] = IPPROTO_UDP;
+		ip[7] = 64;
+		memcpy(ip + 8, &s->sin6_addr, 16);
+		memcpy(ip + 24, &d->sin6_addr, 16);
+
+		udp = ip + ip_len;
+		put16(udp, ntohs(s->sin6_port));
+		put16(udp + 2, ntohs(d->sin6_port));
+		sum = checksum_add(0, ip + 8, 32);
+	}
+	else
+		return -1;
+
+	put16(udp + 4, (uint16_t) (UDP_HEADER_LEN + len));
+	proto_len[0] = 0;
+	proto_len[1] = IPPROTO_UDP;
+	put16(proto_len + 2, (uint16_t) (UDP_HEADER_LEN + len));
+	sum = checksum_add(sum, proto_len, sizeof(proto_len));
+	sum = checksum_add(sum, udp, UDP_HEADER_LEN);
+	sum = checksum_add(sum, data, len);
+	put16(udp + 6, checksum_fold(sum) ? checksum_fold(sum) : 0xffff);
+
+	record.ts_sec = (uint32_t) time;
+	record.ts_frac = (uint32_t) ((time - (double) record.ts_sec) * 1e6);
+	record.incl_len = record.orig_len = (uint32_t) (ip_len + UDP_HEADER_LEN + len);
+
+	pthread_mutex_lock(&file->mutex);
+	if (fwrite(&record, sizeof(record), 1, file->fp) != 1 ||
+			fwrite(ip, ip_len + UDP_HEADER_LEN, 1, file->fp) != 1 ||
+			(len > 0 && fwrite(data, len, 1, file->fp) != 1))
+		ret = -1;
+	pthread_mutex_unlock(&file->mutex);
+	return ret;
+}
+
+/* Parses the IP and UDP headers of a packet. @return 1 if it is UDP. */
+static int parse_ip(const uint8_t *p, size_t len, double time, struct pcap_udp *udp) {
+	const uint8_t *payload;
+	size_t hdr_len, udp_len;
+
+	memset(udp, 0, sizeof(*udp));
+	if (len < 1)
+		return 0;
+
+	if ((p[0] >> 4) == 4) {
+		struct sockaddr_in *src = (struct sockaddr_in *) &udp->src;
+		struct sockaddr_in *dst = (struct sockaddr_in *) &udp->dst;
+
+		hdr_len = (size_t) (p[0] & 0x0f) * 4;
+		if (len < IPV4_HEADER_LEN || hdr_len < IPV4_HEADER_LEN ||
+				len < hdr_len + UDP_HEADER_LEN || p[9] != IPPROTO_UDP)
+			return 0;
+		// Only the first fragment has the UDP header
+		if ((get16(p + 6) & 0x1fff) != 0)
+			return 0;
+		if (get16(p + 2) >= hdr_len && get16(p + 2) < len)
+			len = get16(p + 2);
+
+		src->sin_family = dst->sin_family = AF_INET;
+		memcpy(&src->sin_addr, p + 12, 4);
+		memcpy(&dst->sin_addr, p + 16, 4);
+		payload = p + hdr_len;
+		src->sin_port = htons(get16(payload));
+		dst->sin_port = htons(get16(payload + 2));
+	}
+	else if ((p[0] >> 4) == 6) {
+		struct sockaddr_in6 *src = (struct sockaddr_in6 *) &udp->src;
+		struct sockaddr_in6 *dst = (struct sockaddr_in6 *) &udp->dst;
+
+		// Extension headers are not followed
+		hdr_len = IPV6_HEADER_LEN;
+		if (len < hdr_len + UDP_HEADER_LEN || p[6] != IPPROTO_UDP)
+			return 0;
+		if (hdr_len + get16(p + 4) < len)
+			len = hdr_len + get16(p + 4);
+
+		src->sin6_family = dst->sin6_family = AF_INET6;
+		memcpy(&src->sin6_addr, p + 8, 16);
+		memcpy(&dst->sin6_addr, p + 24, 16);
+		payload = p + hdr_len;
+		src->sin6_port = htons(get16(payload));
+		dst->sin6_port = htons(get16(payload + 2));
+	}
+	else
+		return 0;
+
+	udp_len = get16(payload + 4);
+	if (udp_len < UDP_HEADER_LEN || hdr_len + udp_len > len)
+		udp_len = len - hdr_len;
+
+	udp->time = time;
+	udp->data = payload + UDP_HEADER_LEN;
+	udp->len = udp_len - UDP_HEADER_LEN;
+	return 1;
+}
+
+/* Skips the link layer header. @return The offset of the IP header, or -1. */
+static long link_offset(uint32_t linktype, const uint8_t *p, size_t len) {
+	uint16_t ethertype;
+	size_t off;
+
+	switch (linktype) {
+	case PCAP_LINKTYPE_ETHERNET:
+		if (len < 14)
+			return -1;
+		off = 12;
+		ethertype = get16(p + off);
+		// 802.1Q and 802.1ad tags
+		while ((ethertype == 0x8100 || ethertype == 0x88a8) && len >= off + 6) {
+			off += 4;
+			ethertype = get16(p + off);
+		}
+		off += 2;
+		return (ethertype == 0x0800 || ethertype == 0x86dd) ? (long) off : -1;
+	case PCAP_LINKTYPE_LINUX_SLL:
+		if (len < 16)
+			return -1;
+		ethertype = get16(p + 14);
+		return (ethertype == 0x0800 || ethertype == 0x86dd) ? 16 : -1;
+	case PCAP_LINKTYPE_LINUX_SLL2:
+		if (len < 20)
+			return -1;
+		ethertype = get16(p);
+		return (ethertype == 0x0800 || ethertype == 0x86dd) ? 20 : -1;
+	case PCAP_LINKTYPE_NULL:
+		// The family is in the byte order of the host that captured it
+		return len < 4 ? -1 : 4;
+	default:
+		return 0;
+	}
+}
+
+int pcap_file_read_udp(struct pcap_file *file, struct pcap_udp *udp) {
+	struct pcap_record_header record;
+	double time;
+	long off;
+
+	if (file == NULL || file->write)
+		return -1;
+
+	for (;;) {
+		if (fread(&record, sizeof(record), 1, file->fp) != 1)
+			return feof(file->fp) ? 0 : -1;
+		if (file->swapped) {
+			record.ts_sec = swap32(record.ts_sec);
+			record.ts_frac = swap32(record.ts_frac);
+			record.incl_len = swap32(record.incl_len);
+		}
+		if (record.incl_len > PCAP_SNAPLEN)
+			return -1;
+		if (record.incl_len > 0 &&
+				fread(file->buf, record.incl_len, 1, file->fp) != 1)
+			return -1;
+
+		time = (double) record.ts_sec +
+				(double) record.ts_frac / (file->nsec ? 1e9 : 1e6);
+		off = link_offset(file->linktype, file->buf, record.incl_len);
+		if (off >= 0 && parse_ip(file->buf + off, record.incl_len - (size_t) off,
+				time, udp))
+			return 1;
+	}
+}
+
+void pcap_file_flush(struct pcap_file *file) {
+	if (file == NULL)
+		return;
+	pthread_mutex_lock(&file->mutex);
+	fflush(file->fp);
+	pthread_mutex_unlock(&file->mutex);
+}
+
+void pcap_file_close(struct pcap_file *file) {
+	if (file == NULL)
+		return;
+	fclose(file->fp);
+	pthread_mutex_destroy(&file->mutex);
+	free(file->buf);
+	free(file);
+}
+
+uint16_t pcap_addr_port(const struct sockaddr_storage *addr) {
+	if (addr->ss_family == AF_INET)
+		return ntohs(((const struct sockaddr_in *) addr)->sin_port);
+	if (addr->ss_family == AF_INET6)
+		return ntohs(((const struct sockaddr_in6 *) addr)->sin6_port);
+	return 0;
+}
+
+void pcap_addr_str(const struct sockaddr_storage *addr, char *buf, size_t len) {
+	char ip[INET6_ADDRSTRLEN] = "?";
+
+	if (addr->ss_family == AF_INET6) {
+		inet_ntop(AF_INET6, &((const struct sockaddr_in6 *) addr)->sin6_addr, ip, sizeof(ip));
+		snprintf(buf, len, "[%s]:%u", ip, pcap_addr_port(addr));
+		return;
+	}
+	if (addr->ss_family == AF_INET)
+		inet_ntop(AF_INET, &((const struct sockaddr_in *) addr)->sin_addr, ip, sizeof(ip));
+	snprintf(buf, len, "%s:%u", ip, pcap_addr_port(addr));
+}
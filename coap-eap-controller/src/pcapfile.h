@@ -0,0 +1,106 @@
+/**
+ * @file pcapfile.h
+ * @brief Headers of the reader and writer of pcap files.
+ *
+ * Only the classic pcap format (not pcapng) and UDP over IPv4 or IPv6 are
+ * handled, which is what the traffic of the controller needs: CoAP with
+ * the devices and RADIUS with the AAA server.
+ *
+ * Files are written with LINKTYPE_RAW, the IP and UDP headers are built
+ * from the addresses of the datagram. They are read with Ethernet, Linux
+ * "cooked" (SLL and SLL2), BSD loopback and raw IP link types, so
+ * captures taken with tcpdump on any interface can be used too.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PCAPFILE_H
+#define PCAPFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_SNAPLEN 65535
+
+#define PCAP_LINKTYPE_NULL 0
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_LINKTYPE_RAW 101
+#define PCAP_LINKTYPE_LINUX_SLL 113
+#define PCAP_LINKTYPE_IPV4 228
+#define PCAP_LINKTYPE_IPV6 229
+#define PCAP_LINKTYPE_LINUX_SLL2 276
+
+struct pcap_file;
+
+/** A UDP datagram read from a pcap file.*/
+struct pcap_udp {
+	double time;                  /**< Timestamp, in seconds.*/
+	struct sockaddr_storage src;
+	struct sockaddr_storage dst;
+	const uint8_t *data;          /**< Valid until the next read.*/
+	size_t len;
+};
+
+/**
+ * Creates a pcap file, it is truncated if it exists.
+ *
+ * @return The file, or NULL on error.
+ */
+struct pcap_file *pcap_file_create(const char *path);
+
+/**
+ * Opens a pcap file to be read.
+ *
+ * @return The file, or NULL if it cannot be opened or its format or link
+ * type are not supported.
+ */
+struct pcap_file *pcap_file_open(const char *path);
+
+/**
+ * Writes a UDP datagram. src and dst must be of the same family.
+ * It can be called from several threads.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int pcap_file_write_udp(struct pcap_file *file, double time,
+		const struct sockaddr *src, const struct sockaddr *dst,
+		const uint8_t *data, size_t len);
+
+/**
+ * Reads the next UDP datagram, the rest of packets are skipped.
+ *
+ * @return 1 if a datagram has been read, 0 at the end of the file, -1 on
+ * error.
+ */
+int pcap_file_read_udp(struct pcap_file *file, struct pcap_udp *udp);
+
+/** Flushes the data written to the file.*/
+void pcap_file_flush(struct pcap_file *file);
+
+void pcap_file_close(struct pcap_file *file);
+
+/** @return The port of the address, in host order.*/
+uint16_t pcap_addr_port(const struct sockaddr_storage *addr);
+
+/** Writes "address:port" (e.g. "[fd00::1]:5683") in buf.*/
+void pcap_addr_str(const struct sockaddr_storage *addr, char *buf, size_t len);
+
+#endif
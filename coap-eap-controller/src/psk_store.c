@@ -0,0 +1,314 @@
+/**
+ * @file psk_store.c
+ * @brief Credentials of the standalone mode.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "includes.h"
+#include "common.h"
+#include "eap_common/eap_psk_common.h"
+
+#include "psk_store.h"
+#include "panautils.h"
+
+/** Max length of an identity.*/
+#define PSK_STORE_IDENTITY_LEN 253
+
+/** A device, its identity is in the buffer of the table.*/
+struct psk_entry {
+	uint32_t offset;
+	uint16_t len;
+	uint8_t psk[PSK_STORE_KEY_LEN];
+	/**AK and KDK of EAP-PSK, derived when the file is loaded.*/
+	struct eap_psk_keys keys;
+};
+
+/** The credentials of a file, replaced as a whole when it is loaded again.*/
+struct psk_table {
+	/**Content of the file, mapped or copied.*/
+	char *buf;
+	size_t size;
+	int mapped;
+	struct psk_entry *entries;
+	uint32_t count;
+	/**index + 1 of the entry, 0 if the slot is empty.*/
+	uint32_t *slots;
+	uint32_t slots_mask;
+};
+
+static struct psk_table *table = NULL;
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* FNV-1a of the identity. */
+static uint32_t identity_hash(const uint8_t *identity, size_t len) {
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ identity[i]) * 16777619u;
+	return hash;
+}
+
+/* Slot of the identity, or the empty one where it would be inserted. */
+static uint32_t find_slot(const struct psk_table *t, const uint8_t *identity, size_t len) {
+	uint32_t i = identity_hash(identity, len) & t->slots_mask;
+	const struct psk_entry *e;
+
+	while (t->slots[i] != 0) {
+		e = &t->entries[t->slots[i] - 1];
+		if (e->len == len && memcmp(t->buf + e->offset, identity, len) == 0)
+			break;
+		i = (i + 1) & t->slots_mask;
+	}
+	return i;
+}
+
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* 16 characters or 32 hexadecimal digits. */
+static int parse_psk(const char *p, size_t len, uint8_t *psk) {
+	size_t i;
+	int high, low;
+
+	if (len == PSK_STORE_KEY_LEN) {
+		memcpy(psk, p, len);
+		return 0;
+	}
+	if (len != 2 * PSK_STORE_KEY_LEN)
+		return -1;
+	for (i = 0; i < PSK_STORE_KEY_LEN; i++) {
+		high = hex_value(p[2 * i]);
+		low = hex_value(p[2 * i + 1]);
+		if (high < 0 || low < 0)
+			return -1;
+		psk[i] = (uint8_t) (high << 4 | low);
+	}
+	return 0;
+}
+
+static int is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void free_table(struct psk_table *t) {
+	if (t == NULL)
+		return;
+	if (t->mapped)
+		munmap(t->buf, t->size);
+	else
+		XFREE(t->buf);
+	// The keys of the devices are not left in the heap.
+	if (t->entries != NULL)
+		memset(t->entries, 0, t->count * sizeof(*t->entries));
+	XFREE(t->entries);
+	XFREE(t->slots);
+	XFREE(t);
+}
+
+/* Indexes the lines of t->buf. */
+static int build_table(struct psk_table *t) {
+	const char *p = t->buf, *end = t->buf + t->size;
+	const char *identity, *psk;
+	size_t identity_len, psk_len, lines = 1, slots = 2;
+	uint32_t slot, line = 0;
+	struct psk_entry *e;
+
+	for (; p < end; p++)
+		lines += *p == '\n';
+	// Load factor of 1/2 at most.
+	while (slots < 2 * lines)
+		slots *= 2;
+	t->entries = XMALLOC(struct psk_entry, lines);
+	t->slots = XCALLOC(uint32_t, slots);
+	t->slots_mask = (uint32_t) slots - 1;
+
+	for (p = t->buf; p < end; p++) {
+		line++;
+		while (p < end && is_space(*p))
+			p++;
+		if (p == end || *p == '\n' || *p == '#')
+			goto next_line;
+
+		identity = p;
+		while (p < end && !is_space(*p) && *p != '\n')
+			p++;
+		identity_len = (size_t) (p - identity);
+		while (p < end && is_space(*p))
+			p++;
+		psk = p;
+		while (p < end && !is_space(*p) && *p != '\n')
+			p++;
+		psk_len = (size_t) (p - psk);
+		while (p < end && is_space(*p))
+			p++;
+
+		if (identity_len > PSK_STORE_IDENTITY_LEN || (p < end && *p != '\n' && *p != '#')) {
+			pana_error("psk_store: line %u is not \"identity psk\"", line);
+			return -1;
+		}
+
+		// A device repeated takes the key of its last line.
+		slot = find_slot(t, (const uint8_t *) identity, identity_len);
+		if (t->slots[slot] == 0) {
+			t->slots[slot] = ++t->count;
+			e = &t->entries[t->count - 1];
+			e->offset = (uint32_t) (identity - t->buf);
+			e->len = (uint16_t) identity_len;
+		}
+		e = &t->entries[t->slots[slot] - 1];
+		if (parse_psk(psk, psk_len, e->psk) < 0) {
+			pana_error("psk_store: the key of line %u must be %d characters or %d hexadecimal digits",
+					line, PSK_STORE_KEY_LEN, 2 * PSK_STORE_KEY_LEN);
+			return -1;
+		}
+		eap_psk_keys_setup(e->psk, &e->keys);
+
+next_line:
+		while (p < end && *p != '\n')
+			p++;
+	}
+	return 0;
+}
+
+/* Replaces the table in use if t is right. */
+static int install_table(struct psk_table *t) {
+	struct psk_table *old;
+	int count;
+
+	if (build_table(t) < 0) {
+		free_table(t);
+		return -1;
+	}
+	count = (int) t->count;
+
+	pthread_rwlock_wrlock(&table_lock);
+	old = table;
+	table = t;
+	pthread_rwlock_unlock(&table_lock);
+
+	free_table(old);
+	pana_debug("psk_store: %d devices loaded", count);
+	return count;
+}
+
+int psk_store_load(const char *path) {
+	struct psk_table *t;
+	struct stat st;
+	void *buf;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		pana_error("psk_store: cannot open %s", path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	t = XCALLOC(struct psk_table, 1);
+	if (st.st_size > 0) {
+		buf = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf == MAP_FAILED) {
+			pana_error("psk_store: cannot map %s", path);
+			close(fd);
+			XFREE(t);
+			return -1;
+		}
+		t->buf = (char *) buf;
+		t->size = (size_t) st.st_size;
+		t->mapped = 1;
+	}
+	close(fd);
+	return install_table(t);
+}
+
+int psk_store_load_buffer(const char *buf, size_t len) {
+	struct psk_table *t = XCALLOC(struct psk_table, 1);
+	char *copy = XMALLOC(char, len + 1);
+
+	memcpy(copy, buf, len);
+	t->buf = copy;
+	t->size = len;
+	return install_table(t);
+}
+
+int psk_store_get(const uint8_t *identity, size_t identity_len, uint8_t *psk) {
+	uint32_t slot;
+	int ret = -1;
+
+	pthread_rwlock_rdlock(&table_lock);
+	if (table != NULL) {
+		slot = find_slot(table, identity, identity_len);
+		if (table->slots[slot] != 0) {
+			memcpy(psk, table->entries[table->slots[slot] - 1].psk, PSK_STORE_KEY_LEN);
+			ret = 0;
+		}
+	}
+	pthread_rwlock_unlock(&table_lock);
+	return ret;
+}
+
+int psk_store_get_keys(const uint8_t *identity, size_t identity_len, struct eap_psk_keys *keys) {
+	uint32_t slot;
+	int ret = -1;
+
+	pthread_rwlock_rdlock(&table_lock);
+	if (table != NULL) {
+		slot = find_slot(table, identity, identity_len);
+		if (table->slots[slot] != 0) {
+			memcpy(keys, &table->entries[table->slots[slot] - 1].keys, sizeof(*keys));
+			ret = 0;
+		}
+	}
+	pthread_rwlock_unlock(&table_lock);
+	return ret;
+}
+
+size_t psk_store_count() {
+	size_t n;
+
+	pthread_rwlock_rdlock(&table_lock);
+	n = table != NULL ? table->count : 0;
+	pthread_rwlock_unlock(&table_lock);
+	return n;
+}
+
+void psk_store_close() {
+	struct psk_table *old;
+
+	pthread_rwlock_wrlock(&table_lock);
+	old = table;
+	table = NULL;
+	pthread_rwlock_unlock(&table_lock);
+	free_table(old);
+}
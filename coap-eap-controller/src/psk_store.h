@@ -0,0 +1,90 @@
+/**
+ * @file psk_store.h
+ * @brief Headers of the credentials of the standalone mode.
+ *
+ * In standalone mode (MODE 0 in config.xml) the controller is the EAP
+ * server of the devices, with EAP-PSK, and takes their keys from this
+ * store instead of asking the AAA server.
+ *
+ * The store is a text file, one device per line:
+ *
+ *   # identity  psk
+ *   usera       1234567812345678
+ *   userb       000102030405060708090a0b0c0d0e0f
+ *
+ * The PSK is 16 characters, or 32 hexadecimal digits. The file is mapped
+ * in memory (mmap) and indexed by identity in an open addressing table,
+ * the identities are not copied. The AK and KDK of EAP-PSK, with their
+ * AES key schedules, are derived once per device when the file is loaded
+ * (about 400 bytes per device), so the authentications do not derive
+ * them again. It can be loaded again while the controller runs (SIGHUP):
+ * the new table replaces the old one at once, and the old one is kept if
+ * the file has errors.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PSK_STORE_H
+#define PSK_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct eap_psk_keys;
+
+/** Length of the PSK of EAP-PSK.*/
+#define PSK_STORE_KEY_LEN 16
+
+/**
+ * Loads the file of credentials, replacing the ones loaded before.
+ *
+ * @return Number of devices loaded, -1 on error (the previous ones are kept).
+ */
+int psk_store_load(const char *path);
+/** Same as psk_store_load, from a buffer with the content of a file.*/
+int psk_store_load_buffer(const char *buf, size_t len);
+/**
+ * Looks for the PSK of a device.
+ *
+ * @param *identity Identity of the device (not '\0' terminated).
+ * @param identity_len Its length.
+ * @param *psk Filled with the key, PSK_STORE_KEY_LEN bytes.
+ *
+ * @return 0 if it has been found, -1 otherwise.
+ */
+int psk_store_get(const uint8_t *identity, size_t identity_len, uint8_t *psk);
+/**
+ * Looks for the AK and KDK of a device (eap_psk_common.h).
+ *
+ * @return 0 if it has been found, -1 otherwise.
+ */
+int psk_store_get_keys(const uint8_t *identity, size_t identity_len, struct eap_psk_keys *keys);
+/** @return Number of devices in the store.*/
+size_t psk_store_count();
+/** Frees the credentials.*/
+void psk_store_close();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
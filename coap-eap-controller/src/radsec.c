@@ -0,0 +1,680 @@
+/**
+ * @file radsec.c
+ * @brief RADIUS over TLS (RadSec, RFC 6614) transport to the AAA server.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#include "radsec.h"
+#include "panautils.h"
+
+#define RADIUS_HDR_LEN 20
+#define RADIUS_MAX_LEN 4096
+/** A whole TLS record fits in the read buffer, after a partial message.*/
+#define RADSEC_IN_SIZE (16384 + RADIUS_MAX_LEN)
+/** Backoff of the reconnections, in seconds.*/
+#define RADSEC_BACKOFF_MIN 0.1
+#define RADSEC_BACKOFF_MAX 30
+/** Seconds to establish a connection, TCP and TLS.*/
+#define RADSEC_CONNECT_TIMEOUT 5
+/** Seconds without any answer, with requests in flight, before the connection is taken as lost.*/
+#define RADSEC_ANSWER_TIMEOUT 10
+
+enum radsec_state {
+	RADSEC_CLOSED,
+	RADSEC_CONNECTING,
+	RADSEC_HANDSHAKE,
+	RADSEC_UP
+};
+
+struct radsec_conn {
+	int fd;
+	enum radsec_state state;
+	SSL *ssl;
+	/**Last session of the server, resumed by the next connection.*/
+	SSL_SESSION *session;
+	/**TLS waits for the socket to be writable.*/
+	int want_write;
+	/**Next connection attempt when closed, or end of the current one.*/
+	double deadline;
+	double backoff;
+	/**Last answer received, or start of the requests in flight.*/
+	double last_answer;
+	/**The connection established has received answers.*/
+	int answered;
+
+	/**Requests queued by radsec_send, under the lock.*/
+	uint8_t *out;
+	size_t out_len;
+	size_t out_size;
+	/**Requests being written by the network thread.*/
+	uint8_t *wbuf;
+	size_t wbuf_len;
+	size_t wbuf_off;
+	size_t wbuf_size;
+
+	uint8_t in[RADSEC_IN_SIZE];
+	size_t in_len;
+
+	/**Copy of the requests without answer, by RADIUS identifier, under the lock.*/
+	uint8_t *pending[256];
+	uint32_t in_flight;
+};
+
+struct radsec {
+	SSL_CTX *ctx;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char *host;
+	int verify;
+	size_t queue_limit;
+	/**The senders wake up the network thread through it.*/
+	int doorbell[2];
+	int rung;
+	struct radsec_conn *conns;
+	int nconns;
+	/**The counters of the connections are only written by the network thread.*/
+	struct radsec_stats stats;
+	pthread_mutex_t lock;
+};
+
+static struct radsec *radsec = NULL;
+
+static uint16_t radius_len(const uint8_t *msg) {
+	return (uint16_t) ((msg[2] << 8) | msg[3]);
+}
+
+/* The session is kept by the connection: the next one resumes it. */
+static int new_session(SSL *ssl, SSL_SESSION *session) {
+	struct radsec_conn *c = (struct radsec_conn *) SSL_get_app_data(ssl);
+
+	if (c == NULL)
+		return 0;
+	if (c->session != NULL)
+		SSL_SESSION_free(c->session);
+	c->session = session;
+	return 1;
+}
+
+static int resolve(const char *host, int port, struct sockaddr_storage *addr, socklen_t *addr_len) {
+	struct addrinfo hints, *res;
+	char service[8];
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+	if (getaddrinfo(host, service, &hints, &res) != 0)
+		return -1;
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	*addr_len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return 0;
+}
+
+static int append(uint8_t **buf, size_t *len, size_t *size, const uint8_t *data, size_t data_len) {
+	if (*len + data_len > *size) {
+		size_t n = *size ? *size : 4096;
+		uint8_t *p;
+
+		while (n < *len + data_len)
+			n *= 2;
+		p = (uint8_t *) realloc(*buf, n);
+		if (p == NULL)
+			return -1;
+		*buf = p;
+		*size = n;
+	}
+	memcpy(*buf + *len, data, data_len);
+	*len += data_len;
+	return 0;
+}
+
+/* The connection open with the fewest requests in flight, or the one
+ * closed with the fewest if none is open. Under the lock. */
+static struct radsec_conn *pick_conn(struct radsec_conn *except) {
+	struct radsec_conn *best = NULL, *c;
+	int i;
+
+	for (i = 0; i < radsec->nconns; i++) {
+		c = &radsec->conns[i];
+		if (c == except)
+			continue;
+		if (best == NULL || (c->state == RADSEC_UP && best->state != RADSEC_UP) ||
+				((c->state == RADSEC_UP) == (best->state == RADSEC_UP) &&
+				 c->in_flight < best->in_flight))
+			best = c;
+	}
+	return best;
+}
+
+/* Removes the request with this identifier, wherever it is. Under the lock. */
+static void forget_request(uint8_t id) {
+	struct radsec_conn *c;
+	int i;
+
+	for (i = 0; i < radsec->nconns; i++) {
+		c = &radsec->conns[i];
+		if (c->pending[id] != NULL) {
+			free(c->pending[id]);
+			c->pending[id] = NULL;
+			c->in_flight--;
+			radsec->stats.in_flight--;
+			return;
+		}
+	}
+}
+
+static void ring(void) {
+	char b = 0;
+
+	if (!radsec->rung) {
+		radsec->rung = 1;
+		if (write(radsec->doorbell[1], &b, 1) < 0 && errno != EAGAIN)
+			pana_error("radsec: the network thread could not be woken up");
+	}
+}
+
+int radsec_send(void *ctx, const uint8_t *data, size_t len) {
+	struct radsec_conn *c;
+	uint8_t *copy;
+	uint8_t id;
+
+	if (radsec == NULL || len < RADIUS_HDR_LEN || len > RADIUS_MAX_LEN)
+		return -1;
+	id = data[1];
+	copy = (uint8_t *) malloc(len);
+	if (copy == NULL)
+		return -1;
+	memcpy(copy, data, len);
+
+	pthread_mutex_lock(&radsec->lock);
+	// A retransmission of the RADIUS client replaces the old request.
+	forget_request(id);
+	c = pick_conn(NULL);
+	if (c->out_len + len > radsec->queue_limit ||
+			append(&c->out, &c->out_len, &c->out_size, data, len) < 0) {
+		radsec->stats.refused++;
+		pthread_mutex_unlock(&radsec->lock);
+		free(copy);
+		errno = ENOBUFS;
+		return -1;
+	}
+	if (c->in_flight++ == 0)
+		c->last_answer = getTime();
+	c->pending[id] = copy;
+	radsec->stats.requests++;
+	radsec->stats.in_flight++;
+	ring();
+	pthread_mutex_unlock(&radsec->lock);
+	return (int) len;
+}
+
+/* Queues again the requests without answer of a connection lost, on the
+ * connection open with the fewest requests, or on the same one if none
+ * is open. Its queue is dropped: the requests of the queue are pending too. */
+static void requeue(struct radsec_conn *c) {
+	struct radsec_conn *to;
+	int id;
+
+	pthread_mutex_lock(&radsec->lock);
+	c->out_len = 0;
+	c->wbuf_len = c->wbuf_off = 0;
+	for (id = 0; id < 256; id++) {
+		if (c->pending[id] == NULL)
+			continue;
+		to = pick_conn(c);
+		if (to == NULL || to->state != RADSEC_UP)
+			to = c;
+		if (append(&to->out, &to->out_len, &to->out_size, c->pending[id], radius_len(c->pending[id])) < 0) {
+			forget_request((uint8_t) id);
+			continue;
+		}
+		if (to != c) {
+			to->pending[id] = c->pending[id];
+			c->pending[id] = NULL;
+			c->in_flight--;
+			if (to->in_flight++ == 0)
+				to->last_answer = getTime();
+		}
+		radsec->stats.resent++;
+	}
+	pthread_mutex_unlock(&radsec->lock);
+}
+
+/* A connection lost after it got answers is opened again at once, the
+ * backoff is for the ones that fail. why is NULL if the server closed it. */
+static void conn_close(struct radsec_conn *c, double now, const char *why) {
+	if (why != NULL)
+		pana_error("radsec: connection to the AAA server %s: %s", c->state == RADSEC_UP ? "lost" : "failed", why);
+	else
+		pana_debug("radsec: connection closed by the AAA server\n");
+	if (c->state == RADSEC_UP)
+		radsec->stats.up--;
+	if (c->state == RADSEC_UP && c->answered) {
+		c->backoff = RADSEC_BACKOFF_MIN;
+		c->deadline = now;
+	} else {
+		c->deadline = now + c->backoff;
+		c->backoff *= 2;
+		if (c->backoff > RADSEC_BACKOFF_MAX)
+			c->backoff = RADSEC_BACKOFF_MAX;
+	}
+	radsec->stats.failures++;
+	if (c->ssl != NULL) {
+		// A session is only resumable if its connection was shut down:
+		// the close_notify of the server is answered.
+		if (why == NULL)
+			SSL_shutdown(c->ssl);
+		SSL_free(c->ssl);
+		c->ssl = NULL;
+	}
+	if (c->fd >= 0) {
+		close(c->fd);
+		c->fd = -1;
+	}
+	c->state = RADSEC_CLOSED;
+	c->want_write = 0;
+	c->in_len = 0;
+	requeue(c);
+}
+
+static void conn_handshake(struct radsec_conn *c, double now) {
+	int ret = SSL_connect(c->ssl);
+	const char *reason;
+
+	if (ret == 1) {
+		c->state = RADSEC_UP;
+		c->want_write = 0;
+		c->last_answer = now;
+		c->answered = 0;
+		radsec->stats.connects++;
+		radsec->stats.up++;
+		if (SSL_session_reused(c->ssl))
+			radsec->stats.resumed++;
+		pana_debug("radsec: connection to the AAA server established%s\n",
+				SSL_session_reused(c->ssl) ? " (resumed)" : "");
+		return;
+	}
+	switch (SSL_get_error(c->ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		c->want_write = 0;
+		break;
+	case SSL_ERROR_WANT_WRITE:
+		c->want_write = 1;
+		break;
+	default:
+		reason = ERR_reason_error_string(ERR_get_error());
+		ERR_clear_error();
+		conn_close(c, now, reason != NULL ? reason : "TLS handshake");
+	}
+}
+
+static void conn_start_tls(struct radsec_conn *c, double now) {
+	c->ssl = SSL_new(radsec->ctx);
+	if (c->ssl == NULL || SSL_set_fd(c->ssl, c->fd) != 1) {
+		conn_close(c, now, "TLS connection");
+		return;
+	}
+	SSL_set_app_data(c->ssl, c);
+	if (c->session != NULL)
+		SSL_set_session(c->ssl, c->session);
+	if (radsec->verify) {
+		// The name or the address of the server must be in its certificate.
+		X509_VERIFY_PARAM *param = SSL_get0_param(c->ssl);
+
+		if (X509_VERIFY_PARAM_set1_ip_asc(param, radsec->host) != 1) {
+			SSL_set1_host(c->ssl, radsec->host);
+			SSL_set_tlsext_host_name(c->ssl, radsec->host);
+		}
+	}
+	c->state = RADSEC_HANDSHAKE;
+	conn_handshake(c, now);
+}
+
+static void conn_open(struct radsec_conn *c, double now) {
+	int one = 1;
+
+	c->fd = socket(radsec->addr.ss_family, SOCK_STREAM, 0);
+	if (c->fd < 0) {
+		conn_close(c, now, strerror(errno));
+		return;
+	}
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+	fcntl(c->fd, F_SETFD, FD_CLOEXEC);
+	// The requests are written as soon as they are queued.
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(c->fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+
+	c->deadline = now + RADSEC_CONNECT_TIMEOUT;
+	if (connect(c->fd, (struct sockaddr *) &radsec->addr, radsec->addr_len) == 0)
+		conn_start_tls(c, now);
+	else if (errno == EINPROGRESS)
+		c->state = RADSEC_CONNECTING;
+	else
+		conn_close(c, now, strerror(errno));
+}
+
+/* Writes everything queued, the queue of the senders becomes the buffer
+ * being written when the previous one is done. */
+static void conn_write(struct radsec_conn *c, double now) {
+	int ret;
+
+	for (;;) {
+		if (c->wbuf_off == c->wbuf_len) {
+			uint8_t *buf;
+			size_t size;
+
+			pthread_mutex_lock(&radsec->lock);
+			buf = c->wbuf;
+			size = c->wbuf_size;
+			c->wbuf = c->out;
+			c->wbuf_size = c->out_size;
+			c->wbuf_len = c->out_len;
+			c->wbuf_off = 0;
+			c->out = buf;
+			c->out_size = size;
+			c->out_len = 0;
+			pthread_mutex_unlock(&radsec->lock);
+			if (c->wbuf_len == 0)
+				return;
+		}
+
+		ret = SSL_write(c->ssl, c->wbuf + c->wbuf_off, (int) (c->wbuf_len - c->wbuf_off));
+		if (ret > 0) {
+			c->wbuf_off += (size_t) ret;
+			c->want_write = 0;
+			radsec->stats.writes++;
+			continue;
+		}
+		switch (SSL_get_error(c->ssl, ret)) {
+		case SSL_ERROR_WANT_WRITE:
+			c->want_write = 1;
+			return;
+		case SSL_ERROR_WANT_READ:
+			return;
+		default:
+			conn_close(c, now, "write");
+			ERR_clear_error();
+			return;
+		}
+	}
+}
+
+/* Reads the answers and passes the whole ones to deliver. */
+static void conn_read(struct radsec_conn *c, double now, radsec_deliver_cb deliver) {
+	size_t off, len;
+	int ret;
+
+	for (;;) {
+		ret = SSL_read(c->ssl, c->in + c->in_len, (int) (sizeof(c->in) - c->in_len));
+		if (ret <= 0) {
+			switch (SSL_get_error(c->ssl, ret)) {
+			case SSL_ERROR_WANT_READ:
+				return;
+			case SSL_ERROR_WANT_WRITE:
+				c->want_write = 1;
+				return;
+			case SSL_ERROR_ZERO_RETURN:
+				conn_close(c, now, NULL);
+				return;
+			default:
+				conn_close(c, now, "read");
+				ERR_clear_error();
+				return;
+			}
+		}
+		c->in_len += (size_t) ret;
+
+		for (off = 0; c->in_len - off >= 4; off += len) {
+			len = radius_len(c->in + off);
+			if (len < RADIUS_HDR_LEN || len > RADIUS_MAX_LEN) {
+				conn_close(c, now, "invalid RADIUS message");
+				return;
+			}
+			if (c->in_len - off < len)
+				break;
+			pthread_mutex_lock(&radsec->lock);
+			forget_request(c->in[off + 1]);
+			radsec->stats.answers++;
+			pthread_mutex_unlock(&radsec->lock);
+			c->last_answer = now;
+			c->answered = 1;
+			deliver(c->in + off, (int) len);
+		}
+		memmove(c->in, c->in + off, c->in_len - off);
+		c->in_len -= off;
+	}
+}
+
+int radsec_init(const struct radsec_conf *conf) {
+	int i;
+
+	if (radsec != NULL || conf->connections <= 0 || conf->connections > RADSEC_MAX_CONNECTIONS)
+		return -1;
+	radsec = (struct radsec *) calloc(1, sizeof(*radsec));
+	if (radsec == NULL)
+		return -1;
+	radsec->doorbell[0] = radsec->doorbell[1] = -1;
+	pthread_mutex_init(&radsec->lock, NULL);
+	radsec->queue_limit = conf->queue_limit ? conf->queue_limit : RADSEC_DEFAULT_QUEUE_LIMIT;
+	radsec->host = strdup(conf->host);
+	if (resolve(conf->host, conf->port, &radsec->addr, &radsec->addr_len) < 0) {
+		pana_error("radsec: the address of the AAA server %s could not be resolved", conf->host);
+		goto fail;
+	}
+
+	// RFC 6614 needs TLS 1.1 at least.
+	radsec->ctx = SSL_CTX_new(TLS_client_method());
+	if (radsec->ctx == NULL || SSL_CTX_set_min_proto_version(radsec->ctx, TLS1_2_VERSION) != 1)
+		goto fail;
+	SSL_CTX_set_mode(radsec->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+	SSL_CTX_set_session_cache_mode(radsec->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(radsec->ctx, new_session);
+	if (conf->ca != NULL) {
+		if (SSL_CTX_load_verify_locations(radsec->ctx, conf->ca, NULL) != 1) {
+			pana_error("radsec: %s could not be loaded", conf->ca);
+			goto fail;
+		}
+		SSL_CTX_set_verify(radsec->ctx, SSL_VERIFY_PEER, NULL);
+		radsec->verify = 1;
+	} else
+		pana_error("radsec: without CA, the certificate of the AAA server is not verified");
+	if (conf->cert != NULL && (SSL_CTX_use_certificate_chain_file(radsec->ctx, conf->cert) != 1 ||
+			SSL_CTX_use_PrivateKey_file(radsec->ctx, conf->key ? conf->key : conf->cert, SSL_FILETYPE_PEM) != 1)) {
+		pana_error("radsec: %s could not be loaded", conf->cert);
+		goto fail;
+	}
+
+	if (pipe(radsec->doorbell) < 0)
+		goto fail;
+	for (i = 0; i < 2; i++) {
+		fcntl(radsec->doorbell[i], F_SETFL, fcntl(radsec->doorbell[i], F_GETFL) | O_NONBLOCK);
+		fcntl(radsec->doorbell[i], F_SETFD, FD_CLOEXEC);
+	}
+	// A connection lost while it is written must not kill the controller.
+	signal(SIGPIPE, SIG_IGN);
+
+	radsec->conns = (struct radsec_conn *) calloc((size_t) conf->connections, sizeof(*radsec->conns));
+	if (radsec->conns == NULL)
+		goto fail;
+	radsec->nconns = conf->connections;
+	for (i = 0; i < radsec->nconns; i++) {
+		radsec->conns[i].fd = -1;
+		radsec->conns[i].backoff = RADSEC_BACKOFF_MIN;
+		radsec->conns[i].deadline = 0;
+	}
+	return 0;
+
+fail:
+	ERR_clear_error();
+	radsec_deinit();
+	return -1;
+}
+
+void radsec_deinit() {
+	struct radsec_conn *c;
+	int i, id;
+
+	if (radsec == NULL)
+		return;
+	for (i = 0; i < radsec->nconns; i++) {
+		c = &radsec->conns[i];
+		if (c->ssl != NULL)
+			SSL_free(c->ssl);
+		if (c->fd >= 0)
+			close(c->fd);
+		if (c->session != NULL)
+			SSL_SESSION_free(c->session);
+		for (id = 0; id < 256; id++)
+			free(c->pending[id]);
+		free(c->out);
+		free(c->wbuf);
+	}
+	free(radsec->conns);
+	for (i = 0; i < 2; i++)
+		if (radsec->doorbell[i] >= 0)
+			close(radsec->doorbell[i]);
+	if (radsec->ctx != NULL)
+		SSL_CTX_free(radsec->ctx);
+	free(radsec->host);
+	pthread_mutex_destroy(&radsec->lock);
+	free(radsec);
+	radsec = NULL;
+}
+
+int radsec_enabled() {
+	return radsec != NULL;
+}
+
+int radsec_fd_set(fd_set *rset, fd_set *wset) {
+	struct radsec_conn *c;
+	int i, maxfd = radsec->doorbell[0];
+
+	FD_SET(radsec->doorbell[0], rset);
+	for (i = 0; i < radsec->nconns; i++) {
+		c = &radsec->conns[i];
+		if (c->state == RADSEC_CLOSED)
+			continue;
+		if (c->state != RADSEC_CONNECTING)
+			FD_SET(c->fd, rset);
+		if (c->state == RADSEC_CONNECTING || c->want_write)
+			FD_SET(c->fd, wset);
+		if (c->fd > maxfd)
+			maxfd = c->fd;
+	}
+	return maxfd;
+}
+
+int radsec_timeout(struct timespec *ts) {
+	struct radsec_conn *c;
+	double next = -1, at, now = getTime();
+	int i;
+
+	for (i = 0; i < radsec->nconns; i++) {
+		c = &radsec->conns[i];
+		if (c->state != RADSEC_UP)
+			at = c->deadline;
+		else if (c->in_flight > 0)
+			at = c->last_answer + RADSEC_ANSWER_TIMEOUT;
+		else
+			continue;
+		if (next < 0 || at < next)
+			next = at;
+	}
+	if (next < 0)
+		return 0;
+	next = next > now ? next - now : 0;
+	ts->tv_sec = (time_t) next;
+	ts->tv_nsec = (long) ((next - (double) ts->tv_sec) * 1e9);
+	return 1;
+}
+
+void radsec_process(fd_set *rset, fd_set *wset, radsec_deliver_cb deliver) {
+	struct radsec_conn *c;
+	double now = getTime();
+	char drain[64];
+	int i, err;
+	socklen_t err_len;
+
+	if (FD_ISSET(radsec->doorbell[0], rset)) {
+		pthread_mutex_lock(&radsec->lock);
+		while (read(radsec->doorbell[0], drain, sizeof(drain)) > 0)
+			;
+		radsec->rung = 0;
+		pthread_mutex_unlock(&radsec->lock);
+	}
+
+	for (i = 0; i < radsec->nconns; i++) {
+		c = &radsec->conns[i];
+		switch (c->state) {
+		case RADSEC_CLOSED:
+			if (now >= c->deadline)
+				conn_open(c, now);
+			break;
+		case RADSEC_CONNECTING:
+			if (FD_ISSET(c->fd, wset)) {
+				err = 0;
+				err_len = sizeof(err);
+				if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0)
+					conn_close(c, now, strerror(err ? err : errno));
+				else
+					conn_start_tls(c, now);
+			} else if (now >= c->deadline)
+				conn_close(c, now, "timeout");
+			break;
+		case RADSEC_HANDSHAKE:
+			if (FD_ISSET(c->fd, rset) || FD_ISSET(c->fd, wset))
+				conn_handshake(c, now);
+			else if (now >= c->deadline)
+				conn_close(c, now, "TLS handshake timeout");
+			break;
+		case RADSEC_UP:
+			if (FD_ISSET(c->fd, rset))
+				conn_read(c, now, deliver);
+			if (c->state == RADSEC_UP && c->in_flight > 0 &&
+					now >= c->last_answer + RADSEC_ANSWER_TIMEOUT)
+				conn_close(c, now, "no answers");
+			break;
+		}
+		// Also the requests of the connection just established.
+		if (c->state == RADSEC_UP)
+			conn_write(c, now);
+	}
+}
+
+void radsec_get_stats(struct radsec_stats *stats) {
+	pthread_mutex_lock(&radsec->lock);
+	*stats = radsec->stats;
+	pthread_mutex_unlock(&radsec->lock);
+}
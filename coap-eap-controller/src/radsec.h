@@ -0,0 +1,149 @@
+/**
+ * @file radsec.h
+ * @brief Headers of the RADIUS over TLS (RadSec, RFC 6614) transport to the AAA server.
+ *
+ * The Access-Requests of the RADIUS client (radius_client.c) are sent over
+ * a pool of persistent TLS/TCP connections instead of the UDP socket, set
+ * as its transport with radius_client_set_transport() and radsec_send():
+ *
+ *  - The connections stay open, and many requests are in flight on each
+ *    of them at the same time (pipelining): a new request goes to the
+ *    connection with the fewest ones.
+ *  - The requests queued while a connection is written are sent together,
+ *    in as few TLS records and writes as they fit in.
+ *  - A request is kept until its answer arrives: if its connection is
+ *    lost, it is sent again over another one, or over the same one once
+ *    it is opened again. TCP does the retransmissions, so a lost segment
+ *    costs a TCP retransmission timeout and not a CoAP one.
+ *  - A connection lost is opened again with an exponential backoff, and
+ *    resumes its last TLS session.
+ *
+ * The requests can be sent from any thread, but the connections are only
+ * handled by the network thread, which waits for radsec_fd_set() and
+ * radsec_timeout() and then calls radsec_process() with the answers'
+ * callback. Every message is signed with RADSEC_SECRET.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef RADSEC_H
+#define RADSEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/select.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Shared secret of the RADIUS messages over TLS (RFC 6614, 2.3).*/
+#define RADSEC_SECRET "radsec"
+#define RADSEC_DEFAULT_PORT 2083
+/** Max number of connections of the pool.*/
+#define RADSEC_MAX_CONNECTIONS 64
+/** Bytes queued on a connection before the new requests are refused.*/
+#define RADSEC_DEFAULT_QUEUE_LIMIT (1024 * 1024)
+
+/** Configuration of the transport.*/
+struct radsec_conf {
+	/**Name or IP address of the AAA server.*/
+	const char *host;
+	int port;
+	/**Connections of the pool, 1..RADSEC_MAX_CONNECTIONS.*/
+	int connections;
+	/**CA of the server's certificate, NULL to not verify it.*/
+	const char *ca;
+	/**Certificate and key of the controller, NULL if the server does not ask for them.*/
+	const char *cert;
+	const char *key;
+	/**0 for RADSEC_DEFAULT_QUEUE_LIMIT.*/
+	size_t queue_limit;
+};
+
+/** Counters of the transport.*/
+struct radsec_stats {
+	/**Connections established, and the ones with a resumed TLS session.*/
+	uint64_t connects;
+	uint64_t resumed;
+	/**Connections that could not be established or were lost.*/
+	uint64_t failures;
+	/**Requests queued, and the ones refused because the queue was full.*/
+	uint64_t requests;
+	uint64_t refused;
+	/**Requests sent again after their connection was lost.*/
+	uint64_t resent;
+	/**Answers received.*/
+	uint64_t answers;
+	/**Writes of the TLS connections, every one with as many requests as were queued.*/
+	uint64_t writes;
+	/**Connections established now and requests in flight.*/
+	uint32_t up;
+	uint32_t in_flight;
+};
+
+/** Called by radsec_process() with every answer received.*/
+typedef void (*radsec_deliver_cb)(uint8_t *buf, int len);
+
+/**
+ * Creates the TLS context and starts opening the connections.
+ *
+ * @return 0 on success, -1 if the configuration is not valid.
+ */
+int radsec_init(const struct radsec_conf *conf);
+/** Closes the connections, the requests in flight are dropped.*/
+void radsec_deinit();
+/** @return TRUE if radsec_init has been called.*/
+int radsec_enabled();
+
+/**
+ * Queues a RADIUS message on a connection. It has the signature of the
+ * transport of the RADIUS client, ctx is not used. Thread safe.
+ *
+ * @return len, or -1 if the queue is full.
+ */
+int radsec_send(void *ctx, const uint8_t *data, size_t len);
+
+/**
+ * Adds the descriptors the network thread must wait for.
+ *
+ * @return The highest one.
+ */
+int radsec_fd_set(fd_set *rset, fd_set *wset);
+/**
+ * Time the network thread can wait at most, for the next reconnection
+ * or the expiration of a connection.
+ *
+ * @return 1 if ts is set, 0 if it can wait forever.
+ */
+int radsec_timeout(struct timespec *ts);
+/**
+ * Handles the connections after the wait: writes the requests queued,
+ * reads the answers, which are passed to deliver, and opens again the
+ * connections lost. rset and wset can be empty.
+ */
+void radsec_process(fd_set *rset, fd_set *wset, radsec_deliver_cb deliver);
+
+void radsec_get_stats(struct radsec_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
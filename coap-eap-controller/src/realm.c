@@ -0,0 +1,369 @@
+/**
+ * @file realm.c
+ * @brief Routing of the devices to the AAA servers by realm.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "realm.h"
+#include "panautils.h"
+
+/** Max length of a realm, and of a server of its line.*/
+#define REALM_NAME_LEN 253
+#define REALM_SERVER_LEN 64
+
+/** A label of a realm: the node of the trie under the one of the next label.*/
+struct realm_node {
+	uint32_t parent;
+	/**Offset of the label in the buffer of the table.*/
+	uint32_t label;
+	uint16_t label_len;
+	/**Index of the realm that ends at this label, -1 if none.*/
+	int32_t realm;
+};
+
+struct realm_entry {
+	uint32_t name;
+	uint16_t name_len;
+	uint32_t servers;
+	uint64_t sessions;
+};
+
+/** The realms of a file, compiled.*/
+struct realm_table {
+	/**Content of the file, with the realms in lower case.*/
+	char *buf;
+	size_t size;
+	struct realm_entry *realms;
+	uint32_t count;
+	/**Node 0 is the root, above the last labels.*/
+	struct realm_node *nodes;
+	uint32_t nodes_count;
+	/**index of the node, 0 if the slot is empty (the root is never in it).*/
+	uint32_t *slots;
+	uint32_t slots_mask;
+};
+
+static struct realm_table *table = NULL;
+static uint32_t default_servers = 1;
+static uint64_t default_sessions = 0;
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+static inline uint8_t lower(uint8_t c) {
+	return c >= 'A' && c <= 'Z' ? (uint8_t) (c - 'A' + 'a') : c;
+}
+
+/* The hash of a label (FNV-1a of its bytes from the last one) and of its parent. */
+static inline uint32_t node_hash(uint32_t label_hash, uint32_t parent) {
+	return (label_hash ^ (parent * 0x9e3779b1u)) * FNV_PRIME;
+}
+
+static uint32_t label_hash(const char *label, size_t len) {
+	uint32_t hash = FNV_OFFSET;
+
+	while (len > 0)
+		hash = (hash ^ (uint8_t) label[--len]) * FNV_PRIME;
+	return hash;
+}
+
+/* Slot of the child of parent with the label, or the empty one where it
+ * would be inserted. The label of the identity can be in upper case. */
+static uint32_t find_slot(const struct realm_table *t, uint32_t parent, uint32_t hash,
+		const uint8_t *label, size_t len) {
+	uint32_t i = node_hash(hash, parent) & t->slots_mask;
+	const struct realm_node *n;
+	const char *name;
+	size_t j;
+
+	for (; t->slots[i] != 0; i = (i + 1) & t->slots_mask) {
+		n = &t->nodes[t->slots[i]];
+		if (n->parent != parent || n->label_len != len)
+			continue;
+		name = t->buf + n->label;
+		for (j = 0; j < len && (uint8_t) name[j] == lower(label[j]); j++)
+			;
+		if (j == len)
+			break;
+	}
+	return i;
+}
+
+static int is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void free_table(struct realm_table *t) {
+	if (t == NULL)
+		return;
+	XFREE(t->buf);
+	XFREE(t->realms);
+	XFREE(t->nodes);
+	XFREE(t->slots);
+	XFREE(t);
+}
+
+/* Adds the labels of the realm to the trie, from the last one. */
+static int add_realm(struct realm_table *t, const char *name, size_t len, uint32_t index) {
+	const char *end = name + len, *label;
+	uint32_t node = 0, slot;
+	struct realm_node *n;
+
+	while (end > name) {
+		label = end;
+		while (label > name && label[-1] != '.')
+			label--;
+		if (label == end)
+			return -1;
+		slot = find_slot(t, node, label_hash(label, (size_t) (end - label)),
+				(const uint8_t *) label, (size_t) (end - label));
+		if (t->slots[slot] == 0) {
+			n = &t->nodes[t->nodes_count];
+			n->parent = node;
+			n->label = (uint32_t) (label - t->buf);
+			n->label_len = (uint16_t) (end - label);
+			n->realm = -1;
+			t->slots[slot] = t->nodes_count++;
+		}
+		node = t->slots[slot];
+		end = label > name ? label - 1 : label;
+		if (label > name && end == name)
+			return -1;
+	}
+	// A realm repeated takes the servers of its last line.
+	if (t->nodes[node].realm < 0)
+		t->nodes[node].realm = (int32_t) index;
+	return t->nodes[node].realm;
+}
+
+/* Parses and compiles the lines of t->buf. */
+static int build_table(struct realm_table *t, realm_server_cb server_index, void *arg) {
+	char *p = t->buf, *end = t->buf + t->size, *name, *server;
+	char server_buf[REALM_SERVER_LEN + 1];
+	size_t name_len, server_len, lines = 1, labels = 1, slots = 2, i;
+	uint32_t line = 0, servers;
+	struct realm_entry *e;
+	int index, realm;
+
+	for (; p < end; p++) {
+		lines += *p == '\n';
+		labels += *p == '\n' || *p == '.';
+	}
+	// Load factor of 1/2 at most.
+	while (slots < 2 * labels)
+		slots *= 2;
+	t->realms = XCALLOC(struct realm_entry, lines);
+	t->nodes = XCALLOC(struct realm_node, labels + 1);
+	t->slots = XCALLOC(uint32_t, slots);
+	t->slots_mask = (uint32_t) slots - 1;
+	t->nodes[0].realm = -1;
+	t->nodes_count = 1;
+
+	for (p = t->buf; p < end; p++) {
+		line++;
+		while (p < end && is_space(*p))
+			p++;
+		if (p == end || *p == '\n' || *p == '#')
+			goto next_line;
+
+		name = p;
+		while (p < end && !is_space(*p) && *p != '\n')
+			p++;
+		name_len = (size_t) (p - name);
+		for (i = 0; i < name_len; i++)
+			name[i] = (char) lower((uint8_t) name[i]);
+
+		servers = 0;
+		for (;;) {
+			while (p < end && is_space(*p))
+				p++;
+			if (p == end || *p == '\n' || *p == '#')
+				break;
+			server = p;
+			while (p < end && !is_space(*p) && *p != '\n')
+				p++;
+			server_len = (size_t) (p - server);
+			index = -1;
+			if (server_len <= REALM_SERVER_LEN) {
+				memcpy(server_buf, server, server_len);
+				server_buf[server_len] = '\0';
+				index = server_index(server_buf, arg);
+			}
+			if (index < 0 || index >= REALM_MAX_SERVERS) {
+				pana_error("realm: the server %.*s of line %u is not valid", (int) server_len, server, line);
+				return -1;
+			}
+			servers |= 1u << index;
+		}
+
+		if (name_len == 0 || name_len > REALM_NAME_LEN || servers == 0) {
+			pana_error("realm: line %u is not \"realm server...\"", line);
+			return -1;
+		}
+		realm = add_realm(t, name, name_len, t->count);
+		if (realm < 0) {
+			pana_error("realm: %.*s of line %u is not a realm", (int) name_len, name, line);
+			return -1;
+		}
+		if ((uint32_t) realm == t->count)
+			t->count++;
+		e = &t->realms[realm];
+		e->name = (uint32_t) (name - t->buf);
+		e->name_len = (uint16_t) name_len;
+		e->servers = servers;
+
+next_line:
+		while (p < end && *p != '\n')
+			p++;
+	}
+	return 0;
+}
+
+/* Replaces the table in use if t is right. */
+static int install_table(struct realm_table *t, realm_server_cb server_index, void *arg) {
+	int count;
+
+	if (build_table(t, server_index, arg) < 0) {
+		free_table(t);
+		return -1;
+	}
+	count = (int) t->count;
+
+	free_table(table);
+	table = t;
+	pana_debug("realm: %d realms loaded, %u labels", count, t->nodes_count - 1);
+	return count;
+}
+
+int realm_table_load(const char *path, realm_server_cb server_index, void *arg) {
+	struct realm_table *t;
+	struct stat st;
+	ssize_t n;
+	size_t done = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		pana_error("realm: cannot open %s", path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	// Copied, the realms are written in lower case.
+	t = XCALLOC(struct realm_table, 1);
+	t->size = (size_t) st.st_size;
+	t->buf = XMALLOC(char, t->size + 1);
+	while (done < t->size && (n = read(fd, t->buf + done, t->size - done)) > 0)
+		done += (size_t) n;
+	close(fd);
+	if (done < t->size) {
+		pana_error("realm: cannot read %s", path);
+		free_table(t);
+		return -1;
+	}
+	return install_table(t, server_index, arg);
+}
+
+int realm_table_load_buffer(const char *buf, size_t len, realm_server_cb server_index, void *arg) {
+	struct realm_table *t = XCALLOC(struct realm_table, 1);
+
+	t->buf = XMALLOC(char, len + 1);
+	memcpy(t->buf, buf, len);
+	t->size = len;
+	return install_table(t, server_index, arg);
+}
+
+void realm_set_default(uint32_t servers) {
+	default_servers = servers;
+}
+
+int realm_lookup(const uint8_t *identity, size_t identity_len) {
+	const uint8_t *at, *end, *p;
+	uint32_t node = 0, hash, slot;
+	int best = -1;
+
+	if (table == NULL || table->count == 0)
+		return -1;
+
+	// The realm is after the last '@'.
+	for (at = identity + identity_len; at > identity && at[-1] != '@'; at--)
+		;
+	if (at == identity)
+		return -1;
+
+	for (end = identity + identity_len; end > at; end = p - 1) {
+		hash = FNV_OFFSET;
+		for (p = end; p > at && p[-1] != '.'; p--)
+			hash = (hash ^ lower(p[-1])) * FNV_PRIME;
+		if (p == end)
+			break;
+		slot = find_slot(table, node, hash, p, (size_t) (end - p));
+		node = table->slots[slot];
+		if (node == 0)
+			break;
+		if (table->nodes[node].realm >= 0)
+			best = table->nodes[node].realm;
+		if (p == at)
+			break;
+	}
+	return best;
+}
+
+uint32_t realm_route(const uint8_t *identity, size_t identity_len) {
+	int realm = realm_lookup(identity, identity_len);
+
+	if (realm < 0) {
+		__atomic_fetch_add(&default_sessions, 1, __ATOMIC_RELAXED);
+		return default_servers;
+	}
+	__atomic_fetch_add(&table->realms[realm].sessions, 1, __ATOMIC_RELAXED);
+	return table->realms[realm].servers;
+}
+
+size_t realm_count() {
+	return table != NULL ? table->count : 0;
+}
+
+int realm_get(size_t i, struct realm_info *info) {
+	const struct realm_entry *e;
+
+	if (table == NULL || i >= table->count)
+		return -1;
+	e = &table->realms[i];
+	info->name = table->buf + e->name;
+	info->name_len = e->name_len;
+	info->servers = e->servers;
+	info->sessions = __atomic_load_n(&e->sessions, __ATOMIC_RELAXED);
+	return 0;
+}
+
+uint64_t realm_default_sessions() {
+	return __atomic_load_n(&default_sessions, __ATOMIC_RELAXED);
+}
+
+void realm_table_close() {
+	free_table(table);
+	table = NULL;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file realm.h
+ * @brief Headers of the routing of the devices to the AAA servers by realm.
+ *
+ * In pass-through mode, a new session goes to the AAA servers of the realm
+ * of the device's identity (its NAI, RFC 7542: user@realm), taken from
+ * the EAP-Response/Identity. The table is a text file (REALM_FILE), one
+ * realm per line with its servers, added to the pool of AAA servers:
+ *
+ *   # realm              servers ("ip:port", "[ipv6]:port", AS_PORT if none)
+ *   vendor-a.example     10.0.0.1:1812 10.0.0.2:1812
+ *   vendor-b.example     [2001:db8::1]:1812
+ *
+ * A realm matches itself and its subdomains, the longest one wins, and the
+ * case is ignored: "dev@lab.vendor-a.example" goes to vendor-a.example.
+ * The identities without realm, or with one that is not in the table, go
+ * to the default servers (AS_IP and AS_POOL).
+ *
+ * The table is compiled when it is loaded into a trie of the labels of
+ * the realms, from the last one, whose nodes are found in an open
+ * addressing table by their parent and label. A lookup walks the identity
+ * once from its end, hashing every label as it goes: O(identity length),
+ * without allocations nor locks. The table is loaded once at startup,
+ * before the workers start, and not replaced while the controller runs.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REALM_H
+#define REALM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Servers of the pool a realm can go to, the bits of its mask.*/
+#define REALM_MAX_SERVERS 32
+
+/** A realm of the table and its counters.*/
+struct realm_info {
+	/**Name of the realm, in lower case, not '\0' terminated.*/
+	const char *name;
+	size_t name_len;
+	/**Mask of its servers in the pool, bit i for the server i.*/
+	uint32_t servers;
+	/**Sessions routed to it.*/
+	uint64_t sessions;
+};
+
+/**
+ * Gives the index in the pool of a server of the table, added to the
+ * pool if it is not there yet.
+ *
+ * @param *server "ip:port", "[ipv6]:port" or "ip", '\0' terminated.
+ *
+ * @return The index, below REALM_MAX_SERVERS, or -1 if it is not valid.
+ */
+typedef int (*realm_server_cb)(const char *server, void *arg);
+
+/**
+ * Loads and compiles the table of realms, replacing the one loaded before.
+ *
+ * @return Number of realms loaded, -1 on error (the previous ones are kept).
+ */
+int realm_table_load(const char *path, realm_server_cb server_index, void *arg);
+/** Same as realm_table_load, from a buffer with the content of a file.*/
+int realm_table_load_buffer(const char *buf, size_t len, realm_server_cb server_index, void *arg);
+/** Mask of the servers of the identities without a realm of the table.*/
+void realm_set_default(uint32_t servers);
+
+/**
+ * Finds the realm of an identity.
+ *
+ * @return Its index in the table, or -1 if it has none in the table.
+ */
+int realm_lookup(const uint8_t *identity, size_t identity_len);
+/**
+ * Servers of a new session of an identity, with the counter of its realm.
+ * It has the signature of eap_auth_set_radius_route.
+ *
+ * @return The mask of the servers of its realm, or the default one.
+ */
+uint32_t realm_route(const uint8_t *identity, size_t identity_len);
+
+/** @return Number of realms in the table.*/
+size_t realm_count();
+/** @return 0 if info has been filled with the realm i, -1 if there is none.*/
+int realm_get(size_t i, struct realm_info *info);
+/** @return Sessions routed to the default servers.*/
+uint64_t realm_default_sessions();
+/** Frees the table.*/
+void realm_table_close();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,400 @@
+/**
+ * @file reauth.c
+ * @brief Re-authentication scheduler of the controller.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <netinet/in.h>
+
+#include "reauth.h"
+#include "panautils.h"
+
+/** Initial number of entries of the table.*/
+#define REAUTH_INITIAL 64
+/** Tolerance of the token bucket to the rounding of reauth_next.*/
+#define REAUTH_EPSILON 1e-9
+
+/** An authorized device: 72 bytes.*/
+struct reauth_entry {
+	/**IPv6 address, or IPv4 in the first 4 bytes.*/
+	uint8_t addr[16];
+	uint16_t port;
+	uint8_t family;
+	char location[REAUTH_LOCATION_LEN];
+	/**Position in the heap.*/
+	uint32_t heap;
+	/**Time its re-authentication is started, if the rate allows it.*/
+	double due;
+	double expires;
+};
+
+/*
+ * The entries are kept packed in an array (the last one fills the hole
+ * of the one removed), a binary heap of their indexes sorted by due time
+ * says which one is next and an open addressing table (linear probing)
+ * finds the entry of an address.
+ */
+static struct reauth_entry *entries = NULL;
+static uint32_t *heap = NULL;
+static uint32_t count = 0;
+static uint32_t capacity = 0;
+/** index + 1 of the entry, 0 if the slot is empty.*/
+static uint32_t *slots = NULL;
+static uint32_t slots_mask = 0;
+
+static double lifetime = 0;
+static double jitter = 0;
+static double guard = 0;
+static double rate = 0;
+/** Token bucket of the rate.*/
+static double tokens = 0;
+static double tokens_time = -1;
+
+static pthread_mutex_t reauth_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Table of addresses */
+
+static void entry_key(struct reauth_entry *e, const struct sockaddr_storage *addr) {
+	memset(e->addr, 0, sizeof(e->addr));
+	e->family = (uint8_t) addr->ss_family;
+	if (addr->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) addr;
+		memcpy(e->addr, &in6->sin6_addr, 16);
+		e->port = in6->sin6_port;
+	} else {
+		const struct sockaddr_in *in = (const struct sockaddr_in *) addr;
+		memcpy(e->addr, &in->sin_addr, 4);
+		e->port = in->sin_port;
+	}
+}
+
+static void entry_addr(const struct reauth_entry *e, struct sockaddr_storage *addr) {
+	memset(addr, 0, sizeof(*addr));
+	addr->ss_family = e->family;
+	if (e->family == AF_INET6) {
+		struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) addr;
+		memcpy(&in6->sin6_addr, e->addr, 16);
+		in6->sin6_port = e->port;
+	} else {
+		struct sockaddr_in *in = (struct sockaddr_in *) addr;
+		memcpy(&in->sin_addr, e->addr, 4);
+		in->sin_port = e->port;
+	}
+}
+
+static int same_key(const struct reauth_entry *a, const struct reauth_entry *b) {
+	return a->family == b->family && a->port == b->port &&
+			memcmp(a->addr, b->addr, sizeof(a->addr)) == 0;
+}
+
+/* FNV-1a of the address and port. */
+static uint32_t key_hash(const struct reauth_entry *e) {
+	uint32_t hash = 2166136261u;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		hash = (hash ^ e->addr[i]) * 16777619u;
+	hash = (hash ^ (e->port & 0xff)) * 16777619u;
+	hash = (hash ^ (e->port >> 8)) * 16777619u;
+	return hash ^ e->family;
+}
+
+/* Slot of the key, or the empty one where it would be inserted. */
+static uint32_t find_slot(const struct reauth_entry *key) {
+	uint32_t i = key_hash(key) & slots_mask;
+
+	while (slots[i] != 0 && !same_key(&entries[slots[i] - 1], key))
+		i = (i + 1) & slots_mask;
+	return i;
+}
+
+/* Backward shift, so no tombstones are needed. */
+static void delete_slot(uint32_t i) {
+	uint32_t j = i, home;
+
+	for (;;) {
+		slots[i] = 0;
+		for (;;) {
+			j = (j + 1) & slots_mask;
+			if (slots[j] == 0)
+				return;
+			home = key_hash(&entries[slots[j] - 1]) & slots_mask;
+			// Moved unless its home is cyclically in (i, j].
+			if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+				continue;
+			break;
+		}
+		slots[i] = slots[j];
+		i = j;
+	}
+}
+
+/* Heap of due times */
+
+static void heap_set(uint32_t pos, uint32_t index) {
+	heap[pos] = index;
+	entries[index].heap = pos;
+}
+
+static void sift_up(uint32_t pos) {
+	uint32_t index = heap[pos], parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (entries[heap[parent]].due <= entries[index].due)
+			break;
+		heap_set(pos, heap[parent]);
+		pos = parent;
+	}
+	heap_set(pos, index);
+}
+
+static void sift_down(uint32_t pos) {
+	uint32_t index = heap[pos], child;
+
+	for (;;) {
+		child = 2 * pos + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count && entries[heap[child + 1]].due < entries[heap[child]].due)
+			child++;
+		if (entries[index].due <= entries[heap[child]].due)
+			break;
+		heap_set(pos, heap[child]);
+		pos = child;
+	}
+	heap_set(pos, index);
+}
+
+/* Removes entry index, the last one takes its place. */
+static void remove_entry(uint32_t index) {
+	uint32_t pos = entries[index].heap;
+	uint32_t last = count - 1;
+	uint32_t moved = heap[last];
+
+	delete_slot(find_slot(&entries[index]));
+
+	// Out of the heap.
+	heap_set(pos, moved);
+	count--;
+	if (pos < count) {
+		sift_up(pos);
+		sift_down(entries[moved].heap);
+	}
+
+	// Packed.
+	if (index != last) {
+		entries[index] = entries[last];
+		heap[entries[index].heap] = index;
+		slots[find_slot(&entries[index])] = index + 1;
+	}
+}
+
+static void grow() {
+	uint32_t i;
+
+	capacity = capacity == 0 ? REAUTH_INITIAL : capacity * 2;
+	entries = XREALLOC(struct reauth_entry, entries, capacity);
+	heap = XREALLOC(uint32_t, heap, capacity);
+
+	// Load factor of 1/2 at most.
+	XFREE(slots);
+	slots_mask = 2 * capacity - 1;
+	slots = XCALLOC(uint32_t, 2 * capacity);
+	for (i = 0; i < count; i++)
+		slots[find_slot(&entries[i])] = i + 1;
+}
+
+/* Number in [0, 1) taken from the seed (splitmix64). */
+static double seed_uniform(uint32_t seed) {
+	uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+	return (double) (z >> 11) / 9007199254740992.0;
+}
+
+/* Tokens of the bucket at time t, a second of the rate at most. */
+static double tokens_at(double t) {
+	double burst = rate > 1 ? rate : 1;
+	double n = tokens;
+
+	if (tokens_time < 0)
+		return burst;
+	if (t > tokens_time)
+		n += (t - tokens_time) * rate;
+	return n > burst ? burst : n;
+}
+
+static void refill(double now) {
+	tokens = tokens_at(now);
+	if (now > tokens_time)
+		tokens_time = now;
+}
+
+/* API */
+
+void reauth_init(double l, double j, double r) {
+	pthread_mutex_lock(&reauth_mutex);
+	lifetime = l > 0 ? l : 0;
+	guard = lifetime / 4 < REAUTH_GUARD ? lifetime / 4 : REAUTH_GUARD;
+	// A device is never re-authenticated before half its lifetime.
+	jitter = j < 0 ? 0 : j > lifetime / 2 - 2 * guard ? lifetime / 2 - 2 * guard : j;
+	rate = r > 0 ? r : 0;
+	tokens_time = -1;
+	pthread_mutex_unlock(&reauth_mutex);
+
+	if (lifetime > 0)
+		pana_debug("reauth: lifetime %.0f s, jitter %.0f s, rate %.1f/s", lifetime, jitter, rate);
+}
+
+int reauth_enabled() {
+	return lifetime > 0;
+}
+
+double reauth_min_delay() {
+	return lifetime > 0 ? lifetime - 2 * guard - jitter : 0;
+}
+
+int reauth_add(const struct sockaddr_storage *addr, const char *location,
+		uint32_t seed, double now) {
+	struct reauth_entry key, *e;
+	size_t len = strlen(location);
+	uint32_t slot, index;
+
+	if (len >= REAUTH_LOCATION_LEN)
+		return -1;
+
+	entry_key(&key, addr);
+
+	pthread_mutex_lock(&reauth_mutex);
+	if (count == capacity)
+		grow();
+
+	slot = find_slot(&key);
+	if (slots[slot] != 0) {
+		index = slots[slot] - 1;
+	} else {
+		index = count++;
+		entries[index] = key;
+		slots[slot] = index + 1;
+		heap_set(count - 1, index);
+	}
+
+	e = &entries[index];
+	memcpy(e->location, location, len + 1);
+	e->expires = now + lifetime;
+	e->due = e->expires - 2 * guard - seed_uniform(seed) * jitter;
+	if (e->due < now)
+		e->due = now;
+	sift_up(e->heap);
+	sift_down(e->heap);
+	pthread_mutex_unlock(&reauth_mutex);
+	return 0;
+}
+
+void reauth_remove(const struct sockaddr_storage *addr) {
+	struct reauth_entry key;
+	uint32_t slot;
+
+	entry_key(&key, addr);
+
+	pthread_mutex_lock(&reauth_mutex);
+	if (count > 0) {
+		slot = find_slot(&key);
+		if (slots[slot] != 0)
+			remove_entry(slots[slot] - 1);
+	}
+	pthread_mutex_unlock(&reauth_mutex);
+}
+
+int reauth_pop(double now, struct reauth_device *dev) {
+	struct reauth_entry *e;
+	int urgent;
+
+	pthread_mutex_lock(&reauth_mutex);
+	if (count == 0 || entries[heap[0]].due > now) {
+		pthread_mutex_unlock(&reauth_mutex);
+		return 0;
+	}
+
+	e = &entries[heap[0]];
+	// The heap is sorted by due time, and so by the time they get urgent:
+	// if the first one has to wait for the rate, all of them wait.
+	urgent = now >= e->due + guard;
+	if (rate > 0) {
+		refill(now);
+		if (tokens < 1 - REAUTH_EPSILON && !urgent) {
+			pthread_mutex_unlock(&reauth_mutex);
+			return 0;
+		}
+		tokens -= 1;
+	}
+
+	entry_addr(e, &dev->addr);
+	memcpy(dev->location, e->location, sizeof(dev->location));
+	dev->expires = e->expires;
+	dev->urgent = urgent;
+	remove_entry(heap[0]);
+	pthread_mutex_unlock(&reauth_mutex);
+	return 1;
+}
+
+double reauth_next(double now) {
+	double next, t, missing;
+
+	pthread_mutex_lock(&reauth_mutex);
+	if (count == 0) {
+		pthread_mutex_unlock(&reauth_mutex);
+		return -1;
+	}
+
+	next = entries[heap[0]].due;
+	if (rate > 0) {
+		t = next > now ? next : now;
+		missing = 1 - tokens_at(t);
+		if (missing > 0) {
+			t += missing / rate;
+			next = t < entries[heap[0]].due + guard ? t : entries[heap[0]].due + guard;
+		}
+	}
+	pthread_mutex_unlock(&reauth_mutex);
+	return next;
+}
+
+size_t reauth_count() {
+	size_t n;
+
+	pthread_mutex_lock(&reauth_mutex);
+	n = count;
+	pthread_mutex_unlock(&reauth_mutex);
+	return n;
+}
+
+void reauth_deinit() {
+	pthread_mutex_lock(&reauth_mutex);
+	XFREE(entries);
+	XFREE(heap);
+	XFREE(slots);
+	count = capacity = slots_mask = 0;
+	lifetime = 0;
+	pthread_mutex_unlock(&reauth_mutex);
+}
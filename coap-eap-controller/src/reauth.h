@@ -0,0 +1,120 @@
+/**
+ * @file reauth.h
+ * @brief Headers of the re-authentication scheduler of the controller.
+ *
+ * Every device that finishes a bootstrap is authorized for the lifetime
+ * of its session. The scheduler keeps the authorized devices in a
+ * compact table and starts their re-authentication before the lifetime
+ * expires, so they never lose their keys.
+ *
+ * A fleet that bootstraps at once (e.g. after a power outage) would
+ * otherwise expire at once too and hit the AAA server with all its
+ * re-authentications in the same second. Two things spread them:
+ *
+ * - jitter: each device is due at a random time of the jitter seconds
+ *   before its deadline (never before half the lifetime). The random
+ *   number is taken from the session id, not from rand(), so the
+ *   controller's sequence of session ids is not changed.
+ * - rate: at most rate re-authentications are started per second (token
+ *   bucket), the rest wait. A device that has waited REAUTH_GUARD seconds
+ *   is started anyway and is urgent: it is put before the other tasks of
+ *   the workers.
+ *
+ * The deadline of a device leaves REAUTH_GUARD seconds before the
+ * expiry to finish the exchange, and REAUTH_GUARD more to wait for the
+ * rate (both are reduced to a fourth of the lifetime for short ones).
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REAUTH_H
+#define REAUTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Seconds kept before the expiry to re-authenticate a device.*/
+#define REAUTH_GUARD 60
+/** Max length of the location of a device, '\0' included.*/
+#define REAUTH_LOCATION_LEN 32
+
+/** A device whose re-authentication has to be started.*/
+struct reauth_device {
+	struct sockaddr_storage addr;
+	/**Location where the POSTs of the device are sent.*/
+	char location[REAUTH_LOCATION_LEN];
+	/**Time its current session expires.*/
+	double expires;
+	/**TRUE if it has waited for the rate too long.*/
+	int urgent;
+};
+
+/**
+ * Enables the scheduler.
+ *
+ * @param lifetime Lifetime of the sessions in seconds, 0 disables it.
+ * @param jitter Seconds over which the re-authentications are spread.
+ * @param rate Max re-authentications started per second, 0 for no limit.
+ */
+void reauth_init(double lifetime, double jitter, double rate);
+/** @return TRUE if the scheduler is enabled.*/
+int reauth_enabled();
+/**
+ * Tracks a device which has just been authorized, replacing its previous
+ * entry if there was one.
+ *
+ * @param *addr Address of the device.
+ * @param *location Location of its POSTs.
+ * @param seed Spreads the device in the jitter, e.g. its session id.
+ * @param now Current time.
+ *
+ * @return 0 on success, -1 if the location does not fit.
+ */
+int reauth_add(const struct sockaddr_storage *addr, const char *location,
+		uint32_t seed, double now);
+/** Stops tracking a device.*/
+void reauth_remove(const struct sockaddr_storage *addr);
+/**
+ * Takes the next device whose re-authentication must be started at now,
+ * if any. It is not tracked anymore, until reauth_add is called again.
+ *
+ * @return 1 if *dev has been filled, 0 if no device is due.
+ */
+int reauth_pop(double now, struct reauth_device *dev);
+/** @return Time reauth_pop will return the next device, -1 if there is none.*/
+double reauth_next(double now);
+/**
+ * @return Seconds after reauth_add before which the device is never due,
+ * lifetime - 2 guard - jitter, 0 if the scheduler is disabled.
+ */
+double reauth_min_delay();
+/** @return Number of devices tracked.*/
+size_t reauth_count();
+/** Frees the table and disables the scheduler.*/
+void reauth_deinit();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
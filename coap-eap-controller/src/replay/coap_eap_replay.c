@@ -0,0 +1,1269 @@
+/**
+ * @file coap_eap_replay.c
+ * @brief Replays a capture of CoAP-EAP and RADIUS traffic against a controller.
+ *
+ * The capture (taken with tcpdump, with the CAPTURE_FILE of config.xml or
+ * with "coap_eap_sim -w") is split in flows, one per bootstrapping of a
+ * device: the request that starts it, the POSTs of the controller and the
+ * ACKs of the device. Then the tool plays both ends of the controller:
+ *
+ *  - The devices: every flow sends its request from its own UDP socket at
+ *    the time it was captured, and answers every POST of the controller
+ *    with the ACK captured, after the same think time. The message ID and
+ *    the token of the ACK are those of the POST received, and the EAP
+ *    identifier is that of the EAP request carried in it.
+ *  - The AAA server: the Access-Requests of the controller are answered
+ *    with the answer captured for the same EAP response, with the RADIUS
+ *    identifier and the authenticators of the request received. The MPPE
+ *    keys are encrypted again, so the controller derives the same MSK.
+ *
+ * Time can be scaled (-s 10 replays ten times faster, -s 0 as fast as
+ * possible), and -j limits the flows in progress. The latency of every
+ * flow (from its first request to the POST that carries the EAP success)
+ * is written in the results file (-o), and a summary is printed as JSON in
+ * stdout. Two results files, e.g. of two builds of the controller replaying
+ * the same capture, are compared with -d.
+ *
+ *   coap_eap_replay -r capture.pcap [-c addr] [-C port] [-a addr] [-A port]
+ *                   [-S secret] [-s scale] [-j flows] [-t s] [-o results]
+ *   coap_eap_replay -d base_results new_results
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "includes.h"
+#include "common.h"
+#include "radius/radius.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "uthash.h"
+#include "../pcapfile.h"
+
+#define COAP_TYPE_CON 0
+#define COAP_TYPE_NON 1
+#define COAP_TYPE_ACK 2
+#define COAP_CODE_POST 2
+#define COAP_OPTION_OSCORE 9
+#define COAP_PAYLOAD_MARKER 0xff
+
+/** Retransmission of the first request, as the devices (RFC 7252).*/
+#define ACK_TIMEOUT 2.0
+#define MAX_RETRANSMIT 4
+
+#define MAX_DATAGRAM 1500
+#define FLOW_NAME_LEN 80
+
+enum flow_state {
+	FLOW_WAITING = 0,   /**< Not started yet.*/
+	FLOW_RUNNING,
+	FLOW_OK,
+	FLOW_TIMEOUT,
+	FLOW_DIVERGED       /**< The controller sent more POSTs than captured.*/
+};
+
+static const char *flow_state_names[] = {
+	"waiting", "running", "ok", "timeout", "diverged"
+};
+
+/** A CoAP message captured.*/
+struct message {
+	uint8_t *data;
+	size_t len;
+	/** For the ACKs, time since the POST they answer was captured.*/
+	double think;
+};
+
+struct flow {
+	char name[FLOW_NAME_LEN];
+	struct sockaddr_storage addr;     /**< Address of the device captured.*/
+	double start;                     /**< Time of the first request captured.*/
+	double recorded_latency;          /**< Negative if it did not finish.*/
+	struct message trigger;
+	struct message *acks;
+	size_t nacks;
+
+	/* While the capture is read */
+	double last_post;
+	int last_post_mid;
+	int last_ack_mid;
+	int finished;
+	/** Bootstraps of the device captured, this one included.*/
+	size_t bootstraps;
+
+	/* While it is replayed */
+	uint8_t state;
+	int fd;
+	double sent;
+	double end;
+	uint32_t posts;
+	size_t next_ack;
+	uint8_t token[8];
+	uint8_t token_len;
+	int bound;
+	/** POST being answered after the think time, -1 if none.*/
+	int pending_mid;
+	uint8_t *pending;
+	size_t pending_len;
+	uint8_t *last_ack;
+	size_t last_ack_len;
+	int last_mid;
+
+	UT_hash_handle hh;
+};
+
+/** An answer of the AAA server captured.*/
+struct aaa_answer {
+	uint8_t *request;
+	size_t request_len;
+	uint8_t *answer;
+	size_t answer_len;
+	double delay;
+	/** The answer built for the request received, to be sent again.*/
+	uint8_t *live;
+	size_t live_len;
+	uint8_t live_authenticator[16];
+	struct aaa_answer *next;
+};
+
+/** Answers of the requests with the same EAP response.*/
+struct aaa_key {
+	uint8_t *eap;
+	size_t eap_len;
+	struct aaa_answer *answers;
+	struct aaa_answer *last;
+	UT_hash_handle hh;
+};
+
+/** A request captured that has not been answered yet.*/
+struct aaa_request {
+	uint8_t *data;
+	size_t len;
+	double time;
+};
+
+enum event_kind {
+	EV_START = 0,
+	EV_RETRANSMIT,
+	EV_ACK,
+	EV_TIMEOUT,
+	EV_AAA
+};
+
+struct event {
+	double at;
+	uint64_t seq;
+	int kind;
+	uint32_t arg;
+	void *ptr;
+};
+
+/** A RADIUS answer waiting to be sent.*/
+struct aaa_send {
+	uint8_t *data;
+	size_t len;
+	struct sockaddr_storage to;
+};
+
+static struct {
+	const char *pcap;
+	const char *ctrl_addr;
+	uint16_t ctrl_port;
+	const char *aaa_addr;
+	uint16_t aaa_port;
+	const char *secret;
+	double scale;
+	uint32_t max_flows;
+	double timeout;
+	const char *results;
+} opt;
+
+static struct flow *flows_by_addr = NULL;
+static struct flow **flows = NULL;
+static size_t nflows = 0;
+static size_t flows_size = 0;
+static struct aaa_key *aaa_keys = NULL;
+static struct aaa_request aaa_requests[256];
+
+static struct sockaddr_storage ctrl;
+static socklen_t ctrl_len;
+static int aaa_fd = -1;
+static int epfd = -1;
+
+static struct event *events = NULL;
+static size_t nevents = 0;
+static size_t events_size = 0;
+static uint64_t event_seq = 0;
+
+static struct flow **waiting = NULL;
+static size_t waiting_head = 0;
+static size_t waiting_tail = 0;
+static uint32_t running = 0;
+static size_t ended = 0;
+
+static struct {
+	uint64_t skipped;          /**< Flows of the capture without first request.*/
+	uint64_t posts;
+	uint64_t duplicates;
+	uint64_t ignored;
+	uint64_t aaa_requests;
+	uint64_t aaa_retransmits;
+	uint64_t aaa_unmatched;
+} stats;
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: coap_eap_replay -r capture.pcap [-c addr] [-C port] [-a addr] [-A port]\n"
+			"\t[-S secret] [-s scale] [-j flows] [-t s] [-o results]\n"
+			"       coap_eap_replay -d base_results new_results\n");
+	exit(1);
+}
+
+static void *xmemdup(const void *p, size_t len) {
+	void *copy = malloc(len > 0 ? len : 1);
+
+	if (copy == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memcpy(copy, p, len);
+	return copy;
+}
+
+/*
+ * Events, in a binary heap ordered by time (and by order of insertion).
+ */
+
+static int event_before(const struct event *a, const struct event *b) {
+	return a->at < b->at || (a->at == b->at && a->seq < b->seq);
+}
+
+static void schedule(double at, int kind, void *ptr, uint32_t arg) {
+	struct event ev;
+	size_t i;
+
+	if (nevents == events_size) {
+		events_size = events_size ? events_size * 2 : 1024;
+		events = realloc(events, events_size * sizeof(*events));
+		if (events == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	ev.at = at;
+	ev.seq = event_seq++;
+	ev.kind = kind;
+	ev.ptr = ptr;
+	ev.arg = arg;
+
+	i = nevents++;
+	while (i > 0 && event_before(&ev, &events[(i - 1) / 2])) {
+		events[i] = events[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	events[i] = ev;
+}
+
+static struct event pop_event() {
+	struct event top = events[0];
+	struct event last = events[--nevents];
+	size_t i = 0, child;
+
+	while ((child = 2 * i + 1) < nevents) {
+		if (child + 1 < nevents && event_before(&events[child + 1], &events[child]))
+			child++;
+		if (!event_before(&events[child], &last))
+			break;
+		events[i] = events[child];
+		i = child;
+	}
+	if (nevents > 0)
+		events[i] = last;
+	return top;
+}
+
+/*
+ * CoAP messages. Only the fields the replay needs are parsed.
+ */
+
+struct coap_view {
+	uint8_t type;
+	uint8_t code;
+	uint16_t mid;
+	uint8_t token_len;
+	const uint8_t *token;
+	size_t options;           /**< Offset of the options.*/
+	const uint8_t *payload;   /**< NULL if there is no payload.*/
+	size_t payload_len;
+	int oscore;
+};
+
+static int coap_parse(const uint8_t *buf, size_t len, struct coap_view *view) {
+	size_t pos;
+	unsigned number = 0;
+
+	memset(view, 0, sizeof(*view));
+	if (len < 4 || (buf[0] >> 6) != 1 || (buf[0] & 0x0f) > 8)
+		return -1;
+
+	view->type = (buf[0] >> 4) & 0x03;
+	view->code = buf[1];
+	view->mid = (uint16_t) ((buf[2] << 8) | buf[3]);
+	view->token_len = buf[0] & 0x0f;
+	view->token = buf + 4;
+	pos = 4 + view->token_len;
+	if (pos > len)
+		return -1;
+	view->options = pos;
+
+	while (pos < len && buf[pos] != COAP_PAYLOAD_MARKER) {
+		unsigned delta = buf[pos] >> 4, olen = buf[pos] & 0x0f;
+
+		pos++;
+		if (delta == 13) {
+			if (pos >= len)
+				return -1;
+			delta = 13 + buf[pos++];
+		}
+		else if (delta == 14) {
+			if (pos + 1 >= len)
+				return -1;
+			delta = 269 + ((buf[pos] << 8) | buf[pos + 1]);
+			pos += 2;
+		}
+		else if (delta == 15)
+			return -1;
+		if (olen == 13) {
+			if (pos >= len)
+				return -1;
+			olen = 13 + buf[pos++];
+		}
+		else if (olen == 14) {
+			if (pos + 1 >= len)
+				return -1;
+			olen = 269 + ((buf[pos] << 8) | buf[pos + 1]);
+			pos += 2;
+		}
+		else if (olen == 15)
+			return -1;
+
+		number += delta;
+		if (number == COAP_OPTION_OSCORE)
+			view->oscore = 1;
+		pos += olen;
+		if (pos > len)
+			return -1;
+	}
+	if (pos + 1 < len) {
+		view->payload = buf + pos + 1;
+		view->payload_len = len - pos - 1;
+	}
+	return 0;
+}
+
+/*
+ * The capture.
+ */
+
+static struct flow *flow_new(const struct sockaddr_storage *addr, double time,
+		const uint8_t *buf, size_t len) {
+	struct flow *flow = calloc(1, sizeof(*flow));
+	char name[INET6_ADDRSTRLEN + 8];
+	struct flow *prev = NULL;
+
+	if (flow == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	// A device that bootstraps again is another flow
+	HASH_FIND(hh, flows_by_addr, addr, sizeof(*addr), prev);
+	flow->bootstraps = 1;
+	if (prev != NULL) {
+		HASH_DEL(flows_by_addr, prev);
+		flow->bootstraps = prev->bootstraps + 1;
+	}
+	pcap_addr_str(addr, name, sizeof(name));
+	if (flow->bootstraps > 1)
+		snprintf(flow->name, sizeof(flow->name), "%s#%zu", name, flow->bootstraps);
+	else
+		snprintf(flow->name, sizeof(flow->name), "%s", name);
+
+	flow->addr = *addr;
+	flow->start = time;
+	flow->recorded_latency = -1;
+	flow->trigger.data = xmemdup(buf, len);
+	flow->trigger.len = len;
+	flow->last_post_mid = -1;
+	flow->last_ack_mid = -1;
+	flow->fd = -1;
+	HASH_ADD(hh, flows_by_addr, addr, sizeof(flow->addr), flow);
+
+	if (nflows == flows_size) {
+		flows_size = flows_size ? flows_size * 2 : 1024;
+		flows = realloc(flows, flows_size * sizeof(*flows));
+		if (flows == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	flows[nflows++] = flow;
+	return flow;
+}
+
+static void read_coap(const struct pcap_udp *udp) {
+	struct coap_view view;
+	struct flow *flow = NULL;
+
+	if (coap_parse(udp->data, udp->len, &view) < 0 ||
+			(view.code != COAP_CODE_POST && view.type != COAP_TYPE_ACK))
+		return;
+
+	if (view.type == COAP_TYPE_NON) {
+		// The request that starts the bootstrapping, or its retransmission
+		HASH_FIND(hh, flows_by_addr, &udp->src, sizeof(udp->src), flow);
+		if (flow == NULL || flow->finished || flow->nacks > 0)
+			flow_new(&udp->src, udp->time, udp->data, udp->len);
+	}
+	else if (view.type == COAP_TYPE_CON) {
+		HASH_FIND(hh, flows_by_addr, &udp->dst, sizeof(udp->dst), flow);
+		if (flow == NULL || flow->finished)
+			return;
+		if (view.mid != flow->last_post_mid || view.oscore) {
+			flow->last_post = udp->time;
+			flow->last_post_mid = view.mid;
+		}
+		if (view.oscore && flow->recorded_latency < 0)
+			flow->recorded_latency = udp->time - flow->start;
+	}
+	else {
+		HASH_FIND(hh, flows_by_addr, &udp->src, sizeof(udp->src), flow);
+		if (flow == NULL || flow->finished || view.mid == flow->last_ack_mid ||
+				view.mid != flow->last_post_mid)
+			return;
+		flow->acks = realloc(flow->acks, (flow->nacks + 1) * sizeof(*flow->acks));
+		flow->acks[flow->nacks].data = xmemdup(udp->data, udp->len);
+		flow->acks[flow->nacks].len = udp->len;
+		flow->acks[flow->nacks].think = udp->time - flow->last_post;
+		flow->nacks++;
+		flow->last_ack_mid = view.mid;
+		// The ACK of the EAP success
+		if (flow->recorded_latency >= 0)
+			flow->finished = 1;
+	}
+}
+
+/* @return The EAP-Message attributes of a RADIUS message, concatenated. */
+static size_t radius_eap(const uint8_t *buf, size_t len, uint8_t *eap, size_t eap_size) {
+	size_t pos = 20, eap_len = 0;
+
+	while (pos + 2 <= len && buf[pos + 1] >= 2 && pos + buf[pos + 1] <= len) {
+		if (buf[pos] == RADIUS_ATTR_EAP_MESSAGE && eap_len + buf[pos + 1] - 2 <= eap_size) {
+			memcpy(eap + eap_len, buf + pos + 2, buf[pos + 1] - 2);
+			eap_len += buf[pos + 1] - 2;
+		}
+		pos += buf[pos + 1];
+	}
+	// The EAP identifier is chosen by the AAA server of every run
+	if (eap_len >= 2)
+		eap[1] = 0;
+	return eap_len;
+}
+
+static struct aaa_key *find_aaa_key(const uint8_t *eap, size_t eap_len) {
+	struct aaa_key *key;
+
+	HASH_FIND(hh, aaa_keys, eap, eap_len, key);
+	return key;
+}
+
+static void read_radius(const struct pcap_udp *udp) {
+	struct aaa_request *req;
+	struct aaa_answer *answer;
+	struct aaa_key *key;
+	uint8_t eap[4096];
+	size_t eap_len;
+
+	if (udp->len < 20)
+		return;
+	req = &aaa_requests[udp->data[1]];
+
+	if (udp->data[0] == RADIUS_CODE_ACCESS_REQUEST) {
+		free(req->data);
+		req->data = xmemdup(udp->data, udp->len);
+		req->len = udp->len;
+		req->time = udp->time;
+		return;
+	}
+	if (udp->data[0] != RADIUS_CODE_ACCESS_ACCEPT && udp->data[0] != RADIUS_CODE_ACCESS_REJECT &&
+			udp->data[0] != RADIUS_CODE_ACCESS_CHALLENGE)
+		return;
+	// Retransmitted answers are ignored too
+	if (req->data == NULL)
+		return;
+
+	answer = calloc(1, sizeof(*answer));
+	answer->request = req->data;
+	answer->request_len = req->len;
+	answer->answer = xmemdup(udp->data, udp->len);
+	answer->answer_len = udp->len;
+	answer->delay = udp->time - req->time;
+	req->data = NULL;
+
+	eap_len = radius_eap(answer->request, answer->request_len, eap, sizeof(eap));
+	key = find_aaa_key(eap, eap_len);
+	if (key == NULL) {
+		key = calloc(1, sizeof(*key));
+		key->eap = xmemdup(eap, eap_len);
+		key->eap_len = eap_len;
+		HASH_ADD_KEYPTR(hh, aaa_keys, key->eap, key->eap_len, key);
+	}
+	if (key->last != NULL)
+		key->last->next = answer;
+	else
+		key->answers = answer;
+	key->last = answer;
+}
+
+static int read_capture(const char *path) {
+	struct pcap_file *file = pcap_file_open(path);
+	struct pcap_udp udp;
+	int ret;
+
+	if (file == NULL) {
+		fprintf(stderr, "%s: cannot read the capture\n", path);
+		return -1;
+	}
+	while ((ret = pcap_file_read_udp(file, &udp)) == 1) {
+		if (pcap_addr_port(&udp.src) == opt.aaa_port || pcap_addr_port(&udp.dst) == opt.aaa_port)
+			read_radius(&udp);
+		else
+			read_coap(&udp);
+	}
+	pcap_file_close(file);
+	if (ret < 0)
+		fprintf(stderr, "%s: truncated capture, the rest is ignored\n", path);
+	return 0;
+}
+
+/*
+ * The devices.
+ */
+
+static void flow_send(struct flow *flow, const uint8_t *buf, size_t len) {
+	if (send(flow->fd, buf, len, 0) < 0 && errno != ECONNREFUSED)
+		perror("send");
+}
+
+static void flow_end(struct flow *flow, int state, double t) {
+	flow->state = (uint8_t) state;
+	flow->end = t;
+	if (flow->fd >= 0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, flow->fd, NULL);
+		close(flow->fd);
+		flow->fd = -1;
+	}
+	free(flow->last_ack);
+	flow->last_ack = NULL;
+	free(flow->pending);
+	flow->pending = NULL;
+	running--;
+	ended++;
+
+	// The next flow that waits for a place
+	if (waiting_head < waiting_tail)
+		schedule(t, EV_START, waiting[waiting_head++], 1);
+}
+
+static void send_trigger(struct flow *flow) {
+	uint8_t buf[MAX_DATAGRAM];
+	size_t len = flow->trigger.len < sizeof(buf) ? flow->trigger.len : sizeof(buf);
+	uint16_t mid = (uint16_t) rand();
+
+	// A new message ID, the controller could take it as a duplicate
+	memcpy(buf, flow->trigger.data, len);
+	buf[2] = (uint8_t) (mid >> 8);
+	buf[3] = (uint8_t) mid;
+	flow_send(flow, buf, len);
+}
+
+static void flow_start(struct flow *flow, int queued) {
+	struct epoll_event ev;
+
+	if (!queued && opt.max_flows > 0 && running >= opt.max_flows) {
+		waiting[waiting_tail++] = flow;
+		return;
+	}
+
+	flow->fd = socket(ctrl.ss_family, SOCK_DGRAM, 0);
+	if (flow->fd < 0 || connect(flow->fd, (struct sockaddr *) &ctrl, ctrl_len) < 0) {
+		perror("socket");
+		exit(1);
+	}
+	fcntl(flow->fd, F_SETFL, O_NONBLOCK);
+	ev.events = EPOLLIN;
+	ev.data.ptr = flow;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, flow->fd, &ev);
+
+	running++;
+	flow->state = FLOW_RUNNING;
+	flow->pending_mid = -1;
+	flow->last_mid = -1;
+	flow->sent = now();
+	send_trigger(flow);
+	schedule(flow->sent + ACK_TIMEOUT, EV_RETRANSMIT, flow, 1);
+	schedule(flow->sent + opt.timeout, EV_TIMEOUT, flow, 0);
+}
+
+/* Builds the ACK captured with the message ID, token and EAP identifier of the POST. */
+static size_t build_ack(const struct message *ack, const struct coap_view *post,
+		uint8_t *buf, size_t size) {
+	struct coap_view view;
+	size_t rest, len;
+
+	if (coap_parse(ack->data, ack->len, &view) < 0)
+		return 0;
+	rest = ack->len - view.options;
+	len = 4 + post->token_len + rest;
+	if (len > size)
+		return 0;
+
+	buf[0] = (uint8_t) ((ack->data[0] & 0xf0) | post->token_len);
+	buf[1] = ack->data[1];
+	buf[2] = (uint8_t) (post->mid >> 8);
+	buf[3] = (uint8_t) post->mid;
+	memcpy(buf + 4, post->token, post->token_len);
+	memcpy(buf + 4 + post->token_len, ack->data + view.options, rest);
+
+	if (view.payload != NULL && view.payload_len >= 2 && post->payload != NULL &&
+			post->payload_len >= 2)
+		buf[len - view.payload_len + 1] = post->payload[1];
+	return len;
+}
+
+static void send_ack(struct flow *flow, size_t index, const struct coap_view *post) {
+	uint8_t buf[MAX_DATAGRAM];
+	size_t len = build_ack(&flow->acks[index], post, buf, sizeof(buf));
+
+	if (len == 0)
+		return;
+	free(flow->last_ack);
+	flow->last_ack = xmemdup(buf, len);
+	flow->last_ack_len = len;
+	flow->last_mid = post->mid;
+	flow_send(flow, buf, len);
+}
+
+static void flow_receive(struct flow *flow) {
+	uint8_t buf[MAX_DATAGRAM];
+	struct coap_view post;
+	ssize_t len;
+
+	while ((len = recv(flow->fd, buf, sizeof(buf), 0)) >= 0) {
+		double t = now();
+
+		if (flow->state != FLOW_RUNNING)
+			return;
+		if (coap_parse(buf, (size_t) len, &post) < 0 || post.type != COAP_TYPE_CON ||
+				post.code != COAP_CODE_POST) {
+			stats.ignored++;
+			continue;
+		}
+
+		if (!flow->bound) {
+			flow->bound = 1;
+			flow->token_len = post.token_len;
+			memcpy(flow->token, post.token, post.token_len);
+		}
+		else if (post.token_len != flow->token_len ||
+				memcmp(post.token, flow->token, post.token_len) != 0) {
+			// A session started by a retransmission of the first request
+			stats.ignored++;
+			continue;
+		}
+
+		stats.posts++;
+		if (post.mid == flow->last_mid && flow->last_ack != NULL) {
+			stats.duplicates++;
+			flow_send(flow, flow->last_ack, flow->last_ack_len);
+			continue;
+		}
+		if (post.mid == flow->pending_mid) {
+			stats.duplicates++;
+			continue;
+		}
+		flow->posts++;
+
+		if (flow->next_ack >= flow->nacks) {
+			flow_end(flow, post.oscore ? FLOW_OK : FLOW_DIVERGED, t);
+			return;
+		}
+
+		// The EAP success: the bootstrapping is done when it arrives
+		if (post.oscore) {
+			send_ack(flow, flow->next_ack++, &post);
+			flow_end(flow, FLOW_OK, t);
+			return;
+		}
+
+		if (opt.scale > 0 && flow->acks[flow->next_ack].think > 0) {
+			// The POST is kept until the think time has passed
+			flow->pending_mid = post.mid;
+			free(flow->pending);
+			flow->pending = xmemdup(buf, (size_t) len);
+			flow->pending_len = (size_t) len;
+			schedule(t + flow->acks[flow->next_ack].think / opt.scale, EV_ACK, flow,
+					(uint32_t) flow->next_ack);
+		}
+		else
+			send_ack(flow, flow->next_ack++, &post);
+	}
+}
+
+static void flow_event(const struct event *ev) {
+	struct flow *flow = ev->ptr;
+	struct coap_view post;
+	uint8_t buf[MAX_DATAGRAM];
+	size_t len;
+
+	switch (ev->kind) {
+	case EV_START:
+		flow_start(flow, ev->arg);
+		break;
+	case EV_RETRANSMIT:
+		if (flow->state != FLOW_RUNNING || flow->bound)
+			break;
+		if (ev->arg > MAX_RETRANSMIT) {
+			flow_end(flow, FLOW_TIMEOUT, ev->at);
+			break;
+		}
+		send_trigger(flow);
+		schedule(ev->at + ACK_TIMEOUT * (1 << ev->arg), EV_RETRANSMIT, flow, ev->arg + 1);
+		break;
+	case EV_ACK:
+		if (flow->state != FLOW_RUNNING || flow->next_ack != ev->arg || flow->pending == NULL)
+			break;
+		len = flow->pending_len;
+		memcpy(buf, flow->pending, len);
+		if (coap_parse(buf, len, &post) < 0)
+			break;
+		flow->pending_mid = -1;
+		send_ack(flow, flow->next_ack++, &post);
+		break;
+	case EV_TIMEOUT:
+		if (flow->state == FLOW_RUNNING)
+			flow_end(flow, FLOW_TIMEOUT, ev->at);
+		break;
+	}
+}
+
+/*
+ * The AAA server.
+ */
+
+static int is_ms_key(const uint8_t *attr) {
+	// Vendor-Specific of Microsoft, MS-MPPE-Send-Key and MS-MPPE-Recv-Key
+	return attr[0] == RADIUS_ATTR_VENDOR_SPECIFIC && attr[1] >= 8 &&
+			WPA_GET_BE32(attr + 2) == RADIUS_VENDOR_ID_MICROSOFT &&
+			(attr[6] == RADIUS_VENDOR_ATTR_MS_MPPE_SEND_KEY ||
+			 attr[6] == RADIUS_VENDOR_ATTR_MS_MPPE_RECV_KEY);
+}
+
+/* Builds the answer captured for the request received. */
+static struct radius_msg *build_answer(const struct aaa_answer *answer, const uint8_t *req,
+		size_t req_len) {
+	const u8 *secret = (const u8 *) opt.secret;
+	size_t secret_len = strlen(opt.secret);
+	struct radius_msg *msg, *recorded, *recorded_req;
+	struct radius_ms_mppe_keys *keys;
+	const uint8_t *buf = answer->answer;
+	size_t pos = 20;
+
+	msg = radius_msg_new(buf[0], req[1]);
+	if (msg == NULL)
+		return NULL;
+
+	while (pos + 2 <= answer->answer_len && buf[pos + 1] >= 2 &&
+			pos + buf[pos + 1] <= answer->answer_len) {
+		if (buf[pos] != RADIUS_ATTR_MESSAGE_AUTHENTICATOR && !is_ms_key(buf + pos) &&
+				!radius_msg_add_attr(msg, buf[pos], buf + pos + 2, buf[pos + 1] - 2)) {
+			radius_msg_free(msg);
+			return NULL;
+		}
+		pos += buf[pos + 1];
+	}
+
+	// The keys were encrypted with the authenticator of the request captured
+	recorded = radius_msg_parse(answer->answer, answer->answer_len);
+	recorded_req = radius_msg_parse(answer->request, answer->request_len);
+	keys = radius_msg_get_ms_keys(recorded, recorded_req, secret, secret_len);
+	if (keys != NULL) {
+		if (keys->send != NULL && keys->recv != NULL)
+			radius_msg_add_mppe_keys(msg, req + 4, secret, secret_len,
+					keys->send, keys->send_len, keys->recv, keys->recv_len);
+		os_free(keys->send);
+		os_free(keys->recv);
+		os_free(keys);
+	}
+	radius_msg_free(recorded);
+	radius_msg_free(recorded_req);
+
+	if (radius_msg_finish_srv(msg, secret, secret_len, req + 4) < 0) {
+		radius_msg_free(msg);
+		return NULL;
+	}
+	return msg;
+}
+
+static void aaa_send(const uint8_t *buf, size_t len, const struct sockaddr_storage *to) {
+	socklen_t to_len = to->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) :
+			sizeof(struct sockaddr_in);
+
+	if (sendto(aaa_fd, buf, len, 0, (const struct sockaddr *) to, to_len) < 0)
+		perror("sendto");
+}
+
+static void aaa_request(const uint8_t *buf, size_t len, const struct sockaddr_storage *from) {
+	struct aaa_answer *answer, *unused = NULL;
+	struct radius_msg *msg;
+	struct wpabuf *wbuf;
+	struct aaa_key *key;
+	struct aaa_send *pending;
+	uint8_t eap[4096];
+	size_t eap_len;
+
+	if (len < 20 || buf[0] != RADIUS_CODE_ACCESS_REQUEST)
+		return;
+	stats.aaa_requests++;
+
+	eap_len = radius_eap(buf, len, eap, sizeof(eap));
+	key = find_aaa_key(eap, eap_len);
+	if (key == NULL) {
+		stats.aaa_unmatched++;
+		return;
+	}
+
+	// Retransmission of a request already answered
+	for (answer = key->answers; answer != NULL; answer = answer->next) {
+		if (answer->live != NULL && answer->live[1] == buf[1] &&
+				memcmp(answer->live_authenticator, buf + 4, 16) == 0) {
+			stats.aaa_retransmits++;
+			aaa_send(answer->live, answer->live_len, from);
+			return;
+		}
+		if (answer->live == NULL && unused == NULL)
+			unused = answer;
+	}
+	if (unused == NULL) {
+		stats.aaa_unmatched++;
+		return;
+	}
+
+	msg = build_answer(unused, buf, len);
+	if (msg == NULL) {
+		stats.aaa_unmatched++;
+		return;
+	}
+	wbuf = radius_msg_get_buf(msg);
+	unused->live = xmemdup(wpabuf_head(wbuf), wpabuf_len(wbuf));
+	unused->live_len = wpabuf_len(wbuf);
+	memcpy(unused->live_authenticator, buf + 4, 16);
+	radius_msg_free(msg);
+
+	if (opt.scale > 0 && unused->delay > 0) {
+		pending = malloc(sizeof(*pending));
+		pending->data = unused->live;
+		pending->len = unused->live_len;
+		pending->to = *from;
+		schedule(now() + unused->delay / opt.scale, EV_AAA, pending, 0);
+	}
+	else
+		aaa_send(unused->live, unused->live_len, from);
+}
+
+static void aaa_receive() {
+	uint8_t buf[4096];
+	struct sockaddr_storage from;
+	socklen_t from_len = sizeof(from);
+	ssize_t len;
+
+	while ((len = recvfrom(aaa_fd, buf, sizeof(buf), 0, (struct sockaddr *) &from,
+			&from_len)) >= 0) {
+		aaa_request(buf, (size_t) len, &from);
+		from_len = sizeof(from);
+	}
+}
+
+static int resolve(const char *host, uint16_t port, struct sockaddr_storage *addr,
+		socklen_t *len) {
+	struct sockaddr_in *sin = (struct sockaddr_in *) addr;
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) addr;
+
+	memset(addr, 0, sizeof(*addr));
+	if (inet_pton(AF_INET, host, &sin->sin_addr) == 1) {
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		*len = sizeof(*sin);
+		return 0;
+	}
+	if (inet_pton(AF_INET6, host, &sin6->sin6_addr) == 1) {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		*len = sizeof(*sin6);
+		return 0;
+	}
+	fprintf(stderr, "%s: not an IP address\n", host);
+	return -1;
+}
+
+static int aaa_open() {
+	struct sockaddr_storage addr;
+	socklen_t len;
+	struct epoll_event ev;
+
+	if (resolve(opt.aaa_addr, opt.aaa_port, &addr, &len) < 0)
+		return -1;
+	aaa_fd = socket(addr.ss_family, SOCK_DGRAM, 0);
+	if (aaa_fd < 0 || bind(aaa_fd, (struct sockaddr *) &addr, len) < 0) {
+		perror("bind");
+		return -1;
+	}
+	fcntl(aaa_fd, F_SETFL, O_NONBLOCK);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, aaa_fd, &ev);
+}
+
+/*
+ * The results.
+ */
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, size_t n, double p) {
+	size_t i;
+
+	if (n == 0)
+		return 0;
+	i = (size_t) ceil(p * (double) n);
+	return sorted[i > 0 ? i - 1 : 0];
+}
+
+static void print_latencies(FILE *out, const char *name, double *values, size_t n) {
+	double sum = 0;
+	size_t i;
+
+	qsort(values, n, sizeof(*values), compare_double);
+	for (i = 0; i < n; i++)
+		sum += values[i];
+	fprintf(out, "\"%s\": {\"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+			"\"max\": %.3f}", name, n ? sum / (double) n : 0, percentile(values, n, 0.5),
+			percentile(values, n, 0.9), percentile(values, n, 0.99), n ? values[n - 1] : 0);
+}
+
+static void report(double duration) {
+	uint64_t count[FLOW_DIVERGED + 1] = {0};
+	double *latency = malloc((nflows + 1) * sizeof(double));
+	double *recorded = malloc((nflows + 1) * sizeof(double));
+	size_t nlatency = 0, nrecorded = 0, i;
+	FILE *out = NULL;
+
+	if (opt.results != NULL && (out = fopen(opt.results, "w")) == NULL)
+		perror(opt.results);
+	if (out != NULL)
+		fprintf(out, "# flow status latency_ms posts recorded_ms\n");
+
+	for (i = 0; i < nflows; i++) {
+		struct flow *flow = flows[i];
+		double ms = (flow->end - flow->sent) * 1e3;
+
+		count[flow->state]++;
+		if (flow->state == FLOW_OK)
+			latency[nlatency++] = ms;
+		if (flow->recorded_latency >= 0)
+			recorded[nrecorded++] = flow->recorded_latency * 1e3;
+		if (out != NULL)
+			fprintf(out, "%s %s %.3f %u %.3f\n", flow->name, flow_state_names[flow->state],
+					flow->state == FLOW_OK ? ms : -1, flow->posts,
+					flow->recorded_latency >= 0 ? flow->recorded_latency * 1e3 : -1);
+	}
+	if (out != NULL)
+		fclose(out);
+
+	printf("{\"flows\": %zu, \"ok\": %" PRIu64 ", \"timeout\": %" PRIu64 ", \"diverged\": %" PRIu64
+			", \"skipped\": %" PRIu64 ", \"duration_s\": %.3f,\n",
+			nflows, count[FLOW_OK], count[FLOW_TIMEOUT], count[FLOW_DIVERGED],
+			stats.skipped, duration);
+	printf(" \"posts\": %" PRIu64 ", \"duplicates\": %" PRIu64 ", \"ignored\": %" PRIu64
+			", \"aaa_requests\": %" PRIu64 ", \"aaa_retransmits\": %" PRIu64
+			", \"aaa_unmatched\": %" PRIu64 ",\n ",
+			stats.posts, stats.duplicates, stats.ignored, stats.aaa_requests,
+			stats.aaa_retransmits, stats.aaa_unmatched);
+	print_latencies(stdout, "latency_ms", latency, nlatency);
+	printf(",\n ");
+	print_latencies(stdout, "recorded_latency_ms", recorded, nrecorded);
+	printf("}\n");
+
+	free(latency);
+	free(recorded);
+}
+
+/*
+ * Comparison of two results files.
+ */
+
+struct result {
+	char name[FLOW_NAME_LEN];
+	int ok;
+	double latency;
+	UT_hash_handle hh;
+};
+
+struct regression {
+	const char *name;
+	double base;
+	double latency;
+};
+
+static struct result *read_results(const char *path, size_t *n) {
+	struct result *results = NULL, *r;
+	char line[256], status[32];
+	FILE *in = fopen(path, "r");
+
+	if (in == NULL) {
+		perror(path);
+		exit(1);
+	}
+	*n = 0;
+	while (fgets(line, sizeof(line), in) != NULL) {
+		if (line[0] == '#')
+			continue;
+		r = calloc(1, sizeof(*r));
+		if (sscanf(line, "%79s %31s %lf", r->name, status, &r->latency) != 3) {
+			free(r);
+			continue;
+		}
+		r->ok = strcmp(status, "ok") == 0;
+		HASH_ADD_STR(results, name, r);
+		(*n)++;
+	}
+	fclose(in);
+	return results;
+}
+
+static int compare_regression(const void *a, const void *b) {
+	const struct regression *x = a, *y = b;
+	double dx = x->latency - x->base, dy = y->latency - y->base;
+
+	return dx > dy ? -1 : dx < dy;
+}
+
+static int diff_results(const char *base_path, const char *new_path) {
+	struct result *base, *new_results, *r, *b, *tmp;
+	size_t nbase, nnew, n = 0, only_base = 0, only_new = 0, i;
+	double *base_lat, *new_lat, *delta;
+	struct regression *worst;
+
+	base = read_results(base_path, &nbase);
+	new_results = read_results(new_path, &nnew);
+	base_lat = malloc((nbase + 1) * sizeof(double));
+	new_lat = malloc((nbase + 1) * sizeof(double));
+	delta = malloc((nbase + 1) * sizeof(double));
+	worst = malloc((nbase + 1) * sizeof(*worst));
+
+	HASH_ITER(hh, new_results, r, tmp) {
+		HASH_FIND_STR(base, r->name, b);
+		if (b == NULL || !b->ok) {
+			only_new += r->ok;
+			continue;
+		}
+		if (!r->ok) {
+			only_base++;
+			continue;
+		}
+		base_lat[n] = b->latency;
+		new_lat[n] = r->latency;
+		delta[n] = r->latency - b->latency;
+		worst[n].name = r->name;
+		worst[n].base = b->latency;
+		worst[n].latency = r->latency;
+		n++;
+	}
+	HASH_ITER(hh, base, b, tmp) {
+		HASH_FIND_STR(new_results, b->name, r);
+		if (r == NULL && b->ok)
+			only_base++;
+	}
+
+	qsort(worst, n, sizeof(*worst), compare_regression);
+	printf("{\"compared\": %zu, \"ok_only_in_base\": %zu, \"ok_only_in_new\": %zu,\n ",
+			n, only_base, only_new);
+	print_latencies(stdout, "base_ms", base_lat, n);
+	printf(",\n ");
+	print_latencies(stdout, "new_ms", new_lat, n);
+	printf(",\n ");
+	print_latencies(stdout, "delta_ms", delta, n);
+	printf(",\n \"worst\": [");
+	for (i = 0; i < n && i < 10; i++)
+		printf("%s\n  {\"flow\": \"%s\", \"base_ms\": %.3f, \"new_ms\": %.3f}", i ? "," : "",
+				worst[i].name, worst[i].base, worst[i].latency);
+	printf("]}\n");
+
+	free(base_lat);
+	free(new_lat);
+	free(delta);
+	free(worst);
+	HASH_ITER(hh, base, r, tmp) {
+		HASH_DEL(base, r);
+		free(r);
+	}
+	HASH_ITER(hh, new_results, r, tmp) {
+		HASH_DEL(new_results, r);
+		free(r);
+	}
+	return 0;
+}
+
+static void parse_options(int argc, char *argv[]) {
+	int c;
+
+	opt.ctrl_addr = "::1";
+	opt.ctrl_port = 5683;
+	opt.aaa_addr = "127.0.0.1";
+	opt.aaa_port = 1812;
+	opt.secret = "testing123";
+	opt.scale = 1;
+	opt.max_flows = 0;
+	opt.timeout = 60;
+
+	while ((c = getopt(argc, argv, "r:c:C:a:A:S:s:j:t:o:d:")) != -1) {
+		switch (c) {
+		case 'r': opt.pcap = optarg; break;
+		case 'c': opt.ctrl_addr = optarg; break;
+		case 'C': opt.ctrl_port = (uint16_t) atoi(optarg); break;
+		case 'a': opt.aaa_addr = optarg; break;
+		case 'A': opt.aaa_port = (uint16_t) atoi(optarg); break;
+		case 'S': opt.secret = optarg; break;
+		case 's': opt.scale = atof(optarg); break;
+		case 'j': opt.max_flows = (uint32_t) strtoul(optarg, NULL, 10); break;
+		case 't': opt.timeout = atof(optarg); break;
+		case 'o': opt.results = optarg; break;
+		case 'd':
+			if (optind >= argc)
+				usage();
+			exit(diff_results(optarg, argv[optind]));
+		default: usage();
+		}
+	}
+	if (opt.pcap == NULL || opt.scale < 0 || opt.timeout <= 0)
+		usage();
+}
+
+int main(int argc, char *argv[]) {
+	struct epoll_event ready[256];
+	struct rlimit limit;
+	double base, first = -1, start;
+	size_t i, n;
+	int nready;
+
+	parse_options(argc, argv);
+	srand((unsigned) time(NULL));
+
+	if (read_capture(opt.pcap) < 0)
+		return 1;
+
+	// Flows without ACKs were captured half
+	for (i = 0, n = 0; i < nflows; i++) {
+		if (flows[i]->nacks == 0) {
+			stats.skipped++;
+			continue;
+		}
+		flows[i]->fd = -1;
+		flows[n++] = flows[i];
+		if (first < 0 || flows[i]->start < first)
+			first = flows[i]->start;
+	}
+	nflows = n;
+	if (nflows == 0) {
+		fprintf(stderr, "%s: no CoAP-EAP flows found\n", opt.pcap);
+		return 1;
+	}
+
+	// A socket per flow in progress
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	epfd = epoll_create1(0);
+	if (epfd < 0 || aaa_open() < 0 || resolve(opt.ctrl_addr, opt.ctrl_port, &ctrl, &ctrl_len) < 0)
+		return 1;
+
+	waiting = malloc(nflows * sizeof(*waiting));
+	base = now();
+	for (i = 0; i < nflows; i++)
+		schedule(base + (opt.scale > 0 ? (flows[i]->start - first) / opt.scale : 0),
+				EV_START, flows[i], 0);
+
+	start = now();
+	while (ended < nflows) {
+		int timeout = -1;
+
+		if (nevents > 0) {
+			double wait = events[0].at - now();
+			timeout = wait > 0 ? (int) ceil(wait * 1e3) : 0;
+		}
+		nready = epoll_wait(epfd, ready, 256, timeout);
+		for (i = 0; nready > 0 && i < (size_t) nready; i++) {
+			if (ready[i].data.ptr == NULL)
+				aaa_receive();
+			else
+				flow_receive(ready[i].data.ptr);
+		}
+
+		while (nevents > 0 && events[0].at <= now()) {
+			struct event ev = pop_event();
+
+			if (ev.kind == EV_AAA) {
+				struct aaa_send *pending = ev.ptr;
+				aaa_send(pending->data, pending->len, &pending->to);
+				free(pending);
+			}
+			else
+				flow_event(&ev);
+		}
+	}
+
+	report(now() - start);
+	return 0;
+}
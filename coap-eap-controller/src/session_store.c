@@ -0,0 +1,189 @@
+/**
+ * @file session_store.c
+ * @brief Memory-mapped store of CoAP-EAP sessions.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "session_store.h"
+#include "panautils.h"
+
+/** The file mapped, NULL if the store is not opened.*/
+static struct session_store_header *store = NULL;
+static size_t store_size = 0;
+/** Stack of free slots, filled by session_store_recover.*/
+static int *free_slots = NULL;
+static int nfree = 0;
+static pthread_mutex_t free_slots_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct session_slot *get_slot(int slot) {
+	return ((struct session_slot *) (store + 1)) + slot;
+}
+
+/* FNV-1a over 64 bits words, the record's size is a multiple of 8. */
+static uint32_t store_checksum(const struct session_record *record) {
+	const uint8_t *p = (const uint8_t *) record;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint64_t word;
+	size_t i;
+
+	for (i = 0; i + sizeof(word) <= sizeof(*record); i += sizeof(word)) {
+		memcpy(&word, p + i, sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ULL;
+	}
+	return (uint32_t) (hash ^ (hash >> 32));
+}
+
+int session_store_open(const char *path, uint32_t nslots) {
+	struct session_store_header header;
+	struct stat st;
+	int fd;
+
+	if (store != NULL || nslots == 0)
+		return -1;
+
+	store_size = sizeof(header) + (size_t) nslots * sizeof(struct session_slot);
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		pana_error("session_store: cannot open %s", path);
+		return -1;
+	}
+
+	// A file of another version (or size) is emptied, its records can not
+	// be read.
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size != store_size ||
+			pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+			header.magic != SESSION_STORE_MAGIC ||
+			header.version != SESSION_STORE_VERSION ||
+			header.slot_size != sizeof(struct session_slot) ||
+			header.nslots != nslots) {
+		pana_debug("session_store: initializing %s with %u slots", path, nslots);
+		if (ftruncate(fd, 0) < 0 || ftruncate(fd, (off_t) store_size) < 0) {
+			pana_error("session_store: cannot resize %s", path);
+			close(fd);
+			return -1;
+		}
+	}
+
+	store = mmap(NULL, store_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (store == MAP_FAILED) {
+		pana_error("session_store: cannot map %s", path);
+		store = NULL;
+		return -1;
+	}
+
+	store->magic = SESSION_STORE_MAGIC;
+	store->version = SESSION_STORE_VERSION;
+	store->slot_size = sizeof(struct session_slot);
+	store->nslots = nslots;
+
+	free_slots = XMALLOC(int, nslots);
+	nfree = 0;
+	return 0;
+}
+
+int session_store_recover(session_store_cb cb, void *arg) {
+	struct session_slot *s;
+	int kept = 0;
+	int i;
+
+	if (store == NULL)
+		return 0;
+
+	// Pushed backwards, so the first slots are used first.
+	for (i = (int) store->nslots - 1; i >= 0; i--) {
+		s = get_slot(i);
+		if (s->seq == 0) {
+			free_slots[nfree++] = i;
+			continue;
+		}
+		if ((s->seq & 1) || s->checksum != store_checksum(&s->record)) {
+			pana_debug("session_store: slot %d is not valid, discarded", i);
+		}
+		else if (cb == NULL || cb(i, &s->record, arg) == 0) {
+			kept++;
+			continue;
+		}
+		s->seq = 0;
+		free_slots[nfree++] = i;
+	}
+	return kept;
+}
+
+int session_store_enabled() {
+	return store != NULL;
+}
+
+int session_store_alloc() {
+	int slot = -1;
+
+	pthread_mutex_lock(&free_slots_mutex);
+	if (nfree > 0)
+		slot = free_slots[--nfree];
+	pthread_mutex_unlock(&free_slots_mutex);
+	return slot;
+}
+
+struct session_record* session_store_begin(int slot) {
+	struct session_slot *s = get_slot(slot);
+	uint32_t seq = s->seq + 1;
+
+	// 0 means free, so it is skipped when the counter wraps.
+	if ((seq & 1) == 0)
+		seq++;
+	if (seq == 0xFFFFFFFF)
+		seq = 1;
+	__atomic_store_n(&s->seq, seq, __ATOMIC_RELEASE);
+	return &s->record;
+}
+
+void session_store_commit(int slot) {
+	struct session_slot *s = get_slot(slot);
+
+	s->checksum = store_checksum(&s->record);
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+void session_store_release(int slot) {
+	if (store == NULL || slot < 0)
+		return;
+
+	__atomic_store_n(&get_slot(slot)->seq, 0, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&free_slots_mutex);
+	free_slots[nfree++] = slot;
+	pthread_mutex_unlock(&free_slots_mutex);
+}
+
+void session_store_close() {
+	if (store == NULL)
+		return;
+
+	munmap(store, store_size);
+	store = NULL;
+	XFREE(free_slots);
+	nfree = 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file session_store.h
+ * @brief Headers of the memory-mapped store of CoAP-EAP sessions.
+ *
+ * The store keeps a copy of every session in progress in a file mapped
+ * with MAP_SHARED, so a controller which is restarted (or crashes) can
+ * resume the exchanges in progress instead of waiting for every device
+ * to time out and start again.
+ *
+ * The file holds a header and a fixed number of slots. Each slot holds
+ * one record and a sequence number which is odd while the record is being
+ * written, and a checksum of the record. A slot that was being written
+ * when the process died, or whose checksum does not match, is discarded
+ * when the store is recovered.
+ *
+ * The data written to the mapping survives the death of the process, but
+ * not the one of the machine: the store does not msync the file.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/** "CEAS" */
+#define SESSION_STORE_MAGIC 0x43454153
+/** Must be changed whenever struct session_record is changed.*/
+#define SESSION_STORE_VERSION 1
+
+#define STORE_LOCATION_LEN 128
+#define STORE_IDENTITY_LEN 128
+#define STORE_USERID_LEN 48
+/** Max length of a RADIUS attribute.*/
+#define STORE_RADIUS_STATE_LEN 253
+#define STORE_KEY_LEN 64
+/** Same as BUF_LEN of the controller.*/
+#define STORE_SENT_LEN 500
+/** The controller reads up to MAXBUFLEN bytes from the devices.*/
+#define STORE_RECEIVED_LEN 128
+
+/**
+ * Serialized state of a CoAP-EAP session. It is enough to resume the
+ * exchange with the device where it was: the last POST sent and the
+ * last ACK received, the state of the EAP authenticator and the State
+ * attribute to be sent back to the AAA server.
+ */
+struct session_record {
+	uint32_t session_id;
+	uint16_t message_id;
+	/** Event the session is waiting for, FLOW_EV_ACK or FLOW_EV_RADIUS.*/
+	uint8_t waiting;
+	/** TRUE if the EAP authenticator is in pass-through mode.*/
+	uint8_t passthrough;
+	/** Identifier of the EAP request the device has to answer.*/
+	int16_t eap_id;
+	uint16_t rtx_counter;
+	int32_t eap_workarround;
+	/** TRUE if the EAP success has been sent to the device.*/
+	uint8_t eap_success;
+	/** Server of the pool of AAA servers holding the State, plus one, 0 if none.*/
+	uint8_t radius_server;
+	uint16_t key_len;
+	double rt;
+	double rt_init;
+	struct sockaddr_storage addr;
+	char location[STORE_LOCATION_LEN];
+	char userID[STORE_USERID_LEN];
+	uint16_t identity_len;
+	uint8_t identity[STORE_IDENTITY_LEN];
+	uint16_t radius_state_len;
+	uint8_t radius_state[STORE_RADIUS_STATE_LEN];
+	uint8_t msk_key[STORE_KEY_LEN];
+	uint16_t sent_len;
+	uint8_t sent[STORE_SENT_LEN];
+	uint16_t received_len;
+	uint8_t received[STORE_RECEIVED_LEN];
+};
+
+/** Header of the store's file.*/
+struct session_store_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_size;
+	uint32_t nslots;
+};
+
+/** Slot of the store's file.*/
+struct session_slot {
+	/** 0 if the slot is free, odd while it is being written.*/
+	uint32_t seq;
+	uint32_t checksum;
+	struct session_record record;
+};
+
+/**
+ * Callback of session_store_recover, called with every valid record.
+ *
+ * @return 0 to keep the slot, any other value to release it.
+ */
+typedef int (*session_store_cb)(int slot, const struct session_record *record, void *arg);
+
+/**
+ * Opens (or creates) the store in path with nslots slots. A file created
+ * with another version or number of slots is emptied.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int session_store_open(const char *path, uint32_t nslots);
+/**
+ * Calls cb with every valid record of the store, the slots that are not
+ * valid are released. Must be called once, after session_store_open and
+ * before any other function of the store.
+ *
+ * @return Number of records kept.
+ */
+int session_store_recover(session_store_cb cb, void *arg);
+/** @return TRUE if the store has been opened.*/
+int session_store_enabled();
+/** @return A free slot, -1 if the store is full or is not opened.*/
+int session_store_alloc();
+/**
+ * Starts writing the record of a slot. The record is not valid until
+ * session_store_commit is called.
+ *
+ * @return The record to be written, it is mapped in the file.
+ */
+struct session_record* session_store_begin(int slot);
+/** Makes valid the record written since session_store_begin.*/
+void session_store_commit(int slot);
+/** Frees a slot, its record is not recovered anymore.*/
+void session_store_release(int slot);
+/**
+ * Unmaps the store. The records are kept in the file, it is the same as
+ * if the process finished.
+ */
+void session_store_close();
+
+#endif
@@ -0,0 +1,919 @@
+/**
+ * @file coap_eap_sim.c
+ * @brief Capacity planning of the CoAP-EAP Controller by simulation.
+ *
+ * Runs the controller (built with -DSIMULATION) against N emulated devices
+ * that start their bootstrapping following a Poisson process, and an
+ * emulated AAA server. The links between the devices and the controller,
+ * and between the controller and the AAA server, have their own latency,
+ * jitter and loss, and the controller and the AAA server are FIFO servers
+ * with a configurable service time.
+ *
+ * The RADIUS client of the controller is kept: its socket is replaced by
+ * one end of a socketpair, and the Access-Requests written to it are sent
+ * to the emulated AAA server through the simulated network.
+ *
+ * The result is printed as JSON in stdout: the bootstraps finished, failed
+ * and stalled, the allocations of the controller per bootstrap, the
+ * latency percentiles, the throughput and latency along
+ * the (virtual) time, the peak of requests per second of the AAA server
+ * and the hash of the trace, which must be the same for two runs with the
+ * same options.
+ *
+ *   coap_eap_sim [-n devices] [-r arrivals/s] [-s seed]
+ *                [-l ms] [-j ms] [-p loss]      device <-> controller
+ *                [-L ms] [-J ms] [-P loss]      controller <-> AAA
+ *                [-t connections]               RadSec to the AAA server
+ *                [-D connections]               Diameter to the AAA server
+ *                [-A servers] [-B balance] [-Z at:s]   pool of AAA servers
+ *                [-c us] [-a us]                service time of controller, AAA
+ *                [-T s] [-S s] [-R reauths/s] [-H s]   re-authentication
+ *                [-K entries]                   ERP cache
+ *                [-E]                           standalone mode
+ *                [-b s] [-g s] [-v] [-w pcap]
+ *
+ * With -T the sessions last T seconds and the controller re-authenticates
+ * the devices (reauth.h), spread over S seconds and at R per second at
+ * most (the config.xml values by default, 0 disables them); the simulation
+ * runs until the horizon H, 1.5 T by default, and the report has the peak
+ * of AAA requests per second since the first re-authentication. E.g. a
+ * fleet that bootstraps at once after a power outage:
+ *
+ *   coap_eap_sim -n 10000 -r 10000 -T 600 -S 0 -R 0
+ *   coap_eap_sim -n 10000 -r 10000 -T 600 -S 300 -R 50
+ *
+ * Without -T the devices are not re-authenticated. The first
+ * re-authentication of a device can start T - 2 guard - S seconds after its
+ * bootstrap (T / 2 for T below 240 s), which must not be shorter than -g:
+ * e.g. -T 120 at least with the default -g 60.
+ *
+ * The re-authentications use ERP (erp.h) when the controller still has
+ * the keys of the device, its cache has K entries (ERP_CACHE_SIZE by
+ * default, 0 disables ERP). The report compares the latency of the
+ * re-authentications done with ERP and with a full EAP, and has the hit
+ * rate and the memory of the cache.
+ *
+ * With -E the controller runs in standalone mode (MODE 0): it is the EAP
+ * server of the devices, with their keys in the PSK store (psk_store.h),
+ * and the AAA server is not used. Otherwise it is in pass-through mode,
+ * whatever config.xml says.
+ *
+ * With -t the controller talks to the AAA server over t RadSec (RFC 6614)
+ * connections (radsec.h) instead of UDP: every connection is a TCP stream
+ * in each direction (sim_stream_send), so a lost request costs a TCP
+ * retransmission timeout and the messages behind it on the same
+ * connection wait for it, instead of the CoAP retransmission of a request
+ * lost over UDP. The requests go to the connection of their RADIUS
+ * identifier. E.g. the tail latency with 2% of loss to a remote AAA server:
+ *
+ *   coap_eap_sim -n 10000 -L 20 -P 0.02
+ *   coap_eap_sim -n 10000 -L 20 -P 0.02 -t 4
+ *
+ * With -A the controller has a pool of A AAA servers (AS_POOL), each one
+ * with its own link, socket and service time, and spreads the sessions
+ * over them with the balance B (RadiusBalance, 1 by default: the fewest
+ * requests pending). The servers share the EAP sessions, but a request
+ * with the State of another server is dropped. With -Z server 0 drops
+ * everything, Status-Server included, from at during s seconds; the
+ * controller marks it down when its probes are not answered and sends the
+ * new sessions to the other ones. The report has the requests, the
+ * round-trip time and the downs of every server. E.g. the throughput of
+ * AAA servers of 1 ms per request, and one of three servers lost:
+ *
+ *   coap_eap_sim -n 20000 -r 1500 -a 1000 -A 1
+ *   coap_eap_sim -n 20000 -r 1500 -a 1000 -A 2
+ *   coap_eap_sim -n 20000 -r 1000 -a 1000 -A 3 -Z 5:10
+ *
+ * With -D the controller sends the EAP responses in Diameter-EAP-Requests
+ * (RFC 4072) over D connections (diameter.h) instead of RADIUS, also TCP
+ * streams as with -t. The requests go to the connection of their
+ * hop-by-hop identifier, and are pipelined: there is no window of 256
+ * identifiers per socket. The AAA server answers them with the same EAP
+ * sessions. E.g. the throughput and latency of both protocols:
+ *
+ *   coap_eap_sim -n 20000 -r 2000 -L 5 -a 200
+ *   coap_eap_sim -n 20000 -r 2000 -L 5 -a 200 -D 4
+ *
+ * With -w the messages of the controller are captured in a pcap file, with
+ * the virtual time, to be replayed against a real controller (src/replay).
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+
+#include "../mainserver.h"
+#include "../lalarm.h"
+#include "../loadconfig.h"
+#include "../reauth.h"
+#include "../erp.h"
+#include "../psk_store.h"
+#include "../radsec.h"
+#include "../diameter.h"
+#include "../wpa_supplicant/src/radius/radius_client.h"
+
+#include "sim.h"
+
+/** Alarms expire when their time is strictly before the time given.*/
+#define ALARM_EPSILON 1e-9
+/** Credentials of the PaC in config.xml.*/
+#define DEVICE_IDENTITY "usera"
+#define DEVICE_PSK "passwordpassword"
+
+extern struct lalarm_coap* list_alarms_coap_eap;
+extern pthread_mutex_t list_sessions_mutex;
+
+struct sim_options {
+	uint32_t devices;
+	double rate;
+	uint64_t seed;
+	struct sim_link device_link;
+	struct sim_link aaa_link;
+	int aaa_connections;
+	int diameter_connections;
+	int aaa_servers;
+	int balance;
+	double stall_at;
+	double stall_for;
+	double ctrl_service;
+	double aaa_service;
+	double bucket;
+	double give_up;
+	double lifetime;
+	double jitter;
+	double reauth_rate;
+	double horizon;
+	long erp_cache;
+	int standalone;
+	int verbose;
+	const char *capture;
+};
+
+struct completion {
+	double end;
+	double latency;
+};
+
+static struct sim_options opt;
+static struct sim_server ctrl_server;
+/** The AAA servers of the pool, one with -A 1.*/
+static struct sim_server aaa_server[AS_POOL_MAX];
+/** Ends of the socketpairs that replace the sockets of the RADIUS client, one per server.*/
+static int aaa_fd[AS_POOL_MAX];
+/** Requests received by every server, and the ones dropped while stalled (-Z).*/
+static uint64_t aaa_server_requests[AS_POOL_MAX];
+static uint64_t stall_dropped = 0;
+/** With -t or -D, the streams of the RadSec or Diameter connections to and from the AAA server.*/
+static struct sim_stream *to_aaa = NULL;
+static struct sim_stream *from_aaa = NULL;
+
+static uint32_t next_device = 0;
+static uint32_t in_progress = 0;
+static uint32_t max_in_progress = 0;
+static uint64_t ended = 0;
+/** Bootstraps finished, in the order they finished.*/
+static struct completion *completions = NULL;
+static size_t ncompletions = 0;
+/** Requests received by the AAA server in every second.*/
+static uint32_t *aaa_per_s = NULL;
+static size_t aaa_seconds = 0;
+/** Latencies of the re-authentications finished, with a full EAP and with ERP.*/
+static double *reauth_full = NULL;
+static size_t nreauth_full = 0;
+static double *reauth_erp = NULL;
+static size_t nreauth_erp = 0;
+static size_t reauth_size = 0;
+
+static void usage() {
+	fprintf(stderr, "usage: coap_eap_sim [-n devices] [-r arrivals/s] [-s seed]\n"
+			"\t[-l ms] [-j ms] [-p loss] [-L ms] [-J ms] [-P loss] [-t connections] [-D connections]\n"
+			"\t[-A servers] [-B balance] [-Z at:s]\n"
+			"\t[-c us] [-a us] [-T s] [-S s] [-R reauths/s] [-H s]\n"
+			"\t[-K entries] [-E] [-b s] [-g s] [-v] [-w pcap]\n");
+	exit(1);
+}
+
+static void parse_options(int argc, char *argv[]) {
+	int c;
+
+	opt.devices = 100000;
+	opt.rate = 500;
+	opt.seed = 1;
+	opt.device_link.latency = 0.020;
+	opt.device_link.jitter = 0.005;
+	opt.device_link.loss = 0;
+	opt.aaa_link.latency = 0.001;
+	opt.aaa_link.jitter = 0.0002;
+	opt.aaa_link.loss = 0;
+	opt.aaa_connections = 0;
+	opt.diameter_connections = 0;
+	opt.aaa_servers = 1;
+	opt.balance = RADIUS_BALANCE_LEAST_OUTSTANDING;
+	opt.stall_at = -1;
+	opt.stall_for = 0;
+	opt.ctrl_service = 0;
+	opt.aaa_service = 0.0001;
+	opt.bucket = 10;
+	opt.give_up = 60;
+	opt.lifetime = 0;
+	opt.jitter = -1;
+	opt.reauth_rate = -1;
+	opt.horizon = -1;
+	opt.erp_cache = -1;
+	opt.standalone = 0;
+	opt.verbose = 0;
+	opt.capture = NULL;
+
+	while ((c = getopt(argc, argv, "n:r:s:l:j:p:L:J:P:t:D:A:B:Z:c:a:T:S:R:H:K:Eb:g:vw:")) != -1) {
+		switch (c) {
+		case 'n': opt.devices = (uint32_t) strtoul(optarg, NULL, 10); break;
+		case 'r': opt.rate = atof(optarg); break;
+		case 's': opt.seed = strtoull(optarg, NULL, 10); break;
+		case 'l': opt.device_link.latency = atof(optarg) / 1e3; break;
+		case 'j': opt.device_link.jitter = atof(optarg) / 1e3; break;
+		case 'p': opt.device_link.loss = atof(optarg); break;
+		case 'L': opt.aaa_link.latency = atof(optarg) / 1e3; break;
+		case 'J': opt.aaa_link.jitter = atof(optarg) / 1e3; break;
+		case 'P': opt.aaa_link.loss = atof(optarg); break;
+		case 't': opt.aaa_connections = atoi(optarg); break;
+		case 'D': opt.diameter_connections = atoi(optarg); break;
+		case 'A': opt.aaa_servers = atoi(optarg); break;
+		case 'B': opt.balance = atoi(optarg); break;
+		case 'Z':
+			if (sscanf(optarg, "%lf:%lf", &opt.stall_at, &opt.stall_for) != 2)
+				usage();
+			break;
+		case 'c': opt.ctrl_service = atof(optarg) / 1e6; break;
+		case 'a': opt.aaa_service = atof(optarg) / 1e6; break;
+		case 'T': opt.lifetime = atof(optarg); break;
+		case 'S': opt.jitter = atof(optarg); break;
+		case 'R': opt.reauth_rate = atof(optarg); break;
+		case 'H': opt.horizon = atof(optarg); break;
+		case 'K': opt.erp_cache = atol(optarg); break;
+		case 'E': opt.standalone = 1; break;
+		case 'b': opt.bucket = atof(optarg); break;
+		case 'g': opt.give_up = atof(optarg); break;
+		case 'v': opt.verbose = 1; break;
+		case 'w': opt.capture = optarg; break;
+		default: usage();
+		}
+	}
+	if (opt.devices == 0 || opt.rate <= 0 || opt.bucket <= 0 || opt.lifetime < 0 ||
+			opt.aaa_connections < 0 || opt.aaa_connections > RADSEC_MAX_CONNECTIONS ||
+			opt.aaa_servers < 1 || opt.aaa_servers > AS_POOL_MAX ||
+			(opt.aaa_servers > 1 && opt.aaa_connections > 0) ||
+			opt.diameter_connections < 0 || opt.diameter_connections > DIAMETER_MAX_CONNECTIONS ||
+			(opt.diameter_connections > 0 && (opt.aaa_connections > 0 || opt.aaa_servers > 1 ||
+			opt.standalone)) ||
+			opt.balance < RADIUS_BALANCE_FAILOVER || opt.balance > RADIUS_BALANCE_LATENCY)
+		usage();
+	if (opt.horizon < 0)
+		opt.horizon = 1.5 * opt.lifetime;
+}
+
+/*
+ * Every message waits for its turn in the server that receives it: the
+ * *_arrival callbacks queue it and the *_turn ones process it.
+ */
+
+/* Controller <-> AAA server */
+
+static void ctrl_radius_arrival(void *arg, uint8_t *buf, int len);
+static void aaa_arrival(void *arg, uint8_t *buf, int len);
+
+/* Over UDP, or over the RadSec connection of the RADIUS identifier. The
+ * argument is the server of the pool. */
+static void aaa_link_send(struct sim_stream *streams, sim_event_cb cb, void *arg, uint8_t *buf, int len) {
+	if (opt.aaa_connections > 0)
+		sim_stream_send(&opt.aaa_link, &streams[buf[1] % opt.aaa_connections], cb, arg, buf, len);
+	else
+		sim_link_send(&opt.aaa_link, cb, arg, buf, len);
+}
+
+/* Sends the Access-Requests written by the RADIUS client, to the server
+ * of the socket. */
+static void drain_radius() {
+	uint8_t buf[MAX_DATA_LEN];
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < opt.aaa_servers; i++) {
+		while ((len = recv(aaa_fd[i], buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+			aaa_link_send(to_aaa, aaa_arrival, (void *) (uintptr_t) i, buf, (int) len);
+	}
+}
+
+static void aaa_count(double now) {
+	size_t second = (size_t) now;
+
+	if (second >= aaa_seconds) {
+		size_t n = aaa_seconds ? aaa_seconds : 64;
+
+		while (n <= second)
+			n *= 2;
+		aaa_per_s = realloc(aaa_per_s, n * sizeof(*aaa_per_s));
+		memset(aaa_per_s + aaa_seconds, 0, (n - aaa_seconds) * sizeof(*aaa_per_s));
+		aaa_seconds = n;
+	}
+	aaa_per_s[second]++;
+}
+
+/* Peak of requests per second of the AAA server since from. */
+static uint32_t aaa_peak(double from, size_t *at) {
+	uint32_t peak = 0;
+	size_t i;
+
+	*at = 0;
+	for (i = from > 0 ? (size_t) from : 0; i < aaa_seconds; i++) {
+		if (aaa_per_s[i] > peak) {
+			peak = aaa_per_s[i];
+			*at = i;
+		}
+	}
+	return peak;
+}
+
+/* Server 0 drops everything during the stall of -Z. */
+static int aaa_stalled(int server) {
+	return server == 0 && opt.stall_at >= 0 && sim_now() >= opt.stall_at &&
+			sim_now() < opt.stall_at + opt.stall_for;
+}
+
+static void aaa_turn(void *arg, uint8_t *buf, int len) {
+	int server = (int) (uintptr_t) arg;
+	uint8_t *answer;
+	int answer_len = 0;
+
+	if (aaa_stalled(server)) {
+		stall_dropped++;
+		return;
+	}
+	aaa_count(sim_now());
+	aaa_server_requests[server]++;
+	sim_trace(SIM_TRACE_TO_AAA, (uint32_t) server, buf, len);
+	answer = sim_aaa_request(buf, len, &answer_len, server);
+	if (answer != NULL) {
+		aaa_link_send(from_aaa, ctrl_radius_arrival, arg, answer, answer_len);
+		free(answer);
+	}
+}
+
+static void aaa_arrival(void *arg, uint8_t *buf, int len) {
+	int server = (int) (uintptr_t) arg;
+
+	sim_schedule(sim_server_enqueue(&aaa_server[server]), aaa_turn, arg, buf, len);
+}
+
+static void ctrl_radius_turn(void *arg, uint8_t *buf, int len) {
+	sim_trace(SIM_TRACE_FROM_AAA, (uint32_t) (uintptr_t) arg, buf, len);
+	sim_alloc_count(1);
+	process_radius_datagram(buf, len);
+	sim_alloc_count(0);
+	drain_radius();
+}
+
+static void ctrl_radius_arrival(void *arg, uint8_t *buf, int len) {
+	sim_schedule(sim_server_enqueue(&ctrl_server), ctrl_radius_turn, arg, buf, len);
+}
+
+/* Over Diameter (-D), through the connection of the hop-by-hop identifier. */
+
+static void ctrl_diameter_arrival(void *arg, uint8_t *buf, int len);
+static void aaa_diameter_arrival(void *arg, uint8_t *buf, int len);
+
+static struct sim_stream *diameter_stream(struct sim_stream *streams, const uint8_t *buf) {
+	uint32_t hbh = ((uint32_t) buf[12] << 24) | ((uint32_t) buf[13] << 16) |
+			((uint32_t) buf[14] << 8) | buf[15];
+
+	return &streams[hbh % (uint32_t) opt.diameter_connections];
+}
+
+/* The transport of the controller's Diameter requests. */
+static int diameter_send(void *ctx, const uint8_t *buf, size_t len) {
+	sim_stream_send(&opt.aaa_link, diameter_stream(to_aaa, buf), aaa_diameter_arrival, NULL,
+			buf, (int) len);
+	return 0;
+}
+
+static void aaa_diameter_turn(void *arg, uint8_t *buf, int len) {
+	uint8_t *answer;
+	int answer_len = 0;
+
+	if (aaa_stalled(0)) {
+		stall_dropped++;
+		return;
+	}
+	aaa_count(sim_now());
+	aaa_server_requests[0]++;
+	sim_trace(SIM_TRACE_TO_AAA, 0, buf, len);
+	answer = sim_aaa_diameter(buf, len, &answer_len);
+	if (answer != NULL) {
+		sim_stream_send(&opt.aaa_link, diameter_stream(from_aaa, answer), ctrl_diameter_arrival, NULL,
+				answer, answer_len);
+		free(answer);
+	}
+}
+
+static void aaa_diameter_arrival(void *arg, uint8_t *buf, int len) {
+	sim_schedule(sim_server_enqueue(&aaa_server[0]), aaa_diameter_turn, arg, buf, len);
+}
+
+static void ctrl_diameter_turn(void *arg, uint8_t *buf, int len) {
+	sim_trace(SIM_TRACE_FROM_AAA, 0, buf, len);
+	sim_alloc_count(1);
+	process_diameter_message(buf, len);
+	sim_alloc_count(0);
+}
+
+static void ctrl_diameter_arrival(void *arg, uint8_t *buf, int len) {
+	sim_schedule(sim_server_enqueue(&ctrl_server), ctrl_diameter_turn, arg, buf, len);
+}
+
+/* Controller <-> devices */
+
+static void device_receive(void *arg, uint8_t *buf, int len) {
+	uint32_t id = (uint32_t) (uintptr_t) arg;
+
+	sim_trace(SIM_TRACE_TO_DEVICE, id, buf, len);
+	sim_device_receive(id, buf, len);
+}
+
+void sim_coap_send(struct sockaddr_storage *addr, uint8_t *buf, size_t len) {
+	uint32_t id;
+
+	if (sim_device_id(addr, &id) == 0)
+		sim_link_send(&opt.device_link, device_receive, (void *) (uintptr_t) id, buf, (int) len);
+}
+
+static void ctrl_coap_turn(void *arg, uint8_t *buf, int len) {
+	uint32_t id = (uint32_t) (uintptr_t) arg;
+	struct sockaddr_storage addr;
+
+	sim_trace(SIM_TRACE_TO_CTRL, id, buf, len);
+	sim_device_address(id, &addr);
+	sim_alloc_count(1);
+	process_coap_datagram(buf, len, &addr);
+	sim_alloc_count(0);
+	drain_radius();
+}
+
+static void ctrl_coap_arrival(void *arg, uint8_t *buf, int len) {
+	sim_schedule(sim_server_enqueue(&ctrl_server), ctrl_coap_turn, arg, buf, len);
+}
+
+static void device_send(uint32_t id, const uint8_t *buf, int len) {
+	sim_link_send(&opt.device_link, ctrl_coap_arrival, (void *) (uintptr_t) id, buf, len);
+}
+
+static void device_done(uint32_t id, double start, double end, int ok) {
+	struct completion c;
+
+	in_progress--;
+	ended++;
+	if (!ok)
+		return;
+
+	c.end = end;
+	c.latency = end - start;
+	completions[ncompletions++] = c;
+}
+
+static void device_reauth(uint32_t id, double start, double end, int ok, int erp) {
+	if (!ok)
+		return;
+	if (nreauth_full == reauth_size || nreauth_erp == reauth_size) {
+		reauth_size = reauth_size ? 2 * reauth_size : 1024;
+		reauth_full = realloc(reauth_full, reauth_size * sizeof(double));
+		reauth_erp = realloc(reauth_erp, reauth_size * sizeof(double));
+	}
+	if (erp)
+		reauth_erp[nreauth_erp++] = end - start;
+	else
+		reauth_full[nreauth_full++] = end - start;
+}
+
+/* Poisson arrivals, only the next one is in the queue. */
+static void device_arrival(void *arg, uint8_t *buf, int len) {
+	uint32_t id = next_device++;
+
+	if (next_device < opt.devices)
+		sim_schedule(sim_now() + sim_exponential(opt.rate), device_arrival, NULL, NULL, 0);
+
+	in_progress++;
+	if (in_progress > max_in_progress)
+		max_in_progress = in_progress;
+	sim_device_start(id);
+}
+
+/* Report */
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* v must be sorted. */
+static double percentile(const double *v, size_t n, double p) {
+	size_t i;
+
+	if (n == 0)
+		return 0;
+	i = (size_t) ceil(p * (double) n);
+	return v[i > 0 ? i - 1 : 0];
+}
+
+static void print_link(FILE *out, const char *name, const struct sim_link *l) {
+	fprintf(out, "\"%s\": {\"latency_ms\": %g, \"jitter_ms\": %g, \"loss\": %g}",
+			name, l->latency * 1e3, l->jitter * 1e3, l->loss);
+}
+
+static void report(FILE *out, double wall) {
+	const struct sim_device_stats *dev = sim_device_get_stats();
+	const struct sim_aaa_stats *aaa = sim_aaa_get_stats();
+	struct erp_cache_stats erp;
+	double *latencies = malloc((ncompletions + 1) * sizeof(double));
+	double *bucket = malloc((ncompletions + 1) * sizeof(double));
+	double last_end = 0, high;
+	size_t i, j, n, b, nbuckets, peak_at;
+	uint32_t peak;
+	uint64_t alloc_bytes, allocs = sim_alloc_get(&alloc_bytes);
+
+	for (i = 0; i < ncompletions; i++) {
+		latencies[i] = completions[i].latency;
+		if (completions[i].end > last_end)
+			last_end = completions[i].end;
+	}
+	qsort(latencies, ncompletions, sizeof(double), compare_double);
+
+	fprintf(out, "{\"simulation\": \"coap-eap\",\n \"config\": {\"devices\": %u, \"rate\": %g, \"seed\": %llu, ",
+			opt.devices, opt.rate, (unsigned long long) opt.seed);
+	print_link(out, "device_link", &opt.device_link);
+	fprintf(out, ", ");
+	print_link(out, "aaa_link", &opt.aaa_link);
+	fprintf(out, ", \"ctrl_service_us\": %g, \"aaa_service_us\": %g, \"give_up_s\": %g, \"mode\": \"%s\"},\n",
+			opt.ctrl_service * 1e6, opt.aaa_service * 1e6, opt.give_up,
+			opt.standalone ? "standalone" : opt.diameter_connections > 0 ? "passthrough-diameter" :
+			"passthrough");
+
+	fprintf(out, " \"devices\": {\"started\": %llu, \"finished\": %llu, \"failed\": %llu, \"stalled\": %llu, "
+			"\"triggers\": %llu, \"posts\": %llu, \"duplicates\": %llu, \"ignored\": %llu, \"max_in_progress\": %u},\n",
+			(unsigned long long) dev->started, (unsigned long long) dev->finished,
+			(unsigned long long) dev->failed, (unsigned long long) dev->stalled,
+			(unsigned long long) dev->triggers, (unsigned long long) dev->posts,
+			(unsigned long long) dev->duplicates, (unsigned long long) dev->ignored, max_in_progress);
+	peak = aaa_peak(0, &peak_at);
+	fprintf(out, " \"aaa\": {\"requests\": %llu, \"challenges\": %llu, \"accepts\": %llu, \"rejects\": %llu, "
+			"\"dropped\": %llu, \"sessions\": %llu, \"peak_per_s\": %u, \"peak_at_s\": %zu},\n",
+			(unsigned long long) aaa->requests, (unsigned long long) aaa->challenges,
+			(unsigned long long) aaa->accepts, (unsigned long long) aaa->rejects,
+			(unsigned long long) aaa->dropped, (unsigned long long) aaa->sessions, peak, peak_at);
+	if (opt.aaa_servers > 1) {
+		struct hostapd_radius_servers *conf = get_rad_client_ctx()->conf;
+		struct hostapd_radius_server *serv;
+
+		fprintf(out, " \"pool\": {\"balance\": %d, \"misrouted\": %llu, \"status_answered\": %llu, "
+				"\"stall_at_s\": %g, \"stall_s\": %g, \"stall_dropped\": %llu, \"servers\": [",
+				opt.balance, (unsigned long long) aaa->misrouted, (unsigned long long) aaa->status,
+				opt.stall_at, opt.stall_for, (unsigned long long) stall_dropped);
+		for (i = 0; i < (size_t) opt.aaa_servers; i++) {
+			serv = &conf->auth_servers[i];
+			fprintf(out, "%s\n  {\"requests\": %llu, \"outstanding\": %u, \"srtt_ms\": %.3f, "
+					"\"alive\": %d, \"downs\": %u, \"probes\": %u}",
+					i ? "," : "", (unsigned long long) aaa_server_requests[i], serv->outstanding,
+					serv->srtt / 1e3, serv->alive, serv->downs, serv->status_probes);
+		}
+		fprintf(out, "]},\n");
+	}
+	if (opt.aaa_connections > 0) {
+		uint64_t retransmits = 0;
+
+		for (i = 0; i < (size_t) opt.aaa_connections; i++)
+			retransmits += to_aaa[i].retransmits + from_aaa[i].retransmits;
+		fprintf(out, " \"radsec\": {\"connections\": %d, \"rto_ms\": %g, \"tcp_retransmits\": %llu},\n",
+				opt.aaa_connections, to_aaa[0].rto * 1e3, (unsigned long long) retransmits);
+	}
+	if (opt.diameter_connections > 0) {
+		struct diameter_stats diameter;
+		uint64_t retransmits = 0;
+
+		for (i = 0; i < (size_t) opt.diameter_connections; i++)
+			retransmits += to_aaa[i].retransmits + from_aaa[i].retransmits;
+		diameter_get_stats(&diameter);
+		fprintf(out, " \"diameter\": {\"connections\": %d, \"rto_ms\": %g, \"tcp_retransmits\": %llu, "
+				"\"requests\": %llu, \"answers\": %llu, \"refused\": %llu, \"unknown\": %llu, "
+				"\"in_flight\": %u},\n",
+				opt.diameter_connections, to_aaa[0].rto * 1e3, (unsigned long long) retransmits,
+				(unsigned long long) diameter.requests, (unsigned long long) diameter.answers,
+				(unsigned long long) diameter.refused, (unsigned long long) diameter.unknown,
+				diameter.in_flight);
+	}
+	if (opt.lifetime > 0) {
+		// The load of the re-authentications alone, the bootstraps are over.
+		peak = dev->reauth_start >= 0 ? aaa_peak(dev->reauth_start, &peak_at) : 0;
+		fprintf(out, " \"reauth\": {\"lifetime_s\": %g, \"jitter_s\": %g, \"rate\": %g, \"horizon_s\": %g, "
+				"\"started\": %llu, \"finished\": %llu, \"failed\": %llu, \"tracked\": %zu, "
+				"\"first_s\": %.3f, \"aaa_peak_per_s\": %u, \"aaa_peak_at_s\": %zu},\n",
+				opt.lifetime, opt.jitter, opt.reauth_rate, opt.horizon,
+				(unsigned long long) dev->reauths, (unsigned long long) dev->reauth_finished,
+				(unsigned long long) dev->reauth_failed, reauth_count(),
+				dev->reauth_start, peak, peak_at);
+
+		// A re-authentication with ERP does not reach the AAA server.
+		qsort(reauth_full, nreauth_full, sizeof(double), compare_double);
+		qsort(reauth_erp, nreauth_erp, sizeof(double), compare_double);
+		erp_cache_get_stats(&erp);
+		fprintf(out, " \"erp\": {\"finished\": %llu, \"full_eap\": %zu, "
+				"\"erp_p50_ms\": %.3f, \"erp_p99_ms\": %.3f, \"full_p50_ms\": %.3f, \"full_p99_ms\": %.3f, "
+				"\"cache\": {\"capacity\": %u, \"entries\": %u, \"bytes\": %zu, \"added\": %llu, "
+				"\"hits\": %llu, \"misses\": %llu, \"hit_rate\": %.3f, \"expired\": %llu, "
+				"\"evicted\": %llu, \"rejected\": %llu}},\n",
+				(unsigned long long) dev->reauth_erp, nreauth_full,
+				percentile(reauth_erp, nreauth_erp, 0.50) * 1e3,
+				percentile(reauth_erp, nreauth_erp, 0.99) * 1e3,
+				percentile(reauth_full, nreauth_full, 0.50) * 1e3,
+				percentile(reauth_full, nreauth_full, 0.99) * 1e3,
+				erp.capacity, erp.entries, erp.bytes, (unsigned long long) erp.added,
+				(unsigned long long) erp.hits, (unsigned long long) erp.misses,
+				erp.hits + erp.misses ? (double) erp.hits / (double) (erp.hits + erp.misses) : 0,
+				(unsigned long long) erp.expired, (unsigned long long) erp.evicted,
+				(unsigned long long) erp.rejected);
+	}
+	// Everything the controller allocates while handling the messages and
+	// alarms, shared among the bootstraps finished.
+	fprintf(out, " \"controller\": {\"allocs\": %llu, \"alloc_bytes\": %llu, "
+			"\"allocs_per_bootstrap\": %.1f, \"bytes_per_bootstrap\": %.1f},\n",
+			(unsigned long long) allocs, (unsigned long long) alloc_bytes,
+			dev->finished ? (double) allocs / (double) dev->finished : 0,
+			dev->finished ? (double) alloc_bytes / (double) dev->finished : 0);
+
+	fprintf(out, " \"virtual_s\": %.6f, \"wall_s\": %.3f, \"speedup\": %.1f, \"throughput\": %.2f,\n",
+			last_end, wall, wall > 0 ? last_end / wall : 0,
+			last_end > 0 ? (double) ncompletions / last_end : 0);
+	fprintf(out, " \"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+			percentile(latencies, ncompletions, 0.50) * 1e3,
+			percentile(latencies, ncompletions, 0.90) * 1e3,
+			percentile(latencies, ncompletions, 0.99) * 1e3,
+			ncompletions ? latencies[ncompletions - 1] * 1e3 : 0);
+
+	// Throughput and latency of the bootstraps finished in each bucket,
+	// completions is ordered by end.
+	fprintf(out, " \"curve\": [");
+	nbuckets = (size_t) (last_end / opt.bucket) + 1;
+	for (b = 0, i = 0; b < nbuckets; b++) {
+		for (n = 0; i < ncompletions && (size_t) (completions[i].end / opt.bucket) == b; i++)
+			bucket[n++] = completions[i].latency;
+		qsort(bucket, n, sizeof(double), compare_double);
+		fprintf(out, "%s\n  {\"t\": %g, \"throughput\": %.2f, \"p50_ms\": %.3f, \"p99_ms\": %.3f}",
+				b ? "," : "", (double) b * opt.bucket, (double) n / opt.bucket,
+				percentile(bucket, n, 0.50) * 1e3, percentile(bucket, n, 0.99) * 1e3);
+	}
+	fprintf(out, "],\n");
+
+	// Latency histogram, buckets of 10 ms doubling their width.
+	fprintf(out, " \"histogram_ms\": [");
+	high = 0.010;
+	for (i = 0, j = 0; j < ncompletions; i++) {
+		for (n = 0; j < ncompletions && latencies[j] < high; j++)
+			n++;
+		fprintf(out, "%s{\"lt\": %g, \"count\": %zu}", i ? ", " : "", high * 1e3, n);
+		high *= 2;
+	}
+	fprintf(out, "],\n");
+
+	fprintf(out, " \"trace_hash\": \"%016llx\"}\n", (unsigned long long) sim_trace_hash());
+
+	free(latencies);
+	free(bucket);
+}
+
+static double wall_clock() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	struct sim_device_config device_config;
+	struct radius_client_data *radius_data;
+	char *aaa_ips[AS_POOL_MAX];
+	int aaa_ports[AS_POOL_MAX];
+	struct os_time status;
+	FILE *out;
+	int sv[2], i;
+	double wall;
+
+	parse_options(argc, argv);
+
+	// The controller prints every message it handles, only the report
+	// goes to stdout.
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	if (!opt.verbose) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		close(null_fd);
+	}
+
+	sim_random_seed(opt.seed);
+	srand((unsigned) opt.seed);
+
+	load_config_server();
+	MODE = opt.standalone ? 0 : 1;
+	if (opt.standalone && (psk_store_load_buffer(DEVICE_IDENTITY " " DEVICE_PSK "\n",
+			sizeof(DEVICE_IDENTITY " " DEVICE_PSK "\n") - 1) < 0 ||
+			eap_auth_set_standalone(psk_store_get, psk_store_get_keys) < 0)) {
+		fprintf(out, "{\"error\": \"cannot initialize the standalone mode\"}\n");
+		return 1;
+	}
+	// Only with -T, the re-authentications are hours away otherwise.
+	if (opt.jitter < 0)
+		opt.jitter = REAUTH_JITTER;
+	if (opt.reauth_rate < 0)
+		opt.reauth_rate = REAUTH_RATE;
+	reauth_init(opt.lifetime, opt.jitter, opt.reauth_rate);
+	// The devices take a POST of a new session for a re-authentication only
+	// once the sessions of their retransmitted triggers have given up.
+	if (opt.lifetime > 0 && reauth_min_delay() < opt.give_up) {
+		fprintf(out, "{\"error\": \"-T %g is too short: the re-authentications start %g s after "
+				"the bootstrap, before -g %g s\"}\n", opt.lifetime, reauth_min_delay(), opt.give_up);
+		return 1;
+	}
+	// The keys are only used by the re-authentications.
+	if (opt.erp_cache < 0)
+		opt.erp_cache = ERP_CACHE_SIZE;
+	if (opt.lifetime > 0 && erp_cache_init((uint32_t) opt.erp_cache, ERP_KEY_LIFETIME) < 0) {
+		fprintf(out, "{\"error\": \"cannot allocate the ERP cache\"}\n");
+		return 1;
+	}
+	pthread_mutex_init(&list_sessions_mutex, NULL);
+	list_alarms_coap_eap = init_alarms_coap();
+
+	// The servers of the pool are AS_IP, at AS_PORT, AS_PORT + 1...
+	for (i = 0; i < opt.aaa_servers; i++) {
+		aaa_ips[i] = AS_IP;
+		aaa_ports[i] = AS_PORT + i;
+	}
+	rad_client_init_pool(aaa_ips, aaa_ports, opt.aaa_servers, AS_SECRET, opt.balance,
+			AS_STATUS_INTERVAL);
+	radius_data = get_rad_client_ctx();
+	if (radius_data == NULL) {
+		fprintf(out, "{\"error\": \"cannot initialize the RADIUS client\"}\n");
+		return 1;
+	}
+	for (i = 0; i < opt.aaa_servers; i++) {
+		struct hostapd_radius_server *serv = &radius_data->conf->auth_servers[i];
+
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0) {
+			fprintf(out, "{\"error\": \"cannot initialize the RADIUS client\"}\n");
+			return 1;
+		}
+		if (serv->sock == radius_data->auth_sock) {
+			close(radius_data->auth_sock);
+			radius_data->auth_sock = sv[0];
+		}
+		else if (serv->sock >= 0)
+			close(serv->sock);
+		serv->sock = sv[0];
+		aaa_fd[i] = sv[1];
+	}
+	if (opt.aaa_connections > 0 || opt.diameter_connections > 0) {
+		int connections = opt.aaa_connections + opt.diameter_connections;
+
+		to_aaa = calloc((size_t) connections, sizeof(*to_aaa));
+		from_aaa = calloc((size_t) connections, sizeof(*from_aaa));
+		for (i = 0; i < connections; i++) {
+			sim_stream_init(&to_aaa[i], &opt.aaa_link);
+			sim_stream_init(&from_aaa[i], &opt.aaa_link);
+		}
+	}
+	// The RADIUS client is kept, but the requests go to diameter_send.
+	if (opt.diameter_connections > 0) {
+		struct diameter_conf diameter_conf;
+
+		memset(&diameter_conf, 0, sizeof(diameter_conf));
+		diameter_conf.connections = opt.diameter_connections;
+		diameter_conf.origin_host = DIAMETER_ORIGIN_HOST;
+		diameter_conf.origin_realm = DIAMETER_ORIGIN_REALM;
+		diameter_conf.destination_realm = DIAMETER_REALM;
+		diameter_conf.transport = diameter_send;
+		if (init_diameter_backend(&diameter_conf) < 0) {
+			fprintf(out, "{\"error\": \"cannot initialize Diameter\"}\n");
+			return 1;
+		}
+	}
+
+	if (opt.capture != NULL) {
+		if (capture_open(opt.capture) < 0) {
+			fprintf(out, "{\"error\": \"cannot create %s\"}\n", opt.capture);
+			return 1;
+		}
+		capture_sockets_init();
+	}
+
+	if (sim_aaa_init(AS_SECRET, DEVICE_PSK) < 0) {
+		fprintf(out, "{\"error\": \"cannot initialize the AAA server\"}\n");
+		return 1;
+	}
+
+	device_config.identity = DEVICE_IDENTITY;
+	device_config.psk = DEVICE_PSK;
+	device_config.ack_timeout = ACK_TIMEOUT;
+	device_config.max_retransmit = MAX_RETRANSMIT;
+	device_config.give_up = opt.give_up;
+	device_config.reauth_after = reauth_min_delay();
+	device_config.erp = erp_cache_enabled();
+	if (sim_devices_init(opt.devices, &device_config, device_send, device_done) < 0) {
+		fprintf(out, "{\"error\": \"cannot allocate the devices\"}\n");
+		return 1;
+	}
+	sim_device_set_reauth_cb(device_reauth);
+
+	ctrl_server.service = opt.ctrl_service;
+	for (i = 0; i < opt.aaa_servers; i++)
+		aaa_server[i].service = opt.aaa_service;
+
+	completions = malloc(opt.devices * sizeof(*completions));
+	sim_schedule(sim_exponential(opt.rate), device_arrival, NULL, NULL, 0);
+
+	wall = wall_clock();
+	for (;;) {
+		double next = sim_next_event();
+		double alarm = list_alarms_coap_eap != NULL ? list_alarms_coap_eap->tmp : -1;
+		double reauth = reauth_next(sim_now());
+
+		// The re-authentications are started by process_alarms too.
+		if (reauth >= 0) {
+			if (reauth < sim_now())
+				reauth = sim_now();
+			if (alarm < 0 || reauth < alarm)
+				alarm = reauth;
+		}
+		// And the Status-Server probes of the pool, while there are
+		// messages in flight: the simulation would not end otherwise.
+		if (next >= 0 && radius_client_status_next(radius_data, &status) == 0) {
+			double probe = (double) status.sec + (double) status.usec / 1e6 + 1e-6;
+			if (probe < sim_now())
+				probe = sim_now();
+			if (alarm < 0 || probe < alarm)
+				alarm = probe;
+		}
+
+		if (next < 0 && alarm < 0)
+			break;
+		// Until every device has ended, and up to the horizon.
+		if (ended >= opt.devices && (next < 0 || next > opt.horizon) &&
+				(alarm < 0 || alarm > opt.horizon))
+			break;
+
+		if (alarm >= 0 && (next < 0 || alarm <= next)) {
+			sim_set_now(alarm);
+			sim_alloc_count(1);
+			process_alarms(alarm + ALARM_EPSILON);
+			sim_alloc_count(0);
+			drain_radius();
+		}
+		else
+			sim_run_next_event();
+	}
+	wall = wall_clock() - wall;
+
+	report(out, wall);
+	fclose(out);
+	capture_close();
+
+	sim_devices_deinit();
+	reauth_deinit();
+	erp_cache_deinit();
+	psk_store_close();
+	free(completions);
+	free(reauth_full);
+	free(reauth_erp);
+	free(aaa_per_s);
+	if (diameter_enabled())
+		diameter_deinit();
+	sim_aaa_deinit();
+	return 0;
+}
@@ -0,0 +1,345 @@
+/**
+ * @file diameter_aaa.c
+ * @brief Diameter EAP server to run the controller against, with the AAA server of the simulation.
+ *
+ * A stand-in for a Diameter AAA server (freeDiameter with its EAP
+ * application, for instance) in the tests of the controller with
+ * DIAMETER_CONNECTIONS: it listens on TCP, answers the Capabilities-
+ * Exchange, Device-Watchdog and Disconnect-Peer requests of every
+ * connection, and the Diameter-EAP-Requests with the EAP-PSK server of
+ * the simulation (sim_aaa_diameter). A request the EAP server drops is
+ * answered with DIAMETER_UNABLE_TO_COMPLY.
+ *
+ *   diameter_aaa [-p port] [-k psk] [-v]
+ *
+ * Every identity is a user of EAP-PSK with the key psk, "passwordpassword"
+ * by default as the PaC of config.xml. It runs until it is killed, and
+ * prints its counters when it gets SIGINT or SIGTERM.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../diameter.h"
+#include "sim.h"
+
+#define MAX_CLIENTS 64
+#define ORIGIN_HOST "aaa.localdomain"
+#define ORIGIN_REALM "localdomain"
+#define PRODUCT_NAME "diameter_aaa"
+
+struct client {
+	int fd;
+	uint8_t *in;
+	size_t in_len;
+	uint8_t *out;
+	size_t out_len;
+	size_t out_size;
+	/**Closed once the answer to its Disconnect-Peer-Request is written.*/
+	int disconnect;
+};
+
+static struct client clients[MAX_CLIENTS];
+static volatile sig_atomic_t stop = 0;
+static int verbose = 0;
+static uint64_t connections = 0, watchdogs = 0, unable = 0;
+
+static void on_signal(int sig) {
+	stop = 1;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: diameter_aaa [-p port] [-k psk] [-v]\n");
+	exit(1);
+}
+
+static uint8_t *reserve(struct client *c, size_t len) {
+	if (c->out_len + len > c->out_size) {
+		size_t size = c->out_size ? c->out_size : 4096;
+		uint8_t *out;
+
+		while (size < c->out_len + len)
+			size *= 2;
+		out = realloc(c->out, size);
+		if (out == NULL)
+			return NULL;
+		c->out = out;
+		c->out_size = size;
+	}
+	return c->out + c->out_len;
+}
+
+/* Answer of a base protocol request, with the AVPs of the CEA if cea. */
+static void answer_base(struct client *c, const struct diameter_msg *req, uint32_t result, int cea) {
+	uint8_t *msg = reserve(c, 512), addr[6];
+	struct sockaddr_in local;
+	socklen_t local_len = sizeof(local);
+	size_t len;
+
+	if (msg == NULL)
+		return;
+	len = diameter_put_header(msg, 0, req->cmd, DIAMETER_APP_COMMON, req->hbh, req->e2e);
+	len += diameter_put_u32(msg + len, DIAMETER_AVP_RESULT_CODE, result);
+	len += diameter_put_avp(msg + len, DIAMETER_AVP_ORIGIN_HOST, ORIGIN_HOST, strlen(ORIGIN_HOST));
+	len += diameter_put_avp(msg + len, DIAMETER_AVP_ORIGIN_REALM, ORIGIN_REALM, strlen(ORIGIN_REALM));
+	if (cea) {
+		memset(&local, 0, sizeof(local));
+		getsockname(c->fd, (struct sockaddr *) &local, &local_len);
+		addr[0] = 0;
+		addr[1] = 1;
+		memcpy(addr + 2, &local.sin_addr, 4);
+		len += diameter_put_avp(msg + len, DIAMETER_AVP_HOST_IP_ADDRESS, addr, sizeof(addr));
+		len += diameter_put_u32(msg + len, DIAMETER_AVP_VENDOR_ID, 0);
+		len += diameter_put_avp(msg + len, DIAMETER_AVP_PRODUCT_NAME, PRODUCT_NAME, strlen(PRODUCT_NAME));
+		len += diameter_put_u32(msg + len, DIAMETER_AVP_AUTH_APPLICATION_ID, DIAMETER_APP_EAP);
+	}
+	diameter_finish(msg, len);
+	c->out_len += len;
+}
+
+static void answer_der(struct client *c, const uint8_t *buf, size_t buf_len, const struct diameter_msg *req) {
+	uint8_t *answer, *msg;
+	int answer_len = 0;
+	size_t len;
+
+	answer = sim_aaa_diameter(buf, (int) buf_len, &answer_len);
+	if (answer != NULL) {
+		msg = reserve(c, (size_t) answer_len);
+		if (msg != NULL) {
+			memcpy(msg, answer, (size_t) answer_len);
+			c->out_len += (size_t) answer_len;
+		}
+		free(answer);
+		return;
+	}
+
+	// RFC 6733, 7.1.5: the server must answer, the session fails.
+	unable++;
+	msg = reserve(c, 256 + req->session_id_len);
+	if (msg == NULL)
+		return;
+	len = diameter_put_header(msg, DIAMETER_FLAG_PROXIABLE, DIAMETER_CMD_DER, DIAMETER_APP_EAP,
+			req->hbh, req->e2e);
+	if (req->session_id != NULL)
+		len += diameter_put_avp(msg + len, DIAMETER_AVP_SESSION_ID, req->session_id, req->session_id_len);
+	len += diameter_put_u32(msg + len, DIAMETER_AVP_AUTH_APPLICATION_ID, DIAMETER_APP_EAP);
+	len += diameter_put_u32(msg + len, DIAMETER_AVP_RESULT_CODE, DIAMETER_UNABLE_TO_COMPLY);
+	len += diameter_put_avp(msg + len, DIAMETER_AVP_ORIGIN_HOST, ORIGIN_HOST, strlen(ORIGIN_HOST));
+	len += diameter_put_avp(msg + len, DIAMETER_AVP_ORIGIN_REALM, ORIGIN_REALM, strlen(ORIGIN_REALM));
+	diameter_finish(msg, len);
+	c->out_len += len;
+}
+
+/* @return -1 if the client must be closed. */
+static int handle_message(struct client *c, const uint8_t *buf, size_t len) {
+	struct diameter_msg msg;
+
+	if (diameter_parse(buf, len, &msg) < 0) {
+		fprintf(stderr, "diameter_aaa: invalid message\n");
+		return -1;
+	}
+	if (!(msg.flags & DIAMETER_FLAG_REQUEST))
+		return 0;
+
+	switch (msg.cmd) {
+	case DIAMETER_CMD_CAPABILITIES_EXCHANGE:
+		if (verbose)
+			fprintf(stderr, "diameter_aaa: peer %.*s\n", (int) msg.origin_host_len,
+					msg.origin_host != NULL ? (const char *) msg.origin_host : "");
+		answer_base(c, &msg, DIAMETER_SUCCESS, 1);
+		break;
+	case DIAMETER_CMD_DEVICE_WATCHDOG:
+		watchdogs++;
+		answer_base(c, &msg, DIAMETER_SUCCESS, 0);
+		break;
+	case DIAMETER_CMD_DISCONNECT_PEER:
+		answer_base(c, &msg, DIAMETER_SUCCESS, 0);
+		c->disconnect = 1;
+		break;
+	case DIAMETER_CMD_DER:
+		answer_der(c, buf, len, &msg);
+		break;
+	default:
+		fprintf(stderr, "diameter_aaa: command %u not supported\n", msg.cmd);
+	}
+	return 0;
+}
+
+static void client_close(struct client *c) {
+	close(c->fd);
+	c->fd = -1;
+	c->in_len = c->out_len = 0;
+	c->disconnect = 0;
+}
+
+static void client_read(struct client *c) {
+	size_t off = 0, len;
+	ssize_t ret;
+
+	ret = recv(c->fd, c->in + c->in_len, 2 * DIAMETER_MAX_LEN - c->in_len, 0);
+	if (ret <= 0) {
+		if (ret < 0 && errno == EINTR)
+			return;
+		client_close(c);
+		return;
+	}
+	c->in_len += (size_t) ret;
+
+	while (c->in_len - off >= DIAMETER_HDR_LEN) {
+		len = diameter_length(c->in + off);
+		if (len < DIAMETER_HDR_LEN || len > DIAMETER_MAX_LEN) {
+			client_close(c);
+			return;
+		}
+		if (c->in_len - off < len)
+			break;
+		if (handle_message(c, c->in + off, len) < 0) {
+			client_close(c);
+			return;
+		}
+		off += len;
+	}
+	memmove(c->in, c->in + off, c->in_len - off);
+	c->in_len -= off;
+}
+
+static void client_write(struct client *c) {
+	ssize_t ret = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+
+	if (ret < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			client_close(c);
+		return;
+	}
+	memmove(c->out, c->out + ret, c->out_len - (size_t) ret);
+	c->out_len -= (size_t) ret;
+	if (c->out_len == 0 && c->disconnect)
+		client_close(c);
+}
+
+int main(int argc, char *argv[]) {
+	const struct sim_aaa_stats *stats;
+	struct sockaddr_in addr;
+	const char *psk = "passwordpassword";
+	int port = DIAMETER_DEFAULT_PORT, listen_fd, fd, maxfd, opt, i;
+	fd_set rset, wset;
+
+	while ((opt = getopt(argc, argv, "p:k:v")) != -1) {
+		switch (opt) {
+		case 'p': port = atoi(optarg); break;
+		case 'k': psk = optarg; break;
+		case 'v': verbose = 1; break;
+		default: usage();
+		}
+	}
+
+	sim_random_seed((uint64_t) time(NULL) ^ (uint64_t) getpid());
+	if (sim_aaa_init("", psk) < 0) {
+		fprintf(stderr, "diameter_aaa: cannot initialize the EAP server\n");
+		return 1;
+	}
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		clients[i].fd = -1;
+		clients[i].in = malloc(2 * DIAMETER_MAX_LEN);
+		if (clients[i].in == NULL)
+			return 1;
+	}
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	opt = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((uint16_t) port);
+	if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+		perror("diameter_aaa");
+		return 1;
+	}
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (verbose)
+		fprintf(stderr, "diameter_aaa: listening on %d\n", port);
+
+	while (!stop) {
+		FD_ZERO(&rset);
+		FD_ZERO(&wset);
+		FD_SET(listen_fd, &rset);
+		maxfd = listen_fd;
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			if (clients[i].fd < 0)
+				continue;
+			FD_SET(clients[i].fd, &rset);
+			if (clients[i].out_len > 0)
+				FD_SET(clients[i].fd, &wset);
+			if (clients[i].fd > maxfd)
+				maxfd = clients[i].fd;
+		}
+		if (select(maxfd + 1, &rset, &wset, NULL, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("diameter_aaa");
+			break;
+		}
+
+		if (FD_ISSET(listen_fd, &rset) && (fd = accept(listen_fd, NULL, NULL)) >= 0) {
+			for (i = 0; i < MAX_CLIENTS && clients[i].fd >= 0; i++)
+				;
+			if (i == MAX_CLIENTS)
+				close(fd);
+			else {
+				opt = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+				clients[i].fd = fd;
+				connections++;
+			}
+		}
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			if (clients[i].fd >= 0 && FD_ISSET(clients[i].fd, &rset))
+				client_read(&clients[i]);
+			// The answers of this round are written at once.
+			if (clients[i].fd >= 0 && clients[i].out_len > 0)
+				client_write(&clients[i]);
+		}
+	}
+
+	stats = sim_aaa_get_stats();
+	printf("{\"connections\": %llu, \"watchdogs\": %llu, \"requests\": %llu, \"challenges\": %llu, "
+			"\"accepts\": %llu, \"rejects\": %llu, \"dropped\": %llu, \"unable_to_comply\": %llu, "
+			"\"sessions\": %llu}\n",
+			(unsigned long long) connections, (unsigned long long) watchdogs,
+			(unsigned long long) stats->requests, (unsigned long long) stats->challenges,
+			(unsigned long long) stats->accepts, (unsigned long long) stats->rejects,
+			(unsigned long long) stats->dropped, (unsigned long long) unable,
+			(unsigned long long) stats->sessions);
+	sim_aaa_deinit();
+	return 0;
+}
@@ -0,0 +1,321 @@
+/**
+ * @file sim.c
+ * @brief Virtual clock, event queue and network of the simulation.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "includes.h"
+#include "os.h"
+#include "radius/radius.h"
+
+#include "sim.h"
+
+struct sim_event {
+	double at;
+	uint64_t seq;
+	sim_event_cb cb;
+	void *arg;
+	uint8_t *buf;
+	int len;
+};
+
+static double now = 0;
+
+/* Binary heap ordered by (at, seq). */
+static struct sim_event *events = NULL;
+static size_t nevents = 0;
+static size_t events_size = 0;
+static uint64_t next_seq = 0;
+
+/* Generators: one for the network, another one for the EAP nonces, so
+ * the nonces do not change the schedule of the messages. */
+static uint64_t net_state = 0;
+static uint64_t eap_state = 0;
+
+static uint64_t trace_hash = 0xcbf29ce484222325ULL;
+
+/* Allocations of the controller, see sim_alloc_count. */
+static int alloc_counting = 0;
+static uint64_t alloc_count = 0;
+static uint64_t alloc_bytes = 0;
+
+double sim_now() {
+	return now;
+}
+
+void sim_set_now(double t) {
+	if (t > now)
+		now = t;
+}
+
+static int event_before(const struct sim_event *a, const struct sim_event *b) {
+	if (a->at != b->at)
+		return a->at < b->at;
+	return a->seq < b->seq;
+}
+
+void sim_schedule(double at, sim_event_cb cb, void *arg, const uint8_t *buf, int len) {
+	struct sim_event ev;
+	size_t i, parent;
+	// The events are sent by the controller, but they are not its own.
+	int counting = alloc_counting;
+
+	alloc_counting = 0;
+	if (nevents == events_size) {
+		events_size = events_size ? events_size * 2 : 1024;
+		events = realloc(events, events_size * sizeof(*events));
+		if (events == NULL)
+			abort();
+	}
+
+	ev.at = at < now ? now : at;
+	ev.seq = next_seq++;
+	ev.cb = cb;
+	ev.arg = arg;
+	ev.buf = NULL;
+	ev.len = len;
+	if (len > 0) {
+		ev.buf = malloc((size_t) len);
+		memcpy(ev.buf, buf, (size_t) len);
+	}
+
+	i = nevents++;
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!event_before(&ev, &events[parent]))
+			break;
+		events[i] = events[parent];
+		i = parent;
+	}
+	events[i] = ev;
+	alloc_counting = counting;
+}
+
+double sim_next_event() {
+	return nevents > 0 ? events[0].at : -1;
+}
+
+size_t sim_pending_events() {
+	return nevents;
+}
+
+void sim_run_next_event() {
+	struct sim_event ev, last;
+	size_t i = 0, child;
+
+	if (nevents == 0)
+		return;
+
+	ev = events[0];
+	last = events[--nevents];
+	while ((child = 2 * i + 1) < nevents) {
+		if (child + 1 < nevents && event_before(&events[child + 1], &events[child]))
+			child++;
+		if (!event_before(&events[child], &last))
+			break;
+		events[i] = events[child];
+		i = child;
+	}
+	if (nevents > 0)
+		events[i] = last;
+
+	sim_set_now(ev.at);
+	ev.cb(ev.arg, ev.buf, ev.len);
+	free(ev.buf);
+}
+
+/* splitmix64 */
+static uint64_t next_random(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+void sim_random_seed(uint64_t seed) {
+	net_state = seed;
+	eap_state = seed ^ 0x5851f42d4c957f2dULL;
+}
+
+uint64_t sim_random() {
+	return next_random(&net_state);
+}
+
+double sim_uniform() {
+	return (double) (sim_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double sim_exponential(double rate) {
+	return -log(1.0 - sim_uniform()) / rate;
+}
+
+int sim_link_send(const struct sim_link *link, sim_event_cb cb, void *arg,
+		const uint8_t *buf, int len) {
+	double delay = link->latency;
+
+	// Both numbers are always drawn, so losing a datagram does not
+	// change the latency of the following ones.
+	double lost = sim_uniform();
+	double jitter = sim_uniform();
+
+	if (lost < link->loss)
+		return 0;
+
+	delay += jitter * link->jitter;
+	sim_schedule(now + delay, cb, arg, buf, len);
+	return 1;
+}
+
+/* RTO of Linux for a steady round trip: the RTT plus its min of 200 ms. The
+ * losses are only recovered by the RTO, without fast retransmission,
+ * which needs the segments that follow. */
+void sim_stream_init(struct sim_stream *stream, const struct sim_link *link) {
+	stream->rto = 0.2 + 2 * (link->latency + link->jitter);
+	stream->last_sent = -1;
+	stream->last_arrival = 0;
+	stream->retransmits = 0;
+}
+
+int sim_stream_send(const struct sim_link *link, struct sim_stream *stream,
+		sim_event_cb cb, void *arg, const uint8_t *buf, int len) {
+	double delay = 0, rto = stream->rto, at;
+	int retransmits = 0;
+
+	if (stream->last_sent != now) {
+		// As in sim_link_send, both numbers are drawn for every try.
+		while (sim_uniform() < link->loss) {
+			sim_uniform();
+			delay += rto;
+			rto *= 2;
+			retransmits++;
+		}
+		delay += link->latency + sim_uniform() * link->jitter;
+		at = now + delay;
+		stream->last_sent = now;
+		stream->last_arrival = at > stream->last_arrival ? at : stream->last_arrival;
+		stream->retransmits += (uint64_t) retransmits;
+	}
+	sim_schedule(stream->last_arrival, cb, arg, buf, len);
+	return retransmits;
+}
+
+double sim_server_enqueue(struct sim_server *server) {
+	double start = server->free_at > now ? server->free_at : now;
+
+	server->free_at = start + server->service;
+	return server->free_at;
+}
+
+static void trace_bytes(const void *data, size_t len) {
+	const uint8_t *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		trace_hash = (trace_hash ^ p[i]) * 0x100000001b3ULL;
+}
+
+void sim_trace(int kind, uint32_t who, const uint8_t *buf, int len) {
+	uint64_t t = (uint64_t) llround(now * 1e9);
+
+	trace_bytes(&kind, sizeof(kind));
+	trace_bytes(&who, sizeof(who));
+	trace_bytes(&t, sizeof(t));
+	trace_bytes(&len, sizeof(len));
+	trace_bytes(buf, (size_t) len);
+}
+
+uint64_t sim_trace_hash() {
+	return trace_hash;
+}
+
+void sim_alloc_count(int on) {
+	alloc_counting = on;
+}
+
+uint64_t sim_alloc_get(uint64_t *bytes) {
+	*bytes = alloc_bytes;
+	return alloc_count;
+}
+
+/*
+ * malloc, calloc and realloc are wrapped (see Makefile) to count the
+ * allocations of the controller; new goes through malloc (sim_device.cpp).
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+static void count_alloc(size_t size) {
+	if (alloc_counting) {
+		alloc_count++;
+		alloc_bytes += size;
+	}
+}
+
+void *__wrap_malloc(size_t size) {
+	count_alloc(size);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+	count_alloc(num * size);
+	return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+	count_alloc(size);
+	return __real_realloc(p, size);
+}
+
+/*
+ * The EAP library takes its nonces from os_get_random and the RADIUS
+ * client its timers from os_get_time; they are replaced at link time
+ * (-Wl,--wrap, see Makefile) so the content of the messages is also
+ * deterministic. So is the Request Authenticator, which
+ * radius_msg_make_authenticator takes from the time and the memory of the
+ * EAP context (its addresses change from run to run).
+ */
+int __wrap_os_get_random(unsigned char *buf, size_t len) {
+	uint64_t r;
+
+	while (len > 0) {
+		size_t n = len < sizeof(r) ? len : sizeof(r);
+		r = next_random(&eap_state);
+		memcpy(buf, &r, n);
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int __wrap_os_get_time(struct os_time *t) {
+	t->sec = (os_time_t) now;
+	t->usec = (os_time_t) ((now - (double) t->sec) * 1e6);
+	return 0;
+}
+
+void __wrap_radius_msg_make_authenticator(struct radius_msg *msg,
+		const u8 *data, size_t len) {
+	__wrap_os_get_random(radius_msg_get_hdr(msg)->authenticator,
+			sizeof(radius_msg_get_hdr(msg)->authenticator));
+}
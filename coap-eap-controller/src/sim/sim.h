@@ -0,0 +1,262 @@
+/**
+ * @file sim.h
+ * @brief Discrete-event simulation of the CoAP-EAP Controller.
+ *
+ * The controller is built with -DSIMULATION and driven by a virtual clock
+ * (getTime returns sim_now) and an in-memory network: the datagrams sent
+ * to the devices and to the AAA server become events of a queue ordered
+ * by time, and the alarms of the sessions are fired when the virtual clock
+ * reaches them. Nothing sleeps, so the simulation runs as fast as the
+ * controller can process the messages.
+ *
+ * Every random decision (arrivals, latency, loss, the controller's rand()
+ * and the EAP nonces) is taken from generators seeded with the seed of the
+ * simulation: two runs with the same configuration give the same result,
+ * which is checked with the hash of the trace of the messages delivered.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** One direction of a link of the simulated network.*/
+struct sim_link {
+	double latency;   /**< One way latency, in seconds.*/
+	double jitter;    /**< Uniform jitter added to the latency, in seconds.*/
+	double loss;      /**< Probability of losing a datagram, 0..1.*/
+};
+
+/**
+ * One direction of a TCP connection over a link, as the ones of RadSec:
+ * the segments lost are retransmitted and the messages are delivered in
+ * order, so a message waits for the ones before it.
+ */
+struct sim_stream {
+	double rto;          /**< Retransmission timeout of the first loss, in seconds.*/
+	double last_sent;    /**< Time the last segment was sent, -1 if none.*/
+	double last_arrival; /**< Time the last segment arrives.*/
+	uint64_t retransmits;
+};
+
+/** A FIFO server: every message takes service seconds to be processed.*/
+struct sim_server {
+	double service;
+	double free_at;
+};
+
+/** Callback of an event. buf is only valid during the call.*/
+typedef void (*sim_event_cb)(void *arg, uint8_t *buf, int len);
+
+/** Virtual time, in seconds.*/
+double sim_now();
+/** Sets the virtual time, it never goes back.*/
+void sim_set_now(double now);
+
+/**
+ * Adds an event to the queue. The data of buf is copied.
+ * Events with the same time are run in the order they were added.
+ */
+void sim_schedule(double at, sim_event_cb cb, void *arg, const uint8_t *buf, int len);
+/** @return Time of the next event, or a negative value if there are none.*/
+double sim_next_event();
+/** Runs the next event, after moving the clock to its time.*/
+void sim_run_next_event();
+/** @return Number of events in the queue.*/
+size_t sim_pending_events();
+
+/** Seeds the generators of the simulation.*/
+void sim_random_seed(uint64_t seed);
+/** @return A random number of the network's generator.*/
+uint64_t sim_random();
+/** @return A random number in [0,1).*/
+double sim_uniform();
+/** @return A random number of an exponential distribution of the given rate.*/
+double sim_exponential(double rate);
+
+/**
+ * Sends a datagram through a link: the event is scheduled after the
+ * latency of the link, unless the datagram is lost.
+ *
+ * @return 1 if the datagram is delivered, 0 if it is lost.
+ */
+int sim_link_send(const struct sim_link *link, sim_event_cb cb, void *arg,
+		const uint8_t *buf, int len);
+/** Starts a stream over the link, with the RTO of a TCP connection.*/
+void sim_stream_init(struct sim_stream *stream, const struct sim_link *link);
+/**
+ * Sends a message through a stream. The messages sent at the same time
+ * go in the same segment, which is retransmitted after rto, 2 rto, 4
+ * rto... while it is lost.
+ *
+ * @return The number of retransmissions of the message.
+ */
+int sim_stream_send(const struct sim_link *link, struct sim_stream *stream,
+		sim_event_cb cb, void *arg, const uint8_t *buf, int len);
+/**
+ * @return Time at which a message arriving now is processed by the server.
+ */
+double sim_server_enqueue(struct sim_server *server);
+
+/** Adds a delivered datagram to the hash of the trace.*/
+void sim_trace(int kind, uint32_t who, const uint8_t *buf, int len);
+/** @return Hash of the trace.*/
+uint64_t sim_trace_hash();
+
+/**
+ * Counts the allocations (malloc, calloc, realloc and new) made while on
+ * is not 0, the ones of the controller. The allocations of the simulation
+ * itself are never counted.
+ */
+void sim_alloc_count(int on);
+/** @return Allocations counted, and their bytes in bytes.*/
+uint64_t sim_alloc_get(uint64_t *bytes);
+
+/** Kinds of the trace.*/
+#define SIM_TRACE_TO_DEVICE   1
+#define SIM_TRACE_TO_CTRL     2
+#define SIM_TRACE_TO_AAA      3
+#define SIM_TRACE_FROM_AAA    4
+
+/*
+ * Emulated AAA server (sim_aaa.c), a RADIUS (or Diameter) server with EAP-PSK.
+ */
+
+/** Number of messages handled by the AAA server.*/
+struct sim_aaa_stats {
+	uint64_t requests;
+	uint64_t challenges;
+	uint64_t accepts;
+	uint64_t rejects;
+	uint64_t dropped;
+	uint64_t sessions;
+	/** Requests with the State of a session of another server, dropped.*/
+	uint64_t misrouted;
+	/** Status-Server probes answered.*/
+	uint64_t status;
+};
+
+/** Initializes the AAA server with the shared secret of the controller.*/
+int sim_aaa_init(const char *secret, const char *psk);
+/**
+ * Processes an Access-Request or a Status-Server received by a server of
+ * the pool. All the servers share the sessions, but a session is only
+ * known by the server that started it.
+ *
+ * @return The answer, to be freed with free(), or NULL if there is none.
+ */
+uint8_t *sim_aaa_request(const uint8_t *buf, int len, int *answer_len, int server);
+/**
+ * Processes a Diameter-EAP-Request, the sessions are the same as the
+ * Access-Requests' ones (of the server 0). The capabilities exchange and
+ * the watchdogs are left to the caller.
+ *
+ * @return The Diameter-EAP-Answer, to be freed with free(), or NULL if
+ * there is none.
+ */
+uint8_t *sim_aaa_diameter(const uint8_t *buf, int len, int *answer_len);
+/** @return The counters of the AAA server.*/
+const struct sim_aaa_stats *sim_aaa_get_stats();
+void sim_aaa_deinit();
+
+/*
+ * Emulated devices (sim_device.cpp), each one runs an EAP peer.
+ */
+
+/** Configuration of the devices.*/
+struct sim_device_config {
+	const char *identity;
+	const char *psk;
+	/** Initial timeout of the request that starts the exchange.*/
+	double ack_timeout;
+	/** Retransmissions of the request that starts the exchange.*/
+	int max_retransmit;
+	/** A device gives up if it has not finished after this time.*/
+	double give_up;
+	/**
+	 * A device that has finished accepts a POST of a new session (a
+	 * re-authentication) once this time has passed, 0 if it never does:
+	 * reauth_min_delay(), the controller cannot start it before. It must
+	 * be longer than the sessions started by retransmissions of the
+	 * trigger can last, and than give_up: a re-authentication also gives
+	 * up after give_up.
+	 */
+	double reauth_after;
+	/**
+	 * The devices keep the ERP keys (erp.h) of their full authentication,
+	 * and answer the EAP-Initiate/Re-auth-Start with them.
+	 */
+	int erp;
+};
+
+/** Counters of the devices.*/
+struct sim_device_stats {
+	uint64_t started;
+	uint64_t finished;
+	uint64_t failed;       /**< EAP failure or no answer to the trigger.*/
+	uint64_t stalled;      /**< Bound to a session that did not finish.*/
+	uint64_t triggers;     /**< Requests sent to start the exchange.*/
+	uint64_t posts;        /**< POSTs received.*/
+	uint64_t duplicates;   /**< POSTs received again, answered from the cache.*/
+	uint64_t ignored;      /**< POSTs of other sessions of the device.*/
+	uint64_t reauths;      /**< Re-authentications started by the controller.*/
+	uint64_t reauth_finished;
+	uint64_t reauth_failed;
+	uint64_t reauth_erp;   /**< Re-authentications finished with ERP.*/
+	double reauth_start;   /**< Time of the first re-authentication, -1 if none.*/
+};
+
+/** Sends a datagram from a device to the controller.*/
+typedef void (*sim_device_send_cb)(uint32_t id, const uint8_t *buf, int len);
+/** Called when a device finishes (ok is 1) or gives up (ok is 0).*/
+typedef void (*sim_device_done_cb)(uint32_t id, double start, double end, int ok);
+/** Called when a re-authentication finishes, erp is 1 if it was done with ERP.*/
+typedef void (*sim_device_reauth_cb)(uint32_t id, double start, double end, int ok, int erp);
+
+/**
+ * Allocates n devices, they are started with sim_device_start.
+ */
+int sim_devices_init(uint32_t n, const struct sim_device_config *config,
+		sim_device_send_cb send, sim_device_done_cb done);
+/** Sets the callback of the re-authentications, none by default.*/
+void sim_device_set_reauth_cb(sim_device_reauth_cb reauth);
+/** Starts the bootstrapping of a device now.*/
+void sim_device_start(uint32_t id);
+/** Delivers a datagram of the controller to a device.*/
+void sim_device_receive(uint32_t id, const uint8_t *buf, int len);
+/** Address of a device, as seen by the controller.*/
+void sim_device_address(uint32_t id, struct sockaddr_storage *addr);
+/** @return 0 if addr is the address of a device, its id in id.*/
+int sim_device_id(const struct sockaddr_storage *addr, uint32_t *id);
+/** @return The counters of the devices.*/
+const struct sim_device_stats *sim_device_get_stats();
+void sim_devices_deinit();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
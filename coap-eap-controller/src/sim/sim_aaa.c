@@ -0,0 +1,381 @@
+/**
+ * @file sim_aaa.c
+ * @brief Emulated AAA server of the simulation.
+ *
+ * A RADIUS server with EAP-PSK, it encapsulates the EAP server the same
+ * way as radius_server.c (State attribute, MS-MPPE keys in the
+ * Access-Accept, Message-Authenticator), but it is called directly with
+ * the datagrams of the simulated network instead of reading a socket in
+ * the eloop.
+ *
+ * As the AAA server used with the controller, a new session answers first
+ * with an EAP Request/Identity (see eap_workarround in mainserver.cpp).
+ *
+ * The same sessions are also reached with Diameter-EAP-Requests
+ * (sim_aaa_diameter), the Diameter EAP application of diameter.h: the
+ * State AVP holds the session, and the MSK goes in the
+ * EAP-Master-Session-Key AVP of the answer.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "includes.h"
+#include "common.h"
+#include "eap_server/eap.h"
+#include "eap_server/eap_methods.h"
+#include "radius/radius.h"
+
+#include "uthash.h"
+#include "diameter.h"
+#include "sim.h"
+
+struct aaa_session {
+	uint32_t sess_id;
+	/** Server of the pool that holds the session.*/
+	int server;
+	struct eap_sm *eap;
+	struct eap_eapol_interface *eap_if;
+	UT_hash_handle hh;
+};
+
+/* Identity of the Diameter server. */
+#define SIM_AAA_ORIGIN_HOST "aaa.localdomain"
+#define SIM_AAA_ORIGIN_REALM "localdomain"
+
+static struct aaa_session *sessions = NULL;
+static uint32_t next_sess_id = 1;
+static struct eap_method *aaa_methods = NULL;
+static char *aaa_secret = NULL;
+static char *aaa_psk = NULL;
+static struct sim_aaa_stats stats;
+
+/* Every identity is a user of EAP-PSK with the same key. */
+static int aaa_get_eap_user(void *ctx, const u8 *identity, size_t identity_len,
+		int phase2, struct eap_user *user) {
+
+	os_memset(user, 0, sizeof(*user));
+	user->methods[0].vendor = EAP_VENDOR_IETF;
+	user->methods[0].method = EAP_TYPE_PSK;
+	user->password = (u8 *) os_strdup(aaa_psk);
+	user->password_len = os_strlen(aaa_psk);
+	return 0;
+}
+
+static const char *aaa_get_eap_req_id_text(void *ctx, size_t *len) {
+	*len = 0;
+	return NULL;
+}
+
+static struct eapol_callbacks aaa_eapol_cb = {
+	.get_eap_user = aaa_get_eap_user,
+	.get_eap_req_id_text = aaa_get_eap_req_id_text,
+};
+
+static struct aaa_session *aaa_new_session(int server) {
+	struct aaa_session *sess = os_zalloc(sizeof(*sess));
+	struct eap_config eap_conf;
+
+	if (sess == NULL)
+		return NULL;
+
+	os_memset(&eap_conf, 0, sizeof(eap_conf));
+	eap_conf.backend_auth = TRUE;
+	eap_conf.eap_server = 1;
+	eap_conf.eap_methods = aaa_methods;
+
+	sess->eap = eap_server_sm_init(sess, &aaa_eapol_cb, &eap_conf);
+	if (sess->eap == NULL) {
+		os_free(sess);
+		return NULL;
+	}
+	sess->eap_if = eap_get_interface(sess->eap);
+	sess->eap_if->portEnabled = TRUE;
+	sess->eap_if->eapRestart = TRUE;
+
+	sess->sess_id = next_sess_id++;
+	sess->server = server;
+	HASH_ADD_INT(sessions, sess_id, sess);
+	stats.sessions++;
+	return sess;
+}
+
+static void aaa_free_session(struct aaa_session *sess) {
+	HASH_DEL(sessions, sess);
+	eap_server_sm_deinit(sess->eap);
+	os_free(sess);
+}
+
+/* Steps the EAP server of the session of a request: a new one if the
+ * request has no State. eap is allocated and taken by the session. The
+ * session must then be answered, it is NULL if the request is dropped. */
+static struct aaa_session *aaa_step(const u8 *state, u8 *eap, size_t eap_len, int server) {
+	struct aaa_session *sess = NULL;
+
+	if (state != NULL) {
+		uint32_t sess_id = WPA_GET_BE32(state);
+		HASH_FIND_INT(sessions, &sess_id, sess);
+		if (sess == NULL) {
+			stats.dropped++;
+			os_free(eap);
+			return NULL;
+		}
+		// Another server of the pool does not know the State.
+		if (sess->server != server) {
+			stats.misrouted++;
+			stats.dropped++;
+			os_free(eap);
+			return NULL;
+		}
+
+		if (eap == NULL) {
+			stats.dropped++;
+			return NULL;
+		}
+		wpabuf_free(sess->eap_if->eapRespData);
+		sess->eap_if->eapRespData = wpabuf_alloc_ext_data(eap, eap_len);
+		sess->eap_if->eapResp = TRUE;
+	}
+	else {
+		// The EAP response of the request is not used: the EAP
+		// server starts with its own Request/Identity.
+		sess = aaa_new_session(server);
+		if (sess == NULL) {
+			stats.dropped++;
+			return NULL;
+		}
+	}
+
+	eap_server_sm_step(sess->eap);
+
+	if (!((sess->eap_if->eapReq || sess->eap_if->eapSuccess || sess->eap_if->eapFail) &&
+			sess->eap_if->eapReqData) && !sess->eap_if->eapFail) {
+		stats.dropped++;
+		return NULL;
+	}
+	return sess;
+}
+
+/* Result of the session once stepped, as a RADIUS code. */
+static int aaa_result(struct aaa_session *sess) {
+
+	if (sess->eap_if->eapFail) {
+		sess->eap_if->eapFail = FALSE;
+		stats.rejects++;
+		return RADIUS_CODE_ACCESS_REJECT;
+	} else if (sess->eap_if->eapSuccess) {
+		sess->eap_if->eapSuccess = FALSE;
+		stats.accepts++;
+		return RADIUS_CODE_ACCESS_ACCEPT;
+	}
+	sess->eap_if->eapReq = FALSE;
+	stats.challenges++;
+	return RADIUS_CODE_ACCESS_CHALLENGE;
+}
+
+/* Builds the answer as radius_server_encapsulate_eap does. */
+static struct radius_msg *aaa_encapsulate_eap(struct aaa_session *sess, struct radius_msg *request) {
+	struct radius_hdr *hdr = radius_msg_get_hdr(request);
+	struct radius_msg *msg;
+	unsigned int sess_id;
+	int code = aaa_result(sess);
+
+	msg = radius_msg_new(code, hdr->identifier);
+	if (msg == NULL)
+		return NULL;
+
+	sess_id = htonl(sess->sess_id);
+	if (code == RADIUS_CODE_ACCESS_CHALLENGE)
+		radius_msg_add_attr(msg, RADIUS_ATTR_STATE, (u8 *) &sess_id, sizeof(sess_id));
+
+	if (sess->eap_if->eapReqData)
+		radius_msg_add_eap(msg, wpabuf_head(sess->eap_if->eapReqData),
+				wpabuf_len(sess->eap_if->eapReqData));
+
+	if (code == RADIUS_CODE_ACCESS_ACCEPT && sess->eap_if->eapKeyData) {
+		int len = sess->eap_if->eapKeyDataLen > 64 ? 32 : sess->eap_if->eapKeyDataLen / 2;
+
+		radius_msg_add_mppe_keys(msg, hdr->authenticator,
+				(u8 *) aaa_secret, os_strlen(aaa_secret),
+				sess->eap_if->eapKeyData + len, len,
+				sess->eap_if->eapKeyData, len);
+	}
+
+	radius_msg_finish_srv(msg, (u8 *) aaa_secret, os_strlen(aaa_secret), hdr->authenticator);
+	return msg;
+}
+
+int sim_aaa_init(const char *secret, const char *psk) {
+
+	if (eap_server_identity_register(&aaa_methods) < 0 ||
+			eap_server_psk_register(&aaa_methods) < 0)
+		return -1;
+
+	aaa_secret = os_strdup(secret);
+	aaa_psk = os_strdup(psk);
+	os_memset(&stats, 0, sizeof(stats));
+	return 0;
+}
+
+/* Status-Server (RFC 5997): the server is alive. */
+static struct radius_msg *aaa_status(struct radius_msg *request) {
+	struct radius_hdr *hdr = radius_msg_get_hdr(request);
+	struct radius_msg *msg = radius_msg_new(RADIUS_CODE_ACCESS_ACCEPT, hdr->identifier);
+
+	if (msg != NULL)
+		radius_msg_finish_srv(msg, (u8 *) aaa_secret, os_strlen(aaa_secret), hdr->authenticator);
+	return msg;
+}
+
+uint8_t *sim_aaa_request(const uint8_t *buf, int len, int *answer_len, int server) {
+	struct radius_msg *msg, *reply;
+	struct aaa_session *sess = NULL;
+	struct wpabuf *reply_buf;
+	u8 statebuf[4];
+	u8 *eap;
+	size_t eap_len;
+	uint8_t *answer = NULL;
+
+	stats.requests++;
+
+	msg = radius_msg_parse(buf, (size_t) len);
+	if (msg == NULL || radius_msg_verify_msg_auth(msg, (u8 *) aaa_secret, os_strlen(aaa_secret), NULL)) {
+		stats.dropped++;
+		goto out;
+	}
+	if (radius_msg_get_hdr(msg)->code == RADIUS_CODE_STATUS_SERVER) {
+		stats.status++;
+		reply = aaa_status(msg);
+		goto answer;
+	}
+	if (radius_msg_get_hdr(msg)->code != RADIUS_CODE_ACCESS_REQUEST) {
+		stats.dropped++;
+		goto out;
+	}
+
+	if (radius_msg_get_attr(msg, RADIUS_ATTR_STATE, statebuf, sizeof(statebuf)) == sizeof(statebuf)) {
+		eap = radius_msg_get_eap(msg, &eap_len);
+		sess = aaa_step(statebuf, eap, eap_len, server);
+	} else
+		sess = aaa_step(NULL, NULL, 0, server);
+	if (sess == NULL)
+		goto out;
+
+	reply = aaa_encapsulate_eap(sess, msg);
+answer:
+	if (reply != NULL) {
+		reply_buf = radius_msg_get_buf(reply);
+		*answer_len = (int) wpabuf_len(reply_buf);
+		answer = os_malloc(wpabuf_len(reply_buf));
+		os_memcpy(answer, wpabuf_head(reply_buf), wpabuf_len(reply_buf));
+		radius_msg_free(reply);
+	}
+
+	// The controller does not retransmit, finished sessions are removed
+	// at once.
+	if (sess != NULL && answer != NULL && answer[0] != RADIUS_CODE_ACCESS_CHALLENGE)
+		aaa_free_session(sess);
+
+out:
+	if (msg != NULL)
+		radius_msg_free(msg);
+	return answer;
+}
+
+uint8_t *sim_aaa_diameter(const uint8_t *buf, int len, int *answer_len) {
+	struct diameter_msg msg;
+	struct aaa_session *sess;
+	uint8_t *answer, sess_id[4];
+	size_t size, pos;
+	u8 *eap = NULL;
+	int code;
+
+	stats.requests++;
+
+	if (diameter_parse(buf, (size_t) len, &msg) < 0 || msg.cmd != DIAMETER_CMD_DER ||
+			!(msg.flags & DIAMETER_FLAG_REQUEST) || msg.session_id == NULL ||
+			(msg.state != NULL && msg.state_len != sizeof(sess_id))) {
+		stats.dropped++;
+		return NULL;
+	}
+	if (msg.state != NULL) {
+		if (msg.eap != NULL)
+			eap = os_malloc(msg.eap_len);
+		if (eap != NULL)
+			os_memcpy(eap, msg.eap, msg.eap_len);
+		sess = aaa_step(msg.state, eap, msg.eap_len, 0);
+	} else
+		sess = aaa_step(NULL, NULL, 0, 0);
+	if (sess == NULL)
+		return NULL;
+
+	code = aaa_result(sess);
+	size = DIAMETER_HDR_LEN + DIAMETER_AVP_SIZE(msg.session_id_len) + 2 * DIAMETER_AVP_SIZE(4) +
+		DIAMETER_AVP_SIZE(strlen(SIM_AAA_ORIGIN_HOST)) + DIAMETER_AVP_SIZE(strlen(SIM_AAA_ORIGIN_REALM)) +
+		DIAMETER_AVP_SIZE(sizeof(sess_id)) +
+		(sess->eap_if->eapReqData ? DIAMETER_AVP_SIZE(wpabuf_len(sess->eap_if->eapReqData)) : 0) +
+		(sess->eap_if->eapKeyData ? DIAMETER_AVP_SIZE(sess->eap_if->eapKeyDataLen) : 0);
+	answer = os_malloc(size);
+	if (answer == NULL) {
+		aaa_free_session(sess);
+		return NULL;
+	}
+
+	pos = diameter_put_header(answer, DIAMETER_FLAG_PROXIABLE, DIAMETER_CMD_DER, DIAMETER_APP_EAP,
+			msg.hbh, msg.e2e);
+	pos += diameter_put_avp(answer + pos, DIAMETER_AVP_SESSION_ID, msg.session_id, msg.session_id_len);
+	pos += diameter_put_u32(answer + pos, DIAMETER_AVP_AUTH_APPLICATION_ID, DIAMETER_APP_EAP);
+	pos += diameter_put_u32(answer + pos, DIAMETER_AVP_RESULT_CODE,
+			code == RADIUS_CODE_ACCESS_CHALLENGE ? DIAMETER_MULTI_ROUND_AUTH :
+			code == RADIUS_CODE_ACCESS_ACCEPT ? DIAMETER_SUCCESS : DIAMETER_AUTHENTICATION_REJECTED);
+	pos += diameter_put_avp(answer + pos, DIAMETER_AVP_ORIGIN_HOST, SIM_AAA_ORIGIN_HOST,
+			strlen(SIM_AAA_ORIGIN_HOST));
+	pos += diameter_put_avp(answer + pos, DIAMETER_AVP_ORIGIN_REALM, SIM_AAA_ORIGIN_REALM,
+			strlen(SIM_AAA_ORIGIN_REALM));
+	if (sess->eap_if->eapReqData)
+		pos += diameter_put_avp(answer + pos, DIAMETER_AVP_EAP_PAYLOAD,
+				wpabuf_head(sess->eap_if->eapReqData), wpabuf_len(sess->eap_if->eapReqData));
+	if (code == RADIUS_CODE_ACCESS_CHALLENGE) {
+		WPA_PUT_BE32(sess_id, sess->sess_id);
+		pos += diameter_put_avp(answer + pos, DIAMETER_AVP_STATE, sess_id, sizeof(sess_id));
+	}
+	if (code == RADIUS_CODE_ACCESS_ACCEPT && sess->eap_if->eapKeyData)
+		pos += diameter_put_avp(answer + pos, DIAMETER_AVP_EAP_MASTER_SESSION_KEY,
+				sess->eap_if->eapKeyData, sess->eap_if->eapKeyDataLen);
+	diameter_finish(answer, pos);
+	*answer_len = (int) pos;
+
+	// As with RADIUS, finished sessions are removed at once.
+	if (code != RADIUS_CODE_ACCESS_CHALLENGE)
+		aaa_free_session(sess);
+	return answer;
+}
+
+const struct sim_aaa_stats *sim_aaa_get_stats() {
+	return &stats;
+}
+
+void sim_aaa_deinit() {
+	struct aaa_session *sess, *tmp;
+
+	HASH_ITER(hh, sessions, sess, tmp) {
+		aaa_free_session(sess);
+	}
+	eap_server_unregister_methods(&aaa_methods);
+	os_free(aaa_secret);
+	os_free(aaa_psk);
+}
@@ -0,0 +1,451 @@
+/**
+ * @file sim_device.cpp
+ * @brief Emulated devices of the simulation.
+ *
+ * Every device starts the exchange with a non-confirmable POST to
+ * /.well-known/coap-eap, retransmitted with exponential back-off until the
+ * first POST of the controller arrives, and then answers each POST with
+ * an ACK carrying the EAP response of its EAP peer (eap_peer_interface.c).
+ * The exchange is finished when the POST with the OSCORE option arrives.
+ *
+ * With ERP (../erp.h) the devices keep the keys of their last full
+ * authentication, and answer the Re-auth-Start of a re-authentication
+ * with an EAP-Initiate/Re-auth.
+ *
+ * A device only talks with the first session that reaches it: the POSTs
+ * of the sessions started by the retransmissions of its first request are
+ * ignored, as the controller times them out.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <new>
+
+extern "C" {
+#include "../libeapstack/eap_peer_interface.h"
+}
+
+#include "../cantcoap-master/cantcoap.h"
+#include "../erp.h"
+#include "sim.h"
+
+#define DEVICE_BUF_LEN 500
+#define DEVICE_PORT 5683
+
+enum device_state {
+	DEVICE_IDLE = 0,
+	DEVICE_TRIGGER,   /**< Waiting for the first POST.*/
+	DEVICE_BOUND,     /**< Talking with a session of the controller.*/
+	DEVICE_DONE,
+	DEVICE_FAILED
+};
+
+struct sim_device {
+	uint8_t state;
+	uint8_t retransmits;
+	/** Bound to a re-authentication.*/
+	uint8_t reauth;
+	/** The re-authentication has been done with ERP.*/
+	uint8_t erp_used;
+	uint16_t trigger_mid;
+	/** SEQ of the last EAP-Initiate/Re-auth.*/
+	uint16_t erp_seq;
+	uint32_t token;
+	double rt;
+	double start;
+	double end;
+	/** Last ACK sent, for the POSTs received again.*/
+	uint16_t last_mid;
+	uint16_t last_ack_len;
+	uint8_t *last_ack;
+	struct eap_peer_ctx *peer;
+	/** Keys of ERP, NULL until a full authentication succeeds.*/
+	struct erp_keys *erp;
+};
+
+static struct sim_device *devices = NULL;
+static uint32_t ndevices = 0;
+static struct sim_device_config config;
+static sim_device_send_cb send_cb = NULL;
+static sim_device_done_cb done_cb = NULL;
+static sim_device_reauth_cb reauth_cb = NULL;
+static struct sim_device_stats stats;
+
+static void *device_arg(uint32_t id) {
+	return (void *) (uintptr_t) id;
+}
+
+static uint32_t device_from_arg(void *arg) {
+	return (uint32_t) (uintptr_t) arg;
+}
+
+static void free_peer(struct sim_device *dev) {
+	if (dev->peer != NULL) {
+		eap_peer_deinit(dev->peer, &dev->peer->eap_methods);
+		free(dev->peer);
+		dev->peer = NULL;
+	}
+}
+
+static int new_peer(struct sim_device *dev) {
+	dev->peer = (struct eap_peer_ctx *) malloc(sizeof(*dev->peer));
+	if (eap_peer_init(dev->peer, dev, (char *) config.identity, (char *) config.psk,
+			(char *) "", (char *) "", (char *) "", (char *) "", 1398) < 0) {
+		free(dev->peer);
+		dev->peer = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* Keeps the keys of ERP of the full authentication just finished. */
+static void keep_erp_keys(struct sim_device *dev) {
+	const u8 *msk;
+	size_t len;
+
+	if (!config.erp || dev->peer == NULL)
+		return;
+	msk = eap_peer_get_eapKeyData(dev->peer, &len);
+	if (msk == NULL)
+		return;
+	if (dev->erp == NULL)
+		dev->erp = (struct erp_keys *) malloc(sizeof(*dev->erp));
+	erp_derive(msk, len, dev->erp);
+	dev->erp_seq = 0;
+}
+
+static void device_finish(uint32_t id, int state) {
+	struct sim_device *dev = &devices[id];
+
+	// A re-authentication does not end the device, it keeps its keys
+	// until the session expires if it fails.
+	if (dev->reauth) {
+		if (state == DEVICE_DONE)
+			stats.reauth_finished++;
+		else
+			stats.reauth_failed++;
+		if (reauth_cb != NULL)
+			reauth_cb(id, dev->start, sim_now(), state == DEVICE_DONE, dev->erp_used);
+		dev->reauth = 0;
+		dev->state = DEVICE_DONE;
+		dev->end = sim_now();
+		free_peer(dev);
+		return;
+	}
+
+	if (state == DEVICE_DONE)
+		stats.finished++;
+	else if (dev->state == DEVICE_BOUND)
+		stats.stalled++;
+	else
+		stats.failed++;
+
+	dev->state = (uint8_t) state;
+	dev->end = sim_now();
+	free_peer(dev);
+	done_cb(id, dev->start, sim_now(), state == DEVICE_DONE);
+}
+
+static void send_trigger(uint32_t id) {
+	struct sim_device *dev = &devices[id];
+	CoapPDU pdu;
+
+	pdu.setVersion(1);
+	pdu.setType(CoapPDU::COAP_NON_CONFIRMABLE);
+	pdu.setCode(CoapPDU::COAP_POST);
+	pdu.setMessageID(dev->trigger_mid);
+	pdu.setURI((char *) "/.well-known/coap-eap");
+
+	stats.triggers++;
+	send_cb(id, pdu.getPDUPointer(), pdu.getPDULength());
+}
+
+static void trigger_timeout(void *arg, uint8_t *buf, int len) {
+	uint32_t id = device_from_arg(arg);
+	struct sim_device *dev = &devices[id];
+
+	if (dev->state != DEVICE_TRIGGER)
+		return;
+
+	if (dev->retransmits >= config.max_retransmit) {
+		device_finish(id, DEVICE_FAILED);
+		return;
+	}
+
+	dev->retransmits++;
+	dev->rt *= 2;
+	send_trigger(id);
+	sim_schedule(sim_now() + dev->rt, trigger_timeout, arg, NULL, 0);
+}
+
+static void give_up(void *arg, uint8_t *buf, int len) {
+	uint32_t id = device_from_arg(arg);
+
+	if (devices[id].state == DEVICE_TRIGGER || devices[id].state == DEVICE_BOUND)
+		device_finish(id, DEVICE_FAILED);
+}
+
+static void send_ack(uint32_t id, CoapPDU *ack) {
+	struct sim_device *dev = &devices[id];
+
+	free(dev->last_ack);
+	dev->last_ack_len = (uint16_t) ack->getPDULength();
+	dev->last_ack = (uint8_t *) malloc(dev->last_ack_len);
+	memcpy(dev->last_ack, ack->getPDUPointer(), dev->last_ack_len);
+	dev->last_mid = ack->getMessageID();
+
+	send_cb(id, dev->last_ack, dev->last_ack_len);
+}
+
+int sim_devices_init(uint32_t n, const struct sim_device_config *conf,
+		sim_device_send_cb send, sim_device_done_cb done) {
+
+	devices = (struct sim_device *) calloc(n, sizeof(*devices));
+	if (devices == NULL)
+		return -1;
+
+	ndevices = n;
+	config = *conf;
+	send_cb = send;
+	done_cb = done;
+	memset(&stats, 0, sizeof(stats));
+	stats.reauth_start = -1;
+	return 0;
+}
+
+void sim_device_set_reauth_cb(sim_device_reauth_cb reauth) {
+	reauth_cb = reauth;
+}
+
+void sim_device_start(uint32_t id) {
+	struct sim_device *dev = &devices[id];
+
+	if (new_peer(dev) < 0) {
+		device_finish(id, DEVICE_FAILED);
+		return;
+	}
+
+	stats.started++;
+	dev->state = DEVICE_TRIGGER;
+	dev->start = sim_now();
+	dev->trigger_mid = (uint16_t) sim_random();
+	// ACK_TIMEOUT * [1, ACK_RANDOM_FACTOR] as in RFC 7252
+	dev->rt = config.ack_timeout * (1 + 0.5 * sim_uniform());
+
+	send_trigger(id);
+	sim_schedule(sim_now() + dev->rt, trigger_timeout, device_arg(id), NULL, 0);
+	sim_schedule(sim_now() + config.give_up, give_up, device_arg(id), NULL, 0);
+}
+
+void sim_device_receive(uint32_t id, const uint8_t *buf, int len) {
+	struct sim_device *dev = &devices[id];
+	uint8_t copy[DEVICE_BUF_LEN];
+	uint32_t token;
+
+	if (len <= 0 || len > DEVICE_BUF_LEN)
+		return;
+	memcpy(copy, buf, (size_t) len);
+
+	CoapPDU post(copy, len, len);
+	if (post.validate() != 1 || post.getType() != CoapPDU::COAP_CONFIRMABLE ||
+			post.getCode() != CoapPDU::COAP_POST || post.getTokenLength() != sizeof(token))
+		return;
+	memcpy(&token, post.getTokenPointer(), sizeof(token));
+
+	if (dev->state == DEVICE_TRIGGER) {
+		dev->state = DEVICE_BOUND;
+		dev->token = token;
+	}
+	// The controller re-authenticates the device with a new session.
+	else if (dev->state == DEVICE_DONE && token != dev->token && config.reauth_after > 0 &&
+			sim_now() >= dev->end + config.reauth_after) {
+		if (new_peer(dev) < 0)
+			return;
+		stats.reauths++;
+		if (stats.reauth_start < 0)
+			stats.reauth_start = sim_now();
+		dev->state = DEVICE_BOUND;
+		dev->reauth = 1;
+		dev->erp_used = 0;
+		dev->start = sim_now();
+		dev->token = token;
+		free(dev->last_ack);
+		dev->last_ack = NULL;
+		sim_schedule(sim_now() + config.give_up, give_up, device_arg(id), NULL, 0);
+	}
+	else if (dev->state == DEVICE_IDLE || token != dev->token) {
+		stats.ignored++;
+		return;
+	}
+
+	stats.posts++;
+
+	// Our ACK was lost, the controller sends the POST again.
+	if (dev->last_ack != NULL && post.getMessageID() == dev->last_mid) {
+		stats.duplicates++;
+		send_cb(id, dev->last_ack, dev->last_ack_len);
+		return;
+	}
+	if (dev->state != DEVICE_BOUND)
+		return;
+
+	CoapPDU ack;
+	ack.setVersion(1);
+	ack.setType(CoapPDU::COAP_ACKNOWLEDGEMENT);
+	ack.setCode(CoapPDU::COAP_CHANGED);
+	ack.setMessageID(post.getMessageID());
+	ack.setToken((uint8_t *) &token, sizeof(token));
+
+	uint8_t *payload = post.getPayloadPointer();
+	int payload_len = post.getPayloadLength();
+
+	// ERP: the device answers with the keys of its last full authentication
+	// or, if it has none, with an empty ACK, and gets a full EAP.
+	if (dev->reauth && payload != NULL && erp_is_start(payload, (size_t) payload_len)) {
+		uint8_t reauth[ERP_MSG_LEN];
+
+		ack.addOption(CoapPDU::COAP_OPTION_LOCATION_PATH, 1, (uint8_t *) "a");
+		if (dev->erp != NULL) {
+			dev->erp_seq++;
+			erp_build(EAP_CODE_INITIATE, payload[1], 0, dev->erp_seq, dev->erp, reauth);
+			ack.setPayload(reauth, sizeof(reauth));
+		}
+		send_ack(id, &ack);
+		return;
+	}
+	if (dev->reauth && payload != NULL && payload_len > 0 && payload[0] == EAP_CODE_FINISH) {
+		struct erp_msg msg;
+
+		send_ack(id, &ack);
+		if (dev->erp != NULL &&
+				erp_parse(payload, (size_t) payload_len, EAP_CODE_FINISH, &msg) == 0 &&
+				msg.seq == dev->erp_seq && erp_verify(dev->erp, payload, (size_t) payload_len)) {
+			stats.reauth_erp++;
+			dev->erp_used = 1;
+			device_finish(id, DEVICE_DONE);
+		} else
+			device_finish(id, DEVICE_FAILED);
+		return;
+	}
+
+	// The EAP success: the device derives its OSCORE context, done.
+	if (post.getOptionPointer(CoapPDU::COAP_OPTION_OSCORE) != NULL) {
+		send_ack(id, &ack);
+		keep_erp_keys(dev);
+		device_finish(id, DEVICE_DONE);
+		return;
+	}
+
+	if (payload == NULL || payload_len < 4)
+		return;
+
+	// The first POST carries the cipher suites after the EAP request.
+	int eap_len = (payload[2] << 8) | payload[3];
+	if (eap_len > payload_len)
+		eap_len = payload_len;
+
+	eap_peer_set_eapReq(dev->peer, TRUE);
+	eap_peer_set_eapReqData(dev->peer, payload, (size_t) eap_len);
+	eap_peer_step(dev->peer);
+	eap_peer_set_eapReq(dev->peer, FALSE);
+
+	if (eap_peer_get_eapFail(dev->peer)) {
+		device_finish(id, DEVICE_FAILED);
+		return;
+	}
+	if (!eap_peer_get_eapResp(dev->peer))
+		return;
+	eap_peer_set_eapResp(dev->peer, FALSE);
+
+	struct wpabuf *resp = eap_peer_get_eapRespData(dev->peer);
+	ack.addOption(CoapPDU::COAP_OPTION_LOCATION_PATH, 1, (uint8_t *) "a");
+	ack.setPayload((uint8_t *) wpabuf_head(resp), (int) wpabuf_len(resp));
+	send_ack(id, &ack);
+}
+
+void sim_device_address(uint32_t id, struct sockaddr_storage *addr) {
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) addr;
+	uint32_t be_id = htonl(id);
+
+	memset(addr, 0, sizeof(*addr));
+	sin6->sin6_family = AF_INET6;
+	sin6->sin6_port = htons(DEVICE_PORT);
+	// fd00::<id>
+	sin6->sin6_addr.s6_addr[0] = 0xfd;
+	memcpy(&sin6->sin6_addr.s6_addr[12], &be_id, sizeof(be_id));
+}
+
+int sim_device_id(const struct sockaddr_storage *addr, uint32_t *id) {
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) addr;
+	uint32_t be_id;
+
+	if (sin6->sin6_family != AF_INET6 || sin6->sin6_addr.s6_addr[0] != 0xfd)
+		return -1;
+
+	memcpy(&be_id, &sin6->sin6_addr.s6_addr[12], sizeof(be_id));
+	*id = ntohl(be_id);
+	return *id < ndevices ? 0 : -1;
+}
+
+const struct sim_device_stats *sim_device_get_stats() {
+	return &stats;
+}
+
+void sim_devices_deinit() {
+	uint32_t i;
+
+	for (i = 0; i < ndevices; i++) {
+		free_peer(&devices[i]);
+		free(devices[i].last_ack);
+		free(devices[i].erp);
+	}
+	free(devices);
+	devices = NULL;
+	ndevices = 0;
+}
+
+/* new/delete go through malloc/free, so the controller's are counted too (sim_alloc_count). */
+void *operator new(size_t size) {
+	void *p = malloc(size ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	free(p);
+}
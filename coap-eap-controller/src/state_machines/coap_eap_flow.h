@@ -0,0 +1,97 @@
+/**
+ * @file coap_eap_flow.h
+ * @brief Stackless coroutines used to run the CoAP-EAP exchange of a session.
+ *
+ * The exchange with every device is written as a single function that
+ * waits for the next event (CoAP ACK, RADIUS answer or timer) and is
+ * resumed directly by the thread that receives it. The implementation
+ * follows the local continuations used by Contiki's protothreads: the
+ * resume point is a line number stored in the session, so no stack nor
+ * memory is reserved per step. Local variables are not preserved across
+ * waits; every state that must survive is kept in coap_eap_ctx.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef COAP_EAP_FLOW_H
+#define COAP_EAP_FLOW_H
+
+/** Event identifier: first request of a device (starts the flow).*/
+#define FLOW_EV_START  1
+/** Event identifier: CoAP ACK received.*/
+#define FLOW_EV_ACK    2
+/** Event identifier: RADIUS (or Diameter) answer received.*/
+#define FLOW_EV_RADIUS 3
+/** Event identifier: retransmission alarm expired.*/
+#define FLOW_EV_TIMER  4
+/** Event identifier: session restored from the session store (starts the flow).*/
+#define FLOW_EV_RESTORE 5
+/** Event identifier: re-authentication of an authorized device (starts the flow).*/
+#define FLOW_EV_REAUTH 6
+/** Event identifier: the AAA server has not answered in time.*/
+#define FLOW_EV_AAA_TIMER 7
+
+/** The flow is waiting for another event.*/
+#define FLOW_WAITING 0
+/** The flow has been aborted (timeout, EAP failure).*/
+#define FLOW_EXITED  1
+/** The flow has reached its end.*/
+#define FLOW_ENDED   2
+/** The flow had already finished, the event has been ignored.*/
+#define FLOW_IGNORED 3
+
+/** Resume point used once the flow has finished.*/
+#define FLOW_DONE ((unsigned short) -1)
+
+/** State of a flow.*/
+struct coap_eap_flow {
+	/** Local continuation: line where the flow must be resumed.*/
+	unsigned short lc;
+	/** Scratch result kept across waits.*/
+	int result;
+};
+
+/** Initializes a flow, it will start from the beginning.*/
+#define FLOW_INIT(f)	do { (f)->lc = 0; (f)->result = 0; } while (0)
+
+/** Declares the start of the flow inside the function that implements it.*/
+#define FLOW_BEGIN(f)	switch ((f)->lc) { \
+			case FLOW_DONE: return FLOW_IGNORED; \
+			case 0:
+
+/**
+ * Yields until the next event satisfies cond. The flow always gives up
+ * the control at least once, so the event that triggered the current
+ * step is never consumed twice.
+ */
+#define FLOW_AWAIT(f, cond)	do { \
+			(f)->lc = __LINE__; return FLOW_WAITING; \
+			case __LINE__: \
+			if (!(cond)) return FLOW_WAITING; \
+		} while (0)
+
+/** Aborts the flow. Further events are ignored.*/
+#define FLOW_EXIT(f)	do { (f)->lc = FLOW_DONE; return FLOW_EXITED; } while (0)
+
+/** Declares the end of the flow.*/
+#define FLOW_END(f)	} (f)->lc = FLOW_DONE; return FLOW_ENDED
+
+/** Returns TRUE once the flow has finished.*/
+#define FLOW_FINISHED(f)	((f)->lc == FLOW_DONE)
+
+#endif
@@ -37,10 +37,11 @@ extern "C" {
 }
 #endif
 
+/* The generator is seeded once by main (or by the simulator, with its seed).
+ * Seeding it again with the time of each session made sessions created in
+ * the same second share their RT. */
 int
 coap_prng_impl(unsigned char *buf, size_t len) {
-  time_t t;
-  srand((unsigned) time(&t));
     while (len--)
         *buf++ = rand() & 0xFF;
     return 1;
@@ -48,30 +49,25 @@ coap_prng_impl(unsigned char *buf, size_t len) {
 
 
 void init_CoAP_EAP_Session(coap_eap_ctx* coap_eap_session){
-	
-	    struct timeval start, end;
- 
-		long mtime, seconds, useconds;   
- 
-		gettimeofday(&end, NULL);
-	 
-	    seconds  = end.tv_sec;
-	    useconds = end.tv_usec;
-	 
-	    mtime = seconds + useconds;
-	 
-		srand(mtime);
 	 
 	 coap_eap_session->session_id 		= rand();
 	 printf("New session_id %X\n",htons(coap_eap_session->session_id));
 	 
 	 coap_eap_session->message_id 			= 1;
 	 coap_eap_session->CURRENT_STATE		= 0;
+	 FLOW_INIT(&coap_eap_session->flow);
+	 coap_eap_session->waiting 			= 0;
+	 coap_eap_session->store_slot 		= -1;
+	 coap_eap_session->erp 				= ERP_NONE;
 	 coap_eap_session->RTX_COUNTER 			= 0;
 	 coap_eap_session->ISSET 			= 0;
 	 coap_eap_session->lastSentMessage 		= NULL;
+	 coap_eap_session->lastSentMessage_len 	= 0;
+	 coap_eap_session->lastSentEap 		= NULL;
+	 coap_eap_session->lastSentIovcnt 		= 0;
 	 coap_eap_session->lastReceivedMessage 	= NULL;
 	 coap_eap_session->location 			= NULL;//strdup("/b");
+	 coap_template_invalidate(&coap_eap_session->post_template);
 
 	 coap_eap_session->eap_workarround = 0;
 	 memset(coap_eap_session->userID,0,40);
@@ -93,7 +89,7 @@ void init_CoAP_EAP_Session(coap_eap_ctx* coap_eap_session){
 	
 	 /*Rafa: We create a session id based on the token*/
 	 pthread_mutex_init(&(coap_eap_session->mutex), NULL);
-	 load_config_server();
+	 // The configuration has already been loaded by main.
 	 // Init EAP authenticator.
 	 eap_auth_init(&(coap_eap_session->eap_ctx), coap_eap_session, CA_CERT, SERVER_CERT, SERVER_KEY);
 
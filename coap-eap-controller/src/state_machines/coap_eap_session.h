@@ -39,6 +39,10 @@ extern "C"{
 }
 #endif
 
+#include "coap_eap_flow.h"
+#include "../coap_template.h"
+#include "../erp.h"
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -56,6 +60,12 @@ extern "C"{
 typedef struct
 {
 
+  /**Segments of the last POST sent, kept for the retransmissions.*/
+  struct iovec lastSentIov[COAP_TEMPLATE_IOV];
+  int lastSentIovcnt;
+  /**EAP request of the last POST sent, taken from the authenticator.*/
+  struct wpabuf * lastSentEap;
+  /**Copy of the last POST sent, only when restored from the store.*/
   uint8_t * lastSentMessage;
   int lastSentMessage_len;
   
@@ -71,6 +81,14 @@ typedef struct
  struct eap_auth_ctx eap_ctx;
  uint32_t session_id;
  uint16_t CURRENT_STATE;
+ /**Exchange with the device, resumed on every event of the session.*/
+ struct coap_eap_flow flow;
+ /**Event the flow is waiting for, FLOW_EV_ACK or FLOW_EV_RADIUS.*/
+ int waiting;
+ /**Slot of the session in the session store, -1 if it is not stored.*/
+ int store_slot;
+ /**Step of the ERP re-authentication, ERP_NONE for a full EAP one (see erp.h).*/
+ int erp;
  /**Contains MSK key value when generated.*/
     u8 *msk_key;
     u8 *auth_key; //It will have 16 bytes
@@ -109,6 +127,8 @@ typedef struct
     unsigned char uri_opt_str[40];
     int uri_opt_str_n;
     char *location;
+    /**Header and options of the POSTs sent to location.*/
+    struct coap_template post_template;
     int eap_workarround;
 
 } coap_eap_ctx;
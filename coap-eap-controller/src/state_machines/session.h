@@ -100,10 +100,37 @@ int IP_VERSION_AUTH;	// Version of IP protocol used in AAA comunication
 char* AS_IP;		    // AAA server's IP
 short AS_PORT;          // AAA server's port
 char* AS_SECRET;        // Shared secret between AAA client and server
+char* AS_POOL;          // More AAA servers with AS_SECRET, "ip:port ..." (the pool), NULL if there is only AS_IP
+int AS_BALANCE;         // Selection of the AAA server of a new session in the pool (RadiusBalance)
+int AS_STATUS_INTERVAL; // Seconds between the Status-Server probes of the idle AAA servers of the pool, 0 if they are not probed
+char* REALM_FILE;       // AAA servers of the realms of the devices (realm.h), NULL if every device goes to AS_IP and AS_POOL
+int AAA_LOOPBACK;       // The AAA server runs in the controller, without sockets (aaa_loopback.h), for benchmarks (its number of threads) or not (0)
 int PING_TIME;	   // Time to wait for test channel status in the access phase.
 int NUMBER_PING;   // Number of ping messages to be exchanged.
 int NUMBER_PING_AUX;   // Number of ping messages to be exchanged (auxiliar variable).
-int MODE;
+int MODE;               // Standalone (0), the controller is the EAP server, or pass-through (1) to the AAA server
+char* PSK_FILE;         // Credentials of the devices in standalone mode (psk_store.h)
+char* STORE_FILE;       // File of the session store, NULL if it is not used
+int STORE_SLOTS;        // Number of sessions that fit in the session store
+char* CAPTURE_FILE;     // pcap file where the CoAP and RADIUS traffic is captured, NULL if it is not used
+int REAUTH_LIFETIME;    // Lifetime of the sessions, the devices are re-authenticated before it expires. 0 if it is not used
+int REAUTH_JITTER;      // Seconds over which the re-authentications are spread
+int REAUTH_RATE;        // Max re-authentications started per second, 0 for no limit
+int ERP_CACHE_SIZE;     // Devices whose ERP keys are kept, 0 if ERP is not used
+int ERP_KEY_LIFETIME;   // Seconds the ERP keys of a full authentication are kept
+int TLS_SESSION_CACHE;  // EAP-TLS sessions resumed by session ID in standalone mode, 0 if they are not kept
+int TLS_SESSION_LIFETIME; // Seconds an EAP-TLS session can be resumed since its full handshake
+int TLS_SESSION_TICKETS;  // EAP-TLS sessions resumed with session tickets (1) or not (0)
+int RADSEC_CONNECTIONS; // TLS connections to the AAA server (RadSec, radsec.h), 0 if RADIUS goes over UDP
+short RADSEC_PORT;      // AAA server's RadSec port
+char* RADSEC_CA;        // CA of the AAA server's certificate, NULL if it is not verified
+char* RADSEC_CERT;      // Certificate of the controller for RadSec, NULL if it is not sent
+char* RADSEC_KEY;       // Key of RADSEC_CERT
+int DIAMETER_CONNECTIONS; // TCP connections to the AAA server with Diameter EAP (diameter.h) instead of RADIUS, 0 if it is not used
+short DIAMETER_PORT;    // AAA server's Diameter port
+char* DIAMETER_ORIGIN_HOST;  // Diameter identity of the controller
+char* DIAMETER_ORIGIN_REALM; // Realm of the controller
+char* DIAMETER_REALM;   // Realm of the AAA server (Destination-Realm)
 #endif
 
 #ifdef __cplusplus
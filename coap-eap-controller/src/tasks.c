@@ -0,0 +1,124 @@
+/**
+ * @file tasks.c
+ * @brief Tasks' list shared by the worker threads.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <semaphore.h>
+
+#include "tasks.h"
+#include "panautils.h"
+
+/** Linked list of server's tasks.*/
+static struct task_list* list_tasks = NULL;
+/** Last task. */
+static struct task_list* last_task = NULL;
+/** Linked list of priority tasks, served before list_tasks.*/
+static struct task_list* list_priority_tasks = NULL;
+/** Last priority task. */
+static struct task_list* last_priority_task = NULL;
+/** Mutex associated to tasks' list. */
+static pthread_mutex_t list_tasks_mutex;
+/** Semaphore used to wait for new tasks by workers. */
+static sem_t got_task;
+
+void init_tasks() {
+	pthread_mutex_init(&list_tasks_mutex, NULL);
+	sem_init(&got_task, 0, 0);
+}
+
+struct task_list* get_task() {
+	struct task_list* task = NULL;
+
+	pana_debug("Trying to get a task.");
+
+	/* lock the mutex, to assure exclusive access to the list */
+	pthread_mutex_lock(&list_tasks_mutex);
+
+	if (list_priority_tasks != NULL) {
+		task = list_priority_tasks;
+		list_priority_tasks = list_priority_tasks->next;
+		task->next = NULL;
+	}
+	else if (list_tasks != NULL) {
+		task = list_tasks;
+		list_tasks = list_tasks->next;
+		task->next = NULL;
+	}
+
+	/* unlock mutex */
+	pthread_mutex_unlock(&list_tasks_mutex);
+
+	if (task == NULL)
+		pana_debug("Task not found");
+
+	return task;
+}
+
+static void append_task(struct task_list **list, struct task_list **last,
+		task_function funcion, void * arg) {
+
+	if(arg == NULL)
+	{
+		pana_error("ERROR: append_task: arg  == NULL ");
+		exit(0);
+	}
+
+	struct task_list * new_element; // A new element in the list
+
+	// create structure with new element
+	new_element = XMALLOC(struct task_list,1);
+
+	new_element->use_function = funcion;
+	new_element->data = arg;
+	new_element->next = NULL;
+
+	// lock the mutex, to assure exclusive access to the list
+	pthread_mutex_lock(&list_tasks_mutex);
+
+	/* add new task to the end of the list, updating list */
+	/* pointers as required */
+	if (*list == NULL) { /* special case - list is empty */
+		*list = new_element;
+		*last = new_element;
+	}
+	else {
+		(*last)->next = new_element;
+		*last = (*last)->next;
+	}
+
+	pana_debug("add_task: added task");
+
+	/* unlock mutex */
+	pthread_mutex_unlock(&list_tasks_mutex);
+	/* signal the semaphore - there's a new task to handle */
+	sem_post(&got_task);
+}
+
+void add_task(task_function funcion, void * arg) {
+	append_task(&list_tasks, &last_task, funcion, arg);
+}
+
+void add_priority_task(task_function funcion, void * arg) {
+	append_task(&list_priority_tasks, &last_priority_task, funcion, arg);
+}
+
+void wait_task() {
+	sem_wait(&got_task);
+}
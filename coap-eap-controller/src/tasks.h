@@ -0,0 +1,74 @@
+/**
+ * @file tasks.h
+ * @brief Headers of the tasks' list shared by the worker threads.
+ **/
+/*
+ *  Copyright (C) Dan Garcia Carrillo on 2021.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TASKS_H
+#define TASKS_H
+
+#include "include.h"
+
+/** Task's callback.*/
+typedef void* (*task_function)(void* data);
+
+/** List of tasks.*/
+struct task_list {
+	/** Function to be used with the task.*/
+    task_function use_function;
+    /** Data of the task.*/
+    void* data;
+    /**Pointer to the next task of the list.*/
+    struct task_list * next;
+};
+
+/** Initializes the tasks' list, its mutex and its semaphore. */
+void init_tasks();
+/**
+ * A procedure to add a task in the tasks' list
+ * managed by the controller.
+ *
+ * @param funcion Callback to function to be executed
+ * by some worker thread.
+ * @param *arg Arguments of the function pointed by the
+ * callback.
+ */
+void add_task(task_function funcion, void* arg);
+/**
+ * Same as add_task, but the task is taken by the workers before any
+ * task added with add_task (e.g. a re-authentication that can not wait).
+ *
+ * @param funcion Callback to function to be executed
+ * by some worker thread.
+ * @param *arg Arguments of the function pointed by the
+ * callback.
+ */
+void add_priority_task(task_function funcion, void* arg);
+/**
+ * A procedure to get a task from the tasks' list managed by
+ * the controller. The priority tasks are taken first.
+ *
+ * @return A pointer to the a new task available, NULL if the list is empty.
+ * It must be freed by the caller.
+ */
+struct task_list* get_task();
+/** Blocks the calling worker until a new task has been added. */
+void wait_task();
+
+#endif
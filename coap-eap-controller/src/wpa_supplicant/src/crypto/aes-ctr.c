@@ -20,29 +20,24 @@
 #include "aes_wrap.h"
 
 /**
- * aes_128_ctr_encrypt - AES-128 CTR mode encryption
- * @key: Key for encryption (16 bytes)
+ * aes_128_ctr_encrypt_key - AES-128 CTR mode encryption with an expanded key
+ * @key: Key schedule from aes_128_key_setup
  * @nonce: Nonce for counter mode (16 bytes)
  * @data: Data to encrypt in-place
  * @data_len: Length of data in bytes
- * Returns: 0 on success, -1 on failure
  */
-int aes_128_ctr_encrypt(const u8 *key, const u8 *nonce,
-			u8 *data, size_t data_len)
+void aes_128_ctr_encrypt_key(const struct aes_128_key *key, const u8 *nonce,
+			     u8 *data, size_t data_len)
 {
-	void *ctx;
 	size_t j, len, left = data_len;
 	int i;
 	u8 *pos = data;
 	u8 counter[AES_BLOCK_SIZE], buf[AES_BLOCK_SIZE];
 
-	ctx = aes_encrypt_init(key, 16);
-	if (ctx == NULL)
-		return -1;
 	os_memcpy(counter, nonce, AES_BLOCK_SIZE);
 
 	while (left > 0) {
-		aes_encrypt(ctx, counter, buf);
+		aes_128_key_encrypt(key, counter, buf);
 
 		len = (left < AES_BLOCK_SIZE) ? left : AES_BLOCK_SIZE;
 		for (j = 0; j < len; j++)
@@ -56,6 +51,24 @@ int aes_128_ctr_encrypt(const u8 *key, const u8 *nonce,
 				break;
 		}
 	}
-	aes_encrypt_deinit(ctx);
+}
+
+
+/**
+ * aes_128_ctr_encrypt - AES-128 CTR mode encryption
+ * @key: Key for encryption (16 bytes)
+ * @nonce: Nonce for counter mode (16 bytes)
+ * @data: Data to encrypt in-place
+ * @data_len: Length of data in bytes
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_128_ctr_encrypt(const u8 *key, const u8 *nonce,
+			u8 *data, size_t data_len)
+{
+	struct aes_128_key k;
+
+	aes_128_key_setup(&k, key);
+	aes_128_ctr_encrypt_key(&k, nonce, data, data_len);
+	os_memset(&k, 0, sizeof(k));
 	return 0;
 }
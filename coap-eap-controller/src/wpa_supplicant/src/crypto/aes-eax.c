@@ -19,9 +19,27 @@
 #include "aes.h"
 #include "aes_wrap.h"
 
+/* OMAC1 of the block [n]_16 followed by data, as defined by EAX. */
+static void eax_omac(const struct aes_128_key *key, u8 n,
+		     const u8 *data, size_t data_len, u8 *mac)
+{
+	u8 block[AES_BLOCK_SIZE];
+	const u8 *addr[2];
+	size_t len[2];
+
+	os_memset(block, 0, AES_BLOCK_SIZE - 1);
+	block[AES_BLOCK_SIZE - 1] = n;
+	addr[0] = block;
+	len[0] = AES_BLOCK_SIZE;
+	addr[1] = data;
+	len[1] = data_len;
+	omac1_aes_128_vector_key(key, 2, addr, len, mac);
+}
+
+
 /**
- * aes_128_eax_encrypt - AES-128 EAX mode encryption
- * @key: Key for encryption (16 bytes)
+ * aes_128_eax_encrypt_key - AES-128 EAX mode encryption with an expanded key
+ * @key: Key schedule from aes_128_key_setup
  * @nonce: Nonce for counter mode
  * @nonce_len: Nonce length in bytes
  * @hdr: Header data to be authenticity protected
@@ -29,63 +47,29 @@
  * @data: Data to encrypt in-place
  * @data_len: Length of data in bytes
  * @tag: 16-byte tag value
- * Returns: 0 on success, -1 on failure
  */
-int aes_128_eax_encrypt(const u8 *key, const u8 *nonce, size_t nonce_len,
-			const u8 *hdr, size_t hdr_len,
-			u8 *data, size_t data_len, u8 *tag)
+void aes_128_eax_encrypt_key(const struct aes_128_key *key,
+			     const u8 *nonce, size_t nonce_len,
+			     const u8 *hdr, size_t hdr_len,
+			     u8 *data, size_t data_len, u8 *tag)
 {
-	u8 *buf;
-	size_t buf_len;
 	u8 nonce_mac[AES_BLOCK_SIZE], hdr_mac[AES_BLOCK_SIZE],
 		data_mac[AES_BLOCK_SIZE];
-	int i, ret = -1;
-
-	if (nonce_len > data_len)
-		buf_len = nonce_len;
-	else
-		buf_len = data_len;
-	if (hdr_len > buf_len)
-		buf_len = hdr_len;
-	buf_len += 16;
-
-	buf = os_malloc(buf_len);
-	if (buf == NULL)
-		return -1;
-
-	os_memset(buf, 0, 15);
-
-	buf[15] = 0;
-	os_memcpy(buf + 16, nonce, nonce_len);
-	if (omac1_aes_128(key, buf, 16 + nonce_len, nonce_mac))
-		goto fail;
-
-	buf[15] = 1;
-	os_memcpy(buf + 16, hdr, hdr_len);
-	if (omac1_aes_128(key, buf, 16 + hdr_len, hdr_mac))
-		goto fail;
-
-	if (aes_128_ctr_encrypt(key, nonce_mac, data, data_len))
-		goto fail;
-	buf[15] = 2;
-	os_memcpy(buf + 16, data, data_len);
-	if (omac1_aes_128(key, buf, 16 + data_len, data_mac))
-		goto fail;
+	int i;
+
+	eax_omac(key, 0, nonce, nonce_len, nonce_mac);
+	eax_omac(key, 1, hdr, hdr_len, hdr_mac);
+	aes_128_ctr_encrypt_key(key, nonce_mac, data, data_len);
+	eax_omac(key, 2, data, data_len, data_mac);
 
 	for (i = 0; i < AES_BLOCK_SIZE; i++)
 		tag[i] = nonce_mac[i] ^ data_mac[i] ^ hdr_mac[i];
-
-	ret = 0;
-fail:
-	os_free(buf);
-
-	return ret;
 }
 
 
 /**
- * aes_128_eax_decrypt - AES-128 EAX mode decryption
- * @key: Key for decryption (16 bytes)
+ * aes_128_eax_decrypt_key - AES-128 EAX mode decryption with an expanded key
+ * @key: Key schedule from aes_128_key_setup
  * @nonce: Nonce for counter mode
  * @nonce_len: Nonce length in bytes
  * @hdr: Header data to be authenticity protected
@@ -93,59 +77,79 @@ fail:
  * @data: Data to encrypt in-place
  * @data_len: Length of data in bytes
  * @tag: 16-byte tag value
- * Returns: 0 on success, -1 on failure, -2 if tag does not match
+ * Returns: 0 on success, -2 if tag does not match
  */
-int aes_128_eax_decrypt(const u8 *key, const u8 *nonce, size_t nonce_len,
-			const u8 *hdr, size_t hdr_len,
-			u8 *data, size_t data_len, const u8 *tag)
+int aes_128_eax_decrypt_key(const struct aes_128_key *key,
+			    const u8 *nonce, size_t nonce_len,
+			    const u8 *hdr, size_t hdr_len,
+			    u8 *data, size_t data_len, const u8 *tag)
 {
-	u8 *buf;
-	size_t buf_len;
 	u8 nonce_mac[AES_BLOCK_SIZE], hdr_mac[AES_BLOCK_SIZE],
 		data_mac[AES_BLOCK_SIZE];
 	int i;
 
-	if (nonce_len > data_len)
-		buf_len = nonce_len;
-	else
-		buf_len = data_len;
-	if (hdr_len > buf_len)
-		buf_len = hdr_len;
-	buf_len += 16;
-
-	buf = os_malloc(buf_len);
-	if (buf == NULL)
-		return -1;
-
-	os_memset(buf, 0, 15);
-
-	buf[15] = 0;
-	os_memcpy(buf + 16, nonce, nonce_len);
-	if (omac1_aes_128(key, buf, 16 + nonce_len, nonce_mac)) {
-		os_free(buf);
-		return -1;
-	}
-
-	buf[15] = 1;
-	os_memcpy(buf + 16, hdr, hdr_len);
-	if (omac1_aes_128(key, buf, 16 + hdr_len, hdr_mac)) {
-		os_free(buf);
-		return -1;
-	}
-
-	buf[15] = 2;
-	os_memcpy(buf + 16, data, data_len);
-	if (omac1_aes_128(key, buf, 16 + data_len, data_mac)) {
-		os_free(buf);
-		return -1;
-	}
-
-	os_free(buf);
+	eax_omac(key, 0, nonce, nonce_len, nonce_mac);
+	eax_omac(key, 1, hdr, hdr_len, hdr_mac);
+	eax_omac(key, 2, data, data_len, data_mac);
 
 	for (i = 0; i < AES_BLOCK_SIZE; i++) {
 		if (tag[i] != (nonce_mac[i] ^ data_mac[i] ^ hdr_mac[i]))
 			return -2;
 	}
 
-	return aes_128_ctr_encrypt(key, nonce_mac, data, data_len);
+	aes_128_ctr_encrypt_key(key, nonce_mac, data, data_len);
+	return 0;
+}
+
+
+/**
+ * aes_128_eax_encrypt - AES-128 EAX mode encryption
+ * @key: Key for encryption (16 bytes)
+ * @nonce: Nonce for counter mode
+ * @nonce_len: Nonce length in bytes
+ * @hdr: Header data to be authenticity protected
+ * @hdr_len: Length of the header data bytes
+ * @data: Data to encrypt in-place
+ * @data_len: Length of data in bytes
+ * @tag: 16-byte tag value
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_128_eax_encrypt(const u8 *key, const u8 *nonce, size_t nonce_len,
+			const u8 *hdr, size_t hdr_len,
+			u8 *data, size_t data_len, u8 *tag)
+{
+	struct aes_128_key k;
+
+	aes_128_key_setup(&k, key);
+	aes_128_eax_encrypt_key(&k, nonce, nonce_len, hdr, hdr_len,
+				data, data_len, tag);
+	os_memset(&k, 0, sizeof(k));
+	return 0;
+}
+
+
+/**
+ * aes_128_eax_decrypt - AES-128 EAX mode decryption
+ * @key: Key for decryption (16 bytes)
+ * @nonce: Nonce for counter mode
+ * @nonce_len: Nonce length in bytes
+ * @hdr: Header data to be authenticity protected
+ * @hdr_len: Length of the header data bytes
+ * @data: Data to encrypt in-place
+ * @data_len: Length of data in bytes
+ * @tag: 16-byte tag value
+ * Returns: 0 on success, -1 on failure, -2 if tag does not match
+ */
+int aes_128_eax_decrypt(const u8 *key, const u8 *nonce, size_t nonce_len,
+			const u8 *hdr, size_t hdr_len,
+			u8 *data, size_t data_len, const u8 *tag)
+{
+	struct aes_128_key k;
+	int ret;
+
+	aes_128_key_setup(&k, key);
+	ret = aes_128_eax_decrypt_key(&k, nonce, nonce_len, hdr, hdr_len,
+				      data, data_len, tag);
+	os_memset(&k, 0, sizeof(k));
+	return ret;
 }
@@ -26,6 +26,7 @@
 #include "common.h"
 #include "crypto.h"
 #include "aes_i.h"
+#include "aes_wrap.h"
 
 void rijndaelEncrypt(const u32 rk[/*44*/], const u8 pt[16], u8 ct[16])
 {
@@ -119,3 +120,26 @@ void aes_encrypt_deinit(void *ctx)
 	os_memset(ctx, 0, AES_PRIV_SIZE);
 	os_free(ctx);
 }
+
+
+/**
+ * aes_128_key_setup - Expand an AES-128 key for aes_128_key_encrypt
+ * @key: Key schedule to fill in
+ * @k: Key (16 bytes)
+ */
+void aes_128_key_setup(struct aes_128_key *key, const u8 *k)
+{
+	rijndaelKeySetupEnc(key->rk, k);
+}
+
+
+/**
+ * aes_128_key_encrypt - Encrypt one AES block with an expanded key
+ * @key: Key schedule from aes_128_key_setup
+ * @in: Plaintext (16 bytes)
+ * @out: Ciphertext (16 bytes)
+ */
+void aes_128_key_encrypt(const struct aes_128_key *key, const u8 *in, u8 *out)
+{
+	rijndaelEncrypt(key->rk, in, out);
+}
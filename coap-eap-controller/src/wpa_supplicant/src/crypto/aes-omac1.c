@@ -33,29 +33,20 @@ static void gf_mulx(u8 *pad)
 
 
 /**
- * omac1_aes_128_vector - One-Key CBC MAC (OMAC1) hash with AES-128
- * @key: 128-bit key for the hash operation
+ * omac1_aes_128_vector_key - OMAC1 with AES-128 and an expanded key
+ * @key: Key schedule from aes_128_key_setup
  * @num_elem: Number of elements in the data vector
  * @addr: Pointers to the data areas
  * @len: Lengths of the data blocks
  * @mac: Buffer for MAC (128 bits, i.e., 16 bytes)
- * Returns: 0 on success, -1 on failure
- *
- * This is a mode for using block cipher (AES in this case) for authentication.
- * OMAC1 was standardized with the name CMAC by NIST in a Special Publication
- * (SP) 800-38B.
  */
-int omac1_aes_128_vector(const u8 *key, size_t num_elem,
-			 const u8 *addr[], const size_t *len, u8 *mac)
+void omac1_aes_128_vector_key(const struct aes_128_key *key, size_t num_elem,
+			      const u8 *addr[], const size_t *len, u8 *mac)
 {
-	void *ctx;
 	u8 cbc[AES_BLOCK_SIZE], pad[AES_BLOCK_SIZE];
 	const u8 *pos, *end;
 	size_t i, e, left, total_len;
 
-	ctx = aes_encrypt_init(key, 16);
-	if (ctx == NULL)
-		return -1;
 	os_memset(cbc, 0, AES_BLOCK_SIZE);
 
 	total_len = 0;
@@ -66,30 +57,33 @@ int omac1_aes_128_vector(const u8 *key, size_t num_elem,
 	e = 0;
 	pos = addr[0];
 	end = pos + len[0];
+	/* Empty elements are skipped, and there is none after the last. */
+	while (pos >= end && ++e < num_elem) {
+		pos = addr[e];
+		end = pos + len[e];
+	}
 
 	while (left >= AES_BLOCK_SIZE) {
 		for (i = 0; i < AES_BLOCK_SIZE; i++) {
 			cbc[i] ^= *pos++;
-			if (pos >= end) {
-				e++;
+			while (pos >= end && ++e < num_elem) {
 				pos = addr[e];
 				end = pos + len[e];
 			}
 		}
 		if (left > AES_BLOCK_SIZE)
-			aes_encrypt(ctx, cbc, cbc);
+			aes_128_key_encrypt(key, cbc, cbc);
 		left -= AES_BLOCK_SIZE;
 	}
 
 	os_memset(pad, 0, AES_BLOCK_SIZE);
-	aes_encrypt(ctx, pad, pad);
+	aes_128_key_encrypt(key, pad, pad);
 	gf_mulx(pad);
 
 	if (left || total_len == 0) {
 		for (i = 0; i < left; i++) {
 			cbc[i] ^= *pos++;
-			if (pos >= end) {
-				e++;
+			while (pos >= end && ++e < num_elem) {
 				pos = addr[e];
 				end = pos + len[e];
 			}
@@ -100,8 +94,31 @@ int omac1_aes_128_vector(const u8 *key, size_t num_elem,
 
 	for (i = 0; i < AES_BLOCK_SIZE; i++)
 		pad[i] ^= cbc[i];
-	aes_encrypt(ctx, pad, mac);
-	aes_encrypt_deinit(ctx);
+	aes_128_key_encrypt(key, pad, mac);
+}
+
+
+/**
+ * omac1_aes_128_vector - One-Key CBC MAC (OMAC1) hash with AES-128
+ * @key: 128-bit key for the hash operation
+ * @num_elem: Number of elements in the data vector
+ * @addr: Pointers to the data areas
+ * @len: Lengths of the data blocks
+ * @mac: Buffer for MAC (128 bits, i.e., 16 bytes)
+ * Returns: 0 on success, -1 on failure
+ *
+ * This is a mode for using block cipher (AES in this case) for authentication.
+ * OMAC1 was standardized with the name CMAC by NIST in a Special Publication
+ * (SP) 800-38B.
+ */
+int omac1_aes_128_vector(const u8 *key, size_t num_elem,
+			 const u8 *addr[], const size_t *len, u8 *mac)
+{
+	struct aes_128_key k;
+
+	aes_128_key_setup(&k, key);
+	omac1_aes_128_vector_key(&k, num_elem, addr, len, mac);
+	os_memset(&k, 0, sizeof(k));
 	return 0;
 }
 
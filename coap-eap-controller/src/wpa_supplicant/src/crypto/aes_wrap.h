@@ -22,6 +22,31 @@
 #ifndef AES_WRAP_H
 #define AES_WRAP_H
 
+/*
+ * AES-128 key schedule kept by the caller (internal AES only). The _key
+ * functions use it instead of expanding the key on every call, and none of
+ * them allocates memory.
+ */
+struct aes_128_key {
+	u32 rk[44];
+};
+
+void aes_128_key_setup(struct aes_128_key *key, const u8 *k);
+void aes_128_key_encrypt(const struct aes_128_key *key, const u8 *in, u8 *out);
+void omac1_aes_128_vector_key(const struct aes_128_key *key, size_t num_elem,
+			      const u8 *addr[], const size_t *len, u8 *mac);
+void aes_128_ctr_encrypt_key(const struct aes_128_key *key, const u8 *nonce,
+			     u8 *data, size_t data_len);
+void aes_128_eax_encrypt_key(const struct aes_128_key *key,
+			     const u8 *nonce, size_t nonce_len,
+			     const u8 *hdr, size_t hdr_len,
+			     u8 *data, size_t data_len, u8 *tag);
+int __must_check aes_128_eax_decrypt_key(const struct aes_128_key *key,
+					 const u8 *nonce, size_t nonce_len,
+					 const u8 *hdr, size_t hdr_len,
+					 u8 *data, size_t data_len,
+					 const u8 *tag);
+
 int __must_check aes_wrap(const u8 *kek, int n, const u8 *plain, u8 *cipher);
 int __must_check aes_unwrap(const u8 *kek, int n, const u8 *cipher, u8 *plain);
 int __must_check omac1_aes_128_vector(const u8 *key, size_t num_elem,
@@ -19,6 +19,7 @@
 #include "sha1_i.h"
 #include "md5.h"
 #include "crypto.h"
+#include "sha_x86.h"
 
 typedef struct SHA1Context SHA1_CTX;
 
@@ -184,6 +185,14 @@ void SHA1Transform(u32 state[5], const unsigned char buffer[64])
 	CHAR64LONG16* block;
 #ifdef SHA1HANDSOFF
 	CHAR64LONG16 workspace;
+#endif
+#ifdef CONFIG_SHA_X86
+	if (sha_x86_enabled()) {
+		sha1_x86_blocks(state, buffer, 1);
+		return;
+	}
+#endif /* CONFIG_SHA_X86 */
+#ifdef SHA1HANDSOFF
 	block = &workspace;
 	os_memcpy(block, buffer, 64);
 #else
@@ -261,6 +270,13 @@ void SHA1Update(SHA1_CTX* context, const void *_data, u32 len)
 	if ((j + len) > 63) {
 		os_memcpy(&context->buffer[j], data, (i = 64-j));
 		SHA1Transform(context->state, context->buffer);
+#ifdef CONFIG_SHA_X86
+		if (i + 63 < len && sha_x86_enabled()) {
+			sha1_x86_blocks(context->state, &data[i],
+					(len - i) / 64);
+			i += (len - i) & ~63;
+		}
+#endif /* CONFIG_SHA_X86 */
 		for ( ; i + 63 < len; i += 64) {
 			SHA1Transform(context->state, &data[i]);
 		}
@@ -278,6 +294,7 @@ void SHA1Update(SHA1_CTX* context, const void *_data, u32 len)
 
 void SHA1Final(unsigned char digest[20], SHA1_CTX* context)
 {
+	static const unsigned char pad[64] = { 0x80 };
 	u32 i;
 	unsigned char finalcount[8];
 
@@ -286,10 +303,9 @@ void SHA1Final(unsigned char digest[20], SHA1_CTX* context)
 			((context->count[(i >= 4 ? 0 : 1)] >>
 			  ((3-(i & 3)) * 8) ) & 255);  /* Endian independent */
 	}
-	SHA1Update(context, (unsigned char *) "\200", 1);
-	while ((context->count[0] & 504) != 448) {
-		SHA1Update(context, (unsigned char *) "\0", 1);
-	}
+	/* 0x80 and the zeros up to 56 octets (mod 64) at once */
+	i = (context->count[0] >> 3) & 63;
+	SHA1Update(context, pad, i < 56 ? 56 - i : 120 - i);
 	SHA1Update(context, finalcount, 8);  /* Should cause a SHA1Transform()
 					      */
 	for (i = 0; i < 20; i++) {
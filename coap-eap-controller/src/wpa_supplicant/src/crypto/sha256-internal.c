@@ -17,6 +17,7 @@
 #include "common.h"
 #include "sha256.h"
 #include "crypto.h"
+#include "sha_x86.h"
 
 struct sha256_state {
 	u64 length;
@@ -100,6 +101,13 @@ static int sha256_compress(struct sha256_state *md, unsigned char *buf)
 	u32 t;
 	int i;
 
+#ifdef CONFIG_SHA_X86
+	if (sha_x86_enabled()) {
+		sha256_x86_blocks(md->state, buf, 1);
+		return 0;
+	}
+#endif /* CONFIG_SHA_X86 */
+
 	/* copy state into S */
 	for (i = 0; i < 8; i++) {
 		S[i] = md->state[i];
@@ -168,6 +176,17 @@ static int sha256_process(struct sha256_state *md, const unsigned char *in,
 		return -1;
 
 	while (inlen > 0) {
+#ifdef CONFIG_SHA_X86
+		if (md->curlen == 0 && inlen >= block_size &&
+		    sha_x86_enabled()) {
+			n = inlen / block_size;
+			sha256_x86_blocks(md->state, in, n);
+			md->length += n * block_size * 8;
+			in += n * block_size;
+			inlen -= n * block_size;
+			continue;
+		}
+#endif /* CONFIG_SHA_X86 */
 		if (md->curlen == 0 && inlen >= block_size) {
 			if (sha256_compress(md, (unsigned char *) in) < 0)
 				return -1;
@@ -0,0 +1,247 @@
+/*
+ * SHA-1 and SHA-256 with the x86 SHA extensions
+ * Copyright (c) 2021, Dan Garcia Carrillo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Alternatively, this software may be distributed under the terms of BSD
+ * license.
+ *
+ * See README and COPYING for more details.
+ *
+ * The compression functions of sha1-internal.c and sha256-internal.c use
+ * these when the CPU has the SHA extensions (cpuid), and their portable
+ * code otherwise, on other CPUs, or without CONFIG_SHA_X86. Only these
+ * functions are built for SHA/SSE4.1, so the rest of the library runs on
+ * any x86 CPU.
+ */
+
+#include "includes.h"
+
+#include "common.h"
+#include "sha_x86.h"
+
+#ifdef CONFIG_SHA_X86
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA_X86_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+/* -1 until the CPU has been checked */
+static int sha_x86 = -1;
+
+
+static int sha_x86_cpu(void)
+{
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3) ||
+	    !(c & bit_SSE4_1) || __get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, a, b, c, d);
+	return (b & bit_SHA) != 0;
+}
+
+
+/**
+ * sha_x86_enabled - Whether the SHA extensions are used
+ * Returns: 1 if they are, 0 if the portable code is
+ */
+int sha_x86_enabled(void)
+{
+	int enabled = __atomic_load_n(&sha_x86, __ATOMIC_RELAXED);
+
+	if (enabled < 0) {
+		enabled = sha_x86_cpu();
+		__atomic_store_n(&sha_x86, enabled, __ATOMIC_RELAXED);
+	}
+	return enabled;
+}
+
+
+/**
+ * sha_x86_enable - Use the SHA extensions or the portable code
+ * @enable: Whether the SHA extensions are to be used, if the CPU has them
+ * Returns: 1 if they are used, 0 if the portable code is
+ *
+ * They are used by default when the CPU has them, this is meant to compare
+ * both.
+ */
+int sha_x86_enable(int enable)
+{
+	int enabled = enable && sha_x86_cpu();
+
+	__atomic_store_n(&sha_x86, enabled, __ATOMIC_RELAXED);
+	return enabled;
+}
+
+
+/**
+ * sha1_x86_blocks - SHA-1 compression function of a number of blocks
+ * @state: Hash state (A..E)
+ * @data: blocks * 64 octets
+ * @blocks: Number of blocks
+ */
+SHA_X86_TARGET
+void sha1_x86_blocks(u32 state[5], const u8 *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					    0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e, prev, w[4];
+	int g;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state),
+				 0x1B);
+	e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	while (blocks--) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/* 20 groups of 4 rounds, w[g & 3] is W[4g..4g+3] */
+		prev = abcd;
+#pragma GCC unroll 20
+		for (g = 0; g < 20; g++) {
+			if (g < 4) {
+				w[g] = _mm_shuffle_epi8(_mm_loadu_si128(
+					(const __m128i *) (data + 16 * g)),
+							mask);
+			} else {
+				w[g & 3] = _mm_sha1msg2_epu32(
+					_mm_xor_si128(
+						_mm_sha1msg1_epu32(
+							w[g & 3],
+							w[(g + 1) & 3]),
+						w[(g + 2) & 3]),
+					w[(g + 3) & 3]);
+			}
+
+			if (g == 0)
+				e = _mm_add_epi32(e0, w[0]);
+			else
+				e = _mm_sha1nexte_epu32(prev, w[g & 3]);
+			prev = abcd;
+			switch (g / 5) {
+			case 0:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+				break;
+			case 1:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 1);
+				break;
+			case 2:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 2);
+				break;
+			default:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 3);
+				break;
+			}
+		}
+
+		e0 = _mm_sha1nexte_epu32(prev, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+		data += 64;
+	}
+
+	_mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+
+static const u32 sha256_x86_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+/**
+ * sha256_x86_blocks - SHA-256 compression function of a number of blocks
+ * @state: Hash state (A..H)
+ * @data: blocks * 64 octets
+ * @blocks: Number of blocks
+ */
+SHA_X86_TARGET
+void sha256_x86_blocks(u32 state[8], const u8 *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	__m128i abef, cdgh, abef_save, cdgh_save, msg, tmp, w[4];
+	int i;
+
+	/* The instructions take the state as ABEF and CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[0]),
+				0xB1);
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[4]),
+				 0x1B);
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+	while (blocks--) {
+		abef_save = abef;
+		cdgh_save = cdgh;
+
+		/* 16 groups of 4 rounds, w[i & 3] is W[4i..4i+3] */
+#pragma GCC unroll 16
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+					(const __m128i *) (data + 16 * i)),
+							mask);
+			} else {
+				tmp = _mm_alignr_epi8(w[(i + 3) & 3],
+						      w[(i + 2) & 3], 4);
+				w[i & 3] = _mm_sha256msg2_epu32(
+					_mm_add_epi32(
+						_mm_sha256msg1_epu32(
+							w[i & 3],
+							w[(i + 1) & 3]),
+						tmp),
+					w[(i + 3) & 3]);
+			}
+
+			msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128(
+				(const __m128i *) &sha256_x86_k[4 * i]));
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh,
+						     _mm_shuffle_epi32(msg,
+								       0x0E));
+		}
+
+		abef = _mm_add_epi32(abef, abef_save);
+		cdgh = _mm_add_epi32(cdgh, cdgh_save);
+		data += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(abef, 0x1B);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i *) &state[0],
+			 _mm_blend_epi16(tmp, cdgh, 0xF0));
+	_mm_storeu_si128((__m128i *) &state[4],
+			 _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+#else /* CONFIG_SHA_X86 */
+
+int sha_x86_enabled(void)
+{
+	return 0;
+}
+
+
+int sha_x86_enable(int enable)
+{
+	return 0;
+}
+
+#endif /* CONFIG_SHA_X86 */
@@ -0,0 +1,30 @@
+/*
+ * SHA-1 and SHA-256 with the x86 SHA extensions
+ * Copyright (c) 2021, Dan Garcia Carrillo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Alternatively, this software may be distributed under the terms of BSD
+ * license.
+ *
+ * See README and COPYING for more details.
+ */
+
+#ifndef SHA_X86_H
+#define SHA_X86_H
+
+#if defined(CONFIG_SHA_X86) && !defined(__x86_64__) && !defined(__i386__)
+#undef CONFIG_SHA_X86
+#endif
+
+int sha_x86_enabled(void);
+int sha_x86_enable(int enable);
+
+#ifdef CONFIG_SHA_X86
+void sha1_x86_blocks(u32 state[5], const u8 *data, size_t blocks);
+void sha256_x86_blocks(u32 state[8], const u8 *data, size_t blocks);
+#endif /* CONFIG_SHA_X86 */
+
+#endif /* SHA_X86_H */
@@ -261,6 +261,21 @@ tls_connection_set_params(void *tls_ctx, struct tls_connection *conn,
 int __must_check tls_global_set_params(
 	void *tls_ctx, const struct tls_connection_params *params);
 
+/**
+ * tls_global_set_session_cache - Set session resumption of the server
+ * @tls_ctx: TLS context data from tls_init()
+ * @size: Max number of sessions kept to be resumed by session ID, 0 = none
+ * @lifetime: Seconds a session can be resumed after its full handshake
+ * @tickets: 1 = issue and accept session tickets (RFC 5077)
+ * Returns: 0 on success, -1 on failure
+ *
+ * The sessions are shared by all the server connections of tls_ctx and are
+ * lost with it. Calling this again drops the sessions kept so far.
+ */
+int __must_check tls_global_set_session_cache(void *tls_ctx, size_t size,
+					      unsigned int lifetime,
+					      int tickets);
+
 /**
  * tls_global_set_verify - Set global certificate verification options
  * @tls_ctx: TLS context data from tls_init()
@@ -788,6 +788,13 @@ fail:
 }
 
 
+int tls_global_set_session_cache(void *ssl_ctx, size_t size,
+				 unsigned int lifetime, int tickets)
+{
+	return -1;
+}
+
+
 int tls_global_set_verify(void *ssl_ctx, int check_crl)
 {
 	/* TODO */
@@ -21,6 +21,7 @@
 #include "tls.h"
 #include "tls/tlsv1_client.h"
 #include "tls/tlsv1_server.h"
+#include "tls/tlsv1_session_cache.h"
 
 
 static int tls_ref_count = 0;
@@ -28,6 +29,7 @@ static int tls_ref_count = 0;
 struct tls_global {
 	int server;
 	struct tlsv1_credentials *server_cred;
+	struct tlsv1_session_cache *session_cache;
 	int check_crl;
 };
 
@@ -64,12 +66,16 @@ void tls_deinit(void *ssl_ctx)
 {
 	struct tls_global *global = ssl_ctx;
 	tls_ref_count--;
+#ifdef CONFIG_TLS_INTERNAL_SERVER
+	/* Every context has its own credentials */
+	tlsv1_cred_free(global->server_cred);
+	tlsv1_session_cache_deinit(global->session_cache);
+#endif /* CONFIG_TLS_INTERNAL_SERVER */
 	if (tls_ref_count == 0) {
 #ifdef CONFIG_TLS_INTERNAL_CLIENT
 		tlsv1_client_global_deinit();
 #endif /* CONFIG_TLS_INTERNAL_CLIENT */
 #ifdef CONFIG_TLS_INTERNAL_SERVER
-		tlsv1_cred_free(global->server_cred);
 		tlsv1_server_global_deinit();
 #endif /* CONFIG_TLS_INTERNAL_SERVER */
 	}
@@ -108,6 +114,9 @@ struct tls_connection * tls_connection_init(void *tls_ctx)
 			os_free(conn);
 			return NULL;
 		}
+		if (global->session_cache)
+			tlsv1_server_set_session_cache(conn->server,
+						       global->session_cache);
 	}
 #endif /* CONFIG_TLS_INTERNAL_SERVER */
 
@@ -268,6 +277,25 @@ int tls_global_set_params(void *tls_ctx,
 }
 
 
+int tls_global_set_session_cache(void *tls_ctx, size_t size,
+				 unsigned int lifetime, int tickets)
+{
+#ifdef CONFIG_TLS_INTERNAL_SERVER
+	struct tls_global *global = tls_ctx;
+
+	tlsv1_session_cache_deinit(global->session_cache);
+	global->session_cache = NULL;
+	if (size == 0 && !tickets)
+		return 0;
+	global->session_cache = tlsv1_session_cache_init(size, lifetime,
+							 tickets);
+	return global->session_cache ? 0 : -1;
+#else /* CONFIG_TLS_INTERNAL_SERVER */
+	return -1;
+#endif /* CONFIG_TLS_INTERNAL_SERVER */
+}
+
+
 int tls_global_set_verify(void *tls_ctx, int check_crl)
 {
 	struct tls_global *global = tls_ctx;
@@ -71,6 +71,13 @@ int tls_global_set_params(void *tls_ctx,
 }
 
 
+int tls_global_set_session_cache(void *tls_ctx, size_t size,
+				 unsigned int lifetime, int tickets)
+{
+	return -1;
+}
+
+
 int tls_global_set_verify(void *tls_ctx, int check_crl)
 {
 	return -1;
@@ -58,6 +58,10 @@ struct tls_global {
 
 static struct tls_global *tls_global = NULL;
 
+/* SSL_CTX ex_data set by tls_global_set_session_cache() */
+static int tls_ex_idx_resumption = -1;
+static const unsigned char tls_resumption_sid_ctx[] = "EAP server";
+
 
 struct tls_connection {
 	SSL *ssl;
@@ -1446,6 +1450,46 @@ static int tls_global_ca_cert(SSL_CTX *ssl_ctx, const char *ca_cert)
 }
 
 
+int tls_global_set_session_cache(void *ssl_ctx, size_t size,
+				 unsigned int lifetime, int tickets)
+{
+	SSL_CTX *ssl = ssl_ctx;
+	int resumption = size > 0 || tickets;
+
+	if (tls_ex_idx_resumption < 0) {
+		tls_ex_idx_resumption = SSL_CTX_get_ex_new_index(0, NULL, NULL,
+								 NULL, NULL);
+		if (tls_ex_idx_resumption < 0)
+			return -1;
+	}
+
+	SSL_CTX_set_session_cache_mode(ssl, size > 0 ? SSL_SESS_CACHE_SERVER :
+				       SSL_SESS_CACHE_OFF);
+	SSL_CTX_sess_set_cache_size(ssl, size);
+	SSL_CTX_set_timeout(ssl, lifetime);
+#ifdef SSL_OP_NO_TICKET
+	if (tickets)
+		SSL_CTX_clear_options(ssl, SSL_OP_NO_TICKET);
+	else
+		SSL_CTX_set_options(ssl, SSL_OP_NO_TICKET);
+#else /* SSL_OP_NO_TICKET */
+	if (tickets)
+		return -1;
+#endif /* SSL_OP_NO_TICKET */
+
+	if (resumption &&
+	    !SSL_CTX_set_session_id_context(ssl, tls_resumption_sid_ctx,
+					    sizeof(tls_resumption_sid_ctx))) {
+		tls_show_errors(MSG_INFO, __func__, "Failed to set session "
+				"id context");
+		return -1;
+	}
+	SSL_CTX_set_ex_data(ssl, tls_ex_idx_resumption,
+			    resumption ? (void *) tls_resumption_sid_ctx : NULL);
+	return 0;
+}
+
+
 int tls_global_set_verify(void *ssl_ctx, int check_crl)
 {
 	int flags;
@@ -1517,12 +1561,16 @@ int tls_connection_set_verify(void *ssl_ctx, struct tls_connection *conn,
 	 * value in order to effectively disable session resumption for now
 	 * since not all areas of the server code are ready for it (e.g.,
 	 * EAP-TTLS needs special handling for Phase 2 after abbreviated TLS
-	 * handshake).
+	 * handshake). Resumption enabled with tls_global_set_session_cache()
+	 * keeps the context of the SSL_CTX, shared by all its connections.
 	 */
-	counter++;
-	SSL_set_session_id_context(conn->ssl,
-				   (const unsigned char *) &counter,
-				   sizeof(counter));
+	if (tls_ex_idx_resumption < 0 ||
+	    SSL_CTX_get_ex_data(ssl_ctx, tls_ex_idx_resumption) == NULL) {
+		counter++;
+		SSL_set_session_id_context(conn->ssl,
+					   (const unsigned char *) &counter,
+					   sizeof(counter));
+	}
 
 	return 0;
 }
@@ -22,53 +22,87 @@
 #define aes_block_size 16
 
 
+/**
+ * eap_psk_keys_setup - Derive AK and KDK from a PSK, with their key schedules
+ * @psk: PSK (16 bytes)
+ * @keys: Keys to fill in
+ */
+void eap_psk_keys_setup(const u8 *psk, struct eap_psk_keys *keys)
+{
+	struct aes_128_key psk_key;
+
+	aes_128_key_setup(&psk_key, psk);
+	os_memset(keys->ak, 0, aes_block_size);
+	aes_128_key_encrypt(&psk_key, keys->ak, keys->ak);
+	os_memcpy(keys->kdk, keys->ak, aes_block_size);
+	keys->ak[aes_block_size - 1] ^= 0x01;
+	keys->kdk[aes_block_size - 1] ^= 0x02;
+	aes_128_key_encrypt(&psk_key, keys->ak, keys->ak);
+	aes_128_key_encrypt(&psk_key, keys->kdk, keys->kdk);
+	os_memset(&psk_key, 0, sizeof(psk_key));
+
+	aes_128_key_setup(&keys->ak_key, keys->ak);
+	aes_128_key_setup(&keys->kdk_key, keys->kdk);
+}
+
+
 int eap_psk_key_setup(const u8 *psk, u8 *ak, u8 *kdk)
 {
-	os_memset(ak, 0, aes_block_size);
-	if (aes_128_encrypt_block(psk, ak, ak))
-		return -1;
-	os_memcpy(kdk, ak, aes_block_size);
-	ak[aes_block_size - 1] ^= 0x01;
-	kdk[aes_block_size - 1] ^= 0x02;
-	if (aes_128_encrypt_block(psk, ak, ak) ||
-	    aes_128_encrypt_block(psk, kdk, kdk))
-		return -1;
+	struct eap_psk_keys keys;
+
+	eap_psk_keys_setup(psk, &keys);
+	os_memcpy(ak, keys.ak, aes_block_size);
+	os_memcpy(kdk, keys.kdk, aes_block_size);
+	os_memset(&keys, 0, sizeof(keys));
 	return 0;
 }
 
 
-int eap_psk_derive_keys(const u8 *kdk, const u8 *rand_p, u8 *tek, u8 *msk,
-			u8 *emsk)
+/**
+ * eap_psk_derive_keys_key - Derive TEK, MSK and EMSK with the KDK schedule
+ * @kdk: Key schedule of the KDK
+ * @rand_p: RAND_P (16 bytes)
+ * @tek: Buffer for TEK (16 bytes)
+ * @msk: Buffer for MSK (EAP_MSK_LEN bytes)
+ * @emsk: Buffer for EMSK (EAP_EMSK_LEN bytes)
+ */
+void eap_psk_derive_keys_key(const struct aes_128_key *kdk, const u8 *rand_p,
+			     u8 *tek, u8 *msk, u8 *emsk)
 {
 	u8 hash[aes_block_size];
 	u8 counter = 1;
 	int i;
 
-	if (aes_128_encrypt_block(kdk, rand_p, hash))
-		return -1;
+	aes_128_key_encrypt(kdk, rand_p, hash);
 
 	hash[aes_block_size - 1] ^= counter;
-	if (aes_128_encrypt_block(kdk, hash, tek))
-		return -1;
+	aes_128_key_encrypt(kdk, hash, tek);
 	hash[aes_block_size - 1] ^= counter;
 	counter++;
 
 	for (i = 0; i < EAP_MSK_LEN / aes_block_size; i++) {
 		hash[aes_block_size - 1] ^= counter;
-		if (aes_128_encrypt_block(kdk, hash, &msk[i * aes_block_size]))
-			return -1;
+		aes_128_key_encrypt(kdk, hash, &msk[i * aes_block_size]);
 		hash[aes_block_size - 1] ^= counter;
 		counter++;
 	}
 
 	for (i = 0; i < EAP_EMSK_LEN / aes_block_size; i++) {
 		hash[aes_block_size - 1] ^= counter;
-		if (aes_128_encrypt_block(kdk, hash,
-					  &emsk[i * aes_block_size]))
-			return -1;
+		aes_128_key_encrypt(kdk, hash, &emsk[i * aes_block_size]);
 		hash[aes_block_size - 1] ^= counter;
 		counter++;
 	}
+}
+
+
+int eap_psk_derive_keys(const u8 *kdk, const u8 *rand_p, u8 *tek, u8 *msk,
+			u8 *emsk)
+{
+	struct aes_128_key kdk_key;
 
+	aes_128_key_setup(&kdk_key, kdk);
+	eap_psk_derive_keys_key(&kdk_key, rand_p, tek, msk, emsk);
+	os_memset(&kdk_key, 0, sizeof(kdk_key));
 	return 0;
 }
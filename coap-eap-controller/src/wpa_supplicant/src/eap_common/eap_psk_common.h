@@ -15,6 +15,8 @@
 #ifndef EAP_PSK_COMMON_H
 #define EAP_PSK_COMMON_H
 
+#include "crypto/aes_wrap.h"
+
 
 #define EAP_PSK_RAND_LEN 16
 #define EAP_PSK_MAC_LEN 16
@@ -71,8 +73,20 @@ struct eap_psk_hdr_4 {
 #endif /* _MSC_VER */
 
 
+/* AK and KDK of a PSK with their AES-128 key schedules: they only depend
+ * on the PSK, so they can be derived once per device. */
+struct eap_psk_keys {
+	u8 ak[EAP_PSK_AK_LEN];
+	u8 kdk[EAP_PSK_KDK_LEN];
+	struct aes_128_key ak_key;
+	struct aes_128_key kdk_key;
+};
+
 int __must_check eap_psk_key_setup(const u8 *psk, u8 *ak, u8 *kdk);
 int __must_check eap_psk_derive_keys(const u8 *kdk, const u8 *rand_p, u8 *tek,
 				     u8 *msk, u8 *emsk);
+void eap_psk_keys_setup(const u8 *psk, struct eap_psk_keys *keys);
+void eap_psk_derive_keys_key(const struct aes_128_key *kdk, const u8 *rand_p,
+			     u8 *tek, u8 *msk, u8 *emsk);
 
 #endif /* EAP_PSK_COMMON_H */
@@ -26,7 +26,10 @@
 struct eap_psk_data {
 	enum { PSK_INIT, PSK_MAC_SENT, PSK_DONE } state;
 	u8 rand_p[EAP_PSK_RAND_LEN];
-	u8 ak[EAP_PSK_AK_LEN], kdk[EAP_PSK_KDK_LEN], tek[EAP_PSK_TEK_LEN];
+	/* AK and KDK with their key schedules, derived once per method */
+	struct eap_psk_keys keys;
+	u8 tek[EAP_PSK_TEK_LEN];
+	struct aes_128_key tek_key;
 	u8 *id_s, *id_p;
 	size_t id_s_len, id_p_len;
 	u8 msk[EAP_MSK_LEN];
@@ -50,12 +53,11 @@ static void * eap_psk_init(struct eap_sm *sm)
 	data = os_zalloc(sizeof(*data));
 	if (data == NULL)
 		return NULL;
-	if (eap_psk_key_setup(password, data->ak, data->kdk)) {
-		os_free(data);
-		return NULL;
-	}
-	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: AK", data->ak, EAP_PSK_AK_LEN);
-	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: KDK", data->kdk, EAP_PSK_KDK_LEN);
+	eap_psk_keys_setup(password, &data->keys);
+	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: AK", data->keys.ak,
+			EAP_PSK_AK_LEN);
+	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: KDK", data->keys.kdk,
+			EAP_PSK_KDK_LEN);
 	data->state = PSK_INIT;
 
 	identity = eap_get_config_identity(sm, &identity_len);
@@ -80,6 +82,7 @@ static void eap_psk_deinit(struct eap_sm *sm, void *priv)
 	struct eap_psk_data *data = priv;
 	os_free(data->id_s);
 	os_free(data->id_p);
+	os_memset(data, 0, sizeof(*data));
 	os_free(data);
 }
 
@@ -91,8 +94,8 @@ static struct wpabuf * eap_psk_process_1(struct eap_psk_data *data,
 	const struct eap_psk_hdr_1 *hdr1;
 	struct eap_psk_hdr_2 *hdr2;
 	struct wpabuf *resp;
-	u8 *buf, *pos;
-	size_t buflen, len;
+	const u8 *addr[4];
+	size_t vlen[4], len;
 	const u8 *cpos;
 
 	wpa_printf(MSG_DEBUG, "EAP-PSK: in INIT state");
@@ -147,25 +150,16 @@ static struct wpabuf * eap_psk_process_1(struct eap_psk_data *data,
 	os_memcpy(hdr2->rand_p, data->rand_p, EAP_PSK_RAND_LEN);
 	wpabuf_put_data(resp, data->id_p, data->id_p_len);
 	/* MAC_P = OMAC1-AES-128(AK, ID_P||ID_S||RAND_S||RAND_P) */
-	buflen = data->id_p_len + data->id_s_len + 2 * EAP_PSK_RAND_LEN;
-	buf = os_malloc(buflen);
-	if (buf == NULL) {
-		wpabuf_free(resp);
-		return NULL;
-	}
-	os_memcpy(buf, data->id_p, data->id_p_len);
-	pos = buf + data->id_p_len;
-	os_memcpy(pos, data->id_s, data->id_s_len);
-	pos += data->id_s_len;
-	os_memcpy(pos, hdr1->rand_s, EAP_PSK_RAND_LEN);
-	pos += EAP_PSK_RAND_LEN;
-	os_memcpy(pos, data->rand_p, EAP_PSK_RAND_LEN);
-	if (omac1_aes_128(data->ak, buf, buflen, hdr2->mac_p)) {
-		os_free(buf);
-		wpabuf_free(resp);
-		return NULL;
-	}
-	os_free(buf);
+	addr[0] = data->id_p;
+	vlen[0] = data->id_p_len;
+	addr[1] = data->id_s;
+	vlen[1] = data->id_s_len;
+	addr[2] = hdr1->rand_s;
+	vlen[2] = EAP_PSK_RAND_LEN;
+	addr[3] = data->rand_p;
+	vlen[3] = EAP_PSK_RAND_LEN;
+	omac1_aes_128_vector_key(&data->keys.ak_key, 4, addr, vlen,
+				 hdr2->mac_p);
 	wpa_hexdump(MSG_DEBUG, "EAP-PSK: RAND_P", hdr2->rand_p,
 		    EAP_PSK_RAND_LEN);
 	wpa_hexdump(MSG_DEBUG, "EAP-PSK: MAC_P", hdr2->mac_p, EAP_PSK_MAC_LEN);
@@ -185,10 +179,10 @@ static struct wpabuf * eap_psk_process_3(struct eap_psk_data *data,
 	const struct eap_psk_hdr_3 *hdr3;
 	struct eap_psk_hdr_4 *hdr4;
 	struct wpabuf *resp;
-	u8 *buf, *rpchannel, nonce[16], *decrypted;
-	const u8 *pchannel, *tag, *msg;
+	u8 *rpchannel, nonce[16], *decrypted, decrypted_buf[64];
+	const u8 *pchannel, *tag, *msg, *addr[2];
 	u8 mac[EAP_PSK_MAC_LEN];
-	size_t buflen, left, data_len, len, plen;
+	size_t vlen[2], left, data_len, len, plen;
 	int failed = 0;
 	const u8 *pos;
 
@@ -229,17 +223,11 @@ static struct wpabuf * eap_psk_process_3(struct eap_psk_data *data,
 	}
 
 	/* MAC_S = OMAC1-AES-128(AK, ID_S||RAND_P) */
-	buflen = data->id_s_len + EAP_PSK_RAND_LEN;
-	buf = os_malloc(buflen);
-	if (buf == NULL)
-		return NULL;
-	os_memcpy(buf, data->id_s, data->id_s_len);
-	os_memcpy(buf + data->id_s_len, data->rand_p, EAP_PSK_RAND_LEN);
-	if (omac1_aes_128(data->ak, buf, buflen, mac)) {
-		os_free(buf);
-		return NULL;
-	}
-	os_free(buf);
+	addr[0] = data->id_s;
+	vlen[0] = data->id_s_len;
+	addr[1] = data->rand_p;
+	vlen[1] = EAP_PSK_RAND_LEN;
+	omac1_aes_128_vector_key(&data->keys.ak_key, 2, addr, vlen, mac);
 	if (os_memcmp(mac, hdr3->mac_s, EAP_PSK_MAC_LEN) != 0) {
 		wpa_printf(MSG_WARNING, "EAP-PSK: Invalid MAC_S in third "
 			   "message");
@@ -249,12 +237,9 @@ static struct wpabuf * eap_psk_process_3(struct eap_psk_data *data,
 	}
 	wpa_printf(MSG_DEBUG, "EAP-PSK: MAC_S verified successfully");
 
-	if (eap_psk_derive_keys(data->kdk, data->rand_p, data->tek,
-				data->msk, data->emsk)) {
-		ret->methodState = METHOD_DONE;
-		ret->decision = DECISION_FAIL;
-		return NULL;
-	}
+	eap_psk_derive_keys_key(&data->keys.kdk_key, data->rand_p, data->tek,
+				data->msk, data->emsk);
+	aes_128_key_setup(&data->tek_key, data->tek);
 	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: TEK", data->tek, EAP_PSK_TEK_LEN);
 	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: MSK", data->msk, EAP_MSK_LEN);
 	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: EMSK", data->emsk, EAP_EMSK_LEN);
@@ -276,7 +261,8 @@ static struct wpabuf * eap_psk_process_3(struct eap_psk_data *data,
 		    wpabuf_head(reqData), 5);
 	wpa_hexdump(MSG_MSGDUMP, "EAP-PSK: PCHANNEL - cipher msg", msg, left);
 
-	decrypted = os_malloc(left);
+	decrypted = left <= sizeof(decrypted_buf) ? decrypted_buf :
+		os_malloc(left);
 	if (decrypted == NULL) {
 		ret->methodState = METHOD_DONE;
 		ret->decision = DECISION_FAIL;
@@ -284,13 +270,14 @@ static struct wpabuf * eap_psk_process_3(struct eap_psk_data *data,
 	}
 	os_memcpy(decrypted, msg, left);
 
-	if (aes_128_eax_decrypt(data->tek, nonce, sizeof(nonce),
-				wpabuf_head(reqData),
-				sizeof(struct eap_hdr) + 1 +
-				sizeof(*hdr3) - EAP_PSK_MAC_LEN, decrypted,
-				left, tag)) {
+	if (aes_128_eax_decrypt_key(&data->tek_key, nonce, sizeof(nonce),
+				    wpabuf_head(reqData),
+				    sizeof(struct eap_hdr) + 1 +
+				    sizeof(*hdr3) - EAP_PSK_MAC_LEN, decrypted,
+				    left, tag)) {
 		wpa_printf(MSG_WARNING, "EAP-PSK: PCHANNEL decryption failed");
-		os_free(decrypted);
+		if (decrypted != decrypted_buf)
+			os_free(decrypted);
 		return NULL;
 	}
 	wpa_hexdump(MSG_DEBUG, "EAP-PSK: Decrypted PCHANNEL message",
@@ -320,7 +307,8 @@ static struct wpabuf * eap_psk_process_3(struct eap_psk_data *data,
 	resp = eap_msg_alloc(EAP_VENDOR_IETF, EAP_TYPE_PSK, plen,
 			     EAP_CODE_RESPONSE, eap_get_id(reqData));
 	if (resp == NULL) {
-		os_free(decrypted);
+		if (decrypted != decrypted_buf)
+			os_free(decrypted);
 		return NULL;
 	}
 	hdr4 = wpabuf_put(resp, sizeof(*hdr4));
@@ -348,14 +336,10 @@ static struct wpabuf * eap_psk_process_3(struct eap_psk_data *data,
 
 	wpa_hexdump(MSG_DEBUG, "EAP-PSK: reply message (plaintext)",
 		    rpchannel + 4 + 16, data_len);
-	if (aes_128_eax_encrypt(data->tek, nonce, sizeof(nonce),
+	aes_128_eax_encrypt_key(&data->tek_key, nonce, sizeof(nonce),
 				wpabuf_head(resp),
 				sizeof(struct eap_hdr) + 1 + sizeof(*hdr4),
-				rpchannel + 4 + 16, data_len, rpchannel + 4)) {
-		os_free(decrypted);
-		wpabuf_free(resp);
-		return NULL;
-	}
+				rpchannel + 4 + 16, data_len, rpchannel + 4);
 	wpa_hexdump(MSG_DEBUG, "EAP-PSK: reply message (PCHANNEL)",
 		    rpchannel, 4 + 16 + data_len);
 
@@ -365,7 +349,8 @@ static struct wpabuf * eap_psk_process_3(struct eap_psk_data *data,
 	ret->methodState = METHOD_DONE;
 	ret->decision = failed ? DECISION_FAIL : DECISION_UNCOND_SUCC;
 
-	os_free(decrypted);
+	if (decrypted != decrypted_buf)
+		os_free(decrypted);
 
 	return resp;
 }
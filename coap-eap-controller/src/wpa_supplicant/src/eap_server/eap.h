@@ -83,10 +83,17 @@ struct eap_eapol_interface {
 	Boolean aaaTimeout;
 };
 
+struct eap_psk_keys;
+
 struct eapol_callbacks {
 	int (*get_eap_user)(void *ctx, const u8 *identity, size_t identity_len,
 			    int phase2, struct eap_user *user);
 	const char * (*get_eap_req_id_text)(void *ctx, size_t *len);
+	/* Optional: AK and KDK of an EAP-PSK peer already derived by the
+	 * credential store, 0 if they are found. Without it (or if it fails)
+	 * they are derived from the password given by get_eap_user. */
+	int (*get_eap_psk_keys)(void *ctx, const u8 *identity,
+				size_t identity_len, struct eap_psk_keys *keys);
 
 	struct eap_method *eap_methods; //Rafa: Lists of eap_methods. Useful in tunneled EAP methods.
 
@@ -132,5 +139,7 @@ void eap_sm_pending_cb(struct eap_sm *sm);
 int eap_sm_method_pending(struct eap_sm *sm);
 const u8 * eap_get_identity(struct eap_sm *sm, size_t *len);
 struct eap_eapol_interface * eap_get_interface(struct eap_sm *sm);
+int eap_server_sm_get_resume_state(struct eap_sm *sm, int *passthrough);
+void eap_server_sm_resume(struct eap_sm *sm, int passthrough, int id);
 
 #endif /* EAP_H */
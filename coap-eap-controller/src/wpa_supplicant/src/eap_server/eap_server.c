@@ -1365,3 +1365,46 @@ struct eap_eapol_interface * eap_get_interface(struct eap_sm *sm)
 {
 	return &sm->eap_if;
 }
+
+
+/**
+ * eap_server_sm_get_resume_state - Get the state needed to resume a session
+ * @sm: Pointer to EAP state machine allocated with eap_server_sm_init()
+ * @passthrough: Set to 1 if the state machine is in pass-through mode
+ * Returns: Identifier of the current EAP request, -1 if none
+ *
+ * Together with the last request sent to the peer, this is enough to
+ * restore a state machine waiting for a response with
+ * eap_server_sm_resume() in another process.
+ */
+int eap_server_sm_get_resume_state(struct eap_sm *sm, int *passthrough)
+{
+	*passthrough = sm->EAP_state >= EAP_INITIALIZE_PASSTHROUGH;
+	return sm->currentId;
+}
+
+
+/**
+ * eap_server_sm_resume - Restore a state machine waiting for a response
+ * @sm: Pointer to EAP state machine allocated with eap_server_sm_init()
+ * @passthrough: Whether the session was in pass-through mode
+ * @id: Identifier of the EAP request the peer is answering
+ *
+ * A state machine which is not in pass-through mode must have sent its
+ * first request (eapRestart and one step) before it is resumed; only its
+ * identifier is changed. In pass-through mode the state machine is placed
+ * in IDLE2, so the next response is forwarded to the AAA server.
+ */
+void eap_server_sm_resume(struct eap_sm *sm, int passthrough, int id)
+{
+	if (passthrough) {
+		sm->EAP_state = EAP_IDLE2;
+		sm->eap_if.eapReq = FALSE;
+		sm->eap_if.eapNoReq = FALSE;
+		sm->eap_if.eapResp = FALSE;
+		sm->eap_if.aaaEapResp = FALSE;
+		sm->retransCount = 0;
+	}
+	sm->currentId = id;
+	sm->lastId = id;
+}
@@ -22,14 +22,21 @@
 #include "eap_common/eap_psk_common.h"
 #include "eap_server/eap_i.h"
 
+/* Stack buffer of the decrypted PCHANNEL of PSK-4. */
+#define EAP_PSK_PCHANNEL_BUF_LEN 64
+
 
 struct eap_psk_data {
 	enum { PSK_1, PSK_3, SUCCESS, FAILURE } state;
 	u8 rand_s[EAP_PSK_RAND_LEN];
 	u8 rand_p[EAP_PSK_RAND_LEN];
-	u8 *id_p, *id_s;
-	size_t id_p_len, id_s_len;
-	u8 ak[EAP_PSK_AK_LEN], kdk[EAP_PSK_KDK_LEN], tek[EAP_PSK_TEK_LEN];
+	u8 *id_s;
+	size_t id_s_len;
+	/* The MACs, the keys and the PCHANNEL use the key schedules, the
+	 * messages are processed without allocating memory. */
+	struct eap_psk_keys keys;
+	u8 tek[EAP_PSK_TEK_LEN];
+	struct aes_128_key tek_key;
 	u8 msk[EAP_MSK_LEN];
 	u8 emsk[EAP_EMSK_LEN];
 };
@@ -53,7 +60,7 @@ static void * eap_psk_init(struct eap_sm *sm)
 static void eap_psk_reset(struct eap_sm *sm, void *priv)
 {
 	struct eap_psk_data *data = priv;
-	os_free(data->id_p);
+	os_memset(data, 0, sizeof(*data));
 	os_free(data);
 }
 
@@ -98,8 +105,9 @@ static struct wpabuf * eap_psk_build_3(struct eap_sm *sm,
 {
 	struct wpabuf *req;
 	struct eap_psk_hdr_3 *psk;
-	u8 *buf, *pchannel, nonce[16];
-	size_t buflen;
+	u8 *pchannel, nonce[16];
+	const u8 *addr[2];
+	size_t len[2];
 
 	wpa_printf(MSG_DEBUG, "EAP-PSK: PSK-3 (sending)");
 
@@ -117,20 +125,15 @@ static struct wpabuf * eap_psk_build_3(struct eap_sm *sm,
 	os_memcpy(psk->rand_s, data->rand_s, EAP_PSK_RAND_LEN);
 
 	/* MAC_S = OMAC1-AES-128(AK, ID_S||RAND_P) */
-	buflen = data->id_s_len + EAP_PSK_RAND_LEN;
-	buf = os_malloc(buflen);
-	if (buf == NULL)
-		goto fail;
-
-	os_memcpy(buf, data->id_s, data->id_s_len);
-	os_memcpy(buf + data->id_s_len, data->rand_p, EAP_PSK_RAND_LEN);
-	if (omac1_aes_128(data->ak, buf, buflen, psk->mac_s))
-		goto fail;
-	os_free(buf);
-
-	if (eap_psk_derive_keys(data->kdk, data->rand_p, data->tek, data->msk,
-				data->emsk))
-		goto fail;
+	addr[0] = data->id_s;
+	len[0] = data->id_s_len;
+	addr[1] = data->rand_p;
+	len[1] = EAP_PSK_RAND_LEN;
+	omac1_aes_128_vector_key(&data->keys.ak_key, 2, addr, len, psk->mac_s);
+
+	eap_psk_derive_keys_key(&data->keys.kdk_key, data->rand_p, data->tek,
+				data->msk, data->emsk);
+	aes_128_key_setup(&data->tek_key, data->tek);
 	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: TEK", data->tek, EAP_PSK_TEK_LEN);
 	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: MSK", data->msk, EAP_MSK_LEN);
 	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: EMSK", data->emsk, EAP_EMSK_LEN);
@@ -142,19 +145,13 @@ static struct wpabuf * eap_psk_build_3(struct eap_sm *sm,
 	pchannel[4 + 16] = EAP_PSK_R_FLAG_DONE_SUCCESS << 6;
 	wpa_hexdump(MSG_DEBUG, "EAP-PSK: PCHANNEL (plaintext)",
 		    pchannel, 4 + 16 + 1);
-	if (aes_128_eax_encrypt(data->tek, nonce, sizeof(nonce),
+	aes_128_eax_encrypt_key(&data->tek_key, nonce, sizeof(nonce),
 				wpabuf_head(req), 22,
-				pchannel + 4 + 16, 1, pchannel + 4))
-		goto fail;
+				pchannel + 4 + 16, 1, pchannel + 4);
 	wpa_hexdump(MSG_DEBUG, "EAP-PSK: PCHANNEL (encrypted)",
 		    pchannel, 4 + 16 + 1);
 
 	return req;
-
-fail:
-	wpabuf_free(req);
-	data->state = FAILURE;
-	return NULL;
 }
 
 
@@ -220,8 +217,9 @@ static void eap_psk_process_2(struct eap_sm *sm,
 			      struct wpabuf *respData)
 {
 	const struct eap_psk_hdr_2 *resp;
-	u8 *pos, mac[EAP_PSK_MAC_LEN], *buf;
-	size_t left, buflen;
+	u8 mac[EAP_PSK_MAC_LEN];
+	const u8 *addr[4], *id_p;
+	size_t len[4], left, id_p_len;
 	int i;
 	const u8 *cpos;
 
@@ -240,21 +238,19 @@ static void eap_psk_process_2(struct eap_sm *sm,
 	cpos = (const u8 *) (resp + 1);
 	left -= sizeof(*resp);
 
-	os_free(data->id_p);
-	data->id_p = os_malloc(left);
-	if (data->id_p == NULL) {
-		wpa_printf(MSG_INFO, "EAP-PSK: Failed to allocate memory for "
-			   "ID_P");
-		return;
-	}
-	os_memcpy(data->id_p, cpos, left);
-	data->id_p_len = left;
-	wpa_hexdump_ascii(MSG_MSGDUMP, "EAP-PSK: ID_P",
-			  data->id_p, data->id_p_len);
+	/* ID_P is only used here, it is not copied. */
+	id_p = cpos;
+	id_p_len = left;
+	wpa_hexdump_ascii(MSG_MSGDUMP, "EAP-PSK: ID_P", id_p, id_p_len);
 
-	if (eap_user_get(sm, data->id_p, data->id_p_len, 0) < 0) {
+	if (sm->eapol_cb->get_eap_psk_keys != NULL &&
+	    sm->eapol_cb->get_eap_psk_keys(sm->eapol_ctx, id_p, id_p_len,
+					   &data->keys) == 0)
+		goto keys_ready;
+
+	if (eap_user_get(sm, id_p, id_p_len, 0) < 0) {
 		wpa_hexdump_ascii(MSG_DEBUG, "EAP-PSK: unknown ID_P",
-				  data->id_p, data->id_p_len);
+				  id_p, id_p_len);
 		data->state = FAILURE;
 		return;
 	}
@@ -274,7 +270,7 @@ static void eap_psk_process_2(struct eap_sm *sm,
 	    sm->user->methods[i].method != EAP_TYPE_PSK) {
 		wpa_hexdump_ascii(MSG_DEBUG,
 				  "EAP-PSK: EAP-PSK not enabled for ID_P",
-				  data->id_p, data->id_p_len);
+				  id_p, id_p_len);
 		data->state = FAILURE;
 		return;
 	}
@@ -283,41 +279,32 @@ static void eap_psk_process_2(struct eap_sm *sm,
 	    sm->user->password_len != EAP_PSK_PSK_LEN) {
 		wpa_hexdump_ascii(MSG_DEBUG, "EAP-PSK: invalid password in "
 				  "user database for ID_P",
-				  data->id_p, data->id_p_len);
-		data->state = FAILURE;
-		return;
-	}
-	if (eap_psk_key_setup(sm->user->password, data->ak, data->kdk)) {
+				  id_p, id_p_len);
 		data->state = FAILURE;
 		return;
 	}
-	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: AK", data->ak, EAP_PSK_AK_LEN);
-	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: KDK", data->kdk, EAP_PSK_KDK_LEN);
+	eap_psk_keys_setup(sm->user->password, &data->keys);
+
+keys_ready:
+	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: AK", data->keys.ak,
+			EAP_PSK_AK_LEN);
+	wpa_hexdump_key(MSG_DEBUG, "EAP-PSK: KDK", data->keys.kdk,
+			EAP_PSK_KDK_LEN);
 
 	wpa_hexdump(MSG_MSGDUMP, "EAP-PSK: RAND_P (client rand)",
 		    resp->rand_p, EAP_PSK_RAND_LEN);
 	os_memcpy(data->rand_p, resp->rand_p, EAP_PSK_RAND_LEN);
 
 	/* MAC_P = OMAC1-AES-128(AK, ID_P||ID_S||RAND_S||RAND_P) */
-	buflen = data->id_p_len + data->id_s_len + 2 * EAP_PSK_RAND_LEN;
-	buf = os_malloc(buflen);
-	if (buf == NULL) {
-		data->state = FAILURE;
-		return;
-	}
-	os_memcpy(buf, data->id_p, data->id_p_len);
-	pos = buf + data->id_p_len;
-	os_memcpy(pos, data->id_s, data->id_s_len);
-	pos += data->id_s_len;
-	os_memcpy(pos, data->rand_s, EAP_PSK_RAND_LEN);
-	pos += EAP_PSK_RAND_LEN;
-	os_memcpy(pos, data->rand_p, EAP_PSK_RAND_LEN);
-	if (omac1_aes_128(data->ak, buf, buflen, mac)) {
-		os_free(buf);
-		data->state = FAILURE;
-		return;
-	}
-	os_free(buf);
+	addr[0] = id_p;
+	len[0] = id_p_len;
+	addr[1] = data->id_s;
+	len[1] = data->id_s_len;
+	addr[2] = data->rand_s;
+	len[2] = EAP_PSK_RAND_LEN;
+	addr[3] = data->rand_p;
+	len[3] = EAP_PSK_RAND_LEN;
+	omac1_aes_128_vector_key(&data->keys.ak_key, 4, addr, len, mac);
 	wpa_hexdump(MSG_DEBUG, "EAP-PSK: MAC_P", resp->mac_p, EAP_PSK_MAC_LEN);
 	if (os_memcmp(mac, resp->mac_p, EAP_PSK_MAC_LEN) != 0) {
 		wpa_printf(MSG_INFO, "EAP-PSK: Invalid MAC_P");
@@ -336,7 +323,7 @@ static void eap_psk_process_4(struct eap_sm *sm,
 			      struct wpabuf *respData)
 {
 	const struct eap_psk_hdr_4 *resp;
-	u8 *decrypted, nonce[16];
+	u8 *decrypted, nonce[16], pchannel[EAP_PSK_PCHANNEL_BUF_LEN];
 	size_t left;
 	const u8 *pos, *tag;
 
@@ -376,16 +363,18 @@ static void eap_psk_process_4(struct eap_sm *sm,
 	pos += 16;
 	left -= 16;
 
-	decrypted = os_malloc(left);
+	/* The PCHANNEL is usually just the R flag. */
+	decrypted = left <= sizeof(pchannel) ? pchannel : os_malloc(left);
 	if (decrypted == NULL)
 		return;
 	os_memcpy(decrypted, pos, left);
 
-	if (aes_128_eax_decrypt(data->tek, nonce, sizeof(nonce),
-				wpabuf_head(respData), 22, decrypted, left,
-				tag)) {
+	if (aes_128_eax_decrypt_key(&data->tek_key, nonce, sizeof(nonce),
+				    wpabuf_head(respData), 22, decrypted, left,
+				    tag)) {
 		wpa_printf(MSG_WARNING, "EAP-PSK: PCHANNEL decryption failed");
-		os_free(decrypted);
+		if (decrypted != pchannel)
+			os_free(decrypted);
 		data->state = FAILURE;
 		return;
 	}
@@ -407,7 +396,8 @@ static void eap_psk_process_4(struct eap_sm *sm,
 		data->state = FAILURE;
 		break;
 	}
-	os_free(decrypted);
+	if (decrypted != pchannel)
+		os_free(decrypted);
 }
 
 
@@ -418,7 +408,8 @@ static void eap_psk_process(struct eap_sm *sm, void *priv,
 	const u8 *pos;
 	size_t len;
 
-	if (sm->user == NULL || sm->user->password == NULL) {
+	if (sm->user == NULL || (sm->user->password == NULL &&
+				 sm->eapol_cb->get_eap_psk_keys == NULL)) {
 		wpa_printf(MSG_INFO, "EAP-PSK: Plaintext password not "
 			   "configured");
 		data->state = FAILURE;
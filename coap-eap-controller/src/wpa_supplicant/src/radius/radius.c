@@ -54,6 +54,48 @@ struct radius_msg {
 	 * attr_used - Total number of attributes in the array
 	 */
 	size_t attr_used;
+
+	/**
+	 * index - Attributes of every type, %NULL if not indexed
+	 *
+	 * Only the parsed messages are indexed.
+	 */
+	struct radius_attr_index *index;
+
+	/**
+	 * attr_next - 1 + index of the next attribute of the same type
+	 *
+	 * 0 if it is the last one, one per attribute of attr_pos.
+	 */
+	u16 *attr_next;
+
+	/**
+	 * block - Where msg, buf and the arrays are (RADIUS_MSG_*)
+	 */
+	int block;
+};
+
+/* msg, buf and the arrays are allocated apart (radius_msg_new) */
+#define RADIUS_MSG_HEAP 0
+/* msg, buf and the arrays are one allocation (radius_msg_parse,
+ * radius_msg_new_sized) */
+#define RADIUS_MSG_BLOCK 1
+/* msg, buf and the arrays are in an arena (radius_msg_parse_arena) */
+#define RADIUS_MSG_ARENA 2
+
+/**
+ * struct radius_attr_index - Index of the attributes of a parsed message
+ */
+struct radius_attr_index {
+	/**
+	 * first - 1 + index of the first attribute of every type, 0 = none
+	 */
+	u16 first[256];
+
+	/**
+	 * eap_len - Total length of the EAP-Message attributes
+	 */
+	size_t eap_len;
 };
 
 
@@ -77,6 +119,24 @@ radius_get_attr_hdr(struct radius_msg *msg, int idx)
 }
 
 
+/* Index of the next attribute of the type after prev (-1 for the first
+ * one), -1 if there is none */
+static int radius_msg_next_attr(struct radius_msg *msg, u8 type, int prev)
+{
+	size_t i;
+
+	if (msg->index)
+		return (prev < 0 ? msg->index->first[type] :
+			msg->attr_next[prev]) - 1;
+
+	for (i = prev + 1; i < msg->attr_used; i++) {
+		if (radius_get_attr_hdr(msg, i)->type == type)
+			return i;
+	}
+	return -1;
+}
+
+
 static void radius_msg_set_hdr(struct radius_msg *msg, u8 code, u8 identifier)
 {
 	msg->hdr->code = code;
@@ -128,17 +188,67 @@ struct radius_msg * radius_msg_new(u8 code, u8 identifier)
 }
 
 
+/**
+ * radius_msg_new_sized - Create a new RADIUS message of a known size
+ * @code: Code for RADIUS header
+ * @identifier: Identifier for RADIUS header
+ * @len: Length of the message once finished, header included
+ * @attr_count: Number of attributes of the message once finished
+ * Returns: Context for RADIUS message or %NULL on failure
+ *
+ * As radius_msg_new(), but the message, its buffer and its attribute array
+ * are one allocation of that size: attributes can only be added while they
+ * fit. The caller is responsible for freeing the returned data with
+ * radius_msg_free().
+ */
+struct radius_msg * radius_msg_new_sized(u8 code, u8 identifier, size_t len,
+					 size_t attr_count)
+{
+	struct radius_msg *msg;
+	struct wpabuf *buf;
+	size_t data_len;
+
+	if (len < sizeof(struct radius_hdr))
+		len = sizeof(struct radius_hdr);
+	data_len = (len + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+
+	msg = os_malloc(sizeof(*msg) + sizeof(*buf) + data_len +
+			attr_count * sizeof(size_t));
+	if (msg == NULL)
+		return NULL;
+
+	os_memset(msg, 0, sizeof(*msg));
+	buf = (struct wpabuf *) (msg + 1);
+	buf->size = len;
+	buf->used = 0;
+	buf->ext_data = (u8 *) (buf + 1);
+	msg->buf = buf;
+	msg->attr_pos = (size_t *) (buf->ext_data + data_len);
+	msg->attr_size = attr_count;
+	msg->block = RADIUS_MSG_BLOCK;
+
+	msg->hdr = wpabuf_put(msg->buf, sizeof(struct radius_hdr));
+	os_memset(msg->hdr, 0, sizeof(struct radius_hdr));
+	radius_msg_set_hdr(msg, code, identifier);
+
+	return msg;
+}
+
+
 /**
  * radius_msg_free - Free a RADIUS message
- * @msg: RADIUS message from radius_msg_new() or radius_msg_parse()
+ * @msg: RADIUS message from radius_msg_new(), radius_msg_new_sized() or
+ * radius_msg_parse()
  */
 void radius_msg_free(struct radius_msg *msg)
 {
-	if (msg == NULL)
+	if (msg == NULL || msg->block == RADIUS_MSG_ARENA)
 		return;
 
-	wpabuf_free(msg->buf);
-	os_free(msg->attr_pos);
+	if (msg->block == RADIUS_MSG_HEAP) {
+		wpabuf_free(msg->buf);
+		os_free(msg->attr_pos);
+	}
 	os_free(msg);
 }
 
@@ -440,6 +550,11 @@ static int radius_msg_add_attr_to_array(struct radius_msg *msg,
 		size_t *nattr_pos;
 		int nlen = msg->attr_size * 2;
 
+		if (msg->block != RADIUS_MSG_HEAP) {
+			wpa_printf(MSG_ERROR, "RADIUS: Too many attributes");
+			return -1;
+		}
+
 		nattr_pos = os_realloc(msg->attr_pos,
 				       nlen * sizeof(*msg->attr_pos));
 		if (nattr_pos == NULL)
@@ -462,6 +577,12 @@ struct radius_attr_hdr *radius_msg_add_attr(struct radius_msg *msg, u8 type,
 	size_t buf_needed;
 	struct radius_attr_hdr *attr;
 
+	if (msg->index) {
+		wpa_printf(MSG_ERROR, "radius_msg_add_attr: parsed messages "
+			   "cannot be extended");
+		return NULL;
+	}
+
 	if (data_len > RADIUS_MAX_ATTR_LEN) {
 		printf("radius_msg_add_attr: too long attribute (%lu bytes)\n",
 		       (unsigned long) data_len);
@@ -471,6 +592,11 @@ struct radius_attr_hdr *radius_msg_add_attr(struct radius_msg *msg, u8 type,
 	buf_needed = sizeof(*attr) + data_len;
 
 	if (wpabuf_tailroom(msg->buf) < buf_needed) {
+		if (msg->block != RADIUS_MSG_HEAP) {
+			wpa_printf(MSG_ERROR, "radius_msg_add_attr: message "
+				   "buffer full");
+			return NULL;
+		}
 		/* allocate more space for message buffer */
 		if (wpabuf_resize(&msg->buf, buf_needed) < 0)
 			return NULL;
@@ -490,31 +616,65 @@ struct radius_attr_hdr *radius_msg_add_attr(struct radius_msg *msg, u8 type,
 
 
 /**
- * radius_msg_parse - Parse a RADIUS message
- * @data: RADIUS message to be parsed
- * @len: Length of data buffer in octets
- * Returns: Parsed RADIUS message or %NULL on failure
+ * radius_msg_add_attrs - Add attributes already encoded
+ * @msg: RADIUS message
+ * @attrs: Attributes, as in a message
+ * @len: Length of attrs in octets
+ * Returns: 0 on success, -1 on failure
  *
- * This parses a RADIUS message and makes a copy of its data. The caller is
- * responsible for freeing the returned data with radius_msg_free().
+ * The attributes are copied as they are, as a block built once for many
+ * messages.
  */
-struct radius_msg * radius_msg_parse(const u8 *data, size_t len)
+int radius_msg_add_attrs(struct radius_msg *msg, const u8 *attrs, size_t len)
 {
-	struct radius_msg *msg;
-	struct radius_hdr *hdr;
-	struct radius_attr_hdr *attr;
-	size_t msg_len;
-	unsigned char *pos, *end;
+	u8 *start, *pos, *end;
+
+	if (msg->index || (wpabuf_tailroom(msg->buf) < len &&
+			   (msg->block != RADIUS_MSG_HEAP ||
+			    wpabuf_resize(&msg->buf, len) < 0)))
+		return -1;
+	msg->hdr = wpabuf_mhead(msg->buf);
+
+	start = wpabuf_put(msg->buf, len);
+	os_memcpy(start, attrs, len);
+	end = start + len;
+	for (pos = start; pos < end; pos += pos[1]) {
+		if (end - pos < 2 || pos[1] < sizeof(struct radius_attr_hdr) ||
+		    pos[1] > end - pos ||
+		    radius_msg_add_attr_to_array(msg,
+						 (struct radius_attr_hdr *) pos))
+			goto fail;
+	}
+	return 0;
+
+ fail:
+	/* Back to the message without them */
+	while (msg->attr_used > 0 &&
+	       msg->attr_pos[msg->attr_used - 1] >=
+	       (size_t) (start - wpabuf_head_u8(msg->buf)))
+		msg->attr_used--;
+	msg->buf->used -= len;
+	return -1;
+}
+
+
+/* Checks the header and the attribute lengths of a RADIUS message and
+ * counts its attributes. Returns the length of the message, 0 if invalid. */
+static size_t radius_msg_check(const u8 *data, size_t len, size_t *attr_count)
+{
+	const struct radius_hdr *hdr;
+	const u8 *pos, *end;
+	size_t msg_len, count = 0;
 
 	if (data == NULL || len < sizeof(*hdr))
-		return NULL;
+		return 0;
 
-	hdr = (struct radius_hdr *) data;
+	hdr = (const struct radius_hdr *) data;
 
 	msg_len = ntohs(hdr->length);
 	if (msg_len < sizeof(*hdr) || msg_len > len) {
 		wpa_printf(MSG_INFO, "RADIUS: Invalid message length");
-		return NULL;
+		return 0;
 	}
 
 	if (msg_len < len) {
@@ -522,42 +682,142 @@ struct radius_msg * radius_msg_parse(const u8 *data, size_t len)
 			   "RADIUS message", (unsigned long) len - msg_len);
 	}
 
-	msg = os_zalloc(sizeof(*msg));
-	if (msg == NULL)
-		return NULL;
-
-	msg->buf = wpabuf_alloc_copy(data, msg_len);
-	if (msg->buf == NULL || radius_msg_initialize(msg)) {
-		radius_msg_free(msg);
-		return NULL;
+	pos = data + sizeof(*hdr);
+	end = data + msg_len;
+	while (pos < end) {
+		/* TODO: check that the length is suitable for the type */
+		if (end - pos < 2 || pos[1] < sizeof(struct radius_attr_hdr) ||
+		    pos[1] > end - pos)
+			return 0;
+		pos += pos[1];
+		count++;
 	}
-	msg->hdr = wpabuf_mhead(msg->buf);
 
-	/* parse attributes */
-	pos = wpabuf_mhead_u8(msg->buf) + sizeof(struct radius_hdr);
-	end = wpabuf_mhead_u8(msg->buf) + wpabuf_len(msg->buf);
-	while (pos < end) {
-		if ((size_t) (end - pos) < sizeof(*attr))
-			goto fail;
+	*attr_count = count;
+	return msg_len;
+}
 
-		attr = (struct radius_attr_hdr *) pos;
 
-		if (pos + attr->length > end || attr->length < sizeof(*attr))
-			goto fail;
+/* Size of the message, the copy of its data and its arrays */
+static size_t radius_msg_block_size(size_t msg_len, size_t attr_count)
+{
+	size_t data_len = (msg_len + sizeof(size_t) - 1) &
+		~(sizeof(size_t) - 1);
 
-		/* TODO: check that attr->length is suitable for attr->type */
+	return sizeof(struct radius_msg) + sizeof(struct radius_attr_index) +
+		sizeof(struct wpabuf) + data_len +
+		attr_count * (sizeof(size_t) + sizeof(u16));
+}
 
-		if (radius_msg_add_attr_to_array(msg, attr))
-			goto fail;
 
+/* Decodes a message checked by radius_msg_check() into mem, of
+ * radius_msg_block_size() bytes, and indexes its attributes */
+static struct radius_msg * radius_msg_decode(const u8 *data, size_t msg_len,
+					     size_t attr_count, u8 *mem,
+					     int block)
+{
+	struct radius_msg *msg = (struct radius_msg *) mem;
+	struct radius_attr_index *index;
+	struct radius_attr_hdr *attr;
+	struct wpabuf *buf;
+	u16 last[256];
+	u8 *copy;
+	size_t i, pos;
+
+	index = (struct radius_attr_index *) (msg + 1);
+	buf = (struct wpabuf *) (index + 1);
+	copy = (u8 *) (buf + 1);
+	os_memcpy(copy, data, msg_len);
+
+	os_memset(msg, 0, sizeof(*msg));
+	os_memset(index, 0, sizeof(*index));
+	buf->size = buf->used = msg_len;
+	buf->ext_data = copy;
+	msg->buf = buf;
+	msg->hdr = (struct radius_hdr *) copy;
+	msg->attr_pos = (size_t *) (copy + ((msg_len + sizeof(size_t) - 1) &
+					    ~(sizeof(size_t) - 1)));
+	msg->attr_next = (u16 *) (msg->attr_pos + attr_count);
+	msg->attr_size = msg->attr_used = attr_count;
+	msg->index = index;
+	msg->block = block;
+
+	pos = sizeof(struct radius_hdr);
+	for (i = 0; i < attr_count; i++) {
+		attr = (struct radius_attr_hdr *) (copy + pos);
+		msg->attr_pos[i] = pos;
+		msg->attr_next[i] = 0;
+		if (index->first[attr->type])
+			msg->attr_next[last[attr->type] - 1] = i + 1;
+		else
+			index->first[attr->type] = i + 1;
+		last[attr->type] = i + 1;
+		if (attr->type == RADIUS_ATTR_EAP_MESSAGE)
+			index->eap_len += attr->length - sizeof(*attr);
 		pos += attr->length;
 	}
 
 	return msg;
+}
 
- fail:
-	radius_msg_free(msg);
-	return NULL;
+
+/**
+ * radius_msg_parse - Parse a RADIUS message
+ * @data: RADIUS message to be parsed
+ * @len: Length of data buffer in octets
+ * Returns: Parsed RADIUS message or %NULL on failure
+ *
+ * This parses a RADIUS message and makes a copy of its data, in one
+ * allocation with the index of its attributes. The caller is responsible for
+ * freeing the returned data with radius_msg_free(). Attributes cannot be added
+ * to the parsed message.
+ */
+struct radius_msg * radius_msg_parse(const u8 *data, size_t len)
+{
+	size_t msg_len, attr_count;
+	u8 *mem;
+
+	msg_len = radius_msg_check(data, len, &attr_count);
+	if (msg_len == 0)
+		return NULL;
+
+	mem = os_malloc(radius_msg_block_size(msg_len, attr_count));
+	if (mem == NULL)
+		return NULL;
+
+	return radius_msg_decode(data, msg_len, attr_count, mem,
+				 RADIUS_MSG_BLOCK);
+}
+
+
+/**
+ * radius_msg_parse_arena - Parse a RADIUS message into an arena
+ * @data: RADIUS message to be parsed
+ * @len: Length of data buffer in octets
+ * @arena: Arena of the caller, the message is allocated from its free space
+ * Returns: Parsed RADIUS message or %NULL on failure or if the arena is full
+ *
+ * As radius_msg_parse(), without allocations. The message lives as long as
+ * the memory of the arena, until arena->used is reset by the caller:
+ * radius_msg_free() does nothing with it.
+ */
+struct radius_msg * radius_msg_parse_arena(const u8 *data, size_t len,
+					   struct radius_arena *arena)
+{
+	size_t msg_len, attr_count, start, size;
+
+	msg_len = radius_msg_check(data, len, &attr_count);
+	if (msg_len == 0)
+		return NULL;
+
+	start = (arena->used + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+	size = radius_msg_block_size(msg_len, attr_count);
+	if (start > arena->size || size > arena->size - start)
+		return NULL;
+	arena->used = start + size;
+
+	return radius_msg_decode(data, msg_len, attr_count, arena->buf + start,
+				 RADIUS_MSG_ARENA);
 }
 
 
@@ -588,17 +848,22 @@ int radius_msg_add_eap(struct radius_msg *msg, const u8 *data, size_t data_len)
 u8 *radius_msg_get_eap(struct radius_msg *msg, size_t *eap_len)
 {
 	u8 *eap, *pos;
-	size_t len, i;
+	size_t len;
+	int i;
 	struct radius_attr_hdr *attr;
 
 	if (msg == NULL)
 		return NULL;
 
-	len = 0;
-	for (i = 0; i < msg->attr_used; i++) {
-		attr = radius_get_attr_hdr(msg, i);
-		if (attr->type == RADIUS_ATTR_EAP_MESSAGE)
-			len += attr->length - sizeof(struct radius_attr_hdr);
+	if (msg->index)
+		len = msg->index->eap_len;
+	else {
+		len = 0;
+		for (i = radius_msg_next_attr(msg, RADIUS_ATTR_EAP_MESSAGE, -1);
+		     i >= 0;
+		     i = radius_msg_next_attr(msg, RADIUS_ATTR_EAP_MESSAGE, i))
+			len += radius_get_attr_hdr(msg, i)->length -
+				sizeof(struct radius_attr_hdr);
 	}
 
 	if (len == 0)
@@ -608,14 +873,16 @@ u8 *radius_msg_get_eap(struct radius_msg *msg, size_t *eap_len)
 	if (eap == NULL)
 		return NULL;
 
+	/* The fragments are only reassembled here, when asked for */
 	pos = eap;
-	for (i = 0; i < msg->attr_used; i++) {
+	for (i = radius_msg_next_attr(msg, RADIUS_ATTR_EAP_MESSAGE, -1); i >= 0;
+	     i = radius_msg_next_attr(msg, RADIUS_ATTR_EAP_MESSAGE, i)) {
+		int flen;
+
 		attr = radius_get_attr_hdr(msg, i);
-		if (attr->type == RADIUS_ATTR_EAP_MESSAGE) {
-			int flen = attr->length - sizeof(*attr);
-			os_memcpy(pos, attr + 1, flen);
-			pos += flen;
-		}
+		flen = attr->length - sizeof(*attr);
+		os_memcpy(pos, attr + 1, flen);
+		pos += flen;
 	}
 
 	if (eap_len)
@@ -630,25 +897,20 @@ int radius_msg_verify_msg_auth(struct radius_msg *msg, const u8 *secret,
 {
 	u8 auth[MD5_MAC_LEN], orig[MD5_MAC_LEN];
 	u8 orig_authenticator[16];
-	struct radius_attr_hdr *attr = NULL, *tmp;
-	size_t i;
-
-	for (i = 0; i < msg->attr_used; i++) {
-		tmp = radius_get_attr_hdr(msg, i);
-		if (tmp->type == RADIUS_ATTR_MESSAGE_AUTHENTICATOR) {
-			if (attr != NULL) {
-				printf("Multiple Message-Authenticator "
-				       "attributes in RADIUS message\n");
-				return 1;
-			}
-			attr = tmp;
-		}
-	}
+	struct radius_attr_hdr *attr;
+	int i;
 
-	if (attr == NULL) {
+	i = radius_msg_next_attr(msg, RADIUS_ATTR_MESSAGE_AUTHENTICATOR, -1);
+	if (i < 0) {
 		printf("No Message-Authenticator attribute found\n");
 		return 1;
 	}
+	if (radius_msg_next_attr(msg, RADIUS_ATTR_MESSAGE_AUTHENTICATOR, i) >= 0) {
+		printf("Multiple Message-Authenticator "
+		       "attributes in RADIUS message\n");
+		return 1;
+	}
+	attr = radius_get_attr_hdr(msg, i);
 
 	os_memcpy(orig, attr + 1, MD5_MAC_LEN);
 	os_memset(attr + 1, 0, MD5_MAC_LEN);
@@ -716,17 +978,15 @@ int radius_msg_copy_attr(struct radius_msg *dst, struct radius_msg *src,
 			 u8 type)
 {
 	struct radius_attr_hdr *attr;
-	size_t i;
-	int count = 0;
+	int i, count = 0;
 
-	for (i = 0; i < src->attr_used; i++) {
+	for (i = radius_msg_next_attr(src, type, -1); i >= 0;
+	     i = radius_msg_next_attr(src, type, i)) {
 		attr = radius_get_attr_hdr(src, i);
-		if (attr->type == type) {
-			if (!radius_msg_add_attr(dst, type, (u8 *) (attr + 1),
-						 attr->length - sizeof(*attr)))
-				return -1;
-			count++;
-		}
+		if (!radius_msg_add_attr(dst, type, (u8 *) (attr + 1),
+					 attr->length - sizeof(*attr)))
+			return -1;
+		count++;
 	}
 
 	return count;
@@ -767,20 +1027,20 @@ static u8 *radius_msg_get_vendor_attr(struct radius_msg *msg, u32 vendor,
 				      u8 subtype, size_t *alen)
 {
 	u8 *data, *pos;
-	size_t i, len;
+	size_t len;
+	int i;
 
 	if (msg == NULL)
 		return NULL;
 
-	for (i = 0; i < msg->attr_used; i++) {
+	for (i = radius_msg_next_attr(msg, RADIUS_ATTR_VENDOR_SPECIFIC, -1);
+	     i >= 0;
+	     i = radius_msg_next_attr(msg, RADIUS_ATTR_VENDOR_SPECIFIC, i)) {
 		struct radius_attr_hdr *attr = radius_get_attr_hdr(msg, i);
 		size_t left;
 		u32 vendor_id;
 		struct radius_attr_vendor *vhdr;
 
-		if (attr->type != RADIUS_ATTR_VENDOR_SPECIFIC)
-			continue;
-
 		left = attr->length - sizeof(*attr);
 		if (left < 4)
 			continue;
@@ -1141,19 +1401,14 @@ radius_msg_add_attr_user_password(struct radius_msg *msg,
 
 int radius_msg_get_attr(struct radius_msg *msg, u8 type, u8 *buf, size_t len)
 {
-	struct radius_attr_hdr *attr = NULL, *tmp;
-	size_t i, dlen;
-
-	for (i = 0; i < msg->attr_used; i++) {
-		tmp = radius_get_attr_hdr(msg, i);
-		if (tmp->type == type) {
-			attr = tmp;
-			break;
-		}
-	}
+	struct radius_attr_hdr *attr;
+	size_t dlen;
+	int i;
 
-	if (!attr)
+	i = radius_msg_next_attr(msg, type, -1);
+	if (i < 0)
 		return -1;
+	attr = radius_get_attr_hdr(msg, i);
 
 	dlen = attr->length - sizeof(*attr);
 	if (buf)
@@ -1165,13 +1420,13 @@ int radius_msg_get_attr(struct radius_msg *msg, u8 type, u8 *buf, size_t len)
 int radius_msg_get_attr_ptr(struct radius_msg *msg, u8 type, u8 **buf,
 			    size_t *len, const u8 *start)
 {
-	size_t i;
+	int i;
 	struct radius_attr_hdr *attr = NULL, *tmp;
 
-	for (i = 0; i < msg->attr_used; i++) {
+	for (i = radius_msg_next_attr(msg, type, -1); i >= 0;
+	     i = radius_msg_next_attr(msg, type, i)) {
 		tmp = radius_get_attr_hdr(msg, i);
-		if (tmp->type == type &&
-		    (start == NULL || (u8 *) tmp > start)) {
+		if (start == NULL || (u8 *) tmp > start) {
 			attr = tmp;
 			break;
 		}
@@ -1188,13 +1443,12 @@ int radius_msg_get_attr_ptr(struct radius_msg *msg, u8 type, u8 **buf,
 
 int radius_msg_count_attr(struct radius_msg *msg, u8 type, int min_len)
 {
-	size_t i;
-	int count;
+	int i, count;
 
-	for (count = 0, i = 0; i < msg->attr_used; i++) {
+	for (count = 0, i = radius_msg_next_attr(msg, type, -1); i >= 0;
+	     i = radius_msg_next_attr(msg, type, i)) {
 		struct radius_attr_hdr *attr = radius_get_attr_hdr(msg, i);
-		if (attr->type == type &&
-		    attr->length >= sizeof(struct radius_attr_hdr) + min_len)
+		if (attr->length >= sizeof(struct radius_attr_hdr) + min_len)
 			count++;
 	}
 
@@ -177,6 +177,15 @@ struct radius_ms_mppe_keys {
 
 struct radius_msg;
 
+/**
+ * struct radius_arena - Memory of the caller for radius_msg_parse_arena()
+ */
+struct radius_arena {
+	u8 *buf;
+	size_t size;
+	size_t used; /* the messages are released by setting it to 0 */
+};
+
 /* Default size to be allocated for new RADIUS messages */
 #define RADIUS_DEFAULT_MSG_SIZE 1024
 
@@ -193,6 +202,8 @@ struct radius_msg;
 struct radius_hdr * radius_msg_get_hdr(struct radius_msg *msg);
 struct wpabuf * radius_msg_get_buf(struct radius_msg *msg);
 struct radius_msg * radius_msg_new(u8 code, u8 identifier);
+struct radius_msg * radius_msg_new_sized(u8 code, u8 identifier, size_t len,
+					 size_t attr_count);
 void radius_msg_free(struct radius_msg *msg);
 void radius_msg_dump(struct radius_msg *msg);
 int radius_msg_finish(struct radius_msg *msg, const u8 *secret,
@@ -203,7 +214,11 @@ void radius_msg_finish_acct(struct radius_msg *msg, const u8 *secret,
 			    size_t secret_len);
 struct radius_attr_hdr * radius_msg_add_attr(struct radius_msg *msg, u8 type,
 					     const u8 *data, size_t data_len);
+int radius_msg_add_attrs(struct radius_msg *msg, const u8 *attrs,
+			size_t len);
 struct radius_msg * radius_msg_parse(const u8 *data, size_t len);
+struct radius_msg * radius_msg_parse_arena(const u8 *data, size_t len,
+					   struct radius_arena *arena);
 int radius_msg_add_eap(struct radius_msg *msg, const u8 *data,
 		       size_t data_len);
 u8 *radius_msg_get_eap(struct radius_msg *msg, size_t *len);
@@ -29,10 +29,37 @@ radius_change_server(struct radius_client_data *radius,
 		     int sock, int sock6, int auth);
 static int radius_client_init_acct(struct radius_client_data *radius);
 static int radius_client_init_auth(struct radius_client_data *radius);
+static int radius_client_send_msg(struct radius_client_data *radius,
+				  struct radius_msg *msg, RadiusType msg_type,
+				  const u8 *addr, void *session, int *server);
+
+
+/* Pool of authentication servers: every server has its own socket and its
+ * own load (see radius_client_send_server()). */
+static int radius_client_pool(struct radius_client_data *radius)
+{
+	return radius->conf->num_auth_servers > 1;
+}
+
+
+/* The request is not pending on its server anymore. The ones sent before
+ * the server was marked down are not counted. */
+static void radius_client_msg_release(struct radius_msg_list *req)
+{
+	struct hostapd_radius_server *serv = req->server;
+
+	if (serv == NULL)
+		return;
+	req->server = NULL;
+	if (req->epoch == serv->epoch &&
+	    __atomic_load_n(&serv->outstanding, __ATOMIC_RELAXED) > 0)
+		__atomic_fetch_sub(&serv->outstanding, 1, __ATOMIC_RELAXED);
+}
 
 
 static void radius_client_msg_free(struct radius_msg_list *req)
 {
+	radius_client_msg_release(req);
 	radius_msg_free(req->msg);
 	os_free(req);
 }
@@ -112,6 +139,17 @@ static void radius_client_handle_send_error(struct radius_client_data *radius,
 }
 
 
+/* The accounting messages always go through their UDP socket. */
+static int radius_client_transmit(struct radius_client_data *radius, int s,
+				  struct wpabuf *buf)
+{
+	if (radius->transport && s == radius->auth_sock)
+		return radius->transport(radius->transport_ctx,
+					 wpabuf_head(buf), wpabuf_len(buf));
+	return send(s, wpabuf_head(buf), wpabuf_len(buf), 0);
+}
+
+
 static int radius_client_retransmit(struct radius_client_data *radius,
 				    struct radius_msg_list *entry,
 				    os_time_t now)
@@ -130,7 +168,7 @@ static int radius_client_retransmit(struct radius_client_data *radius,
 			conf->acct_server->retransmissions++;
 		}
 	} else {
-		s = radius->auth_sock;
+		s = entry->server ? entry->server->sock : radius->auth_sock;
 		if (entry->attempts == 0)
 			conf->auth_server->requests++;
 		else {
@@ -147,8 +185,11 @@ static int radius_client_retransmit(struct radius_client_data *radius,
 
 	os_get_time(&entry->last_attempt);
 	buf = radius_msg_get_buf(entry->msg);
-	if (send(s, wpabuf_head(buf), wpabuf_len(buf), 0) < 0)
+	if (radius_client_transmit(radius, s, buf) < 0)
 		radius_client_handle_send_error(radius, s, entry->msg_type);
+	else if (radius->tx_cb)
+		radius->tx_cb(radius->tx_cb_ctx, entry->msg_type,
+			      wpabuf_head(buf), wpabuf_len(buf));
 
 	entry->next_try = now + entry->next_wait;
 	entry->next_wait *= 2;
@@ -310,7 +351,8 @@ static void radius_client_list_add(struct radius_client_data *radius,
 				   struct radius_msg *msg,
 				   RadiusType msg_type,
 				   const u8 *shared_secret,
-				   size_t shared_secret_len, const u8 *addr, void *session)
+				   size_t shared_secret_len, const u8 *addr, void *session,
+				   struct hostapd_radius_server *server)
 {
 	struct radius_msg_list *entry, *prev;
 
@@ -341,6 +383,13 @@ static void radius_client_list_add(struct radius_client_data *radius,
 	entry->next_try = entry->first_try + RADIUS_CLIENT_FIRST_WAIT;
 	entry->attempts = 1;
 	entry->next_wait = RADIUS_CLIENT_FIRST_WAIT * 2;
+	if (server) {
+		entry->server = server;
+		entry->epoch = server->epoch;
+		if (__atomic_fetch_add(&server->outstanding, 1,
+				       __ATOMIC_RELAXED) == 0)
+			server->waiting_since = entry->last_attempt;
+	}
 	entry->next = radius->msgs;
 	radius->msgs = entry;
 	radius_client_update_timeout(radius);
@@ -421,12 +470,113 @@ int radius_client_send(struct radius_client_data *radius,
 		       struct radius_msg *msg, RadiusType msg_type,
 		       const u8 *addr,void *session)
 {
-	
+	return radius_client_send_msg(radius, msg, msg_type, addr, session,
+				      NULL);
+}
+
+
+/**
+ * radius_client_send_server - Send a RADIUS authentication request to a
+ * server of the pool
+ * @radius: RADIUS client context from radius_client_init()
+ * @msg: RADIUS message to be sent
+ * @addr: MAC address of the device related to this message or %NULL
+ * @session: Authentication session of the message
+ * @server: Index in auth_servers of the server the message must be sent to,
+ * or -1 to select it. Set to the server used.
+ * Returns: 0 on success, -1 on failure
+ *
+ * As radius_client_send() with RADIUS_AUTH. When there is more than one
+ * authentication server, the first request of a session goes to the server
+ * selected by the balance of the configuration, among the ones alive (see
+ * radius_client_status_timer()), or among some of them with
+ * radius_client_select_server(), and the next ones must go to the same
+ * server, which holds the State of the session. With one server, it is
+ * always used.
+ */
+int radius_client_send_server(struct radius_client_data *radius,
+			      struct radius_msg *msg, const u8 *addr,
+			      void *session, int *server)
+{
+	return radius_client_send_msg(radius, msg, RADIUS_AUTH, addr, session,
+				      server);
+}
+
+
+/**
+ * radius_client_select_server - Select the server of a new session
+ * @radius: RADIUS client context from radius_client_init()
+ * @servers: Mask of the servers of the pool it can go to, bit i for
+ * auth_servers[i]
+ * Returns: Index of the server, to be passed to radius_client_send_server()
+ *
+ * For failover, the first one alive, else the one alive with the lowest
+ * load, looking at them from next_server on so that the ties are spread.
+ * If none is alive, the same among all of the mask. A server without
+ * round-trip time yet is taken as the fastest one. A mask without any
+ * server of the pool is taken as all of them.
+ */
+int radius_client_select_server(struct radius_client_data *radius,
+				u32 servers)
+{
+	struct hostapd_radius_servers *conf = radius->conf;
+	struct hostapd_radius_server *serv;
+	int i, j, alive, best = -1;
+	u32 srtt_min = 0;
+	u64 load, best_load = 0;
+
+	if (!radius_client_pool(radius))
+		return 0;
+	if (conf->num_auth_servers < 32 &&
+	    (servers & ((1u << conf->num_auth_servers) - 1)) == 0)
+		servers = ~0u;
+
+	for (i = 0; i < conf->num_auth_servers; i++) {
+		serv = &conf->auth_servers[i];
+		if (serv->srtt && (srtt_min == 0 || serv->srtt < srtt_min))
+			srtt_min = serv->srtt;
+	}
+
+	for (alive = 1; alive >= 0 && best < 0; alive--) {
+		for (j = 0; j < conf->num_auth_servers; j++) {
+			if (conf->balance == RADIUS_BALANCE_FAILOVER)
+				i = j;
+			else
+				i = (radius->next_server + j) %
+					conf->num_auth_servers;
+			serv = &conf->auth_servers[i];
+			if (i >= 32 || !(servers & (1u << i)) ||
+			    (alive && !serv->alive))
+				continue;
+			if (conf->balance == RADIUS_BALANCE_FAILOVER)
+				return i;
+			load = __atomic_load_n(&serv->outstanding,
+					       __ATOMIC_RELAXED);
+			if (conf->balance == RADIUS_BALANCE_LATENCY)
+				load = (load + 1) * (serv->srtt ? serv->srtt :
+						     srtt_min ? srtt_min : 1);
+			if (best < 0 || load < best_load) {
+				best = i;
+				best_load = load;
+			}
+		}
+	}
+	radius->next_server = (radius->next_server + 1) %
+		conf->num_auth_servers;
+	return best;
+}
+
+
+static int radius_client_send_msg(struct radius_client_data *radius,
+				  struct radius_msg *msg, RadiusType msg_type,
+				  const u8 *addr, void *session, int *server)
+{
 	struct hostapd_radius_servers *conf = radius->conf;
+	struct hostapd_radius_server *serv, *pool_serv = NULL;
 	const u8 *shared_secret;
 	size_t shared_secret_len;
 	char *name;
-	int s, res;
+	int s, res, i;
 	struct wpabuf *buf;
 
 	if (msg_type == RADIUS_ACCT_INTERIM) {
@@ -456,12 +606,25 @@ int radius_client_send(struct radius_client_data *radius,
 				       "No authentication server configured");
 			return -1;
 		}
-		shared_secret = conf->auth_server->shared_secret;
-		shared_secret_len = conf->auth_server->shared_secret_len;
+		serv = conf->auth_server;
+		s = radius->auth_sock;
+		if (radius_client_pool(radius)) {
+			if (server != NULL && *server >= 0 &&
+			    *server < conf->num_auth_servers)
+				i = *server;
+			else
+				i = radius_client_select_server(radius, ~0u);
+			serv = pool_serv = &conf->auth_servers[i];
+			s = serv->sock;
+			if (server != NULL)
+				*server = i;
+		} else if (server != NULL)
+			*server = 0;
+		shared_secret = serv->shared_secret;
+		shared_secret_len = serv->shared_secret_len;
 		radius_msg_finish(msg, shared_secret, shared_secret_len);
 		name = "authentication";
-		s = radius->auth_sock;
-		conf->auth_server->requests++;
+		serv->requests++;
 	}
 
 	hostapd_logger(radius->ctx, NULL, HOSTAPD_MODULE_RADIUS,
@@ -475,18 +638,48 @@ int radius_client_send(struct radius_client_data *radius,
 	
 	/*Rafa: Here we should add a timer to alarm list to provoke reauth. Network manager will receive the answer... hopefully */
 	radius_client_list_add(radius, msg, msg_type, shared_secret,
-			       shared_secret_len, addr, session);
+			       shared_secret_len, addr, session, pool_serv);
 	
 
-	res = send(s, wpabuf_head(buf), wpabuf_len(buf), 0);
+	res = radius_client_transmit(radius, s, buf);
 	if (res < 0)
 		radius_client_handle_send_error(radius, s, msg_type);
+	else if (radius->tx_cb)
+		radius->tx_cb(radius->tx_cb_ctx, msg_type,
+			      wpabuf_head(buf), wpabuf_len(buf));
 	
 	
 
 	return res;
 }
 
+/* An answer of a server of the pool: one request less pending, a sample of
+ * its round-trip time, and it is alive. */
+static void radius_client_answered(struct radius_client_data *radius,
+				   struct radius_msg_list *req,
+				   struct os_time *now)
+{
+	struct hostapd_radius_server *serv = req->server;
+	struct os_time diff;
+	u32 rtt;
+	char abuf[50];
+
+	os_time_sub(now, &req->last_attempt, &diff);
+	rtt = diff.sec * 1000000 + diff.usec;
+	serv->srtt = serv->srtt ? serv->srtt - serv->srtt / 8 + rtt / 8 : rtt;
+	serv->waiting_since = *now;
+	if (!serv->alive) {
+		hostapd_logger(radius->ctx, NULL, HOSTAPD_MODULE_RADIUS,
+			       HOSTAPD_LEVEL_NOTICE,
+			       "Authentication server %s:%d answers again",
+			       hostapd_ip_txt(&serv->addr, abuf, sizeof(abuf)),
+			       serv->port);
+		serv->alive = 1;
+	}
+	radius_client_msg_release(req);
+}
+
+
 void radius_client_receive(struct radius_msg *msg, void *eloop_ctx, void *sock_ctx)
 {
 	
@@ -603,6 +796,10 @@ void radius_client_receive(struct radius_msg *msg, void *eloop_ctx, void *sock_c
 				   "Received RADIUS packet matched with a pending "
 				   "request, round trip time %d.%02d sec",
 				   roundtrip / 100, roundtrip % 100);
+	if (req->server) {
+		rconf = req->server;
+		radius_client_answered(radius, req, &now);
+	}
 	rconf->round_trip_time = roundtrip;
 	
 	/* Remove ACKed RADIUS packet from retransmit list */
@@ -658,6 +855,244 @@ fail:
 }
 
 
+/**
+ * radius_client_get_auth_socks - Sockets the authentication answers arrive on
+ * @radius: RADIUS client context from radius_client_init()
+ * @socks: Buffer for the sockets
+ * @max: Size of socks
+ * Returns: Number of sockets in socks
+ *
+ * One socket, or one per server of a pool: all of them must be read and
+ * their datagrams passed to radius_client_receive().
+ */
+int radius_client_get_auth_socks(struct radius_client_data *radius,
+				 int *socks, int max)
+{
+	struct hostapd_radius_servers *conf = radius->conf;
+	int i, num = 0;
+
+	if (!radius_client_pool(radius)) {
+		if (radius->auth_sock >= 0 && max > 0)
+			socks[num++] = radius->auth_sock;
+		return num;
+	}
+	for (i = 0; i < conf->num_auth_servers && num < max; i++) {
+		if (conf->auth_servers[i].sock >= 0)
+			socks[num++] = conf->auth_servers[i].sock;
+	}
+	return num;
+}
+
+
+/* A Status-Server probe (RFC 5997) to a server of the pool. The probe is
+ * kept even if it could not be sent, so that its timeout counts. */
+static void radius_client_status_send(struct radius_client_data *radius,
+				      struct hostapd_radius_server *serv,
+				      struct os_time *now)
+{
+	static const char nas_id[] = "coap-eap-controller";
+	struct radius_msg *msg;
+	struct wpabuf *buf;
+
+	radius_msg_free(serv->status_req);
+	serv->status_req = NULL;
+
+	msg = radius_msg_new(RADIUS_CODE_STATUS_SERVER, serv->status_id++);
+	if (msg == NULL)
+		return;
+	radius_msg_make_authenticator(msg, (u8 *) &serv->addr,
+				      sizeof(serv->addr));
+	if (!radius_msg_add_attr(msg, RADIUS_ATTR_NAS_IDENTIFIER,
+				 (u8 *) nas_id, sizeof(nas_id) - 1) ||
+	    radius_msg_finish(msg, serv->shared_secret,
+			      serv->shared_secret_len) < 0) {
+		radius_msg_free(msg);
+		return;
+	}
+
+	serv->status_req = msg;
+	serv->status_sent = *now;
+	serv->status_probes++;
+	buf = radius_msg_get_buf(msg);
+	if (send(serv->sock, wpabuf_head(buf), wpabuf_len(buf), 0) < 0)
+		perror("send[RADIUS Status-Server]");
+}
+
+
+/**
+ * radius_client_status_response - Handle the answer of a Status-Server probe
+ * @radius: RADIUS client context from radius_client_init()
+ * @msg: RADIUS message received
+ * Returns: 1 if msg answers a probe (the caller frees it), 0 if not
+ *
+ * The answer of a probe marks its server alive again.
+ */
+int radius_client_status_response(struct radius_client_data *radius,
+				  struct radius_msg *msg)
+{
+	struct hostapd_radius_servers *conf;
+	struct hostapd_radius_server *serv;
+	struct radius_hdr *hdr = radius_msg_get_hdr(msg);
+	char abuf[50];
+	int i, found = 0;
+
+	if (radius == NULL || !radius_client_pool(radius) ||
+	    hdr->code != RADIUS_CODE_ACCESS_ACCEPT)
+		return 0;
+
+	pthread_mutex_lock(& mutex_radius);
+	conf = radius->conf;
+	for (i = 0; i < conf->num_auth_servers && !found; i++) {
+		serv = &conf->auth_servers[i];
+		if (serv->status_req == NULL ||
+		    radius_msg_get_hdr(serv->status_req)->identifier !=
+		    hdr->identifier ||
+		    radius_msg_verify(msg, serv->shared_secret,
+				      serv->shared_secret_len,
+				      serv->status_req, 1))
+			continue;
+		found = 1;
+		radius_msg_free(serv->status_req);
+		serv->status_req = NULL;
+		if (!serv->alive) {
+			hostapd_logger(radius->ctx, NULL,
+				       HOSTAPD_MODULE_RADIUS,
+				       HOSTAPD_LEVEL_NOTICE,
+				       "Authentication server %s:%d answers "
+				       "Status-Server again",
+				       hostapd_ip_txt(&serv->addr, abuf,
+						      sizeof(abuf)),
+				       serv->port);
+			serv->alive = 1;
+		}
+	}
+	pthread_mutex_unlock(& mutex_radius);
+	return found;
+}
+
+
+/* When the next probe of a server is due: while it is down, every interval;
+ * while its requests are not answered, after the timeout; while it is idle,
+ * every interval if there is one. A probe pending is due at its timeout.
+ * Returns 0 and sets due, or -1 if no probe is due. */
+static int radius_client_status_due(struct hostapd_radius_servers *conf,
+				    struct hostapd_radius_server *serv,
+				    struct os_time *due)
+{
+	struct os_time *last;
+
+	if (serv->sock < 0)
+		return -1;
+	if (serv->status_req) {
+		*due = serv->status_sent;
+		due->sec += RADIUS_CLIENT_STATUS_TIMEOUT;
+		return 0;
+	}
+	if (!serv->alive) {
+		*due = serv->status_sent;
+		due->sec += conf->status_interval > 0 ?
+			conf->status_interval : RADIUS_CLIENT_STATUS_TIMEOUT;
+		return 0;
+	}
+
+	last = os_time_before(&serv->waiting_since, &serv->status_sent) ?
+		&serv->status_sent : &serv->waiting_since;
+	*due = *last;
+	if (__atomic_load_n(&serv->outstanding, __ATOMIC_RELAXED) > 0)
+		due->sec += RADIUS_CLIENT_STATUS_TIMEOUT;
+	else if (conf->status_interval > 0)
+		due->sec += conf->status_interval;
+	else
+		return -1;
+	return 0;
+}
+
+
+/**
+ * radius_client_status_timer - Probe the servers of a pool
+ * @radius: RADIUS client context from radius_client_init()
+ *
+ * To be called periodically, or at radius_client_status_next(). A server
+ * whose probe is not answered in RADIUS_CLIENT_STATUS_TIMEOUT seconds is
+ * marked down: the new sessions go to the other ones, and its requests
+ * pending are not counted anymore. The probes due are sent.
+ */
+void radius_client_status_timer(struct radius_client_data *radius)
+{
+	struct hostapd_radius_servers *conf;
+	struct hostapd_radius_server *serv;
+	struct os_time now, due;
+	char abuf[50];
+	int i;
+
+	if (radius == NULL || !radius_client_pool(radius))
+		return;
+
+	pthread_mutex_lock(& mutex_radius);
+	conf = radius->conf;
+	os_get_time(&now);
+	for (i = 0; i < conf->num_auth_servers; i++) {
+		serv = &conf->auth_servers[i];
+		if (radius_client_status_due(conf, serv, &due) < 0 ||
+		    os_time_before(&now, &due))
+			continue;
+		if (serv->status_req && serv->alive) {
+			hostapd_logger(radius->ctx, NULL,
+				       HOSTAPD_MODULE_RADIUS,
+				       HOSTAPD_LEVEL_NOTICE,
+				       "Authentication server %s:%d does not "
+				       "answer, marked down",
+				       hostapd_ip_txt(&serv->addr, abuf,
+						      sizeof(abuf)),
+				       serv->port);
+			serv->alive = 0;
+			serv->downs++;
+			serv->epoch++;
+			serv->outstanding = 0;
+		}
+		if (serv->status_req && !serv->alive) {
+			/* The next probe of a server down waits its interval */
+			radius_msg_free(serv->status_req);
+			serv->status_req = NULL;
+			continue;
+		}
+		radius_client_status_send(radius, serv, &now);
+	}
+	pthread_mutex_unlock(& mutex_radius);
+}
+
+
+/**
+ * radius_client_status_next - Time of the next radius_client_status_timer()
+ * @radius: RADIUS client context from radius_client_init()
+ * @next: Set to the time the next probe or probe timeout is due
+ * Returns: 0 if next is set, -1 if nothing is due
+ */
+int radius_client_status_next(struct radius_client_data *radius,
+			      struct os_time *next)
+{
+	struct hostapd_radius_servers *conf;
+	struct os_time due;
+	int i, ret = -1;
+
+	if (radius == NULL || !radius_client_pool(radius))
+		return -1;
+
+	pthread_mutex_lock(& mutex_radius);
+	conf = radius->conf;
+	for (i = 0; i < conf->num_auth_servers; i++) {
+		if (radius_client_status_due(conf, &conf->auth_servers[i],
+					     &due) < 0)
+			continue;
+		if (ret < 0 || os_time_before(&due, next))
+			*next = due;
+		ret = 0;
+	}
+	pthread_mutex_unlock(& mutex_radius);
+	return ret;
+}
+
+
 /*static void radius_client_receive(int sock, void *eloop_ctx, void *sock_ctx)
 {
 	struct radius_client_data *radius = eloop_ctx;
@@ -841,14 +1276,50 @@ u8 radius_client_get_id(struct radius_client_data *radius)
 		}
 		entry = entry->next;
 
-		if (_remove)
+		if (_remove) {
 			radius_client_msg_free(_remove);
+			radius->num_msgs--;
+		}
 	}
 
 	return id;
 }
 
 
+/**
+ * radius_client_set_tx_cb - Set the callback of the messages sent
+ * @radius: RADIUS client context from radius_client_init()
+ * @tx_cb: Called with every message sent to the server, or %NULL
+ * @ctx: Context pointer for tx_cb
+ */
+void radius_client_set_tx_cb(struct radius_client_data *radius,
+			     void (*tx_cb)(void *ctx, RadiusType msg_type,
+					   const u8 *data, size_t len),
+			     void *ctx)
+{
+	radius->tx_cb = tx_cb;
+	radius->tx_cb_ctx = ctx;
+}
+
+
+/**
+ * radius_client_set_transport - Set the transport of the authentication
+ * messages
+ * @radius: RADIUS client context from radius_client_init()
+ * @transport: Sends a message to the server instead of the UDP socket, or
+ * %NULL to go back to it
+ * @ctx: Context pointer for transport
+ */
+void radius_client_set_transport(struct radius_client_data *radius,
+				 int (*transport)(void *ctx, const u8 *data,
+						  size_t len),
+				 void *ctx)
+{
+	radius->transport = transport;
+	radius->transport_ctx = ctx;
+}
+
+
 /**
  * radius_client_flush - Flush all pending RADIUS client messages
  * @radius: RADIUS client context from radius_client_init()
@@ -1118,10 +1589,64 @@ static int radius_client_disable_pmtu_discovery(int s)
 }
 
 
+/* A socket connected to a server of the pool other than the current one,
+ * its answers are read from it. */
+static int radius_client_open_server_sock(struct hostapd_radius_server *serv)
+{
+	struct sockaddr_in serv4;
+#ifdef CONFIG_IPV6
+	struct sockaddr_in6 serv6;
+#endif /* CONFIG_IPV6 */
+	struct sockaddr *addr;
+	socklen_t addrlen;
+	int s;
+
+	switch (serv->addr.af) {
+	case AF_INET:
+		os_memset(&serv4, 0, sizeof(serv4));
+		serv4.sin_family = AF_INET;
+		serv4.sin_addr.s_addr = serv->addr.u.v4.s_addr;
+		serv4.sin_port = htons(serv->port);
+		addr = (struct sockaddr *) &serv4;
+		addrlen = sizeof(serv4);
+		break;
+#ifdef CONFIG_IPV6
+	case AF_INET6:
+		os_memset(&serv6, 0, sizeof(serv6));
+		serv6.sin6_family = AF_INET6;
+		os_memcpy(&serv6.sin6_addr, &serv->addr.u.v6,
+			  sizeof(struct in6_addr));
+		serv6.sin6_port = htons(serv->port);
+		addr = (struct sockaddr *) &serv6;
+		addrlen = sizeof(serv6);
+		break;
+#endif /* CONFIG_IPV6 */
+	default:
+		return -1;
+	}
+
+	s = socket(addr->sa_family, SOCK_DGRAM, 0);
+	if (s < 0) {
+		perror("socket[RADIUS]");
+		return -1;
+	}
+	if (addr->sa_family == AF_INET)
+		radius_client_disable_pmtu_discovery(s);
+	if (connect(s, addr, addrlen) < 0) {
+		perror("connect[radius]");
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+
 static int radius_client_init_auth(struct radius_client_data *radius)
 {
 	struct hostapd_radius_servers *conf = radius->conf;
-	int ok = 0;
+	struct hostapd_radius_server *serv;
+	struct os_time now;
+	int ok = 0, i;
 
 
 	radius->auth_serv_sock = socket(PF_INET, SOCK_DGRAM, 0);
@@ -1148,6 +1673,23 @@ static int radius_client_init_auth(struct radius_client_data *radius)
 	radius_change_server(radius, conf->auth_server, NULL,
 			     radius->auth_serv_sock, radius->auth_serv_sock6,
 			     1);
+
+	/* A pool: every server has its own socket, the current one that of
+	 * radius_change_server(). The first probes wait an interval. */
+	os_get_time(&now);
+	for (i = 0; i < conf->num_auth_servers; i++) {
+		serv = &conf->auth_servers[i];
+		serv->alive = 1;
+		serv->waiting_since = now;
+		if (serv == conf->auth_server)
+			serv->sock = radius->auth_sock;
+		else if (radius_client_pool(radius)) {
+			serv->sock = radius_client_open_server_sock(serv);
+			if (serv->sock < 0)
+				return -1;
+		} else
+			serv->sock = -1;
+	}
 	
     /*Rafa: We must change this to add this socket to the select in the network manager thread*/
 	/*if (radius->auth_serv_sock >= 0 &&
@@ -1284,6 +1826,9 @@ radius_client_init(void *ctx, struct hostapd_radius_servers *conf)
  */
 void radius_client_deinit(struct radius_client_data *radius)
 {
+	struct hostapd_radius_server *serv;
+	int i;
+
 	if (!radius)
 		return;
 
@@ -1302,6 +1847,15 @@ void radius_client_deinit(struct radius_client_data *radius)
 	//eloop_cancel_timeout(radius_retry_primary_timer, radius, NULL);
 
 	radius_client_flush(radius, 0);
+	for (i = 0; i < radius->conf->num_auth_servers; i++) {
+		serv = &radius->conf->auth_servers[i];
+		if (serv->sock >= 0 && serv->sock != radius->auth_sock) {
+			close(serv->sock);
+			serv->sock = -1;
+		}
+		radius_msg_free(serv->status_req);
+		serv->status_req = NULL;
+	}
 	os_free(radius->auth_handlers);
 	os_free(radius->acct_handlers);
 	os_free(radius);
@@ -121,8 +121,93 @@ struct hostapd_radius_server {
 	 * packets_dropped - radiusAuthClientPacketsDropped or radiusAccClientPacketsDropped
 	 */
 	u32 packets_dropped;
+
+	/* Pool of authentication servers (more than one auth_servers entry),
+	 * see radius_client_send_server() */
+
+	/**
+	 * sock - Socket connected to this server, -1 if not used
+	 */
+	int sock;
+
+	/**
+	 * outstanding - Requests sent to this server and not answered yet
+	 */
+	u32 outstanding;
+
+	/**
+	 * srtt - Smoothed round-trip time of the answers in microseconds
+	 * (EWMA with a gain of 1/8), 0 before the first one
+	 */
+	u32 srtt;
+
+	/**
+	 * alive - Whether new sessions are sent to this server. Cleared when
+	 * a Status-Server probe is not answered, set by any answer.
+	 */
+	int alive;
+
+	/**
+	 * epoch - Incremented when the server is marked down: the requests
+	 * sent before are not counted in outstanding anymore
+	 */
+	u32 epoch;
+
+	/**
+	 * downs - Number of times the server has been marked down
+	 */
+	u32 downs;
+
+	/**
+	 * waiting_since - Time of the last answer or, if no request was
+	 * pending, of the last request sent
+	 */
+	struct os_time waiting_since;
+
+	/**
+	 * status_req - Status-Server probe (RFC 5997) waiting for its
+	 * answer, or %NULL
+	 */
+	struct radius_msg *status_req;
+
+	/**
+	 * status_sent - Time status_req was sent
+	 */
+	struct os_time status_sent;
+
+	/**
+	 * status_probes - Number of Status-Server probes sent
+	 */
+	u32 status_probes;
+
+	/**
+	 * status_id - Identifier of the next probe
+	 */
+	u8 status_id;
 };
 
+/**
+ * RadiusBalance - Selection of the server of a new session in a pool
+ */
+typedef enum {
+	/**
+	 * RADIUS_BALANCE_FAILOVER - The first server alive, in priority order
+	 */
+	RADIUS_BALANCE_FAILOVER,
+
+	/**
+	 * RADIUS_BALANCE_LEAST_OUTSTANDING - The server alive with the fewest
+	 * requests pending
+	 */
+	RADIUS_BALANCE_LEAST_OUTSTANDING,
+
+	/**
+	 * RADIUS_BALANCE_LATENCY - The server alive with the lowest expected
+	 * delay, its round-trip time times its requests pending plus one
+	 */
+	RADIUS_BALANCE_LATENCY
+} RadiusBalance;
+
 /**
  * struct hostapd_radius_servers - RADIUS servers for RADIUS client
  */
@@ -183,6 +268,19 @@ struct hostapd_radius_servers {
 	 * force_client_addr - Whether to force client (local) address
 	 */
 	int force_client_addr;
+
+	/**
+	 * balance - Selection of the server of a new session when there is
+	 * more than one authentication server (RadiusBalance)
+	 */
+	int balance;
+
+	/**
+	 * status_interval - Interval in seconds between the Status-Server
+	 * probes of the idle authentication servers of a pool, 0 to probe
+	 * them only when they stop answering
+	 */
+	int status_interval;
 };
 
 
@@ -277,6 +375,13 @@ typedef enum {
  */
 #define RADIUS_CLIENT_NUM_FAILOVER 4
 
+/**
+ * RADIUS_CLIENT_STATUS_TIMEOUT - Seconds without answers after which a
+ * server of a pool with requests pending is probed with Status-Server, and
+ * after which a probe not answered marks the server down
+ */
+#define RADIUS_CLIENT_STATUS_TIMEOUT 3
+
 
 /**
  * struct radius_rx_handler - RADIUS client RX handler
@@ -362,7 +467,16 @@ struct radius_msg_list {
 	 */
 	size_t shared_secret_len;
 	
-	/* TODO: server config with failover to backup server(s) */
+	/**
+	 * server - Authentication server of the pool the message was sent
+	 * to, %NULL if it is not counted in its outstanding requests
+	 */
+	struct hostapd_radius_server *server;
+
+	/**
+	 * epoch - server->epoch when the message was sent
+	 */
+	u32 epoch;
 	
 	/**
 	 * next - Next message in the list
@@ -460,6 +574,35 @@ struct radius_client_data {
 	 * next_radius_identifier - Next RADIUS message identifier to use
 	 */
 	u8 next_radius_identifier;
+
+	/**
+	 * tx_cb - Called with every message sent (and retransmitted) to the
+	 * server, e.g. to capture the traffic. NULL if not used.
+	 */
+	void (*tx_cb)(void *ctx, RadiusType msg_type, const u8 *data, size_t len);
+
+	/**
+	 * tx_cb_ctx - Context of tx_cb
+	 */
+	void *tx_cb_ctx;
+
+	/**
+	 * transport - Sends the authentication messages instead of the UDP
+	 * socket, e.g. over RADIUS over TLS (RFC 6614). NULL if not used.
+	 * Returns -1 if the message could not be sent.
+	 */
+	int (*transport)(void *ctx, const u8 *data, size_t len);
+
+	/**
+	 * transport_ctx - Context of transport
+	 */
+	void *transport_ctx;
+
+	/**
+	 * next_server - First server looked at by the next selection, so that
+	 * the ties are spread over the pool
+	 */
+	int next_server;
 };
 
 
@@ -473,7 +616,20 @@ int radius_client_register(struct radius_client_data *radius,
 int radius_client_send(struct radius_client_data *radius,
 		       struct radius_msg *msg,
 		       RadiusType msg_type, const u8 *addr,void *session);
+int radius_client_send_server(struct radius_client_data *radius,
+			      struct radius_msg *msg, const u8 *addr,
+			      void *session, int *server);
+int radius_client_select_server(struct radius_client_data *radius,
+				u32 servers);
 u8 radius_client_get_id(struct radius_client_data *radius);
+void radius_client_set_tx_cb(struct radius_client_data *radius,
+			     void (*tx_cb)(void *ctx, RadiusType msg_type,
+					   const u8 *data, size_t len),
+			     void *ctx);
+void radius_client_set_transport(struct radius_client_data *radius,
+				 int (*transport)(void *ctx, const u8 *data,
+						  size_t len),
+				 void *ctx);
 void radius_client_flush(struct radius_client_data *radius, int only_auth);
 struct radius_client_data *
 radius_client_init(void *ctx, struct hostapd_radius_servers *conf);
@@ -482,6 +638,13 @@ void radius_client_flush_auth(struct radius_client_data *radius,
 			      const u8 *addr);
 int radius_client_get_mib(struct radius_client_data *radius, char *buf,
 			  size_t buflen);
+int radius_client_get_auth_socks(struct radius_client_data *radius,
+				 int *socks, int max);
+int radius_client_status_response(struct radius_client_data *radius,
+				  struct radius_msg *msg);
+void radius_client_status_timer(struct radius_client_data *radius);
+int radius_client_status_next(struct radius_client_data *radius,
+			      struct os_time *next);
 //static void radius_client_receive(struct radius_msg *msg, void *eloop_ctx, void *sock_ctx);
 void radius_client_receive(struct radius_msg *msg, void *eloop_ctx, void *sock_ctx);
 
@@ -31,6 +31,11 @@
  */
 #define RADIUS_MAX_SESSION 100
 
+/**
+ * RADIUS_COMPLETED_TIMEOUT - Time the completed sessions are kept in seconds
+ */
+#define RADIUS_COMPLETED_TIMEOUT 10
+
 /**
  * RADIUS_MAX_MSG_LEN - Maximum message length for incoming RADIUS messages
  */
@@ -62,6 +67,9 @@ struct radius_server_counters {
  */
 struct radius_session {
 	struct radius_session *next;
+	struct radius_session *prev;
+	/* Next session of the same bucket of sess_hash */
+	struct radius_session *hnext;
 	struct radius_client *client;
 	struct radius_server_data *server;
 	unsigned int sess_id;
@@ -76,6 +84,8 @@ struct radius_session {
 	u8 last_identifier;
 	struct radius_msg *last_reply;
 	u8 last_authenticator[16];
+	/* Buffers of eap and last_reply, NULL without session_arena */
+	struct wpabuf_arena *arena;
 };
 
 /**
@@ -83,6 +93,12 @@ struct radius_session {
  */
 struct radius_client {
 	struct radius_client *next;
+	/* Position in the client file, the first match is used */
+	unsigned int index;
+	/* Next client of the same bucket of client_hash (a single address) or
+	 * of the subnets list */
+	struct radius_client *hnext;
+	struct radius_client *next_subnet;
 	struct in_addr addr;
 	struct in_addr mask;
 #ifdef CONFIG_IPV6
@@ -109,11 +125,34 @@ struct radius_server_data {
 	 */
 	struct radius_client *clients;
 
+	/**
+	 * client_hash - Clients of a single address, by address
+	 *
+	 * client_hash_size buckets, a power of 2. The clients with a shorter
+	 * mask are in the subnets list, in the order of the client file.
+	 */
+	struct radius_client **client_hash;
+	size_t client_hash_size;
+	struct radius_client *subnets;
+
 	/**
 	 * next_sess_id - Next session identifier
 	 */
 	unsigned int next_sess_id;
 
+	/**
+	 * sess_id_step - Increment of next_sess_id
+	 */
+	unsigned int sess_id_step;
+
+	/**
+	 * sess_hash - Sessions of every client, by session identifier
+	 *
+	 * 1 << sess_hash_bits buckets, at least max_sessions.
+	 */
+	struct radius_session **sess_hash;
+	int sess_hash_bits;
+
 	/**
 	 * conf_ctx - Context pointer for callbacks
 	 *
@@ -285,6 +324,37 @@ struct radius_server_data {
 	 * msg_ctx - Context data for wpa_msg() calls
 	 */
 	void *msg_ctx;
+
+	/**
+	 * eap_methods - EAP methods of the sessions
+	 */
+	struct eap_method *eap_methods;
+
+	/**
+	 * max_sessions - Maximum number of active sessions
+	 */
+	int max_sessions;
+
+	/**
+	 * completed_timeout - Time the completed sessions are kept in seconds
+	 */
+	int completed_timeout;
+
+	/**
+	 * session_arena - Whether the sessions have their own wpabuf arena
+	 */
+	int session_arena;
+
+	/**
+	 * send_reply - Callback for sending the replies, %NULL to use auth_sock
+	 */
+	int (*send_reply)(void *ctx, const u8 *data, size_t len,
+			  const struct sockaddr *to, socklen_t tolen);
+
+	/**
+	 * send_reply_ctx - Context pointer for send_reply
+	 */
+	void *send_reply_ctx;
 };
 
 
@@ -305,55 +375,144 @@ static void radius_server_session_remove_timeout(void *eloop_ctx,
 						 void *timeout_ctx);
 
 
-static struct radius_client *
-radius_server_get_client(struct radius_server_data *data, struct in_addr *addr,
-			 int ipv6)
+static int radius_server_client_match(struct radius_client *client,
+				      struct in_addr *addr, int ipv6)
 {
-	struct radius_client *client = data->clients;
-
-	while (client) {
 #ifdef CONFIG_IPV6
-		if (ipv6) {
-			struct in6_addr *addr6;
-			int i;
-
-			addr6 = (struct in6_addr *) addr;
-			for (i = 0; i < 16; i++) {
-				if ((addr6->s6_addr[i] &
-				     client->mask6.s6_addr[i]) !=
-				    (client->addr6.s6_addr[i] &
-				     client->mask6.s6_addr[i])) {
-					i = 17;
-					break;
-				}
-			}
-			if (i == 16) {
-				break;
-			}
+	if (ipv6) {
+		struct in6_addr *addr6;
+		int i;
+
+		addr6 = (struct in6_addr *) addr;
+		for (i = 0; i < 16; i++) {
+			if ((addr6->s6_addr[i] &
+			     client->mask6.s6_addr[i]) !=
+			    (client->addr6.s6_addr[i] &
+			     client->mask6.s6_addr[i]))
+				return 0;
 		}
+		return 1;
+	}
 #endif /* CONFIG_IPV6 */
-		if (!ipv6 && (client->addr.s_addr & client->mask.s_addr) ==
-		    (addr->s_addr & client->mask.s_addr)) {
-			break;
+	return (client->addr.s_addr & client->mask.s_addr) ==
+		(addr->s_addr & client->mask.s_addr);
+}
+
+
+/* FNV-1a of the address, the key of client_hash */
+static size_t radius_server_client_hash(struct radius_server_data *data,
+					const void *addr)
+{
+	const u8 *pos = addr;
+	size_t i, len = data->ipv6 ? 16 : 4;
+	u32 h = 2166136261u;
+
+	for (i = 0; i < len; i++) {
+		h ^= pos[i];
+		h *= 16777619;
+	}
+	return h & (data->client_hash_size - 1);
+}
+
+
+static int radius_server_client_single(struct radius_server_data *data,
+				       struct radius_client *client)
+{
+#ifdef CONFIG_IPV6
+	if (data->ipv6) {
+		int i;
+
+		for (i = 0; i < 16; i++)
+			if (client->mask6.s6_addr[i] != 0xff)
+				return 0;
+		return 1;
+	}
+#endif /* CONFIG_IPV6 */
+	return client->mask.s_addr == 0xffffffff;
+}
+
+
+/* Puts the clients of a single address in client_hash and the others in the
+ * subnets list. */
+static int radius_server_index_clients(struct radius_server_data *data)
+{
+	struct radius_client *client, **tail = &data->subnets;
+	size_t count = 0, h;
+
+	for (client = data->clients; client; client = client->next)
+		client->index = count++;
+	data->client_hash_size = 16;
+	while (data->client_hash_size < count)
+		data->client_hash_size *= 2;
+	data->client_hash = os_zalloc(data->client_hash_size *
+				      sizeof(*data->client_hash));
+	if (data->client_hash == NULL)
+		return -1;
+
+	for (client = data->clients; client; client = client->next) {
+		if (!radius_server_client_single(data, client)) {
+			*tail = client;
+			tail = &client->next_subnet;
+			continue;
 		}
+#ifdef CONFIG_IPV6
+		if (data->ipv6)
+			h = radius_server_client_hash(data, &client->addr6);
+		else
+#endif /* CONFIG_IPV6 */
+		h = radius_server_client_hash(data, &client->addr);
+		client->hnext = data->client_hash[h];
+		data->client_hash[h] = client;
+	}
+	return 0;
+}
 
-		client = client->next;
+
+static struct radius_client *
+radius_server_get_client(struct radius_server_data *data, struct in_addr *addr,
+			 int ipv6)
+{
+	struct radius_client *client, *found = NULL;
+
+	/* The earliest client of the file that matches, as in a linear scan:
+	 * the one of the address, unless a subnet comes before it */
+	client = data->client_hash[radius_server_client_hash(data, addr)];
+	for (; client; client = client->hnext) {
+		if (radius_server_client_match(client, addr, ipv6) &&
+		    (found == NULL || client->index < found->index))
+			found = client;
 	}
 
-	return client;
+	for (client = data->subnets; client; client = client->next_subnet) {
+		if (found && client->index > found->index)
+			break;
+		if (radius_server_client_match(client, addr, ipv6))
+			return client;
+	}
+
+	return found;
+}
+
+
+static size_t radius_server_sess_hash(struct radius_server_data *data,
+				      unsigned int sess_id)
+{
+	return (u32) (sess_id * 2654435761u) >> (32 - data->sess_hash_bits);
 }
 
 
 static struct radius_session *
-radius_server_get_session(struct radius_client *client, unsigned int sess_id)
+radius_server_get_session(struct radius_server_data *data,
+			  struct radius_client *client, unsigned int sess_id)
 {
-	struct radius_session *sess = client->sessions;
+	struct radius_session *sess;
 
+	sess = data->sess_hash[radius_server_sess_hash(data, sess_id)];
 	while (sess) {
-		if (sess->sess_id == sess_id) {
+		if (sess->sess_id == sess_id && sess->client == client) {
 			break;
 		}
-		sess = sess->next;
+		sess = sess->hnext;
 	}
 
 	return sess;
@@ -369,6 +528,7 @@ static void radius_server_session_free(struct radius_server_data *data,
 	radius_msg_free(sess->last_msg);
 	os_free(sess->last_from_addr);
 	radius_msg_free(sess->last_reply);
+	wpabuf_arena_free(sess->arena);
 	os_free(sess);
 	data->num_sess--;
 }
@@ -378,25 +538,24 @@ static void radius_server_session_remove(struct radius_server_data *data,
 					 struct radius_session *sess)
 {
 	struct radius_client *client = sess->client;
-	struct radius_session *session, *prev;
+	struct radius_session **pos;
 
 	eloop_cancel_timeout(radius_server_session_remove_timeout, data, sess);
 
-	prev = NULL;
-	session = client->sessions;
-	while (session) {
-		if (session == sess) {
-			if (prev == NULL) {
-				client->sessions = sess->next;
-			} else {
-				prev->next = sess->next;
-			}
-			radius_server_session_free(data, sess);
-			break;
-		}
-		prev = session;
-		session = session->next;
-	}
+	if (sess->prev)
+		sess->prev->next = sess->next;
+	else
+		client->sessions = sess->next;
+	if (sess->next)
+		sess->next->prev = sess->prev;
+
+	pos = &data->sess_hash[radius_server_sess_hash(data, sess->sess_id)];
+	while (*pos && *pos != sess)
+		pos = &(*pos)->hnext;
+	if (*pos)
+		*pos = sess->hnext;
+
+	radius_server_session_free(data, sess);
 }
 
 
@@ -425,8 +584,9 @@ radius_server_new_session(struct radius_server_data *data,
 			  struct radius_client *client)
 {
 	struct radius_session *sess;
+	size_t h;
 
-	if (data->num_sess >= RADIUS_MAX_SESSION) {
+	if (data->num_sess >= data->max_sessions) {
 		RADIUS_DEBUG("Maximum number of existing session - no room "
 			     "for a new session");
 		return NULL;
@@ -438,9 +598,17 @@ radius_server_new_session(struct radius_server_data *data,
 
 	sess->server = data;
 	sess->client = client;
-	sess->sess_id = data->next_sess_id++;
+	if (data->session_arena)
+		sess->arena = wpabuf_arena_new();
+	sess->sess_id = data->next_sess_id;
+	data->next_sess_id += data->sess_id_step;
 	sess->next = client->sessions;
+	if (client->sessions)
+		client->sessions->prev = sess;
 	client->sessions = sess;
+	h = radius_server_sess_hash(data, sess->sess_id);
+	sess->hnext = data->sess_hash[h];
+	data->sess_hash[h] = sess;
 	eloop_register_timeout(RADIUS_SESSION_TIMEOUT, 0,
 			       radius_server_session_timeout, data, sess);
 	data->num_sess++;
@@ -458,6 +626,7 @@ radius_server_get_new_session(struct radius_server_data *data,
 	int res;
 	struct radius_session *sess;
 	struct eap_config eap_conf;
+	struct wpabuf_arena *arena;
 
 	RADIUS_DEBUG("Creating a new session");
 
@@ -505,12 +674,15 @@ radius_server_get_new_session(struct radius_server_data *data,
 	eap_conf.eap_sim_aka_result_ind = data->eap_sim_aka_result_ind;
 	eap_conf.tnc = data->tnc;
 	eap_conf.wps = data->wps;
+	eap_conf.eap_methods = data->eap_methods;
+	arena = wpabuf_arena_set(sess->arena);
 	sess->eap = eap_server_sm_init(sess, &radius_server_eapol_cb,
 				       &eap_conf);
+	wpabuf_arena_set(arena);
 	if (sess->eap == NULL) {
 		RADIUS_DEBUG("Failed to initialize EAP state machine for the "
 			     "new session");
-		radius_server_session_free(data, sess);
+		radius_server_session_remove(data, sess);
 		return NULL;
 	}
 	sess->eap_if = eap_get_interface(sess->eap);
@@ -597,6 +769,23 @@ radius_server_encapsulate_eap(struct radius_server_data *data,
 }
 
 
+static int radius_server_send(struct radius_server_data *data,
+			      struct wpabuf *buf,
+			      struct sockaddr *to, socklen_t tolen)
+{
+	if (data->send_reply)
+		return data->send_reply(data->send_reply_ctx,
+					wpabuf_head(buf), wpabuf_len(buf),
+					to, tolen);
+	if (sendto(data->auth_sock, wpabuf_head(buf), wpabuf_len(buf), 0,
+		   to, tolen) < 0) {
+		perror("sendto[RADIUS SRV]");
+		return -1;
+	}
+	return 0;
+}
+
+
 static int radius_server_reject(struct radius_server_data *data,
 				struct radius_client *client,
 				struct radius_msg *request,
@@ -646,11 +835,8 @@ static int radius_server_reject(struct radius_server_data *data,
 	data->counters.access_rejects++;
 	client->counters.access_rejects++;
 	buf = radius_msg_get_buf(msg);
-	if (sendto(data->auth_sock, wpabuf_head(buf), wpabuf_len(buf), 0,
-		   (struct sockaddr *) from, sizeof(*from)) < 0) {
-		perror("sendto[RADIUS SRV]");
+	if (radius_server_send(data, buf, from, fromlen) < 0)
 		ret = -1;
-	}
 
 	radius_msg_free(msg);
 
@@ -672,6 +858,7 @@ static int radius_server_request(struct radius_server_data *data,
 	unsigned int state;
 	struct radius_session *sess;
 	struct radius_msg *reply;
+	struct wpabuf_arena *arena;
 	int is_complete = 0;
 
 	if (force_sess)
@@ -682,7 +869,7 @@ static int radius_server_request(struct radius_server_data *data,
 		state_included = res >= 0;
 		if (res == sizeof(statebuf)) {
 			state = WPA_GET_BE32(statebuf);
-			sess = radius_server_get_session(client, state);
+			sess = radius_server_get_session(data, client, state);
 		} else {
 			sess = NULL;
 		}
@@ -716,12 +903,7 @@ static int radius_server_request(struct radius_server_data *data,
 		if (sess->last_reply) {
 			struct wpabuf *buf;
 			buf = radius_msg_get_buf(sess->last_reply);
-			res = sendto(data->auth_sock, wpabuf_head(buf),
-				     wpabuf_len(buf), 0,
-				     (struct sockaddr *) from, fromlen);
-			if (res < 0) {
-				perror("sendto[RADIUS SRV]");
-			}
+			radius_server_send(data, buf, from, fromlen);
 			return 0;
 		}
 
@@ -754,7 +936,9 @@ static int radius_server_request(struct radius_server_data *data,
 		os_free(eap);
 	eap = NULL;
 	sess->eap_if->eapResp = TRUE;
+	arena = wpabuf_arena_set(sess->arena);
 	eap_server_sm_step(sess->eap);
+	wpabuf_arena_set(arena);
 
 	if ((sess->eap_if->eapReq || sess->eap_if->eapSuccess ||
 	     sess->eap_if->eapFail) && sess->eap_if->eapReqData) {
@@ -785,7 +969,9 @@ static int radius_server_request(struct radius_server_data *data,
 	if (sess->eap_if->eapSuccess || sess->eap_if->eapFail)
 		is_complete = 1;
 
+	arena = wpabuf_arena_set(sess->arena);
 	reply = radius_server_encapsulate_eap(data, client, sess, msg);
+	wpabuf_arena_set(arena);
 
 	if (reply) {
 		struct wpabuf *buf;
@@ -811,12 +997,7 @@ static int radius_server_request(struct radius_server_data *data,
 			break;
 		}
 		buf = radius_msg_get_buf(reply);
-		res = sendto(data->auth_sock, wpabuf_head(buf),
-			     wpabuf_len(buf), 0,
-			     (struct sockaddr *) from, fromlen);
-		if (res < 0) {
-			perror("sendto[RADIUS SRV]");
-		}
+		radius_server_send(data, buf, from, fromlen);
 		radius_msg_free(sess->last_reply);
 		sess->last_reply = reply;
 		sess->last_from_port = from_port;
@@ -833,7 +1014,7 @@ static int radius_server_request(struct radius_server_data *data,
 			     sess->sess_id);
 		eloop_cancel_timeout(radius_server_session_remove_timeout,
 				     data, sess);
-		eloop_register_timeout(10, 0,
+		eloop_register_timeout(data->completed_timeout, 0,
 				       radius_server_session_remove_timeout,
 				       data, sess);
 	}
@@ -842,60 +1023,61 @@ static int radius_server_request(struct radius_server_data *data,
 }
 
 
-static void radius_server_receive_auth(int sock, void *eloop_ctx,
-				       void *sock_ctx)
+/**
+ * radius_server_receive - Process a RADIUS request
+ * @data: RADIUS server context from radius_server_init()
+ * @buf: RADIUS message received
+ * @len: Length of buf in octets
+ * @from: Address of the client
+ * @fromlen: Length of from
+ *
+ * This is used with the server's socket and, with send_reply, by the caller
+ * that receives the requests itself. The reply, if any, is sent before
+ * returning.
+ */
+void radius_server_receive(struct radius_server_data *data, const u8 *buf,
+			   size_t len, const struct sockaddr *from,
+			   socklen_t fromlen)
 {
-	struct radius_server_data *data = eloop_ctx;
-	u8 *buf = NULL;
 	union {
 		struct sockaddr_storage ss;
 		struct sockaddr_in sin;
 #ifdef CONFIG_IPV6
 		struct sockaddr_in6 sin6;
 #endif /* CONFIG_IPV6 */
-	} from;
-	socklen_t fromlen;
-	int len;
+	} addr;
 	struct radius_client *client = NULL;
 	struct radius_msg *msg = NULL;
 	char abuf[50];
 	int from_port = 0;
 
-	buf = os_malloc(RADIUS_MAX_MSG_LEN);
-	if (buf == NULL) {
-		goto fail;
-	}
-
-	fromlen = sizeof(from);
-	len = recvfrom(sock, buf, RADIUS_MAX_MSG_LEN, 0,
-		       (struct sockaddr *) &from.ss, &fromlen);
-	if (len < 0) {
-		perror("recvfrom[radius_server]");
-		goto fail;
-	}
+	if (fromlen > sizeof(addr))
+		return;
+	os_memset(&addr, 0, sizeof(addr));
+	os_memcpy(&addr, from, fromlen);
 
 #ifdef CONFIG_IPV6
 	if (data->ipv6) {
-		if (inet_ntop(AF_INET6, &from.sin6.sin6_addr, abuf,
+		if (inet_ntop(AF_INET6, &addr.sin6.sin6_addr, abuf,
 			      sizeof(abuf)) == NULL)
 			abuf[0] = '\0';
-		from_port = ntohs(from.sin6.sin6_port);
+		from_port = ntohs(addr.sin6.sin6_port);
 		RADIUS_DEBUG("Received %d bytes from %s:%d",
-			     len, abuf, from_port);
+			     (int) len, abuf, from_port);
 
 		client = radius_server_get_client(data,
 						  (struct in_addr *)
-						  &from.sin6.sin6_addr, 1);
+						  &addr.sin6.sin6_addr, 1);
 	}
 #endif /* CONFIG_IPV6 */
 
 	if (!data->ipv6) {
-		os_strlcpy(abuf, inet_ntoa(from.sin.sin_addr), sizeof(abuf));
-		from_port = ntohs(from.sin.sin_port);
+		os_strlcpy(abuf, inet_ntoa(addr.sin.sin_addr), sizeof(abuf));
+		from_port = ntohs(addr.sin.sin_port);
 		RADIUS_DEBUG("Received %d bytes from %s:%d",
-			     len, abuf, from_port);
+			     (int) len, abuf, from_port);
 
-		client = radius_server_get_client(data, &from.sin.sin_addr, 0);
+		client = radius_server_get_client(data, &addr.sin.sin_addr, 0);
 	}
 
 	RADIUS_DUMP("Received data", buf, len);
@@ -903,7 +1085,7 @@ static void radius_server_receive_auth(int sock, void *eloop_ctx,
 	if (client == NULL) {
 		RADIUS_DEBUG("Unknown client %s - packet ignored", abuf);
 		data->counters.invalid_requests++;
-		goto fail;
+		return;
 	}
 
 	msg = radius_msg_parse(buf, len);
@@ -911,12 +1093,9 @@ static void radius_server_receive_auth(int sock, void *eloop_ctx,
 		RADIUS_DEBUG("Parsing incoming RADIUS frame failed");
 		data->counters.malformed_access_requests++;
 		client->counters.malformed_access_requests++;
-		goto fail;
+		return;
 	}
 
-	os_free(buf);
-	buf = NULL;
-
 	if (wpa_debug_level <= MSG_MSGDUMP) {
 		radius_msg_dump(msg);
 	}
@@ -940,13 +1119,37 @@ static void radius_server_receive_auth(int sock, void *eloop_ctx,
 		goto fail;
 	}
 
-	if (radius_server_request(data, msg, (struct sockaddr *) &from,
+	if (radius_server_request(data, msg, (struct sockaddr *) &addr.ss,
 				  fromlen, client, abuf, from_port, NULL) ==
 	    -2)
 		return; /* msg was stored with the session */
 
 fail:
 	radius_msg_free(msg);
+}
+
+
+static void radius_server_receive_auth(int sock, void *eloop_ctx,
+				       void *sock_ctx)
+{
+	struct radius_server_data *data = eloop_ctx;
+	u8 *buf;
+	struct sockaddr_storage from;
+	socklen_t fromlen;
+	int len;
+
+	buf = os_malloc(RADIUS_MAX_MSG_LEN);
+	if (buf == NULL)
+		return;
+
+	fromlen = sizeof(from);
+	len = recvfrom(sock, buf, RADIUS_MAX_MSG_LEN, 0,
+		       (struct sockaddr *) &from, &fromlen);
+	if (len < 0)
+		perror("recvfrom[radius_server]");
+	else
+		radius_server_receive(data, buf, len,
+				      (struct sockaddr *) &from, fromlen);
 	os_free(buf);
 }
 
@@ -1205,6 +1408,25 @@ radius_server_read_clients(const char *client_file, int ipv6)
 }
 
 
+/* Client of every address (0.0.0.0/0 or ::/0, the masks are zero). */
+static struct radius_client *
+radius_server_any_client(const char *shared_secret)
+{
+	struct radius_client *entry;
+
+	entry = os_zalloc(sizeof(*entry));
+	if (entry == NULL)
+		return NULL;
+	entry->shared_secret = os_strdup(shared_secret);
+	if (entry->shared_secret == NULL) {
+		os_free(entry);
+		return NULL;
+	}
+	entry->shared_secret_len = os_strlen(entry->shared_secret);
+	return entry;
+}
+
+
 /**
  * radius_server_init - Initialize RADIUS server
  * @conf: Configuration for the RADIUS server
@@ -1268,13 +1490,45 @@ radius_server_init(struct radius_server_conf *conf)
 		}
 	}
 
-	data->clients = radius_server_read_clients(conf->client_file,
-						   conf->ipv6);
+	data->eap_methods = conf->eap_methods;
+	data->max_sessions = conf->max_sessions > 0 ? conf->max_sessions :
+		RADIUS_MAX_SESSION;
+	data->completed_timeout = conf->completed_timeout > 0 ?
+		conf->completed_timeout : RADIUS_COMPLETED_TIMEOUT;
+	data->session_arena = conf->session_arena;
+	data->next_sess_id = conf->sess_id_offset;
+	data->sess_id_step = conf->sess_id_step > 0 ? conf->sess_id_step : 1;
+	data->sess_hash_bits = 4;
+	while (data->sess_hash_bits < 30 &&
+	       (1 << data->sess_hash_bits) < data->max_sessions)
+		data->sess_hash_bits++;
+	data->sess_hash = os_zalloc(sizeof(*data->sess_hash) <<
+				    data->sess_hash_bits);
+	if (data->sess_hash == NULL) {
+		radius_server_deinit(data);
+		return NULL;
+	}
+	data->send_reply = conf->send_reply;
+	data->send_reply_ctx = conf->send_reply_ctx;
+	data->auth_sock = -1;
+
+	if (conf->client_file)
+		data->clients = radius_server_read_clients(conf->client_file,
+							   conf->ipv6);
+	else if (conf->shared_secret)
+		data->clients = radius_server_any_client(conf->shared_secret);
 	if (data->clients == NULL) {
 		printf("No RADIUS clients configured.\n");
 		radius_server_deinit(data);
 		return NULL;
 	}
+	if (radius_server_index_clients(data) < 0) {
+		radius_server_deinit(data);
+		return NULL;
+	}
+
+	if (data->send_reply)
+		return data;
 
 #ifdef CONFIG_IPV6
 	if (conf->ipv6)
@@ -1314,6 +1568,8 @@ void radius_server_deinit(struct radius_server_data *data)
 	}
 
 	radius_server_free_clients(data, data->clients);
+	os_free(data->client_hash);
+	os_free(data->sess_hash);
 
 	os_free(data->pac_opaque_encr_key);
 	os_free(data->eap_fast_a_id);
@@ -194,6 +194,82 @@ struct radius_server_conf {
 	 * msg_ctx - Context data for wpa_msg() calls
 	 */
 	void *msg_ctx;
+
+	/**
+	 * eap_methods - EAP methods of the sessions
+	 *
+	 * List of the server methods registered by the caller (e.g., with
+	 * eap_server_psk_register()).
+	 */
+	struct eap_method *eap_methods;
+
+	/**
+	 * shared_secret - Shared secret of any RADIUS client
+	 *
+	 * Used when client_file is %NULL: the requests of every address are
+	 * accepted with this secret.
+	 */
+	const char *shared_secret;
+
+	/**
+	 * max_sessions - Maximum number of active sessions
+	 *
+	 * 0 for the default, RADIUS_MAX_SESSION.
+	 */
+	int max_sessions;
+
+	/**
+	 * completed_timeout - Time the completed sessions are kept in seconds
+	 *
+	 * The retransmissions of the last request of a session are answered
+	 * with the same reply during this time. 0 for the default, 10.
+	 */
+	int completed_timeout;
+
+	/**
+	 * sess_id_offset - Identifier of the first session
+	 */
+	unsigned int sess_id_offset;
+
+	/**
+	 * sess_id_step - Increment of the session identifiers
+	 *
+	 * The sessions are sess_id_offset + k * sess_id_step (in the State
+	 * attribute), so that the requests of several servers sharing the
+	 * same clients can be told apart. 0 for the default, 1.
+	 */
+	unsigned int sess_id_step;
+
+	/**
+	 * session_arena - Whether each session has its own wpabuf arena
+	 *
+	 * The buffers of the EAP state machine and the replies of a session
+	 * are taken from an arena (wpabuf_arena_new()) released with the
+	 * session. Only with CONFIG_WPABUF_POOL, and only if the eloop of the
+	 * server runs in a single thread.
+	 */
+	int session_arena;
+
+	/**
+	 * send_reply - Callback for sending the replies without the socket
+	 * @ctx: Context data from send_reply_ctx
+	 * @data: RADIUS message
+	 * @len: Length of data in octets
+	 * @to: Address the request was received from
+	 * @tolen: Length of to
+	 * Returns: 0 on success, -1 on failure
+	 *
+	 * If set, no UDP socket is opened and auth_port is not used: the
+	 * requests are given to radius_server_receive() and the replies to
+	 * this callback, from the thread that calls it.
+	 */
+	int (*send_reply)(void *ctx, const u8 *data, size_t len,
+			  const struct sockaddr *to, socklen_t tolen);
+
+	/**
+	 * send_reply_ctx - Context pointer for send_reply
+	 */
+	void *send_reply_ctx;
 };
 
 
@@ -202,6 +278,10 @@ radius_server_init(struct radius_server_conf *conf);
 
 void radius_server_deinit(struct radius_server_data *data);
 
+void radius_server_receive(struct radius_server_data *data, const u8 *buf,
+			   size_t len, const struct sockaddr *from,
+			   socklen_t fromlen);
+
 int radius_server_get_mib(struct radius_server_data *data, char *buf,
 			  size_t buflen);
 
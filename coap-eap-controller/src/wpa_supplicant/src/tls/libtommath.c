@@ -27,6 +27,15 @@
 #define BN_S_MP_MUL_HIGH_DIGS_C /* Note: #undef in tommath_superclass.h; this
 				 * would require other than mp_reduce */
 
+/* Exptmod with odd moduli (RSA, DH) on 64-bit limbs with a fixed window, see
+ * mp_exptmod_mont64(). It needs 128-bit products from the compiler. The
+ * reductions left (CRT, R^2 mod P) are then most of the time with the
+ * bit-by-bit division, so the faster one is included too. */
+#if defined(__SIZEOF_INT128__) && !defined(LTM_NO_MONT64)
+#define LTM_MONT64
+#define BN_MP_MUL_D_C
+#endif
+
 #ifdef LTM_FAST
 
 /* Use faster div at the cost of about 1 kB */
@@ -44,10 +53,12 @@
 
 #else /* LTM_FAST */
 
+#ifndef LTM_MONT64
 #define BN_MP_DIV_SMALL
 #define BN_MP_INIT_MULTI_C
 #define BN_MP_CLEAR_MULTI_C
 #define BN_MP_ABS_C
+#endif /* LTM_MONT64 */
 #endif /* LTM_FAST */
 
 /* Current uses do not require support for negative exponent in exptmod, so we
@@ -179,6 +190,9 @@ static int fast_s_mp_sqr (mp_int * a, mp_int * b);
 #ifdef BN_MP_MUL_D_C
 static int mp_mul_d (mp_int * a, mp_digit b, mp_int * c);
 #endif /* BN_MP_MUL_D_C */
+#ifdef LTM_MONT64
+static int mp_exptmod_mont64(mp_int * G, mp_int * X, mp_int * P, mp_int * Y);
+#endif /* LTM_MONT64 */
 
 
 
@@ -570,6 +584,279 @@ static int mp_mod (mp_int * a, mp_int * b, mp_int * c)
 }
 
 
+#ifdef LTM_MONT64
+
+/*
+ * Not from LibTomMath: Montgomery exponentiation for odd moduli on 64-bit
+ * limbs, with 128-bit products, instead of the 28-bit digits of mp_int that
+ * the Barrett reduction of s_mp_exptmod() works on. The exponent is taken
+ * in fixed windows of MONT64_WINDOW bits: every window does the same
+ * squarings and one multiplication, by a table entry read with a mask, and
+ * the final subtraction of the Montgomery multiplication is masked too, so
+ * the time does not depend on the bits of the exponent (only on its length).
+ */
+
+#define MONT64_MAX_LIMBS 64 /* 4096-bit moduli */
+#define MONT64_WINDOW    5
+
+typedef unsigned __int128 mont64_word;
+
+/* r = t - m unless that borrows, t (n limbs and top) < 2m */
+static void mont64_final_sub(u64 *r, const u64 *t, u64 top, const u64 *m,
+                             int n)
+{
+  u64 s[MONT64_MAX_LIMBS], borrow, keep;
+  mont64_word w;
+  int j;
+
+  borrow = 0;
+  for (j = 0; j < n; j++) {
+    w = (mont64_word) t[j] - m[j] - borrow;
+    s[j] = (u64) w;
+    borrow = (u64) (w >> 64) & 1;
+  }
+  keep = (u64) 0 - (borrow & (top ^ 1));
+  for (j = 0; j < n; j++) {
+    r[j] = (t[j] & keep) | (s[j] & ~keep);
+  }
+}
+
+/* r = a * b / 2^(64 n) mod m, with a, b < m; r may be a or b */
+static void mont64_mul(u64 *r, const u64 *a, const u64 *b, const u64 *m,
+                       u64 m0inv, int n)
+{
+  u64 t[MONT64_MAX_LIMBS + 1], c1, c2, q;
+  mont64_word w, w2;
+  int i, j;
+
+  os_memset(t, 0, (n + 1) * sizeof(u64));
+  for (i = 0; i < n; i++) {
+    /* t = (t + a * b[i] + q * m) / 2^64, with q making it divisible */
+    w = (mont64_word) a[0] * b[i] + t[0];
+    c1 = (u64) (w >> 64);
+    q = (u64) w * m0inv;
+    w2 = (mont64_word) q * m[0] + (u64) w;
+    c2 = (u64) (w2 >> 64);
+    for (j = 1; j < n; j++) {
+      w = (mont64_word) a[j] * b[i] + t[j] + c1;
+      c1 = (u64) (w >> 64);
+      w2 = (mont64_word) q * m[j] + (u64) w + c2;
+      c2 = (u64) (w2 >> 64);
+      t[j - 1] = (u64) w2;
+    }
+    w = (mont64_word) t[n] + c1 + c2;
+    t[n - 1] = (u64) w;
+    t[n] = (u64) (w >> 64);
+  }
+
+  mont64_final_sub(r, t, t[n], m, n);
+}
+
+/* r = a^2 / 2^(64 n) mod m, with a < m; r may be a. The square takes half
+ * the products of mont64_mul(), the reduction is done afterwards. */
+static void mont64_sqr(u64 *r, const u64 *a, const u64 *m, u64 m0inv, int n)
+{
+  u64 t[2 * MONT64_MAX_LIMBS], c, top, q;
+  mont64_word w;
+  int i, j;
+
+  /* t = the products a[i] a[j], i < j */
+  os_memset(t, 0, 2 * n * sizeof(u64));
+  for (i = 0; i < n - 1; i++) {
+    c = 0;
+    for (j = i + 1; j < n; j++) {
+      w = (mont64_word) a[i] * a[j] + t[i + j] + c;
+      t[i + j] = (u64) w;
+      c = (u64) (w >> 64);
+    }
+    t[i + n] = c;
+  }
+
+  /* t = 2 t + the squares a[i]^2 */
+  for (i = 2 * n - 1; i > 0; i--) {
+    t[i] = (t[i] << 1) | (t[i - 1] >> 63);
+  }
+  t[0] <<= 1;
+  c = 0;
+  for (i = 0; i < n; i++) {
+    w = (mont64_word) a[i] * a[i] + t[2 * i] + c;
+    t[2 * i] = (u64) w;
+    w = (mont64_word) t[2 * i + 1] + (u64) (w >> 64);
+    t[2 * i + 1] = (u64) w;
+    c = (u64) (w >> 64);
+  }
+
+  /* t = t / 2^(64 n) mod m, top carries over from one limb to the next */
+  top = 0;
+  for (i = 0; i < n; i++) {
+    q = t[i] * m0inv;
+    c = 0;
+    for (j = 0; j < n; j++) {
+      w = (mont64_word) q * m[j] + t[i + j] + c;
+      t[i + j] = (u64) w;
+      c = (u64) (w >> 64);
+    }
+    w = (mont64_word) t[i + n] + c + top;
+    t[i + n] = (u64) w;
+    top = (u64) (w >> 64);
+  }
+
+  mont64_final_sub(r, t + n, top, m, n);
+}
+
+/* r = table[idx], reading every entry */
+static void mont64_select(u64 *r, const u64 *table, int idx, int n)
+{
+  u64 mask;
+  int i, j;
+
+  os_memset(r, 0, n * sizeof(u64));
+  for (i = 0; i < (1 << MONT64_WINDOW); i++) {
+    mask = (u64) 0 - (u64) (i == idx);
+    for (j = 0; j < n; j++) {
+      r[j] |= table[i * n + j] & mask;
+    }
+  }
+}
+
+/* the DIGIT_BIT digits of a (a < 2^(64 n)) to n limbs */
+static void mont64_from_mp(mp_int * a, u64 *r, int n)
+{
+  int i, bit, limb, shift;
+
+  os_memset(r, 0, n * sizeof(u64));
+  for (i = 0; i < a->used; i++) {
+    bit = i * DIGIT_BIT;
+    limb = bit / 64;
+    shift = bit % 64;
+    if (limb < n) {
+      r[limb] |= (u64) a->dp[i] << shift;
+    }
+    if (shift + DIGIT_BIT > 64 && limb + 1 < n) {
+      r[limb + 1] |= (u64) a->dp[i] >> (64 - shift);
+    }
+  }
+}
+
+static int mont64_to_mp(const u64 *r, int n, mp_int * a)
+{
+  int i, bit, limb, shift, digits, err, olduse;
+  u64 d;
+
+  digits = (n * 64 + DIGIT_BIT - 1) / DIGIT_BIT;
+  if (a->alloc < digits) {
+    if ((err = mp_grow (a, digits)) != MP_OKAY) {
+      return err;
+    }
+  }
+
+  olduse = a->used;
+  for (i = 0; i < digits; i++) {
+    bit = i * DIGIT_BIT;
+    limb = bit / 64;
+    shift = bit % 64;
+    d = r[limb] >> shift;
+    if (shift + DIGIT_BIT > 64 && limb + 1 < n) {
+      d |= r[limb + 1] << (64 - shift);
+    }
+    a->dp[i] = (mp_digit) (d & MP_MASK);
+  }
+  for (; i < olduse; i++) {
+    a->dp[i] = 0;
+  }
+  a->used = digits;
+  a->sign = MP_ZPOS;
+  mp_clamp (a);
+  return MP_OKAY;
+}
+
+static int mp_exptmod_mont64(mp_int * G, mp_int * X, mp_int * P, mp_int * Y)
+{
+  int n, bits, bit, win, idx, i, j, err;
+  u64 *table, *m, *acc, *tmp, m0inv, inv;
+  size_t table_len;
+  mp_int r;
+
+  n = (mp_count_bits (P) + 63) / 64;
+  bits = mp_count_bits (X);
+
+  /* the table, the modulus and two temporaries */
+  table_len = ((1 << MONT64_WINDOW) + 3) * n * sizeof(u64);
+  table = XMALLOC (table_len);
+  if (table == NULL) {
+    return MP_MEM;
+  }
+  m = table + (1 << MONT64_WINDOW) * n;
+  acc = m + n;
+  tmp = acc + n;
+
+  if ((err = mp_init (&r)) != MP_OKAY) {
+    XFREE (table);
+    return err;
+  }
+
+  /* m0inv = -1/m mod 2^64, Newton's iteration doubles the correct bits */
+  mont64_from_mp (P, m, n);
+  inv = m[0];
+  for (i = 0; i < 5; i++) {
+    inv *= 2 - m[0] * inv;
+  }
+  m0inv = (u64) 0 - inv;
+
+  /* tmp = R^2 mod P, with R = 2^(64 n) */
+  if ((err = mp_2expt (&r, 128 * n)) != MP_OKAY ||
+      (err = mp_mod (&r, P, &r)) != MP_OKAY) {
+    goto LBL_ERR;
+  }
+  mont64_from_mp (&r, tmp, n);
+
+  /* table[i] = G^i R mod P */
+  if ((err = mp_mod (G, P, &r)) != MP_OKAY) {
+    goto LBL_ERR;
+  }
+  mont64_from_mp (&r, acc, n);
+  mont64_mul (table + n, acc, tmp, m, m0inv, n);
+  os_memset (acc, 0, n * sizeof(u64));
+  acc[0] = 1;
+  mont64_mul (table, acc, tmp, m, m0inv, n);
+  for (i = 2; i < (1 << MONT64_WINDOW); i++) {
+    mont64_mul (table + i * n, table + (i - 1) * n, table + n, m, m0inv, n);
+  }
+
+  /* acc = G^X R mod P, from the most significant window */
+  os_memcpy (acc, table, n * sizeof(u64));
+  for (win = (bits + MONT64_WINDOW - 1) / MONT64_WINDOW - 1; win >= 0; win--) {
+    idx = 0;
+    for (j = MONT64_WINDOW - 1; j >= 0; j--) {
+      bit = win * MONT64_WINDOW + j;
+      idx <<= 1;
+      if (bit < bits) {
+        idx |= (int) ((X->dp[bit / DIGIT_BIT] >> (bit % DIGIT_BIT)) & 1);
+      }
+    }
+    for (j = 0; j < MONT64_WINDOW; j++) {
+      mont64_sqr (acc, acc, m, m0inv, n);
+    }
+    mont64_select (tmp, table, idx, n);
+    mont64_mul (acc, acc, tmp, m, m0inv, n);
+  }
+
+  /* out of the Montgomery form */
+  os_memset (tmp, 0, n * sizeof(u64));
+  tmp[0] = 1;
+  mont64_mul (acc, acc, tmp, m, m0inv, n);
+  err = mont64_to_mp (acc, n, Y);
+
+LBL_ERR:
+  os_memset (table, 0, table_len);
+  XFREE (table);
+  mp_clear (&r);
+  return err;
+}
+
+#endif /* LTM_MONT64 */
+
+
 /* this is a shell function that calls either the normal or Montgomery
  * exptmod functions.  Originally the call to the montgomery code was
  * embedded in the normal function but that wasted alot of stack space
@@ -624,6 +911,13 @@ static int mp_exptmod (mp_int * G, mp_int * X, mp_int * P, mp_int * Y)
 #endif /* LTM_NO_NEG_EXP */
   }
 
+#ifdef LTM_MONT64
+  if (mp_isodd (P) == MP_YES &&
+      mp_count_bits (P) <= MONT64_MAX_LIMBS * 64) {
+     return mp_exptmod_mont64 (G, X, P, Y);
+  }
+#endif /* LTM_MONT64 */
+
 /* modified diminished radix reduction */
 #if defined(BN_MP_REDUCE_IS_2K_L_C) && defined(BN_MP_REDUCE_2K_L_C) && defined(BN_S_MP_EXPTMOD_C)
   if (mp_reduce_is_2k_l(P) == MP_YES) {
@@ -376,6 +376,7 @@ void tlsv1_client_deinit(struct tlsv1_client *conn)
 	tlsv1_record_change_read_cipher(&conn->rl);
 	tls_verify_hash_free(&conn->verify);
 	os_free(conn->client_hello_ext);
+	os_free(conn->ticket);
 	tlsv1_client_free_dh(conn);
 	tlsv1_cred_free(conn->cred);
 	os_free(conn);
@@ -511,6 +512,26 @@ int tlsv1_client_resumed(struct tlsv1_client *conn)
 }
 
 
+/**
+ * tlsv1_client_set_session_tickets - Enable session tickets (RFC 5077)
+ * @conn: TLSv1 client connection data from tlsv1_client_init()
+ * @enabled: 1 to send the SessionTicket extension, 0 to not send it
+ *
+ * The ticket received in a full handshake is sent in the next ClientHello of
+ * the connection, see tlsv1_client_shutdown(). The extension is not sent if
+ * another one was set with tlsv1_client_hello_ext() (EAP-FAST PAC-Opaque).
+ */
+void tlsv1_client_set_session_tickets(struct tlsv1_client *conn, int enabled)
+{
+	conn->ticket_enabled = !!enabled;
+	if (!enabled) {
+		os_free(conn->ticket);
+		conn->ticket = NULL;
+		conn->ticket_len = 0;
+	}
+}
+
+
 /**
  * tlsv1_client_hello_ext - Set TLS extension for ClientHello
  * @conn: TLSv1 client connection data from tlsv1_client_init()
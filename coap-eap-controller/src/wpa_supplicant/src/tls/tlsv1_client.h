@@ -40,6 +40,7 @@ int tlsv1_client_get_cipher(struct tlsv1_client *conn, char *buf,
 			    size_t buflen);
 int tlsv1_client_shutdown(struct tlsv1_client *conn);
 int tlsv1_client_resumed(struct tlsv1_client *conn);
+void tlsv1_client_set_session_tickets(struct tlsv1_client *conn, int enabled);
 int tlsv1_client_hello_ext(struct tlsv1_client *conn, int ext_type,
 			   const u8 *data, size_t data_len);
 int tlsv1_client_get_keys(struct tlsv1_client *conn, struct tls_keys *keys);
@@ -39,6 +39,8 @@ struct tlsv1_client {
 	unsigned int session_resumed:1;
 	unsigned int session_ticket_included:1;
 	unsigned int use_session_ticket:1;
+	unsigned int ticket_enabled:1;
+	unsigned int ticket_expected:1;
 
 	struct crypto_public_key *server_rsa_key;
 
@@ -53,6 +55,11 @@ struct tlsv1_client {
 	u8 *client_hello_ext;
 	size_t client_hello_ext_len;
 
+	/* RFC 5077 ticket of the last session, see
+	 * tlsv1_client_set_session_tickets() */
+	u8 *ticket;
+	size_t ticket_len;
+
 	/* The prime modulus used for Diffie-Hellman */
 	u8 *dh_p;
 	size_t dh_p_len;
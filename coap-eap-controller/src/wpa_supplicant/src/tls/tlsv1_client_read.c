@@ -32,6 +32,84 @@ static int tls_process_server_hello_done(struct tlsv1_client *conn, u8 ct,
 					 const u8 *in_data, size_t *in_len);
 
 
+/* Only an empty SessionTicket extension (RFC 5077) is understood */
+static int tls_process_server_hello_ext(struct tlsv1_client *conn,
+					const u8 *pos, const u8 *end)
+{
+	u16 ext_type, ext_len;
+
+	if (end - pos < 2 || WPA_GET_BE16(pos) != end - pos - 2)
+		return -1;
+	pos += 2;
+
+	while (pos < end) {
+		if (end - pos < 4)
+			return -1;
+		ext_type = WPA_GET_BE16(pos);
+		ext_len = WPA_GET_BE16(pos + 2);
+		pos += 4;
+		if (ext_len > end - pos)
+			return -1;
+		if (ext_type != TLS_EXT_SESSION_TICKET || ext_len != 0)
+			return -1;
+		wpa_printf(MSG_DEBUG, "TLSv1: Server will send a new session "
+			   "ticket");
+		conn->ticket_expected = 1;
+		pos += ext_len;
+	}
+
+	return 0;
+}
+
+
+static int tls_process_new_session_ticket(struct tlsv1_client *conn,
+					  const u8 *in_data, size_t *in_len)
+{
+	const u8 *pos = in_data, *end;
+	size_t len, ticket_len;
+	u8 *ticket;
+
+	if (*in_len < 4)
+		goto decode_error;
+	len = WPA_GET_BE24(pos + 1);
+	pos += 4;
+	if (len > *in_len - 4 || len < 6)
+		goto decode_error;
+	end = pos + len;
+
+	/* uint32 ticket_lifetime_hint */
+	pos += 4;
+	/* opaque ticket<0..2^16-1> */
+	ticket_len = WPA_GET_BE16(pos);
+	pos += 2;
+	if (ticket_len != (size_t) (end - pos))
+		goto decode_error;
+	wpa_printf(MSG_DEBUG, "TLSv1: Received NewSessionTicket (len=%lu)",
+		   (unsigned long) ticket_len);
+
+	ticket = ticket_len ? os_malloc(ticket_len) : NULL;
+	if (ticket_len && ticket == NULL) {
+		tls_alert(conn, TLS_ALERT_LEVEL_FATAL,
+			  TLS_ALERT_INTERNAL_ERROR);
+		return -1;
+	}
+	if (ticket)
+		os_memcpy(ticket, pos, ticket_len);
+	os_free(conn->ticket);
+	conn->ticket = ticket;
+	conn->ticket_len = ticket_len;
+	conn->ticket_expected = 0;
+
+	*in_len = end - in_data;
+	return 0;
+
+decode_error:
+	wpa_printf(MSG_DEBUG, "TLSv1: Failed to decode NewSessionTicket");
+	tls_alert(conn, TLS_ALERT_LEVEL_FATAL, TLS_ALERT_DECODE_ERROR);
+	return -1;
+}
+
+
 static int tls_process_server_hello(struct tlsv1_client *conn, u8 ct,
 				    const u8 *in_data, size_t *in_len)
 {
@@ -164,6 +242,10 @@ static int tls_process_server_hello(struct tlsv1_client *conn, u8 ct,
 	}
 	pos++;
 
+	if (end != pos && conn->ticket_enabled &&
+	    tls_process_server_hello_ext(conn, pos, end) == 0)
+		pos = end;
+
 	if (end != pos) {
 		/* TODO: ServerHello extensions */
 		wpa_hexdump(MSG_DEBUG, "TLSv1: Unexpected extra data in the "
@@ -171,6 +253,13 @@ static int tls_process_server_hello(struct tlsv1_client *conn, u8 ct,
 		goto decode_error;
 	}
 
+	if (!conn->session_resumed && !conn->ticket_expected) {
+		/* The server did not accept the ticket nor issue a new one */
+		os_free(conn->ticket);
+		conn->ticket = NULL;
+		conn->ticket_len = 0;
+	}
+
 	if (conn->session_ticket_included && conn->session_ticket_cb) {
 		/* TODO: include SessionTicket extension if one was included in
 		 * ServerHello */
@@ -690,6 +779,10 @@ static int tls_process_server_change_cipher_spec(struct tlsv1_client *conn,
 	const u8 *pos;
 	size_t left;
 
+	if (ct == TLS_CONTENT_TYPE_HANDSHAKE && conn->ticket_expected &&
+	    *in_len >= 1 && in_data[0] == TLS_HANDSHAKE_TYPE_NEW_SESSION_TICKET)
+		return tls_process_new_session_ticket(conn, in_data, in_len);
+
 	if (ct != TLS_CONTENT_TYPE_CHANGE_CIPHER_SPEC) {
 		wpa_printf(MSG_DEBUG, "TLSv1: Expected ChangeCipherSpec; "
 			   "received content type 0x%x", ct);
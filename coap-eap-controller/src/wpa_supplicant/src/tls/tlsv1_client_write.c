@@ -65,7 +65,10 @@ u8 * tls_send_client_hello(struct tlsv1_client *conn, size_t *out_len)
 	wpa_hexdump(MSG_MSGDUMP, "TLSv1: client_random",
 		    conn->client_random, TLS_RANDOM_LEN);
 
+	conn->ticket_expected = 0;
 	len = 100 + conn->num_cipher_suites * 2 + conn->client_hello_ext_len;
+	if (conn->ticket_enabled && conn->client_hello_ext == NULL)
+		len += 6 + conn->ticket_len;
 	hello = os_malloc(len);
 	if (hello == NULL)
 		return NULL;
@@ -109,6 +112,18 @@ u8 * tls_send_client_hello(struct tlsv1_client *conn, size_t *out_len)
 		os_memcpy(pos, conn->client_hello_ext,
 			  conn->client_hello_ext_len);
 		pos += conn->client_hello_ext_len;
+	} else if (conn->ticket_enabled) {
+		/* SessionTicket, empty to ask for a new ticket */
+		WPA_PUT_BE16(pos, 4 + conn->ticket_len);
+		pos += 2;
+		WPA_PUT_BE16(pos, TLS_EXT_SESSION_TICKET);
+		pos += 2;
+		WPA_PUT_BE16(pos, conn->ticket_len);
+		pos += 2;
+		if (conn->ticket) {
+			os_memcpy(pos, conn->ticket, conn->ticket_len);
+			pos += conn->ticket_len;
+		}
 	}
 
 	WPA_PUT_BE24(hs_length, pos - hs_length - 3);
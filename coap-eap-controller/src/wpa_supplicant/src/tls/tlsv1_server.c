@@ -356,6 +356,11 @@ static void tlsv1_server_clear_data(struct tlsv1_server *conn)
 	conn->session_ticket_len = 0;
 	conn->use_session_ticket = 0;
 
+	conn->client_session_id_len = 0;
+	conn->session_ticket_ext = 0;
+	conn->session_resumed = 0;
+	conn->new_session_ticket = 0;
+
 	os_free(conn->dh_secret);
 	conn->dh_secret = NULL;
 	conn->dh_secret_len = 0;
@@ -491,7 +496,7 @@ int tlsv1_server_shutdown(struct tlsv1_server *conn)
  */
 int tlsv1_server_resumed(struct tlsv1_server *conn)
 {
-	return 0;
+	return conn->session_resumed;
 }
 
 
@@ -590,3 +595,18 @@ void tlsv1_server_set_session_ticket_cb(struct tlsv1_server *conn,
 	conn->session_ticket_cb = cb;
 	conn->session_ticket_cb_ctx = ctx;
 }
+
+
+/**
+ * tlsv1_server_set_session_cache - Enable session resumption
+ * @conn: TLSv1 server connection data from tlsv1_server_init()
+ * @cache: Sessions and ticket keys from tlsv1_session_cache_init(), shared by
+ * the connections of a server
+ *
+ * It is not used if a SessionTicket callback is set (EAP-FAST).
+ */
+void tlsv1_server_set_session_cache(struct tlsv1_server *conn,
+				    struct tlsv1_session_cache *cache)
+{
+	conn->session_cache = cache;
+}
@@ -18,6 +18,7 @@
 #include "tlsv1_cred.h"
 
 struct tlsv1_server;
+struct tlsv1_session_cache;
 
 int tlsv1_server_global_init(void);
 void tlsv1_server_global_deinit(void);
@@ -50,5 +51,7 @@ typedef int (*tlsv1_server_session_ticket_cb)
 void tlsv1_server_set_session_ticket_cb(struct tlsv1_server *conn,
 					tlsv1_server_session_ticket_cb cb,
 					void *ctx);
+void tlsv1_server_set_session_cache(struct tlsv1_server *conn,
+				    struct tlsv1_session_cache *cache);
 
 #endif /* TLSV1_SERVER_H */
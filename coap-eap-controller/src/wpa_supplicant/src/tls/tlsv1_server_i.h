@@ -59,6 +59,14 @@ struct tlsv1_server {
 
 	int use_session_ticket;
 
+	/* Session resumption without EAP-FAST (tlsv1_session_cache.c) */
+	struct tlsv1_session_cache *session_cache;
+	u8 client_session_id[TLS_SESSION_ID_MAX_LEN];
+	size_t client_session_id_len;
+	int session_ticket_ext; /* SessionTicket extension in ClientHello */
+	int session_resumed; /* abbreviated handshake */
+	int new_session_ticket; /* NewSessionTicket to be sent */
+
 	u8 *dh_secret;
 	size_t dh_secret_len;
 };
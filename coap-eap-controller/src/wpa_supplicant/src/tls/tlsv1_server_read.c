@@ -109,8 +109,10 @@ static int tls_process_client_hello(struct tlsv1_server *conn, u8 ct,
 	if (end - pos < 1 + *pos || *pos > TLS_SESSION_ID_MAX_LEN)
 		goto decode_error;
 	wpa_hexdump(MSG_MSGDUMP, "TLSv1: client session_id", pos + 1, *pos);
+	/* The session is looked up in the cache with the ServerHello */
+	os_memcpy(conn->client_session_id, pos + 1, *pos);
+	conn->client_session_id_len = *pos;
 	pos += 1 + *pos;
-	/* TODO: add support for session resumption */
 
 	/* CipherSuite cipher_suites<2..2^16-1> */
 	if (end - pos < 2)
@@ -235,6 +237,7 @@ static int tls_process_client_hello(struct tlsv1_server *conn, u8 ct,
 				    "Extension data", pos, ext_len);
 
 			if (ext_type == TLS_EXT_SESSION_TICKET) {
+				conn->session_ticket_ext = 1;
 				os_free(conn->session_ticket);
 				conn->session_ticket = os_malloc(ext_len);
 				if (conn->session_ticket) {
@@ -1064,7 +1067,7 @@ static int tls_process_client_finished(struct tlsv1_server *conn, u8 ct,
 
 	*in_len = end - in_data;
 
-	if (conn->use_session_ticket) {
+	if (conn->use_session_ticket || conn->session_resumed) {
 		/* Abbreviated handshake using session ticket; RFC 4507 */
 		wpa_printf(MSG_DEBUG, "TLSv1: Abbreviated handshake completed "
 			   "successfully");
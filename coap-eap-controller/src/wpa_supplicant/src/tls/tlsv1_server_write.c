@@ -23,6 +23,7 @@
 #include "tlsv1_record.h"
 #include "tlsv1_server.h"
 #include "tlsv1_server_i.h"
+#include "tlsv1_session_cache.h"
 
 
 static size_t tls_server_cert_chain_der_len(struct tlsv1_server *conn)
@@ -43,6 +44,51 @@ static size_t tls_server_cert_chain_der_len(struct tlsv1_server *conn)
 }
 
 
+/* Session ID or session ticket (RFC 5077) of a previous full handshake */
+static int tls_server_resume_session(struct tlsv1_server *conn)
+{
+	struct tlsv1_session_cache *cache = conn->session_cache;
+
+	/* The client must send a session ID with its ticket, the ServerHello
+	 * with the same one tells it the ticket has been accepted. */
+	if (conn->session_ticket_ext && tlsv1_session_cache_tickets(cache)) {
+		if (conn->client_session_id_len > 0 &&
+		    tlsv1_session_ticket_parse(cache, conn->session_ticket,
+					       conn->session_ticket_len,
+					       conn->cipher_suite,
+					       conn->verify_peer,
+					       conn->master_secret) == 0)
+			conn->session_resumed = 1;
+		else
+			conn->new_session_ticket = 1;
+	}
+
+	if (!conn->session_resumed &&
+	    tlsv1_session_cache_get(cache, conn->client_session_id,
+				    conn->client_session_id_len,
+				    conn->cipher_suite, conn->verify_peer,
+				    conn->master_secret) == 0)
+		conn->session_resumed = 1;
+
+	if (!conn->session_resumed)
+		return 0;
+
+	wpa_printf(MSG_DEBUG, "TLSv1: Resuming session");
+	conn->new_session_ticket = 0;
+	os_memcpy(conn->session_id, conn->client_session_id,
+		  conn->client_session_id_len);
+	conn->session_id_len = conn->client_session_id_len;
+	if (tlsv1_server_derive_keys(conn, NULL, 0) < 0) {
+		wpa_printf(MSG_DEBUG, "TLSv1: Failed to derive keys");
+		tlsv1_server_alert(conn, TLS_ALERT_LEVEL_FATAL,
+				   TLS_ALERT_INTERNAL_ERROR);
+		return -1;
+	}
+
+	return 0;
+}
+
+
 static int tls_write_server_hello(struct tlsv1_server *conn,
 				  u8 **msgpos, u8 *end)
 {
@@ -66,11 +112,17 @@ static int tls_write_server_hello(struct tlsv1_server *conn,
 	wpa_hexdump(MSG_MSGDUMP, "TLSv1: server_random",
 		    conn->server_random, TLS_RANDOM_LEN);
 
-	conn->session_id_len = TLS_SESSION_ID_MAX_LEN;
-	if (os_get_random(conn->session_id, conn->session_id_len)) {
-		wpa_printf(MSG_ERROR, "TLSv1: Could not generate "
-			   "session_id");
+	if (conn->session_cache && conn->session_ticket_cb == NULL &&
+	    tls_server_resume_session(conn) < 0)
 		return -1;
+
+	if (!conn->session_resumed) {
+		conn->session_id_len = TLS_SESSION_ID_MAX_LEN;
+		if (os_get_random(conn->session_id, conn->session_id_len)) {
+			wpa_printf(MSG_ERROR, "TLSv1: Could not generate "
+				   "session_id");
+			return -1;
+		}
 	}
 	wpa_hexdump(MSG_MSGDUMP, "TLSv1: session_id",
 		    conn->session_id, conn->session_id_len);
@@ -101,6 +153,17 @@ static int tls_write_server_hello(struct tlsv1_server *conn,
 	/* CompressionMethod compression_method */
 	*pos++ = TLS_COMPRESSION_NULL;
 
+	if (conn->new_session_ticket) {
+		/* Extension server_hello_extension_list<0..2^16-1>: an empty
+		 * SessionTicket, the ticket is sent with NewSessionTicket */
+		WPA_PUT_BE16(pos, 4);
+		pos += 2;
+		WPA_PUT_BE16(pos, TLS_EXT_SESSION_TICKET);
+		pos += 2;
+		WPA_PUT_BE16(pos, 0);
+		pos += 2;
+	}
+
 	if (conn->session_ticket && conn->session_ticket_cb) {
 		int res = conn->session_ticket_cb(
 			conn->session_ticket_cb_ctx,
@@ -574,6 +637,66 @@ static int tls_write_server_change_cipher_spec(struct tlsv1_server *conn,
 }
 
 
+static int tls_write_server_new_session_ticket(struct tlsv1_server *conn,
+					       u8 **msgpos, u8 *end)
+{
+	u8 *pos, *rhdr, *hs_start, *hs_length;
+	size_t rlen;
+
+	pos = *msgpos;
+
+	wpa_printf(MSG_DEBUG, "TLSv1: Send NewSessionTicket");
+	rhdr = pos;
+	pos += TLS_RECORD_HEADER_LEN;
+
+	/* opaque fragment[TLSPlaintext.length] */
+
+	/* Handshake */
+	hs_start = pos;
+	/* HandshakeType msg_type */
+	*pos++ = TLS_HANDSHAKE_TYPE_NEW_SESSION_TICKET;
+	/* uint24 length (to be filled) */
+	hs_length = pos;
+	pos += 3;
+	/* body - NewSessionTicket */
+	if (end - pos < 4 + 2 + TLSV1_SESSION_TICKET_LEN) {
+		tlsv1_server_alert(conn, TLS_ALERT_LEVEL_FATAL,
+				   TLS_ALERT_INTERNAL_ERROR);
+		return -1;
+	}
+	/* uint32 ticket_lifetime_hint */
+	WPA_PUT_BE32(pos, tlsv1_session_cache_lifetime(conn->session_cache));
+	pos += 4;
+	/* opaque ticket<0..2^16-1> */
+	WPA_PUT_BE16(pos, TLSV1_SESSION_TICKET_LEN);
+	pos += 2;
+	if (tlsv1_session_ticket_build(conn->session_cache, conn->cipher_suite,
+				       conn->verify_peer, conn->master_secret,
+				       pos) < 0) {
+		wpa_printf(MSG_DEBUG, "TLSv1: Failed to build session ticket");
+		tlsv1_server_alert(conn, TLS_ALERT_LEVEL_FATAL,
+				   TLS_ALERT_INTERNAL_ERROR);
+		return -1;
+	}
+	pos += TLSV1_SESSION_TICKET_LEN;
+
+	WPA_PUT_BE24(hs_length, pos - hs_length - 3);
+	tls_verify_hash_add(&conn->verify, hs_start, pos - hs_start);
+
+	if (tlsv1_record_send(&conn->rl, TLS_CONTENT_TYPE_HANDSHAKE,
+			      rhdr, end - rhdr, pos - hs_start, &rlen) < 0) {
+		wpa_printf(MSG_DEBUG, "TLSv1: Failed to create TLS record");
+		tlsv1_server_alert(conn, TLS_ALERT_LEVEL_FATAL,
+				   TLS_ALERT_INTERNAL_ERROR);
+		return -1;
+	}
+
+	*msgpos = rhdr + rlen;
+
+	return 0;
+}
+
+
 static int tls_write_server_finished(struct tlsv1_server *conn,
 				     u8 **msgpos, u8 *end)
 {
@@ -672,7 +795,7 @@ static u8 * tls_send_server_hello(struct tlsv1_server *conn, size_t *out_len)
 		return NULL;
 	}
 
-	if (conn->use_session_ticket) {
+	if (conn->use_session_ticket || conn->session_resumed) {
 		/* Abbreviated handshake using session ticket; RFC 4507 */
 		if (tls_write_server_change_cipher_spec(conn, &pos, end) < 0 ||
 		    tls_write_server_finished(conn, &pos, end) < 0) {
@@ -718,7 +841,9 @@ static u8 * tls_send_change_cipher_spec(struct tlsv1_server *conn,
 	pos = msg;
 	end = msg + 1000;
 
-	if (tls_write_server_change_cipher_spec(conn, &pos, end) < 0 ||
+	if ((conn->new_session_ticket &&
+	     tls_write_server_new_session_ticket(conn, &pos, end) < 0) ||
+	    tls_write_server_change_cipher_spec(conn, &pos, end) < 0 ||
 	    tls_write_server_finished(conn, &pos, end) < 0) {
 		os_free(msg);
 		return NULL;
@@ -729,6 +854,12 @@ static u8 * tls_send_change_cipher_spec(struct tlsv1_server *conn,
 	wpa_printf(MSG_DEBUG, "TLSv1: Handshake completed successfully");
 	conn->state = ESTABLISHED;
 
+	if (conn->session_cache && conn->session_ticket_cb == NULL)
+		tlsv1_session_cache_add(conn->session_cache, conn->session_id,
+					conn->session_id_len,
+					conn->cipher_suite, conn->verify_peer,
+					conn->master_secret);
+
 	return msg;
 }
 
@@ -741,7 +872,8 @@ u8 * tlsv1_server_handshake_write(struct tlsv1_server *conn, size_t *out_len)
 	case SERVER_CHANGE_CIPHER_SPEC:
 		return tls_send_change_cipher_spec(conn, out_len);
 	default:
-		if (conn->state == ESTABLISHED && conn->use_session_ticket) {
+		if (conn->state == ESTABLISHED &&
+		    (conn->use_session_ticket || conn->session_resumed)) {
 			/* Abbreviated handshake was already completed. */
 			return NULL;
 		}
@@ -0,0 +1,335 @@
+/*
+ * TLSv1 server - session resumption (session ID cache and session tickets)
+ * Copyright (c) 2021, Dan Garcia Carrillo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Alternatively, this software may be distributed under the terms of BSD
+ * license.
+ *
+ * See README and COPYING for more details.
+ *
+ * The sessions of the full handshakes are kept in a ring of a fixed size,
+ * indexed by session ID: the oldest one is replaced when it is full. The
+ * tickets (RFC 5077) carry the same state encrypted with AES-128-CBC and
+ * authenticated with HMAC-SHA256, under keys that live as long as the
+ * cache, so the server does not keep anything for them.
+ */
+
+#include "includes.h"
+
+#include "common.h"
+#include "crypto/aes_wrap.h"
+#include "crypto/sha256.h"
+#include "tlsv1_common.h"
+#include "tlsv1_session_cache.h"
+
+
+#define TICKET_KEY_NAME_LEN 16
+#define TICKET_IV_LEN 16
+/* cipher_suite | verified | reserved | issued | master_secret | padding */
+#define TICKET_STATE_LEN 64
+#define TICKET_MAC_LEN 32
+
+struct tlsv1_session {
+	u8 session_id[TLS_SESSION_ID_MAX_LEN];
+	u8 session_id_len; /* 0 = free slot */
+	u8 verified;
+	u16 cipher_suite;
+	u8 master_secret[TLS_MASTER_SECRET_LEN];
+	os_time_t added;
+	int next; /* next session of the bucket, -1 = last */
+};
+
+struct tlsv1_session_cache {
+	struct tlsv1_session *sessions;
+	size_t size;
+	size_t oldest;
+	int *buckets;
+	size_t bucket_mask;
+	unsigned int lifetime;
+
+	int tickets;
+	u8 ticket_key_name[TICKET_KEY_NAME_LEN];
+	u8 ticket_aes_key[16];
+	u8 ticket_hmac_key[32];
+};
+
+
+static size_t session_hash(struct tlsv1_session_cache *cache,
+			   const u8 *session_id, size_t session_id_len)
+{
+	u32 hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < session_id_len; i++)
+		hash = (hash ^ session_id[i]) * 16777619u;
+	return hash & cache->bucket_mask;
+}
+
+
+/**
+ * tlsv1_session_cache_init - Initialize the resumption state of a server
+ * @size: Max number of sessions kept by session ID, 0 = no session ID cache
+ * @lifetime: Seconds a session can be resumed since its full handshake
+ * @tickets: Whether session tickets (RFC 5077) are issued and accepted
+ * Returns: Pointer to the cache or %NULL on failure
+ */
+struct tlsv1_session_cache * tlsv1_session_cache_init(size_t size,
+						      unsigned int lifetime,
+						      int tickets)
+{
+	struct tlsv1_session_cache *cache;
+	size_t buckets = 1, i;
+
+	cache = os_zalloc(sizeof(*cache));
+	if (cache == NULL)
+		return NULL;
+	cache->lifetime = lifetime;
+	cache->tickets = tickets;
+
+	if (size > 0) {
+		while (buckets < size)
+			buckets *= 2;
+		cache->sessions = os_zalloc(size * sizeof(*cache->sessions));
+		cache->buckets = os_malloc(buckets * sizeof(int));
+		if (cache->sessions == NULL || cache->buckets == NULL) {
+			tlsv1_session_cache_deinit(cache);
+			return NULL;
+		}
+		for (i = 0; i < buckets; i++)
+			cache->buckets[i] = -1;
+		cache->size = size;
+		cache->bucket_mask = buckets - 1;
+	}
+
+	if (tickets &&
+	    (os_get_random(cache->ticket_key_name, TICKET_KEY_NAME_LEN) ||
+	     os_get_random(cache->ticket_aes_key,
+			   sizeof(cache->ticket_aes_key)) ||
+	     os_get_random(cache->ticket_hmac_key,
+			   sizeof(cache->ticket_hmac_key)))) {
+		wpa_printf(MSG_ERROR, "TLSv1: Could not generate the session "
+			   "ticket keys");
+		tlsv1_session_cache_deinit(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+
+/**
+ * tlsv1_session_cache_deinit - Free the resumption state of a server
+ * @cache: Cache from tlsv1_session_cache_init()
+ */
+void tlsv1_session_cache_deinit(struct tlsv1_session_cache *cache)
+{
+	if (cache == NULL)
+		return;
+	if (cache->sessions)
+		os_memset(cache->sessions, 0,
+			  cache->size * sizeof(*cache->sessions));
+	os_free(cache->sessions);
+	os_free(cache->buckets);
+	os_memset(cache, 0, sizeof(*cache));
+	os_free(cache);
+}
+
+
+/**
+ * tlsv1_session_cache_get - Look for a session to be resumed
+ * @cache: Cache from tlsv1_session_cache_init()
+ * @session_id: Session ID of the ClientHello
+ * @session_id_len: Length of session_id
+ * @cipher_suite: Cipher suite selected for the new handshake
+ * @verified: Whether the peer certificate must have been verified
+ * @master_secret: Buffer for the master secret of the session
+ * Returns: 0 if the session can be resumed, -1 if not
+ */
+int tlsv1_session_cache_get(struct tlsv1_session_cache *cache,
+			    const u8 *session_id, size_t session_id_len,
+			    u16 cipher_suite, int verified, u8 *master_secret)
+{
+	struct tlsv1_session *s;
+	struct os_time now;
+	int i;
+
+	if (cache->size == 0 || session_id_len == 0)
+		return -1;
+
+	i = cache->buckets[session_hash(cache, session_id, session_id_len)];
+	for (; i >= 0; i = s->next) {
+		s = &cache->sessions[i];
+		if (s->session_id_len == session_id_len &&
+		    os_memcmp(s->session_id, session_id, session_id_len) == 0)
+			break;
+	}
+	if (i < 0)
+		return -1;
+
+	os_get_time(&now);
+	if (now.sec - s->added >= (os_time_t) cache->lifetime ||
+	    s->cipher_suite != cipher_suite || (verified && !s->verified))
+		return -1;
+
+	os_memcpy(master_secret, s->master_secret, TLS_MASTER_SECRET_LEN);
+	return 0;
+}
+
+
+/**
+ * tlsv1_session_cache_add - Keep the session of a full handshake
+ * @cache: Cache from tlsv1_session_cache_init()
+ * @session_id: Session ID sent in the ServerHello
+ * @session_id_len: Length of session_id
+ * @cipher_suite: Cipher suite of the session
+ * @verified: Whether the peer certificate was verified
+ * @master_secret: Master secret of the session
+ *
+ * The oldest session is replaced if the cache is full.
+ */
+void tlsv1_session_cache_add(struct tlsv1_session_cache *cache,
+			     const u8 *session_id, size_t session_id_len,
+			     u16 cipher_suite, int verified,
+			     const u8 *master_secret)
+{
+	struct tlsv1_session *s;
+	struct os_time now;
+	int idx, *prev;
+	size_t bucket;
+
+	if (cache->size == 0 || session_id_len == 0 ||
+	    session_id_len > TLS_SESSION_ID_MAX_LEN)
+		return;
+
+	idx = (int) cache->oldest;
+	s = &cache->sessions[idx];
+	cache->oldest = (cache->oldest + 1) % cache->size;
+
+	if (s->session_id_len) {
+		bucket = session_hash(cache, s->session_id, s->session_id_len);
+		for (prev = &cache->buckets[bucket]; *prev != idx;
+		     prev = &cache->sessions[*prev].next)
+			;
+		*prev = s->next;
+	}
+
+	os_get_time(&now);
+	os_memcpy(s->session_id, session_id, session_id_len);
+	s->session_id_len = session_id_len;
+	s->verified = !!verified;
+	s->cipher_suite = cipher_suite;
+	os_memcpy(s->master_secret, master_secret, TLS_MASTER_SECRET_LEN);
+	s->added = now.sec;
+
+	bucket = session_hash(cache, session_id, session_id_len);
+	s->next = cache->buckets[bucket];
+	cache->buckets[bucket] = idx;
+}
+
+
+int tlsv1_session_cache_tickets(struct tlsv1_session_cache *cache)
+{
+	return cache->tickets;
+}
+
+
+unsigned int tlsv1_session_cache_lifetime(struct tlsv1_session_cache *cache)
+{
+	return cache->lifetime;
+}
+
+
+/**
+ * tlsv1_session_ticket_build - Build the ticket of a full handshake
+ * @cache: Cache from tlsv1_session_cache_init() with tickets enabled
+ * @cipher_suite: Cipher suite of the session
+ * @verified: Whether the peer certificate was verified
+ * @master_secret: Master secret of the session
+ * @ticket: Buffer for the ticket, TLSV1_SESSION_TICKET_LEN bytes
+ * Returns: 0 on success, -1 on failure
+ */
+int tlsv1_session_ticket_build(struct tlsv1_session_cache *cache,
+			       u16 cipher_suite, int verified,
+			       const u8 *master_secret, u8 *ticket)
+{
+	u8 *iv = ticket + TICKET_KEY_NAME_LEN;
+	u8 *state = iv + TICKET_IV_LEN;
+	struct os_time now;
+
+	os_memcpy(ticket, cache->ticket_key_name, TICKET_KEY_NAME_LEN);
+	if (os_get_random(iv, TICKET_IV_LEN))
+		return -1;
+
+	os_get_time(&now);
+	os_memset(state, 0, TICKET_STATE_LEN);
+	WPA_PUT_BE16(state, cipher_suite);
+	state[2] = !!verified;
+	WPA_PUT_BE32(state + 4, (u32) now.sec);
+	os_memcpy(state + 8, master_secret, TLS_MASTER_SECRET_LEN);
+	if (aes_128_cbc_encrypt(cache->ticket_aes_key, iv, state,
+				TICKET_STATE_LEN))
+		return -1;
+
+	hmac_sha256(cache->ticket_hmac_key, sizeof(cache->ticket_hmac_key),
+		    ticket, TICKET_KEY_NAME_LEN + TICKET_IV_LEN +
+		    TICKET_STATE_LEN, state + TICKET_STATE_LEN);
+	return 0;
+}
+
+
+/**
+ * tlsv1_session_ticket_parse - Check a ticket received in the ClientHello
+ * @cache: Cache from tlsv1_session_cache_init() with tickets enabled
+ * @ticket: The ticket
+ * @ticket_len: Length of ticket
+ * @cipher_suite: Cipher suite selected for the new handshake
+ * @verified: Whether the peer certificate must have been verified
+ * @master_secret: Buffer for the master secret of the session
+ * Returns: 0 if the session can be resumed, -1 if not
+ */
+int tlsv1_session_ticket_parse(struct tlsv1_session_cache *cache,
+			       const u8 *ticket, size_t ticket_len,
+			       u16 cipher_suite, int verified,
+			       u8 *master_secret)
+{
+	u8 mac[TICKET_MAC_LEN], state[TICKET_STATE_LEN];
+	const u8 *iv = ticket + TICKET_KEY_NAME_LEN;
+	const u8 *enc = iv + TICKET_IV_LEN;
+	struct os_time now;
+	u8 diff = 0;
+	size_t i;
+	int ret = -1;
+
+	if (ticket == NULL || ticket_len != TLSV1_SESSION_TICKET_LEN ||
+	    os_memcmp(ticket, cache->ticket_key_name, TICKET_KEY_NAME_LEN))
+		return -1;
+
+	hmac_sha256(cache->ticket_hmac_key, sizeof(cache->ticket_hmac_key),
+		    ticket, TICKET_KEY_NAME_LEN + TICKET_IV_LEN +
+		    TICKET_STATE_LEN, mac);
+	for (i = 0; i < TICKET_MAC_LEN; i++)
+		diff |= mac[i] ^ enc[TICKET_STATE_LEN + i];
+	if (diff) {
+		wpa_printf(MSG_DEBUG, "TLSv1: Invalid session ticket MAC");
+		return -1;
+	}
+
+	os_memcpy(state, enc, TICKET_STATE_LEN);
+	if (aes_128_cbc_decrypt(cache->ticket_aes_key, iv, state,
+				TICKET_STATE_LEN))
+		return -1;
+
+	os_get_time(&now);
+	if ((u32) now.sec - WPA_GET_BE32(state + 4) < cache->lifetime &&
+	    WPA_GET_BE16(state) == cipher_suite &&
+	    (!verified || state[2])) {
+		os_memcpy(master_secret, state + 8, TLS_MASTER_SECRET_LEN);
+		ret = 0;
+	}
+	os_memset(state, 0, sizeof(state));
+	return ret;
+}
@@ -0,0 +1,44 @@
+/*
+ * TLSv1 server - session resumption (session ID cache and session tickets)
+ * Copyright (c) 2021, Dan Garcia Carrillo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Alternatively, this software may be distributed under the terms of BSD
+ * license.
+ *
+ * See README and COPYING for more details.
+ */
+
+#ifndef TLSV1_SESSION_CACHE_H
+#define TLSV1_SESSION_CACHE_H
+
+/* key_name | IV | encrypted state | HMAC-SHA256 (RFC 5077, 4) */
+#define TLSV1_SESSION_TICKET_LEN (16 + 16 + 64 + 32)
+
+struct tlsv1_session_cache;
+
+struct tlsv1_session_cache * tlsv1_session_cache_init(size_t size,
+						      unsigned int lifetime,
+						      int tickets);
+void tlsv1_session_cache_deinit(struct tlsv1_session_cache *cache);
+int tlsv1_session_cache_get(struct tlsv1_session_cache *cache,
+			    const u8 *session_id, size_t session_id_len,
+			    u16 cipher_suite, int verified, u8 *master_secret);
+void tlsv1_session_cache_add(struct tlsv1_session_cache *cache,
+			     const u8 *session_id, size_t session_id_len,
+			     u16 cipher_suite, int verified,
+			     const u8 *master_secret);
+int tlsv1_session_cache_tickets(struct tlsv1_session_cache *cache);
+unsigned int tlsv1_session_cache_lifetime(struct tlsv1_session_cache *cache);
+int tlsv1_session_ticket_build(struct tlsv1_session_cache *cache,
+			       u16 cipher_suite, int verified,
+			       const u8 *master_secret, u8 *ticket);
+int tlsv1_session_ticket_parse(struct tlsv1_session_cache *cache,
+			       const u8 *ticket, size_t ticket_len,
+			       u16 cipher_suite, int verified,
+			       u8 *master_secret);
+
+#endif /* TLSV1_SESSION_CACHE_H */
@@ -1,5 +1,5 @@
 /*
- * Event loop based on select() loop
+ * Event loop based on select() or epoll() loop
  * Copyright (c) 2002-2009, Jouni Malinen <j@w1.fi>
  *
  * This program is free software; you can redistribute it and/or modify
@@ -13,6 +13,9 @@
  */
 
 #include "includes.h"
+#ifdef CONFIG_ELOOP_EPOLL
+#include <sys/epoll.h>
+#endif /* CONFIG_ELOOP_EPOLL */
 
 #include "common.h"
 #include "trace.h"
@@ -31,8 +34,12 @@ struct eloop_sock {
 };
 
 struct eloop_timeout {
-	struct dl_list list;
+	/* Position in the heap and next timeout of the same hash bucket */
+	size_t index;
+	struct eloop_timeout *hnext;
 	struct os_time time;
+	/* Timeouts of the same time run in the order they were registered */
+	u64 seq;
 	void *eloop_data;
 	void *user_data;
 	eloop_timeout_handler handler;
@@ -41,6 +48,21 @@ struct eloop_timeout {
 	WPA_TRACE_INFO
 };
 
+/*
+ * The timeouts are kept in a binary min-heap by time, and indexed by
+ * (handler, eloop_data, user_data) in a hash table for
+ * eloop_cancel_timeout() and eloop_is_timeout_registered(): registering,
+ * cancelling and running a timeout cost O(log n), not O(n).
+ */
+struct eloop_timeout_heap {
+	struct eloop_timeout **heap;
+	size_t count;
+	size_t size;
+	struct eloop_timeout **hash;
+	size_t hash_size;
+	u64 next_seq;
+};
+
 struct eloop_signal {
 	int sig;
 	void *user_data;
@@ -51,9 +73,18 @@ struct eloop_signal {
 struct eloop_sock_table {
 	int count;
 	struct eloop_sock *table;
+	eloop_event_type type;
 	int changed;
 };
 
+#ifdef CONFIG_ELOOP_EPOLL
+/* Sockets of a descriptor, by event type, and the events epoll waits for */
+struct eloop_epoll_fd {
+	struct eloop_sock sock[3];
+	u32 events;
+};
+#endif /* CONFIG_ELOOP_EPOLL */
+
 struct eloop_data {
 	int max_sock;
 
@@ -61,7 +92,16 @@ struct eloop_data {
 	struct eloop_sock_table writers;
 	struct eloop_sock_table exceptions;
 
-	struct dl_list timeout;
+	struct eloop_timeout_heap timeout;
+
+#ifdef CONFIG_ELOOP_EPOLL
+	int epollfd;
+	/* Indexed by descriptor, epoll_fds_size entries */
+	struct eloop_epoll_fd *epoll_fds;
+	int epoll_fds_size;
+	struct epoll_event *epoll_events;
+	int epoll_events_size;
+#endif /* CONFIG_ELOOP_EPOLL */
 
 	int signal_count;
 	struct eloop_signal *signals;
@@ -72,7 +112,9 @@ struct eloop_data {
 	int reader_table_changed;
 };
 
-static struct eloop_data eloop;
+/* One event loop per thread, so that several servers (e.g., RADIUS) can run
+ * in their own threads of the same process. */
+static __thread struct eloop_data eloop;
 
 
 #ifdef WPA_TRACE
@@ -121,7 +163,17 @@ static void eloop_trace_sock_remove_ref(struct eloop_sock_table *table)
 int eloop_init(void)
 {
 	os_memset(&eloop, 0, sizeof(eloop));
-	dl_list_init(&eloop.timeout);
+	eloop.readers.type = EVENT_TYPE_READ;
+	eloop.writers.type = EVENT_TYPE_WRITE;
+	eloop.exceptions.type = EVENT_TYPE_EXCEPTION;
+#ifdef CONFIG_ELOOP_EPOLL
+	eloop.epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (eloop.epollfd < 0) {
+		wpa_printf(MSG_ERROR, "%s: epoll_create1 failed: %s",
+			   __func__, strerror(errno));
+		return -1;
+	}
+#endif /* CONFIG_ELOOP_EPOLL */
 #ifdef WPA_TRACE
 	signal(SIGSEGV, eloop_sigsegv_handler);
 #endif /* WPA_TRACE */
@@ -129,6 +181,141 @@ int eloop_init(void)
 }
 
 
+#ifdef CONFIG_ELOOP_EPOLL
+
+static u32 eloop_epoll_event(eloop_event_type type)
+{
+	switch (type) {
+	case EVENT_TYPE_READ:
+		return EPOLLIN;
+	case EVENT_TYPE_WRITE:
+		return EPOLLOUT;
+	case EVENT_TYPE_EXCEPTION:
+		return EPOLLPRI;
+	}
+	return 0;
+}
+
+
+/* Adds (handler != NULL) or removes the socket of a type, and updates the
+ * events of its descriptor. */
+static int eloop_epoll_set(eloop_event_type type, struct eloop_sock *sock,
+			   int fd)
+{
+	struct eloop_epoll_fd *e;
+	struct epoll_event ev;
+	u32 events;
+	int op;
+
+	if (fd < 0)
+		return -1;
+	if (fd >= eloop.epoll_fds_size) {
+		int size = eloop.epoll_fds_size ? eloop.epoll_fds_size : 16;
+
+		if (sock == NULL)
+			return 0;
+		while (size <= fd)
+			size *= 2;
+		e = os_realloc(eloop.epoll_fds, size * sizeof(*e));
+		if (e == NULL)
+			return -1;
+		os_memset(e + eloop.epoll_fds_size, 0,
+			  (size - eloop.epoll_fds_size) * sizeof(*e));
+		eloop.epoll_fds = e;
+		eloop.epoll_fds_size = size;
+	}
+
+	e = &eloop.epoll_fds[fd];
+	events = e->events & ~eloop_epoll_event(type);
+	if (sock)
+		events |= eloop_epoll_event(type);
+	if (events == e->events)
+		op = -1;
+	else if (e->events == 0)
+		op = EPOLL_CTL_ADD;
+	else if (events == 0)
+		op = EPOLL_CTL_DEL;
+	else
+		op = EPOLL_CTL_MOD;
+
+	if (op >= 0) {
+		os_memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.fd = fd;
+		if (epoll_ctl(eloop.epollfd, op, fd, &ev) < 0) {
+			wpa_printf(MSG_ERROR, "%s: epoll_ctl for fd %d "
+				   "failed: %s", __func__, fd,
+				   strerror(errno));
+			return -1;
+		}
+	}
+	e->events = events;
+	if (sock)
+		e->sock[type] = *sock;
+	else
+		os_memset(&e->sock[type], 0, sizeof(e->sock[type]));
+	return 0;
+}
+
+
+static int eloop_epoll_grow_events(void)
+{
+	int count = eloop.readers.count + eloop.writers.count +
+		eloop.exceptions.count;
+	struct epoll_event *tmp;
+
+	if (count <= eloop.epoll_events_size)
+		return 0;
+	tmp = os_realloc(eloop.epoll_events, count * 2 * sizeof(*tmp));
+	if (tmp == NULL)
+		return -1;
+	eloop.epoll_events = tmp;
+	eloop.epoll_events_size = count * 2;
+	return 0;
+}
+
+
+static int eloop_epoll_call(int fd, eloop_event_type type)
+{
+	struct eloop_sock *sock = &eloop.epoll_fds[fd].sock[type];
+
+	if (sock->handler == NULL)
+		return 0;
+	eloop.readers.changed = eloop.writers.changed =
+		eloop.exceptions.changed = 0;
+	sock->handler(sock->sock, sock->eloop_data, sock->user_data);
+	/* The descriptors of the events left may have been reused */
+	return eloop.readers.changed || eloop.writers.changed ||
+		eloop.exceptions.changed;
+}
+
+
+static void eloop_epoll_dispatch(struct epoll_event *events, int nfds)
+{
+	int i, fd;
+	u32 ev;
+
+	for (i = 0; i < nfds; i++) {
+		fd = events[i].data.fd;
+		ev = events[i].events;
+		if (fd >= eloop.epoll_fds_size)
+			continue;
+		/* Errors and hang ups are read, as with select() */
+		if ((ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+		    eloop_epoll_call(fd, EVENT_TYPE_READ))
+			break;
+		if ((ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) &&
+		    eloop_epoll_call(fd, EVENT_TYPE_WRITE))
+			break;
+		if ((ev & EPOLLPRI) &&
+		    eloop_epoll_call(fd, EVENT_TYPE_EXCEPTION))
+			break;
+	}
+}
+
+#endif /* CONFIG_ELOOP_EPOLL */
+
+
 static int eloop_sock_table_add_sock(struct eloop_sock_table *table,
                                      int sock, eloop_sock_handler handler,
                                      void *eloop_data, void *user_data)
@@ -150,8 +337,17 @@ static int eloop_sock_table_add_sock(struct eloop_sock_table *table,
 	tmp[table->count].user_data = user_data;
 	tmp[table->count].handler = handler;
 	wpa_trace_record(&tmp[table->count]);
-	table->count++;
 	table->table = tmp;
+#ifdef CONFIG_ELOOP_EPOLL
+	if (eloop_epoll_set(table->type, &tmp[table->count], sock) < 0) {
+		eloop_trace_sock_add_ref(table);
+		return -1;
+	}
+#endif /* CONFIG_ELOOP_EPOLL */
+	table->count++;
+#ifdef CONFIG_ELOOP_EPOLL
+	eloop_epoll_grow_events();
+#endif /* CONFIG_ELOOP_EPOLL */
 	if (sock > eloop.max_sock)
 		eloop.max_sock = sock;
 	table->changed = 1;
@@ -184,9 +380,13 @@ static void eloop_sock_table_remove_sock(struct eloop_sock_table *table,
 	table->count--;
 	table->changed = 1;
 	eloop_trace_sock_add_ref(table);
+#ifdef CONFIG_ELOOP_EPOLL
+	eloop_epoll_set(table->type, NULL, sock);
+#endif /* CONFIG_ELOOP_EPOLL */
 }
 
 
+#ifndef CONFIG_ELOOP_EPOLL
 static void eloop_sock_table_set_fds(struct eloop_sock_table *table,
 				     fd_set *fds)
 {
@@ -221,6 +421,7 @@ static void eloop_sock_table_dispatch(struct eloop_sock_table *table,
 		}
 	}
 }
+#endif /* CONFIG_ELOOP_EPOLL */
 
 
 static void eloop_sock_table_destroy(struct eloop_sock_table *table)
@@ -295,12 +496,123 @@ void eloop_unregister_sock(int sock, eloop_event_type type)
 }
 
 
+static int eloop_timeout_before(struct eloop_timeout *a,
+				struct eloop_timeout *b)
+{
+	if (a->time.sec != b->time.sec)
+		return a->time.sec < b->time.sec;
+	if (a->time.usec != b->time.usec)
+		return a->time.usec < b->time.usec;
+	return a->seq < b->seq;
+}
+
+
+static void eloop_heap_set(size_t i, struct eloop_timeout *timeout)
+{
+	eloop.timeout.heap[i] = timeout;
+	timeout->index = i;
+}
+
+
+static void eloop_heap_up(size_t i)
+{
+	struct eloop_timeout *timeout = eloop.timeout.heap[i];
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!eloop_timeout_before(timeout, eloop.timeout.heap[parent]))
+			break;
+		eloop_heap_set(i, eloop.timeout.heap[parent]);
+		i = parent;
+	}
+	eloop_heap_set(i, timeout);
+}
+
+
+static void eloop_heap_down(size_t i)
+{
+	struct eloop_timeout *timeout = eloop.timeout.heap[i];
+	size_t count = eloop.timeout.count;
+
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count &&
+		    eloop_timeout_before(eloop.timeout.heap[child + 1],
+					 eloop.timeout.heap[child]))
+			child++;
+		if (!eloop_timeout_before(eloop.timeout.heap[child], timeout))
+			break;
+		eloop_heap_set(i, eloop.timeout.heap[child]);
+		i = child;
+	}
+	eloop_heap_set(i, timeout);
+}
+
+
+static size_t eloop_timeout_hash(eloop_timeout_handler handler,
+				 void *eloop_data, void *user_data)
+{
+	size_t h = (size_t) handler;
+
+	h = h * 31 + (size_t) eloop_data;
+	h = h * 31 + (size_t) user_data;
+	h ^= h >> 17;
+	h *= 0x9e3779b1;
+	h ^= h >> 15;
+	return h & (eloop.timeout.hash_size - 1);
+}
+
+
+static void eloop_hash_add(struct eloop_timeout *timeout)
+{
+	size_t h = eloop_timeout_hash(timeout->handler, timeout->eloop_data,
+				      timeout->user_data);
+
+	timeout->hnext = eloop.timeout.hash[h];
+	eloop.timeout.hash[h] = timeout;
+}
+
+
+/* Makes room for one more timeout in the heap and the hash table */
+static int eloop_timeout_grow(void)
+{
+	struct eloop_timeout_heap *t = &eloop.timeout;
+	struct eloop_timeout **tmp;
+	size_t size, i;
+
+	if (t->count < t->size)
+		return 0;
+
+	size = t->size ? t->size * 2 : 16;
+	tmp = os_realloc(t->heap, size * sizeof(*tmp));
+	if (tmp == NULL)
+		return -1;
+	t->heap = tmp;
+	t->size = size;
+
+	/* The hash table has as many buckets as the heap has entries */
+	tmp = os_zalloc(size * sizeof(*tmp));
+	if (tmp == NULL)
+		return t->hash ? 0 : -1;
+	os_free(t->hash);
+	t->hash = tmp;
+	t->hash_size = size;
+	for (i = 0; i < t->count; i++)
+		eloop_hash_add(t->heap[i]);
+	return 0;
+}
+
+
 int eloop_register_timeout(unsigned int secs, unsigned int usecs,
 			   eloop_timeout_handler handler,
 			   void *eloop_data, void *user_data)
 {
-	struct eloop_timeout *timeout, *tmp;
+	struct eloop_timeout *timeout;
 
+	if (eloop_timeout_grow() < 0)
+		return -1;
 	timeout = os_zalloc(sizeof(*timeout));
 	if (timeout == NULL)
 		return -1;
@@ -314,6 +626,7 @@ int eloop_register_timeout(unsigned int secs, unsigned int usecs,
 		timeout->time.sec++;
 		timeout->time.usec -= 1000000;
 	}
+	timeout->seq = eloop.timeout.next_seq++;
 	timeout->eloop_data = eloop_data;
 	timeout->user_data = user_data;
 	timeout->handler = handler;
@@ -321,14 +634,9 @@ int eloop_register_timeout(unsigned int secs, unsigned int usecs,
 	wpa_trace_add_ref(timeout, user, user_data);
 	wpa_trace_record(timeout);
 
-	/* Maintain timeouts in order of increasing time */
-	dl_list_for_each(tmp, &eloop.timeout, struct eloop_timeout, list) {
-		if (os_time_before(&timeout->time, &tmp->time)) {
-			dl_list_add(tmp->list.prev, &timeout->list);
-			return 0;
-		}
-	}
-	dl_list_add_tail(&eloop.timeout, &timeout->list);
+	eloop_hash_add(timeout);
+	eloop.timeout.heap[eloop.timeout.count] = timeout;
+	eloop_heap_up(eloop.timeout.count++);
 
 	return 0;
 }
@@ -336,7 +644,27 @@ int eloop_register_timeout(unsigned int secs, unsigned int usecs,
 
 static void eloop_remove_timeout(struct eloop_timeout *timeout)
 {
-	dl_list_del(&timeout->list);
+	struct eloop_timeout **pos;
+	size_t i = timeout->index;
+
+	pos = &eloop.timeout.hash[eloop_timeout_hash(timeout->handler,
+						     timeout->eloop_data,
+						     timeout->user_data)];
+	while (*pos != timeout)
+		pos = &(*pos)->hnext;
+	*pos = timeout->hnext;
+
+	/* The last entry takes its place and is moved up or down */
+	if (i < --eloop.timeout.count) {
+		eloop_heap_set(i, eloop.timeout.heap[eloop.timeout.count]);
+		if (i > 0 &&
+		    eloop_timeout_before(eloop.timeout.heap[i],
+					 eloop.timeout.heap[(i - 1) / 2]))
+			eloop_heap_up(i);
+		else
+			eloop_heap_down(i);
+	}
+
 	wpa_trace_remove_ref(timeout, eloop, timeout->eloop_data);
 	wpa_trace_remove_ref(timeout, user, timeout->user_data);
 	os_free(timeout);
@@ -346,19 +674,44 @@ static void eloop_remove_timeout(struct eloop_timeout *timeout)
 int eloop_cancel_timeout(eloop_timeout_handler handler,
 			 void *eloop_data, void *user_data)
 {
-	struct eloop_timeout *timeout, *prev;
+	struct eloop_timeout *timeout, *next;
+	size_t i;
 	int removed = 0;
 
-	dl_list_for_each_safe(timeout, prev, &eloop.timeout,
-			      struct eloop_timeout, list) {
+	if (eloop.timeout.count == 0)
+		return 0;
+
+	if (eloop_data == ELOOP_ALL_CTX || user_data == ELOOP_ALL_CTX) {
+		/* Not in a single bucket: the heap is walked from the end, and
+		 * the entry that takes the place of a removed one is checked
+		 * too (the ones it may displace stay below it) */
+		for (i = eloop.timeout.count; i-- > 0;) {
+			timeout = eloop.timeout.heap[i];
+			if (timeout->handler == handler &&
+			    (timeout->eloop_data == eloop_data ||
+			     eloop_data == ELOOP_ALL_CTX) &&
+			    (timeout->user_data == user_data ||
+			     user_data == ELOOP_ALL_CTX)) {
+				eloop_remove_timeout(timeout);
+				removed++;
+				if (i < eloop.timeout.count)
+					i++;
+			}
+		}
+		return removed;
+	}
+
+	timeout = eloop.timeout.hash[eloop_timeout_hash(handler, eloop_data,
+							user_data)];
+	while (timeout) {
+		next = timeout->hnext;
 		if (timeout->handler == handler &&
-		    (timeout->eloop_data == eloop_data ||
-		     eloop_data == ELOOP_ALL_CTX) &&
-		    (timeout->user_data == user_data ||
-		     user_data == ELOOP_ALL_CTX)) {
+		    timeout->eloop_data == eloop_data &&
+		    timeout->user_data == user_data) {
 			eloop_remove_timeout(timeout);
 			removed++;
 		}
+		timeout = next;
 	}
 
 	return removed;
@@ -370,7 +723,12 @@ int eloop_is_timeout_registered(eloop_timeout_handler handler,
 {
 	struct eloop_timeout *tmp;
 
-	dl_list_for_each(tmp, &eloop.timeout, struct eloop_timeout, list) {
+	if (eloop.timeout.count == 0)
+		return 0;
+
+	tmp = eloop.timeout.hash[eloop_timeout_hash(handler, eloop_data,
+						    user_data)];
+	for (; tmp; tmp = tmp->hnext) {
 		if (tmp->handler == handler &&
 		    tmp->eloop_data == eloop_data &&
 		    tmp->user_data == user_data)
@@ -490,33 +848,60 @@ int eloop_register_signal_reconfig(eloop_signal_handler handler,
 
 void eloop_run(void)
 {
+#ifdef CONFIG_ELOOP_EPOLL
+	int timeout_ms = -1;
+#else /* CONFIG_ELOOP_EPOLL */
 	fd_set *rfds, *wfds, *efds;
-	int res;
 	struct timeval _tv;
+#endif /* CONFIG_ELOOP_EPOLL */
+	int res;
 	struct os_time tv, now;
 
+#ifndef CONFIG_ELOOP_EPOLL
 	rfds = os_malloc(sizeof(*rfds));
 	wfds = os_malloc(sizeof(*wfds));
 	efds = os_malloc(sizeof(*efds));
 	if (rfds == NULL || wfds == NULL || efds == NULL)
 		goto out;
+#endif /* CONFIG_ELOOP_EPOLL */
 
 	while (!eloop.terminate &&
-	       (!dl_list_empty(&eloop.timeout) || eloop.readers.count > 0 ||
+	       (eloop.timeout.count > 0 || eloop.readers.count > 0 ||
 		eloop.writers.count > 0 || eloop.exceptions.count > 0)) {
 		struct eloop_timeout *timeout;
-		timeout = dl_list_first(&eloop.timeout, struct eloop_timeout,
-					list);
+		timeout = eloop.timeout.count ? eloop.timeout.heap[0] : NULL;
 		if (timeout) {
 			os_get_time(&now);
 			if (os_time_before(&now, &timeout->time))
 				os_time_sub(&timeout->time, &now, &tv);
 			else
 				tv.sec = tv.usec = 0;
+#ifdef CONFIG_ELOOP_EPOLL
+			/* Rounded up, not to wake up before the timeout */
+			timeout_ms = tv.sec * 1000 + (tv.usec + 999) / 1000;
+#else /* CONFIG_ELOOP_EPOLL */
 			_tv.tv_sec = tv.sec;
 			_tv.tv_usec = tv.usec;
+#endif /* CONFIG_ELOOP_EPOLL */
 		}
 
+#ifdef CONFIG_ELOOP_EPOLL
+		if (eloop_epoll_grow_events() < 0 ||
+		    eloop.epoll_events_size == 0) {
+			/* Only timeouts: there is nothing to wait for */
+			if (timeout && timeout_ms > 0)
+				os_sleep(timeout_ms / 1000,
+					 (timeout_ms % 1000) * 1000);
+			res = 0;
+		} else
+			res = epoll_wait(eloop.epollfd, eloop.epoll_events,
+					 eloop.epoll_events_size,
+					 timeout ? timeout_ms : -1);
+		if (res < 0 && errno != EINTR && errno != 0) {
+			perror("epoll_wait");
+			goto out;
+		}
+#else /* CONFIG_ELOOP_EPOLL */
 		eloop_sock_table_set_fds(&eloop.readers, rfds);
 		eloop_sock_table_set_fds(&eloop.writers, wfds);
 		eloop_sock_table_set_fds(&eloop.exceptions, efds);
@@ -526,16 +911,22 @@ void eloop_run(void)
 			perror("select");
 			goto out;
 		}
+#endif /* CONFIG_ELOOP_EPOLL */
 		eloop_process_pending_signals();
 
-		/* check if some registered timeouts have occurred */
+		/* check if some registered timeouts have occurred, all of the
+		 * ones due are run, as the sockets may keep the loop busy */
 		if (timeout) {
 			os_get_time(&now);
-			if (!os_time_before(&now, &timeout->time)) {
-				void *eloop_data = timeout->eloop_data;
-				void *user_data = timeout->user_data;
-				eloop_timeout_handler handler =
-					timeout->handler;
+			while (eloop.timeout.count > 0 &&
+			       !os_time_before(&now,
+					       &eloop.timeout.heap[0]->time)) {
+				void *eloop_data, *user_data;
+				eloop_timeout_handler handler;
+				timeout = eloop.timeout.heap[0];
+				eloop_data = timeout->eloop_data;
+				user_data = timeout->user_data;
+				handler = timeout->handler;
 				eloop_remove_timeout(timeout);
 				handler(eloop_data, user_data);
 			}
@@ -545,15 +936,22 @@ void eloop_run(void)
 		if (res <= 0)
 			continue;
 
+#ifdef CONFIG_ELOOP_EPOLL
+		eloop_epoll_dispatch(eloop.epoll_events, res);
+#else /* CONFIG_ELOOP_EPOLL */
 		eloop_sock_table_dispatch(&eloop.readers, rfds);
 		eloop_sock_table_dispatch(&eloop.writers, wfds);
 		eloop_sock_table_dispatch(&eloop.exceptions, efds);
+#endif /* CONFIG_ELOOP_EPOLL */
 	}
 
 out:
+#ifndef CONFIG_ELOOP_EPOLL
 	os_free(rfds);
 	os_free(wfds);
 	os_free(efds);
+#endif /* CONFIG_ELOOP_EPOLL */
+	return;
 }
 
 
@@ -565,13 +963,13 @@ void eloop_terminate(void)
 
 void eloop_destroy(void)
 {
-	struct eloop_timeout *timeout, *prev;
+	struct eloop_timeout *timeout;
 	struct os_time now;
 
 	os_get_time(&now);
-	dl_list_for_each_safe(timeout, prev, &eloop.timeout,
-			      struct eloop_timeout, list) {
+	while (eloop.timeout.count > 0) {
 		int sec, usec;
+		timeout = eloop.timeout.heap[eloop.timeout.count - 1];
 		sec = timeout->time.sec - now.sec;
 		usec = timeout->time.usec - now.usec;
 		if (timeout->time.usec < now.usec) {
@@ -590,6 +988,15 @@ void eloop_destroy(void)
 	eloop_sock_table_destroy(&eloop.readers);
 	eloop_sock_table_destroy(&eloop.writers);
 	eloop_sock_table_destroy(&eloop.exceptions);
+	os_free(eloop.timeout.heap);
+	os_free(eloop.timeout.hash);
+#ifdef CONFIG_ELOOP_EPOLL
+	os_free(eloop.epoll_fds);
+	os_free(eloop.epoll_events);
+	if (eloop.epollfd >= 0)
+		close(eloop.epollfd);
+	eloop.epollfd = -1;
+#endif /* CONFIG_ELOOP_EPOLL */
 	os_free(eloop.signals);
 }
 
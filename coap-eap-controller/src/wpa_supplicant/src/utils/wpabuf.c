@@ -39,9 +39,192 @@ static struct wpabuf_trace * wpabuf_get_trace(const struct wpabuf *buf)
 	return (struct wpabuf_trace *)
 		((const u8 *) buf - sizeof(struct wpabuf_trace));
 }
+
+/* The pool would need its own header in front of the trace magic */
+#undef CONFIG_WPABUF_POOL
 #endif /* WPA_TRACE */
 
 
+#ifdef CONFIG_WPABUF_POOL
+/*
+ * Most of the buffers of an EAP exchange are small and short-lived: they are
+ * taken from per-thread free lists of a few size classes (32 to 2048 octets
+ * of data) instead of the heap. Larger buffers are allocated as before.
+ * Optionally, a thread can take its buffers from an arena (e.g., the one of
+ * the session it is handling): wpabuf_free() does nothing with them and they
+ * are all released at once by wpabuf_arena_free().
+ */
+#define WPABUF_POOL_MIN_SHIFT 5
+#define WPABUF_POOL_CLASSES 7
+#define WPABUF_POOL_MAX_FREE 128
+#define WPABUF_CLASS_HEAP WPABUF_POOL_CLASSES
+#define WPABUF_CLASS_ARENA (WPABUF_POOL_CLASSES + 1)
+#define WPABUF_ARENA_CHUNK 8192
+
+/* In front of every struct wpabuf, it keeps the data aligned */
+struct wpabuf_block {
+	struct wpabuf_block *next; /* in the free list of its class */
+	unsigned int cls;
+	unsigned int capacity; /* octets of data after struct wpabuf */
+};
+
+struct wpabuf_arena_chunk {
+	struct wpabuf_arena_chunk *next;
+};
+
+struct wpabuf_arena {
+	struct wpabuf_arena_chunk *chunks;
+	u8 *pos;
+	size_t left;
+};
+
+static int wpabuf_pool_enabled = 1;
+static __thread struct wpabuf_block *wpabuf_pool[WPABUF_POOL_CLASSES];
+static __thread unsigned int wpabuf_pool_count[WPABUF_POOL_CLASSES];
+static __thread struct wpabuf_arena *wpabuf_pool_arena;
+static __thread struct wpabuf_pool_stats wpabuf_stats;
+
+
+static struct wpabuf_block * wpabuf_get_block(const struct wpabuf *buf)
+{
+	return (struct wpabuf_block *)
+		((const u8 *) buf - sizeof(struct wpabuf_block));
+}
+
+
+static unsigned int wpabuf_class(size_t len)
+{
+	unsigned int cls = 0;
+
+	if (!wpabuf_pool_enabled)
+		return WPABUF_CLASS_HEAP;
+	while (cls < WPABUF_POOL_CLASSES &&
+	       len > (1U << (WPABUF_POOL_MIN_SHIFT + cls)))
+		cls++;
+	return cls;
+}
+
+
+static struct wpabuf_block * wpabuf_arena_alloc(struct wpabuf_arena *arena,
+						size_t len)
+{
+	struct wpabuf_arena_chunk *chunk;
+	struct wpabuf_block *blk;
+	size_t need, size;
+
+	need = (sizeof(*blk) + sizeof(struct wpabuf) + len + 7) & ~(size_t) 7;
+	if (need > arena->left) {
+		/* The rest of the current chunk is not used */
+		size = need > WPABUF_ARENA_CHUNK ? need : WPABUF_ARENA_CHUNK;
+		chunk = os_malloc(sizeof(*chunk) + size);
+		if (chunk == NULL)
+			return NULL;
+		wpabuf_stats.heap_allocs++;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->pos = (u8 *) (chunk + 1);
+		arena->left = size;
+	}
+
+	blk = (struct wpabuf_block *) arena->pos;
+	arena->pos += need;
+	arena->left -= need;
+	blk->cls = WPABUF_CLASS_ARENA;
+	blk->capacity = need - sizeof(*blk) - sizeof(struct wpabuf);
+	wpabuf_stats.arena_allocs++;
+	return blk;
+}
+
+
+/* A zeroed struct wpabuf followed by len zeroed octets */
+static struct wpabuf * wpabuf_block_alloc(size_t len)
+{
+	struct wpabuf_block *blk;
+	struct wpabuf *buf;
+	unsigned int cls;
+
+	wpabuf_stats.allocs++;
+	if (wpabuf_pool_arena) {
+		blk = wpabuf_arena_alloc(wpabuf_pool_arena, len);
+		if (blk == NULL)
+			return NULL;
+	} else {
+		cls = wpabuf_class(len);
+		if (cls < WPABUF_POOL_CLASSES && wpabuf_pool[cls]) {
+			blk = wpabuf_pool[cls];
+			wpabuf_pool[cls] = blk->next;
+			wpabuf_pool_count[cls]--;
+			wpabuf_stats.pool_hits++;
+		} else {
+			size_t capacity = cls < WPABUF_POOL_CLASSES ?
+				1U << (WPABUF_POOL_MIN_SHIFT + cls) : len;
+			blk = os_malloc(sizeof(*blk) + sizeof(struct wpabuf) +
+					capacity);
+			if (blk == NULL)
+				return NULL;
+			wpabuf_stats.heap_allocs++;
+			blk->cls = cls;
+			blk->capacity = capacity;
+		}
+	}
+
+	buf = (struct wpabuf *) (blk + 1);
+	os_memset(buf, 0, sizeof(*buf) + len);
+	return buf;
+}
+
+
+static void wpabuf_block_free(struct wpabuf *buf)
+{
+	struct wpabuf_block *blk = wpabuf_get_block(buf);
+
+	wpabuf_stats.frees++;
+	if (blk->cls == WPABUF_CLASS_ARENA)
+		return; /* released with its arena */
+	if (blk->cls < WPABUF_POOL_CLASSES && wpabuf_pool_enabled &&
+	    wpabuf_pool_count[blk->cls] < WPABUF_POOL_MAX_FREE) {
+		blk->next = wpabuf_pool[blk->cls];
+		wpabuf_pool[blk->cls] = blk;
+		wpabuf_pool_count[blk->cls]++;
+		return;
+	}
+	os_free(blk);
+}
+
+
+/* Room for len octets of data, the ones after buf->used are zeroed */
+static int wpabuf_block_grow(struct wpabuf **_buf, size_t len)
+{
+	struct wpabuf *buf = *_buf, *nbuf;
+	struct wpabuf_block *blk = wpabuf_get_block(buf);
+
+	if (len > blk->capacity) {
+		if (blk->cls == WPABUF_CLASS_HEAP) {
+			blk = os_realloc(blk, sizeof(*blk) + sizeof(*buf) +
+					 len);
+			if (blk == NULL)
+				return -1;
+			wpabuf_stats.heap_allocs++;
+			blk->capacity = len;
+			buf = (struct wpabuf *) (blk + 1);
+		} else {
+			nbuf = wpabuf_block_alloc(len);
+			if (nbuf == NULL)
+				return -1;
+			os_memcpy(nbuf + 1, buf + 1, buf->used);
+			nbuf->used = buf->used;
+			wpabuf_block_free(buf);
+			buf = nbuf;
+		}
+	}
+
+	os_memset((u8 *) (buf + 1) + buf->used, 0, len - buf->used);
+	*_buf = buf;
+	return 0;
+}
+#endif /* CONFIG_WPABUF_POOL */
+
+
 static void wpabuf_overflow(const struct wpabuf *buf, size_t len)
 {
 #ifdef WPA_TRACE
@@ -101,6 +284,9 @@ int wpabuf_resize(struct wpabuf **_buf, size_t add_len)
 			os_memset(nbuf + sizeof(struct wpabuf_trace) +
 				  sizeof(struct wpabuf) + buf->used, 0,
 				  add_len);
+#elif defined(CONFIG_WPABUF_POOL)
+			if (wpabuf_block_grow(&buf, buf->used + add_len) < 0)
+				return -1;
 #else /* WPA_TRACE */
 			nbuf = os_realloc(buf, sizeof(struct wpabuf) +
 					  buf->used + add_len);
@@ -134,6 +320,10 @@ struct wpabuf * wpabuf_alloc(size_t len)
 		return NULL;
 	trace->magic = WPABUF_MAGIC;
 	buf = (struct wpabuf *) (trace + 1);
+#elif defined(CONFIG_WPABUF_POOL)
+	struct wpabuf *buf = wpabuf_block_alloc(len);
+	if (buf == NULL)
+		return NULL;
 #else /* WPA_TRACE */
 	struct wpabuf *buf = os_zalloc(sizeof(struct wpabuf) + len);
 	if (buf == NULL)
@@ -155,6 +345,10 @@ struct wpabuf * wpabuf_alloc_ext_data(u8 *data, size_t len)
 		return NULL;
 	trace->magic = WPABUF_MAGIC;
 	buf = (struct wpabuf *) (trace + 1);
+#elif defined(CONFIG_WPABUF_POOL)
+	struct wpabuf *buf = wpabuf_block_alloc(0);
+	if (buf == NULL)
+		return NULL;
 #else /* WPA_TRACE */
 	struct wpabuf *buf = os_zalloc(sizeof(struct wpabuf));
 	if (buf == NULL)
@@ -210,7 +404,11 @@ void wpabuf_free(struct wpabuf *buf)
 	if (buf == NULL)
 		return;
 	os_free(buf->ext_data);
+#ifdef CONFIG_WPABUF_POOL
+	wpabuf_block_free(buf);
+#else /* CONFIG_WPABUF_POOL */
 	os_free(buf);
+#endif /* CONFIG_WPABUF_POOL */
 #endif /* WPA_TRACE */
 }
 
@@ -311,3 +509,115 @@ void wpabuf_printf(struct wpabuf *buf, char *fmt, ...)
 		wpabuf_overflow(buf, res);
 	buf->used += res;
 }
+
+
+/**
+ * wpabuf_pool_enable - Enable or disable the free lists of the buffers
+ * @enabled: Whether freed buffers are kept for the next allocations
+ *
+ * Enabled by default with CONFIG_WPABUF_POOL. Meant to be set before the
+ * threads are started, e.g., to compare the pool with the heap.
+ */
+void wpabuf_pool_enable(int enabled)
+{
+#ifdef CONFIG_WPABUF_POOL
+	wpabuf_pool_enabled = enabled;
+#endif /* CONFIG_WPABUF_POOL */
+}
+
+
+/**
+ * wpabuf_pool_flush - Release the free buffers of the calling thread
+ *
+ * To be called by threads that exit, their free lists are lost otherwise.
+ */
+void wpabuf_pool_flush(void)
+{
+#ifdef CONFIG_WPABUF_POOL
+	struct wpabuf_block *blk;
+	unsigned int cls;
+
+	for (cls = 0; cls < WPABUF_POOL_CLASSES; cls++) {
+		while ((blk = wpabuf_pool[cls]) != NULL) {
+			wpabuf_pool[cls] = blk->next;
+			os_free(blk);
+		}
+		wpabuf_pool_count[cls] = 0;
+	}
+#endif /* CONFIG_WPABUF_POOL */
+}
+
+
+/**
+ * wpabuf_pool_get_stats - Get the allocation counters of the calling thread
+ * @stats: Buffer for the counters
+ */
+void wpabuf_pool_get_stats(struct wpabuf_pool_stats *stats)
+{
+#ifdef CONFIG_WPABUF_POOL
+	*stats = wpabuf_stats;
+#else /* CONFIG_WPABUF_POOL */
+	os_memset(stats, 0, sizeof(*stats));
+#endif /* CONFIG_WPABUF_POOL */
+}
+
+
+/**
+ * wpabuf_arena_new - Allocate an arena for the buffers of a session
+ * Returns: Arena for wpabuf_arena_set(), %NULL on failure or without
+ * CONFIG_WPABUF_POOL (the buffers are then taken from the heap)
+ */
+struct wpabuf_arena * wpabuf_arena_new(void)
+{
+#ifdef CONFIG_WPABUF_POOL
+	return os_zalloc(sizeof(struct wpabuf_arena));
+#else /* CONFIG_WPABUF_POOL */
+	return NULL;
+#endif /* CONFIG_WPABUF_POOL */
+}
+
+
+/**
+ * wpabuf_arena_free - Free an arena and all the buffers taken from it
+ * @arena: Arena from wpabuf_arena_new() or %NULL
+ *
+ * None of its buffers can be used afterwards, wpabuf_free() included.
+ */
+void wpabuf_arena_free(struct wpabuf_arena *arena)
+{
+#ifdef CONFIG_WPABUF_POOL
+	struct wpabuf_arena_chunk *chunk;
+
+	if (arena == NULL)
+		return;
+	if (wpabuf_pool_arena == arena)
+		wpabuf_pool_arena = NULL;
+	while ((chunk = arena->chunks) != NULL) {
+		arena->chunks = chunk->next;
+		os_free(chunk);
+	}
+	os_free(arena);
+#endif /* CONFIG_WPABUF_POOL */
+}
+
+
+/**
+ * wpabuf_arena_set - Take the buffers of the calling thread from an arena
+ * @arena: Arena from wpabuf_arena_new(), %NULL for the free lists and heap
+ * Returns: The previous arena of the thread, to be set back afterwards
+ *
+ * The buffers allocated (or moved by wpabuf_resize()) until the arena is
+ * unset are released by wpabuf_arena_free(), wpabuf_free() does nothing with
+ * them. Whatever is allocated while it is set must not outlive it.
+ */
+struct wpabuf_arena * wpabuf_arena_set(struct wpabuf_arena *arena)
+{
+#ifdef CONFIG_WPABUF_POOL
+	struct wpabuf_arena *prev = wpabuf_pool_arena;
+
+	wpabuf_pool_arena = arena;
+	return prev;
+#else /* CONFIG_WPABUF_POOL */
+	return NULL;
+#endif /* CONFIG_WPABUF_POOL */
+}
@@ -29,6 +29,25 @@ struct wpabuf {
 	/* optionally followed by the allocated buffer */
 };
 
+struct wpabuf_arena;
+
+/**
+ * struct wpabuf_pool_stats - Allocation counters of the calling thread
+ *
+ * Only counted with CONFIG_WPABUF_POOL.
+ */
+struct wpabuf_pool_stats {
+	/* wpabufs allocated (resizes that moved the data included) and freed */
+	unsigned long allocs;
+	unsigned long frees;
+	/* allocations served by the free lists of the thread */
+	unsigned long pool_hits;
+	/* allocations served by the arena of the thread */
+	unsigned long arena_allocs;
+	/* calls to os_malloc()/os_realloc(), arena chunks included */
+	unsigned long heap_allocs;
+};
+
 
 int wpabuf_resize(struct wpabuf **buf, size_t add_len);
 struct wpabuf * wpabuf_alloc(size_t len);
@@ -41,6 +60,13 @@ struct wpabuf * wpabuf_concat(struct wpabuf *a, struct wpabuf *b);
 struct wpabuf * wpabuf_zeropad(struct wpabuf *buf, size_t len);
 void wpabuf_printf(struct wpabuf *buf, char *fmt, ...) PRINTF_FORMAT(2, 3);
 
+void wpabuf_pool_enable(int enabled);
+void wpabuf_pool_flush(void);
+void wpabuf_pool_get_stats(struct wpabuf_pool_stats *stats);
+struct wpabuf_arena * wpabuf_arena_new(void);
+void wpabuf_arena_free(struct wpabuf_arena *arena);
+struct wpabuf_arena * wpabuf_arena_set(struct wpabuf_arena *arena);
+
 
 /**
  * wpabuf_size - Get the currently allocated size of a wpabuf buffer
@@ -0,0 +1 @@
+../../../coap-eap-controller/src/coap_eap_cbor.c
\ No newline at end of file
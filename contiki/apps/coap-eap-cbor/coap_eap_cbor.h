@@ -0,0 +1 @@
+../../../coap-eap-controller/src/coap_eap_cbor.h
\ No newline at end of file
@@ -43,6 +43,7 @@
 #include "contiki-net.h"
 
 #include "eap-peer.h"
+#include "coap_eap_cbor.h"
 
 /* Initial resource /hateoas_initial_resource. When called, it will be "overwritten" and a new random Resource will be created. */
 #define REST_RES_HATEOAS 1
@@ -145,6 +146,34 @@ int skipFirstHandlerCall = 0;
 
 RESOURCE(hateoas, METHOD_POST, urlString, "title=\"HATEOAS dynamic resource\";rt=\"Debug\"");
 
+// Cipher suite preferred by the device, taken if the controller offers it.
+#define PREFERRED_CIPHER_SUITE 0
+
+// The controller offers its cipher suites after the EAP request of the first POST,
+// the CBOR is parsed in place. If it does not offer ours, its first one is taken.
+static uint8_t choose_cipher_suite(const uint8_t *payload, int length) {
+  struct coap_eap_cbor offer;
+  uint16_t eapLength;
+  uint8_t i;
+
+  if(length < 4) {
+    return PREFERRED_CIPHER_SUITE;
+  }
+  eapLength = ntohs(((struct eap_msg*) payload)->length);
+  if(eapLength >= length ||
+     coap_eap_cbor_decode(&coap_eap_cbor_request, payload + eapLength, length - eapLength, &offer) < 0 ||
+     !(offer.present & COAP_EAP_CBOR_CIPHER_SUITES) || offer.n_cipher_suites == 0) {
+    return PREFERRED_CIPHER_SUITE;
+  }
+
+  for(i = 0; i < offer.n_cipher_suites; i++) {
+    if(offer.cipher_suites[i] == PREFERRED_CIPHER_SUITE) {
+      return PREFERRED_CIPHER_SUITE;
+    }
+  }
+  return offer.cipher_suites[0];
+}
+
 void hateoas_handler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset) {
   printf("\n");
   printf("hateoas_handler_counter = %d\n", hateoas_handler_counter);
@@ -208,14 +237,24 @@ void hateoas_handler(void *request, void *response, uint8_t *buffer, uint16_t pr
               // sending the ciphersuites to the coap controller, only done once!
 
               char tempPayload[100] = {0};
-              static char cborcryptosuite[2] = {0x81,0x00};
+              struct coap_eap_cbor choice;
+              int cborLength;
+
+              memset(&choice, 0, sizeof(choice));
+              choice.present = COAP_EAP_CBOR_CIPHER_SUITES;
+              choice.n_cipher_suites = 1;
+              choice.cipher_suites[0] = choose_cipher_suite(payloadData, payloadLength);
 
+              // the cipher suite chosen is written right after the EAP response
               memcpy(tempPayload, eapRespData, len);
-              tempPayload[len]=cborcryptosuite[0];
-              tempPayload[len+1]=cborcryptosuite[1];
+              cborLength = coap_eap_cbor_encode(&coap_eap_cbor_response, &choice,
+                                                (uint8_t *) tempPayload + len, sizeof(tempPayload) - len);
+              if(cborLength < 0) {
+                cborLength = 0;
+              }
               
               // 3rd parameter in set_reponse_payload is size_t length. Is the datatype size_t is unsigned integral type. It represents the size of any object in bytes and returned by sizeof operator. It is used for array indexing and counting. It can never be negative. The return type of strcspn, strlen functions is size_t.
-              REST.set_response_payload(response, tempPayload, len+2);
+              REST.set_response_payload(response, tempPayload, len+cborLength);
 
               // see erbium.h in struct rest_implementation_status for the codes
               REST.set_response_status(response, REST.status.CREATED);
@@ -229,7 +268,7 @@ void hateoas_handler(void *request, void *response, uint8_t *buffer, uint16_t pr
               counterCryptoSuite++;
 
               printf("eapResponse Data + Ciphersuites: ");
-              printf_hex(tempPayload, len+2);
+              printf_hex(tempPayload, len+cborLength);
         }
     } 
 